@@ -0,0 +1,39 @@
+// Decode binary logs written by BLOG, or the ring buffer of level logs, to text.
+//   blog logs/blog/xx_blog.log > xx.txt
+//   blog logs/xx.ring > xx.txt
+#include <stdio.h>
+
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/log.h"
+
+int main(int argc, char** argv) {
+    auto v = flag::parse(argc, argv);
+    if (v.empty()) {
+        printf("usage:\n\tblog xx_blog.log\n\tblog a_blog.log b_blog.log\n\tblog xx.ring\n");
+        return 0;
+    }
+
+    int r = 0;
+    fastream s(1 << 20);
+    for (size_t i = 0; i < v.size(); ++i) {
+        fs::file f(v[i].c_str(), 'r');
+        if (!f) {
+            fprintf(stderr, "can't open the file: %s\n", v[i].c_str());
+            r = 1;
+            continue;
+        }
+
+        const fastring data = f.read(f.size());
+        s.clear();
+        const bool ring = data.starts_with("co_ring");
+        const bool ok = ring ? log::decode_ring(data.data(), data.size(), s)
+                             : log::decode_binary(data.data(), data.size(), s);
+        fwrite(s.data(), 1, s.size(), stdout);
+        if (!ok) {
+            fprintf(stderr, "%s: truncated or corrupted\n", v[i].c_str());
+            r = 1;
+        }
+    }
+    return r;
+}
@@ -96,7 +96,7 @@ void decode_array(fs::fstream& fs, Array* a, const fastring& name, const fastrin
     fastring ua = unamed_var();
     fastring uo = unamed_var();
     fs << indent(n) << "auto& " << ua << " = " << js << ";\n"
-       << indent(n) << "for (uint32 i = 0; i < " << ua << ".array_size(); ++i) {\n";
+       << indent(n) << "for (uint32_t i = 0; i < " << ua << ".array_size(); ++i) {\n";
 
     switch (et->type()) {
         case type_string:
@@ -166,6 +166,358 @@ void encode_array(fs::fstream& fs, Array* a, const fastring& name, const fastrin
     fs << indent(n) << "}\n";
 }
 
+void pack_array(fs::fstream& fs, Array* a, const fastring& name, int n) {
+    Type* et = a->element_type();
+    fastring ui = unamed_var();
+    fs << indent(n) << "json::mp::pack_array(_s_, (uint32_t)" << name << ".size());\n"
+       << indent(n) << "for (size_t " << ui << " = 0; " << ui << " < " << name << ".size(); ++"
+       << ui << ") {\n";
+
+    switch (et->type()) {
+        case type_string:
+        case type_bool:
+        case type_int:
+        case type_int32:
+        case type_int64:
+        case type_uint32:
+        case type_uint64:
+        case type_double:
+            fs << indent(n + 4) << "json::mp::pack(_s_, " << name << "[" << ui << "]);\n";
+            break;
+        case type_object:
+            fs << indent(n + 4) << name << "[" << ui << "].pack(_s_);\n";
+            break;
+        case type_array: {
+            fastring ua = unamed_var();
+            fs << indent(n + 4) << "const auto& " << ua << " = " << name << "[" << ui << "];\n";
+            pack_array(fs, (Array*)et, ua, n + 4);
+        } break;
+        default:
+            break;
+    }
+
+    fs << indent(n) << "}\n";
+}
+
+// read an array with json::mp::Reader, or json::Reader if @js is true
+void unpack_array(fs::fstream& fs, Array* a, const fastring& name, int n, bool js = false) {
+    Type* et = a->element_type();
+    if (js) {
+        fastring ut = unamed_var();
+        fs << indent(n) << "if (!_r_.begin_array()) return false;\n"
+           << indent(n) << name << ".clear();\n"
+           << indent(n) << "for (int " << ut << "; (" << ut << " = _r_.next()) != 0;) {\n"
+           << indent(n + 4) << "if (" << ut << " < 0) return false;\n";
+    } else {
+        fastring un = unamed_var();
+        fastring ui = unamed_var();
+        fs << indent(n) << "uint32_t " << un << ";\n"
+           << indent(n) << "if (!_r_.read_array(" << un << ")) return false;\n"
+           << indent(n) << name << ".clear();\n"
+           << indent(n) << "for (uint32_t " << ui << " = 0; " << ui << " < " << un << "; ++"
+           << ui << ") {\n";
+    }
+
+    switch (et->type()) {
+        case type_bool:
+        case type_int:
+        case type_int32:
+        case type_int64:
+        case type_uint32:
+        case type_uint64:
+        case type_double: {
+            fastring uv = unamed_var();
+            fs << indent(n + 4) << et->name() << ' ' << uv << ";\n"
+               << indent(n + 4) << "if (!_r_.read(" << uv << ")) return false;\n"
+               << indent(n + 4) << name << ".push_back(" << uv << ");\n";
+        } break;
+        case type_string:
+            fs << indent(n + 4) << name << ".emplace_back();\n"
+               << indent(n + 4) << "if (!_r_.read(" << name << ".back())) return false;\n";
+            break;
+        case type_object:
+            fs << indent(n + 4) << name << ".emplace_back();\n"
+               << indent(n + 4) << "if (!" << name << ".back()." << (js ? "read_json" : "unpack")
+               << "(_r_)) return false;\n";
+            break;
+        case type_array: {
+            fastring ua = unamed_var();
+            fs << indent(n + 4) << name << ".emplace_back();\n"
+               << indent(n + 4) << "auto& " << ua << " = " << name << ".back();\n";
+            unpack_array(fs, (Array*)et, ua, n + 4, js);
+        } break;
+        default:
+            break;
+    }
+
+    fs << indent(n) << "}\n";
+}
+
+void write_array(fs::fstream& fs, Array* a, const fastring& name, int n) {
+    Type* et = a->element_type();
+    fastring ui = unamed_var();
+    fs << indent(n) << "_w_.begin_array();\n"
+       << indent(n) << "for (size_t " << ui << " = 0; " << ui << " < " << name << ".size(); ++"
+       << ui << ") {\n";
+
+    switch (et->type()) {
+        case type_string:
+        case type_bool:
+        case type_int:
+        case type_int32:
+        case type_int64:
+        case type_uint32:
+        case type_uint64:
+        case type_double:
+            fs << indent(n + 4) << "_w_.value(" << name << "[" << ui << "]);\n";
+            break;
+        case type_object:
+            fs << indent(n + 4) << name << "[" << ui << "].write_json(_w_);\n";
+            break;
+        case type_array: {
+            fastring ua = unamed_var();
+            fs << indent(n + 4) << "const auto& " << ua << " = " << name << "[" << ui << "];\n";
+            write_array(fs, (Array*)et, ua, n + 4);
+        } break;
+        default:
+            break;
+    }
+
+    fs << indent(n) << "}\n";
+    fs << indent(n) << "_w_.end_array();\n";
+}
+
+inline uint32_t fnv1a(const fastring& s, uint32_t h) {
+    for (size_t i = 0; i < s.size(); ++i) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+// Find a perfect hash of the field names: FNV-1a starting from @seed, masked by
+// @mask, maps the names to different slots. The table grows if no seed is found.
+void perfect_hash(const co::vector<Field*>& fields, uint32_t& seed, uint32_t& mask) {
+    uint32_t size = 4;
+    while (size < (fields.size() << 1)) size <<= 1;
+    for (;; size <<= 1) {
+        co::vector<char> used(size);
+        used.resize(size);
+        for (seed = 1; seed <= 4096; ++seed) {
+            memset(used.data(), 0, size);
+            size_t i = 0;
+            for (; i < fields.size(); ++i) {
+                char& x = used[fnv1a(fields[i]->name(), seed) & (size - 1)];
+                if (x) break;
+                x = 1;
+            }
+            if (i == fields.size()) {
+                mask = size - 1;
+                return;
+            }
+        }
+    }
+}
+
+// Dispatch on the key (_k_, _l_) read, with a perfect hash of the field names
+// computed here, and a single memcmp for the slot. @read generates the code that
+// reads the value of a field, the generated code continues the loop after it.
+void gen_dispatch(fs::fstream& fs, const co::vector<Field*>& fields, int n,
+                  const std::function<void(Field*, int)>& read) {
+    if (fields.empty()) return;
+    uint32_t seed, mask;
+    perfect_hash(fields, seed, mask);
+    co::map<uint32_t, Field*> slots;
+    for (auto& f : fields) slots[fnv1a(f->name(), seed) & mask] = f;
+
+    fs << indent(n) << "uint32_t _h_ = " << seed << "u;\n"
+       << indent(n) << "for (uint32_t _j_ = 0; _j_ < _l_; ++_j_) {\n"
+       << indent(n + 4) << "_h_ = (_h_ ^ (uint8_t)_k_[_j_]) * 16777619u;\n"
+       << indent(n) << "}\n"
+       << indent(n) << "switch (_h_ & " << mask << ") {\n";
+    for (auto& x : slots) {
+        const fastring& name = x.second->name();
+        fs << indent(n + 4) << "case " << x.first << ":\n"
+           << indent(n + 8) << "if (_l_ == " << name.size() << " && memcmp(_k_, \"" << name
+           << "\", " << name.size() << ") == 0) {\n";
+        read(x.second, n + 12);
+        fs << indent(n + 12) << "continue;\n" << indent(n + 8) << "}\n" << indent(n + 8)
+           << "break;\n";
+    }
+    fs << indent(n) << "}\n";
+}
+
+// read the value of field @f with _r_, a json::mp::Reader or json::Reader (@js)
+void read_field(fs::fstream& fs, Field* f, int n, bool js) {
+    Type* t = f->type();
+    const fastring& name = f->name();
+    switch (t->type()) {
+        case type_string:
+        case type_bool:
+        case type_int:
+        case type_int32:
+        case type_int64:
+        case type_uint32:
+        case type_uint64:
+        case type_double:
+            fs << indent(n) << "if (!_r_.read(" << name << ")) return false;\n";
+            break;
+        case type_object:
+            fs << indent(n) << "if (!" << name << "." << (js ? "read_json" : "unpack")
+               << "(_r_)) return false;\n";
+            break;
+        case type_array:
+            g_uv = 0;
+            fs << indent(n) << "do {\n";
+            unpack_array(fs, (Array*)t, name, n + 4, js);
+            fs << indent(n) << "} while (0);\n";
+            break;
+        default:
+            break;
+    }
+}
+
+// pack()/unpack() work on MessagePack data directly, without building a Json.
+void gen_pack(fs::fstream& fs, Object* o, int n) {
+    const auto& fields = o->fields();
+
+    // method pack(fastream&)
+    fs << indent(n + 4) << "void pack(fastream& _s_) const {\n";
+    fs << indent(n + 8) << "json::mp::pack_map(_s_, " << fields.size() << ");\n";
+    for (auto& f : fields) {
+        Type* t = f->type();
+        const fastring& name = f->name();
+        fs << indent(n + 8) << "json::mp::pack_str(_s_, \"" << name << "\", " << name.size()
+           << ");\n";
+
+        switch (t->type()) {
+            case type_string:
+            case type_bool:
+            case type_int:
+            case type_int32:
+            case type_int64:
+            case type_uint32:
+            case type_uint64:
+            case type_double:
+                fs << indent(n + 8) << "json::mp::pack(_s_, " << name << ");\n";
+                break;
+            case type_object:
+                fs << indent(n + 8) << name << ".pack(_s_);\n";
+                break;
+            case type_array:
+                g_uv = 0;
+                fs << indent(n + 8) << "do {\n";
+                pack_array(fs, (Array*)t, name, n + 12);
+                fs << indent(n + 8) << "} while (0);\n";
+                break;
+            default:
+                break;
+        }
+    }
+    fs << indent(n + 4) << "}\n\n";
+
+    // method pack()
+    fs << indent(n + 4) << "fastring pack() const {\n"
+       << indent(n + 8) << "fastring _s_(256);\n"
+       << indent(n + 8) << "this->pack((fastream&)_s_);\n"
+       << indent(n + 8) << "return _s_;\n"
+       << indent(n + 4) << "}\n\n";
+
+    // method unpack(json::mp::Reader&)
+    fs << indent(n + 4) << "bool unpack(json::mp::Reader& _r_) {\n";
+    fs << indent(n + 8) << "uint32_t _n_, _l_;\n"
+       << indent(n + 8) << "const char* _k_;\n"
+       << indent(n + 8) << "*this = " << o->name() << "();\n"
+       << indent(n + 8) << "if (!_r_.read_map(_n_)) return false;\n"
+       << indent(n + 8) << "for (uint32_t _i_ = 0; _i_ < _n_; ++_i_) {\n"
+       << indent(n + 12) << "if (!_r_.read_str(_k_, _l_)) return false;\n";
+    gen_dispatch(fs, fields, n + 12, [&fs](Field* f, int k) { read_field(fs, f, k, false); });
+    fs << indent(n + 12) << "if (!_r_.skip()) return false;  // unknown field\n"
+       << indent(n + 8) << "}\n"
+       << indent(n + 8) << "return true;\n"
+       << indent(n + 4) << "}\n\n";
+
+    // method unpack_from(const void*, size_t)
+    fs << indent(n + 4) << "bool unpack_from(const void* _p_, size_t _n_) {\n"
+       << indent(n + 8) << "json::mp::Reader _r_(_p_, _n_);\n"
+       << indent(n + 8) << "return this->unpack(_r_) && _r_.done();\n"
+       << indent(n + 4) << "}\n";
+}
+
+// write_json()/read_json() work on json text directly, without building a Json.
+void gen_json(fs::fstream& fs, Object* o, int n) {
+    const auto& fields = o->fields();
+
+    // method write_json(json::Writer&)
+    fs << indent(n + 4) << "void write_json(json::Writer& _w_) const {\n";
+    fs << indent(n + 8) << "_w_.begin_object();\n";
+    for (auto& f : fields) {
+        Type* t = f->type();
+        const fastring& name = f->name();
+        fs << indent(n + 8) << "_w_.key(\"" << name << "\", " << name.size() << ");\n";
+
+        switch (t->type()) {
+            case type_string:
+            case type_bool:
+            case type_int:
+            case type_int32:
+            case type_int64:
+            case type_uint32:
+            case type_uint64:
+            case type_double:
+                fs << indent(n + 8) << "_w_.value(" << name << ");\n";
+                break;
+            case type_object:
+                fs << indent(n + 8) << name << ".write_json(_w_);\n";
+                break;
+            case type_array:
+                g_uv = 0;
+                fs << indent(n + 8) << "do {\n";
+                write_array(fs, (Array*)t, name, n + 12);
+                fs << indent(n + 8) << "} while (0);\n";
+                break;
+            default:
+                break;
+        }
+    }
+    fs << indent(n + 8) << "_w_.end_object();\n";
+    fs << indent(n + 4) << "}\n\n";
+
+    // method str()
+    fs << indent(n + 4) << "fastring str() const {\n"
+       << indent(n + 8) << "fastring _s_(256);\n"
+       << indent(n + 8) << "json::Writer _w_(_s_);\n"
+       << indent(n + 8) << "this->write_json(_w_);\n"
+       << indent(n + 8) << "return _s_;\n"
+       << indent(n + 4) << "}\n\n";
+
+    // method read_json(json::Reader&)
+    fs << indent(n + 4) << "bool read_json(json::Reader& _r_) {\n";
+    fs << indent(n + 8) << "uint32_t _l_;\n"
+       << indent(n + 8) << "const char* _k_;\n"
+       << indent(n + 8) << "int _t_;\n"
+       << indent(n + 8) << "*this = " << o->name() << "();\n"
+       << indent(n + 8) << "if (!_r_.begin_object()) return false;\n"
+       << indent(n + 8) << "while ((_t_ = _r_.next_key(_k_, _l_)) > 0) {\n";
+    gen_dispatch(fs, fields, n + 12, [&fs](Field* f, int k) { read_field(fs, f, k, true); });
+    fs << indent(n + 12) << "if (!_r_.skip()) return false;  // unknown field\n"
+       << indent(n + 8) << "}\n"
+       << indent(n + 8) << "return _t_ == 0;\n"
+       << indent(n + 4) << "}\n\n";
+
+    // method parse_from(const char*, size_t)
+    fs << indent(n + 4) << "bool parse_from(const char* _p_, size_t _n_) {\n"
+       << indent(n + 8) << "json::Reader _r_(_p_, _n_);\n"
+       << indent(n + 8) << "return this->read_json(_r_) && _r_.done();\n"
+       << indent(n + 4) << "}\n\n"
+       << indent(n + 4) << "bool parse_from(const char* _s_) {\n"
+       << indent(n + 8) << "return this->parse_from(_s_, strlen(_s_));\n"
+       << indent(n + 4) << "}\n\n"
+       << indent(n + 4) << "bool parse_from(const fastring& _s_) {\n"
+       << indent(n + 8) << "return this->parse_from(_s_.data(), _s_.size());\n"
+       << indent(n + 4) << "}\n\n"
+       << indent(n + 4) << "bool parse_from(const std::string& _s_) {\n"
+       << indent(n + 8) << "return this->parse_from(_s_.data(), _s_.size());\n"
+       << indent(n + 4) << "}\n";
+}
+
 void gen_object(fs::fstream& fs, Object* o, int n = 0) {
     fs << indent(n) << "struct " << o->name() << " {\n";
     const auto& aos = o->anony_objects();
@@ -266,7 +618,11 @@ void gen_object(fs::fstream& fs, Object* o, int n = 0) {
         }
     }
     fs << indent(n + 8) << "return _x_;\n";
-    fs << indent(n + 4) << "}\n";
+    fs << indent(n + 4) << "}\n\n";
+
+    gen_pack(fs, o, n);
+    fs << '\n';
+    gen_json(fs, o, n);
 
     fs << indent(n) << "};\n\n";
 }
@@ -687,7 +687,7 @@ case 26:
 #line 204 "geny.yy"
 	{
         yyval.ttype = new Type();
-        yyval.ttype->set_name("int32");
+        yyval.ttype->set_name("int32_t");
         yyval.ttype->set_type(type_int32);
     }
 break;
@@ -695,7 +695,7 @@ case 27:
 #line 210 "geny.yy"
 	{
         yyval.ttype = new Type();
-        yyval.ttype->set_name("int64");
+        yyval.ttype->set_name("int64_t");
         yyval.ttype->set_type(type_int64);
     }
 break;
@@ -703,7 +703,7 @@ case 28:
 #line 216 "geny.yy"
 	{
         yyval.ttype = new Type();
-        yyval.ttype->set_name("uint32");
+        yyval.ttype->set_name("uint32_t");
         yyval.ttype->set_type(type_uint32);
     }
 break;
@@ -711,7 +711,7 @@ case 29:
 #line 222 "geny.yy"
 	{
         yyval.ttype = new Type();
-        yyval.ttype->set_name("uint64");
+        yyval.ttype->set_name("uint64_t");
         yyval.ttype->set_type(type_uint64);
     }
 break;
@@ -203,25 +203,25 @@ BaseType:
   | tok_int32
     {
         $$ = new Type();
-        $$->set_name("int32");
+        $$->set_name("int32_t");
         $$->set_type(type_int32);
     }
   | tok_int64
     {
         $$ = new Type();
-        $$->set_name("int64");
+        $$->set_name("int64_t");
         $$->set_type(type_int64);
     }
   | tok_uint32
     {
         $$ = new Type();
-        $$->set_name("uint32");
+        $$->set_name("uint32_t");
         $$->set_type(type_uint32);
     }
   | tok_uint64
     {
         $$ = new Type();
-        $$->set_name("uint64");
+        $$->set_name("uint64_t");
         $$->set_type(type_uint64);
     }
   | tok_double
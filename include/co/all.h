@@ -1,5 +1,6 @@
 #pragma once
 
+#include "buf_chain.h"
 #include "byte_order.h"
 #include "closure.h"
 #include "co.h"
@@ -13,14 +14,20 @@
 #include "fs.h"
 #include "god.h"
 #include "hash.h"
+#include "intern.h"
 #include "json.h"
 #include "log.h"
+#include "mem.h"
+#include "metrics.h"
 #include "os.h"
 #include "path.h"
 #include "print.h"
 #include "rand.h"
+#include "small_string.h"
+#include "small_vector.h"
 #include "so.h"
 #include "stl.h"
 #include "str.h"
+#include "strview.h"
 #include "tasked.h"
 #include "time.h"
@@ -1,34 +1,85 @@
 #pragma once
 
+#include <functional>
 #include <vector>
 
 #include "co/time.h"
 
 namespace bm {
 
-__coapi void run_benchmarks();
+// run all benchmarks and print the results, ns/iter is the median of the
+// samples, +- is the relative standard deviation with outliers rejected ('*'
+// is appended if there are any), flags:
+//   - bm_samples    number of samples of each benchmark, 20 by default
+//   - bm_min_ms     min time in ms to run each benchmark, 200 by default
+//   - bm_warmup_ms  time in ms to warm up each benchmark, 50 by default
+//   - bm_out        write results to a file, CSV if it ends with .csv, or JSON
+//   - bm_baseline   compare with a JSON file written by bm_out before
+//   - bm_threshold  percent of slowdown seen as a regression, 5 by default
+//   - bm_perf       count cycles, instructions, cache misses and branch misses
+//                   per iteration on linux, true by default. Columns are shown
+//                   only if the counters are available (perf_event_paranoid
+//                   and the VM permitting), single-threaded benchmarks only.
+//
+// A benchmark regressed if its median is slower than that in the baseline by
+// more than bm_threshold percent, and by more than twice the stddev of either
+// run, so that noise is not reported.
+//   - return number of the benchmarks regressed.
+__coapi int run_benchmarks();
 
 namespace xx {
 
+// statistics of the samples of a benchmark, in ns per iteration
 struct Result {
-    Result(const char* bm, double ns) noexcept : bm(bm), ns(ns) {}
+    Result(const char* bm) noexcept
+        : bm(bm), ns(0), mean(0), stddev(0), p99(0), samples(0), outliers(0), threads(1),
+          latency(0), cycles(-1), instructions(-1), cache_misses(-1), branch_misses(-1),
+          base(0), base_stddev(0), regressed(false) {}
     const char* bm;
-    double ns;
+    double ns;      // median
+    double mean;    // mean of the samples, outliers excluded
+    double stddev;  // standard deviation of the samples, outliers excluded
+    double p99;     // 99th percentile of the samples
+    int samples;
+    int outliers;   // samples rejected as outliers
+    int threads;    // number of threads or coroutines running at the same time
+    double latency; // median time of one iteration in each thread, ns * threads
+    // hardware counters per iteration, -1 if not available (see bm_perf)
+    double cycles;
+    double instructions;
+    double cache_misses;
+    double branch_misses;
+    double base;         // median in the baseline, 0 if not found
+    double base_stddev;  // stddev in the baseline
+    bool regressed;      // slower than the baseline
 };
 
 struct Group {
-    Group(const char* name, void (*f)(Group&)) noexcept : name(name), f(f) {}
+    Group(const char* name, void (*f)(Group&)) noexcept : name(name), bm(0), threads(1), f(f) {}
     const char* name;
     const char* bm;
+    int threads;
     void (*f)(Group&);
-    int iters;
-    int64_t ns;
-    co::Timer timer;
     std::vector<Result> res;
 };
 
+// Run a benchmark and add the result to @g.
+//   - @f runs the benchmark @n times.
+//   - It is warmed up first (also for the CPU to reach a stable frequency),
+//     then run in bm_samples samples, taking at least bm_min_ms in total.
+//   - @iters  if > 0, run exactly 1 + iters times, once for warm-up and then
+//             one sample, instead.
+__coapi void run(Group& g, const std::function<void(int64_t)>& f, int64_t iters = 0);
+
+// Run a benchmark in @n threads, or @n coroutines on all the schedulers if
+// @in_co is true, at the same time, and add the result to @g.
+//   - @f(k) runs k iterations of the benchmark, it is called in all the threads
+//     at once.
+//   - A sample is the wall time of all the threads, the ns/iter is that divided
+//     by the total iterations, which is the aggregate throughput.
+__coapi void run_parallel(Group& g, int n, bool in_co, const std::function<void(int64_t)>& f);
+
 __coapi bool add_group(const char* name, void (*f)(Group&));
-__coapi int calc_iters(int64_t ns);
 __coapi void use(void* p, int n);
 
 }  // namespace xx
@@ -44,42 +95,57 @@ __coapi void use(void* p, int n);
     _g_.bm = #_name_;  \
     _BM_add
 
-#define _BM_add(e)                                                           \
-    {                                                                        \
-        auto _f_ = [&]() { e; };                                             \
-        _g_.timer.restart();                                                 \
-        _f_();                                                               \
-        _g_.ns = _g_.timer.ns();                                             \
-        _g_.iters = bm::xx::calc_iters(_g_.ns);                              \
-        if (_g_.iters > 1) {                                                 \
-            _g_.timer.restart();                                             \
-            for (int _i_ = 0; _i_ < _g_.iters; ++_i_) {                      \
-                _f_();                                                       \
-            }                                                                \
-            _g_.ns = _g_.timer.ns();                                         \
-        }                                                                    \
-        _g_.res.push_back(bm::xx::Result(_g_.bm, _g_.ns * 1.0 / _g_.iters)); \
+#define _BM_add(e)                                                       \
+    {                                                                    \
+        auto _f_ = [&]() { e; };                                         \
+        bm::xx::run(_g_, [&](int64_t _n_) {                              \
+            for (int64_t _i_ = 0; _i_ < _n_; ++_i_) _f_();               \
+        });                                                              \
     }
 
+// add a benchmark that runs exactly 1 + 10000 iterations
 #define BM_add1w(_name_) \
     _g_.bm = #_name_;    \
     _BM_add1w
 
-#define _BM_add1w(e)                                                         \
-    {                                                                        \
-        auto _f_ = [&]() { e; };                                             \
-        _g_.timer.restart();                                                 \
-        _f_();                                                               \
-        _g_.ns = _g_.timer.ns();                                             \
-        _g_.iters = 10000; /*bm::xx::calc_iters(_g_.ns);*/                   \
-        if (_g_.iters > 1) {                                                 \
-            _g_.timer.restart();                                             \
-            for (int _i_ = 0; _i_ < _g_.iters; ++_i_) {                      \
-                _f_();                                                       \
-            }                                                                \
-            _g_.ns = _g_.timer.ns();                                         \
-        }                                                                    \
-        _g_.res.push_back(bm::xx::Result(_g_.bm, _g_.ns * 1.0 / _g_.iters)); \
+#define _BM_add1w(e)                                                     \
+    {                                                                    \
+        auto _f_ = [&]() { e; };                                         \
+        bm::xx::run(_g_, [&](int64_t _n_) {                              \
+            for (int64_t _i_ = 0; _i_ < _n_; ++_i_) _f_();               \
+        }, 10000);                                                       \
+    }
+
+// add a benchmark that runs in @_threads_ threads at the same time, the body MUST be
+// thread-safe, e.g.
+//   BM_add_parallel(mutex, 8)(std::lock_guard<std::mutex> g(m); ++x;);
+#define BM_add_parallel(_name_, _threads_) \
+    _g_.bm = #_name_;                      \
+    _g_.threads = (_threads_);             \
+    _BM_add_parallel
+
+#define _BM_add_parallel(e)                                              \
+    {                                                                    \
+        auto _f_ = [&]() { e; };                                         \
+        bm::xx::run_parallel(_g_, _g_.threads, false, [&](int64_t _n_) {       \
+            for (int64_t _i_ = 0; _i_ < _n_; ++_i_) _f_();               \
+        });                                                              \
+    }
+
+// add a benchmark that runs in @_threads_ coroutines at the same time, they are
+// spread over all the schedulers, e.g.
+//   BM_add_co(co::mutex, 64)(co::mutex_guard g(m); ++x;);
+#define BM_add_co(_name_, _threads_) \
+    _g_.bm = #_name_;                \
+    _g_.threads = (_threads_);       \
+    _BM_add_co
+
+#define _BM_add_co(e)                                                    \
+    {                                                                    \
+        auto _f_ = [&]() { e; };                                         \
+        bm::xx::run_parallel(_g_, _g_.threads, true, [&](int64_t _n_) {        \
+            for (int64_t _i_ = 0; _i_ < _n_; ++_i_) _f_();               \
+        });                                                              \
     }
 
 // tell the compiler do not optimize this away
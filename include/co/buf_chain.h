@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "./co/sock.h"
+#include "fastring.h"
+#include "strview.h"
+#include "vector.h"
+
+namespace co {
+
+// A buffer made of a chain of fixed-size blocks, for assembling large messages.
+//   - Data appended is copied into the last block, a new block is added when it
+//     is full. Data written before is never moved, unlike fastream, which copies
+//     everything on each realloc.
+//   - append_ref() adds a slice of the user's memory without copying it, the
+//     memory MUST be valid until the buffer is cleared or sent.
+//   - Blocks are taken from and returned to a small thread-local pool.
+//   - The segments are sent with writev() by co::sendv(fd, buf), or exported as
+//     an iovec array by iov(). str() copies all into a contiguous fastring.
+//
+//   co::buf_chain b;
+//   b << "HTTP/1.1 200 OK\r\n" << "Content-Length: " << body.size() << "\r\n\r\n";
+//   b.append_ref(body.data(), body.size());
+//   co::sendv(fd, b);
+class __coapi buf_chain {
+  public:
+    static const size_t kBlockSize = 16 * 1024;
+
+    constexpr buf_chain() noexcept : _h(0), _size(0), _w(0), _e(0) {}
+    ~buf_chain() { this->clear(); }
+
+    buf_chain(const buf_chain&) = delete;
+    void operator=(const buf_chain&) = delete;
+
+    buf_chain(buf_chain&& b) noexcept
+        : _segs(std::move(b._segs)), _h(b._h), _size(b._size), _w(b._w), _e(b._e) {
+        b._h = 0;
+        b._size = 0;
+        b._w = b._e = 0;
+    }
+
+    // total bytes of the data
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+
+    // number of segments
+    size_t segments() const noexcept { return _segs.size() - _h; }
+
+    // copy the data into blocks
+    buf_chain& append(const void* p, size_t n) {
+        if (_w && (size_t)(_e - _w) >= n) {
+            memcpy(_w, p, n);
+            _w += n;
+            _segs.back().size += n;
+            _size += n;
+            return *this;
+        }
+        return this->_append(p, n);
+    }
+
+    // refer to the user's memory, no copy, @p MUST outlive the data in the chain
+    buf_chain& append_ref(const void* p, size_t n);
+
+    buf_chain& append(co::strview s) { return this->append(s.data(), s.size()); }
+    buf_chain& append(char c) { return this->append(&c, 1); }
+
+    buf_chain& operator<<(co::strview s) { return this->append(s.data(), s.size()); }
+    buf_chain& operator<<(const char* s) { return this->append(s, strlen(s)); }
+    buf_chain& operator<<(char c) { return this->append(&c, 1); }
+
+    buf_chain& operator<<(int v) { return this->_append_int(v); }
+    buf_chain& operator<<(unsigned int v) { return this->_append_uint(v); }
+    buf_chain& operator<<(long v) { return this->_append_int(v); }
+    buf_chain& operator<<(unsigned long v) { return this->_append_uint(v); }
+    buf_chain& operator<<(long long v) { return this->_append_int(v); }
+    buf_chain& operator<<(unsigned long long v) { return this->_append_uint(v); }
+
+    buf_chain& operator<<(double v) {
+        char b[32];
+        return this->append(b, fast::dtoa(v, b, 6));
+    }
+
+    // remove @n bytes from the front, blocks consumed are returned to the pool
+    void consume(size_t n);
+
+    // remove all data, blocks are returned to the pool
+    void clear();
+
+    // fill @v with at most @n segments, starting from the @pos-th segment,
+    // return the number of segments filled.
+    size_t iov(struct iovec* v, size_t n, size_t pos = 0) const;
+
+    // copy the data to a contiguous buffer @p, which MUST hold size() bytes
+    void copy_to(void* p) const;
+
+    // copy the data to a contiguous fastring
+    fastring str() const {
+        fastring s(_size + 1);
+        this->copy_to(s.data());
+        s.resize(_size);
+        return s;
+    }
+
+  private:
+    struct seg_t {
+        char* p;      // beginning of the data
+        size_t size;  // bytes of the data
+        char* block;  // the block holding the data, null for the user's memory
+    };
+
+    buf_chain& _append(const void* p, size_t n);
+
+    // integers are written in place if there is enough room in the last block
+    template <typename V>
+    buf_chain& _append_int(V v) {
+        if (_w && _e - _w >= 24) {
+            const int n = fast::itoa(v, _w);
+            _w += n;
+            _segs.back().size += n;
+            _size += n;
+            return *this;
+        }
+        char b[24];
+        return this->append(b, fast::itoa(v, b));
+    }
+
+    template <typename V>
+    buf_chain& _append_uint(V v) {
+        if (_w && _e - _w >= 24) {
+            const int n = fast::utoa(v, _w);
+            _w += n;
+            _segs.back().size += n;
+            _size += n;
+            return *this;
+        }
+        char b[24];
+        return this->append(b, fast::utoa(v, b));
+    }
+
+    co::vector<seg_t> _segs;
+    size_t _h;  // index of the first segment
+    size_t _size;
+    char* _w;  // where to write in the last block, null if the last segment is not a block
+    char* _e;  // end of the last block
+};
+
+// send all the data of @b on a socket, and clear it on success
+//   - It MUST be called in a coroutine.
+//   - The segments are sent with writev(), up to 64 of them at a time.
+//   - return bytes sent on success, or -1 on error.
+__coapi int64_t sendv(sock_t fd, buf_chain& b, int ms = -1);
+
+}  // namespace co
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string.h>
+
+#include "def.h"
+
 #ifdef _WIN32
 #include <WinSock2.h>
 
@@ -85,3 +89,48 @@ inline uint64_t ntoh64(uint64_t v) {
 }
 
 #endif
+
+// Convert @n integers at @src between host and network byte order, the result is
+// stored in @dst, which may be the same as @src. Both may be unaligned.
+__coapi void hton_n(uint16_t* dst, const uint16_t* src, size_t n);
+__coapi void hton_n(uint32_t* dst, const uint32_t* src, size_t n);
+__coapi void hton_n(uint64_t* dst, const uint64_t* src, size_t n);
+
+inline void ntoh_n(uint16_t* dst, const uint16_t* src, size_t n) { hton_n(dst, src, n); }
+inline void ntoh_n(uint32_t* dst, const uint32_t* src, size_t n) { hton_n(dst, src, n); }
+inline void ntoh_n(uint64_t* dst, const uint64_t* src, size_t n) { hton_n(dst, src, n); }
+
+// load an integer in network byte order from @p, which may be unaligned
+inline uint16_t load_be16(const void* p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return ntoh16(v);
+}
+
+inline uint32_t load_be32(const void* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ntoh32(v);
+}
+
+inline uint64_t load_be64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return ntoh64(v);
+}
+
+// store an integer in network byte order to @p, which may be unaligned
+inline void store_be16(void* p, uint16_t v) {
+    v = hton16(v);
+    memcpy(p, &v, 2);
+}
+
+inline void store_be32(void* p, uint32_t v) {
+    v = hton32(v);
+    memcpy(p, &v, 4);
+}
+
+inline void store_be64(void* p, uint64_t v) {
+    v = hton64(v);
+    memcpy(p, &v, 8);
+}
@@ -15,6 +15,11 @@ class __coapi Closure {
     virtual ~Closure() = default;
     
     virtual void run() = 0;
+
+    // Closures are allocated from a thread-local cache of small blocks, so that
+    // creating and destroying a small closure usually needs no malloc/free.
+    static void* operator new(size_t n);
+    static void operator delete(void* p, size_t n) noexcept;
 };
 
 namespace xx {
@@ -1,10 +1,15 @@
 #pragma once
 
 #include "./co/chan.h"
+#include "./co/chan_mpmc.h"
 #include "./co/event.h"
+#include "./co/future.h"
 #include "./co/io_event.h"
 #include "./co/mutex.h"
+#include "./co/parallel.h"
 #include "./co/pool.h"
+#include "./co/semaphore.h"
+#include "./co/sharded_lru_map.h"
 #include "./co/sock.h"
 #include "./co/thread.h"
 #include "./co/wait_group.h"
@@ -103,6 +108,115 @@ inline void go(F&& f, T* t, P&& p) {
     go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
 }
 
+/**
+ * add a high-priority task, which will run as a coroutine
+ *   - It is thread-safe and can be called from anywhere.
+ *   - In each loop of a scheduler, high-priority coroutines are resumed before
+ *     normal ones, when they are created or ready to resume. At most co_hi_quota
+ *     of them are resumed ahead of normal ones, so normal ones are not starved.
+ *   - Coroutines resumed by I/O events or timers are not reordered.
+ *
+ * @param cb  a pointer to a Closure created by new_closure(), or an user-defined Closure.
+ */
+__coapi void go_hi(Closure* cb);
+
+/**
+ * add a high-priority task, see go_hi(Closure*) and go(F&&, ...) for details
+ */
+template <typename... X>
+inline void go_hi(X&&... x) {
+    go_hi(new_closure(std::forward<X>(x)...));
+}
+
+/**
+ * add a batch of tasks, which will run as coroutines
+ *   - It is thread-safe and can be called from anywhere.
+ *   - Tasks are split evenly across the schedulers, each scheduler is locked and
+ *     woken up only once for the batch.
+ *
+ * @param cbs  an array of Closures created by new_closure(), or user-defined Closures.
+ * @param n    number of the Closures.
+ */
+__coapi void go_batch(Closure* const* cbs, size_t n);
+
+inline void go_batch(const co::vector<Closure*>& cbs) { go_batch(cbs.data(), cbs.size()); }
+
+/**
+ * run a blocking or CPU-heavy task in the blocking thread pool
+ *   - In coroutine, the task runs in one of co_offload_threads threads, and the
+ *     calling coroutine is suspended until it is done. Other coroutines in the
+ *     scheduler keep running. Tasks are queued when all the threads are busy.
+ *   - Not in coroutine, the task runs in the calling thread directly.
+ *   - NOTE: With shared stacks (the default), the stack of the calling coroutine
+ *     may be used by other coroutines while the task is running, so the task
+ *     MUST NOT access variables on it. Capture arguments by value, and return
+ *     the result instead of writing it through a reference.
+ *
+ * @param cb  a pointer to a Closure created by new_closure(), or an user-defined Closure.
+ */
+__coapi void run_blocking(Closure* cb);
+
+namespace xx {
+
+// a task whose result is moved back to the caller of run_blocking()
+template <typename F, typename R>
+class BlockingCall : public Closure {
+  public:
+    BlockingCall(F&& f) : _f(std::forward<F>(f)), _done(false) {}
+    virtual ~BlockingCall() {
+        if (_done) ((R*)&_r)->~R();
+    }
+
+    virtual void run() {
+        new (&_r) R(_f());
+        _done = true;
+    }
+
+    R get() { return std::move(*(R*)&_r); }
+
+  private:
+    typename std::remove_reference<F>::type _f;
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type _r;
+    bool _done;
+};
+
+}  // namespace xx
+
+/**
+ * run f() in the blocking thread pool, see run_blocking(Closure*) for details
+ *   - e.g.
+ *     fastring s = co::run_blocking([data]() { return compress(data); });
+ *
+ * @return  the result of f().
+ */
+template <typename F, typename R = typename std::decay<decltype(std::declval<F&>()())>::type,
+          typename std::enable_if<!std::is_void<R>::value, int>::type = 0>
+inline R run_blocking(F&& f) {
+    auto t = new xx::BlockingCall<F, R>(std::forward<F>(f));
+    run_blocking(static_cast<Closure*>(t));
+    R r(t->get());
+    delete t;
+    return r;
+}
+
+template <typename F, typename R = decltype(std::declval<F&>()()),
+          typename std::enable_if<std::is_void<R>::value, int>::type = 0>
+inline void run_blocking(F&& f) {
+    run_blocking(new_closure(std::forward<F>(f)));
+}
+
+// a snapshot of metrics of the blocking thread pool, see blocking_stats()
+struct blocking_pool_stats {
+    uint32_t threads;   // number of threads in the pool, 0 if not started yet
+    uint64_t queued;    // tasks waiting in the queue
+    uint64_t running;   // tasks running in the threads
+    uint64_t done;      // tasks done since the pool started
+    uint64_t wait_us;   // total time (us) tasks waited in the queue
+};
+
+// get metrics of the blocking thread pool used by run_blocking() and file I/O offload
+__coapi blocking_pool_stats blocking_stats();
+
 // define main function
 //   - make code in main function also runs in coroutine
 #define DEF_main(argc, argv)             \
@@ -120,11 +234,95 @@ inline void go(F&& f, T* t, P&& p) {
     }                                    \
     int _co_main(int argc, char** argv)
 
+// a snapshot of runtime metrics of a scheduler, see Sched::stats()
+struct sched_stats {
+    uint32_t id;              // id of the scheduler
+    uint64_t coroutines;      // number of coroutines alive
+    uint64_t switches;        // number of context switches into coroutines
+    uint64_t stack_bytes;     // bytes of stacks copied out by saving shared stacks
+    uint64_t ready_tasks;     // new and ready tasks picked up in the last loop iteration
+    uint64_t timers;          // number of pending timers
+    uint64_t wait_us;         // time blocked or polling in epoll wait (us)
+    uint64_t run_us;          // time spent in handling events and running coroutines (us)
+    uint64_t spin_hits;       // busy-poll: events found while spinning
+    uint64_t spin_misses;     // busy-poll: spun without events, then blocked
+    uint64_t blocking_waits;  // epoll waits that may block the thread
+    uint64_t stack_collisions;  // times a coroutine was resumed on a stack used by another one
+};
+
+// a call site of coroutines in stack_stats, identified by the type of the
+// coroutine function, e.g. a lambda defined in some function
+struct stack_site {
+    const char* name;    // name of the closure type, mangled by some compilers
+    uint64_t saves;      // number of times its stacks were saved
+    uint64_t max_bytes;  // size of the largest stack saved
+};
+
+// profile of stacks saved by coroutines on shared stacks, see stack_profile()
+//   - hist[0] counts stacks of at most 1 KB, hist[i] (0 < i < 15) those of
+//     (2^(i-1), 2^i] KB, and hist[15] those larger than 16 MB.
+//   - Nothing is recorded unless co_stack_profile is true.
+struct stack_stats {
+    uint64_t saves;                // number of stacks saved
+    uint64_t max_bytes;            // size of the largest stack saved
+    uint64_t hist[16];             // histogram of sizes of stacks saved
+    co::vector<stack_site> sites;  // sorted by max_bytes, the largest first
+};
+
+// get the stack profile of all schedulers, see Sched::stack_profile()
+__coapi stack_stats stack_profile();
+
+/**
+ * dump trace events of all schedulers in the Chrome trace JSON format
+ *   - Events are recorded only when co_trace is true, it may be set at runtime.
+ *     Each scheduler keeps the latest co_trace_events of them in a ring, and
+ *     writing one costs a clock read.
+ *   - Runs of coroutines and blocking waits of schedulers are slices, waits
+ *     for I/O, timers and steals of tasks are instant events.
+ *   - Open the result in chrome://tracing or https://ui.perfetto.dev.
+ */
+__coapi fastring trace_json();
+
+/**
+ * sample CPU time of the process for @ms milliseconds, and return the profile
+ * in the pprof format (protobuf, not compressed), see http::serve_pprof().
+ *   - SIGPROF is raised @hz times per CPU second, a sample is attributed to the
+ *     coroutine running in the thread at that moment, and to the type of the
+ *     closure passed to go() that created it. Samples of a scheduler outside
+ *     coroutines, and of other threads, go to "(scheduler)" and "(thread)".
+ *   - Each sample has a label "co" with the id of the coroutine.
+ *   - Only one profile is taken at a time. It returns an empty string if another
+ *     one is in progress, or on windows.
+ *   - Blocking syscalls may fail with EINTR while profiling, as with any
+ *     SIGPROF-based profiler.
+ *
+ *   go tool pprof -http=:8080 profile
+ */
+__coapi fastring cpu_profile(uint32_t ms, uint32_t hz = 100);
+
 class __coapi Sched {
   public:
     Sched() = delete;
     ~Sched() = delete;
 
+    /**
+     * get a snapshot of runtime metrics of this scheduler
+     *   - It is thread-safe and lock-free, counters are updated by the scheduler
+     *     thread with relaxed atomic stores, the snapshot may be slightly stale.
+     *   - Counters except coroutines, ready_tasks and timers accumulate since the
+     *     scheduler started, take the difference of two snapshots to get rates.
+     */
+    sched_stats stats() const;
+
+    /**
+     * get the profile of stacks saved in this scheduler
+     *   - Sizes of stacks are recorded when they are copied out of the shared
+     *     stacks, it helps to tune co_stack_size and co_stack_num.
+     *   - It works only when co_stack_profile is true, and coroutines on
+     *     dedicated stacks are not profiled.
+     */
+    stack_stats stack_profile() const;
+
     void go(Closure* cb);
 
     template <typename F>
@@ -157,6 +355,45 @@ __coapi const co::vector<Sched*>& scheds();
 // get number of the schedulers
 __coapi int sched_num();
 
+/**
+ * set number of schedulers that take new tasks
+ *   - go() and go_batch() dispatch tasks only to the first @n schedulers. The
+ *     others are parked, they keep running coroutines already in them, and do
+ *     not steal tasks. A parked scheduler with nothing to do blocks in epoll
+ *     wait, using no CPU. Tasks can still be added by co::Sched::go().
+ *   - It can be called at any time from any thread, to follow the load.
+ *
+ * @param n  in [1, sched_num()], all schedulers take new tasks if n is out of range.
+ */
+__coapi void set_active_sched_num(int n);
+
+// get number of schedulers that take new tasks, see set_active_sched_num()
+__coapi int active_sched_num();
+
+/**
+ * set the shared stack new coroutines are bound to when they start
+ *   - "idx": the stack chosen by index of the coroutine, the default.
+ *   - "lru": a free stack, or the least recently used one.
+ *   - co_stack_policy is parsed once when the schedulers start, this changes the
+ *     policy later. It can be called at any time from any thread, and applies to
+ *     coroutines started after it.
+ *
+ * @return  false if @policy is unknown, the policy is not changed then.
+ */
+__coapi bool set_stack_policy(const char* policy);
+
+// get the policy of shared stacks, "idx" or "lru", see set_stack_policy()
+__coapi const char* stack_policy();
+
+/**
+ * release memory not in use to the OS in all schedulers
+ *   - It frees empty blocks of coroutines, cached dedicated stacks and buffers
+ *     for saving stacks, and unused pages of shared stacks.
+ *   - It is thread-safe and returns at once, the work is done later in each
+ *     scheduler thread. Schedulers also do part of it every co_trim_ms ms.
+ */
+__coapi void trim_memory();
+
 // get the current scheduler
 __coapi Sched* sched();
 
@@ -218,6 +455,14 @@ __coapi void del_io_event(sock_t fd);
 //     or the timer expires, the scheduler will resume the coroutine.
 __coapi void yield();
 
+// yield the current coroutine if it has run longer than a time slice
+//   - The time slice is set by co_time_slice_us (10ms by default), and it starts
+//     at the first call after the coroutine was resumed.
+//   - The coroutine will be resumed in the next loop of the scheduler. It is a
+//     cheap way for CPU-heavy loops to share the scheduler with others.
+//   - Return true if the coroutine yielded, false if not or not in coroutine.
+__coapi bool maybe_yield();
+
 // resume the coroutine
 //   - It is thread safe and can be called anywhere.
 //   - @co: a pointer to the coroutine (result of co::coroutine())
@@ -227,6 +472,13 @@ __coapi void resume(void* co);
 //   - It is equal to sleep::ms() if called from non-coroutines.
 __coapi void sleep(uint32_t ms);
 
+// sleep for microseconds
+//   - It is for sub-millisecond delays like pacing, without busy looping. The
+//     scheduler waits with a timeout in microseconds (epoll_pwait2 or a timerfd
+//     on linux). The precision is still milliseconds on windows.
+//   - It sleeps in the thread if called from non-coroutines.
+__coapi void sleep_us(uint32_t us);
+
 // check whether the current coroutine has timed out
 //   - It MUST be called in coroutine.
 //   - When a coroutine returns from an API with a timeout like co::recv, users may
@@ -240,6 +492,59 @@ __coapi bool on_stack(const void* p);
 // stop all schedulers
 __coapi void stop_scheds();
 
+namespace xx {
+__coapi uint32_t cls_key(void (*dtor)(void*));
+__coapi void* cls_get(uint32_t key);
+__coapi void cls_set(uint32_t key, void* p);
+}  // namespace xx
+
+/**
+ * coroutine-local storage, like co::tls, but each coroutine has its own value
+ *   - get() and set() MUST be called in coroutine, get() returns NULL if no value
+ *     was set in the current coroutine.
+ *   - The value is owned by the coroutine. It will be deleted when it is replaced
+ *     by set(), or when the coroutine terminates.
+ *   - Keys are not reclaimed, cls objects are generally global or static variables.
+ *
+ *   co::cls<Context> ctx;
+ *   go([]() {
+ *       ctx.set(new Context);
+ *       ctx->xxx;
+ *   });
+ */
+template <typename T>
+class cls {
+  public:
+    cls() : _key(xx::cls_key(&cls::_delete)) {}
+    ~cls() = default;
+
+    T* get() const { return (T*)xx::cls_get(_key); }
+
+    void set(T* p) { xx::cls_set(_key, p); }
+
+    T* operator->() const {
+        T* const o = this->get();
+        assert(o);
+        return o;
+    }
+
+    T& operator*() const {
+        T* const o = this->get();
+        assert(o);
+        return *o;
+    }
+
+    bool operator==(T* p) const { return this->get() == p; }
+    bool operator!=(T* p) const { return this->get() != p; }
+    explicit operator bool() const { return this->get() != 0; }
+
+  private:
+    static void _delete(void* p) { delete (T*)p; }
+
+    uint32_t _key;
+    DISALLOW_COPY_AND_ASSIGN(cls);
+};
+
 }  // namespace co
 
 using co::go;
@@ -0,0 +1,273 @@
+#pragma once
+
+// C++20 stackless coroutines on the schedulers of co.
+//   - This header is not included by co/co.h, and it is empty before C++20.
+//   - A co::task is resumed by the scheduler loop in a pooled coroutine that
+//     returns without yielding, so its frame is never copied out of the shared
+//     stack. A stackful coroutine pays that copy whenever it is suspended.
+//   - Blocking APIs of co, socket I/O, channels, events and so on, are awaited
+//     through co::stackful(), which runs them in a stackful coroutine of the
+//     current scheduler and resumes the waiter with the result.
+//   - GCC before 13 may destroy temporaries in a co_await expression twice, keep
+//     callables with non-trivial captures in a variable before co_await.
+//
+//   co::task<int> get(co::chan<int>& ch) {
+//       co_await co::sleep_for(10);
+//       co_return co_await co::stackful([&ch]() { int v = 0; ch >> v; return v; });
+//   }
+
+#include "../co.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+
+namespace co {
+
+template <typename T = void>
+class task;
+
+namespace xx {
+
+class resume_task : public Closure {
+  public:
+    explicit resume_task(std::coroutine_handle<> h) noexcept : _h(h) {}
+    virtual ~resume_task() = default;
+
+    virtual void run() {
+        const auto h = _h;
+        delete this;
+        h.resume();
+    }
+
+  private:
+    std::coroutine_handle<> _h;
+};
+
+// resume @h in the scheduler @s, or in the next scheduler if @s is NULL
+inline void resume_in(Sched* s, std::coroutine_handle<> h) {
+    Closure* const c = new resume_task(h);
+    s ? s->go(c) : co::go(c);
+}
+
+struct task_promise_base {
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+
+        // transfer to the awaiting coroutine if any, without growing the stack
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            const auto c = h.promise().cont;
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() const noexcept { std::terminate(); }
+
+    std::coroutine_handle<> cont;
+};
+
+template <typename T>
+struct task_promise : task_promise_base {
+    task_promise() noexcept : _has(false) {}
+
+    ~task_promise() {
+        if (_has) reinterpret_cast<T*>(&_v)->~T();
+    }
+
+    task<T> get_return_object() noexcept;
+
+    template <typename V>
+    void return_value(V&& v) {
+        new (&_v) T(std::forward<V>(v));
+        _has = true;
+    }
+
+    T result() { return std::move(*reinterpret_cast<T*>(&_v)); }
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _v;
+    bool _has;
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void result() const noexcept {}
+};
+
+// the root of a spawned task, its frame is freed when it is done
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept {
+            return detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> h;
+};
+
+}  // namespace xx
+
+/**
+ * A lazy stackless coroutine that returns T.
+ *   - It starts when it is awaited by another task, or by co::spawn().
+ *   - The awaiting task is resumed by symmetric transfer when it finishes.
+ */
+template <typename T>
+class task {
+  public:
+    typedef xx::task_promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    explicit task(handle_t h) noexcept : _h(h) {}
+    task(task&& t) noexcept : _h(t._h) { t._h = nullptr; }
+
+    ~task() {
+        if (_h) _h.destroy();
+    }
+
+    task(const task&) = delete;
+    void operator=(const task&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+        _h.promise().cont = c;
+        return _h;
+    }
+
+    T await_resume() { return _h.promise().result(); }
+
+  private:
+    handle_t _h;
+};
+
+namespace xx {
+
+template <typename T>
+inline task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+inline detached run_detached(task<void> t) { co_await t; }
+
+template <typename T>
+class future_awaiter : public future_callback {
+  public:
+    explicit future_awaiter(const co::future<T>& f) noexcept : _f(f), _s(0) {}
+
+    bool await_ready() const noexcept { return _f.ready(); }
+
+    // return false to resume at once if the future is done in the meantime
+    bool await_suspend(std::coroutine_handle<> h) {
+        _h = h;
+        _s = co::sched();
+        this->f = &future_awaiter::on_done;
+        return _f.base()->add_callback(this);
+    }
+
+    T await_resume() const { return _f.get(); }
+
+  private:
+    static void on_done(future_callback* c) {
+        const auto a = static_cast<future_awaiter*>(c);
+        xx::resume_in(a->_s, a->_h);
+    }
+
+    co::future<T> _f;
+    Sched* _s;
+    std::coroutine_handle<> _h;
+};
+
+class sleep_awaiter {
+  public:
+    explicit sleep_awaiter(uint32_t ms) noexcept : _ms(ms) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) const {
+        const uint32_t ms = _ms;
+        Sched* const s = co::sched();
+        auto f = [h, ms]() {
+            co::sleep(ms);
+            h.resume();
+        };
+        s ? s->go(f) : co::go(f);
+    }
+
+    void await_resume() const noexcept {}
+
+  private:
+    uint32_t _ms;
+};
+
+class sched_awaiter {
+  public:
+    explicit sched_awaiter(Sched* s) noexcept : _s(s) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) const { xx::resume_in(_s, h); }
+    void await_resume() const noexcept {}
+
+  private:
+    Sched* _s;
+};
+
+}  // namespace xx
+
+// start a task in the next scheduler, it runs to the end on its own
+inline void spawn(task<void>&& t) {
+    xx::resume_in(0, xx::run_detached(std::move(t)).h);
+}
+
+// start a task in the scheduler @s
+inline void spawn(Sched* s, task<void>&& t) {
+    xx::resume_in(s, xx::run_detached(std::move(t)).h);
+}
+
+// co_await a future, the task is resumed in its own scheduler when it is ready
+template <typename T>
+inline xx::future_awaiter<T> operator co_await(const co::future<T>& f) noexcept {
+    return xx::future_awaiter<T>(f);
+}
+
+// co_await co::sleep_for(ms) suspends the task for @ms milliseconds
+inline xx::sleep_awaiter sleep_for(uint32_t ms) noexcept { return xx::sleep_awaiter(ms); }
+
+// co_await co::yield_now() lets other tasks in the scheduler run first
+inline xx::sched_awaiter yield_now() { return xx::sched_awaiter(co::sched()); }
+
+// co_await co::resume_on(s) moves the task to the scheduler @s
+inline xx::sched_awaiter resume_on(Sched* s) noexcept { return xx::sched_awaiter(s); }
+
+/**
+ * run f() in a stackful coroutine of the current scheduler, co_await the
+ * result to wait for it in a task.
+ *   - Blocking APIs of co, socket I/O, channels and so on, work in f().
+ */
+template <typename F, typename T = typename std::decay<decltype(std::declval<F>()())>::type>
+inline co::future<T> stackful(F&& f) {
+    auto t = new xx::async_task<F, T>(std::forward<F>(f));
+    t->ref();  // one for the future, and one for the task
+    Sched* const s = co::sched();
+    s ? s->go(static_cast<Closure*>(t)) : co::go(static_cast<Closure*>(t));
+    return co::future<T>(static_cast<xx::future_state<T>*>(t));
+}
+
+}  // namespace co
+
+#endif
+#endif
@@ -4,8 +4,12 @@
 #include <functional>
 
 #include "../def.h"
+#include "../small_vector.h"
+#include "../vector.h"
 
 namespace co {
+class select;
+
 namespace xx {
 
 class __coapi pipe {
@@ -13,7 +17,7 @@ class __coapi pipe {
     typedef std::function<void(void*, void*, int)> C;
     typedef std::function<void(void*)> D;
 
-    pipe(uint32_t buf_size, uint32_t blk_size, uint32_t ms, C&& c, D&& d);
+    pipe(uint32_t buf_size, uint32_t blk_size, uint32_t ms, C&& c, D&& d, bool local = false);
     ~pipe();
 
     pipe(pipe&& p) noexcept : _p(p._p) { p._p = 0; }
@@ -24,12 +28,15 @@ class __coapi pipe {
 
     void read(void* p) const;
     void write(void* p, int o) const;
+    size_t read_n(void* p, size_t n) const;
+    size_t write_n(void* p, size_t n, int o) const;
     void close() const;
     bool is_closed() const noexcept;
     bool done() const noexcept;
 
   private:
     void* _p;
+    friend class co::select;
 };
 
 class __coapi pipe_cap {
@@ -65,9 +72,12 @@ class __coapi pipe_cap {
 template <typename T>
 class chan {
   public:
-    // @cap  max capacity of the queue, 1 by default.
-    // @ms   timeout in milliseconds, -1 by default.
-    explicit chan(uint32_t cap = 1, uint32_t ms = (uint32_t)-1)
+    // @cap    max capacity of the queue, 1 by default.
+    // @ms     timeout in milliseconds, -1 by default.
+    // @local  if true, the channel can only be used by coroutines in the same
+    //         scheduler. It requires no lock, and waiting coroutines are woken
+    //         up directly in the scheduler thread. false by default.
+    explicit chan(uint32_t cap = 1, uint32_t ms = (uint32_t)-1, bool local = false)
         : _p(
               cap * sizeof(T), sizeof(T), ms,
               [](void* dst, void* src, int o) {
@@ -80,7 +90,7 @@ class chan {
                           break;
                   }
               },
-              [](void* p) { static_cast<T*>(p)->~T(); }) {}
+              [](void* p) { static_cast<T*>(p)->~T(); }, local) {}
 
     ~chan() = default;
 
@@ -106,6 +116,20 @@ class chan {
         return (chan&)*this;
     }
 
+    // read up to @n elements to @p, block until at least one is available.
+    //   - @p points to an array of at least n objects.
+    //   - Return number of elements read, 0 if the channel was closed or timed out.
+    size_t read_n(T* p, size_t n) const { return _p.read_n((void*)p, n); }
+
+    // write @n elements in @p to the channel (copy constructor will be used).
+    //   - Elements are written in batches, it blocks until all of them are written.
+    //   - Return number of elements written, less than n if the channel was closed
+    //     or timed out, and done() will return false.
+    size_t write_n(const T* p, size_t n) const { return _p.write_n((void*)p, n, 0); }
+
+    // like write_n(), but move constructor will be used
+    size_t move_n(T* p, size_t n) const { return _p.write_n((void*)p, n, 1); }
+
     // return true if the read or write operation was done successfully
     bool done() const noexcept { return _p.done(); }
 
@@ -118,11 +142,60 @@ class chan {
 
   private:
     xx::pipe _p;
+    friend class select;
 };
 
 template <typename T>
 using Chan = chan<T>;
 
+// Wait on multiple channels at once, like select in golang. It MUST be used in
+// coroutine, and only co::chan is supported.
+//   - recv() adds a channel and the object to read an element into.
+//   - wait() returns as soon as an element is read from one of the channels,
+//     the waits on other channels are cancelled then.
+//   - A closed channel with no element in it is also ready, done() returns false
+//     in that case.
+//
+//   co::select s;
+//   s.recv(ch1, x).recv(ch2, y);
+//   int i = s.wait(100);  // i is 0 or 1, or -1 on timeout
+class __coapi select {
+  public:
+    select() : _next(0), _done(false) {}
+    ~select() = default;
+
+    template <typename T>
+    select& recv(const chan<T>& c, T& x) {
+        _pipes.push_back(&c._p);
+        _bufs.push_back((void*)&x);
+        return *this;
+    }
+
+    // wait until an element is read from one of the channels.
+    //   - @ms  timeout in milliseconds, -1 for never timeout, 0 for no wait.
+    //   - Return index of the channel in the order they were added by recv(),
+    //     or -1 on timeout.
+    int wait(uint32_t ms = (uint32_t)-1);
+
+    // return true if an element was read in the last wait()
+    bool done() const noexcept { return _done; }
+
+    // remove all the channels
+    void clear() noexcept {
+        _pipes.clear();
+        _bufs.clear();
+    }
+
+  private:
+    // a select usually waits on a few channels, no heap allocation for them
+    co::small_vector<const xx::pipe*, 4> _pipes;
+    co::small_vector<void*, 4> _bufs;
+    co::small_vector<void*, 4> _ws;  // waiters in the channels
+    uint32_t _next;
+    bool _done;
+    DISALLOW_COPY_AND_ASSIGN(select);
+};
+
 template <typename T>
 class chan1 {
   public:
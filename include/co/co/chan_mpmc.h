@@ -0,0 +1,248 @@
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "../def.h"
+
+namespace co {
+namespace xx {
+
+// Wait queue of coroutines or threads, used on the slow path of lock-free
+// containers. The waiter count is checked without a lock, so the fast path
+// costs nothing when nobody waits.
+class __coapi waitq {
+  public:
+    waitq();
+    ~waitq();
+
+    // Park the caller until it is woken up by notify() or timed out.
+    //   - @f is called with the internal lock held, after the caller was counted
+    //     as a waiter. The caller is not parked if f(arg) returns true.
+    //   - Return 1 if f(arg) returned true, 0 if woken up, -1 on timeout.
+    int wait(bool (*f)(void*), void* arg, uint32_t ms);
+
+    // wake up a waiter, or all waiters
+    void notify();
+    void notify_all();
+
+    bool has_waiters() const noexcept { return _n.load(std::memory_order_seq_cst) != 0; }
+
+  private:
+    void* _p;
+    std::atomic_uint32_t _n;
+    DISALLOW_COPY_AND_ASSIGN(waitq);
+};
+
+// result of the last operation on a chan_mpmc in the current thread
+__coapi bool& mpmc_done();
+
+}  // namespace xx
+
+// Bounded MPMC channel based on a ring buffer with sequence-numbered slots.
+//   - Readers and writers do not take any lock unless the ring is empty or full,
+//     in which case coroutines (or threads) are parked until it is not.
+//   - Woken waiters compete with others for the element or slot, there is no
+//     direct hand-off like co::chan, and a waiter may be parked again.
+//   - It is designed for many producers and consumers on different schedulers,
+//     use co::chan if strict fairness is required.
+template <typename T>
+class chan_mpmc {
+  public:
+    // @cap  capacity of the ring, rounded up to power of 2, 1024 by default.
+    // @ms   timeout in milliseconds, -1 by default.
+    explicit chan_mpmc(uint32_t cap = 1024, uint32_t ms = (uint32_t)-1) : _p(new impl(cap, ms)) {}
+
+    ~chan_mpmc() {
+        if (_p && _p->refn.fetch_sub(1, std::memory_order_acq_rel) == 1) delete _p;
+    }
+
+    chan_mpmc(chan_mpmc&& c) noexcept : _p(c._p) { c._p = 0; }
+
+    // copy constructor, just increment the reference count
+    chan_mpmc(const chan_mpmc& c) : _p(c._p) { _p->refn.fetch_add(1, std::memory_order_relaxed); }
+
+    void operator=(const chan_mpmc&) = delete;
+
+    // read an element from the channel to @x
+    chan_mpmc& operator>>(T& x) const {
+        xx::mpmc_done() = _p->read(x);
+        return (chan_mpmc&)*this;
+    }
+
+    // write an element to the channel (copy constructor will be used)
+    chan_mpmc& operator<<(const T& x) const {
+        xx::mpmc_done() = _p->write(x);
+        return (chan_mpmc&)*this;
+    }
+
+    // write an element to the channel (move constructor will be used)
+    chan_mpmc& operator<<(T&& x) const {
+        xx::mpmc_done() = _p->write(std::move(x));
+        return (chan_mpmc&)*this;
+    }
+
+    // return true if the read or write operation was done successfully
+    bool done() const noexcept { return xx::mpmc_done(); }
+
+    // close the channel.
+    // write was disabled then, but we can still read from the channel.
+    void close() const { _p->close(); }
+
+    // check if the channel was closed (false for closed)
+    explicit operator bool() const noexcept {
+        return !_p->closed.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct slot {
+        std::atomic_size_t seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+    };
+
+    struct impl {
+        impl(uint32_t cap, uint32_t ms) : refn(1), closed(false), ms(ms) {
+            size_t n = 2;
+            while (n < cap) n <<= 1;
+            mask = n - 1;
+            slots = (slot*)::malloc(sizeof(slot) * n);
+            assert(slots);
+            for (size_t i = 0; i < n; ++i) new (&slots[i].seq) std::atomic_size_t(i);
+            head.store(0, std::memory_order_relaxed);
+            tail.store(0, std::memory_order_relaxed);
+        }
+
+        ~impl() {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            for (size_t i = head.load(std::memory_order_relaxed); i != t; ++i) {
+                ((T*)&slots[i & mask].data)->~T();
+            }
+            ::free(slots);
+        }
+
+        template <typename U>
+        bool try_write(U&& x) {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            for (;;) {
+                slot& s = slots[pos & mask];
+                const size_t seq = s.seq.load(std::memory_order_acquire);
+                const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if (dif == 0) {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        new (&s.data) T(std::forward<U>(x));
+                        s.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (dif < 0) {
+                    return false;  // full
+                } else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool try_read(T& x) {
+            size_t pos = head.load(std::memory_order_relaxed);
+            for (;;) {
+                slot& s = slots[pos & mask];
+                const size_t seq = s.seq.load(std::memory_order_acquire);
+                const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (dif == 0) {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        T* const p = (T*)&s.data;
+                        x = std::move(*p);
+                        p->~T();
+                        s.seq.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (dif < 0) {
+                    return false;  // empty
+                } else {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        template <typename U>
+        bool write(U&& x) {
+            for (;;) {
+                if (closed.load(std::memory_order_relaxed)) return false;
+                if (this->try_write(std::forward<U>(x))) break;
+                struct arg_t {
+                    impl* c;
+                    typename std::remove_reference<U>::type* x;
+                    bool ok;
+                } a{this, &x, false};
+                const int r = wq.wait(
+                    [](void* p) {
+                        auto a = (arg_t*)p;
+                        if (a->c->closed.load(std::memory_order_relaxed)) return true;
+                        return a->ok = a->c->try_write(std::forward<U>(*a->x));
+                    },
+                    &a, ms);
+                if (r == 1) {
+                    if (!a.ok) return false;  // closed
+                    break;
+                }
+                if (r < 0) return false;  // timeout
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (rq.has_waiters()) rq.notify();
+            return true;
+        }
+
+        bool read(T& x) {
+            for (;;) {
+                if (this->try_read(x)) break;
+                struct arg_t {
+                    impl* c;
+                    T* x;
+                    bool ok;
+                } a{this, &x, false};
+                const int r = rq.wait(
+                    [](void* p) {
+                        auto a = (arg_t*)p;
+                        if ((a->ok = a->c->try_read(*a->x))) return true;
+                        return a->c->closed.load(std::memory_order_relaxed);
+                    },
+                    &a, ms);
+                if (r == 1) {
+                    if (!a.ok) return false;  // closed and empty
+                    break;
+                }
+                if (r < 0) return false;  // timeout
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (wq.has_waiters()) wq.notify();
+            return true;
+        }
+
+        void close() {
+            closed.store(true, std::memory_order_seq_cst);
+            rq.notify_all();
+            wq.notify_all();
+        }
+
+        std::atomic_uint32_t refn;
+        std::atomic_bool closed;
+        uint32_t ms;
+        size_t mask;
+        slot* slots;
+        char _pad0[L1_CACHE_LINE_SIZE];
+        std::atomic_size_t head;  // position to read
+        char _pad1[L1_CACHE_LINE_SIZE];
+        std::atomic_size_t tail;  // position to write
+        char _pad2[L1_CACHE_LINE_SIZE];
+        xx::waitq rq;  // readers waiting for elements
+        xx::waitq wq;  // writers waiting for free slots
+    };
+
+    impl* _p;
+};
+
+}  // namespace co
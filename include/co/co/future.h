@@ -0,0 +1,259 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "../clist.h"
+#include "../closure.h"
+#include "../def.h"
+#include "../vector.h"
+
+namespace co {
+
+__coapi void go(Closure* cb);
+
+namespace xx {
+
+class future_base;
+
+// A callback run by the thread that sets the future, with the lock of the future
+// held, it MUST NOT block. See future_base::add_callback().
+struct future_callback : co::clink {
+    void (*f)(future_callback*);
+};
+
+// wait until one of the @n futures is done, return its index, or -1 on timeout
+__coapi int wait_any(future_base* const* v, size_t n, uint32_t ms);
+
+// Shared state of a future without the value. It is done once the value is set,
+// and waiters, coroutines or threads, are woken up then.
+class __coapi future_base {
+  public:
+    future_base() noexcept : _refn(1), _done(false) {}
+    virtual ~future_base() = default;
+
+    void ref() noexcept { _refn.fetch_add(1, std::memory_order_relaxed); }
+
+    void unref() noexcept {
+        if (_refn.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    bool done() const noexcept { return _done.load(std::memory_order_acquire); }
+
+    // wait until done, or for at most @ms milliseconds
+    bool wait(uint32_t ms = (uint32_t)-1);
+
+    // mark as done and wake up all the waiters, call it once only
+    void set_done();
+
+    // run c->f(c) when the future is done. Return false if it is already done,
+    // and the callback is not added then. @c MUST be valid until it is called.
+    bool add_callback(future_callback* c);
+
+  private:
+    friend int wait_any(future_base* const*, size_t, uint32_t);
+    std::atomic_uint32_t _refn;
+    std::atomic_bool _done;
+    std::mutex _m;
+    co::clist _w;  // waiters
+};
+
+template <typename T>
+class future_state : public future_base {
+  public:
+    future_state() noexcept {}
+
+    virtual ~future_state() {
+        if (this->done()) this->value().~T();
+    }
+
+    T& value() noexcept { return *reinterpret_cast<T*>(&_v); }
+
+    template <typename... X>
+    void set(X&&... x) {
+        new (&_v) T(std::forward<X>(x)...);
+        this->set_done();
+    }
+
+    T& get() {
+        this->wait();
+        return this->value();
+    }
+
+  private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _v;
+};
+
+template <>
+class future_state<void> : public future_base {
+  public:
+    void set() { this->set_done(); }
+    void get() { this->wait(); }
+};
+
+// The task of co::async(), it is the closure and the shared state at the same
+// time, so that a single allocation is needed.
+template <typename F, typename T>
+class async_task : public Closure, public future_state<T> {
+  public:
+    explicit async_task(F&& f) : _f(std::forward<F>(f)) {}
+    virtual ~async_task() = default;
+
+    virtual void run() {
+        this->set(_f());
+        this->unref();
+    }
+
+  private:
+    typename std::remove_reference<F>::type _f;
+};
+
+template <typename F>
+class async_task<F, void> : public Closure, public future_state<void> {
+  public:
+    explicit async_task(F&& f) : _f(std::forward<F>(f)) {}
+    virtual ~async_task() = default;
+
+    virtual void run() {
+        _f();
+        this->set();
+        this->unref();
+    }
+
+  private:
+    typename std::remove_reference<F>::type _f;
+};
+
+}  // namespace xx
+
+/**
+ * The result of an asynchronous call, see co::async() and co::promise.
+ *   - It can be waited in coroutines or threads, a coroutine is resumed in its
+ *     own scheduler when the value is ready.
+ *   - A copy shares the same state with the original one, get() returns a
+ *     reference to the shared value.
+ */
+template <typename T>
+class future {
+  public:
+    typedef xx::future_state<T> S;
+
+    constexpr future() noexcept : _s(0) {}
+
+    // take over a reference of the state @s
+    explicit future(S* s) noexcept : _s(s) {}
+
+    future(const future& f) noexcept : _s(f._s) {
+        if (_s) _s->ref();
+    }
+
+    future(future&& f) noexcept : _s(f._s) { f._s = 0; }
+
+    ~future() {
+        if (_s) _s->unref();
+    }
+
+    future& operator=(future f) noexcept {
+        std::swap(_s, f._s);
+        return *this;
+    }
+
+    // return false if it has no state
+    bool valid() const noexcept { return _s != 0; }
+
+    // check whether the value is ready, without waiting
+    bool ready() const noexcept { return _s->done(); }
+
+    // wait until the value is ready
+    void wait() const { (void)_s->wait(); }
+
+    // wait for at most @ms milliseconds, return false on timeout
+    bool wait(uint32_t ms) const { return _s->wait(ms); }
+
+    // wait until the value is ready and return it
+    typename std::add_lvalue_reference<T>::type get() const { return _s->get(); }
+
+    xx::future_base* base() const noexcept { return _s; }
+
+  private:
+    S* _s;
+};
+
+/**
+ * The producer side of a future, for values delivered by callbacks.
+ *   - set_value() MUST be called once and only once, or the waiters of the
+ *     future will never be woken up.
+ */
+template <typename T>
+class promise {
+  public:
+    promise() : _s(new xx::future_state<T>) {}
+
+    ~promise() {
+        if (_s) _s->unref();
+    }
+
+    promise(promise&& p) noexcept : _s(p._s) { p._s = 0; }
+
+    future<T> get_future() const {
+        _s->ref();
+        return future<T>(_s);
+    }
+
+    template <typename... X>
+    void set_value(X&&... x) const {
+        _s->set(std::forward<X>(x)...);
+    }
+
+  private:
+    xx::future_state<T>* _s;
+    DISALLOW_COPY_AND_ASSIGN(promise);
+};
+
+/**
+ * run f() in a coroutine, and return a future of its result
+ *   - The closure and the shared state are allocated as a single object.
+ *
+ * @param f  any runnable object, f() MUST be able to be called without arguments.
+ */
+template <typename F, typename T = typename std::decay<decltype(std::declval<F>()())>::type>
+inline future<T> async(F&& f) {
+    auto t = new xx::async_task<F, T>(std::forward<F>(f));
+    t->ref();  // one for the future, and one for the task
+    go(static_cast<Closure*>(t));
+    return future<T>(static_cast<xx::future_state<T>*>(t));
+}
+
+// wait until all the futures are ready
+template <typename... T>
+inline void when_all(const future<T>&... f) {
+    const int x[] = {0, (f.wait(), 0)...};
+    (void)x;
+}
+
+// wait until all the futures are ready
+template <typename T>
+inline void when_all(const co::vector<future<T>>& v) {
+    for (size_t i = 0; i < v.size(); ++i) v[i].wait();
+}
+
+// wait until one of the futures is ready, and return its index
+template <typename... T>
+inline int when_any(const future<T>&... f) {
+    xx::future_base* const v[] = {f.base()...};
+    return xx::wait_any(v, sizeof...(T), (uint32_t)-1);
+}
+
+// wait for at most @ms milliseconds until one of the futures is ready.
+// Return its index, or -1 on timeout.
+template <typename T>
+inline int when_any(const co::vector<future<T>>& v, uint32_t ms = (uint32_t)-1) {
+    co::vector<xx::future_base*> b(v.size());
+    for (size_t i = 0; i < v.size(); ++i) b.push_back(v[i].base());
+    return xx::wait_any(b.data(), b.size(), ms);
+}
+
+}  // namespace co
@@ -24,6 +24,7 @@ class __coapi mutex {
     bool try_lock() const noexcept;
 
   private:
+    friend class condition_variable;
     void* _p;
 };
 
@@ -46,6 +47,127 @@ class __coapi mutex_guard {
     DISALLOW_COPY_AND_ASSIGN(mutex_guard);
 };
 
+// Reader-writer lock for coroutines, it can be also used in non-coroutines.
+//   - Multiple readers can hold the lock at the same time with lock_shared().
+//   - Writers are preferred, new readers will wait if a writer is waiting.
+//     When a writer unlocks, readers waiting are woken up before the next writer.
+class __coapi shared_mutex {
+  public:
+    shared_mutex();
+    ~shared_mutex();
+
+    shared_mutex(shared_mutex&& m) noexcept : _p(m._p) { m._p = 0; }
+
+    // copy constructor, just increment the reference count
+    shared_mutex(const shared_mutex& m);
+
+    void operator=(const shared_mutex&) = delete;
+
+    // exclusive lock for writers
+    void lock() const;
+
+    void unlock() const;
+
+    bool try_lock() const;
+
+    // shared lock for readers
+    void lock_shared() const;
+
+    void unlock_shared() const;
+
+    bool try_lock_shared() const;
+
+  private:
+    void* _p;
+};
+
+// hold a shared (read) lock in the scope
+class __coapi shared_lock_guard {
+  public:
+    explicit shared_lock_guard(const co::shared_mutex& m) : _m(m) {
+        _m.lock_shared();
+    }
+
+    explicit shared_lock_guard(const co::shared_mutex* m) : _m(*m) {
+        _m.lock_shared();
+    }
+
+    ~shared_lock_guard() {
+        _m.unlock_shared();
+    }
+
+  private:
+    const co::shared_mutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(shared_lock_guard);
+};
+
+// hold an exclusive (write) lock in the scope
+class __coapi unique_lock_guard {
+  public:
+    explicit unique_lock_guard(const co::shared_mutex& m) : _m(m) {
+        _m.lock();
+    }
+
+    explicit unique_lock_guard(const co::shared_mutex* m) : _m(*m) {
+        _m.lock();
+    }
+
+    ~unique_lock_guard() {
+        _m.unlock();
+    }
+
+  private:
+    const co::shared_mutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(unique_lock_guard);
+};
+
+// Condition variable for coroutines, used with co::mutex. It can be also used
+// in non-coroutines.
+//   - wait() MUST be called with the mutex locked, it unlocks the mutex while
+//     waiting, and locks it again before it returns. It may return spuriously,
+//     check the condition in a loop, or use wait(m, pred).
+//   - notify_all() groups the waiting coroutines by scheduler, and hands each
+//     group over in one batch, with one signal for each scheduler.
+//
+//   co::mutex m;
+//   co::condition_variable cv;
+//   bool ready = false;
+//   go([&]() { co::mutex_guard g(m); cv.wait(m, [&]() { return ready; }); });
+//   go([&]() { co::mutex_guard g(m); ready = true; cv.notify_all(); });
+class __coapi condition_variable {
+  public:
+    condition_variable();
+    ~condition_variable();
+
+    condition_variable(condition_variable&& c) noexcept : _p(c._p) { c._p = 0; }
+
+    // copy constructor, just increment the reference count
+    condition_variable(const condition_variable& c);
+
+    void operator=(const condition_variable&) = delete;
+
+    // wait until notified
+    void wait(const co::mutex& m) const;
+
+    // wait until @pred returns true
+    template <typename P>
+    void wait(const co::mutex& m, P&& pred) const {
+        while (!pred()) this->wait(m);
+    }
+
+    // wait until notified or timed out, return false if timed out
+    bool wait_for(const co::mutex& m, uint32_t ms) const;
+
+    // wake up one waiter
+    void notify_one() const;
+
+    // wake up all waiters
+    void notify_all() const;
+
+  private:
+    void* _p;
+};
+
 typedef mutex Mutex;
 typedef mutex_guard MutexGuard;
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "../def.h"
+#include "../vector.h"
+
+namespace co {
+namespace xx {
+
+// run f(k) for each chunk k in [0, n), the calling thread or coroutine and
+// helpers on the other active schedulers take chunks in turn.
+__coapi void parallel_run(size_t n, std::function<void(size_t)>&& f);
+
+inline size_t chunk_num(size_t begin, size_t end, size_t grain) {
+    return begin < end ? (end - begin + grain - 1) / grain : 0;
+}
+
+}  // namespace xx
+
+/**
+ * run f(i) for each i in [begin, end) across the schedulers
+ *   - The range is split into chunks of @grain indexes. Helper coroutines on the
+ *     other active schedulers and the caller itself run the chunks, and it
+ *     returns when all of them are done.
+ *   - In coroutine, the caller is suspended while waiting for the helpers, its
+ *     scheduler thread keeps running other coroutines.
+ *   - f is copied to the heap. NOTE: With shared stacks (the default), objects
+ *     f refers to MUST NOT be on the stack of the calling coroutine, see
+ *     co::run_blocking().
+ *
+ * @param grain  number of indexes in a chunk, 0 is taken as 1.
+ */
+template <typename F>
+inline void parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+    if (grain == 0) grain = 1;
+    typename std::decay<F>::type g(std::forward<F>(f));
+    xx::parallel_run(xx::chunk_num(begin, end, grain), [begin, end, grain, g](size_t k) {
+        const size_t b = begin + k * grain;
+        const size_t e = end - b > grain ? b + grain : end;
+        for (size_t i = b; i < e; ++i) g(i);
+    });
+}
+
+/**
+ * map each i in [begin, end) to f(i) across the schedulers, and reduce them to
+ * a value with r(x, y), see parallel_for() for how the work is split.
+ *   - Each chunk is reduced from @init, then the results of the chunks are
+ *     reduced from @init in the order of the chunks by the caller, so the result
+ *     does not depend on the schedule even if r is not commutative.
+ *
+ * @param init  identity of the reduction, 0 for sum, e.g.
+ * @return      the reduced value, @init if the range is empty.
+ */
+template <typename T, typename F, typename R>
+inline T parallel_reduce(size_t begin, size_t end, size_t grain, const T& init, F&& f, R&& r) {
+    if (grain == 0) grain = 1;
+    const size_t n = xx::chunk_num(begin, end, grain);
+    co::vector<T> v(n, init);
+    T* const p = v.data();
+    typename std::decay<F>::type g(std::forward<F>(f));
+    typename std::decay<R>::type h(r);
+    xx::parallel_run(n, [begin, end, grain, p, g, h](size_t k) {
+        const size_t b = begin + k * grain;
+        const size_t e = end - b > grain ? b + grain : end;
+        T x(p[k]);
+        for (size_t i = b; i < e; ++i) x = h(std::move(x), g(i));
+        p[k] = std::move(x);
+    });
+
+    T x(init);
+    for (size_t k = 0; k < n; ++k) x = r(std::move(x), std::move(p[k]));
+    return x;
+}
+
+}  // namespace co
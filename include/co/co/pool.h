@@ -36,6 +36,20 @@ class __coapi pool {
      */
     pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap = (size_t)-1);
 
+    /**
+     * the constructor for a pool shared by all schedulers
+     *   - pop() takes an element from the pool of the current scheduler first, and
+     *     borrows one from other schedulers if it is empty. ccb() is called only
+     *     when all the pools are empty.
+     *   - At most @max_num elements can be created by ccb(). When it is reached,
+     *     pop() blocks until an element is pushed back or discarded.
+     *   - Pools of schedulers are protected by locks in this mode.
+     *
+     * @param cap      max capacity of the pool for each thread, -1 for unlimited.
+     * @param max_num  max number of elements alive, -1 for unlimited.
+     */
+    pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap, size_t max_num);
+
     pool(pool&& p) : _p(p._p) { p._p = 0; }
 
     pool(const pool& p);
@@ -60,6 +74,15 @@ class __coapi pool {
      */
     void push(void* e) const;
 
+    /**
+     * destroy an element popped from the pool with dcb, instead of pushing it back
+     *   - It is usually used to drop a broken connection.
+     *   - In shared mode, the element is not counted as alive any more.
+     *
+     * @param e  a pointer to an element, nothing will be done if e is NULL.
+     */
+    void discard(void* e) const;
+
     /**
      * return pool size of the current thread
      *   - It MUST be called in coroutine.
@@ -73,6 +96,23 @@ class __coapi pool {
      */
     void clear() const;
 
+    /**
+     * set a callback to validate elements on pop()
+     *   - f(e) is called for an element taken from the pool, not for new ones
+     *     created by ccb. If it returns false, the element is destroyed with dcb
+     *     and pop() tries the next one.
+     *   - It SHOULD be set before the pool is used.
+     */
+    void set_check(std::function<bool(void*)>&& f) const;
+
+    /**
+     * destroy elements idle in the pool for more than @ms milliseconds
+     *   - A coroutine is created in each scheduler to check the pool every ms/2
+     *     milliseconds, it exits when the pool is destroyed.
+     *   - It can be called only once, after the schedulers are started.
+     */
+    void set_idle_timeout(uint32_t ms) const;
+
   private:
     void* _p;
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "../def.h"
+
+namespace co {
+
+// Counting semaphore for coroutines, it can be also used in non-coroutines.
+//   - Waiters are served in FIFO order, a waiter that needs more units than
+//     available blocks those behind it, so a batch acquire will not starve.
+//   - A copy shares the same counter with the original one.
+class __coapi semaphore {
+  public:
+    // @n: number of units available at the beginning
+    explicit semaphore(uint32_t n);
+    ~semaphore();
+
+    semaphore(semaphore&& s) noexcept : _p(s._p) { s._p = 0; }
+
+    // copy constructor, just increment the reference count
+    semaphore(const semaphore& s);
+
+    void operator=(const semaphore&) = delete;
+
+    // take @n units, wait until they are available
+    void acquire(uint32_t n = 1) const { (void)this->acquire(n, (uint32_t)-1); }
+
+    // take @n units, wait for at most @ms milliseconds.
+    // Return false on timeout, nothing is taken then.
+    bool acquire(uint32_t n, uint32_t ms) const;
+
+    // take @n units if they are available now and no one is waiting
+    bool try_acquire(uint32_t n = 1) const;
+
+    // give back @n units, and wake up waiters that can be served
+    void release(uint32_t n = 1) const;
+
+    // number of units available now
+    uint32_t count() const;
+
+  private:
+    void* _p;
+};
+
+// hold @n units of a semaphore in the scope
+class __coapi semaphore_guard {
+  public:
+    explicit semaphore_guard(const co::semaphore& s, uint32_t n = 1) : _s(s), _n(n) {
+        _s.acquire(_n);
+    }
+
+    ~semaphore_guard() {
+        _s.release(_n);
+    }
+
+  private:
+    const co::semaphore& _s;
+    const uint32_t _n;
+    DISALLOW_COPY_AND_ASSIGN(semaphore_guard);
+};
+
+// Token bucket rate limiter for coroutines, it can be also used in non-coroutines.
+//   - Tokens are refilled at @rate per second from the monotonic clock, and at
+//     most @burst tokens are saved while nobody takes them.
+//   - A caller reserves tokens at once and sleeps until they are due, callers
+//     are served in the order they arrived.
+//   - A copy shares the same bucket with the original one.
+class __coapi rate_limiter {
+  public:
+    // @rate: tokens per second, MUST be greater than 0
+    // @burst: size of the bucket, 0 is treated as 1
+    rate_limiter(double rate, uint32_t burst);
+    ~rate_limiter();
+
+    rate_limiter(rate_limiter&& r) noexcept : _p(r._p) { r._p = 0; }
+
+    // copy constructor, just increment the reference count
+    rate_limiter(const rate_limiter& r);
+
+    void operator=(const rate_limiter&) = delete;
+
+    // take @n tokens, wait until they are due
+    void acquire(uint32_t n = 1) const { (void)this->acquire(n, (uint32_t)-1); }
+
+    // take @n tokens if they are due within @ms milliseconds, and wait for them.
+    // Return false at once if they are not, nothing is taken then.
+    bool acquire(uint32_t n, uint32_t ms) const;
+
+    // take @n tokens if they are available now
+    bool try_acquire(uint32_t n = 1) const { return this->acquire(n, 0); }
+
+    // change the rate and the size of the bucket
+    void set_rate(double rate, uint32_t burst) const;
+
+  private:
+    void* _p;
+};
+
+}  // namespace co
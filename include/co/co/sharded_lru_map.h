@@ -0,0 +1,119 @@
+#pragma once
+
+#include "../stl.h"
+#include "mutex.h"
+
+namespace co {
+
+// A concurrent lru_map, for coroutines in different schedulers and threads.
+//   - Keys are spread over shards by hash. Each shard is a co::lru_map guarded
+//     by its own co::mutex, so operations on different shards do not contend.
+//   - The capacity is divided evenly among the shards, an element may be evicted
+//     before the total capacity is reached if the keys are not spread evenly.
+//   - Values are copied out by get(), or accessed in place by visit() with the
+//     lock of the shard held.
+//
+//   co::sharded_lru_map<fastring, fastring> cache(1 << 20);
+//   cache.insert("key", "value");
+//   fastring v;
+//   if (cache.get("key", v)) { ... }
+template <class K, class V, class Hash = xx::hash<K>, class Pred = xx::eq<K>>
+class sharded_lru_map {
+  public:
+    typedef co::lru_map<K, V, Hash, Pred> map_type;
+
+    /**
+     * @param capacity  max number of elements in all shards.
+     * @param shards    number of shards, rounded up to a power of 2.
+     */
+    explicit sharded_lru_map(size_t capacity = 16 * 1024, size_t shards = 16) {
+        size_t n = 1;
+        while (n < shards) n <<= 1;
+        _mask = n - 1;
+        _shards.reserve(n);
+        for (size_t i = 0; i < n; ++i) _shards.emplace_back((capacity + n - 1) / n);
+    }
+
+    // copy the value of @key to @v, return false if @key is not found
+    bool get(const K& key, V& v) {
+        shard& s = this->_shard(key);
+        co::mutex_guard g(s.mtx);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) return false;
+        v = it->second;
+        return true;
+    }
+
+    // call f(V&) with the lock held, return false if @key is not found
+    template <class F>
+    bool visit(const K& key, F&& f) {
+        shard& s = this->_shard(key);
+        co::mutex_guard g(s.mtx);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) return false;
+        f(it->second);
+        return true;
+    }
+
+    // call f(V&) with the lock held, @key is inserted with V() if it is not found
+    template <class F>
+    void visit_or_insert(const K& key, F&& f) {
+        shard& s = this->_shard(key);
+        co::mutex_guard g(s.mtx);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) {
+            s.map.insert(key, V());
+            it = s.map.find(key);
+        }
+        f(it->second);
+    }
+
+    // The key is not inserted if it already exists.
+    template <class X, class Y>
+    void insert(X&& key, Y&& value) {
+        shard& s = this->_shard(key);
+        co::mutex_guard g(s.mtx);
+        s.map.insert(std::forward<X>(key), std::forward<Y>(value));
+    }
+
+    void erase(const K& key) {
+        shard& s = this->_shard(key);
+        co::mutex_guard g(s.mtx);
+        s.map.erase(key);
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (size_t i = 0; i <= _mask; ++i) {
+            co::mutex_guard g(_shards[i].mtx);
+            n += _shards[i].map.size();
+        }
+        return n;
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= _mask; ++i) {
+            co::mutex_guard g(_shards[i].mtx);
+            _shards[i].map.clear();
+        }
+    }
+
+  private:
+    struct shard {
+        explicit shard(size_t cap) : map(cap) {}
+        co::mutex mtx;
+        map_type map;
+    };
+
+    // lru_map uses the low 32 bits of the mixed hash, shards take high bits
+    shard& _shard(const K& key) {
+        const uint64_t h = ::xx::wy::mix((uint64_t)Hash()(key), 0x9e3779b97f4a7c15ull);
+        return _shards[(size_t)(h >> 40) & _mask];
+    }
+
+    co::vector<shard> _shards;
+    size_t _mask;
+    DISALLOW_COPY_AND_ASSIGN(sharded_lru_map);
+};
+
+}  // namespace co
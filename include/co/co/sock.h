@@ -3,6 +3,7 @@
 #include "../byte_order.h"
 #include "../error.h"
 #include "../fastring.h"
+#include "../vector.h"
 
 
 #ifdef _WIN32
@@ -17,6 +18,12 @@
 
 typedef SOCKET sock_t;
 
+// gather buffer for co::sendv, the same as struct iovec on posix systems
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+
 #else
 #include <arpa/inet.h>  // for inet_ntop...
 #include <errno.h>
@@ -24,8 +31,13 @@ typedef SOCKET sock_t;
 #include <netdb.h>        // getaddrinfo, gethostby...
 #include <netinet/in.h>   // for struct sockaddr_in
 #include <netinet/tcp.h>  // for TCP_NODELAY...
+#ifdef __linux__
+#include <netinet/udp.h>  // for UDP_SEGMENT, UDP_GRO
+#endif
 #include <sys/socket.h>   // basic socket api, struct linger
 #include <sys/types.h>
+#include <sys/uio.h>      // for struct iovec
+#include <sys/un.h>       // for struct sockaddr_un
 #include <unistd.h>
 
 
@@ -242,6 +254,74 @@ __coapi int send(sock_t fd, const void* buf, int n, int ms = -1);
 __coapi int sendto(sock_t fd, const void* buf, int n, const void* dst_addr, int addrlen,
                    int ms = -1);
 
+/**
+ * send data in multiple buffers on a socket, without merging them first
+ *   - It MUST be called in a coroutine.
+ *   - It blocks until all the buffers are sent or timeout, or any error occured.
+ *   - writev is used on posix systems, buffers are sent one by one on windows.
+ *
+ * @param fd   a non-blocking (also overlapped on windows) socket.
+ * @param iov  an array of buffers.
+ * @param n    number of buffers, no more than IOV_MAX.
+ * @param ms   timeout in milliseconds, if ms < 0, it will never time out.
+ *             default: -1.
+ *
+ * @return     total bytes of the buffers on success, or -1 on error.
+ */
+__coapi int sendv(sock_t fd, const struct iovec* iov, int n, int ms = -1);
+
+/**
+ * send part of a file on a socket
+ *   - It MUST be called in a coroutine.
+ *   - sendfile is used on linux and mac, data is not copied to the user space.
+ *     On other systems, the file is read and sent in chunks of 64k.
+ *
+ * @param fd    a non-blocking (also overlapped on windows) socket.
+ * @param file  a file descriptor opened for reading.
+ * @param off   offset in the file to start from.
+ * @param n     bytes to be sent.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      n on success, or -1 on error or the file ended before n bytes.
+ */
+__coapi int64_t sendfile(sock_t fd, int file, int64_t off, int64_t n, int ms = -1);
+
+#ifdef __linux__
+/**
+ * recv multiple messages from a socket with recvmmsg (linux only)
+ *   - It MUST be called in a coroutine.
+ *   - It blocks until any message recieved or timeout, or any error occured.
+ *     Messages already queued on the socket are recieved with a single syscall.
+ *
+ * @param fd    a non-blocking socket, usually an udp socket.
+ * @param msgs  an array of struct mmsghdr, size of each message recieved will be
+ *              stored in msg_len.
+ * @param n     number of elements in msgs.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      number of messages recieved on success, -1 on timeout or error.
+ */
+__coapi int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms = -1);
+
+/**
+ * send multiple messages on a socket with sendmmsg (linux only)
+ *   - It MUST be called in a coroutine.
+ *   - It blocks until all the messages are sent or timeout, or any error occured.
+ *
+ * @param fd    a non-blocking socket, usually an udp socket.
+ * @param msgs  an array of struct mmsghdr, bytes sent for each message will be
+ *              stored in msg_len.
+ * @param n     number of elements in msgs, no more than UIO_MAXIOV in a syscall.
+ * @param ms    timeout in milliseconds, if ms < 0, it will never time out.
+ *              default: -1.
+ *
+ * @return      n on success, -1 on timeout or error.
+ */
+__coapi int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms = -1);
+#endif
+
 #ifdef _WIN32
 // get options on a socket, man getsockopt for details.
 inline int getsockopt(sock_t fd, int lv, int opt, void* optval, int* optlen) {
@@ -277,6 +357,17 @@ inline void set_reuseaddr(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
 }
 
+// set option SO_REUSEPORT on a socket, return false if it is not supported
+inline bool set_reuseport(sock_t fd) {
+#ifdef SO_REUSEPORT
+    const int v = 1;
+    return co::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v)) == 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
 /**
  * set send buffer size for a socket
  *   - It MUST be called before the socket is connected.
@@ -305,6 +396,38 @@ inline void set_tcp_keepalive(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &v, sizeof(v));
 }
 
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/**
+ * set segment size for UDP GSO on a socket (linux 4.18+)
+ *   - A message larger than @size sent on the socket will be split into datagrams of
+ *     @size bytes by the kernel or the NIC, so many datagrams go in one syscall.
+ *
+ * @return  false if it is not supported.
+ */
+inline bool set_udp_segment(sock_t fd, int size) {
+    return co::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) == 0;
+}
+
+/**
+ * enable UDP GRO on a socket (linux 5.0+)
+ *   - Datagrams of a flow may be merged into one message, size of the segments is
+ *     given in a control message of level SOL_UDP and type UDP_GRO.
+ *
+ * @return  false if it is not supported.
+ */
+inline bool set_udp_gro(sock_t fd) {
+    const int v = 1;
+    return co::setsockopt(fd, SOL_UDP, UDP_GRO, &v, sizeof(v)) == 0;
+}
+#endif
+
 /**
  * reset a TCP connection
  *   - It MUST be called in the same thread that performed the IO operation.
@@ -366,6 +489,34 @@ inline bool init_addr(struct sockaddr_in6* addr, const char* ip, int port) {
     return inet_pton(AF_INET6, ip, &addr->sin6_addr) == 1;
 }
 
+#ifndef _WIN32
+/**
+ * fill in unix domain socket address with a path
+ *   - A path starting with '@' is a name in the abstract namespace (linux only),
+ *     e.g. "@rpc.sock", no file is created for it.
+ *
+ * @param addr  a pointer to a unix domain socket address.
+ * @param path  path of the socket file, or "@name".
+ *
+ * @return      length of the address on success, or 0 if the path is too long.
+ */
+inline int init_addr(struct sockaddr_un* addr, const char* path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    const size_t n = strlen(path);
+    if (n == 0 || n >= sizeof(addr->sun_path)) return 0;
+    memcpy(addr->sun_path, path, n);
+    const int h = (int)((char*)addr->sun_path - (char*)addr);
+#ifdef __linux__
+    if (*path == '@') {
+        addr->sun_path[0] = '\0';
+        return h + (int)n;
+    }
+#endif
+    return h + (int)n + 1;
+}
+#endif
+
 // deprecated, use init_addr instead
 inline bool init_ip_addr(struct sockaddr_in* addr, const char* ip, int port) {
     return init_addr(addr, ip, port);
@@ -409,13 +560,46 @@ inline fastring addr2str(const struct sockaddr_in6* addr) {
  *
  * @param addr  a pointer to struct sockaddr.
  * @param len   length of the addr, sizeof(sockaddr_in) or sizeof(sockaddr_in6).
+ *              A unix domain socket address is converted to "unix:path".
  */
 inline fastring addr2str(const void* addr, int len) {
+#ifndef _WIN32
+    if (len >= (int)sizeof(sa_family_t) && ((const sockaddr*)addr)->sa_family == AF_UNIX) {
+        const auto a = (const sockaddr_un*)addr;
+        const int h = (int)((const char*)a->sun_path - (const char*)a);
+        fastring r("unix:");
+        if (len > h) {
+            if (a->sun_path[0] == '\0') {
+                r.append('@').append(a->sun_path + 1, len - h - 1);
+            } else {
+                r.append(a->sun_path, strnlen(a->sun_path, len - h));
+            }
+        }
+        return r;
+    }
+#endif
     if (len == sizeof(sockaddr_in)) return addr2str((sockaddr_in*)addr);
     if (len == sizeof(sockaddr_in6)) return addr2str((sockaddr_in6*)addr);
     return fastring();
 }
 
+/**
+ * resolve a host name to IP addresses
+ *   - IP strings are returned as is, and names in /etc/hosts are checked first.
+ *   - In coroutine, queries are sent to name servers in /etc/resolv.conf over UDP,
+ *     only the calling coroutine is suspended. Results are cached by their TTL,
+ *     and concurrent lookups of the same name share one query.
+ *   - Not in coroutine, the system resolver (getaddrinfo) is used.
+ *
+ * @param host  host name or IP string.
+ * @param af    AF_INET or AF_INET6.
+ * @param ips   IP strings are appended to it, e.g. "127.0.0.1".
+ * @param ms    timeout in milliseconds for a name server, -1 for co_dns_timeout.
+ *
+ * @return      0 on success, otherwise an EAI_XXX error code.
+ */
+__coapi int resolve(const char* host, int af, co::vector<fastring>& ips, int ms = -1);
+
 /**
  * get peer address of a connected socket
  *
@@ -425,6 +609,9 @@ inline fastring peer(sock_t fd) {
     union {
         struct sockaddr_in v4;
         struct sockaddr_in6 v6;
+#ifndef _WIN32
+        struct sockaddr_un un;
+#endif
     } addr;
     int addrlen = sizeof(addr);
     const int r = getpeername(fd, (sockaddr*)&addr, (socklen_t*)&addrlen);
@@ -0,0 +1,8 @@
+#pragma once
+#define COOST_SHARED 0
+#ifndef L1_CACHE_LINE_SIZE 
+#define L1_CACHE_LINE_SIZE 64
+#endif
+#ifndef CO_LOG_MIN_LEVEL
+#define CO_LOG_MIN_LEVEL 0
+#endif
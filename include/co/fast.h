@@ -6,6 +6,7 @@
 #include "__/dtoa_milo.h"
 #include "def.h"
 #include "god.h"
+#include "mem.h"
 
 namespace dp {
 
@@ -38,7 +39,9 @@ constexpr _fpt _n(double v, int n) { return _fpt(v, n); }
 namespace fast {
 
 // double to ascii string, return length of the result
-inline int dtoa(double v, char* buf, int mdp = 324) { return milo::dtoa(v, buf, mdp); }
+//   - @mdp: max decimal places
+//   - short decimals like 3.25 are written directly, others by milo::dtoa()
+__coapi int dtoa(double v, char* buf, int mdp = 324);
 
 // unsigned integer to hex string (e.g. 255 -> 0xff), return length of the result
 __coapi int u32toh(uint32_t v, char* buf);
@@ -92,12 +95,15 @@ inline int ptoh(const void* p, char* buf) { return u32toh((uint32_t)(size_t)p, b
 
 class __coapi stream {
   public:
+    // a stream holds only a pointer to the heap, co::vector moves it by memcpy
+    using trivially_relocatable = std::true_type;
+
     constexpr stream() noexcept : _cap(0), _size(0), _p(0) {}
 
-    explicit stream(size_t cap) : _cap(cap), _size(0) { _p = cap > 0 ? (char*)::malloc(cap) : 0; }
+    explicit stream(size_t cap) : _cap(cap), _size(0) { _p = cap > 0 ? (char*)co::alloc(cap) : 0; }
 
     stream(size_t cap, size_t size) : _cap(cap), _size(size) {
-        _p = cap > 0 ? (char*)::malloc(cap) : 0;
+        _p = cap > 0 ? (char*)co::alloc(cap) : 0;
     }
 
     stream(char* p, size_t cap, size_t size) noexcept : _cap(cap), _size(size), _p(p) {}
@@ -114,7 +120,7 @@ class __coapi stream {
 
     stream& operator=(stream&& s) {
         if (&s != this) {
-            if (_p) ::free(_p);
+            if (_p) co::free(_p);
             _p = s._p;
             _cap = s._cap;
             _size = s._size;
@@ -172,7 +178,7 @@ class __coapi stream {
 
     void reserve(size_t n) {
         if (_cap < n) {
-            _p = (char*)::realloc(_p, n);
+            _p = (char*)co::realloc(_p, n);
             assert(_p);
             _cap = n;
         }
@@ -180,7 +186,7 @@ class __coapi stream {
 
     void reset() {
         if (_p) {
-            ::free(_p);
+            co::free(_p);
             _p = 0;
             _cap = _size = 0;
         }
@@ -189,7 +195,7 @@ class __coapi stream {
     void ensure(size_t n) {
         if (_cap < _size + n + 1) {
             _cap += ((_cap >> 1) + n + 1);
-            _p = (char*)::realloc(_p, _cap);
+            _p = (char*)co::realloc(_p, _cap);
             assert(_p);
         }
     }
@@ -300,7 +306,8 @@ class __coapi stream {
     stream& operator<<(float v) { return this->operator<<((double)v); }
 
     stream& operator<<(const dp::_fpt& v) {
-        this->ensure(v.d + 8);
+        // dtoa() writes all the digits before it truncates them to v.d places
+        this->ensure(24);
         _size += fast::dtoa(v.v, _p + _size, v.d);
         return *this;
     }
@@ -318,4 +325,35 @@ class __coapi stream {
     char* _p;
 };
 
+namespace xx {
+template <typename V, god::if_t<std::is_signed<V>::value, int> = 0>
+inline int ntoa(V v, char* buf) {
+    return itoa(v, buf);
+}
+
+template <typename V, god::if_t<!std::is_signed<V>::value, int> = 0>
+inline int ntoa(V v, char* buf) {
+    return utoa(v, buf);
+}
+}  // namespace xx
+
+// append integers in [p, p + n) to @s, separated by @sep
+//   - Memory is reserved once for all of them, and digits are written to the
+//     buffer directly, without checking the capacity for each integer.
+//   - int64_t a[] = {1, -2, 3};
+//     fastream s;
+//     fast::format_ints(a, 3, ',', s);  // s -> "1,-2,3"
+template <typename T, god::if_t<std::is_integral<T>::value, int> = 0>
+inline void format_ints(const T* p, size_t n, char sep, stream& s) {
+    if (n == 0) return;
+    s.reserve(s.size() + n * 21 + 1);  // at most 20 chars for an integer
+    char* const b = s.data();
+    char* q = b + s.size();
+    for (size_t i = 0; i < n; ++i) {
+        q += xx::ntoa(p[i], q);
+        *q++ = sep;
+    }
+    s.resize(q - 1 - b);
+}
+
 }  // namespace fast
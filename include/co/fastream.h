@@ -124,4 +124,78 @@ class __coapi fastream : public fast::stream {
     fastream& operator<<(const std::string& s) { return this->append_nomchk(s.data(), s.size()); }
 
     fastream& operator<<(const fastream& s) { return this->append(s); }
+
+    // format with {} as placeholders, like {fmt}, {{ and }} for { and }
+    //   - fastream s;
+    //     s.fmt("{} + {} = {}", 1, 2, 3);  // s -> "1 + 2 = 3"
+    //   - Memory for the whole output is reserved once before writing.
+    //   - Args are written with operator<<(). Extra args are ignored, and
+    //     placeholders without args are written as they are.
+    template <typename... X>
+    fastream& fmt(const char* f, X&&... x) {
+        const size_t n = strlen(f);
+        this->reserve(_size + n + _fmt_size(x...) + 1);
+        return this->_fmt(f, f + n, std::forward<X>(x)...);
+    }
+
+  private:
+    static size_t _fmt_size() noexcept { return 0; }
+
+    template <typename X, typename... V>
+    static size_t _fmt_size(const X& x, const V&... v) noexcept {
+        return _arg_size(x) + _fmt_size(v...);
+    }
+
+    // max size of an arg written by operator<<(), 32 for unknown types
+    static size_t _arg_size(const char* s) noexcept { return strlen(s); }
+    static size_t _arg_size(const fastring& s) noexcept { return s.size(); }
+    static size_t _arg_size(const std::string& s) noexcept { return s.size(); }
+    static size_t _arg_size(const fastream& s) noexcept { return s.size(); }
+
+    template <typename T>
+    static size_t _arg_size(const T&) noexcept {
+        return 32;
+    }
+
+    // append text in [f, e) until a placeholder, return the position after it,
+    // or nullptr if no placeholder was found.
+    const char* _fmt_text(const char* f, const char* e) {
+        const char* p = f;
+        while (p < e) {
+            if (*p == '{') {
+                if (p + 1 < e && p[1] == '}') {
+                    this->append_nomchk(f, p - f);
+                    return p + 2;
+                }
+                if (p + 1 < e && p[1] == '{') {
+                    this->append_nomchk(f, p + 1 - f);
+                    f = p += 2;
+                    continue;
+                }
+            } else if (*p == '}' && p + 1 < e && p[1] == '}') {
+                this->append_nomchk(f, p + 1 - f);
+                f = p += 2;
+                continue;
+            }
+            ++p;
+        }
+        this->append_nomchk(f, e - f);
+        return nullptr;
+    }
+
+    fastream& _fmt(const char* f, const char* e) {
+        while (f && f < e) {
+            f = this->_fmt_text(f, e);
+            if (f) this->append_nomchk("{}", 2);
+        }
+        return *this;
+    }
+
+    template <typename X, typename... V>
+    fastream& _fmt(const char* f, const char* e, X&& x, V&&... v) {
+        f = this->_fmt_text(f, e);
+        if (!f) return *this;
+        *this << std::forward<X>(x);
+        return this->_fmt(f, e, std::forward<V>(v)...);
+    }
 };
@@ -11,11 +11,15 @@
 
 #include "fast.h"
 #include "hash/murmur_hash.h"
+#include "hash/wyhash.h"
+#include "strview.h"
 
 
 namespace str {
 __coapi char* memrchr(const char* s, char c, size_t n);
 __coapi char* memmem(const char* s, size_t n, const char* p, size_t m);
+// find the first byte in [s, s + n) that is any of the @m bytes in @c
+__coapi char* memany(const char* s, size_t n, const char* c, size_t m);
 __coapi char* memimem(const char* s, size_t n, const char* p, size_t m);
 __coapi char* memrmem(const char* s, size_t n, const char* p, size_t m);
 __coapi bool match(const char* s, size_t n, const char* p, size_t m);
@@ -46,6 +50,8 @@ class __coapi fastring : public fast::stream {
 
     fastring(const std::string& s) : fastring(s.data(), s.size()) {}
 
+    explicit fastring(co::strview s) : fastring(s.data(), s.size()) {}
+
     fastring(const fastring& s) : fastring(s.data(), s.size()) {}
 
     fastring(fastring&& s) noexcept : fast::stream(std::move(s)) {}
@@ -102,6 +108,8 @@ class __coapi fastring : public fast::stream {
 
     fastring& append(const std::string& s) { return this->append_nomchk(s.data(), s.size()); }
 
+    fastring& append(co::strview s) { return this->append(s.data(), s.size()); }
+
     fastring& append(size_t n, char c) { return (fastring&)fast::stream::append(n, c); }
 
     fastring& append(char c) { return (fastring&)fast::stream::append(c); }
@@ -116,6 +124,8 @@ class __coapi fastring : public fast::stream {
 
     fastring& operator+=(const char* s) { return this->append(s); }
 
+    fastring& operator+=(co::strview s) { return this->append(s); }
+
     fastring& operator+=(char c) { return this->append(c); }
 
     fastring& cat() { return *this; }
@@ -172,6 +182,8 @@ class __coapi fastring : public fast::stream {
 
     fastring& operator<<(const std::string& s) { return this->append_nomchk(s.data(), s.size()); }
 
+    fastring& operator<<(co::strview s) { return this->append(s); }
+
     int compare(const char* s, size_t n) const { return str::memcmp(_p, _size, s, n); }
 
     int compare(const char* s) const { return this->compare(s, strlen(s)); }
@@ -673,6 +685,6 @@ inline std::ostream& operator<<(std::ostream& os, const fastring& s) {
 namespace std {
 template <>
 struct hash<fastring> {
-    size_t operator()(const fastring& s) const { return murmur_hash(s.data(), s.size()); }
+    size_t operator()(const fastring& s) const { return (size_t)wyhash(s.data(), s.size()); }
 };
 }  // namespace std
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include "def.h"
 #include "fastring.h"
 #include "vector.h"
@@ -29,6 +31,29 @@ __coapi fastring set_value(const char* name, const fastring& value);
 //   - @new_name should be a literal string, or a value with static life cycle.
 __coapi fastring alias(const char* name, const char* new_name);
 
+// update value of a flag at runtime, it is thread-safe
+//   - The value of a non-string flag is stored atomically, other threads can
+//     read it as a plain variable, without any lock.
+//   - String flags can not be updated at runtime, as other threads may be
+//     using them. An error is returned if the value differs from the current.
+//   - Callbacks added by flag::on_change() are called in the current thread,
+//     if the value has been changed.
+//   - Return an error message, or an empty string on success.
+//   - eg.
+//     flag::update("log_min_level", "2");
+__coapi fastring update(const char* name, const fastring& value);
+
+// add a callback, it will be called after the flag was changed by flag::update()
+// or flag::reload(). It is for flags that have been read at startup.
+__coapi fastring on_change(const char* name, std::function<void()>&& cb);
+
+// parse the config file again, and update flags with flag::update()
+//   - @path: path of the config file, FLG_config by default.
+//   - Unlike flag::parse(), it never exits the program. Flags not found in the
+//     config file are not changed.
+//   - Return error messages, one per line, or an empty string on success.
+__coapi fastring reload(const fastring& path = fastring());
+
 namespace xx {
 __coapi void add_flag(char type, const char* name, const char* value, const char* help,
                       const char* file, int line, void* addr, const char* alias);
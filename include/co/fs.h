@@ -1,10 +1,14 @@
 #pragma once
 
+#include <functional>
+
 #include "def.h"
 #include "fastream.h"
 #include "fastring.h"
 #include "stl.h"
 
+struct iovec;
+
 namespace fs {
 
 __coapi bool exists(const char* path);
@@ -133,10 +137,38 @@ class __coapi file {
 
     void seek(int64_t off, int whence = seek_beg);
 
+    // allocate disk space for the first @n bytes of the file, the size of the
+    // file is not changed. Return false if not supported by the file system.
+    bool preallocate(int64_t n);
+
     size_t read(void* buf, size_t n);
 
     fastring read(size_t n);
 
+    /**
+     * positional read, the file position is not changed
+     *   - It is safe to call pread() and pwrite() on a file in multiple threads or
+     *     coroutines at the same time, e.g. to read disjoint ranges in parallel.
+     *   - NOTE: On windows, the file position is moved by pread() and pwrite().
+     *
+     * @return  bytes read, less than @n if the end of the file was reached or
+     *          an error occurred.
+     */
+    size_t pread(void* buf, size_t n, int64_t off);
+
+    // read @n bytes at offset @off into a fastring
+    fastring pread(size_t n, int64_t off);
+
+    // scatter read at offset @off into @n buffers, return the total bytes read
+    size_t preadv(const struct iovec* iov, int n, int64_t off);
+
+    // positional write, the file position is not changed
+    //   - NOTE: On linux, data is appended to the end in 'a' mode, whatever @off is.
+    size_t pwrite(const void* s, size_t n, int64_t off);
+
+    // gather write at offset @off from @n buffers, return the total bytes written
+    size_t pwritev(const struct iovec* iov, int n, int64_t off);
+
     size_t write(const void* s, size_t n);
 
     inline size_t write(const char* s) { return this->write(s, strlen(s)); }
@@ -151,6 +183,71 @@ class __coapi file {
     void* _p;
 };
 
+// A read-only memory mapping of a whole file, it is unmapped in the destructor.
+//   - The content is used in place through data() and size(), e.g. passed to
+//     json::parse() or str::split(), without being copied into a fastring.
+//   - Advices are hints to the system about how the memory will be accessed,
+//     they may be ignored. hugepage works only where the system supports huge
+//     pages for file mappings.
+//   - An empty file is opened successfully, with data() pointing to "".
+//
+//   fs::mmap_file m("index.json", fs::mmap_file::sequential);
+//   if (m) json::Json x = json::parse(m.data(), m.size());
+class __coapi mmap_file {
+  public:
+    enum advice_t {
+        normal = 0,
+        sequential = 1,  // read from the beginning to the end
+        random = 2,      // read in random order, no read ahead
+        willneed = 4,    // read the file into memory ahead of time
+        hugepage = 8,    // back the mapping with huge pages
+    };
+
+    inline mmap_file() : _p(0), _n(0) {}
+    ~mmap_file() { this->close(); }
+
+    // @adv: advices, combination of advice_t
+    explicit inline mmap_file(const char* path, int adv = normal) : _p(0), _n(0) {
+        this->open(path, adv);
+    }
+
+    explicit inline mmap_file(const fastring& path, int adv = normal)
+        : mmap_file(path.c_str(), adv) {}
+
+    explicit inline mmap_file(const std::string& path, int adv = normal)
+        : mmap_file(path.c_str(), adv) {}
+
+    inline mmap_file(mmap_file&& m) : _p(m._p), _n(m._n) { m._p = 0, m._n = 0; }
+
+    mmap_file(const mmap_file&) = delete;
+    void operator=(const mmap_file&) = delete;
+    void operator=(mmap_file&&) = delete;
+
+    // map the file, the file opened before will be unmapped first
+    bool open(const char* path, int adv = normal);
+    inline bool open(const fastring& path, int adv = normal) { return this->open(path.c_str(), adv); }
+    inline bool open(const std::string& path, int adv = normal) {
+        return this->open(path.c_str(), adv);
+    }
+
+    // unmap the file
+    void close();
+
+    explicit inline operator bool() const { return _p != 0; }
+    inline bool operator!() const { return _p == 0; }
+
+    inline const char* data() const { return _p; }
+    inline size_t size() const { return _n; }
+    inline bool empty() const { return _n == 0; }
+
+    inline const char* begin() const { return _p; }
+    inline const char* end() const { return _p + _n; }
+
+  private:
+    const char* _p;
+    size_t _n;
+};
+
 // open mode:
 //   'a': append       created if not exists
 //   'w': write        created if not exists, truncated if exists
@@ -230,6 +327,87 @@ class __coapi fstream {
     DISALLOW_COPY_AND_ASSIGN(fstream);
 };
 
+// fstream with a write-behind thread, for bulk writing of large files.
+//   - Data is copied into a buffer of @cap bytes. When it is full, it is handed
+//     to a background thread to write, and the caller goes on with another
+//     buffer. The caller blocks only if the writer falls behind.
+//   - flush() waits until all data appended has been written to the file.
+//   - Output of json::Writer or other fastream producers can be appended in
+//     pieces, clear the fastream after each append to keep it small.
+//
+//   fs::async_fstream s("big.json", 'w', 4 << 20);
+//   fastream b;
+//   json::Writer w(b);
+//   w.begin_array();
+//   for (...) { w.value(x); if (b.size() > 4096) { s << b; b.clear(); } }
+//   w.end_array();
+//   s << b;
+//   s.close();
+class __coapi async_fstream {
+  public:
+    explicit async_fstream(size_t cap = 1 << 20);
+
+    async_fstream(const char* path, char mode, size_t cap = 1 << 20);
+
+    async_fstream(const fastring& path, char mode, size_t cap = 1 << 20)
+        : async_fstream(path.c_str(), mode, cap) {}
+
+    async_fstream(const std::string& path, char mode, size_t cap = 1 << 20)
+        : async_fstream(path.c_str(), mode, cap) {}
+
+    ~async_fstream();
+
+    explicit operator bool() const;
+
+    bool operator!() const { return !(bool)*this; }
+
+    // @mode: 'w' or 'a', the same as fstream
+    bool open(const char* path, char mode);
+
+    bool open(const fastring& path, char mode) { return this->open(path.c_str(), mode); }
+
+    bool open(const std::string& path, char mode) { return this->open(path.c_str(), mode); }
+
+    // wait until all data appended has been written to the file
+    void flush();
+
+    // flush, stop the writer thread and close the file
+    void close();
+
+    // n <= cap - size   ->   append
+    // otherwise         ->   hand the buffer to the writer and append
+    async_fstream& append(const void* s, size_t n) {
+        if (_s.size() + n > _cap) this->_submit(s, n);
+        else _s.append(s, n);
+        return *this;
+    }
+
+    async_fstream& operator<<(const char* s) { return this->append(s, strlen(s)); }
+
+    async_fstream& operator<<(const fastring& s) { return this->append(s.data(), s.size()); }
+
+    async_fstream& operator<<(const std::string& s) { return this->append(s.data(), s.size()); }
+
+    async_fstream& operator<<(const fastream& s) { return this->append(s.data(), s.size()); }
+
+    template <typename T>
+    async_fstream& operator<<(T v) {
+        if (_s.size() + 24 > _cap) this->_submit(0, 0);
+        _s << v;
+        return *this;
+    }
+
+  private:
+    void _submit(const void* s, size_t n);
+
+  private:
+    fastream _s;  // the buffer being filled by the caller
+    size_t _cap;
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(async_fstream);
+};
+
 class __coapi dir {
   public:
     inline dir() : _p(0) {}
@@ -257,14 +435,33 @@ class __coapi dir {
     // return all entries
     co::vector<fastring> all() const;
 
+    // type of a directory entry, symbolic links are not followed
+    enum type_t {
+        unknown = 0,
+        regular,
+        directory,
+        symlink,
+        other,
+    };
+
     class iterator {
       public:
         explicit iterator(void* p) : _p(p) {}
         ~iterator() = default;
 
+        // name of the entry
         fastring operator*() const;
         iterator& operator++();
 
+        // type of the entry, it comes with the entry itself, a lstat is needed
+        // only if the file system does not support d_type.
+        type_t type() const;
+
+        bool is_dir() const { return this->type() == directory; }
+
+        // inode number of the entry, 0 on windows
+        uint64_t ino() const;
+
         inline bool operator==(const iterator& it) const { return _p == it._p; }
 
         inline bool operator!=(const iterator& it) const { return !this->operator==(it); }
@@ -280,4 +477,24 @@ class __coapi dir {
     void* _p;
 };
 
+// walk the directory tree under @path, without the type of each entry checked
+// by a stat on most file systems.
+//   - @f(path, type) is called for each entry, @path is the path of the entry.
+//     If it returns false for a directory, the directory will not be entered.
+//   - Symbolic links are not followed.
+//   - If @threads > 1, directories are read in parallel by @threads threads,
+//     @f MUST be thread-safe then, and entries are not in any specific order.
+//
+//   fs::walk("/tmp", [](const fastring& path, fs::dir::type_t t) {
+//       if (t != fs::dir::directory) co::print(path);
+//       return true;
+//   }, 4);
+__coapi void walk(const char* path, const std::function<bool(const fastring&, dir::type_t)>& f,
+                  int threads = 1);
+
+inline void walk(const fastring& path, const std::function<bool(const fastring&, dir::type_t)>& f,
+                 int threads = 1) {
+    walk(path.c_str(), f, threads);
+}
+
 }  // namespace fs
@@ -153,6 +153,37 @@ constexpr bool is_same() {
     return xx::is_same<T, U, X...>::value;
 };
 
+namespace xx {
+template <typename T>
+struct _void {
+    typedef void type;
+};
+
+template <typename T, typename = void>
+struct is_relocatable {
+    static constexpr bool value = std::is_trivially_copyable<T>::value;
+};
+
+template <typename T>
+struct is_relocatable<T, typename _void<typename T::trivially_relocatable>::type> {
+    static constexpr bool value = std::is_trivially_copyable<T>::value ||
+                                  T::trivially_relocatable::value;
+};
+}  // namespace xx
+
+// check if T can be moved to another address by memcpy, without calling the
+// move constructor and the destructor.
+//   - Trivially copyable types are always relocatable.
+//   - A class opts in with a member typedef, if it does not store pointers to
+//     itself (as co::small_string does), nor register its address anywhere:
+//       using trivially_relocatable = std::true_type;
+//   - The typedef is inherited, a derived class that is not relocatable MUST
+//     redefine it as std::false_type.
+template <typename T>
+constexpr bool is_trivially_relocatable() {
+    return xx::is_relocatable<rm_cv_t<T>>::value;
+}
+
 
 }  // namespace god
 
@@ -3,10 +3,13 @@
 #include "def.h"
 #include "hash/base64.h"
 #include "hash/crc16.h"
+#include "hash/crc32c.h"
 #include "hash/md5.h"
 #include "hash/murmur_hash.h"
+#include "hash/sha1.h"
 #include "hash/sha256.h"
 #include "hash/url.h"
+#include "hash/wyhash.h"
 
 /**
  * 64 bit hash
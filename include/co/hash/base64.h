@@ -25,6 +25,39 @@ __coapi fastring base64_encode(const void* s, size_t n);
  */
 __coapi fastring base64_decode(const void* s, size_t n);
 
+// size of the base64 string encoded from @n bytes
+inline size_t base64_encoded_size(size_t n) { return (n + 2) / 3 * 4; }
+
+// max size of the data decoded from a base64 string of @n bytes
+inline size_t base64_decoded_size(size_t n) { return n * 3 >> 2; }
+
+/**
+ * base64 encode into a buffer provided by the caller 
+ *   - AVX2 (detected at runtime) or NEON is used to encode large data.
+ * 
+ * @param s    a pointer to the data to be encoded.
+ * @param n    size of the data.
+ * @param out  the output buffer, it MUST hold base64_encoded_size(n) bytes.
+ *             The result is NOT null-terminated.
+ *
+ * @return     bytes written to @out, the same as base64_encoded_size(n).
+ */
+__coapi size_t base64_encode(const void* s, size_t n, char* out);
+
+/**
+ * base64 decode into a buffer provided by the caller 
+ *   - AVX2 (detected at runtime) or NEON is used to decode large data.
+ * 
+ * @param s    a pointer to the data to be decoded.
+ * @param n    size of the data.
+ * @param out  the output buffer, it MUST hold base64_decoded_size(n) bytes.
+ *             It may be overwritten even if the input is invalid.
+ *
+ * @return     bytes written to @out on success, or (size_t)-1 if the input is not
+ *             a valid base64-encoded string.
+ */
+__coapi size_t base64_decode(const void* s, size_t n, char* out);
+
 inline fastring base64_encode(const char* s) {
     return base64_encode(s, strlen(s));
 }
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../fastring.h"
+
+/**
+ * CRC-32C (Castagnoli), the checksum used by iSCSI, ext4, RocksDB and others
+ *   - SSE4.2 crc32 instructions are used on x86 if the CPU supports it (checked
+ *     at runtime), and ARMv8 crc32c instructions if built with them enabled.
+ *   - It can be computed incrementally, crc32c(b, m, crc32c(a, n)) is the same
+ *     as the checksum of a followed by b.
+ *
+ * @param s    a pointer to the data.
+ * @param n    size of the data.
+ * @param crc  checksum of the data before, 0 for the beginning.
+ */
+__coapi uint32_t crc32c(const void* s, size_t n, uint32_t crc);
+
+inline uint32_t crc32c(const void* s, size_t n) { return crc32c(s, n, 0); }
+
+inline uint32_t crc32c(const char* s) { return crc32c(s, strlen(s)); }
+
+inline uint32_t crc32c(const fastring& s) { return crc32c(s.data(), s.size()); }
+
+inline uint32_t crc32c(const std::string& s) { return crc32c(s.data(), s.size()); }
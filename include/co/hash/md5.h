@@ -59,6 +59,18 @@ inline fastring md5digest(const fastring& s) { return md5digest(s.data(), s.size
 
 inline fastring md5digest(const std::string& s) { return md5digest(s.data(), s.size()); }
 
+/**
+ * md5digest of many inputs at once 
+ *   - The inputs are hashed in parallel lanes with SSE2 or NEON, 4 at a time. It
+ *     is much faster than calling md5digest() one by one for small inputs.
+ *
+ * @param k    number of the inputs.
+ * @param s    pointers to the inputs.
+ * @param n    sizes of the inputs.
+ * @param res  results, res[i] is the 16-byte binary md5 digest of s[i].
+ */
+__coapi void md5digest_n(size_t k, const void* const* s, const size_t* n, char (*res)[16]);
+
 // md5sum, result is stored in @res.
 __coapi void md5sum(const void* s, size_t n, char res[32]);
 
@@ -0,0 +1,57 @@
+/**
+ * sha1.h -- SHA-1 Hash (FIPS 180-4)
+ *   - SHA-1 is NOT secure against collisions, use it only where a protocol
+ *     requires it, e.g. the WebSocket handshake.
+ */
+#pragma once
+
+#include "../fastring.h"
+
+typedef struct {
+    uint32_t state[5];
+    uint64_t count;
+    uint8_t buffer[64];
+} sha1_ctx_t;
+
+__coapi void sha1_init(sha1_ctx_t* ctx);
+__coapi void sha1_update(sha1_ctx_t* ctx, const void* s, size_t n);
+__coapi void sha1_final(sha1_ctx_t* ctx, uint8_t res[20]);
+
+// sha1digest, 20-byte binary string
+inline void sha1digest(const void* s, size_t n, char res[20]) {
+    sha1_ctx_t ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, s, n);
+    sha1_final(&ctx, (uint8_t*)res);
+}
+
+// return a 20-byte binary string
+inline fastring sha1digest(const void* s, size_t n) {
+    fastring x(20);
+    x.resize(20);
+    sha1digest(s, n, &x[0]);
+    return x;
+}
+
+inline fastring sha1digest(const char* s) { return sha1digest(s, strlen(s)); }
+
+inline fastring sha1digest(const fastring& s) { return sha1digest(s.data(), s.size()); }
+
+inline fastring sha1digest(const std::string& s) { return sha1digest(s.data(), s.size()); }
+
+// sha1sum, result is stored in @res.
+__coapi void sha1sum(const void* s, size_t n, char res[40]);
+
+// return a 40-byte string containing only hexadecimal digits.
+inline fastring sha1sum(const void* s, size_t n) {
+    fastring x(40);
+    x.resize(40);
+    sha1sum(s, n, &x[0]);
+    return x;
+}
+
+inline fastring sha1sum(const char* s) { return sha1sum(s, strlen(s)); }
+
+inline fastring sha1sum(const fastring& s) { return sha1sum(s.data(), s.size()); }
+
+inline fastring sha1sum(const std::string& s) { return sha1sum(s.data(), s.size()); }
@@ -30,6 +30,31 @@ __coapi fastring url_encode(const void* s, size_t n);
  */
 __coapi fastring url_decode(const void* s, size_t n);
 
+/**
+ * url encode into a buffer provided by the caller 
+ *
+ * @param s    a pointer to the data to be encoded.
+ * @param n    size of the data.
+ * @param out  the output buffer, it MUST hold 3 * n bytes in the worst case.
+ *             The result is NOT null-terminated.
+ *
+ * @return     bytes written to @out.
+ */
+__coapi size_t url_encode(const void* s, size_t n, char* out);
+
+/**
+ * url decode into a buffer provided by the caller 
+ *   - @out can be the same as @s, to decode in place.
+ *
+ * @param s    a pointer to the data to be decoded.
+ * @param n    size of the data.
+ * @param out  the output buffer, it MUST hold n bytes.
+ *
+ * @return     bytes written to @out on success, or (size_t)-1 if the input is not
+ *             a valid url-encoded string.
+ */
+__coapi size_t url_decode(const void* s, size_t n, char* out);
+
 inline fastring url_encode(const char* s) {
     return url_encode(s, strlen(s));
 }
@@ -0,0 +1,117 @@
+/*
+ * wyhash (final version 4) from https://github.com/wangyi-fudan/wyhash.
+ * Written by Wang Yi, and is released into the public domain (the Unlicense).
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "../def.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+namespace xx {
+namespace wy {
+
+// 64x64 -> 128 bit multiplication, the low half is put in @a and the high in @b
+inline void mum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    const uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    const uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+// bytes are read in the native order, the hash value differs on big endian systems
+inline uint64_t r8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t r4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t r3(const uint8_t* p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace wy
+}  // namespace xx
+
+/**
+ * 64 bit wyhash, it is much faster than murmur hash, especially for short keys,
+ * and passes the SMHasher tests.
+ *
+ * @param s     a pointer to the data, no alignment is required.
+ * @param n     size of the data.
+ * @param seed  the seed, 0 by default.
+ */
+inline uint64_t wyhash(const void* s, size_t n, uint64_t seed = 0) {
+    using namespace xx::wy;
+    static const uint64_t k[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+    };
+    const uint8_t* p = (const uint8_t*)s;
+    seed ^= mix(seed ^ k[0], k[1]);
+    uint64_t a, b;
+    if (n <= 16) {
+        if (n >= 4) {
+            a = (r4(p) << 32) | r4(p + ((n >> 3) << 2));
+            b = (r4(p + n - 4) << 32) | r4(p + n - 4 - ((n >> 3) << 2));
+        } else if (n > 0) {
+            a = r3(p, n);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = n;
+        if (i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = mix(r8(p) ^ k[1], r8(p + 8) ^ seed);
+                s1 = mix(r8(p + 16) ^ k[2], r8(p + 24) ^ s1);
+                s2 = mix(r8(p + 32) ^ k[3], r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = mix(r8(p) ^ k[1], r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = r8(p + i - 16);
+        b = r8(p + i - 8);
+    }
+    a ^= k[1];
+    b ^= seed;
+    mum(&a, &b);
+    return mix(a ^ k[0] ^ n, b ^ k[1]);
+}
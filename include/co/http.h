@@ -4,6 +4,10 @@
 
 #include "fastring.h"
 
+namespace json {
+class Arena;
+}  // namespace json
+
 
 namespace http {
 
@@ -195,17 +199,113 @@ class __coapi Client {
     curl_ctx_t* _ctx;
 };
 
+/**
+ * native HTTP/1.1 client for coroutine programming
+ *   - libcurl is not required, openssl is required for https.
+ *   - Connections are kept alive in a pool for each host, it is shared by all the
+ *     agents to the same host on the same scheduler. An agent takes a connection
+ *     from the pool for each request, and puts it back when the response is done.
+ *   - It MUST be used in coroutine, and an agent SHOULD NOT be shared by coroutines
+ *     running at the same time.
+ *   - NOTE: It will not url-encode the url passed in.
+ *
+ *   - usage:
+ *     http::Agent a("https://github.com");
+ *     int status = a.get("/");
+ *     if (status == 0) LOG << "error: " << a.strerror();
+ */
+class __coapi Agent {
+  public:
+    /**
+     * @param serv_url  server url in a form of "protocol://host:port", the same as
+     *                  http::Client.
+     */
+    explicit Agent(const char* serv_url);
+    ~Agent();
+
+    Agent(const Agent&) = delete;
+    void operator=(const Agent&) = delete;
+
+    // add a HTTP header, it will be sent in all the following requests
+    void add_header(const char* key, const char* val);
+
+    void add_header(const char* key, int val);
+
+    void add_header(co::strview key, co::strview val);
+
+    // remove a header added by add_header(), the key is not case sensitive
+    void remove_header(const char* key);
+
+    /**
+     * perform a HTTP request
+     *   - Content-Length is set by the agent, the user SHOULD NOT add it.
+     *   - A request on a kept-alive connection is retried once on a new connection,
+     *     if the server closed it before sending anything back.
+     *
+     * @param method  GET, HEAD, POST, PUT, DELETE, etc.
+     * @param url     This url will appear in the request line, it MUST begins with '/'.
+     * @param data    body of the request, it is not sent if @size is 0 and the method
+     *                is neither POST nor PUT.
+     *
+     * @return        the response status, or 0 on error, strerror() can be used to
+     *                get the error message then.
+     */
+    int perform(const char* method, const char* url, const void* data, size_t size);
+
+    int get(const char* url) { return this->perform("GET", url, 0, 0); }
+
+    int head(const char* url) { return this->perform("HEAD", url, 0, 0); }
+
+    int post(const char* url, const void* data, size_t size) {
+        return this->perform("POST", url, data, size);
+    }
+
+    int post(const char* url, const char* s) { return this->post(url, s, strlen(s)); }
+
+    int put(const char* url, const void* data, size_t size) {
+        return this->perform("PUT", url, data, size);
+    }
+
+    int del(const char* url, const void* data = 0, size_t size = 0) {
+        return this->perform("DELETE", url, data, size);
+    }
+
+    // status of the current response, 0 if no response was received
+    int status() const;
+
+    // get error message of the current request
+    const char* strerror() const;
+
+    /**
+     * get value of a HTTP header in the current response
+     *   - The result will be an empty string if the header is not found.
+     *
+     * @param key  a null terminated string, non-case sensitive.
+     */
+    const char* header(const char* key) const;
+
+    // get the entire header part of the current response, with the start line
+    const fastring& header() const;
+
+    // get body of the current response, chunked data is decoded
+    const fastring& body() const;
+
+  private:
+    void* _p;
+};
+
 /**
  * ===========================================================================
  * HTTP server
  *   - openssl required for https.
- *   - only support HTTP/1.0 & HTTP/1.1 at this moment.
+ *   - HTTP/2 is supported with prior knowledge, Upgrade: h2c, or ALPN on https.
  * ===========================================================================
  */
 
 enum Version {
     kHTTP10,
     kHTTP11,
+    kHTTP20,
 };
 
 enum Method {
@@ -246,6 +346,40 @@ class __coapi Req {
     // get length of the body
     size_t body_size() const { return ((uint32_t*)_p)[3]; }
 
+    /**
+     * check whether the body is streamed
+     *   - If Content-Length is larger than FLG_http_stream_body_size (when it is 
+     *     not 0), the server calls on_req() once the header was received, and the 
+     *     body MUST be read with read_body(). body() and body_size() are empty then. 
+     */
+    bool is_body_streamed() const;
+
+    // length of a streamed body, or body_size() if the body is not streamed
+    int64_t content_length() const;
+
+    /**
+     * read the next part of a streamed body
+     *   - The part of the body not read in on_req() will be discarded by the server. 
+     *
+     * @param s   buffer to store the data.
+     * @param n   size of the buffer.
+     * @param ms  timeout in milliseconds, default: FLG_http_recv_timeout.
+     *
+     * @return    bytes read, 0 at the end of the body, or -1 on error or timeout.
+     */
+    int read_body(void* s, int n, int ms = -1) const;
+
+    /**
+     * arena for Json documents of this request, e.g.
+     *   json::Json j;
+     *   j.parse_from(req.body(), req.body_size(), req.arena());
+     *   - It is created on the first call, and kept by the connection for the
+     *     following requests. It is cleared after the response was sent, which
+     *     is O(1), see json::Arena.
+     *   - Documents parsed with it MUST NOT be used after on_req() returns.
+     */
+    json::Arena& arena() const;
+
   private:
     http_req_t* _p;
 };
@@ -271,18 +405,193 @@ class __coapi Res {
     // add a header with an integer value
     void add_header(const char* key, int val);
 
+    // add a header from slices of a buffer, or fastrings
+    void add_header(co::strview key, co::strview val);
+
     /**
      * set body of the response
      *   - The body length will be zero if no body was set.
+     *   - If the body is not smaller than FLG_http_compress_size, and the client
+     *     accepts gzip, the body is compressed (zlib required). Bodies of responses
+     *     with an ETag header are kept compressed in a cache of the scheduler.
      */
     void set_body(const void* s, size_t n);
     void set_body(const char* s) { this->set_body(s, strlen(s)); }
     void set_body(const fastring& s) { this->set_body(s.data(), s.size()); }
 
+    /**
+     * send part of the body with chunked transfer encoding
+     *   - The header is sent with the first chunk, with 'Transfer-Encoding: chunked'
+     *     instead of 'Content-Length', set_status() and add_header() MUST be called
+     *     before it. Each chunk is sent when it is written, the response ends when
+     *     on_req() returns. It MUST NOT be mixed with set_body() or set_file().
+     *   - Chunks are buffered and sent as the body after on_req() returns, for
+     *     HTTP/1.0 and HTTP/2 requests.
+     *   - Writing an empty chunk sends the header only.
+     *
+     * @return  false if the connection was broken, on_req() should return then.
+     */
+    bool write_chunk(const void* s, size_t n);
+    bool write_chunk(const char* s) { return this->write_chunk(s, strlen(s)); }
+    bool write_chunk(const fastring& s) { return this->write_chunk(s.data(), s.size()); }
+
+    /**
+     * send part of a file as the body of the response
+     *   - The file is sent with sendfile after the header, it will not be read into 
+     *     the memory. On SSL connections, SSL_sendfile is used if kernel TLS is enabled. 
+     *   - It replaces set_body(), 'Content-Length' will be set to the length of the part. 
+     *
+     * @param path  path of a regular file.
+     * @param off   offset in the file to start from, default: 0.
+     * @param len   bytes to be sent, -1 for the rest of the file, default: -1.
+     *
+     * @return      false if the file can't be opened or off is beyond the end of the file.
+     */
+    bool set_file(const char* path, int64_t off = 0, int64_t len = -1);
+
   private:
     http_res_t* _p;
 };
 
+/**
+ * path parameters of a request matched by a route, see Server::route()
+ *   - Values are views into the url of the request, no memory is allocated. They
+ *     MUST NOT be used after the handler returns.
+ *
+ *   - usage:
+ *     serv.route(http::kGet, "/users/:id", [](const Req& req, Res& res, const Params& ps) {
+ *         co::strview id = ps["id"];
+ *     });
+ */
+class Params {
+  public:
+    static const int kMaxParams = 8;
+
+    Params() : _n(0) {}
+
+    // number of parameters
+    int size() const { return _n; }
+
+    // name and value of the i-th parameter, in the order of the pattern
+    co::strview name(int i) const { return _names[i]; }
+    co::strview value(int i) const { return _vals[i]; }
+
+    // value of the parameter @name, or an empty view if it is not found
+    co::strview operator[](co::strview name) const {
+        for (int i = 0; i < _n; ++i) {
+            if (_names[i] == name) return _vals[i];
+        }
+        return co::strview();
+    }
+
+  private:
+    friend class Router;
+    co::strview _names[kMaxParams];
+    co::strview _vals[kMaxParams];
+    int _n;
+};
+
+/**
+ * a WebSocket connection accepted by http::Server, see Server::websocket()
+ *   - It is a reference counted handle, copies refer to the same connection.
+ *     It may be kept after the handler returns, send() just fails then.
+ *   - send() is thread-safe, the message is queued and written by a coroutine
+ *     of the connection. recv() MUST be called only in the handler.
+ *   - The connection is closed when the handler returns.
+ */
+class __coapi WebSocket {
+  public:
+    enum Opcode {
+        kText = 1,
+        kBinary = 2,
+    };
+
+    WebSocket() : _p(0) {}
+    WebSocket(const WebSocket& ws);
+    WebSocket& operator=(const WebSocket& ws);
+    ~WebSocket();
+
+    /**
+     * send a message
+     *   - Connections whose messages are queued for more than
+     *     FLG_http_ws_max_queue_size bytes are closed, as a peer can't keep up.
+     *
+     * @return  false if the connection was closed.
+     */
+    bool send(const void* s, size_t n, Opcode op = kText);
+
+    bool send(const char* s) { return this->send(s, strlen(s)); }
+
+    bool send(const fastring& s, Opcode op = kText) { return this->send(s.data(), s.size(), op); }
+
+    /**
+     * receive a message
+     *   - Ping frames are answered automatically, fragmented messages are joined.
+     *
+     * @param msg  the message, it will be cleared first.
+     * @param ms   timeout in milliseconds, -1 for never timeout.
+     *
+     * @return     kText or kBinary, 0 if the connection was closed, or -1 on
+     *             error or timeout.
+     */
+    int recv(fastring& msg, int ms = -1);
+
+    /**
+     * close the connection with a close frame
+     *
+     * @param code  the status code in the close frame, default: 1000 (normal).
+     */
+    void close(uint16_t code = 1000);
+
+    // the connection was closed, or not accepted yet
+    bool closed() const;
+
+  private:
+    friend class Broadcaster;
+    void* _p;
+};
+
+/**
+ * send a message to many WebSocket connections
+ *   - The frame is built once and shared by the queues of all subscribers.
+ *   - It is thread-safe. Closed connections are removed by send().
+ *
+ *   - usage:
+ *     http::Broadcaster bc;
+ *     serv.websocket("/live", [&](const http::Req&, http::WebSocket& ws) {
+ *         bc.add(ws);
+ *         fastring msg;
+ *         while (ws.recv(msg) > 0);
+ *         bc.del(ws);
+ *     });
+ *     bc.send(stats.str());  // in another coroutine or thread
+ */
+class __coapi Broadcaster {
+  public:
+    Broadcaster();
+    ~Broadcaster();
+
+    void add(const WebSocket& ws);
+    void del(const WebSocket& ws);
+
+    // send a message to all subscribers, return the number of them it was queued to
+    size_t send(const void* s, size_t n, WebSocket::Opcode op = WebSocket::kText);
+
+    size_t send(const char* s) { return this->send(s, strlen(s)); }
+
+    size_t send(const fastring& s, WebSocket::Opcode op = WebSocket::kText) {
+        return this->send(s.data(), s.size(), op);
+    }
+
+    // number of subscribers
+    size_t size() const;
+
+  private:
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(Broadcaster);
+};
+
 /**
  * http server based on coroutine
  *   - support both http and https, openssl required for https.
@@ -318,6 +627,71 @@ class __coapi Server {
         return on_req(std::bind(f, o, std::placeholders::_1, std::placeholders::_2));
     }
 
+    typedef std::function<void(const Req&, Res&, const Params&)> Handler;
+
+    /**
+     * add a route for requests of method @m with a path matching @pattern
+     *   - A pattern is made of segments separated by '/'. "users" matches the same
+     *     segment, ":id" matches any segment, and "*path" as the last segment
+     *     matches the rest of the path, e.g. "*path" after "/users/:id/files"
+     *     matches "a/b.txt" of "/users/1/files/a/b.txt".
+     *   - Routes are compiled into a tree of segments, requests are matched without
+     *     allocating memory. Literal segments are preferred to parameters, and
+     *     parameters to the rest of the path. Empty segments and the query string
+     *     are ignored.
+     *   - HEAD requests are handled by GET routes if there are no HEAD routes. 405
+     *     is responded if the path matches but the method not. Requests matching
+     *     no route are passed to the callback set by on_req(), or 404 is responded
+     *     if it was not set.
+     *   - It MUST be called before start().
+     */
+    Server& route(Method m, const char* pattern, Handler&& f);
+
+    Server& route(Method m, const char* pattern, const Handler& f) {
+        return this->route(m, pattern, Handler(f));
+    }
+
+    /**
+     * cache responses in front of the routes and the callback set by on_req()
+     *   - GET requests are cached by the url and the values of the @vary headers.
+     *     HEAD requests are served from the cache, but never fill it.
+     *   - Requests with Authorization or Cookie go to the handler directly, unless
+     *     the header is in @vary, as their responses may be for the user only.
+     *   - Only responses of status 200 with a body set by set_body(), no larger
+     *     than 1M, are cached. Responses with Set-Cookie, or Cache-Control of
+     *     no-store, no-cache or private are not, and requests for the same key
+     *     go to the handler directly for @ttl_ms then.
+     *   - An entry is fresh for @ttl_ms, and served stale for @stale_ms more, while
+     *     a coroutine calls the handler again in the background. The request it
+     *     passes has only the url and the @vary headers.
+     *   - When an entry is missing, one request calls the handler, and others for
+     *     the same key wait for its response.
+     *   - It MUST be called before start().
+     *
+     * @param ttl_ms    time in milliseconds an entry is fresh.
+     * @param stale_ms  time in milliseconds an entry is served stale after @ttl_ms.
+     * @param vary      names of headers in the key, separated by ',', e.g. "Host,Accept-Language".
+     * @param capacity  max number of urls cached, default: 4096.
+     */
+    Server& cache(uint32_t ttl_ms, uint32_t stale_ms = 0, const char* vary = "",
+                  size_t capacity = 4096);
+
+    typedef std::function<void(const Req&, WebSocket&)> WsHandler;
+
+    /**
+     * accept WebSocket connections on @path
+     *   - GET requests to @path with "Upgrade: websocket" are upgraded, and @f
+     *     runs on the coroutine of the connection until it returns. Other
+     *     requests to @path go to routes and on_req() as usual.
+     *   - The query string is ignored when matching @path.
+     *   - It MUST be called before start().
+     */
+    Server& websocket(const char* path, WsHandler&& f);
+
+    Server& websocket(const char* path, const WsHandler& f) {
+        return this->websocket(path, WsHandler(f));
+    }
+
     /**
      * start a http server
      *   - It will not block the calling thread.
@@ -332,7 +706,8 @@ class __coapi Server {
      *   - openssl required by this method.
      *   - It will not block the calling thread.
      *
-     * @param ip    server ip, either an ipv4 or ipv6 address.
+     * @param ip    server ip, either an ipv4 or ipv6 address, or "unix:/path" for
+     *              a unix domain socket.
      * @param port  server port.
      * @param key   path of the private key file for ssl.
      * @param ca    path of the certificate file for ssl.
@@ -353,6 +728,30 @@ class __coapi Server {
     DISALLOW_COPY_AND_ASSIGN(Server);
 };
 
+/**
+ * serve metrics for GET /metrics in the Prometheus text format, call it in on_req()
+ *   - See co::metrics::text(). The server itself records co_http_server_request_us
+ *     and co_http_server_responses_total.
+ *
+ * @return  true if the request was handled, false if the url does not match.
+ */
+__coapi bool serve_metrics(const Req& req, Res& res);
+
+/**
+ * serve a cpu profile for GET /debug/pprof/profile?seconds=N, call it in on_req()
+ *   - It profiles the process for N seconds (30 by default) with co::cpu_profile(),
+ *     and responds 503 if another profile is in progress.
+ *
+ *   serv.on_req([](const http::Req& req, http::Res& res) {
+ *       if (http::serve_pprof(req, res)) return;
+ *       ...
+ *   });
+ *   go tool pprof http://127.0.0.1/debug/pprof/profile?seconds=10
+ *
+ * @return  true if the request was handled, false if the url does not match.
+ */
+__coapi bool serve_pprof(const Req& req, Res& res);
+
 }  // namespace http
 
 namespace so {
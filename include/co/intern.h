@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string.h>
+
+#include "def.h"
+#include "strview.h"
+
+namespace co {
+
+// An interned string. Equal strings are interned to the same object, so they can
+// be compared by pointer, and the hash need not be computed again.
+struct interned {
+    const char* s;  // null-terminated, valid until the program exits
+    uint32_t n;     // length of s
+    uint32_t h;     // FNV-1a hash of s, the same as json::Key::hash()
+};
+
+// intern a string (thread-safe)
+//   - The string is copied only the first time it is interned, and it is never
+//     freed, do not intern strings made from untrusted input without a bound.
+//   - A string already interned is found without any lock.
+__coapi interned intern(const char* s, size_t n);
+
+inline interned intern(const char* s) { return intern(s, strlen(s)); }
+
+inline interned intern(co::strview s) { return intern(s.data(), s.size()); }
+
+// number of strings interned so far
+__coapi size_t interned_count();
+
+}  // namespace co
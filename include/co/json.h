@@ -4,10 +4,13 @@
 #pragma warning(disable : 4200)
 #endif
 
+#include <functional>
 #include <initializer_list>
 
 #include "fastream.h"
+#include "intern.h"
 #include "str.h"
+#include "vector.h"
 
 namespace json {
 namespace xx {
@@ -18,6 +21,7 @@ class Array {
     struct _H {
         uint32_t cap;
         uint32_t size;
+        void* index;  // hash index of an object, freed with the array
         T p[];
     };
 
@@ -28,16 +32,21 @@ class Array {
         _h = (_H*)::malloc(N * (R + cap));
         _h->cap = cap;
         _h->size = 0;
+        _h->index = 0;
     }
 
     Array() : Array(1024 - R) {}
 
-    ~Array() { ::free(_h); }
+    ~Array() {
+        ::free(_h->index);
+        ::free(_h);
+    }
 
     T* data() const { return _h->p; }
     uint32_t size() const { return _h->size; }
     bool empty() const { return this->size() == 0; }
     void resize(uint32_t n) { _h->size = n; }
+    void*& index() const { return _h->index; }
 
     T& back() const { return _h->p[this->size() - 1]; }
     T& operator[](uint32_t i) const { return _h->p[i]; }
@@ -90,13 +99,54 @@ class Array {
     _H* _h;
 };
 
+// Objects with this many members or more are indexed by a hash table of the
+// keys, smaller ones are searched linearly.
+static const uint32_t kIndexMin = 32;
+
+// add the last member of an object to its index, build the index if necessary
+__coapi void index_add(Array& a);
+
 __coapi void* alloc();
 __coapi char* alloc_string(const void* p, size_t n);
 
 }  // namespace xx
 
+// A key with its length and hash computed at compile time, see operator""_jk.
+//   - Members of a large object are found through the hash index of the object
+//     without hashing the key again, and keys are compared only if the hashes
+//     are equal. Members of a small object are compared with the length known.
+struct Key {
+    constexpr Key(const char* s, size_t n) : s(s), n((uint32_t)n), h(hash(s, n, 2166136261u)) {}
+
+    // a key made at runtime, e.g. json::Key(co::intern(name)), is hashed only once
+    Key(const co::interned& k) noexcept : s(k.s), n(k.n), h(k.h) {}
+
+    // FNV-1a, the same as the hash of keys in the index of an object
+    static constexpr uint32_t hash(const char* s, size_t n, uint32_t h) {
+        return n == 0 ? h : hash(s + 1, n - 1, (h ^ (uint8_t)*s) * 16777619u);
+    }
+
+    const char* s;  // null-terminated
+    uint32_t n;
+    uint32_t h;
+};
+
+namespace literals {
+
+// make a json::Key at compile time, e.g.
+//   using namespace json::literals;
+//   int64_t t = x.get("timestamp"_jk).as_int64();
+constexpr Key operator""_jk(const char* s, size_t n) { return Key(s, n); }
+
+}  // namespace literals
+
+class Arena;
+class Path;
+
 class __coapi Json {
   public:
+    using trivially_relocatable = std::true_type;
+
     enum {
         t_null = 0,
         t_bool = 1,
@@ -105,6 +155,8 @@ class __coapi Json {
         t_string = 8,
         t_array = 16,
         t_object = 32,
+        t_arena = 256,    // not a type, set on nodes allocated from an Arena
+        t_shared = 1024,  // not a type, set on nodes of a tree made by share()
     };
 
     struct _obj_t {};
@@ -123,7 +175,7 @@ class __coapi Json {
         }
 
         uint32_t type;
-        uint32_t size;  // size of string
+        uint32_t size;  // size of string, or reference count of a shared node
         union {
             bool b;     // for bool
             int64_t i;  // for int
@@ -156,13 +208,24 @@ class __coapi Json {
     // after this operation, v will be moved and becomes null
     Json& operator=(Json& v) { return this->operator=(std::move(v)); }
 
-    // make a duplicate
+    // make a duplicate, it is O(1) for an object or array in a shared tree.
     Json dup() const {
         Json r;
         r._h = (_H*)this->_dup();
         return r;
     }
 
+    // Make the tree shared and read-only, then dup() shares the nodes instead of
+    // copying them. Shared nodes are reference counted, the last owner frees them.
+    //   - An object or array is copied before it is modified, its members are not.
+    //   - Read it with get() or at(), members returned by them must not be modified.
+    //     Modify it with operator[] or set(), which copy the objects and arrays on
+    //     the path, as they return references that may be written.
+    //   - Copies of a shared tree can be used by different threads, while a Json
+    //     itself should not be used by multiple threads concurrently.
+    Json& share();
+    bool is_shared() const { return _h && (_h->type & t_shared); }
+
     Json(bool v) : _h(new(xx::alloc()) _H(v)) {}
     Json(double v) : _h(new(xx::alloc()) _H(v)) {}
     Json(int64_t v) : _h(new(xx::alloc()) _H(v)) {}
@@ -182,7 +245,7 @@ class __coapi Json {
     // make Json from initializer_list
     Json(std::initializer_list<Json> v);
 
-    int type() const { return _h ? _h->type : t_null; }
+    int type() const { return _h ? (_h->type & 0xff) : t_null; }
     bool is_null() const { return _h == 0; }
     bool is_bool() const { return _h && (_h->type & t_bool); }
     bool is_int() const { return _h && (_h->type & t_int); }
@@ -197,7 +260,7 @@ class __coapi Json {
     //   - other non-bool types, -> false
     bool as_bool() const {
         if (_h) {
-            switch (_h->type) {
+            switch (_h->type & 0xff) {
                 case t_bool:
                     return _h->b;
                 case t_int:
@@ -217,7 +280,7 @@ class __coapi Json {
     //   - other non-int types, -> 0
     int64_t as_int64() const {
         if (_h) {
-            switch (_h->type) {
+            switch (_h->type & 0xff) {
                 case t_int:
                     return _h->i;
                 case t_string:
@@ -240,7 +303,7 @@ class __coapi Json {
     //   - other non-double types, -> 0
     double as_double() const {
         if (_h) {
-            switch (_h->type) {
+            switch (_h->type & 0xff) {
                 case t_double:
                     return _h->d;
                 case t_int:
@@ -271,14 +334,26 @@ class __coapi Json {
     Json& get() const { return *(Json*)this; }
     Json& get(uint32_t i) const;
     Json& get(int i) const { return this->get((uint32_t)i); }
-    Json& get(const char* key) const;
+    Json& get(const char* key) const { return this->get(co::strview(key)); }
+
+    // the key can be a slice of a buffer, or a fastring, with no strlen() or copy.
+    Json& get(co::strview key) const;
 
-    template <class T, class... X>
-    inline Json& get(T&& v, X&&... x) const {
+    // get member by a key made at compile time, e.g. x.get("id"_jk)
+    Json& get(const Key& key) const;
+
+    template <class T, class U, class... X>
+    inline Json& get(T&& v, U&& u, X&&... x) const {
         auto& r = this->get(std::forward<T>(v));
-        return r.is_null() ? r : r.get(std::forward<X>(x)...);
+        return r.is_null() ? r : r.get(std::forward<U>(u), std::forward<X>(x)...);
     }
 
+    // get Json by a compiled path, see json::Path.
+    //   - It is a read-only operation like get().
+    //   - If the path does not exist, or it is not valid, the return value is
+    //     a reference to a null object.
+    Json& at(const Path& path) const;
+
     // set value for Json.
     //   - The last parameter is the value, other parameters are index or key.
     //   - eg.
@@ -299,6 +374,7 @@ class __coapi Json {
     // if the Json calling this method is not an array, it will be reset to an array.
     Json& push_back(Json&& v) {
         if (_h && (_h->type & t_array)) {
+            if (unlikely(_h->type & (t_arena | t_shared))) this->_cow();
             if (unlikely(!_h->p)) new (&_h->p) xx::Array(8);
         } else {
             this->reset();
@@ -316,6 +392,7 @@ class __coapi Json {
     // the last element will be moved to the ith place
     void remove(uint32_t i) {
         if (this->is_array() && i < this->array_size()) {
+            if (unlikely(_h->type & (t_arena | t_shared))) this->_cow();
             ((Json&)_array()[i]).reset();
             _array().remove(i);
         }
@@ -327,6 +404,7 @@ class __coapi Json {
     // erase the ith element from an array
     void erase(uint32_t i) {
         if (this->is_array() && i < this->array_size()) {
+            if (unlikely(_h->type & (t_arena | t_shared))) this->_cow();
             ((Json&)_array()[i]).reset();
             _array().erase(i);
         }
@@ -338,6 +416,7 @@ class __coapi Json {
     // it is better to use get() instead of this method.
     Json& operator[](uint32_t i) const {
         assert(this->is_array() && !_array().empty());
+        if (unlikely(_h->type & t_shared)) ((Json*)this)->_unshare();
         return (Json&)_array()[i];
     }
 
@@ -367,7 +446,7 @@ class __coapi Json {
     // for other types, return 0.
     uint32_t size() const {
         if (_h) {
-            switch (_h->type) {
+            switch (_h->type & 0xff) {
                 case t_array:
                     return _h->p ? _array().size() : 0;
                 case t_object:
@@ -401,6 +480,7 @@ class __coapi Json {
     // if the Json calling this method is not an object, it will be reset to an object.
     Json& add_member(const char* key, Json&& v) {
         if (_h && (_h->type & t_object)) {
+            if (unlikely(_h->type & (t_arena | t_shared))) this->_cow();
             if (unlikely(!_h->p)) new (&_h->p) xx::Array(16);
         } else {
             this->reset();
@@ -410,6 +490,7 @@ class __coapi Json {
         _array().push_back(xx::alloc_string(key, strlen(key)));  // key
         _array().push_back(v._h);
         v._h = 0;
+        if (_array().size() >= (xx::kIndexMin << 1)) xx::index_add(_array());
         return *this;
     }
 
@@ -418,10 +499,14 @@ class __coapi Json {
         return *this;
     }
 
-    bool has_member(const char* key) const;
+    bool has_member(const char* key) const { return this->has_member(co::strview(key)); }
+    bool has_member(co::strview key) const;
+    bool has_member(const Key& key) const;
 
     // it is better to use get(key) instead of this method.
-    Json& operator[](const char* key) const;
+    Json& operator[](const char* key) const { return this->operator[](co::strview(key)); }
+    Json& operator[](co::strview key) const;
+    Json& operator[](const Key& key) const;
 
     class iterator {
       public:
@@ -461,7 +546,7 @@ class __coapi Json {
         if (_h && _h->p && (_h->type & (t_array | t_object))) {
             static_assert(t_array == 16 && t_object == 32, "");
             auto& a = _array();
-            return iterator(a.data(), a.data() + a.size(), _h->type >> 4);
+            return iterator(a.data(), a.data() + a.size(), (_h->type & 0xff) >> 4);
         }
         return iterator(0, 0, 0);
     }
@@ -508,6 +593,31 @@ class __coapi Json {
     bool parse_from(const fastring& s) { return this->parse_from(s.data(), s.size()); }
     bool parse_from(const std::string& s) { return this->parse_from(s.data(), s.size()); }
 
+    // Parse Json from string, nodes and strings are allocated from the arena @a.
+    bool parse_from(const char* s, size_t n, Arena& a);
+
+    // Parse Json from string in place, nodes are allocated from the arena @a.
+    // Strings and keys are unescaped and null-terminated in @s, which the nodes
+    // point to. @s is modified even if it fails, and it must outlive the Json.
+    bool parse_insitu(char* s, size_t n, Arena& a);
+
+    // Serialize to MessagePack, a compact binary format.
+    //   - The binary data is appended to s.
+    //   - Integers are packed in the fewest bytes, doubles as float64.
+    fastream& pack(fastream& s) const { return this->_json2pack(s); }
+    fastring& pack(fastring& s) const { return (fastring&)this->pack((fastream&)s); }
+    fastring pack() const {
+        fastring s(256);
+        this->pack(s);
+        return s;
+    }
+
+    // Unpack Json from MessagePack data, inverse to pack().
+    //   - bin is unpacked as string, float32 as double.
+    //   - ext types and non-string keys are not supported.
+    bool unpack_from(const void* p, size_t n);
+    bool unpack_from(const fastring& s) { return this->unpack_from(s.data(), s.size()); }
+
     void reset();
     void swap(Json& v) noexcept {
         auto h = _h;
@@ -523,8 +633,15 @@ class __coapi Json {
     Json& _set(uint32_t i);
     Json& _set(int i) { return this->_set((uint32_t)i); }
     Json& _set(const char* key);
+    Json& _set(const Key& key) { return this->_set(key.s); }
+    void _unarena();
+    void _arena_reset();
+    void _unshare();
+    void _cow() { (_h->type & t_arena) ? this->_unarena() : this->_unshare(); }
     fastream& _json2str(fastream& fs, bool debug, int mdp) const;
     fastream& _json2pretty(fastream& fs, int indent, int n, int mdp) const;
+    fastream& _json2pack(fastream& fs) const;
+    friend class Writer;
 
   private:
     _H* _h;
@@ -553,6 +670,538 @@ inline Json parse(const char* s) { return parse(s, strlen(s)); }
 inline Json parse(const fastring& s) { return parse(s.data(), s.size()); }
 inline Json parse(const std::string& s) { return parse(s.data(), s.size()); }
 
+// Arena for request-scoped documents.
+//   - Nodes and strings of documents parsed with an arena are allocated in large
+//     chunks, which are released at once by clear() or the destructor.
+//   - Resetting or destroying such a Json frees nothing and is safe on any
+//     thread. It is O(1), unless the documents were modified or have null
+//     values, then the tree is walked to free the values not in the arena.
+//   - A modified object or array is moved out of the arena, its members are not.
+//   - Members moved out of a document should be reset before the document.
+//   - The documents must not be used after the arena was cleared.
+//   - An arena should not be used for parsing by multiple threads concurrently.
+class __coapi Arena {
+  public:
+    Arena();
+    ~Arena();
+
+    // release all documents parsed with this arena, the first chunk is kept
+    void clear();
+
+  private:
+    void* _p;
+    friend class Json;
+    DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// A compiled JSON Pointer (RFC 6901), e.g. "/a/b/3/c".
+//   - The pointer is split and unescaped ("~1" for '/', "~0" for '~') once, and
+//     the keys are hashed once. Json::at() looks up large objects through their
+//     hash index without hashing the keys again.
+//   - A segment of digits is an index for arrays, and a key for objects.
+//   - An empty pointer refers to the whole document.
+//   - e.g.
+//     json::Path p("/a/b/3/c");
+//     int x = j.at(p).as_int();  // j["a"]["b"][3]["c"]
+class __coapi Path {
+  public:
+    Path() : _ok(true) {}
+    Path(const char* s, size_t n) { _ok = this->_parse(s, n); }
+    explicit Path(const char* s) : Path(s, strlen(s)) {}
+    explicit Path(const fastring& s) : Path(s.data(), s.size()) {}
+    explicit Path(const std::string& s) : Path(s.data(), s.size()) {}
+    ~Path() = default;
+
+    // false if the pointer does not start with '/', or has a bad escape
+    bool valid() const { return _ok; }
+
+    // number of segments
+    size_t size() const { return _segs.size(); }
+
+  private:
+    struct seg_t {
+        uint32_t key;    // offset of the key in _keys
+        uint32_t hash;   // hash of the key
+        uint32_t index;  // the key as an array index, or -1 if it is not one
+    };
+
+    bool _parse(const char* s, size_t n);
+
+  private:
+    fastring _keys;  // keys ending with '\0'
+    co::vector<seg_t> _segs;
+    bool _ok;
+    friend class Json;
+};
+
+inline Json parse(const char* s, size_t n, Arena& a) {
+    Json r;
+    if (r.parse_from(s, n, a)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json parse(const fastring& s, Arena& a) { return parse(s.data(), s.size(), a); }
+
+// parse json in place, see Json::parse_insitu()
+inline Json parse_insitu(char* s, size_t n, Arena& a) {
+    Json r;
+    if (r.parse_insitu(s, n, a)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json unpack(const void* p, size_t n) {
+    Json r;
+    if (r.unpack_from(p, n)) return r;
+    r.reset();
+    return r;
+}
+
+inline Json unpack(const fastring& s) { return unpack(s.data(), s.size()); }
+
+// Write json to a fastream directly, without building a Json.
+//   - Commas, colons, and newlines and indents for pretty output, are added by
+//     the Writer. The caller must match the begin and end calls, and call key()
+//     before each value in an object.
+//   - The output is the same as Json::str() or Json::pretty().
+//   - e.g.
+//     fastream s;
+//     json::Writer w(s);
+//     w.begin_object();
+//     w.key("id").value(3);
+//     w.key("tags").begin_array().value("a").value("b").end_array();
+//     w.end_object();  // s: {"id":3,"tags":["a","b"]}
+class __coapi Writer {
+  public:
+    // @pretty: indent with 4 spaces like Json::pretty()
+    // @mdp:    max decimal places of doubles like Json::str()
+    explicit Writer(fastream& s, bool pretty = false, int mdp = 16)
+        : _s(s), _mdp(mdp), _n(0), _pretty(pretty), _first(true), _key(false) {}
+
+    explicit Writer(fastring& s, bool pretty = false, int mdp = 16)
+        : Writer((fastream&)s, pretty, mdp) {}
+
+    ~Writer() = default;
+
+    Writer& begin_object() {
+        this->_sep();
+        _s.append('{');
+        return this->_begin();
+    }
+
+    Writer& begin_array() {
+        this->_sep();
+        _s.append('[');
+        return this->_begin();
+    }
+
+    Writer& end_object() { return this->_end('}'); }
+    Writer& end_array() { return this->_end(']'); }
+
+    Writer& key(const char* s, size_t n);
+    Writer& key(const char* s) { return this->key(s, strlen(s)); }
+    Writer& key(const fastring& s) { return this->key(s.data(), s.size()); }
+    Writer& key(const std::string& s) { return this->key(s.data(), s.size()); }
+
+    Writer& null() {
+        this->_sep();
+        _s.append("null", 4);
+        return *this;
+    }
+
+    Writer& value(decltype(nullptr)) { return this->null(); }
+
+    Writer& value(bool v) {
+        this->_sep();
+        _s << v;
+        return *this;
+    }
+
+    Writer& value(int64_t v) {
+        this->_sep();
+        _s << v;
+        return *this;
+    }
+
+    Writer& value(int32_t v) { return this->value((int64_t)v); }
+    Writer& value(uint32_t v) { return this->value((int64_t)v); }
+    Writer& value(uint64_t v) { return this->value((int64_t)v); }
+
+    Writer& value(double v) {
+        this->_sep();
+        _s << dp::_n(v, _mdp);
+        return *this;
+    }
+
+    // a string, it is escaped
+    Writer& value(const char* s, size_t n);
+    Writer& value(const char* s) { return this->value(s, strlen(s)); }
+    Writer& value(const fastring& s) { return this->value(s.data(), s.size()); }
+    Writer& value(const std::string& s) { return this->value(s.data(), s.size()); }
+
+    // a Json built elsewhere
+    Writer& value(const Json& v);
+
+    template <class T>
+    Writer& member(const char* k, T&& v) {
+        return this->key(k).value(std::forward<T>(v));
+    }
+
+  private:
+    // the separator before a key or value
+    void _sep() {
+        if (_key) {
+            _key = false;
+            return;
+        }
+        if (!_first) _s.append(',');
+        _first = false;
+        if (_pretty && _n > 0) _s.append('\n').append(_n * 4, ' ');
+    }
+
+    Writer& _begin() {
+        ++_n;
+        _first = true;
+        return *this;
+    }
+
+    Writer& _end(char c) {
+        --_n;
+        if (_pretty && !_first) _s.append('\n').append(_n * 4, ' ');
+        _s.append(c);
+        _first = false;
+        return *this;
+    }
+
+  private:
+    fastream& _s;
+    int _mdp;
+    int _n;  // depth of objects and arrays
+    bool _pretty;
+    bool _first;  // no value was written in the current object or array
+    bool _key;    // a key was written, the value follows
+};
+
+// Lazy json, for reading a few values from a large document.
+//   - parse() builds an index of the brackets, colons, commas and strings of the
+//     text, it checks only that strings are terminated and brackets are matched.
+//   - A Cursor finds a value by skipping over the index, a value is parsed only
+//     when it is read. Errors in the parts not read are not detected.
+//   - The text must outlive the Lazy, and Cursors must not outlive the Lazy.
+//   - e.g.
+//     json::Lazy x;
+//     if (x.parse(s)) {
+//         int64_t id = x.get("user", "id").as_int64();
+//         Json tags = x.get("user", "tags").to_json();
+//     }
+class __coapi Lazy {
+  public:
+    class __coapi Cursor {
+      public:
+        Cursor() noexcept : _d(0), _p(0), _t(0) {}
+        Cursor(const void* d, uint32_t p, uint32_t t) noexcept : _d(d), _p(p), _t(t) {}
+
+        // false if the value was not found
+        bool exists() const { return _d != 0; }
+
+        // type of the value like Json::type(), t_null if not found
+        int type() const;
+        bool is_null() const { return this->type() == Json::t_null; }
+        bool is_bool() const { return this->type() == Json::t_bool; }
+        bool is_int() const { return this->type() == Json::t_int; }
+        bool is_double() const { return this->type() == Json::t_double; }
+        bool is_string() const { return this->type() == Json::t_string; }
+        bool is_array() const { return this->type() == Json::t_array; }
+        bool is_object() const { return this->type() == Json::t_object; }
+
+        // the ith element of an array, or value of the key in an object
+        Cursor get(uint32_t i) const;
+        Cursor get(int i) const { return this->get((uint32_t)i); }
+        Cursor get(const char* key) const;
+
+        template <class T, class... X>
+        inline Cursor get(T&& v, X&&... x) const {
+            const Cursor r = this->get(std::forward<T>(v));
+            return r.exists() ? r.get(std::forward<X>(x)...) : r;
+        }
+
+        Cursor operator[](uint32_t i) const { return this->get(i); }
+        Cursor operator[](int i) const { return this->get((uint32_t)i); }
+        Cursor operator[](const char* key) const { return this->get(key); }
+
+        // number of elements of an array or members of an object, 0 for others
+        uint32_t size() const;
+
+        // the value is parsed, and converted like Json::as_xxx()
+        bool as_bool() const { return this->to_json().as_bool(); }
+        int64_t as_int64() const { return this->to_json().as_int64(); }
+        int as_int() const { return (int)this->as_int64(); }
+        double as_double() const { return this->to_json().as_double(); }
+        fastring as_string() const;
+
+        // the text of the value
+        fastring raw() const;
+
+        // parse the value to a Json
+        Json to_json() const;
+
+      private:
+        uint32_t _end() const;
+
+        const void* _d;  // the index
+        uint32_t _p;     // position of the value in the text
+        uint32_t _t;     // index of the first entry at or after _p
+    };
+
+    Lazy() noexcept : _p(0) {}
+    ~Lazy();
+
+    // build the index, return false if the text is not valid
+    bool parse(const char* s, size_t n);
+    bool parse(const char* s) { return this->parse(s, strlen(s)); }
+    bool parse(const fastring& s) { return this->parse(s.data(), s.size()); }
+
+    // the root value, it does not exist if parse() failed
+    Cursor root() const;
+
+    template <class... X>
+    inline Cursor get(X&&... x) const {
+        return this->root().get(std::forward<X>(x)...);
+    }
+
+  private:
+    void* _p;
+    DISALLOW_COPY_AND_ASSIGN(Lazy);
+};
+
+// Handler of json::sax(), a method returns false to stop parsing.
+//   - Strings and keys are passed as pointer and length, which are valid only
+//     in the call. Keys are not unescaped, the same as json::parse().
+class __coapi SaxHandler {
+  public:
+    virtual ~SaxHandler() = default;
+    virtual bool on_null() { return true; }
+    virtual bool on_bool(bool) { return true; }
+    virtual bool on_int(int64_t) { return true; }
+    virtual bool on_double(double) { return true; }
+    virtual bool on_string(const char*, size_t) { return true; }
+    virtual bool on_key(const char*, size_t) { return true; }
+    virtual bool on_object_begin() { return true; }
+    virtual bool on_object_end() { return true; }
+    virtual bool on_array_begin() { return true; }
+    virtual bool on_array_end() { return true; }
+};
+
+// Parse json and pass the values to @h one by one, no Json is built. Return false
+// on any error, or if a method of @h returned false.
+__coapi bool sax(const char* s, size_t n, SaxHandler& h);
+inline bool sax(const fastring& s, SaxHandler& h) { return sax(s.data(), s.size(), h); }
+
+// Incremental json parser, for a document received in chunks.
+//   - feed() parses each chunk as it arrives, a token split between chunks is
+//     buffered until the rest of it arrives, nothing else is buffered.
+//   - A number at the end of the data can't be complete until more data comes,
+//     call finish() at the end of the input.
+//   - e.g.
+//     json::StreamParser sp;
+//     while ((n = conn.recv(buf, sizeof(buf))) > 0) {
+//         if (sp.feed(buf, n) < 0) break;
+//     }
+//     if (sp.finish() > 0) Json v = sp.value();
+class __coapi StreamParser {
+  public:
+    StreamParser();
+    ~StreamParser();
+
+    // return 1 if the document is complete, 0 if more data is needed, or -1 on
+    // any error. Only whitespace may follow a complete document.
+    int feed(const void* p, size_t n);
+
+    // end of the input, return 1 if the document is complete, otherwise -1
+    int finish();
+
+    // the document parsed, it is moved out
+    Json value();
+
+    // discard the state, and be ready for a new document
+    void reset();
+
+  private:
+    void* _p;
+    DISALLOW_COPY_AND_ASSIGN(StreamParser);
+};
+
+// Parse newline-delimited json (NDJSON), a document per line, blank lines are
+// skipped. Return false if a line is not valid json, or @f returned false.
+//   - @f(pos, v) is called for each document, @pos is the offset of the line in
+//     @s, @v may be moved out. It returns false to stop parsing.
+//   - If @threads > 1, the input is split into chunks at line boundaries, which
+//     are parsed in parallel by @threads threads, and nodes are allocated by the
+//     allocator of each thread. @f MUST be thread-safe then, and documents are
+//     not in any specific order, unless @ordered is true. With @ordered, each
+//     thread keeps the documents of a chunk until the chunks before it are done,
+//     and @f is called by one thread at a time, in the order of the lines.
+//   - Parsing stops at the first error, though documents after it may have been
+//     passed to @f by other threads if @threads > 1 and not @ordered.
+//
+//   json::parse_lines(s, [](size_t pos, Json& v) {
+//       co::print(v.get("level").as_c_str());
+//       return true;
+//   }, 8, true);
+__coapi bool parse_lines(const char* s, size_t n, const std::function<bool(size_t, Json&)>& f,
+                         int threads = 1, bool ordered = false);
+
+inline bool parse_lines(const fastring& s, const std::function<bool(size_t, Json&)>& f,
+                        int threads = 1, bool ordered = false) {
+    return parse_lines(s.data(), s.size(), f, threads, ordered);
+}
+
+// Read values one by one from json text, without building a Json.
+//   - All methods return false if the text is invalid or the type mismatches.
+//   - null is read as a default value: false, 0, empty string, array or object.
+//   - Numbers are converted between int, double and bool, like Json::as_xxx().
+//   - Keys are not unescaped, the same as json::parse().
+//   - e.g.
+//     json::Reader r(s);
+//     const char* k;
+//     uint32_t n;
+//     int x;
+//     if (!r.begin_object()) return false;
+//     while ((x = r.next_key(k, n)) > 0) {
+//         if (n == 2 && memcmp(k, "id", 2) == 0) {
+//             if (!r.read(id)) return false;
+//         } else if (!r.skip()) {
+//             return false;
+//         }
+//     }
+//     return x == 0 && r.done();
+class __coapi Reader {
+  public:
+    Reader(const char* s, size_t n) : _b(s), _e(s + n), _first(false), _null(false) {}
+    explicit Reader(const char* s) : Reader(s, strlen(s)) {}
+    explicit Reader(const fastring& s) : Reader(s.data(), s.size()) {}
+    ~Reader() = default;
+
+    // nothing but white spaces left
+    bool done();
+
+    bool read(bool& v);
+    bool read(int64_t& v);
+    bool read(double& v);
+    bool read(fastring& v);
+    bool read(std::string& v);
+
+    bool read(int32_t& v) { return this->_read_int(v); }
+    bool read(uint32_t& v) { return this->_read_int(v); }
+    bool read(uint64_t& v) { return this->_read_int(v); }
+
+    // the beginning of an object or array, null is read as an empty one
+    bool begin_object() { return this->_begin('{'); }
+    bool begin_array() { return this->_begin('['); }
+
+    // read the next key of an object, @p points to the key in the text. Return 1
+    // if a key was read and its value follows, 0 at the end of the object, or -1
+    // on any error.
+    int next_key(const char*& p, uint32_t& n);
+
+    // move to the next element of an array, return 1 if there is one, 0 at the
+    // end of the array, or -1 on any error.
+    int next();
+
+    // skip the next value, objects and arrays are skipped as a whole, it checks
+    // only that strings in them are terminated and brackets are balanced.
+    bool skip();
+
+  private:
+    template <typename T>
+    bool _read_int(T& v) {
+        int64_t x;
+        if (!this->read(x)) return false;
+        v = (T)x;
+        return true;
+    }
+
+    bool _read_str(const char*& p, size_t& n);
+    bool _begin(char c);
+
+  private:
+    const char* _b;
+    const char* _e;
+    bool _first;  // nothing was read in the current object or array
+    bool _null;   // null was read by begin_object() or begin_array()
+};
+
+// MessagePack primitives, Json::pack() and structs generated by gen are built on them.
+namespace mp {
+
+__coapi void pack_int(fastream& s, int64_t v);
+__coapi void pack_uint(fastream& s, uint64_t v);
+__coapi void pack_double(fastream& s, double v);
+__coapi void pack_str(fastream& s, const char* p, uint32_t n);
+__coapi void pack_array(fastream& s, uint32_t n);  // n elements should follow
+__coapi void pack_map(fastream& s, uint32_t n);    // n key-value pairs should follow
+inline void pack_nil(fastream& s) { s.append((char)0xc0); }
+inline void pack_bool(fastream& s, bool v) { s.append((char)(v ? 0xc3 : 0xc2)); }
+
+inline void pack(fastream& s, bool v) { pack_bool(s, v); }
+inline void pack(fastream& s, int32_t v) { pack_int(s, v); }
+inline void pack(fastream& s, int64_t v) { pack_int(s, v); }
+inline void pack(fastream& s, uint32_t v) { pack_uint(s, v); }
+inline void pack(fastream& s, uint64_t v) { pack_uint(s, v); }
+inline void pack(fastream& s, double v) { pack_double(s, v); }
+inline void pack(fastream& s, const fastring& v) { pack_str(s, v.data(), (uint32_t)v.size()); }
+inline void pack(fastream& s, const std::string& v) { pack_str(s, v.data(), (uint32_t)v.size()); }
+
+// Read values one by one from MessagePack data, without building a Json.
+//   - All methods return false if the data is truncated or the type mismatches.
+//   - nil is read as a default value: false, 0, empty string, array or map.
+//   - Numbers are converted between int, double and bool, like Json::as_xxx().
+class __coapi Reader {
+  public:
+    Reader(const void* p, size_t n) : _b((const char*)p), _e((const char*)p + n) {}
+    ~Reader() = default;
+
+    bool done() const { return _b == _e; }
+
+    bool read(bool& v);
+    bool read(int64_t& v);
+    bool read(double& v);
+    bool read(fastring& v);
+    bool read(std::string& v);
+
+    bool read(int32_t& v) { return this->_read_int(v); }
+    bool read(uint32_t& v) { return this->_read_int(v); }
+    bool read(uint64_t& v) { return this->_read_int(v); }
+
+    // read a str or bin, @p points to the data in the buffer
+    bool read_str(const char*& p, uint32_t& n);
+
+    // read header of an array or map, n elements or key-value pairs follow
+    bool read_array(uint32_t& n);
+    bool read_map(uint32_t& n);
+
+    // skip the next value, arrays and maps are skipped as a whole
+    bool skip();
+
+  private:
+    template <typename T>
+    bool _read_int(T& v) {
+        int64_t x;
+        if (!this->read(x)) return false;
+        v = (T)x;
+        return true;
+    }
+
+    bool _read_len(uint8_t c, uint32_t& n);
+
+  private:
+    const char* _b;
+    const char* _e;
+};
+
+}  // namespace mp
+
 }  // namespace json
 
 namespace co {
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
+#include <string>
+#include <type_traits>
 
 #include "fastream.h"
 #include "flag.h"
+#include "time.h"
 
 __coapi DEC_bool(log_console);
 __coapi DEC_int32(log_min_level);
@@ -52,6 +56,49 @@ __coapi void set_write_cb(const std::function<void(const void*, size_t)>& cb, in
 __coapi void set_write_cb(const std::function<void(const char*, const void*, size_t)>& cb,
                           int flags = 0);
 
+namespace xx {
+struct Topic;
+}  // namespace xx
+
+/**
+ * register a topic for TOPIC_LOG
+ *   - Each thread pushes logs of a registered topic to its own buffer of the topic,
+ *     without a lock or a lookup of the topic. Topics with heavy logs should be
+ *     registered.
+ *   - The topic string must live as long as the program, like a literal string.
+ *   - Registering a topic again returns the same handle.
+ *
+ *   static auto t = log::register_topic("co");
+ *   TOPIC_LOG(t) << "hello co";
+ */
+__coapi xx::Topic* register_topic(const char* topic);
+
+/**
+ * decode binary logs written by BLOG to text
+ *   - @p and @n is the content of a binary log file, or a part of it that starts
+ *     at the beginning of the file.
+ *   - Logs are appended to @s in the same format as level logs, the time is shown
+ *     in the local time zone.
+ *   - Return false if the data is truncated or corrupted, logs before it are kept.
+ */
+__coapi bool decode_binary(const void* p, size_t n, fastream& s);
+
+/**
+ * read level logs from the ring buffer written when log_ring_size > 0
+ *   - @p and @n is the content of the file log_dir/xx.ring.
+ *   - Logs still in the ring are appended to @s from the oldest to the newest,
+ *     records not completely written are skipped.
+ *   - Return false if it is not a ring buffer file.
+ */
+__coapi bool decode_ring(const void* p, size_t n, fastream& s);
+
+/**
+ * print stack trace of the current thread to stderr
+ *   - It may be called in a signal handler to dump the stack of a thread that
+ *     receives the signal, though it is not async-signal-safe.
+ */
+__coapi void dump_stack();
+
 namespace xx {
 
 enum LogLevel { trace = 0, debug = 1, info = 2, warning = 3, error = 4, fatal = 5 };
@@ -60,11 +107,18 @@ class __coapi LevelLogSaver {
   public:
     LevelLogSaver(const char* fname, unsigned fnlen, unsigned line, int level);
     LevelLogSaver(const char* fname, unsigned line, int level);
+
+    // @s: "file:line] " of the call site, made at compile time
+    template <size_t N>
+    LevelLogSaver(const char (&s)[N], int level) : LevelLogSaver(level, s, N - 1) {}
+
     ~LevelLogSaver();
 
     fastream& stream() const { return _s; }
 
   private:
+    LevelLogSaver(int level, const char* s, size_t n);
+
     fastream& _s;
     size_t _n;
 };
@@ -85,6 +139,8 @@ class __coapi TLogSaver {
   public:
     TLogSaver(const char* fname, unsigned fnlen, unsigned line, const char* topic);
     TLogSaver(const char* fname, unsigned line, const char* topic);
+    TLogSaver(const char* fname, unsigned fnlen, unsigned line, Topic* topic);
+    TLogSaver(const char* fname, unsigned line, Topic* topic);
     ~TLogSaver();
 
     fastream& stream() const { return _s; }
@@ -93,8 +149,123 @@ class __coapi TLogSaver {
     fastream& _s;
     size_t _n;
     const char* _topic;
+    Topic* _t;  // registered topic
 };
 
+// Binary logs, see BLOG. A record starts with blog_head_t, followed by values of
+// the arguments. A string is written as a 32-bit length and the bytes, other
+// values in 1 (bool, char) or 8 bytes.
+struct blog_head_t {
+    uint32_t id;   // id of the call site
+    uint32_t n;    // size of the record
+    int64_t ms;    // time of the log, set by the logger
+    uint32_t tid;  // thread id, set by the logger
+};
+
+static const uint32_t blog_head_size = 20;
+
+// type of a value in binary logs: b(bool), c(char), i(int), u(unsigned),
+// d(double), s(string), p(pointer)
+template <typename T>
+constexpr char blog_type() {
+    return std::is_same<T, bool>::value ? 'b'
+           : std::is_same<T, char>::value ? 'c'
+           : std::is_integral<T>::value ? (std::is_signed<T>::value ? 'i' : 'u')
+           : std::is_floating_point<T>::value ? 'd'
+           : std::is_same<T, const char*>::value ? 's'
+           : std::is_same<T, char*>::value ? 's'
+           : std::is_same<T, fastring>::value ? 's'
+           : std::is_same<T, std::string>::value ? 's'
+           : std::is_pointer<T>::value ? 'p'
+           : '?';
+}
+
+// types of the arguments of a call site, e.g. "isd"
+template <typename... X>
+inline const char* blog_types() {
+    static const char s[] = {blog_type<typename std::decay<X>::type>()..., '\0'};
+    return s;
+}
+
+template <char C>
+using blog_tag = std::integral_constant<char, C>;
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'b'>) { s.append((char)v); }
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'c'>) { s.append((char)v); }
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'i'>) { s.append((uint64_t)(int64_t)v); }
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'u'>) { s.append((uint64_t)v); }
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'d'>) {
+    const double d = (double)v;
+    s.append(&d, sizeof(d));
+}
+
+template <typename T>
+inline void blog_put(fastream& s, T v, blog_tag<'p'>) { s.append((uint64_t)(uintptr_t)v); }
+
+inline void blog_put_str(fastream& s, const char* p, size_t n) {
+    s.append((uint32_t)n).append(p, n);
+}
+
+inline void blog_put(fastream& s, const char* v, blog_tag<'s'>) { blog_put_str(s, v, strlen(v)); }
+
+inline void blog_put(fastream& s, const fastring& v, blog_tag<'s'>) {
+    blog_put_str(s, v.data(), v.size());
+}
+
+inline void blog_put(fastream& s, const std::string& v, blog_tag<'s'>) {
+    blog_put_str(s, v.data(), v.size());
+}
+
+inline void blog_put(fastream&) {}
+
+template <typename T, typename... X>
+inline void blog_put(fastream& s, const T& v, const X&... x) {
+    typedef typename std::decay<T>::type D;
+    static_assert(blog_type<D>() != '?', "unsupported type for BLOG");
+    blog_put(s, v, blog_tag<blog_type<D>()>());
+    blog_put(s, x...);
+}
+
+// register a call site of BLOG, return its id
+__coapi uint32_t blog_site(int level, const char* file, unsigned line, const char* fmt,
+                           const char* types);
+
+// thread-local buffer for a binary log, and push the log in it to the logger
+__coapi fastream& blog_stream();
+__coapi void blog_push(fastream& s);
+
+template <typename... X>
+inline void blog(std::atomic<uint32_t>& id, int level, const char* file, unsigned line,
+                 const char* fmt, const X&... x) {
+    uint32_t i = id.load(std::memory_order_relaxed);
+    if (i == 0) {
+        i = blog_site(level, file, line, fmt, blog_types<X...>());
+        id.store(i, std::memory_order_relaxed);
+    }
+    fastream& s = blog_stream();
+    s.clear();
+    s.append(i).resize(blog_head_size);
+    blog_put(s, x...);
+    blog_push(s);
+}
+
+// return true if at least @ms milliseconds passed since the last time it
+// returned true, only one of the threads calling it at the same time wins
+inline bool every_ms(std::atomic<int64_t>& last, int64_t ms) {
+    const int64_t now = now::ms();
+    int64_t x = last.load(std::memory_order_relaxed);
+    return now - x >= ms && last.compare_exchange_strong(x, now, std::memory_order_relaxed);
+}
+
 template <int N>
 constexpr const char* path_base(const char (&s)[N], int i = N - 1) {
     return (s[i] == '/' || s[i] == '\\') ? (s + i + 1) : (i == 0 ? s : path_base(s, i - 1));
@@ -118,11 +289,21 @@ using namespace _xx;
 #endif
 // TOPIC_LOG are logs grouped by the topic.
 // TOPIC_LOG("xxx") << "hello xxx" << 23;
-// It is better to use literal string as the topic.
+// The topic is interned (see co/intern.h), it need not outlive the log. A handle
+// returned by log::register_topic() is faster, as no lookup is needed.
 #define TOPIC_LOG(topic) log::xx::TLogSaver(_CO_FILELINE, topic).stream()
 #define TOPIC_TLOG_IF(topic, cond) \
     if (cond) TOPIC_LOG(topic)
 
+// Logs below CO_LOG_MIN_LEVEL are removed at compile time, the operands of them
+// are never evaluated. It is set by LOG_MIN_LEVEL of cmake, or log_min_level of
+// xmake, and can be redefined before including this file.
+//   - e.g. -DCO_LOG_MIN_LEVEL=2 removes TLOG and DLOG.
+#ifndef CO_LOG_MIN_LEVEL
+#define CO_LOG_MIN_LEVEL 0
+#endif
+#define _CO_LOG_ON(lv) (CO_LOG_MIN_LEVEL <= (lv) && FLG_log_min_level <= (lv))
+
 // TLOG  ->  trace log
 // DLOG  ->  debug log
 // LOG   ->  info log
@@ -133,18 +314,19 @@ using namespace _xx;
 //
 // LOG << "hello world " << 23;
 // WLOG_IF(1 + 1 == 2) << "xx";
-#define _CO_LOG_STREAM(lv) log::xx::LevelLogSaver(_CO_FILELINE, lv).stream()
+#define _CO_LOG_SITE __FILE__ ":" PP_STRIFY(__LINE__) "] "
+#define _CO_LOG_STREAM(lv) log::xx::LevelLogSaver(_CO_LOG_SITE, lv).stream()
 #define _CO_FLOG_STREAM log::xx::FatalLogSaver(_CO_FILELINE).stream()
 #define TLOG \
-    if (FLG_log_min_level <= log::xx::trace) _CO_LOG_STREAM(log::xx::trace)
+    if (_CO_LOG_ON(log::xx::trace)) _CO_LOG_STREAM(log::xx::trace)
 #define DLOG \
-    if (FLG_log_min_level <= log::xx::debug) _CO_LOG_STREAM(log::xx::debug)
+    if (_CO_LOG_ON(log::xx::debug)) _CO_LOG_STREAM(log::xx::debug)
 #define LOG \
-    if (FLG_log_min_level <= log::xx::info) _CO_LOG_STREAM(log::xx::info)
+    if (_CO_LOG_ON(log::xx::info)) _CO_LOG_STREAM(log::xx::info)
 #define WLOG \
-    if (FLG_log_min_level <= log::xx::warning) _CO_LOG_STREAM(log::xx::warning)
+    if (_CO_LOG_ON(log::xx::warning)) _CO_LOG_STREAM(log::xx::warning)
 #define ELOG \
-    if (FLG_log_min_level <= log::xx::error) _CO_LOG_STREAM(log::xx::error)
+    if (_CO_LOG_ON(log::xx::error)) _CO_LOG_STREAM(log::xx::error)
 #define FLOG _CO_FLOG_STREAM << "fatal error! "
 
 // conditional log
@@ -182,22 +364,61 @@ using namespace _xx;
 // occasional log
 #define _CO_LOG_COUNTER PP_CONCAT(_co_log_counter_, __LINE__)
 
-#define _CO_LOG_EVERY_N(n, what)                    \
-    static std::atomic_uint32_t _CO_LOG_COUNTER{0}; \
-    if (_CO_LOG_COUNTER.fetch_add(1, std::memory_order_relaxed) % (n) == 0) what
-
-#define _CO_LOG_FIRST_N(n, what)               \
-    static std::atomic_int _CO_LOG_COUNTER{0}; \
-    if (_CO_LOG_COUNTER < (n) && _CO_LOG_COUNTER.fetch_add(1, std::memory_order_relaxed) < (n)) what
-
-#define TLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, TLOG)
-#define DLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, DLOG)
-#define LOG_EVERY_N(n) _CO_LOG_EVERY_N(n, LOG)
-#define WLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, WLOG)
-#define ELOG_EVERY_N(n) _CO_LOG_EVERY_N(n, ELOG)
-
-#define TLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, TLOG)
-#define DLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, DLOG)
-#define LOG_FIRST_N(n) _CO_LOG_FIRST_N(n, LOG)
-#define WLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, WLOG)
-#define ELOG_FIRST_N(n) _CO_LOG_FIRST_N(n, ELOG)
+// the counters are not touched if the level is disabled
+#define _CO_LOG_EVERY_N(n, lv)                                                                \
+    static std::atomic_uint32_t _CO_LOG_COUNTER{0};                                           \
+    if (_CO_LOG_ON(lv) && _CO_LOG_COUNTER.fetch_add(1, std::memory_order_relaxed) % (n) == 0) \
+    _CO_LOG_STREAM(lv)
+
+#define _CO_LOG_FIRST_N(n, lv)                                         \
+    static std::atomic_int _CO_LOG_COUNTER{0};                         \
+    if (_CO_LOG_ON(lv) && _CO_LOG_COUNTER < (n) &&                     \
+        _CO_LOG_COUNTER.fetch_add(1, std::memory_order_relaxed) < (n)) \
+    _CO_LOG_STREAM(lv)
+
+// at most once every @ms milliseconds
+#define _CO_LOG_EVERY_MS(ms, lv)                                             \
+    static std::atomic<int64_t> _CO_LOG_COUNTER{INT64_MIN / 2};              \
+    if (_CO_LOG_ON(lv) && log::xx::every_ms(_CO_LOG_COUNTER, (int64_t)(ms))) \
+    _CO_LOG_STREAM(lv)
+
+#define TLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, log::xx::trace)
+#define DLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, log::xx::debug)
+#define LOG_EVERY_N(n) _CO_LOG_EVERY_N(n, log::xx::info)
+#define WLOG_EVERY_N(n) _CO_LOG_EVERY_N(n, log::xx::warning)
+#define ELOG_EVERY_N(n) _CO_LOG_EVERY_N(n, log::xx::error)
+
+#define TLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, log::xx::trace)
+#define DLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, log::xx::debug)
+#define LOG_FIRST_N(n) _CO_LOG_FIRST_N(n, log::xx::info)
+#define WLOG_FIRST_N(n) _CO_LOG_FIRST_N(n, log::xx::warning)
+#define ELOG_FIRST_N(n) _CO_LOG_FIRST_N(n, log::xx::error)
+
+#define TLOG_EVERY_MS(ms) _CO_LOG_EVERY_MS(ms, log::xx::trace)
+#define DLOG_EVERY_MS(ms) _CO_LOG_EVERY_MS(ms, log::xx::debug)
+#define LOG_EVERY_MS(ms) _CO_LOG_EVERY_MS(ms, log::xx::info)
+#define WLOG_EVERY_MS(ms) _CO_LOG_EVERY_MS(ms, log::xx::warning)
+#define ELOG_EVERY_MS(ms) _CO_LOG_EVERY_MS(ms, log::xx::error)
+
+// Binary logs, formatted offline.
+//   - The id of the call site, the time and raw values of the arguments are
+//     written to log_dir/blog/, without formatting them to text.
+//   - "{}" in the format string are replaced with the arguments when the logs are
+//     decoded by log::decode_binary(), or the blog tool.
+//   - Arguments can be bool, char, integers, floating point numbers, pointers,
+//     or strings (const char*, fastring, std::string).
+//
+// BLOG("user {} logged in from {}", uid, ip);
+#define _CO_BLOG(lv, fmt, ...)                                                      \
+    do {                                                                            \
+        if (_CO_LOG_ON(lv)) {                                                       \
+            static std::atomic<uint32_t> _co_blog_id{0};                            \
+            log::xx::blog(_co_blog_id, lv, __FILE__, __LINE__, fmt, ##__VA_ARGS__); \
+        }                                                                           \
+    } while (0)
+
+#define BTLOG(fmt, ...) _CO_BLOG(log::xx::trace, fmt, ##__VA_ARGS__)
+#define BDLOG(fmt, ...) _CO_BLOG(log::xx::debug, fmt, ##__VA_ARGS__)
+#define BLOG(fmt, ...) _CO_BLOG(log::xx::info, fmt, ##__VA_ARGS__)
+#define BWLOG(fmt, ...) _CO_BLOG(log::xx::warning, fmt, ##__VA_ARGS__)
+#define BELOG(fmt, ...) _CO_BLOG(log::xx::error, fmt, ##__VA_ARGS__)
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "def.h"
+
+/**
+ * Memory allocator for internal use of co, fast::stream, json, waiting contexts
+ * of coroutines and so on.
+ *   - Blocks up to 2K come from 64K slabs owned by the calling thread, in 24 size
+ *     classes. Allocating and freeing them in the same thread takes no lock.
+ *   - A block freed in another thread is pushed to a lock-free list of its slab,
+ *     and is reused by the owner thread later.
+ *   - Larger blocks are allocated with ::malloc.
+ *   - co::free() and co::realloc() also accept memory from ::malloc, so a buffer
+ *     adopted by fastring(p, cap, size) can still be freed by co::free().
+ *   - Build with WITH_SYS_MALLOC (cmake) or with_sys_malloc (xmake) to forward
+ *     all of them to ::malloc, e.g. when jemalloc or mimalloc is linked in.
+ */
+namespace co {
+
+// allocate at least @n bytes, memory of a small block is 16-byte aligned
+__coapi void* alloc(size_t n);
+
+// free memory from co::alloc(), co::realloc() or ::malloc()
+__coapi void free(void* p);
+
+// resize the memory @p to at least @n bytes, @p may be NULL
+__coapi void* realloc(void* p, size_t n);
+
+}  // namespace co
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include "def.h"
+#include "fastream.h"
+#include "fastring.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace co {
+namespace xx {
+
+static const uint32_t metric_shards = 32;
+
+// values of a histogram fall into 8 linear sub-buckets of each power of 2,
+// up to 2^41, the relative error of a bucket is at most 12.5%.
+static const uint32_t metric_buckets = 8 + 38 * 8;
+
+__coapi uint32_t next_metric_shard();
+
+// shard of the current thread, threads are given shards in turn
+inline uint32_t metric_shard() {
+    static thread_local uint32_t s = next_metric_shard();
+    return s;
+}
+
+// Shards of a metric, one per thread (a scheduler runs in a thread) until they
+// are used up. A shard is allocated the first time it is written to.
+template <typename T>
+class metric_shard_set {
+  public:
+    metric_shard_set() noexcept {
+        for (uint32_t i = 0; i < metric_shards; ++i) _v[i].store(0, std::memory_order_relaxed);
+    }
+
+    ~metric_shard_set() {
+        for (uint32_t i = 0; i < metric_shards; ++i) delete _v[i].load(std::memory_order_relaxed);
+    }
+
+    T& local() {
+        const uint32_t i = metric_shard();
+        T* const p = _v[i].load(std::memory_order_acquire);
+        return p ? *p : this->make(i);
+    }
+
+    template <typename F>
+    void each(F&& f) const {
+        for (uint32_t i = 0; i < metric_shards; ++i) {
+            const T* const p = _v[i].load(std::memory_order_acquire);
+            if (p) f(*p);
+        }
+    }
+
+  private:
+    T& make(uint32_t i) {
+        T* const p = new T();
+        T* x = 0;
+        if (_v[i].compare_exchange_strong(x, p, std::memory_order_acq_rel)) return *p;
+        delete p;
+        return *x;
+    }
+
+    std::atomic<T*> _v[metric_shards];
+};
+
+// Base of metrics, it is registered on construction, and unregistered on
+// destruction. The name may carry labels, e.g. http_requests_total{code="200"}.
+class __coapi metric {
+  public:
+    enum type_t : uint8_t {
+        t_counter,
+        t_gauge,
+        t_histogram,
+    };
+
+    metric(type_t type, const char* name, const char* help);
+    virtual ~metric();
+
+    // write samples of the metric in the Prometheus text format
+    virtual void write(fastream& s) const = 0;
+
+    type_t type() const noexcept { return _type; }
+    const fastring& name() const noexcept { return _name; }
+    const fastring& help() const noexcept { return _help; }
+
+    // the name without labels
+    fastring base_name() const;
+
+  private:
+    fastring _name;
+    fastring _help;
+    type_t _type;
+    DISALLOW_COPY_AND_ASSIGN(metric);
+};
+
+}  // namespace xx
+
+/**
+ * Metrics in the Prometheus data model, see metrics::text().
+ *   - Counters and histograms are sharded by threads, updating them is lock-free
+ *     and does not contend across schedulers. Shards are merged on reading.
+ *   - Metrics are usually defined as static objects:
+ *
+ *     static co::metrics::counter reqs("app_requests_total", "requests handled");
+ *     static co::metrics::histogram lat("app_request_us", "latency of requests in us");
+ *     reqs.inc();
+ *     lat.observe(us);
+ */
+namespace metrics {
+
+// a monotonically increasing value
+class __coapi counter : public xx::metric {
+  public:
+    counter(const char* name, const char* help) : xx::metric(t_counter, name, help) {}
+    virtual ~counter() = default;
+
+    void inc(uint64_t n = 1) { _s.local().n.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t value() const;
+
+    virtual void write(fastream& s) const;
+
+  private:
+    struct shard_t {
+        std::atomic_uint64_t n;
+        char _pad[L1_CACHE_LINE_SIZE - sizeof(uint64_t)];
+    };
+    xx::metric_shard_set<shard_t> _s;
+};
+
+// a value that can go up and down
+class __coapi gauge : public xx::metric {
+  public:
+    gauge(const char* name, const char* help) : xx::metric(t_gauge, name, help), _v(0) {}
+    virtual ~gauge() = default;
+
+    void set(int64_t v) { _v.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { _v.fetch_add(n, std::memory_order_relaxed); }
+    void sub(int64_t n) { _v.fetch_sub(n, std::memory_order_relaxed); }
+    int64_t value() const { return _v.load(std::memory_order_relaxed); }
+
+    virtual void write(fastream& s) const;
+
+  private:
+    std::atomic_int64_t _v;
+};
+
+/**
+ * a histogram of non-negative integers, latencies in microseconds, e.g.
+ *   - Values are counted in HDR-style log-linear buckets, see percentile().
+ *   - It is exposed as a Prometheus histogram with buckets at powers of 2, up to
+ *     the largest value observed.
+ */
+class __coapi histogram : public xx::metric {
+  public:
+    histogram(const char* name, const char* help) : xx::metric(t_histogram, name, help) {}
+    virtual ~histogram() = default;
+
+    void observe(uint64_t v) {
+        shard_t& s = _s.local();
+        s.b[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    // number of values observed
+    uint64_t count() const;
+
+    // sum of values observed
+    uint64_t sum() const;
+
+    // upper bound of the bucket where the @q quantile (0 < q <= 1) falls in, at
+    // most 12.5% larger than the exact value. Return 0 if nothing was observed.
+    uint64_t percentile(double q) const;
+
+    virtual void write(fastream& s) const;
+
+    // index of the bucket of @v, a bucket holds values in (lower, upper]
+    static uint32_t bucket(uint64_t v) {
+        if (v <= 8) return v == 0 ? 0 : (uint32_t)(v - 1);
+        const uint64_t u = v - 1;
+#ifdef _MSC_VER
+        unsigned long r;
+        _BitScanReverse64(&r, u);
+        const uint32_t e = (uint32_t)r;
+#else
+        const uint32_t e = 63 - (uint32_t)__builtin_clzll(u);
+#endif
+        if (e > 40) return xx::metric_buckets - 1;
+        return (e - 2) * 8 + (uint32_t)((u >> (e - 3)) & 7);
+    }
+
+    // the largest value in the bucket @i
+    static uint64_t upper(uint32_t i) {
+        if (i < 8) return i + 1;
+        const uint32_t e = i / 8 + 2;
+        return (uint64_t)(9 + i % 8) << (e - 3);
+    }
+
+  private:
+    struct shard_t {
+        std::atomic_uint64_t sum;
+        std::atomic_uint64_t b[xx::metric_buckets];
+    };
+
+    // merge buckets of all the shards into @b, return the count
+    uint64_t merge(uint64_t* b) const;
+
+    xx::metric_shard_set<shard_t> _s;
+};
+
+// add a function called on every metrics::text(), it writes samples of metrics
+// computed on the spot, in the Prometheus text format.
+__coapi void add_collector(std::function<void(fastream&)>&& f);
+
+/**
+ * write all metrics in the Prometheus text format (version 0.0.4)
+ *   - Runtime metrics of co, the schedulers and the blocking thread pool, are
+ *     always included, see co::sched_stats and co::blocking_pool_stats.
+ *   - Serve it with http::serve_metrics().
+ */
+__coapi fastring text();
+
+}  // namespace metrics
+}  // namespace co
@@ -41,6 +41,24 @@ __coapi int pid();
 // get number of processors
 __coapi int cpunum();
 
+struct topology_t {
+    int cpus;         // number of logical processors online
+    int cores;        // number of physical cores
+    int smt;          // hardware threads per core
+    int numa_nodes;   // number of numa nodes
+    size_t l2_size;   // size of the L2 cache in bytes, 0 if unknown
+    size_t l3_size;   // size of the L3 cache in bytes, 0 if unknown
+    double cpu_quota; // cpu quota of the cgroup, in cpus, 0 if unlimited
+    int cpu_limit;    // cpus the process may use, by affinity and cpu quota
+};
+
+// get the cpu topology, it is detected on the first call and cached.
+//   - On linux, it is read from sysfs, the cgroup (v1 or v2) and the cpu
+//     affinity of the process. Other platforms report no cpu quota.
+//   - Fields that can not be detected fall back to cpunum() for counts,
+//     1 for smt and numa_nodes, and 0 for cache sizes.
+__coapi const topology_t& topology();
+
 // get size of a page in bytes
 __coapi size_t pagesize();
 
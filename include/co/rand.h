@@ -18,6 +18,14 @@ inline uint32_t rand(uint32_t& seed) {
     return seed > M ? (seed -= M) : seed;
 }
 
+// generate a 64-bit random number (thread-safe)
+//   - It is a wyrand generator with 8 bytes of state per thread, fast but not
+//     cryptographically secure.
+__coapi uint64_t rand64();
+
+// fill @n bytes at @p with random data (thread-safe)
+__coapi void rand_bytes(void* p, size_t n);
+
 // return a random string with default symbols ("_-0-9a-zA-Z", thread-safe)
 // - @n: length of the random string, 15 by default
 __coapi fastring randstr(int n = 15);
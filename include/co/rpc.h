@@ -18,6 +18,43 @@ class Service {
     virtual const co::map<const char*, Fun>& methods() const = 0;
 };
 
+/**
+ * time left for the rpc call being handled in the current coroutine
+ *   - It is called in methods of services, to give up work that the client will not
+ *     wait for. Clients send their recv timeout as the deadline if FLG_rpc_deadline
+ *     is true, and servers drop requests that expired before they are handled.
+ *
+ * @return  ms left before the client gives up the call, 0 if it has expired, or -1
+ *          if the client sent no deadline.
+ */
+__coapi int deadline();
+
+/**
+ * writer of a streaming rpc method, passed to the handler on the server side
+ *   - Messages are sent in the order they are written, each as a frame carrying the
+ *     request id. The stream ends when the handler returns.
+ *   - Flow control: at most FLG_rpc_stream_window messages are sent before the
+ *     client has consumed them, write() waits for the client in that case.
+ */
+class __coapi Writer {
+  public:
+    /**
+     * send a message to the client
+     *
+     * @return  false if the client has closed the stream or the connection, or has
+     *          not consumed any message in FLG_rpc_send_timeout ms. The handler
+     *          should return then.
+     */
+    bool write(const json::Json& msg);
+
+  private:
+    friend class ServerImpl;
+    explicit Writer(void* p) : _p(p) {}
+    void* _p;
+
+    DISALLOW_COPY_AND_ASSIGN(Writer);
+};
+
 class __coapi Server {
   public:
     Server();
@@ -36,11 +73,25 @@ class __coapi Server {
         return this->add_service(std::shared_ptr<Service>(s));
     }
 
+    typedef std::function<void(json::Json&, Writer&)> StreamFun;
+
+    /**
+     * add a streaming method, it writes a sequence of messages to the client
+     *   - Clients call it with Client::stream(), requests of streams are matched by
+     *     the "api" field.
+     *
+     * @param api  name of the method, like "service.method". It is not copied, and
+     *             is generally a string literal.
+     * @param f    the handler, it runs in its own coroutine.
+     */
+    Server& add_stream(const char* api, StreamFun f);
+
     /**
      * start the rpc server 
      *   - By default, key and ca are NULL, and ssl is disabled.
      * 
-     * @param ip    server ip, either an ipv4 or ipv6 address.
+     * @param ip    server ip, either an ipv4 or ipv6 address, or "unix:/path" for
+     *              a unix domain socket, or "shm:name" for shared memory rings.
      * @param port  server port
      * @param url   the url used to access the HTTP server, MUST begins with '/'
      * @param key   path of ssl private key file.
@@ -63,6 +114,61 @@ class __coapi Server {
     DISALLOW_COPY_AND_ASSIGN(Server);
 };
 
+/**
+ * rpc client
+ *   - A client holds one connection, which can be shared by coroutines in the same
+ *     scheduler. Requests carry ids, and responses are dispatched by id, so calls
+ *     from different coroutines do not wait for each other.
+ *   - Requests are packed in MessagePack by default (see FLG_rpc_binary), and the
+ *     server responds in the same format as the request.
+ *   - Messages larger than FLG_rpc_compress_size are compressed with lz4. The server
+ *     compresses responses only for clients that have it enabled.
+ *   - NOTE: Coroutines share stacks, a client shared by coroutines SHOULD NOT be
+ *     created on the stack of a coroutine.
+ *   - The copy constructor creates a new client with its own connection.
+ *   - ip may be "unix:/path" or "unix:@name" for a server on a unix domain socket,
+ *     or "shm:name" for a server on the same host, messages are then passed in
+ *     shared memory rings without syscalls (linux only).
+ */
+/**
+ * messages of a streaming rpc call, returned by Client::stream()
+ *   - It MUST be used in the coroutine that created it, and destroyed before the
+ *     client. If it is destroyed before the end, the server is told to stop.
+ *
+ *   - usage:
+ *     auto s = cli.stream(req);
+ *     json::Json msg;
+ *     while (s.next(msg)) { ... }
+ *     if (s.result().has_member("error")) { ... }
+ */
+class __coapi Stream {
+  public:
+    Stream(Stream&& s) : _p(s._p) { s._p = 0; }
+    ~Stream();
+
+    void operator=(const Stream&) = delete;
+
+    /**
+     * get the next message of the stream
+     *   - It waits at most FLG_rpc_recv_timeout ms for a message.
+     *
+     * @return  false at the end of the stream or on error.
+     */
+    bool next(json::Json& msg);
+
+    /**
+     * result of the stream after next() returned false
+     *   - It is an empty object if the stream ended normally, or an object with the
+     *     member "error", or null if the connection failed or timed out.
+     */
+    const json::Json& result() const;
+
+  private:
+    friend class Client;
+    explicit Stream(void* p) : _p(p) {}
+    void* _p;
+};
+
 class __coapi Client {
   public:
     Client(const char* ip, int port, bool use_ssl=false);
@@ -71,9 +177,12 @@ class __coapi Client {
 
     void operator=(const Client& c) = delete;
 
-    // perform a rpc request
+    // perform a rpc request, @res is not changed if no response was received
     void call(const json::Json& req, json::Json& res);
 
+    // call a streaming method added by Server::add_stream()
+    Stream stream(const json::Json& req);
+
     // send a heartbeat
     void ping();
 
@@ -84,4 +193,43 @@ class __coapi Client {
     void* _p;
 };
 
+/**
+ * rpc client for a cluster of servers
+ *   - It keeps a pool of rpc::Client for each server in each scheduler, and picks
+ *     a server for each call by power-of-two-choices: of two servers picked at
+ *     random, the one with less outstanding requests weighted by its average
+ *     latency wins.
+ *   - A server is ejected for FLG_rpc_eject_ms, after FLG_rpc_eject_errors calls
+ *     to it failed in a row, or if its average latency is FLG_rpc_eject_slow_ratio
+ *     times that of the fastest server. The last server available is never ejected.
+ *   - Calls are hedged if FLG_rpc_hedge_pct > 0: when no response arrived in that
+ *     percentile of recent latencies, a backup request is sent to another server,
+ *     and the first response wins. Backup requests are limited to a ratio of the
+ *     calls by FLG_rpc_hedge_budget.
+ *   - It MUST be used in coroutine, and it can be shared by all coroutines.
+ *
+ *   - usage:
+ *     rpc::Cluster c({ "10.0.0.1:7788", "10.0.0.2:7788", "[::1]:7788" });
+ *     c.call(req, res);
+ */
+class __coapi Cluster {
+  public:
+    /**
+     * @param addrs    servers in a form of "ip:port", "[ipv6]:port", "unix:/path"
+     *                 or "shm:name".
+     * @param use_ssl  use ssl if it is true.
+     */
+    explicit Cluster(const co::vector<fastring>& addrs, bool use_ssl=false);
+    ~Cluster();
+
+    Cluster(const Cluster&) = delete;
+    void operator=(const Cluster&) = delete;
+
+    // perform a rpc request on one of the servers, @res is not changed on failure
+    void call(const json::Json& req, json::Json& res);
+
+  private:
+    void* _p;
+};
+
 } // rpc
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ostream>
+#include <string>
+
+#include "fastring.h"
+
+namespace co {
+
+// A string with inline storage for up to 15 characters (and the '\0'), the
+// memory is allocated from the heap only for longer strings. It is for short
+// strings created and destroyed frequently, like header names, keys or short
+// tokens, where fastring always has to malloc.
+//   - It is always null-terminated, c_str() is the same as data().
+//   - It is compared with and appended to fastring without copying.
+//
+//   co::small_string s("GET");  // no heap allocation
+//   s.toupper();
+//   fastring x;
+//   x << s << ' ' << "/";
+class small_string {
+  public:
+    static const size_t npos = (size_t)-1;
+    static const size_t N = 16;  // inline capacity, including the '\0'
+
+    small_string() noexcept : _size(0), _cap(N), _p(_buf) { _buf[0] = '\0'; }
+
+    small_string(const void* s, size_t n) : small_string() { this->append(s, n); }
+
+    small_string(const char* s) : small_string(s, strlen(s)) {}
+
+    small_string(size_t n, char c) : small_string() { this->append(n, c); }
+
+    small_string(const fastring& s) : small_string(s.data(), s.size()) {}
+
+    small_string(const std::string& s) : small_string(s.data(), s.size()) {}
+
+    small_string(const small_string& s) : small_string(s.data(), s.size()) {}
+
+    small_string(small_string&& s) noexcept : _size(s._size), _cap(s._cap), _p(s._p) {
+        if (s._p == s._buf) {
+            _p = _buf;
+            memcpy(_buf, s._buf, _size + 1);
+        } else {
+            s._p = s._buf;
+            s._cap = N;
+        }
+        s._size = 0;
+        s._buf[0] = '\0';
+    }
+
+    ~small_string() {
+        if (_p != _buf) ::free(_p);
+    }
+
+    small_string& operator=(const small_string& s) {
+        return &s != this ? this->assign(s.data(), s.size()) : *this;
+    }
+
+    small_string& operator=(small_string&& s) noexcept {
+        if (&s != this) {
+            if (s._p == s._buf) {
+                this->assign(s._buf, s._size);
+            } else {
+                if (_p != _buf) ::free(_p);
+                _p = s._p;
+                _cap = s._cap;
+                _size = s._size;
+                s._p = s._buf;
+                s._cap = N;
+            }
+            s._size = 0;
+            s._buf[0] = '\0';
+        }
+        return *this;
+    }
+
+    small_string& operator=(const char* s) { return this->assign(s, strlen(s)); }
+
+    small_string& operator=(const fastring& s) { return this->assign(s.data(), s.size()); }
+
+    small_string& operator=(const std::string& s) { return this->assign(s.data(), s.size()); }
+
+    small_string& assign(const void* s, size_t n) {
+        if (this->_inside((const char*)s)) {
+            if (s != _p) memmove(_p, s, n);
+        } else {
+            this->reserve(n + 1);
+            memcpy(_p, s, n);
+        }
+        _p[_size = n] = '\0';
+        return *this;
+    }
+
+    char* data() noexcept { return _p; }
+    const char* data() const noexcept { return _p; }
+    const char* c_str() const noexcept { return _p; }
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    size_t capacity() const noexcept { return _cap; }
+
+    // whether the string is stored inline, without heap allocation
+    bool is_inline() const noexcept { return _p == _buf; }
+
+    char& operator[](size_t i) { return _p[i]; }
+    const char& operator[](size_t i) const { return _p[i]; }
+    char& front() { return _p[0]; }
+    const char& front() const { return _p[0]; }
+    char& back() { return _p[_size - 1]; }
+    const char& back() const { return _p[_size - 1]; }
+
+    void clear() noexcept { _p[_size = 0] = '\0'; }
+
+    void resize(size_t n, char c = '\0') {
+        if (_size < n) {
+            this->reserve(n + 1);
+            memset(_p + _size, c, n - _size);
+        }
+        _p[_size = n] = '\0';
+    }
+
+    void reserve(size_t n) {
+        if (_cap < n) {
+            if (_p == _buf) {
+                _p = (char*)::malloc(n);
+                assert(_p);
+                memcpy(_p, _buf, _size + 1);
+            } else {
+                _p = (char*)::realloc(_p, n);
+                assert(_p);
+            }
+            _cap = n;
+        }
+    }
+
+    small_string& append(const void* s, size_t n) {
+        const char* p = (const char*)s;
+        if (_cap < _size + n + 1) {
+            const size_t pos = p - _p;
+            const bool inside = this->_inside(p);
+            this->reserve(_cap + (_cap >> 1) + n + 1);
+            if (inside) p = _p + pos;
+        }
+        memcpy(_p + _size, p, n);
+        _p[_size += n] = '\0';
+        return *this;
+    }
+
+    small_string& append(const char* s) { return this->append(s, strlen(s)); }
+
+    small_string& append(const fastring& s) { return this->append(s.data(), s.size()); }
+
+    small_string& append(const std::string& s) { return this->append(s.data(), s.size()); }
+
+    small_string& append(const small_string& s) { return this->append(s.data(), s.size()); }
+
+    small_string& append(size_t n, char c) {
+        this->reserve(_size + n + 1);
+        memset(_p + _size, c, n);
+        _p[_size += n] = '\0';
+        return *this;
+    }
+
+    small_string& append(char c) { return this->append(1, c); }
+
+    small_string& push_back(char c) { return this->append(c); }
+
+    small_string& operator+=(const char* s) { return this->append(s); }
+    small_string& operator+=(const fastring& s) { return this->append(s); }
+    small_string& operator+=(const small_string& s) { return this->append(s); }
+    small_string& operator+=(char c) { return this->append(c); }
+
+    small_string& operator<<(const char* s) { return this->append(s); }
+    small_string& operator<<(const fastring& s) { return this->append(s); }
+    small_string& operator<<(const std::string& s) { return this->append(s); }
+    small_string& operator<<(const small_string& s) { return this->append(s); }
+    small_string& operator<<(char c) { return this->append(c); }
+
+    int compare(const char* s, size_t n) const { return str::memcmp(_p, _size, s, n); }
+    int compare(const char* s) const { return this->compare(s, strlen(s)); }
+    int compare(const fastring& s) const { return this->compare(s.data(), s.size()); }
+    int compare(const small_string& s) const { return this->compare(s.data(), s.size()); }
+
+    bool starts_with(const char* s, size_t n) const {
+        return n == 0 || (n <= _size && memcmp(_p, s, n) == 0);
+    }
+    bool starts_with(const char* s) const { return this->starts_with(s, strlen(s)); }
+
+    bool ends_with(const char* s, size_t n) const {
+        return n == 0 || (n <= _size && memcmp(_p + _size - n, s, n) == 0);
+    }
+    bool ends_with(const char* s) const { return this->ends_with(s, strlen(s)); }
+
+    size_t find(char c) const {
+        const char* const p = (const char*)memchr(_p, c, _size);
+        return p ? p - _p : npos;
+    }
+
+    size_t find(const char* s) const {
+        const char* const p = str::memmem(_p, _size, s, strlen(s));
+        return p ? p - _p : npos;
+    }
+
+    small_string& toupper() {
+        for (size_t i = 0; i < _size; ++i) _p[i] = (char)::toupper(_p[i]);
+        return *this;
+    }
+
+    small_string& tolower() {
+        for (size_t i = 0; i < _size; ++i) _p[i] = (char)::tolower(_p[i]);
+        return *this;
+    }
+
+    // copy to a fastring
+    fastring str() const { return fastring(_p, _size); }
+
+    void swap(small_string& s) noexcept {
+        small_string t(std::move(s));
+        s = std::move(*this);
+        *this = std::move(t);
+    }
+
+  private:
+    bool _inside(const char* p) const noexcept { return _p <= p && p < _p + _size; }
+
+    size_t _size;
+    size_t _cap;
+    char* _p;
+    char _buf[N];
+};
+
+inline bool operator==(const small_string& a, const small_string& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator==(const small_string& a, const fastring& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator==(const fastring& a, const small_string& b) { return b == a; }
+
+inline bool operator==(const small_string& a, const char* b) { return a.compare(b) == 0; }
+
+inline bool operator==(const char* a, const small_string& b) { return b == a; }
+
+inline bool operator!=(const small_string& a, const small_string& b) { return !(a == b); }
+
+inline bool operator!=(const small_string& a, const fastring& b) { return !(a == b); }
+
+inline bool operator!=(const fastring& a, const small_string& b) { return !(a == b); }
+
+inline bool operator!=(const small_string& a, const char* b) { return !(a == b); }
+
+inline bool operator!=(const char* a, const small_string& b) { return !(b == a); }
+
+inline bool operator<(const small_string& a, const small_string& b) { return a.compare(b) < 0; }
+
+inline bool operator<(const small_string& a, const fastring& b) { return a.compare(b) < 0; }
+
+inline bool operator<(const fastring& a, const small_string& b) { return b.compare(a) > 0; }
+
+inline bool operator<(const small_string& a, const char* b) { return a.compare(b) < 0; }
+
+}  // namespace co
+
+inline fastring& operator<<(fastring& s, const co::small_string& x) {
+    return s.append(x.data(), x.size());
+}
+
+inline fastring& operator+=(fastring& s, const co::small_string& x) {
+    return s.append(x.data(), x.size());
+}
+
+inline std::ostream& operator<<(std::ostream& os, const co::small_string& s) {
+    return os.write(s.data(), s.size());
+}
+
+namespace std {
+template <>
+struct hash<co::small_string> {
+    size_t operator()(const co::small_string& s) const {
+        return (size_t)wyhash(s.data(), s.size());
+    }
+};
+}  // namespace std
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <initializer_list>
+#include <type_traits>
+
+#include "def.h"
+#include "god.h"
+
+namespace co {
+
+// A vector with inline storage for up to N elements, the memory is allocated
+// from the heap only when it grows beyond that. It is for short-lived vectors
+// that usually hold a few elements, where co::vector always has to malloc.
+//   - It has the same API as co::vector, iterators are plain pointers.
+//   - Elements are stored inside the object until it spills to the heap, they
+//     are moved when the object is moved.
+//
+//   co::small_vector<int, 4> v;  // no heap allocation
+//   v.push_back(1);
+//   v.emplace_back(2);
+template <typename T, size_t N>
+class small_vector {
+    static_assert(N > 0, "N must be greater than 0");
+
+  public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    small_vector() noexcept : _cap(N), _size(0), _p(this->_buf()) {}
+
+    // create an empty vector with capacity: @cap
+    explicit small_vector(size_t cap) : small_vector() { this->reserve(cap); }
+
+    // create a vector of n elements with value @x
+    small_vector(size_t n, const T& x) : small_vector() { this->append(n, x); }
+
+    small_vector(const small_vector& x) : small_vector() { this->append(x.data(), x.size()); }
+
+    // elements are moved if @x is inline, otherwise the memory is taken over
+    small_vector(small_vector&& x) noexcept : small_vector() { this->_take(x); }
+
+    small_vector(std::initializer_list<T> x) : small_vector() {
+        this->reserve(x.size());
+        for (const auto& e : x) new (_p + _size++) T(e);
+    }
+
+    template <typename It, god::if_t<std::is_class<It>::value, int> = 0>
+    small_vector(It beg, It end) : small_vector() {
+        this->append(beg, end);
+    }
+
+    small_vector(const T* p, size_t n) : small_vector() { this->append(p, n); }
+
+    ~small_vector() { this->reset(); }
+
+    small_vector& operator=(const small_vector& x) {
+        if (&x != this) {
+            this->clear();
+            this->append(x.data(), x.size());
+        }
+        return *this;
+    }
+
+    small_vector& operator=(small_vector&& x) noexcept {
+        if (&x != this) {
+            this->reset();
+            this->_take(x);
+        }
+        return *this;
+    }
+
+    small_vector& operator=(std::initializer_list<T> x) {
+        this->clear();
+        this->reserve(x.size());
+        for (const auto& e : x) new (_p + _size++) T(e);
+        return *this;
+    }
+
+    size_t capacity() const noexcept { return _cap; }
+    size_t size() const noexcept { return _size; }
+    T* data() const noexcept { return _p; }
+    bool empty() const noexcept { return _size == 0; }
+
+    // whether the elements are stored inline, without heap allocation
+    bool is_inline() const noexcept { return _p == this->_buf(); }
+
+    T& back() { return _p[_size - 1]; }
+    const T& back() const { return _p[_size - 1]; }
+
+    T& front() { return _p[0]; }
+    const T& front() const { return _p[0]; }
+
+    T& operator[](size_t n) { return _p[n]; }
+    const T& operator[](size_t n) const { return _p[n]; }
+
+    iterator begin() const noexcept { return _p; }
+    iterator end() const noexcept { return _p + _size; }
+
+    void reserve(size_t n) {
+        if (_cap < n) this->_grow(n);
+    }
+
+    void resize(size_t n) {
+        this->reserve(n);
+        for (size_t i = n; i < _size; ++i) _p[i].~T();
+        for (size_t i = _size; i < n; ++i) new (_p + i) T();
+        _size = n;
+    }
+
+    // destroy all elements and free the memory
+    void reset() {
+        this->clear();
+        if (!this->is_inline()) {
+            ::free(_p);
+            _p = this->_buf();
+            _cap = N;
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < _size; ++i) _p[i].~T();
+        _size = 0;
+    }
+
+    // @x may be an element of this vector
+    void append(const T& x) { this->emplace_back(x); }
+
+    void append(T&& x) { this->emplace_back(std::move(x)); }
+
+    void append(size_t n, const T& x) {
+        if (_cap < _size + n) {
+            const T v(x);
+            this->reserve(_size + n);
+            for (size_t i = 0; i < n; ++i) new (_p + _size++) T(v);
+        } else {
+            for (size_t i = 0; i < n; ++i) new (_p + _size++) T(x);
+        }
+    }
+
+    template <typename It, god::if_t<std::is_class<It>::value, int> = 0>
+    void append(It beg, It end) {
+        for (auto it = beg; it != end; ++it) this->append(*it);
+    }
+
+    // append n elements, @p may point to elements of this vector
+    void append(const T* p, size_t n) {
+        if (_cap < _size + n) {
+            const bool inside = _p <= p && p < _p + _size;
+            const size_t x = p - _p;
+            this->reserve(_size + (_size >> 1) + n);
+            if (inside) p = _p + x;
+        }
+        for (size_t i = 0; i < n; ++i) new (_p + _size++) T(p[i]);
+    }
+
+    void append(const small_vector& x) { this->append(x.data(), x.size()); }
+
+    // insert a new element (construct with args x...) at the back
+    //   - @x... may refer to elements of this vector, it is safe even if the
+    //     vector grows.
+    template <typename... X>
+    void emplace_back(X&&... x) {
+        if (unlikely(_size == _cap)) {
+            this->_grow_and_emplace(std::forward<X>(x)...);
+        } else {
+            new (_p + _size++) T(std::forward<X>(x)...);
+        }
+    }
+
+    void push_back(const T& x) { this->append(x); }
+    void push_back(T&& x) { this->append(std::move(x)); }
+
+    // pop and return the last element
+    T pop_back() {
+        T x(std::move(_p[--_size]));
+        _p[_size].~T();
+        return x;
+    }
+
+    // remove the last element
+    void remove_back() {
+        if (_size > 0) _p[--_size].~T();
+    }
+
+    // remove the nth element, and move the last element to the nth position
+    void remove(size_t n) {
+        if (n < _size) {
+            _p[n].~T();
+            if (n != --_size) this->_relocate_n(_p + n, _p + _size, 1);
+        }
+    }
+
+    void swap(small_vector& x) noexcept {
+        small_vector t(std::move(x));
+        x = std::move(*this);
+        *this = std::move(t);
+    }
+
+  private:
+    T* _buf() const noexcept { return (T*)&_s; }
+
+    // take over the elements of @x, this vector MUST be empty and inline
+    void _take(small_vector& x) noexcept {
+        if (x.is_inline()) {
+            this->_relocate_n(_p, x._p, x._size);
+        } else {
+            _p = x._p;
+            _cap = x._cap;
+            x._p = x._buf();
+            x._cap = N;
+        }
+        _size = x._size;
+        x._size = 0;
+    }
+
+    void _grow(size_t cap) {
+        T* p;
+        if (!this->is_inline() && god::is_trivially_relocatable<T>()) {
+            p = (T*)::realloc((void*)_p, sizeof(T) * cap);
+            assert(p);
+        } else {
+            p = (T*)::malloc(sizeof(T) * cap);
+            assert(p);
+            this->_relocate_n(p, _p, _size);
+            if (!this->is_inline()) ::free(_p);
+        }
+        _p = p;
+        _cap = cap;
+    }
+
+    // the new element is constructed before the old memory is released, as
+    // the args may refer to elements of this vector.
+    template <typename... X>
+    void _grow_and_emplace(X&&... x) {
+        const size_t cap = _cap + (_cap >> 1) + 1;
+        T* p = (T*)::malloc(sizeof(T) * cap);
+        assert(p);
+        new (p + _size) T(std::forward<X>(x)...);
+        this->_relocate_n(p, _p, _size);
+        if (!this->is_inline()) ::free(_p);
+        _p = p;
+        _cap = cap;
+        ++_size;
+    }
+
+    // move @n elements from @src to uninitialized memory @dst, and destroy the
+    // elements in @src.
+    template <typename X = T, god::if_t<god::is_trivially_relocatable<X>(), int> = 0>
+    void _relocate_n(T* dst, T* src, size_t n) {
+        if (n > 0) memcpy((void*)dst, (const void*)src, sizeof(T) * n);
+    }
+
+    template <typename X = T, god::if_t<!god::is_trivially_relocatable<X>(), int> = 0>
+    void _relocate_n(T* dst, T* src, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            new (dst + i) T(std::move(src[i]));
+            src[i].~T();
+        }
+    }
+
+    size_t _cap;
+    size_t _size;
+    T* _p;
+    typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type _s;
+};
+
+}  // namespace co
@@ -2,6 +2,8 @@
 
 #include "def.h"
 
+struct iovec;
+
 namespace ssl {
 
 typedef void S; // SSL
@@ -122,6 +124,100 @@ __coapi int use_certificate_file(C* c, const char* path);
  */
 __coapi int check_private_key(const C* c);
 
+/**
+ * set protocols for ALPN 
+ *   - A server selects the first protocol in @protos that is also offered by the 
+ *     client, a client offers these protocols to the server. 
+ * 
+ * @param c       a pointer to SSL_CTX.
+ * @param protos  comma-separated protocols in order of preference, e.g. "h2,http/1.1".
+ * 
+ * @return        1 on success, otherwise failed.
+ */
+__coapi int set_alpn(C* c, const char* protos);
+
+/**
+ * get the protocol selected by ALPN 
+ * 
+ * @param s  a pointer to SSL.
+ * @param n  length of the protocol will be stored here.
+ * 
+ * @return   a pointer to the protocol, which is not null-terminated, 
+ *           or NULL if no protocol was selected.
+ */
+__coapi const char* get_alpn(const S* s, unsigned int* n);
+
+/**
+ * enable kernel TLS on a SSL_CTX 
+ *   - After the handshake, records are encrypted or decrypted by the kernel, and 
+ *     ssl::send(), ssl::sendv() and ssl::sendfile() write to the socket directly. 
+ *   - It requires linux with the tls module loaded, and openssl 3.0+ built with 
+ *     ktls. If the kernel does not support the cipher, openssl falls back to the 
+ *     user space silently, see ktls_send() and ktls_recv(). 
+ * 
+ * @param c  a pointer to SSL_CTX.
+ * 
+ * @return   1 on success, 0 if openssl does not support ktls.
+ */
+__coapi int enable_ktls(C* c);
+
+/**
+ * check whether kernel TLS is used for sending on a SSL 
+ * 
+ * @param s  a pointer to SSL.
+ */
+__coapi bool ktls_send(const S* s);
+
+/**
+ * check whether kernel TLS is used for receiving on a SSL 
+ * 
+ * @param s  a pointer to SSL.
+ */
+__coapi bool ktls_recv(const S* s);
+
+/**
+ * issue session tickets with rotating keys on a server 
+ *   - Tickets are encrypted with keys made in memory, and a new key is made every 
+ *     @sec seconds. Tickets of the previous key are still accepted, and clients 
+ *     get a new ticket then. 
+ *   - Sessions are also expired after 2 * @sec seconds. 
+ * 
+ * @param c    a pointer to SSL_CTX.
+ * @param sec  lifetime of a ticket key in seconds, must be > 0.
+ * 
+ * @return     1 on success, otherwise failed.
+ */
+__coapi int set_ticket_key_rotation(C* c, int sec);
+
+/**
+ * enable the client session cache on a SSL_CTX 
+ *   - Sessions (and TLS 1.3 tickets) received by SSLs of this SSL_CTX are stored in 
+ *     a process-wide cache, under the key set by use_cached_session(). 
+ * 
+ * @param c  a pointer to SSL_CTX.
+ */
+__coapi void enable_session_cache(C* c);
+
+/**
+ * resume a cached session on a client SSL 
+ *   - It MUST be called before connect(), and the SSL_CTX of @s MUST have the 
+ *     session cache enabled by enable_session_cache(). 
+ *   - New sessions of this connection will be stored under @key. 
+ * 
+ * @param s    a pointer to SSL.
+ * @param key  key of the session, e.g. "host:port".
+ * 
+ * @return     1 if a cached session was set, otherwise 0.
+ */
+__coapi int use_cached_session(S* s, const char* key);
+
+/**
+ * check whether a session was reused in the handshake 
+ * 
+ * @param s  a pointer to SSL.
+ */
+__coapi bool session_reused(const S* s);
+
 /**
  * shutdown a ssl connection 
  *   - It MUST be called in the coroutine that performed the I/O operation. 
@@ -145,6 +241,9 @@ __coapi int shutdown(S* s, int ms=3000);
 /**
  * wait for a TLS/SSL client to initiate a handshake 
  *   - It MUST be called in the coroutine that performed the I/O operation. 
+ *   - If FLG_ssl_offload_handshake is true, each step of the handshake runs in 
+ *     the blocking thread pool (see co::run_blocking()), the coroutine waits for 
+ *     the socket in the scheduler between the steps. 
  * 
  * @param s   a pointer to SSL.
  * @param ms  timeout in milliseconds, -1 for never timeout. 
@@ -215,6 +314,41 @@ __coapi int recvn(S* s, void* buf, int n, int ms=-1);
  */
 __coapi int send(S* s, const void* buf, int n, int ms=-1);
 
+/**
+ * send data in multiple buffers on a TLS/SSL connection 
+ *   - It MUST be called in a coroutine. 
+ *   - Small buffers are merged into TLS records of up to 16k, large ones are 
+ *     written directly without copying. 
+ * 
+ * @param s    a pointer to SSL.
+ * @param iov  an array of buffers.
+ * @param n    number of buffers.
+ * @param ms   timeout in milliseconds, -1 for never timeout. 
+ *             default: -1. 
+ * 
+ * @return     total bytes of the buffers on success, 
+ *           <=0 on any error, call ssl::strerror() to get the error message. 
+ */
+__coapi int sendv(S* s, const struct iovec* iov, int n, int ms=-1);
+
+/**
+ * send part of a file on a TLS/SSL connection 
+ *   - It MUST be called in a coroutine. 
+ *   - SSL_sendfile is used if kernel TLS is enabled for sending (openssl 3.0+), 
+ *     otherwise the file is read and sent in chunks of 16k. 
+ * 
+ * @param s    a pointer to SSL.
+ * @param fd   a file descriptor opened for reading.
+ * @param off  offset in the file to start from.
+ * @param len  bytes to be sent.
+ * @param ms   timeout in milliseconds, -1 for never timeout. 
+ *             default: -1. 
+ * 
+ * @return     len on success, 
+ *           <=0 on any error, call ssl::strerror() to get the error message. 
+ */
+__coapi int64_t sendfile(S* s, int fd, int64_t off, int64_t len, int ms=-1);
+
 /**
  * check whether a previous API call has timed out 
  *   - When an API with a timeout like ssl::recv returns, ssl::timeout() can be called 
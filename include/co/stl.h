@@ -1,9 +1,12 @@
 #pragma once
 
 #include <deque>
+#include <iterator>
 #include <list>
 #include <map>
 #include <set>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -11,9 +14,22 @@
 #include "clist.h"
 #include "fastream.h"
 #include "hash/murmur_hash.h"
+#include "hash/wyhash.h"
 #include "table.h"
 #include "vector.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CO_FLAT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CO_FLAT_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace co {
 namespace xx {
 
@@ -37,7 +53,14 @@ struct hash {
 
 template <>
 struct hash<const char*> {
-    size_t operator()(const char* x) const noexcept { return murmur_hash(x, strlen(x)); }
+    size_t operator()(const char* x) const noexcept { return (size_t)wyhash(x, strlen(x)); }
+};
+
+template <>
+struct hash<std::string> {
+    size_t operator()(const std::string& x) const noexcept {
+        return (size_t)wyhash(x.data(), x.size());
+    }
 };
 
 template <class T>
@@ -83,104 +106,734 @@ template <class K, class Hash = xx::hash<K>, class Pred = xx::eq<K>,
           class Alloc = std::allocator<K>>
 using hash_set = std::unordered_set<K, Hash, Pred, Alloc>;
 
-template <class K, class V, class Hash = xx::hash<K>, class Pred = xx::eq<K>,
-          class Alloc = std::allocator<std::pair<const K, V>>>
+// A map with a max capacity, the least recently used element is removed when
+// it is full and a new element is inserted.
+//   - Elements are stored in one array and linked intrusively by 32-bit indexes,
+//     both into the hash buckets and into the LRU list, so the key is stored
+//     only once. The array grows up to the capacity, after that an insertion
+//     reuses the element evicted, no memory is allocated.
+//   - find() moves the element found to the front of the LRU list.
+//   - Iterators go from the most recently used element to the least. They are
+//     invalidated only when the element they point to is erased or evicted.
+template <class K, class V, class Hash = xx::hash<K>, class Pred = xx::eq<K>>
 class lru_map {
   public:
-    typedef typename std::unordered_map<K, V, Hash, Pred, Alloc> impl_type;
-    typedef typename impl_type::iterator iterator;
-    typedef typename impl_type::key_type key_type;
-    typedef typename impl_type::value_type value_type;
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+
+    class iterator {
+      public:
+        iterator() noexcept : _m(0), _i(kNil) {}
+        iterator(const lru_map* m, uint32_t i) noexcept : _m((lru_map*)m), _i(i) {}
 
-    typedef typename Alloc::template rebind<K>::other list_allocator;
-    // typedef typename std::allocator_traits<Alloc>::template rebind_alloc<K> list_allocator;
+        value_type& operator*() const { return _m->_nodes[_i].kv(); }
+        value_type* operator->() const { return &_m->_nodes[_i].kv(); }
+
+        iterator& operator++() {
+            _i = _m->_nodes[_i].next;
+            return *this;
+        }
 
-    typedef typename std::list<K, list_allocator> list_type;
+        iterator operator++(int) {
+            iterator it(*this);
+            ++*this;
+            return it;
+        }
 
-    typedef typename std::pair<const K, typename list_type::iterator> help_value_type;
+        bool operator==(const iterator& it) const { return _i == it._i; }
+        bool operator!=(const iterator& it) const { return _i != it._i; }
 
-    typedef typename Alloc::template rebind<help_value_type>::other help_allocator;
-    // typedef typename std::allocator_traits<Alloc>::template rebind_alloc<help_value_type>
-    // help_allocator;
+      private:
+        friend class lru_map;
+        lru_map* _m;
+        uint32_t _i;
+    };
 
-    typedef typename std::unordered_map<K, typename list_type::iterator, Hash, Pred, help_allocator>
-        help_type;
+    lru_map() noexcept : lru_map(1024) {}
 
-    lru_map() : _capacity(1024) {}
-    ~lru_map() = default;
+    explicit lru_map(size_t capacity) noexcept
+        : _nodes(0), _buckets(0), _mask(0), _n(0), _ncap(0), _size(0),
+          _head(kNil), _tail(kNil), _free(kNil) {
+        _capacity = capacity > 0 && capacity < kNil ? (uint32_t)capacity : 1024;
+    }
 
-    explicit lru_map(size_t capacity) { _capacity = capacity > 0 ? capacity : 1024; }
+    lru_map(lru_map&& x) noexcept { this->_steal(x); }
 
-    lru_map(lru_map&& x) : _kv(std::move(x._kv)), _ki(std::move(x._ki)), _kl(std::move(x._kl)) {
-        _capacity = x._capacity;
+    lru_map& operator=(lru_map&& x) noexcept {
+        if (&x != this) {
+            this->_reset();
+            this->_steal(x);
+        }
+        return *this;
     }
 
-    size_t size() const { return _kv.size(); }
-    bool empty() const { return this->size() == 0; }
-    iterator begin() const { return ((lru_map*)this)->_kv.begin(); }
-    iterator end() const { return ((lru_map*)this)->_kv.end(); }
+    ~lru_map() { this->_reset(); }
+
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    size_t capacity() const noexcept { return _capacity; }
+
+    iterator begin() const noexcept { return iterator(this, _head); }
+    iterator end() const noexcept { return iterator(this, kNil); }
 
     iterator find(const key_type& key) {
-        iterator it = _kv.find(key);
-        if (it != _kv.end() && _kl.front() != key) {
-            auto ki = _ki.find(key);
-            _kl.splice(_kl.begin(), _kl, ki->second);  // move key to the front
-            ki->second = _kl.begin();
+        const uint32_t i = this->_find(key, this->_hash_of(key));
+        if (i != kNil && i != _head) {
+            this->_unlink(i);
+            this->_push_front(i);
         }
-        return it;
+        return iterator(this, i);
     }
 
     // The key is not inserted if it already exists.
     template <typename Key, typename Val>
     void insert(Key&& key, Val&& value) {
-        if (_kv.size() >= _capacity) {
-            K k = _kl.back();
-            _kl.pop_back();
-            _kv.erase(k);
-            _ki.erase(k);
-        }
-        auto r = _kv.emplace(std::forward<Key>(key), std::forward<Val>(value));
-        if (r.second) {
-            const auto& k = r.first->first;
-            _kl.push_front(k);
-            _ki[k] = _kl.begin();
+        const uint32_t h = this->_hash_of(key);
+        if (this->_find(key, h) != kNil) return;
+
+        uint32_t i;
+        if (_size >= _capacity) {
+            i = _tail;  // evict the least recently used one
+            this->_unlink(i);
+            this->_unlink_bucket(i);
+            _nodes[i].kv().~value_type();
+            --_size;
+        } else {
+            i = this->_new_node();
         }
+
+        node_t& n = _nodes[i];
+        new (&n.kv()) value_type(std::forward<Key>(key), std::forward<Val>(value));
+        n.hash = h;
+        if (++_size > _mask) this->_grow_buckets();
+        n.hnext = _buckets[h & _mask];
+        _buckets[h & _mask] = i;
+        this->_push_front(i);
     }
 
     void erase(iterator it) {
-        if (it != _kv.end()) {
-            auto ki = _ki.find(it->first);
-            _kl.erase(ki->second);
-            _ki.erase(ki);
-            _kv.erase(it);
-        }
+        if (it != this->end()) this->_erase(it._i);
     }
 
-    void erase(const key_type& key) { this->erase(_kv.find(key)); }
+    void erase(const key_type& key) {
+        const uint32_t i = this->_find(key, this->_hash_of(key));
+        if (i != kNil) this->_erase(i);
+    }
 
+    // remove all elements, the memory is kept
     void clear() {
-        _kv.clear();
-        _ki.clear();
-        _kl.clear();
+        for (uint32_t i = _head; i != kNil; i = _nodes[i].next) _nodes[i].kv().~value_type();
+        if (_buckets) memset(_buckets, 0xff, sizeof(uint32_t) * (_mask + 1));
+        _n = 0;
+        _size = 0;
+        _head = _tail = _free = kNil;
     }
 
     void swap(lru_map& x) noexcept {
-        _kv.swap(x._kv);
-        _ki.swap(x._ki);
-        _kl.swap(x._kl);
-        std::swap(_capacity, x._capacity);
+        char t[sizeof(lru_map)];
+        memcpy(t, (void*)&x, sizeof(lru_map));
+        memcpy((void*)&x, (void*)this, sizeof(lru_map));
+        memcpy((void*)this, t, sizeof(lru_map));
     }
 
     void swap(lru_map&& x) noexcept { x.swap(*this); }
 
   private:
-    impl_type _kv;
-    help_type _ki;
-    list_type _kl;     // key list
-    size_t _capacity;  // max capacity
+    static const uint32_t kNil = (uint32_t)-1;
+
+    struct node_t {
+        uint32_t prev;   // LRU list, the most recently used one is at the head
+        uint32_t next;
+        uint32_t hnext;  // next node in the bucket, or in the free list
+        uint32_t hash;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type v;
+        value_type& kv() { return *(value_type*)&v; }
+    };
+
+    uint32_t _hash_of(const key_type& key) const {
+        return (uint32_t)::xx::wy::mix((uint64_t)Hash()(key), 0x9e3779b97f4a7c15ull);
+    }
+
+    uint32_t _find(const key_type& key, uint32_t h) const {
+        if (!_buckets) return kNil;
+        uint32_t i = _buckets[h & _mask];
+        while (i != kNil) {
+            node_t& n = _nodes[i];
+            if (n.hash == h && Pred()(n.kv().first, key)) return i;
+            i = n.hnext;
+        }
+        return kNil;
+    }
+
+    void _push_front(uint32_t i) {
+        node_t& n = _nodes[i];
+        n.prev = kNil;
+        n.next = _head;
+        if (_head != kNil) _nodes[_head].prev = i;
+        _head = i;
+        if (_tail == kNil) _tail = i;
+    }
+
+    void _unlink(uint32_t i) {
+        node_t& n = _nodes[i];
+        if (n.prev != kNil) _nodes[n.prev].next = n.next; else _head = n.next;
+        if (n.next != kNil) _nodes[n.next].prev = n.prev; else _tail = n.prev;
+    }
+
+    void _unlink_bucket(uint32_t i) {
+        uint32_t* p = &_buckets[_nodes[i].hash & _mask];
+        while (*p != i) p = &_nodes[*p].hnext;
+        *p = _nodes[i].hnext;
+    }
+
+    void _erase(uint32_t i) {
+        this->_unlink(i);
+        this->_unlink_bucket(i);
+        _nodes[i].kv().~value_type();
+        _nodes[i].hnext = _free;
+        _free = i;
+        --_size;
+    }
+
+    // a node from the free list, or from the end of the array, all nodes in
+    // the array are alive when it grows, as the free list is empty.
+    uint32_t _new_node() {
+        if (_free != kNil) {
+            const uint32_t i = _free;
+            _free = _nodes[i].hnext;
+            return i;
+        }
+        if (_n == _ncap) {
+            uint32_t cap = _ncap + (_ncap >> 1) + 8;
+            if (cap > _capacity) cap = _capacity;
+            node_t* p = (node_t*)::malloc(sizeof(node_t) * cap);
+            assert(p);
+            for (uint32_t i = 0; i < _n; ++i) {
+                node_t& o = _nodes[i];
+                memcpy((void*)&p[i], (void*)&o, offsetof(node_t, v));
+                // the element is destroyed right after, its key can be moved
+                value_type& x = o.kv();
+                new (&p[i].kv()) value_type(std::move(const_cast<K&>(x.first)), std::move(x.second));
+                x.~value_type();
+            }
+            ::free(_nodes);
+            _nodes = p;
+            _ncap = cap;
+        }
+        return _n++;
+    }
+
+    // buckets are at least as many as the elements
+    void _grow_buckets() {
+        const uint32_t n = _mask ? (_mask + 1) * 2 : 16;
+        ::free(_buckets);
+        _buckets = (uint32_t*)::malloc(sizeof(uint32_t) * n);
+        assert(_buckets);
+        memset(_buckets, 0xff, sizeof(uint32_t) * n);
+        _mask = n - 1;
+        for (uint32_t i = _head; i != kNil; i = _nodes[i].next) {
+            node_t& x = _nodes[i];
+            x.hnext = _buckets[x.hash & _mask];
+            _buckets[x.hash & _mask] = i;
+        }
+    }
+
+    void _reset() {
+        if (_nodes) {
+            for (uint32_t i = _head; i != kNil; i = _nodes[i].next) _nodes[i].kv().~value_type();
+            ::free(_nodes);
+            ::free(_buckets);
+            _nodes = 0;
+            _buckets = 0;
+        }
+    }
+
+    void _steal(lru_map& x) noexcept {
+        memcpy((void*)this, (void*)&x, sizeof(lru_map));
+        x._nodes = 0;
+        x._buckets = 0;
+        x._mask = x._n = x._ncap = x._size = 0;
+        x._head = x._tail = x._free = kNil;
+    }
+
+    node_t* _nodes;
+    uint32_t* _buckets;
+    uint32_t _mask;      // buckets - 1, or 0 if there is no bucket
+    uint32_t _n;         // nodes used, including those in the free list
+    uint32_t _ncap;      // nodes allocated
+    uint32_t _size;      // elements alive
+    uint32_t _capacity;  // max number of elements
+    uint32_t _head;
+    uint32_t _tail;
+    uint32_t _free;      // free list of nodes erased
     DISALLOW_COPY_AND_ASSIGN(lru_map);
 };
 
+namespace xx {
+namespace flat {
+
+// Control bytes of the slots: a full slot holds the low 7 bits of the hash, the
+// others are negative.
+enum : int8_t {
+    kEmpty = -128,
+    kDeleted = -2,
+    kSentinel = -1,  // end of the table, for iterators
+};
+
+inline uint32_t ctz(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward64(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctzll(x);
+#endif
+}
+
+inline uint32_t clz(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanReverse64(&r, x);
+    return 63 - (uint32_t)r;
+#else
+    return (uint32_t)__builtin_clzll(x);
+#endif
+}
+
+// A group of 16 control bytes, probed at a time. A mask has one bit for each
+// slot in the group that matches, bits for NEON are at 4 * i + 3.
+struct group {
+    static const size_t W = 16;
+#if defined(CO_FLAT_SSE2)
+    typedef uint32_t mask_t;
+    static const int kShift = 0;
+
+    explicit group(const int8_t* p) : v(_mm_loadu_si128((const __m128i*)p)) {}
+    mask_t match(int8_t h) const {
+        return (mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), v));
+    }
+    mask_t match_empty() const { return this->match(kEmpty); }
+    // empty or deleted
+    mask_t match_free() const {
+        return (mask_t)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(kSentinel), v));
+    }
+    // number of slots at the end of the group before the last set bit in @m
+    static uint32_t leading(mask_t m) { return clz(m) - 48; }
+    __m128i v;
+#elif defined(CO_FLAT_NEON)
+    typedef uint64_t mask_t;
+    static const int kShift = 2;
+
+    explicit group(const int8_t* p) : v(vld1q_s8(p)) {}
+    static mask_t to_mask(uint8x16_t x) {
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(x), 4)), 0) &
+               0x8888888888888888ull;
+    }
+    mask_t match(int8_t h) const { return to_mask(vceqq_s8(vdupq_n_s8(h), v)); }
+    mask_t match_empty() const { return this->match(kEmpty); }
+    mask_t match_free() const { return to_mask(vcltq_s8(v, vdupq_n_s8(kSentinel))); }
+    static uint32_t leading(mask_t m) { return clz(m) >> 2; }
+    int8x16_t v;
+#else
+    typedef uint32_t mask_t;
+    static const int kShift = 0;
+
+    explicit group(const int8_t* p) { memcpy(v, p, W); }
+    mask_t match(int8_t h) const {
+        mask_t m = 0;
+        for (size_t i = 0; i < W; ++i) m |= (mask_t)(v[i] == h) << i;
+        return m;
+    }
+    mask_t match_empty() const { return this->match(kEmpty); }
+    mask_t match_free() const {
+        mask_t m = 0;
+        for (size_t i = 0; i < W; ++i) m |= (mask_t)(v[i] < kSentinel) << i;
+        return m;
+    }
+    static uint32_t leading(mask_t m) { return clz(m) - 48; }
+    int8_t v[W];
+#endif
+    // index of the first slot in @m
+    static uint32_t first(mask_t m) { return ctz(m) >> kShift; }
+};
+
+// Groups are probed in a triangular sequence, which visits every group once
+// as the capacity is 2^n - 1.
+struct probe {
+    probe(size_t h, size_t cap) : mask(cap), off(h & cap), step(0) {}
+    size_t offset(size_t i) const { return (off + i) & mask; }
+    void next() {
+        step += group::W;
+        off = (off + step) & mask;
+    }
+    size_t mask;
+    size_t off;
+    size_t step;
+};
+
+// control bytes of an empty table, no memory is allocated for it
+inline int8_t* empty_ctrl() {
+    alignas(16) static int8_t c[group::W] = {
+        kSentinel, kEmpty, kEmpty, kEmpty, kEmpty, kEmpty, kEmpty, kEmpty,
+        kEmpty,    kEmpty, kEmpty, kEmpty, kEmpty, kEmpty, kEmpty, kEmpty,
+    };
+    return c;
+}
+
+}  // namespace flat
+}  // namespace xx
+
+// An open-addressing hash map, a subset of the std::unordered_map interface,
+// in the way of Google's SwissTable (absl::flat_hash_map).
+//   - Elements are stored in a flat array, with an array of control bytes
+//     holding 7 bits of the hash of each slot. A lookup compares 16 control
+//     bytes at once with SSE2 or NEON, and touches the elements only for the
+//     candidates, so there is no node allocation and little pointer chasing.
+//   - The table grows when 7/8 of it is used, all elements are moved then.
+//     Iterators and references are invalidated by any insertion that grows
+//     the table, but not by erase().
+//   - emplace() does not construct the value if the key already exists.
+//
+//   co::flat_hash_map<fastring, int> m;
+//   m["hello"] = 1;
+//   auto it = m.find("hello");
+template <class K, class V, class Hash = xx::hash<K>, class Pred = xx::eq<K>>
+class flat_hash_map {
+  public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef value_type slot_type;
+    typedef xx::flat::group group;
+
+    template <bool C>
+    class iter {
+      public:
+        typedef typename std::conditional<C, const slot_type, slot_type>::type T;
+        typedef std::forward_iterator_tag iterator_category;
+        typedef slot_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        iter() noexcept : _c(0), _s(0) {}
+        iter(const int8_t* c, slot_type* s) noexcept : _c(c), _s(s) {}
+
+        // iterator -> const_iterator
+        template <bool X, god::if_t<C && !X, int> = 0>
+        iter(const iter<X>& i) noexcept : _c(i._c), _s(i._s) {}
+
+        T& operator*() const { return *_s; }
+        T* operator->() const { return _s; }
+
+        iter& operator++() {
+            ++_c, ++_s;
+            this->_skip();
+            return *this;
+        }
+
+        iter operator++(int) {
+            iter i(*this);
+            ++*this;
+            return i;
+        }
+
+        bool operator==(const iter& i) const { return _c == i._c; }
+        bool operator!=(const iter& i) const { return _c != i._c; }
+
+      private:
+        friend class flat_hash_map;
+        template <bool X> friend class iter;
+
+        // move to the next full slot, or the sentinel at the end
+        void _skip() {
+            while (*_c < xx::flat::kSentinel) ++_c, ++_s;
+        }
+
+        const int8_t* _c;
+        slot_type* _s;
+    };
+
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    flat_hash_map() noexcept
+        : _ctrl(xx::flat::empty_ctrl()), _slots(0), _size(0), _cap(0), _growth(0) {}
+
+    // create an empty map with room for @n elements
+    explicit flat_hash_map(size_t n) : flat_hash_map() { this->reserve(n); }
+
+    flat_hash_map(std::initializer_list<value_type> x) : flat_hash_map(x.size()) {
+        for (const auto& e : x) this->insert(e);
+    }
+
+    flat_hash_map(const flat_hash_map& x) : flat_hash_map(x.size()) {
+        for (const auto& e : x) this->_insert_unique(e);
+    }
+
+    flat_hash_map(flat_hash_map&& x) noexcept
+        : _ctrl(x._ctrl), _slots(x._slots), _size(x._size), _cap(x._cap), _growth(x._growth) {
+        new (&x) flat_hash_map();
+    }
+
+    ~flat_hash_map() { this->_reset(); }
+
+    flat_hash_map& operator=(const flat_hash_map& x) {
+        if (&x != this) {
+            this->_reset();
+            new (this) flat_hash_map(x);
+        }
+        return *this;
+    }
+
+    flat_hash_map& operator=(flat_hash_map&& x) noexcept {
+        if (&x != this) {
+            this->_reset();
+            new (this) flat_hash_map(std::move(x));
+        }
+        return *this;
+    }
+
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    size_t capacity() const noexcept { return _cap; }
+
+    iterator begin() noexcept {
+        iterator it(_ctrl, _slots);
+        it._skip();
+        return it;
+    }
+
+    iterator end() noexcept { return iterator(_ctrl + _cap, _slots + _cap); }
+    const_iterator begin() const noexcept { return ((flat_hash_map*)this)->begin(); }
+    const_iterator end() const noexcept { return ((flat_hash_map*)this)->end(); }
+    const_iterator cbegin() const noexcept { return this->begin(); }
+    const_iterator cend() const noexcept { return this->end(); }
+
+    iterator find(const K& key) {
+        const size_t i = this->_find(key, this->_hash_of(key));
+        return i != (size_t)-1 ? iterator(_ctrl + i, _slots + i) : this->end();
+    }
+
+    const_iterator find(const K& key) const { return ((flat_hash_map*)this)->find(key); }
+
+    size_t count(const K& key) const {
+        return this->_find(key, this->_hash_of(key)) != (size_t)-1;
+    }
+
+    bool contains(const K& key) const { return this->count(key) != 0; }
+
+    V& operator[](const K& key) {
+        return this->_try_emplace(key).first->second;
+    }
+
+    V& operator[](K&& key) {
+        return this->_try_emplace(std::move(key)).first->second;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& x) {
+        return this->_try_emplace(x.first, x.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type&& x) {
+        return this->_try_emplace(std::move(const_cast<K&>(x.first)), std::move(x.second));
+    }
+
+    // the value is constructed with @args only if @key is not in the map
+    template <class X, class... Y>
+    std::pair<iterator, bool> emplace(X&& key, Y&&... args) {
+        return this->_try_emplace(std::forward<X>(key), std::forward<Y>(args)...);
+    }
+
+    // erase the element at @it, return an iterator to the next element
+    iterator erase(const_iterator it) {
+        const size_t i = it._s - _slots;
+        this->_erase(i);
+        iterator r(_ctrl + i, _slots + i);
+        r._skip();
+        return r;
+    }
+
+    iterator erase(iterator it) { return this->erase(const_iterator(it)); }
+
+    size_t erase(const K& key) {
+        const size_t i = this->_find(key, this->_hash_of(key));
+        if (i == (size_t)-1) return 0;
+        this->_erase(i);
+        return 1;
+    }
+
+    // remove all elements, the memory is kept
+    void clear() {
+        if (_size > 0) {
+            this->_destroy_all();
+            this->_reset_ctrl();
+            _size = 0;
+            _growth = _growth_of(_cap);
+        }
+    }
+
+    // make room for @n elements, no rehash until there are more of them
+    void reserve(size_t n) {
+        if (n > _size + _growth) {
+            const size_t g = n + (n - 1) / 7;  // capacity for n elements at a load of 7/8
+            this->_resize(_normalize(g));
+        }
+    }
+
+    void swap(flat_hash_map& x) noexcept {
+        std::swap(_ctrl, x._ctrl);
+        std::swap(_slots, x._slots);
+        std::swap(_size, x._size);
+        std::swap(_cap, x._cap);
+        std::swap(_growth, x._growth);
+    }
+
+    void swap(flat_hash_map&& x) noexcept { x.swap(*this); }
+
+  private:
+    static size_t _normalize(size_t n) { return n ? ~(size_t)0 >> xx::flat::clz(n) : 1; }
+    static size_t _growth_of(size_t cap) { return cap - cap / 8; }
+
+    // the hash from the user may be weak (identity for integers), mix it up
+    size_t _hash_of(const K& key) const {
+        return (size_t)::xx::wy::mix((uint64_t)Hash()(key), 0x9e3779b97f4a7c15ull);
+    }
+
+    static int8_t _h2(size_t h) { return (int8_t)(h & 0x7f); }
+
+    // index of @key, or -1 if not found
+    size_t _find(const K& key, size_t h) const {
+        const int8_t h2 = _h2(h);
+        xx::flat::probe p(h >> 7, _cap);
+        while (true) {
+            const group g(_ctrl + p.off);
+            for (auto m = g.match(h2); m; m &= m - 1) {
+                const size_t i = p.offset(group::first(m));
+                if (Pred()(_slots[i].first, key)) return i;
+            }
+            if (g.match_empty()) return (size_t)-1;
+            p.next();
+        }
+    }
+
+    // the first empty or deleted slot for hash @h
+    size_t _find_free(size_t h) const {
+        xx::flat::probe p(h >> 7, _cap);
+        while (true) {
+            const auto m = group(_ctrl + p.off).match_free();
+            if (m) return p.offset(group::first(m));
+            p.next();
+        }
+    }
+
+    // the first W - 1 control bytes are cloned after the sentinel, so that a
+    // group can be loaded from any slot without wrapping around.
+    void _set_ctrl(size_t i, int8_t c) {
+        _ctrl[i] = c;
+        _ctrl[((i - (group::W - 1)) & _cap) + ((group::W - 1) & _cap)] = c;
+    }
+
+    void _reset_ctrl() {
+        memset(_ctrl, xx::flat::kEmpty, _cap + group::W);
+        _ctrl[_cap] = xx::flat::kSentinel;
+    }
+
+    // take a slot for a new element with hash @h, the table may grow
+    size_t _prepare_insert(size_t h) {
+        size_t i = this->_find_free(h);
+        if (unlikely(_growth == 0 && _ctrl[i] != xx::flat::kDeleted)) {
+            // rehash in the same capacity if many slots are deleted
+            this->_resize(_cap > group::W && _size * 32 <= _cap * 25 ? _cap : _cap * 2 + 1);
+            i = this->_find_free(h);
+        }
+        ++_size;
+        _growth -= _ctrl[i] == xx::flat::kEmpty;
+        this->_set_ctrl(i, _h2(h));
+        return i;
+    }
+
+    template <class X, class... Y>
+    std::pair<iterator, bool> _try_emplace(X&& key, Y&&... args) {
+        const size_t h = this->_hash_of(key);
+        size_t i = this->_find(key, h);
+        if (i != (size_t)-1) return std::make_pair(iterator(_ctrl + i, _slots + i), false);
+        i = this->_prepare_insert(h);
+        new (_slots + i) value_type(
+            std::piecewise_construct, std::forward_as_tuple(std::forward<X>(key)),
+            std::forward_as_tuple(std::forward<Y>(args)...)
+        );
+        return std::make_pair(iterator(_ctrl + i, _slots + i), true);
+    }
+
+    void _insert_unique(const value_type& x) {
+        const size_t i = this->_prepare_insert(this->_hash_of(x.first));
+        new (_slots + i) value_type(x);
+    }
+
+    void _erase(size_t i) {
+        _slots[i].~value_type();
+        --_size;
+
+        // The slot can be marked empty if no group through it has ever been full,
+        // or a probe may have passed it and must not stop here.
+        const size_t b = (i - group::W) & _cap;
+        const auto ea = group(_ctrl + i).match_empty();
+        const auto eb = group(_ctrl + b).match_empty();
+        const bool never_full = ea && eb && group::first(ea) + group::leading(eb) < group::W;
+        this->_set_ctrl(i, never_full ? xx::flat::kEmpty : xx::flat::kDeleted);
+        _growth += never_full;
+    }
+
+    void _resize(size_t cap) {
+        int8_t* const ctrl = _ctrl;
+        value_type* const slots = _slots;
+        const size_t old = _cap;
+
+        // control bytes and slots are in one block of memory
+        const size_t n = (cap + group::W + alignof(value_type) - 1) & ~(alignof(value_type) - 1);
+        _ctrl = (int8_t*)::malloc(n + sizeof(value_type) * cap);
+        assert(_ctrl);
+        _slots = (value_type*)((char*)_ctrl + n);
+        _cap = cap;
+        this->_reset_ctrl();
+        _growth = _growth_of(cap) - _size;
+
+        for (size_t i = 0; i < old; ++i) {
+            if (ctrl[i] >= 0) {
+                value_type& x = slots[i];
+                const size_t h = this->_hash_of(x.first);
+                const size_t k = this->_find_free(h);
+                this->_set_ctrl(k, _h2(h));
+                // the element is destroyed right after, its key can be moved
+                new (_slots + k) value_type(std::move(const_cast<K&>(x.first)), std::move(x.second));
+                x.~value_type();
+            }
+        }
+        if (old) ::free(ctrl);
+    }
+
+    void _destroy_all() {
+        for (size_t i = 0; i < _cap; ++i) {
+            if (_ctrl[i] >= 0) _slots[i].~value_type();
+        }
+    }
+
+    void _reset() {
+        if (_cap) {
+            this->_destroy_all();
+            ::free(_ctrl);
+        }
+    }
+
+    int8_t* _ctrl;
+    value_type* _slots;
+    size_t _size;
+    size_t _cap;     // 0 or 2^n - 1
+    size_t _growth;  // elements to insert before the table grows
+};
+
 namespace xx {
 
 struct Fmt {
@@ -332,8 +985,13 @@ struct Fmt {
         return fmt(fs, x.begin(), x.end(), '{', '}');
     }
 
-    template <typename K, typename V, typename H, typename P, typename A>
-    fastream& fmt(fastream& fs, const co::lru_map<K, V, H, P, A>& x) {
+    template <typename K, typename V, typename H, typename P>
+    fastream& fmt(fastream& fs, const co::lru_map<K, V, H, P>& x) {
+        return fmt(fs, x.begin(), x.end(), '{', '}');
+    }
+
+    template <typename K, typename V, typename H, typename P>
+    fastream& fmt(fastream& fs, const co::flat_hash_map<K, V, H, P>& x) {
         return fmt(fs, x.begin(), x.end(), '{', '}');
     }
 };
@@ -416,7 +1074,12 @@ inline fastream& operator<<(fastream& fs, const std::unordered_map<K, V, H, P, A
     return co::xx::Fmt().fmt(fs, x);
 }
 
-template <typename K, typename V, typename H, typename P, typename A>
-inline fastream& operator<<(fastream& fs, const co::lru_map<K, V, H, P, A>& x) {
+template <typename K, typename V, typename H, typename P>
+inline fastream& operator<<(fastream& fs, const co::lru_map<K, V, H, P>& x) {
+    return co::xx::Fmt().fmt(fs, x);
+}
+
+template <typename K, typename V, typename H, typename P>
+inline fastream& operator<<(fastream& fs, const co::flat_hash_map<K, V, H, P>& x) {
     return co::xx::Fmt().fmt(fs, x);
 }
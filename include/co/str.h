@@ -29,6 +29,10 @@ inline fastring replace(const std::string& s, const char* sub, const char* to, s
     return replace(s.data(), s.size(), sub, to, t);
 }
 
+inline fastring replace(co::strview s, co::strview sub, co::strview to, size_t t = 0) {
+    return replace(s.data(), s.size(), sub.data(), sub.size(), to.data(), to.size(), t);
+}
+
 // split string @s (len: @n) by delimiter @c
 // try @t times at most (0 for unlimited)
 __coapi co::vector<fastring> split(const char* s, size_t n, char c, size_t t = 0);
@@ -64,6 +68,218 @@ inline co::vector<fastring> split(const std::string& s, const char* c, size_t t
     return split(s.data(), s.size(), c, strlen(c), t);
 }
 
+// split a slice of a buffer without copying or measuring it first
+//   - str::split(co::strview(buf.data() + pos, n), ',');
+inline co::vector<fastring> split(co::strview s, char c, size_t t = 0) {
+    return split(s.data(), s.size(), c, t);
+}
+
+inline co::vector<fastring> split(co::strview s, co::strview c, size_t t = 0) {
+    return split(s.data(), s.size(), c.data(), c.size(), t);
+}
+
+// split string @s (len: @n) by any of the delimiters in @c (len: @m)
+// try @t times at most (0 for unlimited)
+__coapi co::vector<fastring> split_any(const char* s, size_t n, const char* c, size_t m,
+                                       size_t t = 0);
+
+// str::split_any("x y\tz", " \t");   ->  [ "x", "y", "z" ]
+// str::split_any("x,;y", ",;");       ->  [ "x", "", "y" ]
+inline co::vector<fastring> split_any(const char* s, const char* c, size_t t = 0) {
+    return split_any(s, strlen(s), c, strlen(c), t);
+}
+
+inline co::vector<fastring> split_any(const fastring& s, const char* c, size_t t = 0) {
+    return split_any(s.data(), s.size(), c, strlen(c), t);
+}
+
+inline co::vector<fastring> split_any(const std::string& s, const char* c, size_t t = 0) {
+    return split_any(s.data(), s.size(), c, strlen(c), t);
+}
+
+inline co::vector<fastring> split_any(co::strview s, co::strview c, size_t t = 0) {
+    return split_any(s.data(), s.size(), c.data(), c.size(), t);
+}
+
+// A lazy range of the fields of @s split by a delimiter, the fields are views
+// into @s, nothing is allocated. It yields the same fields as str::split().
+//   - The string MUST outlive the range.
+//
+//   for (co::strview f : str::split_view(line, ',')) { ... }
+//   for (co::strview f : str::split_view(line, ", ")) { ... }
+class split_view {
+  public:
+    // split by the character @c, @t times at most (0 for unlimited)
+    split_view(co::strview s, char c, size_t t = 0) : _s(s), _d(nullptr, 0), _c(c), _t(t) {}
+
+    // split by the string @d, @t times at most (0 for unlimited)
+    split_view(co::strview s, co::strview d, size_t t = 0) : _s(s), _d(d), _c(0), _t(t) {}
+
+    class iterator {
+      public:
+        iterator() noexcept : _r(0), _p(0), _q(0), _n(0) {}
+
+        explicit iterator(const split_view* r) : _r(r), _p(r->_s.data()), _q(0), _n(0) {
+            if (_r->_s.empty() || (_r->_d.data() && _r->_d.empty())) {
+                _p = 0;
+            } else {
+                _q = _r->_find(_p, _n);
+            }
+        }
+
+        co::strview operator*() const { return co::strview(_p, _q - _p); }
+
+        iterator& operator++() {
+            const char* const e = _r->_s.end();
+            if (_q == e) {
+                _p = 0;
+            } else {
+                _p = _q + (_r->_d.data() ? _r->_d.size() : 1);
+                if (_p < e) {
+                    _q = _r->_find(_p, ++_n);
+                } else {
+                    _p = 0;
+                }
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator& x) const { return _p == x._p; }
+        bool operator!=(const iterator& x) const { return _p != x._p; }
+
+      private:
+        const split_view* _r;
+        const char* _p;  // beginning of the current field
+        const char* _q;  // end of the current field
+        size_t _n;       // number of splits done
+    };
+
+    iterator begin() const { return iterator(this); }
+    iterator end() const { return iterator(); }
+
+  private:
+    // end of the field beginning at @p, after @n splits
+    const char* _find(const char* p, size_t n) const {
+        const char* const e = _s.end();
+        if (_t && n == _t) return e;
+        const char* q = _d.data() ? str::memmem(p, e - p, _d.data(), _d.size())
+                                  : (const char*)::memchr(p, _c, e - p);
+        return q ? q : e;
+    }
+
+    co::strview _s;
+    co::strview _d;  // data() is null when splitting by a character
+    char _c;
+    size_t _t;
+};
+
+// split @s by the character @c into @v, @v is cleared first and its memory is
+// reused, the fields are views into @s. Return the number of fields.
+//   - co::vector<co::strview> v;
+//   - str::split_into("x,y,z", ',', v);  // v: [ "x", "y", "z" ]
+inline size_t split_into(co::strview s, char c, co::vector<co::strview>& v, size_t t = 0) {
+    v.clear();
+    for (co::strview f : split_view(s, c, t)) v.push_back(f);
+    return v.size();
+}
+
+inline size_t split_into(co::strview s, co::strview d, co::vector<co::strview>& v, size_t t = 0) {
+    v.clear();
+    for (co::strview f : split_view(s, d, t)) v.push_back(f);
+    return v.size();
+}
+
+// Patterns compiled into an Aho-Corasick automaton, to find or replace all of
+// them in one pass over a string, instead of one pass for each pattern.
+//   - Matches do not overlap. The leftmost match is taken, and the longest one
+//     if several patterns begin there. Among equal patterns the first wins.
+//   - Bytes that can not begin a pattern are skipped 16 at a time with SIMD, if
+//     the patterns begin with no more than 8 distinct bytes.
+//   - Empty patterns are kept for their ids, but never match.
+//   - A matcher is immutable after it is built, it can be shared by threads.
+//
+//   str::matcher m({ "password=", "token=" });
+//   fastring x = m.replace(line, "***");
+//   m.find_all(line, [](size_t pos, size_t len, size_t id) { ... });
+class __coapi matcher {
+  public:
+    // @icase: match ASCII letters case-insensitively
+    matcher(std::initializer_list<co::strview> v, bool icase = false);
+    matcher(const co::vector<fastring>& v, bool icase = false);
+    matcher(const co::vector<co::strview>& v, bool icase = false);
+
+    // number of patterns
+    size_t size() const noexcept { return _n; }
+
+    // find the first match in @s, return false if there is none
+    bool find(co::strview s, size_t& pos, size_t& len, size_t& id) const {
+        const char* const p = this->_find(s.data(), s.end(), len, id);
+        if (p) pos = p - s.data();
+        return p != nullptr;
+    }
+
+    bool contains(co::strview s) const {
+        size_t len, id;
+        return this->_find(s.data(), s.end(), len, id) != nullptr;
+    }
+
+    // call f(pos, len, id) for each match in @s, return the number of matches
+    template <typename F>
+    size_t find_all(co::strview s, F&& f) const {
+        size_t n = 0, len, id;
+        const char* p = s.data();
+        while ((p = this->_find(p, s.end(), len, id))) {
+            f((size_t)(p - s.data()), len, id);
+            p += len;
+            ++n;
+        }
+        return n;
+    }
+
+    // replace each match in @s with @to
+    fastring replace(co::strview s, co::strview to) const {
+        return this->_replace(s, [&to](size_t) { return to; });
+    }
+
+    // replace each match in @s with to[id], where @id is index of the pattern
+    fastring replace(co::strview s, const co::vector<fastring>& to) const {
+        return this->_replace(s, [&to](size_t id) { return co::strview(to[id]); });
+    }
+
+  private:
+    void _build(const co::strview* v, size_t n);
+
+    // beginning of the first match in [p, e), or null if there is none
+    const char* _find(const char* p, const char* e, size_t& len, size_t& id) const;
+
+    template <typename F>
+    fastring _replace(co::strview s, F&& f) const {
+        fastring x(s.size());
+        size_t len, id;
+        const char* p = s.data();
+        const char* q;
+        while ((q = this->_find(p, s.end(), len, id))) {
+            const co::strview to = f(id);
+            x.append(p, q - p).append(to.data(), to.size());
+            p = q + len;
+        }
+        x.append(p, s.end() - p);
+        return x;
+    }
+
+    size_t _n;                     // number of patterns
+    bool _icase;
+    uint32_t _ncls;                // number of byte classes, class 0 is bytes not in patterns
+    uint16_t _cls[256];            // class of each byte
+    uint8_t _start[256];           // 1 if a pattern may begin with the byte
+    char _first[8];                // bytes a pattern may begin with, for the SIMD scan
+    int _nfirst;                   // number of bytes in _first, 0 to disable the scan
+    co::vector<uint32_t> _next;    // transitions, _next[state * _ncls + class]
+    co::vector<uint32_t> _depth;   // length of the string of each state
+    co::vector<uint32_t> _len;     // length of the longest pattern ending at each state
+    co::vector<uint32_t> _id;      // id of that pattern
+};
+
 // remove chars in @c from string @s at the left or right side, or both sides.
 // @d: 'l' or 'L' for left, 'r' or 'R' for right, 'b' for both.
 //   - str::trim(" xx\r\n");            ->  "xx"
@@ -122,6 +338,36 @@ inline uint64_t to_uint64(const std::string& s) { return to_uint64(s.c_str()); }
 inline double to_double(const fastring& s) { return to_double(s.c_str()); }
 inline double to_double(const std::string& s) { return to_double(s.c_str()); }
 
+// parse a number from @s of @n bytes, no null terminator is required
+//   - The overloads taking @s of type T work with fastring, std::string, etc.
+//   - Integers are decimal with an optional sign, and doubles are in the form of
+//     [+-]digits[.digits][(e|E)[+-]digits]. Spaces, base prefixes and unit
+//     suffixes are not accepted.
+//   - Return false if @s is not a valid number or it is out of range, and @v is
+//     not changed then. Neither errno nor co::error() is touched.
+//   - They are much faster than to_xxx() above, and suitable for parsing numbers
+//     in protocol headers or data files.
+__coapi bool parse_int32(const char* s, size_t n, int32_t& v);
+__coapi bool parse_int64(const char* s, size_t n, int64_t& v);
+__coapi bool parse_uint32(const char* s, size_t n, uint32_t& v);
+__coapi bool parse_uint64(const char* s, size_t n, uint64_t& v);
+__coapi bool parse_double(const char* s, size_t n, double& v);
+
+template <typename T>
+inline bool parse_int32(const T& s, int32_t& v) { return parse_int32(s.data(), s.size(), v); }
+
+template <typename T>
+inline bool parse_uint32(const T& s, uint32_t& v) { return parse_uint32(s.data(), s.size(), v); }
+
+template <typename T>
+inline bool parse_int64(const T& s, int64_t& v) { return parse_int64(s.data(), s.size(), v); }
+
+template <typename T>
+inline bool parse_uint64(const T& s, uint64_t& v) { return parse_uint64(s.data(), s.size(), v); }
+
+template <typename T>
+inline bool parse_double(const T& s, double& v) { return parse_double(s.data(), s.size(), v); }
+
 // convert built-in types to string
 template <typename T>
 inline fastring from(T t) {
@@ -160,6 +406,15 @@ inline fastring cat(X&&... x) {
     return s;
 }
 
+// format a string with {} as placeholders, see fastream::fmt() for details
+//   - str::format("{}:{}", "127.0.0.1", 7777);  ==>  "127.0.0.1:7777"
+template <typename... X>
+inline fastring format(const char* f, X&&... x) {
+    fastring s;
+    ((fastream&)s).fmt(f, std::forward<X>(x)...);
+    return s;
+}
+
 template <typename K, typename V>
 inline fastring dbg(const std::pair<K, V>& x) {
     return xx::dbg(x);
@@ -235,8 +490,8 @@ inline fastring dbg(const std::unordered_map<K, V, H, P, A>& x) {
 //     return xx::dbg(x);
 // }
 
-template <typename K, typename V, typename H, typename P, typename A>
-inline fastring dbg(const co::lru_map<K, V, H, P, A>& x) {
+template <typename K, typename V, typename H, typename P>
+inline fastring dbg(const co::lru_map<K, V, H, P>& x) {
     return xx::dbg(x);
 }
 
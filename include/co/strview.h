@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string.h>
+
+#include <ostream>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "hash/wyhash.h"
+
+namespace co {
+
+// A non-owning view of a string, a pointer and a length. It is for passing
+// slices of a buffer to APIs without copying them or calling strlen() again.
+//   - It is NOT null-terminated, use data() with size().
+//   - It is created implicitly from a C string, or from any string type with
+//     data() and size(), like fastring, std::string and co::small_string.
+//   - The string MUST outlive the view.
+//
+//   fastring s("hello world");
+//   co::strview v(s.data() + 6, 5);  // "world"
+//   json::Json x;
+//   x[v] = 1;                        // {"world":1}
+class strview {
+  public:
+    static const size_t npos = (size_t)-1;
+
+    constexpr strview() noexcept : _p(""), _n(0) {}
+
+    constexpr strview(const char* s, size_t n) noexcept : _p(s), _n(n) {}
+
+    strview(const char* s) noexcept : _p(s), _n(strlen(s)) {}
+
+    template <typename S, typename = typename std::enable_if<std::is_convertible<
+                              decltype(std::declval<const S&>().data()), const char*>::value>::type,
+              typename = decltype(std::declval<const S&>().size())>
+    strview(const S& s) noexcept : _p(s.data()), _n(s.size()) {}
+
+    constexpr const char* data() const noexcept { return _p; }
+    constexpr size_t size() const noexcept { return _n; }
+    constexpr bool empty() const noexcept { return _n == 0; }
+
+    const char* begin() const noexcept { return _p; }
+    const char* end() const noexcept { return _p + _n; }
+
+    const char& operator[](size_t i) const { return _p[i]; }
+    const char& front() const { return _p[0]; }
+    const char& back() const { return _p[_n - 1]; }
+
+    strview substr(size_t pos, size_t len = npos) const {
+        if (pos > _n) pos = _n;
+        return strview(_p + pos, len < _n - pos ? len : _n - pos);
+    }
+
+    void remove_prefix(size_t n) { _p += n, _n -= n; }
+    void remove_suffix(size_t n) { _n -= n; }
+
+    size_t find(char c, size_t pos = 0) const {
+        if (pos >= _n) return npos;
+        const char* const p = (const char*)memchr(_p + pos, c, _n - pos);
+        return p ? p - _p : npos;
+    }
+
+    bool starts_with(strview s) const {
+        return s._n <= _n && memcmp(_p, s._p, s._n) == 0;
+    }
+
+    bool ends_with(strview s) const {
+        return s._n <= _n && memcmp(_p + _n - s._n, s._p, s._n) == 0;
+    }
+
+    int compare(strview s) const {
+        const int i = memcmp(_p, s._p, _n < s._n ? _n : s._n);
+        return i != 0 ? i : (_n < s._n ? -1 : _n != s._n);
+    }
+
+  private:
+    const char* _p;
+    size_t _n;
+};
+
+inline bool operator==(strview a, strview b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator!=(strview a, strview b) { return !(a == b); }
+
+inline bool operator<(strview a, strview b) { return a.compare(b) < 0; }
+
+}  // namespace co
+
+inline std::ostream& operator<<(std::ostream& os, co::strview s) {
+    return os.write(s.data(), s.size());
+}
+
+namespace std {
+template <>
+struct hash<co::strview> {
+    size_t operator()(co::strview s) const { return (size_t)wyhash(s.data(), s.size()); }
+};
+}  // namespace std
@@ -2,28 +2,44 @@
 
 #include <assert.h>
 #include <stdlib.h>
-#include <mutex>
+
+#include <atomic>
+
+#include "def.h"
 
 namespace co {
 
 // A fixed-size table.
 //   - The internal memory is zero-cleared at initialization.
+//   - Rows are allocated on demand, without a lock, operator[] is safe to be
+//     called in multiple threads.
 //   - e.g.
 //     co::table<int> t(x, y); // X*Y elements can be stored in
 //                             // X is 1 << x, Y is 1 << y
 template<typename T>
 class table {
   public:
-    inline table(int xbits, int ybits)
+    // @x0bits  the first 1 << x0bits elements are allocated at once in the
+    //          constructor, it is at least one row (@xbits).
+    inline table(int xbits, int ybits, int x0bits = 0)
         : _xbits(xbits),
           _xsize(static_cast<size_t>(1) << xbits),
-          _ysize(static_cast<size_t>(1) << ybits), _i(1) {
-        _v = (T**) ::calloc(_ysize, sizeof(T*));
-        _v[0] = (T*) ::calloc(_xsize, sizeof(T));
+          _ysize(static_cast<size_t>(1) << ybits) {
+        static_assert(sizeof(std::atomic<T*>) == sizeof(T*), "");
+        if (x0bits < xbits) x0bits = xbits;
+        if (x0bits > xbits + ybits) x0bits = xbits + ybits;
+        _n0 = static_cast<size_t>(1) << (x0bits - xbits);
+        _v = (std::atomic<T*>*) ::calloc(_ysize, sizeof(T*));
+        T* const p = (T*) ::calloc(_n0 << xbits, sizeof(T));
+        assert(_v && p);
+        for (size_t i = 0; i < _n0; ++i) {
+            _v[i].store(p + (i << xbits), std::memory_order_relaxed);
+        }
     }
 
     inline ~table() {
-        for (size_t i = 0; i < _i; ++i) ::free(_v[i]);
+        ::free(_v[0].load(std::memory_order_relaxed));
+        for (size_t i = _n0; i < _ysize; ++i) ::free(_v[i].load(std::memory_order_relaxed));
         ::free(_v);
     }
 
@@ -35,24 +51,31 @@ class table {
         const size_t r = i & (_xsize - 1); // i % _xsize
         assert(q < _ysize);
 
-        if (!_v[q]) {
-            std::lock_guard<std::mutex> g(_mtx);
-            if (!_v[q]) {
-                _v[q] = (T*) ::calloc(_xsize, sizeof(T));
-                assert(_v[q]);
-                if (_i <= q) _i = q + 1;
-            }
-        }
-        return _v[q][r];
+        T* p = _v[q].load(std::memory_order_acquire);
+        if (unlikely(!p)) p = this->_alloc_row(q);
+        return p[r];
     }
 
   private:
-    std::mutex _mtx;
+    // the row is published by CAS, the loser frees its memory and uses the
+    // row of the winner.
+    T* _alloc_row(size_t q) {
+        T* p = (T*) ::calloc(_xsize, sizeof(T));
+        assert(p);
+        T* x = 0;
+        if (_v[q].compare_exchange_strong(x, p, std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+            return p;
+        }
+        ::free(p);
+        return x;
+    }
+
     const size_t _xbits;
     const size_t _xsize;
     const size_t _ysize;
-    size_t _i;
-    T** _v;
+    size_t _n0; // number of rows allocated in the constructor
+    std::atomic<T*>* _v;
 };
 
 } // co
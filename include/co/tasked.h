@@ -7,13 +7,21 @@ namespace co {
 
 /**
  * A timed task scheduler
- *   - All tasks will run in a single thread.
+ *   - Tasks are scheduled in a single thread, with a resolution of 1 ms.
+ *   - By default, tasks also run in that thread, and a slow task delays others.
+ *     If @in_co is true, each run of a task is dispatched to a coroutine, and a
+ *     periodic task skips a run if the last one has not finished yet.
+ *   - A periodic task runs at a fixed rate, runs missed by a late task are skipped.
  */
 class __coapi Tasked {
   public:
     typedef std::function<void()> F;
 
-    Tasked();
+    Tasked() : Tasked(false) {}
+
+    // @in_co: run tasks in coroutines if true, otherwise in the scheduler thread
+    explicit Tasked(bool in_co);
+
     ~Tasked();
 
     Tasked(const Tasked&) = delete;
@@ -39,6 +47,22 @@ class __coapi Tasked {
         this->run_every(F(f), sec);
     }
 
+    // run f() once @ms milliseconds later
+    void run_in_ms(F&& f, uint32_t ms);
+
+    // run f() once @ms milliseconds later
+    void run_in_ms(const F& f, uint32_t ms) {
+        this->run_in_ms(F(f), ms);
+    }
+
+    // run f() every @ms milliseconds, @ms MUST be greater than 0
+    void run_every_ms(F&& f, uint32_t ms);
+
+    // run f() every @ms milliseconds
+    void run_every_ms(const F& f, uint32_t ms) {
+        this->run_every_ms(F(f), ms);
+    }
+
     // run f() once at hour:minute:second
     // hour: 0-23, mimute & second: 0-59
     void run_at(F&& f, int hour, int minute=0, int second=0);
@@ -4,6 +4,8 @@
 
 #include "def.h"
 
+struct iovec;
+
 namespace tcp {
 
 /**
@@ -11,6 +13,8 @@ namespace tcp {
  *   - An object of tcp::Connection will be created by tcp::Server if a connection
  *     was accepted. DO NOT create tcp::Connection by yourself.
  *   - If tcp::Server is a SSL server, data will be transfered by SSL.
+ *   - Small reads are served from a read buffer of the connection, which is filled
+ *     with large recvs, so data sent together is received with one syscall.
  */
 struct __coapi Connection final {
     // normal TCP connection
@@ -28,8 +32,12 @@ struct __coapi Connection final {
     // get the underlying socket fd
     int socket() const;
 
+    // get the protocol selected by ALPN on a SSL connection, or an empty string
+    const char* alpn() const;
+
     /**
      * recv using co::recv or ssl::recv
+     *   - Buffered data is returned first.
      *
      * @return  >0 on success, -1 on timeout or error, 0 will be returned if the
      *          peer closed the connection.
@@ -38,12 +46,38 @@ struct __coapi Connection final {
 
     /**
      * recv n bytes using co::recvn or ssl::recvn
+     *   - Buffered data is returned first.
      *
      * @return  n on success, -1 on timeout or error, 0 will be returned if the
      *          peer closed the connection.
      */
     int recvn(void* buf, int n, int ms = -1);
 
+    /**
+     * wait until at least n bytes are buffered, without consuming them
+     *
+     * @param p  a pointer to the buffered data will be stored here, it is valid
+     *           until the next read on the connection.
+     *
+     * @return  number of bytes buffered (>= n) on success, -1 on timeout or error,
+     *          0 will be returned if the peer closed the connection.
+     */
+    int peek(const char** p, int n, int ms = -1);
+
+    /**
+     * read until a delimiter, e.g. "\r\n\r\n" at the end of a HTTP header
+     *   - The data, delimiter included, is consumed from the read buffer.
+     *
+     * @param p    a pointer to the data will be stored here, it is valid until the
+     *             next read on the connection.
+     * @param max  max bytes to read, if the delimiter was not found in max bytes,
+     *             -1 is returned and co::error() is EMSGSIZE.
+     *
+     * @return  length of the data on success, -1 on timeout or error, 0 will be
+     *          returned if the peer closed the connection.
+     */
+    int read_until(const char* delim, const char** p, int max, int ms = -1);
+
     /**
      * send n bytes using co::send or ssl::send
      *   - If use SSL, this method may return 0 on error.
@@ -52,6 +86,25 @@ struct __coapi Connection final {
      */
     int send(const void* buf, int n, int ms = -1);
 
+    /**
+     * send data in multiple buffers using co::sendv or ssl::sendv
+     *   - The buffers are sent in order, there is no need to merge them first.
+     *
+     * @return  total bytes of the buffers on success, <=0 on timeout or error.
+     */
+    int sendv(const struct iovec* iov, int n, int ms = -1);
+
+    /**
+     * send part of a file using co::sendfile or ssl::sendfile
+     *
+     * @param fd   a file descriptor opened for reading.
+     * @param off  offset in the file to start from.
+     * @param len  bytes to be sent.
+     *
+     * @return  len on success, <=0 on timeout or error.
+     */
+    int64_t sendfile(int fd, int64_t off, int64_t len, int ms = -1);
+
     /**
      * close the connection
      *   - Once a Connection was closed, it can't be used any more.
@@ -77,11 +130,57 @@ struct __coapi Connection final {
     const char* strerror() const;
 
   private:
+    friend class ServerImpl;
+    Connection() : _p(0) {}
     void* _p;
 
     DISALLOW_COPY_AND_ASSIGN(Connection);
 };
 
+/**
+ * socket options for latency tuning, see Server::set_sock_opts() and
+ * Client::set_sock_opts()
+ *   - 0 or false keeps the system default. Options the platform does not support
+ *     are ignored, all but sndbuf and rcvbuf are linux options.
+ *   - They are not applied to unix domain sockets or shm connections.
+ */
+struct SockOpts {
+    SockOpts()
+        : fastopen(0), quickack(false), busy_poll(0), notsent_lowat(0), sndbuf(0), rcvbuf(0) {}
+
+    // TCP_FASTOPEN, data goes with the SYN and a reconnect saves a round trip.
+    // For a server, it is the max number of pending TFO requests. For a client,
+    // any value > 0 enables it. The sysctl net.ipv4.tcp_fastopen must allow it.
+    int fastopen;
+
+    // TCP_QUICKACK, ack at once instead of delaying it. It is set when the
+    // connection is established, the kernel may leave the quickack mode later.
+    bool quickack;
+
+    // SO_BUSY_POLL, microseconds to busy poll the device queue when waiting
+    // for data, see socket(7). It may need CAP_NET_ADMIN to raise it.
+    int busy_poll;
+
+    // TCP_NOTSENT_LOWAT, max bytes not sent yet in the send buffer. Senders wait
+    // earlier, so data queued later is not stuck behind a large backlog.
+    int notsent_lowat;
+
+    // SO_SNDBUF and SO_RCVBUF in bytes, they turn off the kernel autotuning of
+    // the buffers. For a server, they are set on the listening socket, so that
+    // the window scale of accepted connections is based on them.
+    int sndbuf;
+    int rcvbuf;
+
+    // a profile for request-response services sensitive to latency
+    static SockOpts low_latency() {
+        SockOpts o;
+        o.fastopen = 256;
+        o.quickack = true;
+        o.notsent_lowat = 16 * 1024;
+        return o;
+    }
+};
+
 /**
  * TCP server based on coroutine
  *   - Support both ipv4 and ipv6.
@@ -115,6 +214,39 @@ class __coapi Server final {
     // return number of connections
     uint32_t conn_num() const;
 
+    /**
+     * set protocols for ALPN of a SSL server
+     *   - It MUST be called before start(), see ssl::set_alpn() for details.
+     *
+     * @param protos  comma-separated protocols in order of preference, e.g. "h2,http/1.1".
+     */
+    Server& set_alpn(const char* protos);
+
+    /**
+     * listen with SO_REUSEPORT, one listening socket and accept loop per scheduler
+     *   - It MUST be called before start(). It is supported on linux only, a single
+     *     listener is used on other platforms.
+     *   - The kernel balances new connections among the listeners, and a connection
+     *     is handled in the scheduler that accepted it.
+     *   - NOTE: Other processes of the same user may also bind to the port.
+     */
+    Server& set_reuseport(bool on = true);
+
+    /**
+     * limit the number of connections
+     *   - It MUST be called before start(). 0 for no limit, which is the default.
+     *   - When the limit was reached, a new connection will be reset at once if shed
+     *     is true. Otherwise, the server stops accepting until some connections are
+     *     closed, and new connections wait in the listen backlog.
+     */
+    Server& set_max_conn(uint32_t n, bool shed = true);
+
+    /**
+     * set socket options of the listening socket and accepted connections
+     *   - It MUST be called before start(), see SockOpts for details.
+     */
+    Server& set_sock_opts(const SockOpts& o);
+
     /**
      * start the server
      *   - The server will loop in a coroutine, and it will not block the calling thread.
@@ -124,6 +256,10 @@ class __coapi Server final {
      *
      * @param ip    server ip, either an ipv4 or ipv6 address.
      *              if ip is NULL or empty, "0.0.0.0" will be used by default.
+     *              "unix:/path" listens on a unix domain socket, port is ignored,
+     *              and "unix:@name" uses the abstract namespace on linux.
+     *              "shm:name" serves clients on the same host with shared memory
+     *              rings (linux only), see also FLG_shm_ring_size.
      * @param port  server port.
      * @param key   path of ssl private key file.
      * @param ca    path of ssl certificate file.
@@ -166,6 +302,8 @@ class __coapi Client final {
      *
      * @param ip       a domain name, or either an ipv4 or ipv6 address of the server.
      *                 if ip is NULL or empty, "127.0.0.1" will be used by default.
+     *                 "unix:/path" or "unix:@name" connects to a unix domain socket.
+     *                 "shm:name" connects to a "shm:name" server on the same host.
      * @param port     the server port.
      * @param use_ssl  use ssl if it is true.
      */
@@ -209,6 +347,20 @@ class __coapi Client final {
      */
     int send(const void* buf, int n, int ms = -1);
 
+    /**
+     * send data in multiple buffers using co::sendv or ssl::sendv
+     *
+     * @return  total bytes of the buffers on success, <=0 on timeout or error.
+     */
+    int sendv(const struct iovec* iov, int n, int ms = -1);
+
+    /**
+     * send part of a file using co::sendfile or ssl::sendfile
+     *
+     * @return  len on success, <=0 on timeout or error.
+     */
+    int64_t sendfile(int fd, int64_t off, int64_t len, int ms = -1);
+
     /**
      * @brief bind ip and port to the client socket
      *
@@ -216,6 +368,12 @@ class __coapi Client final {
      */
     bool bind(const char* ip, int port = 0);
 
+    /**
+     * set socket options of the connection, see SockOpts for details
+     *   - It MUST be called before connect(). They are copied by the copy constructor.
+     */
+    void set_sock_opts(const SockOpts& o) { _opts = o; }
+
     /**
      * check whether the connection has been established
      */
@@ -255,6 +413,8 @@ class __coapi Client final {
     int _fd;
     bool _use_ssl;
     bool _connected;
+    void* _shm;  // pipe of a shm connection
+    SockOpts _opts;
 };
 
 }  // namespace tcp
@@ -7,6 +7,9 @@ namespace co {
 namespace now {
 
 // monotonic timestamp in nanoseconds
+//   - On x86_64 linux, it is read from the TSC if FLG_time_tsc is true and the
+//     TSC is invariant. The TSC is calibrated against the system clock at the
+//     first call.
 __coapi int64_t ns();
 
 // monotonic timestamp in microseconds
@@ -15,6 +18,10 @@ __coapi int64_t us();
 // monotonic timestamp in milliseconds
 __coapi int64_t ms();
 
+// monotonic timestamp in milliseconds, with a resolution of the system tick
+// (1~10 ms), it is cheaper than ms() where clock_gettime() is not served by vDSO
+__coapi int64_t ms_coarse();
+
 // "%Y-%m-%d %H:%M:%S" ==> 2023-01-07 18:01:23
 __coapi fastring str(const char* fm = "%Y-%m-%d %H:%M:%S");
 
@@ -28,8 +35,34 @@ __coapi int64_t us();
 // milliseconds since epoch
 __coapi int64_t ms();
 
+// milliseconds since epoch, with a resolution of the system tick (1~10 ms)
+__coapi int64_t ms_coarse();
+
 }  // namespace epoch
 
+// Strings of a time in milliseconds since epoch, formatted with a cache in each
+// thread. The cache keeps the fields of the last time, only the fields changed
+// are rewritten, e.g. only the milliseconds for a time in the same second, and
+// localtime() is called at most once per minute. The string returned is
+// null-terminated, it is overwritten by the next call of the same function in
+// the thread.
+namespace timestr {
+
+// "2023-01-07T10:01:23.456Z", ISO 8601 in UTC, 24 bytes
+__coapi const char* iso8601(int64_t ms);
+
+// "Sat, 07 Jan 2023 10:01:23 GMT", HTTP-date (RFC 7231), 29 bytes
+__coapi const char* http_date(int64_t ms);
+
+// "0107 18:01:23.456", local time in the format of the logs, 17 bytes
+__coapi const char* logtime(int64_t ms);
+
+inline const char* iso8601() { return iso8601(epoch::ms()); }
+inline const char* http_date() { return http_date(epoch::ms()); }
+inline const char* logtime() { return logtime(epoch::ms()); }
+
+}  // namespace timestr
+
 class __coapi Timer {
   public:
     Timer() { _start = now::ns(); }
@@ -9,6 +9,10 @@
 namespace unitest {
 
 // return number of failed test cases
+//   - With -j N (N > 1), each test runs in a child process, with at most N of
+//     them at a time, and output of a test is printed when it is done. It is
+//     not supported on windows.
+//   - Tests taking longer than -ut_slow_ms (1000 by default) are reported.
 __coapi int run_tests();
 
 // deprecated, use run_tests() instead
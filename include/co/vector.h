@@ -11,9 +11,16 @@
 
 namespace co {
 
+// A vector that allocates its memory with malloc.
+//   - Elements of types that are trivially relocatable (see
+//     god::is_trivially_relocatable), like fastring and json::Json, are moved
+//     by realloc or memcpy when the vector grows, instead of one by one.
 template <typename T>
 class vector {
   public:
+    // a vector holds only a pointer to the heap, it is relocatable itself
+    using trivially_relocatable = std::true_type;
+
     constexpr vector() noexcept : _cap(0), _size(0), _p(0) {}
 
     // create an empty vector with capacity: @cap
@@ -136,15 +143,10 @@ class vector {
         _size = 0;
     }
 
-    void append(const T& x) {
-        this->_realloc_if_no_more_memory();
-        new (_p + _size++) T(x);
-    }
+    // @x may be an element of this vector
+    void append(const T& x) { this->emplace_back(x); }
 
-    void append(T&& x) {
-        this->_realloc_if_no_more_memory();
-        new (_p + _size++) T(std::move(x));
-    }
+    void append(T&& x) { this->emplace_back(std::move(x)); }
 
     void append(size_t n, const T& x) {
         const size_t m = n + _size;
@@ -198,12 +200,18 @@ class vector {
     }
 
     // insert a new element (construct with args x...) at the back
+    //   - The element is constructed in place, no temporary object is created.
+    //   - @x... may refer to elements of this vector, it is safe even if the
+    //     vector grows.
     //   - e.g.
     //     co::vector<fastring> x; x.emplace_back(4, 'x'); // x.back() -> "xxxx"
     template <typename... X>
     void emplace_back(X&&... x) {
-        this->_realloc_if_no_more_memory();
-        new (_p + _size++) T(std::forward<X>(x)...);
+        if (unlikely(_size == _cap)) {
+            this->_grow_and_emplace(std::forward<X>(x)...);
+        } else {
+            new (_p + _size++) T(std::forward<X>(x)...);
+        }
     }
 
     void push_back(const T& x) { this->append(x); }
@@ -226,8 +234,7 @@ class vector {
         if (n < _size) {
             if (n != _size - 1) {
                 this->_destruct(_p[n]);
-                new (_p + n) T(std::move(_p[--_size]));
-                this->_destruct(_p[_size]);
+                this->_relocate_n(_p + n, _p + --_size, 1);
             } else {
                 this->_destruct(_p[--_size]);
             }
@@ -267,32 +274,49 @@ class vector {
     iterator end() const noexcept { return iterator(_p + _size); }
 
   private:
-    void _realloc_if_no_more_memory() {
-        if (unlikely(_cap == _size)) {
-            const size_t cap = _cap;
-            _cap += (_cap >> 1) + 1;
-            _p = this->_realloc(_p, sizeof(T) * cap, sizeof(T) * _cap);
-            assert(_p);
-        }
-    }
-
-    template <typename X, god::if_t<std::is_trivially_copyable<X>::value, int> = 0>
+    // the new element is constructed before the old memory is freed, as the
+    // args may refer to elements of this vector.
+    template <typename... X>
+    void _grow_and_emplace(X&&... x) {
+        const size_t cap = _cap + (_cap >> 1) + 1;
+        T* p = (T*)::malloc(sizeof(T) * cap);
+        assert(p);
+        new (p + _size) T(std::forward<X>(x)...);
+        this->_relocate_n(p, _p, _size);
+        ::free(_p);
+        _p = p;
+        _cap = cap;
+        ++_size;
+    }
+
+    template <typename X, god::if_t<god::is_trivially_relocatable<X>(), int> = 0>
     X* _realloc(X* p, size_t o, size_t n) {
-        return (X*)::realloc(p, n);
+        return (X*)::realloc((void*)p, n);
     }
 
-    template <typename X, god::if_t<!std::is_trivially_copyable<X>::value, int> = 0>
+    template <typename X, god::if_t<!god::is_trivially_relocatable<X>(), int> = 0>
     X* _realloc(X* p, size_t o, size_t n) {
-        // X* x = (X*)co::try_realloc(p, o, n);
-        // if (!x) {
         X* x = (X*)::malloc(n);
-        this->_move_n(x, p, _size);
-        this->_destruct_range(p, 0, _size);
+        this->_relocate_n(x, p, _size);
         ::free(p);
-        // }
         return x;
     }
 
+    // move @n elements from @src to uninitialized memory @dst, and destroy the
+    // elements in @src.
+    template <typename X, god::if_t<god::is_trivially_relocatable<X>(), int> = 0>
+    void _relocate_n(X* dst, X* src, size_t n) {
+        memcpy((void*)dst, (const void*)src, sizeof(X) * n);
+    }
+
+    template <typename X, god::if_t<!god::is_trivially_relocatable<X>(), int> = 0>
+    void _relocate_n(X* dst, X* src, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            new (dst + i) X(std::move(src[i]));
+            src[i].~X();
+        }
+    }
+
     template <typename X, god::if_t<std::is_trivially_copyable<X>::value, int> = 0>
     void _copy_n(X* dst, const X* src, size_t n) {
         memcpy(dst, src, sizeof(X) * n);
@@ -1,22 +1,38 @@
 #include "co/benchmark.h"
 
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <thread>
 
+#include "co/co.h"
 #include "co/color.h"
 #include "co/fastring.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/json.h"
+#include "co/stl.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+DEF_uint32(bm_samples, 20, ">>#2 number of samples of each benchmark");
+DEF_uint32(bm_min_ms, 200, ">>#2 min time in ms to run each benchmark, the warm-up excluded");
+DEF_uint32(bm_warmup_ms, 50, ">>#2 time in ms to warm up each benchmark");
+DEF_string(bm_out, "", ">>#2 write results of all groups to this file, CSV if it ends with .csv, otherwise JSON");
+DEF_string(bm_baseline, "", ">>#2 compare results with a previous run, a JSON file written by bm_out");
+DEF_bool(bm_perf, true, ">>#2 count cycles, instructions, cache and branch misses with perf_event_open on linux");
+DEF_double(bm_threshold, 5.0, ">>#2 a benchmark regressed if its median is slower than the baseline by more than this percent");
 
 namespace bm {
 namespace xx {
 
-int calc_iters(int64_t ns) {
-    if (ns <= 1000) return 100 * 1000;
-    if (ns <= 10000) return 10 * 1000;
-    if (ns <= 100000) return 1000;
-    if (ns <= 1000000) return 100;
-    if (ns <= 10000000) return 10;
-    return 1;
-}
-
 inline std::vector<Group>& groups() {
     static std::vector<Group> _g;
     return _g;
@@ -30,6 +46,263 @@ bool add_group(const char* name, void (*f)(Group&)) {
 // do nothing, just fool the compiler
 void use(void*, int) {}
 
+// median of sorted values
+static double median(const std::vector<double>& v) {
+    const size_t n = v.size();
+    return (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+#ifdef __linux__
+// Hardware counters of the calling thread, in user space only. Events that
+// can not be opened (not permitted, or not supported in a VM) are skipped.
+class Perf {
+  public:
+    Perf() : _leader(-1), _n(0) {
+        static const uint64_t ev[kNum] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (int i = 0; i < kNum; ++i) {
+            struct perf_event_attr a;
+            memset(&a, 0, sizeof(a));
+            a.type = PERF_TYPE_HARDWARE;
+            a.size = sizeof(a);
+            a.config = ev[i];
+            a.disabled = _leader < 0;
+            a.exclude_kernel = 1;
+            a.exclude_hv = 1;
+            a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                            PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const int fd = (int)syscall(__NR_perf_event_open, &a, 0, -1, _leader, 0);
+            _idx[i] = -1;
+            if (fd < 0) continue;
+            if (_leader < 0) _leader = fd;
+            _fd[_n] = fd;
+            _idx[i] = _n++;
+        }
+    }
+
+    ~Perf() {
+        for (int i = 0; i < _n; ++i) ::close(_fd[i]);
+    }
+
+    bool ok() const { return _leader >= 0; }
+
+    void start() {
+        ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    // stop counting, and put the counts in @v, -1 for events not available.
+    // Counts are scaled if the counters were multiplexed.
+    void stop(double (&v)[4]) {
+        ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t b[3 + kNum];  // nr, time_enabled, time_running, values...
+        const ssize_t r = ::read(_leader, b, sizeof(b));
+        const double scale = (r > 0 && b[2] > 0) ? b[1] * 1.0 / b[2] : 0;
+        for (int i = 0; i < kNum; ++i) {
+            const int x = _idx[i];
+            v[i] = (r > 0 && x >= 0 && (uint64_t)x < b[0] && scale > 0) ? b[3 + x] * scale : -1;
+        }
+    }
+
+  private:
+    static const int kNum = 4;
+    int _leader;
+    int _n;
+    int _fd[kNum];
+    int _idx[kNum];  // index of the event in the group, -1 if not opened
+};
+
+// counters of the main thread, null if disabled or not available
+static Perf* perf() {
+    static Perf* p = [] {
+        if (!FLG_bm_perf) return (Perf*)0;
+        Perf* x = new Perf();
+        if (x->ok()) return x;
+        delete x;
+        return (Perf*)0;
+    }();
+    return p;
+}
+#endif
+
+// Run the samples, @sample(k) runs @k iterations and returns the time in ns,
+// results of the samples (ns per iteration) are put in @v, sorted.
+//   - @pc  if not null, hardware counters per iteration of the samples are put
+//          in it (cycles, instructions, cache misses, branch misses), -1 if
+//          not available.
+static void measure(const std::function<int64_t(int64_t)>& sample, int64_t iters,
+                    std::vector<double>& v, double (*pc)[4] = 0) {
+#ifdef __linux__
+    Perf* const p = pc ? perf() : 0;
+#endif
+    auto begin = [&]() {
+#ifdef __linux__
+        if (p) p->start();
+#endif
+    };
+    auto end = [&](int64_t n) {
+        if (pc) {
+            for (auto& x : *pc) x = -1;
+#ifdef __linux__
+            if (p) {
+                p->stop(*pc);
+                for (auto& x : *pc) {
+                    if (x >= 0) x /= n;
+                }
+            }
+#endif
+        }
+    };
+
+    // exactly 1 + iters calls if iters is fixed, some benchmarks depend on the
+    // count, e.g. writing to and then reading from a bounded channel.
+    if (iters > 0) {
+        sample(1);
+        begin();
+        v.assign(1, sample(iters) * 1.0 / iters);
+        end(iters);
+        return;
+    }
+
+    const uint32_t m = FLG_bm_samples > 0 ? FLG_bm_samples : 1;
+
+    // Warm up with doubling batches, it brings the code and data into cache
+    // and the CPU to a stable frequency, and estimates the cost of one call.
+    int64_t n = 0, ns = 0, k = 1;
+    const int64_t warmup = (int64_t)FLG_bm_warmup_ms * 1000000;
+    do {
+        ns += sample(k);
+        n += k;
+        if (k < (1 << 20)) k <<= 1;
+    } while (ns < warmup);
+
+    const double per = ns > 0 ? ns * 1.0 / n : 1.0;
+    iters = (int64_t)(FLG_bm_min_ms * 1000000.0 / m / per);
+    if (iters < 1) iters = 1;
+
+    v.resize(m);
+    begin();
+    for (uint32_t i = 0; i < m; ++i) v[i] = sample(iters) * 1.0 / iters;
+    end(iters * m);
+    std::sort(v.begin(), v.end());
+}
+
+// statistics of the samples, all values are divided by @d
+static void stats(Result& r, const std::vector<double>& v, double d) {
+    const size_t m = v.size();
+    r.samples = (int)m;
+    r.ns = median(v);
+    r.p99 = v[(size_t)ceil(m * 0.99) - 1];
+
+    // samples farther than 3 scaled MADs (~3 sigma) from the median are
+    // outliers, caused by interrupts, context switches and so on.
+    std::vector<double> x(m);
+    for (size_t i = 0; i < m; ++i) x[i] = fabs(v[i] - r.ns);
+    std::sort(x.begin(), x.end());
+    const double lim = 3 * 1.4826 * median(x);
+
+    double sum = 0, sd = 0;
+    int c = 0;
+    for (auto& e : v) {
+        if (lim > 0 && fabs(e - r.ns) > lim) continue;
+        sum += e;
+        ++c;
+    }
+    r.outliers = (int)m - c;
+    r.mean = sum / c;
+    for (auto& e : v) {
+        if (lim > 0 && fabs(e - r.ns) > lim) continue;
+        sd += (e - r.mean) * (e - r.mean);
+    }
+    r.stddev = c > 1 ? sqrt(sd / (c - 1)) : 0;
+
+    r.ns /= d;
+    r.p99 /= d;
+    r.mean /= d;
+    r.stddev /= d;
+}
+
+void run(Group& g, const std::function<void(int64_t)>& f, int64_t iters) {
+    co::Timer t;
+    std::vector<double> v;
+    double pc[4];
+    measure(
+        [&](int64_t k) {
+            t.restart();
+            f(k);
+            return t.ns();
+        },
+        iters, v, &pc);
+
+    Result r(g.bm);
+    stats(r, v, 1);
+    r.cycles = pc[0];
+    r.instructions = pc[1];
+    r.cache_misses = pc[2];
+    r.branch_misses = pc[3];
+    r.latency = r.ns;
+    g.res.push_back(r);
+}
+
+void run_parallel(Group& g, int n, bool in_co, const std::function<void(int64_t)>& f) {
+    if (n < 1) n = 1;
+    co::Timer t;
+    std::vector<double> v;
+
+    if (!in_co) {
+        // threads are created before the timer starts, and released at once
+        measure(
+            [&](int64_t k) {
+                std::atomic_int ready{0};
+                std::atomic_bool start{false};
+                std::vector<std::thread> ths;
+                ths.reserve(n);
+                for (int i = 0; i < n; ++i) {
+                    ths.emplace_back([&]() {
+                        ready.fetch_add(1, std::memory_order_relaxed);
+                        while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+                        f(k);
+                    });
+                }
+                while (ready.load(std::memory_order_relaxed) < n) std::this_thread::yield();
+                t.restart();
+                start.store(true, std::memory_order_release);
+                for (auto& th : ths) th.join();
+                return t.ns();
+            },
+            0, v);
+    } else {
+        // coroutines are spread over the schedulers, creating them is timed
+        auto& s = co::scheds();
+        measure(
+            [&](int64_t k) {
+                co::wait_group wg((uint32_t)n);
+                t.restart();
+                for (int i = 0; i < n; ++i) {
+                    s[i % s.size()]->go([&f, k, wg]() {
+                        f(k);
+                        wg.done();
+                    });
+                }
+                wg.wait();
+                return t.ns();
+            },
+            0, v);
+    }
+
+    // a sample is the wall time of k iterations in each of n workers, the
+    // latency is the wall time per iteration, ns/iter is that divided by n.
+    Result r(g.bm);
+    r.threads = n;
+    r.latency = median(v);
+    stats(r, v, n);
+    g.res.push_back(r);
+}
+
 struct Num {
     constexpr Num(double v) noexcept : v(v) {}
 
@@ -57,39 +330,75 @@ struct Num {
     double v;
 };
 
-// |  group  |  ns/iter  |  iters/s  |  speedup  |
-// | ------- | --------- | --------- | --------- |
-// |  bm 0   |  50.0     |  20.0M    |  1.0      |
-// |  bm 1   |  10.0     |  100.0M   |  5.0      |
+// the i-th hardware counter: cycles, instructions, cache misses, branch misses
+static double counter(const Result& r, int i) {
+    return i == 0 ? r.cycles : i == 1 ? r.instructions : i == 2 ? r.cache_misses : r.branch_misses;
+}
+
+// whether a baseline is loaded, the "vs base" column is printed then
+static bool has_base = false;
+
+// print a cell of the table, padded to 9 characters
+template <typename C>
+static void print_cell(const fastring& t, C&& color) {
+    const size_t p = t.size() <= 7 ? 9 - t.size() : 2;
+    std::cout << "|  " << color(t) << fastring(p, ' ');
+}
+
+// speedup is relative to the first benchmark of the group.
+// |  group  |  ns/iter  |  +-       |  p99      |  iters/s  |  speedup  |
+// | ------- | --------- | --------- | --------- | --------- | --------- |
+// |  bm 0   |  50.0     |  1.2%     |  52.3     |  20.0M    |  1.0      |
+// |  bm 1   |  10.0     |  0.8%     |  10.4     |  100.0M   |  5.0      |
 void print_results(Group& g) {
     size_t grplen = ::strlen(g.name);
     size_t maxlen = grplen;
+    bool par = false;  // the latency column is printed for parallel benchmarks
+    bool pcs[4] = {};  // columns of hardware counters available
+    co::vector<fastring> names(g.res.size());
     for (auto& r : g.res) {
-        const size_t x = ::strlen(r.bm);
-        if (maxlen < x) maxlen = x;
+        for (int i = 0; i < 4; ++i) pcs[i] |= counter(r, i) >= 0;
+        fastring x(r.bm);
+        if (r.threads > 1) {
+            x << " x" << r.threads;
+            par = true;
+        }
+        if (maxlen < x.size()) maxlen = x.size();
+        names.push_back(std::move(x));
     }
 
-    std::cout << "|  " << co::color::bold(g.name).blue() << fastring(maxlen - grplen + 2, ' ')
-              << "|  " << co::color::bold("ns/iter  ").blue() << "|  "
-              << co::color::bold("iters/s  ").blue() << "|  " << co::color::bold("speedup  ").blue()
-              << "|\n";
+    std::cout << "|  " << co::color::bold(g.name).blue() << fastring(maxlen - grplen + 2, ' ');
+    for (auto h : {"ns/iter  ", "+-       ", "p99      ", "iters/s  ", "speedup  "}) {
+        std::cout << "|  " << co::color::bold(h).blue();
+    }
+    if (par) std::cout << "|  " << co::color::bold("latency  ").blue();
+    int cols = 5 + par + has_base;
+    const char* pch[4] = {"cycles   ", "instrs   ", "llc-miss ", "br-miss  "};
+    for (int i = 0; i < 4; ++i) {
+        if (pcs[i]) std::cout << "|  " << co::color::bold(pch[i]).blue(), ++cols;
+    }
+    if (has_base) std::cout << "|  " << co::color::bold("vs base  ").blue();
+    std::cout << "|\n";
 
-    std::cout << "| " << fastring(maxlen + 2, '-') << ' ' << "| " << fastring(9, '-') << ' ' << "| "
-              << fastring(9, '-') << ' ' << "| " << fastring(9, '-') << ' ' << "|\n";
+    std::cout << "| " << fastring(maxlen + 2, '-') << ' ';
+    for (int i = 0; i < cols; ++i) std::cout << "| " << fastring(9, '-') << ' ';
+    std::cout << "|\n";
 
+    auto red = [](const fastring& t) { return co::color::red(t); };
     for (size_t i = 0; i < g.res.size(); ++i) {
         auto& r = g.res[i];
-        const size_t bmlen = ::strlen(r.bm);
-        fastring t = Num(r.ns).str();
-        size_t p = t.size() <= 7 ? 9 - t.size() : 2;
+        std::cout << "|  " << co::color::green(names[i])
+                  << fastring(maxlen - names[i].size() + 2, ' ');
+        print_cell(Num(r.ns).str(), red);
 
-        std::cout << "|  " << co::color::green(r.bm) << fastring(maxlen - bmlen + 2, ' ') << "|  "
-                  << co::color::red(t) << fastring(p, ' ');
+        fastring t(16);
+        t << dp::_1(r.mean > 0 ? r.stddev * 100 / r.mean : 0.0) << '%';
+        if (r.outliers > 0) t << '*';  // some samples were rejected
+        print_cell(t, [](const fastring& t) { return co::color::blue(t); });
+        print_cell(Num(r.p99).str(), red);
 
         double x = r.ns > 0 ? 1000000000.0 / r.ns : 1.2e12;
-        t = Num(x).str();
-        p = t.size() <= 7 ? 9 - t.size() : 2;
-        std::cout << "|  " << co::color::red(t) << fastring(p, ' ');
+        print_cell(Num(x).str(), red);
 
         if (i == 0) {
             t = "1.0";
@@ -98,22 +407,159 @@ void print_results(Group& g) {
             x = r.ns > 0 ? _ / r.ns : (_ > 0 ? 1.2e12 : 1.0);
             t = Num(x).str();
         }
+        print_cell(t, [](const fastring& t) { return co::color::yellow(t); });
+        if (par) print_cell(Num(r.latency).str(), red);
+        for (int k = 0; k < 4; ++k) {
+            if (pcs[k]) {
+                x = counter(r, k);
+                print_cell(x >= 0 ? Num(x).str() : fastring("-"),
+                           [](const fastring& t) { return co::color::blue(t); });
+            }
+        }
+
+        if (has_base) {
+            if (r.base > 0) {
+                x = (r.ns - r.base) * 100 / r.base;
+                t.clear();
+                t << (x >= 0 ? "+" : "") << dp::_1(x) << '%';
+                if (r.regressed) t << '!';
+            } else {
+                t = "-";
+            }
+            print_cell(t, [&r](const fastring& t) {
+                return r.regressed ? co::color::red(t) : co::color::green(t);
+            });
+        }
+        std::cout << "|\n";
+    }
+}
+
+// load results of a previous run: "group/bm" -> (median, stddev)
+static bool load_baseline(const fastring& path,
+                          co::hash_map<fastring, std::pair<double, double>>& m) {
+    fs::mmap_file f(path.c_str());
+    if (!f) {
+        std::cout << co::color::red("failed to open baseline: ") << path << '\n';
+        return false;
+    }
+    json::Json x;
+    if (!x.parse_from(f.data(), f.size()) || !x.get("groups").is_array()) {
+        std::cout << co::color::red("invalid baseline: ") << path << '\n';
+        return false;
+    }
+    const json::Json& groups = x.get("groups");
+    for (uint32_t i = 0; i < groups.array_size(); ++i) {
+        const json::Json& g = groups[i];
+        const json::Json& res = g.get("results");
+        for (uint32_t k = 0; k < res.array_size(); ++k) {
+            const json::Json& r = res[k];
+            fastring key(g.get("name").as_string());
+            key << '/' << r.get("bm").as_c_str();
+            m[key] = std::make_pair(r.get("ns").as_double(), r.get("stddev").as_double());
+        }
+    }
+    return true;
+}
+
+// compare results of a group with the baseline
+static int compare(Group& g, const co::hash_map<fastring, std::pair<double, double>>& m) {
+    int n = 0;
+    fastring key;
+    for (auto& r : g.res) {
+        key.clear();
+        key << g.name << '/' << r.bm;
+        auto it = m.find(key);
+        if (it == m.end() || it->second.first <= 0) continue;
+        r.base = it->second.first;
+        r.base_stddev = it->second.second;
+        const double d = r.ns - r.base;
+        const double sd = r.stddev > r.base_stddev ? r.stddev : r.base_stddev;
+        r.regressed = d > r.base * FLG_bm_threshold / 100 && d > 2 * sd;
+        if (r.regressed) ++n;
+    }
+    return n;
+}
+
+// {"groups":[{"name":"x","results":[{"bm":"y","ns":1.2,...}]}]}
+static fastring to_json(const std::vector<Group>& groups) {
+    json::Json a = json::array();
+    for (auto& g : groups) {
+        json::Json res = json::array();
+        for (auto& r : g.res) {
+            json::Json x({
+                {"bm", r.bm}, {"ns", r.ns}, {"mean", r.mean}, {"stddev", r.stddev},
+                {"p99", r.p99}, {"samples", r.samples}, {"outliers", r.outliers},
+                {"threads", r.threads}, {"latency", r.latency},
+            });
+            if (r.cycles >= 0) x.add_member("cycles", r.cycles);
+            if (r.instructions >= 0) x.add_member("instructions", r.instructions);
+            if (r.cache_misses >= 0) x.add_member("cache_misses", r.cache_misses);
+            if (r.branch_misses >= 0) x.add_member("branch_misses", r.branch_misses);
+            res.push_back(x);
+        }
+        a.push_back(json::Json({{"name", g.name}, {"results", res}}));
+    }
+    json::Json x;
+    x.add_member("groups", a);
+    return x.pretty();
+}
+
+static fastring csv_field(const char* s) {
+    fastring x(strlen(s) + 2);
+    x << '"';
+    for (; *s; ++s) {
+        if (*s == '"') x << '"';
+        x << *s;
+    }
+    x << '"';
+    return x;
+}
 
-        p = t.size() <= 7 ? 9 - t.size() : 2;
-        std::cout << "|  " << co::color::yellow(t) << fastring(p, ' ') << "|\n";
+static fastring to_csv(const std::vector<Group>& groups) {
+    fastring s(1024);
+    s << "group,bm,ns,mean,stddev,p99,samples,outliers,threads,latency,"
+      << "cycles,instructions,cache_misses,branch_misses,base,regressed\n";
+    for (auto& g : groups) {
+        for (auto& r : g.res) {
+            s << csv_field(g.name) << ',' << csv_field(r.bm) << ',' << r.ns << ',' << r.mean << ','
+              << r.stddev << ',' << r.p99 << ',' << r.samples << ',' << r.outliers << ','
+              << r.threads << ',' << r.latency << ',';
+            for (int i = 0; i < 4; ++i) {
+                if (counter(r, i) >= 0) s << counter(r, i);
+                s << ',';
+            }
+            s << r.base << ',' << (r.regressed ? 1 : 0) << '\n';
+        }
     }
+    return s;
 }
 
 }  // namespace xx
 
-void run_benchmarks() {
+int run_benchmarks() {
+    co::hash_map<fastring, std::pair<double, double>> base;
+    if (!FLG_bm_baseline.empty()) xx::has_base = xx::load_baseline(FLG_bm_baseline, base);
+
+    int n = 0;
     auto& groups = xx::groups();
     for (size_t i = 0; i < groups.size(); ++i) {
         if (i != 0) std::cout << '\n';
         auto& g = groups[i];
         g.f(g);
+        if (xx::has_base) n += xx::compare(g, base);
         xx::print_results(g);
     }
+
+    if (!FLG_bm_out.empty()) {
+        fs::file f(FLG_bm_out.c_str(), 'w');
+        const fastring s = FLG_bm_out.ends_with(".csv") ? xx::to_csv(groups) : xx::to_json(groups);
+        if (!f || f.write(s) != s.size()) {
+            std::cout << co::color::red("failed to write results to ") << FLG_bm_out << '\n';
+        }
+    }
+
+    if (n > 0) std::cout << '\n' << co::color::red("regressions: ") << n << '\n';
+    return n;
 }
 
 }  // namespace bm
@@ -0,0 +1,141 @@
+#include "co/buf_chain.h"
+
+#include <limits.h>
+
+namespace co {
+namespace xx {
+
+// Free blocks of the current thread, at most 64 of them (1MB) are cached. A
+// block may be returned in a thread other than the one it was taken from.
+class BlockPool {
+  public:
+    BlockPool() : _v(64) {}
+
+    ~BlockPool() {
+        for (size_t i = 0; i < _v.size(); ++i) ::free(_v[i]);
+    }
+
+    char* pop() {
+        if (!_v.empty()) return _v.pop_back();
+        char* p = (char*)::malloc(buf_chain::kBlockSize);
+        assert(p);
+        return p;
+    }
+
+    void push(char* p) {
+        if (_v.size() < 64) {
+            _v.push_back(p);
+        } else {
+            ::free(p);
+        }
+    }
+
+  private:
+    co::vector<char*> _v;
+};
+
+inline BlockPool& block_pool() {
+    static thread_local BlockPool _p;
+    return _p;
+}
+
+}  // namespace xx
+
+buf_chain& buf_chain::_append(const void* p, size_t n) {
+    const char* s = (const char*)p;
+    while (n > 0) {
+        if (_w == _e) {
+            char* b = xx::block_pool().pop();
+            _segs.push_back(seg_t{b, 0, b});
+            _w = b;
+            _e = b + kBlockSize;
+        }
+        const size_t k = n < (size_t)(_e - _w) ? n : (size_t)(_e - _w);
+        memcpy(_w, s, k);
+        _w += k;
+        _segs.back().size += k;
+        _size += k;
+        s += k;
+        n -= k;
+    }
+    return *this;
+}
+
+buf_chain& buf_chain::append_ref(const void* p, size_t n) {
+    if (n > 0) {
+        _segs.push_back(seg_t{(char*)p, n, 0});
+        _size += n;
+        _w = _e = 0;
+    }
+    return *this;
+}
+
+void buf_chain::consume(size_t n) {
+    if (n >= _size) return this->clear();
+    _size -= n;
+    while (n > 0) {
+        seg_t& x = _segs[_h];
+        if (n < x.size) {
+            x.p += n;
+            x.size -= n;
+            break;
+        }
+        n -= x.size;
+        if (x.block) xx::block_pool().push(x.block);
+        ++_h;
+    }
+}
+
+void buf_chain::clear() {
+    for (size_t i = _h; i < _segs.size(); ++i) {
+        if (_segs[i].block) xx::block_pool().push(_segs[i].block);
+    }
+    _segs.clear();
+    _h = 0;
+    _size = 0;
+    _w = _e = 0;
+}
+
+size_t buf_chain::iov(struct iovec* v, size_t n, size_t pos) const {
+    size_t k = 0;
+    for (size_t i = _h + pos; i < _segs.size() && k < n; ++i, ++k) {
+        v[k].iov_base = _segs[i].p;
+        v[k].iov_len = _segs[i].size;
+    }
+    return k;
+}
+
+void buf_chain::copy_to(void* p) const {
+    char* s = (char*)p;
+    for (size_t i = _h; i < _segs.size(); ++i) {
+        memcpy(s, _segs[i].p, _segs[i].size);
+        s += _segs[i].size;
+    }
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+int64_t sendv(sock_t fd, buf_chain& b, int ms) {
+    // the iovec array is on the stack, as the coroutine may be suspended in
+    // co::sendv() while others in the same thread send their buffers.
+    const size_t kMax = IOV_MAX < 64 ? IOV_MAX : 64;
+    struct iovec v[64];
+    int64_t total = 0;
+    for (size_t pos = 0;;) {
+        const size_t n = b.iov(v, kMax, pos);
+        if (n == 0) break;
+        const int r = co::sendv(fd, v, (int)n, ms);
+        if (r < 0) {
+            b.consume((size_t)total);
+            return -1;
+        }
+        total += r;
+        pos += n;
+    }
+    b.clear();
+    return total;
+}
+
+}  // namespace co
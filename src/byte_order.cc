@@ -0,0 +1,121 @@
+#include "co/byte_order.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BO_NOSWAP
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BO_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BO_NEON
+#endif
+
+namespace {
+
+// The SIMD code swaps 64 bytes at a time with unaligned loads and stores, and
+// returns the number of bytes done, the rest is left to the scalar code.
+// As a block is loaded before it is stored, @d may be the same as @s.
+#if defined(BO_SSE2)
+inline __m128i swap16(__m128i x) {
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+// reverse the 16-bit words in each 32-bit lane, then the bytes in each word
+inline __m128i swap32(__m128i x) {
+    x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+    return swap16(x);
+}
+
+inline __m128i swap64(__m128i x) {
+    x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0x1B), 0x1B);
+    return swap16(x);
+}
+
+#define BO_SWAP_N(name, f)                                              \
+    inline size_t name(void* d, const void* s, size_t bytes) {          \
+        const size_t n = bytes & ~(size_t)63;                           \
+        char* p = (char*)d;                                             \
+        const char* q = (const char*)s;                                 \
+        for (size_t i = 0; i < n; i += 64) {                            \
+            __m128i a = _mm_loadu_si128((const __m128i*)(q + i));       \
+            __m128i b = _mm_loadu_si128((const __m128i*)(q + i + 16));  \
+            __m128i c = _mm_loadu_si128((const __m128i*)(q + i + 32));  \
+            __m128i e = _mm_loadu_si128((const __m128i*)(q + i + 48));  \
+            _mm_storeu_si128((__m128i*)(p + i), f(a));                  \
+            _mm_storeu_si128((__m128i*)(p + i + 16), f(b));             \
+            _mm_storeu_si128((__m128i*)(p + i + 32), f(c));             \
+            _mm_storeu_si128((__m128i*)(p + i + 48), f(e));             \
+        }                                                               \
+        return n;                                                       \
+    }
+
+#elif defined(BO_NEON)
+#define BO_SWAP_N(name, f)                                              \
+    inline size_t name(void* d, const void* s, size_t bytes) {          \
+        const size_t n = bytes & ~(size_t)63;                           \
+        uint8_t* p = (uint8_t*)d;                                       \
+        const uint8_t* q = (const uint8_t*)s;                           \
+        for (size_t i = 0; i < n; i += 64) {                            \
+            uint8x16_t a = vld1q_u8(q + i);                             \
+            uint8x16_t b = vld1q_u8(q + i + 16);                        \
+            uint8x16_t c = vld1q_u8(q + i + 32);                        \
+            uint8x16_t e = vld1q_u8(q + i + 48);                        \
+            vst1q_u8(p + i, f(a));                                      \
+            vst1q_u8(p + i + 16, f(b));                                 \
+            vst1q_u8(p + i + 32, f(c));                                 \
+            vst1q_u8(p + i + 48, f(e));                                 \
+        }                                                               \
+        return n;                                                       \
+    }
+
+#define swap16 vrev16q_u8
+#define swap32 vrev32q_u8
+#define swap64 vrev64q_u8
+#endif
+
+#ifdef BO_SWAP_N
+BO_SWAP_N(swap16_n, swap16)
+BO_SWAP_N(swap32_n, swap32)
+BO_SWAP_N(swap64_n, swap64)
+#undef BO_SWAP_N
+#else
+inline size_t swap16_n(void*, const void*, size_t) { return 0; }
+inline size_t swap32_n(void*, const void*, size_t) { return 0; }
+inline size_t swap64_n(void*, const void*, size_t) { return 0; }
+#endif
+
+}  // namespace
+
+#ifdef BO_NOSWAP
+void hton_n(uint16_t* dst, const uint16_t* src, size_t n) {
+    if (dst != src) memmove(dst, src, n * 2);
+}
+
+void hton_n(uint32_t* dst, const uint32_t* src, size_t n) {
+    if (dst != src) memmove(dst, src, n * 4);
+}
+
+void hton_n(uint64_t* dst, const uint64_t* src, size_t n) {
+    if (dst != src) memmove(dst, src, n * 8);
+}
+
+#else
+// The tail is done with load_be*(), as @dst and @src may be unaligned, e.g. they
+// point into a network buffer.
+#define BO_HTON_N(T, bits)                                \
+    void hton_n(T* dst, const T* src, size_t n) {         \
+        char* p = (char*)dst;                             \
+        const char* q = (const char*)src;                 \
+        n *= sizeof(T);                                   \
+        size_t i = swap##bits##_n(p, q, n);               \
+        for (; i < n; i += sizeof(T)) {                   \
+            const T v = load_be##bits(q + i);             \
+            memcpy(p + i, &v, sizeof(T));                 \
+        }                                                 \
+    }
+
+BO_HTON_N(uint16_t, 16)
+BO_HTON_N(uint32_t, 32)
+BO_HTON_N(uint64_t, 64)
+#undef BO_HTON_N
+#endif
@@ -0,0 +1,80 @@
+#include "co/closure.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+namespace co {
+namespace xx {
+
+// Thread-local cache of small blocks for closures. A closure is usually freed
+// in the scheduler thread it runs in, so closures created in coroutines reuse
+// blocks of the coroutines that have finished on the same scheduler.
+class ClosureCache {
+  public:
+    static const size_t A = 16;          // alignment and step of the size classes
+    static const size_t N = 8;           // size classes: 16, 32, ..., 128 bytes
+    static const uint32_t MAX_NUM = 1024;  // max blocks cached for each class
+
+    ClosureCache() : _h(), _n(), _dead(false) {}
+
+    ~ClosureCache() {
+        for (size_t c = 0; c < N; ++c) {
+            while (_h[c]) {
+                Node* const x = _h[c];
+                _h[c] = x->next;
+                ::free(x);
+            }
+            _n[c] = 0;
+        }
+        _dead = true;
+    }
+
+    void* pop(size_t n) {
+        const size_t c = (n - 1) / A;
+        if (c < N && _h[c]) {
+            Node* const x = _h[c];
+            _h[c] = x->next;
+            --_n[c];
+            return x;
+        }
+        void* const p = ::malloc(c < N ? (c + 1) * A : n);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    void push(void* p, size_t n) {
+        const size_t c = (n - 1) / A;
+        if (c < N && _n[c] < MAX_NUM && !_dead) {
+            Node* const x = (Node*)p;
+            x->next = _h[c];
+            _h[c] = x;
+            ++_n[c];
+        } else {
+            ::free(p);
+        }
+    }
+
+  private:
+    struct Node {
+        Node* next;
+    };
+    Node* _h[N];
+    uint32_t _n[N];
+    bool _dead;  // the thread is exiting
+};
+
+inline ClosureCache& closure_cache() {
+    static thread_local ClosureCache _cache;
+    return _cache;
+}
+
+}  // namespace xx
+
+void* Closure::operator new(size_t n) { return xx::closure_cache().pop(n); }
+
+void Closure::operator delete(void* p, size_t n) noexcept {
+    if (p) xx::closure_cache().push(p, n);
+}
+
+}  // namespace co
@@ -6,15 +6,19 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <cstring>
 #include <mutex>
 
 
 #ifndef _WIN32
 #ifdef __linux__
+#include <linux/futex.h>   // for FUTEX_WAIT_PRIVATE
 #include <sys/syscall.h>   // for SYS_xxx definitions
 #include <time.h>          // for clock_gettime
 #include <unistd.h>        // for syscall()
 
+#include <climits>
+
 #else
 #include <sys/time.h>   // for gettimeofday
 #ifndef __APPLE__
@@ -87,7 +91,7 @@ public:
             while (h) {
                 const auto m = (_memb*)h;
                 h            = h->next;
-                ::free(m);
+                co::free(m);
             }
         }
 
@@ -97,7 +101,7 @@ public:
         void push_back(void* x) {
             _memb* m = (_memb*)_q.back();
             if (!m || m->wx == N) {
-                m = new _memb;
+                m = new (co::alloc(sizeof(_memb))) _memb;
                 _q.push_back(m);
             }
             m->q[m->wx++] = x;
@@ -115,7 +119,7 @@ public:
                     m->rx = m->wx = 0;
                     if (_q.back() != m) {
                         _q.pop_front();
-                        delete m;
+                        co::free(m);
                     }
                 }
             }
@@ -129,31 +133,138 @@ public:
         : ref_counter()
         , _m()
         , _cv()
-        , _lock(0) {}
+        , _lock(0)
+        , _spin(8)
+        , _notified(0) {}
     ~mutex_impl() = default;
 
-    void        lock();
-    void        unlock();
+    inline void lock();
+    inline void unlock();
     inline bool try_lock() noexcept;
 
 private:
+    inline bool _try_lock() noexcept {
+        uint8_t x = 0;
+        return _lock.compare_exchange_strong(x, 1, std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+    bool spin_lock() noexcept;
+    void lock_slow();
+    void unlock_slow();
+
+    static constexpr uint32_t max_spin = 128;
+
     std::mutex              _m;
     std::condition_variable _cv;
     queue                   _wq;
-    uint8_t                 _lock;   // 0: unlocked, 1: locked, 2:notify other thread
+    std::atomic_uint8_t     _lock;       // 0: unlocked, 1: locked, 2: locked with waiters
+    std::atomic_uint16_t    _spin;       // average spins to get the lock, adjusted on the fly
+    uint8_t                 _notified;   // the lock was handed off to a waiting thread
 };
 
-inline bool mutex_impl::try_lock() noexcept {
-    std::unique_lock<std::mutex> g(_m);
-    return _lock ? false : (_lock = 1);
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+    YieldProcessor();
+#else
+    __builtin_ia32_pause();
+#endif
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
 }
 
-void mutex_impl::lock() {
+// Threads wait on a 32-bit word with futex on linux, or WaitOnAddress on windows,
+// instead of a mutex and a condition variable.
+#if defined(__linux__) || defined(_WIN32)
+#define CO_USE_FUTEX 1
+
+// block the thread while *p == v, for at most @ms milliseconds (-1 for ever), it
+// may return spuriously.
+inline void futex_wait(std::atomic_uint32_t* p, uint32_t v, uint32_t ms) {
+#ifdef _WIN32
+    ::WaitOnAddress((volatile VOID*)p, &v, sizeof(v), ms == (uint32_t)-1 ? INFINITE : ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    ::syscall(SYS_futex, (uint32_t*)p, FUTEX_WAIT_PRIVATE, v, ms == (uint32_t)-1 ? nullptr : &ts,
+              nullptr, 0);
+#endif
+}
+
+// wake up all threads blocked on @p
+inline void futex_wake(std::atomic_uint32_t* p) {
+#ifdef _WIN32
+    ::WakeByAddressAll((PVOID)p);
+#else
+    ::syscall(SYS_futex, (uint32_t*)p, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+static constexpr uint32_t futex_spin = 128;
+
+// wait until *p != v, spin a while before blocking the thread. Return false if
+// it is still v after @ms milliseconds.
+bool futex_wait_change(std::atomic_uint32_t* p, uint32_t v, uint32_t ms) {
+    for (uint32_t i = 0; i < futex_spin; ++i) {
+        if (p->load(std::memory_order_acquire) != v) return true;
+        cpu_relax();
+    }
+    const int64_t beg = ms != (uint32_t)-1 ? now::ms() : 0;
+    uint32_t t = ms;
+    for (;;) {
+        futex_wait(p, v, t);
+        if (p->load(std::memory_order_acquire) != v) return true;
+        if (ms != (uint32_t)-1) {
+            const int64_t d = now::ms() - beg;
+            if (d >= ms) return false;
+            t = ms - (uint32_t)d;
+        }
+    }
+}
+#endif
+
+inline bool mutex_impl::try_lock() noexcept { return this->_try_lock(); }
+
+inline void mutex_impl::lock() {
+    if (this->_try_lock() || this->spin_lock()) return;
+    this->lock_slow();
+}
+
+inline void mutex_impl::unlock() {
+    uint8_t x = 1;
+    if (_lock.compare_exchange_strong(x, 0, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+        return;
+    }
+    this->unlock_slow();
+}
+
+// spin briefly before parking the caller. The spin count follows the spins that
+// got the lock recently, and shrinks when spinning does not help (the owner is
+// suspended, or the lock is held for a long time).
+bool mutex_impl::spin_lock() noexcept {
+    const uint32_t avg = _spin.load(std::memory_order_relaxed);
+    const uint32_t max = avg * 2 + 8 < max_spin ? avg * 2 + 8 : max_spin;
+    for (uint32_t i = 1; i <= max; ++i) {
+        cpu_relax();
+        if (_lock.load(std::memory_order_relaxed) == 0 && this->_try_lock()) {
+            _spin.store((uint16_t)(avg + ((int)i - (int)avg) / 8), std::memory_order_relaxed);
+            return true;
+        }
+    }
+    _spin.store((uint16_t)(avg / 2), std::memory_order_relaxed);
+    return false;
+}
+
+// set the lock state to 2 with _m held, so the owner will take the slow path in
+// unlock() and hand the lock off to a waiter.
+void mutex_impl::lock_slow() {
     const auto sched = xx::current_sched();
     if (sched) { /* in coroutine */
         _m.lock();
-        if (!_lock) {
-            _lock = 1;
+        if (_lock.exchange(2, std::memory_order_acquire) == 0) {
             _m.unlock();
         }
         else {
@@ -165,15 +276,12 @@ void mutex_impl::lock() {
     }
     else { /* non-coroutine */
         std::unique_lock<std::mutex> g(_m);
-        if (!_lock) {
-            _lock = 1;
-        }
-        else {
+        if (_lock.exchange(2, std::memory_order_acquire) != 0) {
             _wq.push_back(nullptr);
             for (;;) {
                 _cv.wait(g);
-                if (_lock == 2) {
-                    _lock = 1;
+                if (_notified) {
+                    _notified = 0;
                     break;
                 }
             }
@@ -181,32 +289,210 @@ void mutex_impl::lock() {
     }
 }
 
-void mutex_impl::unlock() {
+void mutex_impl::unlock_slow() {
     _m.lock();
     if (_wq.empty()) {
-        _lock = 0;
+        _lock.store(0, std::memory_order_release);
         _m.unlock();
     }
     else {
+        // the lock is handed off to the waiter, it remains locked
         Coroutine* const co = (Coroutine*)_wq.pop_front();
+        if (_wq.empty()) _lock.store(1, std::memory_order_relaxed);
         if (co) {
             _m.unlock();
             co->sched->add_ready_task(co);
         }
         else {
-            _lock = 2;
+            _notified = 1;
             _m.unlock();
             _cv.notify_one();
         }
     }
 }
 
+// Reader-writer lock for coroutines. Writers are preferred: readers arriving
+// while a writer is waiting will wait too. When a writer unlocks, all waiting
+// readers are let in before the next writer, so readers will not starve.
+// Waiting coroutines are queued as Coroutine*, waiting threads as nullptr,
+// a lock handed off to threads is counted in _tr (readers) or _tw (writers).
+class shared_mutex_impl : public ref_counter {
+public:
+    typedef mutex_impl::queue queue;
+
+    inline shared_mutex_impl() noexcept
+        : ref_counter()
+        , _readers(0)
+        , _writer(false)
+        , _tr(0)
+        , _tw(0) {}
+    ~shared_mutex_impl() = default;
+
+    void lock();
+    void unlock();
+    bool try_lock();
+    void lock_shared();
+    void unlock_shared();
+    bool try_lock_shared();
+
+private:
+    // hand the lock off to the first waiting writer, _m MUST be locked
+    void wake_writer();
+    // hand the lock off to all waiting readers, _m MUST be locked
+    void wake_readers();
+
+    std::mutex              _m;
+    std::condition_variable _rcv;
+    std::condition_variable _wcv;
+    queue                   _rq;        // waiting readers
+    queue                   _wq;        // waiting writers
+    uint32_t                _readers;   // readers holding the lock
+    bool                    _writer;    // a writer holds the lock
+    uint32_t                _tr;        // locks handed off to reader threads
+    uint32_t                _tw;        // locks handed off to writer threads
+};
+
+bool shared_mutex_impl::try_lock() {
+    std::lock_guard<std::mutex> g(_m);
+    if (_writer || _readers) return false;
+    return _writer = true;
+}
+
+bool shared_mutex_impl::try_lock_shared() {
+    std::lock_guard<std::mutex> g(_m);
+    if (_writer || !_wq.empty()) return false;
+    ++_readers;
+    return true;
+}
+
+void shared_mutex_impl::lock() {
+    const auto sched = xx::current_sched();
+    std::unique_lock<std::mutex> g(_m);
+    if (!_writer && !_readers) {
+        _writer = true;
+        return;
+    }
+    if (sched) { /* in coroutine */
+        _wq.push_back(sched->running());
+        g.unlock();
+        sched->yield();
+    }
+    else { /* non-coroutine */
+        _wq.push_back(nullptr);
+        while (_tw == 0) _wcv.wait(g);
+        --_tw;
+    }
+}
+
+void shared_mutex_impl::lock_shared() {
+    const auto sched = xx::current_sched();
+    std::unique_lock<std::mutex> g(_m);
+    if (!_writer && _wq.empty()) {
+        ++_readers;
+        return;
+    }
+    if (sched) { /* in coroutine */
+        _rq.push_back(sched->running());
+        g.unlock();
+        sched->yield();
+    }
+    else { /* non-coroutine */
+        _rq.push_back(nullptr);
+        while (_tr == 0) _rcv.wait(g);
+        --_tr;
+    }
+}
+
+void shared_mutex_impl::unlock() {
+    std::lock_guard<std::mutex> g(_m);
+    _writer = false;
+    if (!_rq.empty()) {
+        this->wake_readers();
+    }
+    else if (!_wq.empty()) {
+        this->wake_writer();
+    }
+}
+
+void shared_mutex_impl::unlock_shared() {
+    std::lock_guard<std::mutex> g(_m);
+    if (--_readers == 0 && !_wq.empty()) this->wake_writer();
+}
+
+void shared_mutex_impl::wake_writer() {
+    _writer = true;
+    Coroutine* const co = (Coroutine*)_wq.pop_front();
+    if (co) {
+        co->sched->add_ready_task(co);
+    }
+    else {
+        ++_tw;
+        _wcv.notify_all();
+    }
+}
+
+void shared_mutex_impl::wake_readers() {
+    uint32_t nt = 0;
+    while (!_rq.empty()) {
+        Coroutine* const co = (Coroutine*)_rq.pop_front();
+        ++_readers;
+        co ? co->sched->add_ready_task(co) : (void)++nt;
+    }
+    if (nt) {
+        _tr += nt;
+        _rcv.notify_all();
+    }
+}
+
+// Coroutines woken up together, e.g. by a broadcast, are grouped by scheduler
+// and handed over in one batch for each scheduler, with one lock and one signal,
+// instead of one for each coroutine. The batch of each thread is reused.
+class ready_batch {
+public:
+    ready_batch() : _n(0) {}
+    ~ready_batch() = default;
+
+    static ready_batch& get() {
+        static thread_local ready_batch b;
+        return b;
+    }
+
+    void add(Coroutine* co) {
+        const uint32_t i = co->sched->id();
+        if (i >= _v.size()) _v.resize(i + 1);
+        _v[i].push_back(co);
+        ++_n;
+    }
+
+    void flush() {
+        if (_n == 0) return;
+        for (size_t i = 0; i < _v.size(); ++i) {
+            auto& v = _v[i];
+            if (v.empty()) continue;
+            if (v.size() == 1) {
+                v[0]->sched->add_ready_task(v[0]);
+            }
+            else {
+                v[0]->sched->add_ready_tasks(v.data(), v.size());
+            }
+            v.clear();
+        }
+        _n = 0;
+    }
+
+private:
+    co::vector<co::vector<Coroutine*>> _v;  // indexed by id of the scheduler
+    size_t _n;
+};
+
 class event_impl : public ref_counter {
 public:
     explicit inline event_impl(bool m, bool s, uint32_t wg = 0) noexcept
         : ref_counter()
         , _m()
+#ifndef CO_USE_FUTEX
         , _cv()
+#endif
         , _wt(0)
         , _sn(0)
         , _wg(wg)
@@ -222,10 +508,12 @@ public:
 
 private:
     std::mutex              _m;
+#ifndef CO_USE_FUTEX
     std::condition_variable _cv;
+#endif
     co::clist               _wc;   // wait coroutine
     uint32_t                _wt;   // wait thread num.
-    uint32_t                _sn;   // signal num.
+    std::atomic_uint32_t    _sn;   // signal num, waiting threads are woken up when it changes
     std::atomic_uint32_t    _wg;   // for wait group
     bool                    _signaled;
     const bool              _manual_reset;
@@ -251,19 +539,22 @@ bool event_impl::wait(uint32_t ms) {
                 if (!x)
                     x = w;
                 else
-                    ::free(w);
+                    co::free(w);
             }
-            if (x)
+            if (x) {
+                x->co = co;
                 x->state = st_wait;
-            else
+            }
+            else {
                 x = make_waitx(co);
+            }
             co->waitx = x;
             _wc.push_back(x);
         }
 
         if (ms != (uint32_t)-1) sched->add_timer(ms);
         sched->yield();
-        if (!sched->timeout()) ::free(co->waitx);
+        if (!sched->timeout()) co::free(co->waitx);
         co->waitx = nullptr;
         return !sched->timeout();
     }
@@ -277,6 +568,15 @@ bool event_impl::wait(uint32_t ms) {
 
         const uint32_t sn = _sn;
         ++_wt;
+#ifdef CO_USE_FUTEX
+        g.unlock();
+        if (futex_wait_change(&_sn, sn, ms)) return true;
+        g.lock();
+        if (sn != _sn) return true;
+        assert(_wt > 0);
+        --_wt;
+        return false;
+#else
         if (ms != (uint32_t)-1) {
             const auto r = _cv.wait_for(g, std::chrono::milliseconds(ms)) == std::cv_status::no_timeout;
             if (!r && sn == _sn) {
@@ -289,6 +589,7 @@ bool event_impl::wait(uint32_t ms) {
             _cv.wait(g);
             return true;
         }
+#endif
     }
 }
 
@@ -317,7 +618,7 @@ void event_impl::signal() {
                         break;
                     }
                     else { /* timeout */
-                        ::free(w);
+                        co::free(w);
                     }
                 } while (h);
             }
@@ -327,7 +628,11 @@ void event_impl::signal() {
             if (_signaled && !_manual_reset) _signaled = false;
             if (has_wt) {
                 ++_sn;
+#ifdef CO_USE_FUTEX
+                futex_wake(&_sn);
+#else
                 _cv.notify_all();
+#endif
             }
         }
         else {
@@ -335,17 +640,20 @@ void event_impl::signal() {
         }
     }
 
+    if (!h) return;
+    auto& b = ready_batch::get();
     while (h) {
         waitx_t* const w = (waitx_t*)h;
         h                = h->next;
         decltype(w->state)::value_type state(st_wait);
         if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
-            w->co->sched->add_ready_task(w->co);
+            b.add(w->co);
         }
         else { /* timeout */
-            ::free(w);
+            co::free(w);
         }
     }
+    b.flush();
 }
 
 inline void event_impl::reset() {
@@ -353,6 +661,252 @@ inline void event_impl::reset() {
     _signaled = false;
 }
 
+// Condition variable used with co::mutex. Waiting coroutines are queued as
+// waitx_t like event_impl, waiting threads are counted in _wt and woken up when
+// _sn changes. notify_one() wakes up all waiting threads if no coroutine is
+// waiting, they may return spuriously.
+class cond_impl : public ref_counter {
+public:
+    inline cond_impl() noexcept
+        : ref_counter()
+        , _m()
+#ifndef CO_USE_FUTEX
+        , _cv()
+#endif
+        , _wt(0)
+        , _sn(0) {}
+    ~cond_impl() = default;
+
+    bool wait(mutex_impl* m, uint32_t ms);
+    void notify_one();
+    void notify_all();
+
+private:
+    // wake up all waiting threads, _m MUST be locked
+    void wake_threads() {
+        _wt = 0;
+        ++_sn;
+#ifdef CO_USE_FUTEX
+        futex_wake(&_sn);
+#else
+        _cv.notify_all();
+#endif
+    }
+
+    std::mutex              _m;
+#ifndef CO_USE_FUTEX
+    std::condition_variable _cv;
+#endif
+    co::clist               _wc;   // waiting coroutines
+    uint32_t                _wt;   // waiting thread num.
+    std::atomic_uint32_t    _sn;   // notify num, waiting threads are woken up when it changes
+};
+
+// The waiter is queued before @m is unlocked, a notify after that is not missed.
+bool cond_impl::wait(mutex_impl* m, uint32_t ms) {
+    const auto sched = xx::current_sched();
+    if (sched) { /* in coroutine */
+        Coroutine* co = sched->running();
+        {
+            std::lock_guard<std::mutex> g(_m);
+            waitx_t* x = 0;
+            while (!_wc.empty()) {
+                waitx_t* const w = (waitx_t*)_wc.front();
+                if (w->state != st_timeout) break;
+                _wc.pop_front();
+                if (!x)
+                    x = w;
+                else
+                    co::free(w);
+            }
+            if (x) {
+                x->co = co;
+                x->state = st_wait;
+            }
+            else {
+                x = make_waitx(co);
+            }
+            co->waitx = x;
+            _wc.push_back(x);
+        }
+        m->unlock();
+
+        if (ms != (uint32_t)-1) sched->add_timer(ms);
+        sched->yield();
+        const bool r = !sched->timeout();
+        if (r) co::free(co->waitx);
+        co->waitx = nullptr;
+        m->lock();
+        return r;
+    }
+    else { /* not in coroutine */
+        std::unique_lock<std::mutex> g(_m);
+        const uint32_t sn = _sn;
+        ++_wt;
+        bool r = true;
+#ifdef CO_USE_FUTEX
+        g.unlock();
+        m->unlock();
+        if (!futex_wait_change(&_sn, sn, ms)) {
+            g.lock();
+            if (sn == _sn) {
+                assert(_wt > 0);
+                --_wt;
+                r = false;
+            }
+            g.unlock();
+        }
+#else
+        m->unlock();
+        if (ms != (uint32_t)-1) {
+            _cv.wait_for(g, std::chrono::milliseconds(ms), [this, sn]() { return sn != _sn; });
+            if (sn == _sn) {
+                assert(_wt > 0);
+                --_wt;
+                r = false;
+            }
+        }
+        else {
+            while (sn == _sn) _cv.wait(g);
+        }
+        g.unlock();
+#endif
+        m->lock();
+        return r;
+    }
+}
+
+void cond_impl::notify_one() {
+    Coroutine* co = 0;
+    {
+        std::lock_guard<std::mutex> g(_m);
+        while (!_wc.empty()) {
+            waitx_t* const w = (waitx_t*)_wc.pop_front();
+            decltype(w->state)::value_type state(st_wait);
+            if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                co = w->co;
+                break;
+            }
+            else { /* timeout */
+                co::free(w);
+            }
+        }
+        if (!co && _wt > 0) this->wake_threads();
+    }
+    if (co) co->sched->add_ready_task(co);
+}
+
+void cond_impl::notify_all() {
+    co::clink* h = 0;
+    {
+        std::lock_guard<std::mutex> g(_m);
+        if (!_wc.empty()) {
+            h = _wc.front();
+            _wc.clear();
+        }
+        if (_wt > 0) this->wake_threads();
+    }
+    if (!h) return;
+
+    auto& b = ready_batch::get();
+    while (h) {
+        waitx_t* const w = (waitx_t*)h;
+        h                = h->next;
+        decltype(w->state)::value_type state(st_wait);
+        if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            b.add(w->co);
+        }
+        else { /* timeout */
+            co::free(w);
+        }
+    }
+    b.flush();
+}
+
+#ifdef CO_USE_FUTEX
+// State of the event is kept in a 32-bit word, threads wait on it with futex:
+//   - bit 0: the event is signaled
+//   - bit 1-15: number of threads waiting
+//   - bit 16-31: generation, increased when the waiting threads are woken up
+// A signal wakes up all threads waiting at that time, or marks the event as
+// signaled if there is none. A thread spins a while before it goes to sleep,
+// a signal during the spin costs no syscall on either side.
+class sync_event_impl {
+public:
+    explicit sync_event_impl(bool m, bool s)
+        : _s(s ? 1 : 0)
+        , _manual_reset(m) {}
+
+    ~sync_event_impl() = default;
+
+    void wait() { this->wait((uint32_t)-1); }
+
+    bool wait(uint32_t ms) {
+        uint32_t s;
+        for (uint32_t i = 0;; ++i) {
+            s = _s.load(std::memory_order_acquire);
+            if (this->_take(s)) return true;
+            if (ms == 0) return false;
+            if (i == futex_spin) break;
+            cpu_relax();
+        }
+
+        // register as a waiter, unless the event is signaled meanwhile
+        for (;;) {
+            if (this->_take(s)) return true;
+            if (_s.compare_exchange_weak(s, s + 2)) break;
+        }
+        s += 2;
+        const uint32_t gen = s >> 16;
+        const int64_t beg = ms != (uint32_t)-1 ? now::ms() : 0;
+        uint32_t t = ms;
+        for (;;) {
+            futex_wait(&_s, s, t);
+            s = _s.load(std::memory_order_acquire);
+            if ((s >> 16) != gen) return true;
+            if (ms != (uint32_t)-1) {
+                const int64_t d = now::ms() - beg;
+                if (d >= ms) break;
+                t = ms - (uint32_t)d;
+            }
+        }
+
+        // timeout, unregister unless a signal came at the same time
+        for (;;) {
+            if ((s >> 16) != gen) return true;
+            if (_s.compare_exchange_weak(s, s - 2)) return false;
+        }
+    }
+
+    void signal() {
+        uint32_t s = _s.load(std::memory_order_relaxed);
+        for (;;) {
+            if ((s & 0xfffe) == 0) {
+                if (_s.compare_exchange_weak(s, s | 1)) return;
+            }
+            else if (_s.compare_exchange_weak(s, (s & 0xffff0000) + 0x10000)) {
+                futex_wake(&_s);
+                return;
+            }
+        }
+    }
+
+    inline void reset() noexcept { _s.fetch_and(~1u); }
+
+private:
+    // take the signal if the event is signaled, @s is updated if it failed
+    bool _take(uint32_t& s) noexcept {
+        while (s & 1) {
+            if (_manual_reset || _s.compare_exchange_weak(s, s & ~1u)) return true;
+        }
+        return false;
+    }
+
+    std::atomic_uint32_t _s;
+    const bool           _manual_reset;
+};
+
+#else
 class sync_event_impl {
 public:
     explicit sync_event_impl(bool m, bool s)
@@ -417,12 +971,346 @@ private:
     bool                    _signaled;
     const bool              _manual_reset;
 };
+#endif
+
+// Waiters of a semaphore are waitx_t extended with the number of units needed.
+// A waiter that timed out stays in the queue, it is freed when it reaches the
+// front, the same as waiters of event_impl.
+class semaphore_impl : public ref_counter {
+public:
+    struct waiter : waitx_t {
+        uint32_t n;   // units needed
+    };
+
+    explicit inline semaphore_impl(uint32_t n) noexcept
+        : ref_counter()
+        , _count(n) {}
+    ~semaphore_impl();
+
+    bool acquire(uint32_t n, uint32_t ms);
+    bool try_acquire(uint32_t n);
+    void release(uint32_t n);
+
+    uint32_t count() {
+        std::lock_guard<std::mutex> g(_m);
+        return _count;
+    }
+
+private:
+    // serve waiters at the front of the queue, _m MUST be locked
+    void serve();
+
+    std::mutex              _m;
+    std::condition_variable _cv;      // for waiting threads
+    co::clist               _wq;      // waiters
+    uint32_t                _count;   // units available
+};
+
+semaphore_impl::~semaphore_impl() {
+    while (!_wq.empty()) co::free(_wq.pop_front());
+}
+
+bool semaphore_impl::try_acquire(uint32_t n) {
+    std::lock_guard<std::mutex> g(_m);
+    if (!_wq.empty() || _count < n) return false;
+    _count -= n;
+    return true;
+}
+
+bool semaphore_impl::acquire(uint32_t n, uint32_t ms) {
+    std::unique_lock<std::mutex> g(_m);
+    if (_wq.empty() && _count >= n) {
+        _count -= n;
+        return true;
+    }
+    if (ms == 0) return false;
+
+    const auto sched = xx::current_sched();
+    waiter* const w = (waiter*)make_waitx(sched ? sched->running() : nullptr, sizeof(waiter));
+    w->n = n;
+    _wq.push_back(w);
+
+    if (sched) { /* in coroutine */
+        Coroutine* const co = sched->running();
+        co->waitx = w;
+        g.unlock();
+        if (ms != (uint32_t)-1) sched->add_timer(ms);
+        sched->yield();
+        co->waitx = nullptr;
+        if (!sched->timeout()) {
+            co::free(w);
+            return true;
+        }
+        // units released before the timeout may be enough for waiters behind
+        g.lock();
+        this->serve();
+        return false;
+    }
+    else { /* not in coroutine */
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (w->state.load(std::memory_order_relaxed) == st_wait) {
+            if (ms == (uint32_t)-1) {
+                _cv.wait(g);
+            }
+            else if (_cv.wait_until(g, deadline) == std::cv_status::timeout) {
+                break;
+            }
+        }
+        decltype(w->state)::value_type state(st_wait);
+        if (w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            this->serve();
+            return false;
+        }
+        co::free(w);
+        return true;
+    }
+}
+
+void semaphore_impl::release(uint32_t n) {
+    std::lock_guard<std::mutex> g(_m);
+    _count += n;
+    this->serve();
+}
+
+void semaphore_impl::serve() {
+    bool nt = false;
+    while (!_wq.empty()) {
+        waiter* const w = (waiter*)_wq.front();
+        if (w->state.load(std::memory_order_relaxed) != st_timeout && w->n > _count) break;
+        _wq.pop_front();
+        decltype(w->state)::value_type state(st_wait);
+        if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            _count -= w->n;
+            if (w->co) {
+                w->co->sched->add_ready_task(w->co);
+            }
+            else {
+                nt = true;
+            }
+        }
+        else { /* timeout */
+            co::free(w);
+        }
+    }
+    if (nt) _cv.notify_all();
+}
+
+// Token bucket in the form of GCRA: _tat is the time the bucket would be full
+// again. A request of n tokens moves it forward by n intervals, and it conforms
+// when the new _tat is within burst intervals from now.
+class rate_limiter_impl : public ref_counter {
+public:
+    inline rate_limiter_impl(double rate, uint32_t burst) noexcept
+        : ref_counter()
+        , _tat(0) {
+        this->set_rate(rate, burst);
+    }
+    ~rate_limiter_impl() = default;
+
+    bool acquire(uint32_t n, uint32_t ms) {
+        int64_t wait_ns;
+        {
+            std::lock_guard<std::mutex> g(_m);
+            const int64_t now_ns = now::us() * 1000;
+            const int64_t tat = (_tat > now_ns ? _tat : now_ns) + n * _interval;
+            wait_ns = tat - _burst * _interval - now_ns;
+            if (wait_ns > 0 && (ms == 0 || (ms != (uint32_t)-1 && wait_ns > ms * 1000000LL))) {
+                return false;
+            }
+            _tat = tat;
+        }
+        while (wait_ns > 0) {
+            const int64_t us = (wait_ns + 999) / 1000;
+            const uint32_t x = us < 1000000000 ? (uint32_t)us : 1000000000;
+            co::sleep_us(x);
+            wait_ns -= x * 1000LL;
+        }
+        return true;
+    }
+
+    void set_rate(double rate, uint32_t burst) {
+        assert(rate > 0);
+        std::lock_guard<std::mutex> g(_m);
+        _interval = (int64_t)(1e9 / rate);
+        if (_interval == 0) _interval = 1;
+        _burst = burst > 0 ? burst : 1;
+    }
+
+private:
+    std::mutex _m;
+    int64_t    _tat;        // theoretical arrival time (ns)
+    int64_t    _interval;   // ns per token
+    int64_t    _burst;      // size of the bucket
+};
+
+// A waiter of futures, it may wait for several futures at the same time, and
+// is linked to each of them by a node. The first future done wins.
+struct future_waiter {
+    waitx_t*        x;      // x->co is NULL for a thread
+    co::sync_event* ev;     // for a thread
+    int             first;  // index of the future done first
+};
+
+// f is NULL for a waiter node
+struct future_node : future_callback {
+    future_waiter* w;
+    int            i;
+};
+
+void future_base::set_done() {
+    std::lock_guard<std::mutex> g(_m);
+    _done.store(true, std::memory_order_release);
+    while (!_w.empty()) {
+        future_node* const n = (future_node*)_w.pop_front();
+        if (n->f) {
+            n->f(n);
+            continue;
+        }
+        future_waiter* const w = n->w;
+        decltype(w->x->state)::value_type state(st_wait);
+        if (w->x->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            w->first = n->i;
+            Coroutine* const co = w->x->co;
+            co ? co->sched->add_ready_task(co) : w->ev->signal();
+        }
+    }
+}
+
+bool future_base::add_callback(future_callback* c) {
+    std::lock_guard<std::mutex> g(_m);
+    if (this->done()) return false;
+    _w.push_back(c);
+    return true;
+}
+
+bool future_base::wait(uint32_t ms) {
+    future_base* const v = this;
+    return wait_any(&v, 1, ms) == 0;
+}
+
+// The waiter and the nodes are allocated in one block on heap. They MUST NOT
+// live on the stack of a coroutine, as stacks are shared by coroutines, and a
+// future may be set by another thread while the caller is suspended. The caller
+// unlinks them from the futures not done before return. A future done in the
+// meantime has finished waking up the waiter when its lock is released.
+int wait_any(future_base* const* v, size_t n, uint32_t ms) {
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i]->done()) return (int)i;
+    }
+    if (ms == 0 || n == 0) return -1;
+
+    const auto sched = xx::current_sched();
+    Coroutine* const co = sched ? sched->running() : nullptr;
+    const size_t size = sizeof(future_waiter) + sizeof(future_node) * n;
+    future_waiter* const w = (future_waiter*) co::alloc(size);
+    future_node* const nodes = (future_node*)(w + 1);
+    w->x = make_waitx(co);
+    w->ev = co ? nullptr : new co::sync_event();
+    w->first = -1;
+
+    size_t k = 0;
+    for (; k < n; ++k) {
+        future_base& f = *v[k];
+        std::lock_guard<std::mutex> g(f._m);
+        if (f.done()) break;
+        new (&nodes[k]) future_node();
+        nodes[k].f = nullptr;
+        nodes[k].w = w;
+        nodes[k].i = (int)k;
+        f._w.push_back(&nodes[k]);
+    }
+
+    decltype(w->x->state)::value_type state(st_wait);
+    if (k < n) { /* future k is done before we wait */
+        if (w->x->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            w->first = (int)k;
+        }
+        else if (co) { /* another one has woken us up, consume it */
+            sched->yield();
+        }
+    }
+    else if (co) { /* in coroutine */
+        co->waitx = w->x;
+        if (ms != (uint32_t)-1) sched->add_timer(ms);
+        sched->yield();
+        co->waitx = nullptr;
+    }
+    else { /* not in coroutine */
+        if (ms == (uint32_t)-1) {
+            w->ev->wait();
+        }
+        else if (!w->ev->wait(ms)) {
+            (void)w->x->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed, std::memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        future_base& f = *v[i];
+        std::lock_guard<std::mutex> g(f._m);
+        if (!f.done()) f._w.erase(&nodes[i]);
+    }
+
+    const int r = w->first;
+    co::free(w->x);
+    delete w->ev;
+    co::free(w);
+    return r;
+}
+
+// shared by the caller and the helpers of parallel_run()
+struct parallel_t {
+    inline parallel_t(size_t n, std::function<void(size_t)>&& f)
+        : f(std::move(f))
+        , n(n)
+        , next(0) {}
+
+    inline void run() {
+        for (size_t k; (k = next.fetch_add(1, std::memory_order_relaxed)) < n;) f(k);
+    }
+
+    std::function<void(size_t)> f;
+    const size_t                n;
+    std::atomic_size_t          next;  // the next chunk to run
+};
+
+void parallel_run(size_t n, std::function<void(size_t)>&& f) {
+    if (n == 0) return;
+    const auto& v = co::scheds();
+    co::Sched* const self = co::sched();
+    size_t m = (size_t)co::active_sched_num(), h = 0;
+    if (m > v.size()) m = v.size();
+    for (size_t i = 0; i < m; ++i) {
+        if (v[i] != self) ++h;
+    }
+    if (h > n - 1) h = n - 1;
+    if (h == 0) {
+        for (size_t k = 0; k < n; ++k) f(k);
+        return;
+    }
+
+    // helpers that find no chunk left just return, the caller frees the state
+    // after all of them are done.
+    parallel_t* const p = new parallel_t(n, std::move(f));
+    co::wait_group wg((uint32_t)h);
+    for (size_t i = 0, k = 0; i < m && k < h; ++i) {
+        if (v[i] == self) continue;
+        v[i]->go([p, wg]() {
+            p->run();
+            wg.done();
+        });
+        ++k;
+    }
+    p->run();
+    wg.wait();
+    delete p;
+}
 
 class pipe_impl : public ref_counter {
 public:
-    explicit inline pipe_impl(uint32_t buf_size, uint32_t blk_size, uint32_t ms, pipe::C&& c, pipe::D&& d)
+    explicit inline pipe_impl(uint32_t buf_size, uint32_t blk_size, uint32_t ms, pipe::C&& c, pipe::D&& d,
+                              bool local)
         : ref_counter()
-        , _buf(buf_size ? (char*)::malloc(buf_size) : nullptr)
+        , _buf(buf_size ? (char*)co::alloc(buf_size) : nullptr)
         , _buf_size(buf_size)
         , _blk_size(blk_size)
         , _ms(ms)
@@ -433,16 +1321,31 @@ public:
         , _rx(0)
         , _wx(0)
         , _full(buf_size == 0)
-        , _closed(0) {
+        , _local(local)
+        , _closed(0)
+        , _sched(nullptr) {
         if (_buf_size) assert(_buf);
     }
 
-    inline ~pipe_impl() { ::free(_buf); }
+    inline ~pipe_impl() { co::free(_buf); }
 
-    void        read(void* p);
-    void        write(void* p, int v);
+    void        read(void* p) { _local ? this->_read<true>(p) : this->_read<false>(p); }
+    void        write(void* p, int v) { _local ? this->_write<true>(p, v) : this->_write<false>(p, v); }
     bool        done() const noexcept { return _done; }
-    void        close();
+    void        close() { _local ? this->_close<true>() : this->_close<false>(); }
+    // for co::select, see select::wait() for details
+    int  sel_try(void* p) { return _local ? this->_sel_try<true>(p) : this->_sel_try<false>(p); }
+    bool sel_wait(void* p, waitx_t* sx, void** pw) {
+        return _local ? this->_sel_wait<true>(p, sx, pw) : this->_sel_wait<false>(p, sx, pw);
+    }
+    int sel_end(void* w, void* p) {
+        return _local ? this->_sel_end<true>((waitx*)w, p) : this->_sel_end<false>((waitx*)w, p);
+    }
+
+    size_t      read_n(void* p, size_t n) { return _local ? this->_read_n<true>(p, n) : this->_read_n<false>(p, n); }
+    size_t      write_n(void* p, size_t n, int v) {
+        return _local ? this->_write_n<true>(p, n, v) : this->_write_n<false>(p, n, v);
+    }
     inline bool is_closed() const noexcept { return _closed.load(std::memory_order_relaxed); }
 
     struct waitx : co::clink
@@ -450,7 +1353,8 @@ public:
         explicit constexpr inline waitx(Coroutine* _co, void* _buf)
             : co(_co)
             , dummy(nullptr) /*state(st_wait)*/
-            , buf(_buf) {
+            , buf(_buf)
+            , sel(nullptr) {
             // x.done = 0;
         }
         ~waitx() = delete;
@@ -462,21 +1366,22 @@ public:
             {
                 std::atomic_uint8_t state;
                 uint8_t             done;   // 1: ok, 2: channel closed
-                uint8_t             v;      // 0: cp, 1: mv, 2: need destruct the object in buf
+                uint8_t             v;      // 0: cp, 1: mv, 2: need destruct the object in buf, 4: reader
             } x;
             void* dummy;
         };
-        void* buf;
+        void*    buf;
+        waitx_t* sel;   // waiting context shared by channels in a co::select
     };
 
     inline waitx* create_waitx(Coroutine* co, void* buf) {
         if (co && xx::current_sched()->on_stack(buf)) {
-            auto p = ::malloc(sizeof(waitx) + _blk_size);
+            auto p = co::alloc(sizeof(waitx) + _blk_size);
             assert(p);
             return new (p) waitx(co, (char*)p + sizeof(waitx));
         }
         else {
-            auto p = ::malloc(sizeof(waitx));
+            auto p = co::alloc(sizeof(waitx));
             assert(p);
             return new (p) waitx(co, buf);
         }
@@ -486,6 +1391,105 @@ private:
     void _read_block(void* p);
     void _write_block(void* p, int v);
 
+    // L is true for a local channel, which is used only by coroutines in the same
+    // scheduler. Neither _m nor atomic CAS is required, and waiting coroutines
+    // are resumed from the local ready queue of the scheduler.
+    template <bool L>
+    void _read(void* p);
+    template <bool L>
+    void _write(void* p, int v);
+    template <bool L>
+    void _close();
+    template <bool L>
+    size_t _read_n(void* p, size_t n);
+    template <bool L>
+    size_t _write_n(void* p, size_t n, int v);
+
+    // read or write as many elements as possible without blocking, _m MUST be locked
+    template <bool L>
+    size_t _try_read_n(char* p, size_t n);
+    template <bool L>
+    size_t _try_write_n(char* p, size_t n, int v);
+
+    template <bool L>
+    int _sel_try(void* p);
+    template <bool L>
+    bool _sel_wait(void* p, waitx_t* sx, void** pw);
+    template <bool L>
+    int _sel_end(waitx* w, void* p);
+
+    // pop a waiting writer that has not timed out, and wake it up after its
+    // element was moved to @dst by the caller, NULL if no writer is waiting.
+    template <bool L>
+    waitx* _pop_writer();
+    template <bool L>
+    void _wake_writer(waitx* w);
+
+    template <bool L>
+    inline void _lock() {
+        if (!L) _m.lock();
+    }
+
+    template <bool L>
+    inline void _unlock() {
+        if (!L) _m.unlock();
+    }
+
+    // mark a waiting coroutine or thread ready, return false if it has timed out
+    template <bool L>
+    inline bool _set_ready(waitx* w) {
+        auto& x = w->sel ? w->sel->state : w->state;
+        if (!L) {
+            uint8_t state(st_wait);
+            return x.compare_exchange_strong(state, st_ready, std::memory_order_relaxed,
+                                             std::memory_order_relaxed);
+        }
+        if (x.load(std::memory_order_relaxed) != st_wait) return false;
+        x.store(st_ready, std::memory_order_relaxed);
+        return true;
+    }
+
+    // no timer is used if _ms is -1, the waiter is always ready unless it is in a select
+    template <bool L>
+    inline bool _ready(waitx* w) {
+        return (_ms == (uint32_t)-1 && !w->sel) || this->_set_ready<L>(w);
+    }
+
+    // free a reader that has timed out, or was woken up by another channel in a
+    // select. In the latter case, the select will free it.
+    inline void _drop(waitx* w) {
+        if (w->sel) {
+            w->x.done = 3;
+        }
+        else {
+            co::free(w);
+        }
+    }
+
+    // readers and writers share the wait queue, readers are marked with 4 in x.v.
+    // Live readers and writers never wait at the same time, but there may be some
+    // timed-out waiters of the other kind at the front.
+    inline bool _has_reader() const noexcept {
+        return !_wq.empty() && (((waitx*)_wq.front())->x.v & 4);
+    }
+    inline bool _has_writer() const noexcept {
+        return !_wq.empty() && !(((waitx*)_wq.front())->x.v & 4);
+    }
+
+    template <bool L>
+    inline void _wake(Coroutine* co) {
+        L ? co->sched->add_local_ready_task(co) : co->sched->add_ready_task(co);
+    }
+
+    // a local channel is bound to the scheduler that uses it first
+    inline void _check_local(Sched* sched) {
+        if (unlikely(sched != _sched)) {
+            CHECK(sched) << "local channel MUST be used in coroutine..";
+            CHECK(!_sched) << "local channel MUST be used in coroutines of the same scheduler..";
+            _sched = sched;
+        }
+    }
+
 private:
     char*       _buf;        // buffer
     uint32_t    _buf_size;   // buffer size
@@ -500,7 +1504,9 @@ private:
     uint32_t                _rx;   // read pos
     uint32_t                _wx;   // write pos
     uint8_t                 _full;
+    const bool              _local;   // used only in coroutines of the same scheduler
     std::atomic_uint8_t     _closed;
+    Sched*                  _sched;   // scheduler a local channel is bound to
 
 private:
     static thread_local bool _done;
@@ -521,14 +1527,16 @@ inline void pipe_impl::_write_block(void* p, int v) {
     if (_wx == _buf_size) _wx = 0;
 }
 
-void pipe_impl::read(void* p) {
+template <bool L>
+void pipe_impl::_read(void* p) {
     auto sched = xx::current_sched();   // gSched;
-    _m.lock();
+    if (L) this->_check_local(sched);
+    this->_lock<L>();
 
     // buffer is neither empty nor full
     if (_rx != _wx) {
         this->_read_block(p);
-        _m.unlock();
+        this->_unlock<L>();
         goto done;
     }
     // buffer is full
@@ -536,56 +1544,52 @@ void pipe_impl::read(void* p) {
         if (_buf) {
             this->_read_block(p);
 
-            while (!_wq.empty()) {
+            while (this->_has_writer()) {
                 waitx*                         w = (waitx*)_wq.pop_front();   // wait for write
-                decltype(w->state)::value_type state(st_wait);
-                if (_ms == (uint32_t)-1 ||
-                    w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                if (this->_ready<L>(w)) {
                     this->_write_block(w->buf, w->x.v & 1);
                     if (w->x.v & 2) _d(w->buf);
                     w->x.done = 1;
                     if (w->co) {
-                        _m.unlock();
-                        w->co->sched->add_ready_task(w->co);
+                        this->_unlock<L>();
+                        this->_wake<L>(w->co);
                     }
                     else {
                         _cv.notify_all();
-                        _m.unlock();
+                        this->_unlock<L>();
                     }
                     goto done;
                 }
                 else { /* timeout */
                     if (w->x.v & 2) _d(w->buf);
-                    ::free(w);
+                    co::free(w);
                 }
             }
 
             _full = 0;
-            _m.unlock();
+            this->_unlock<L>();
             goto done;
         }
         else {
-            while (!_wq.empty()) {
+            while (this->_has_writer()) {
                 waitx*                         w = (waitx*)_wq.pop_front();   // wait for write
-                decltype(w->state)::value_type state(st_wait);
-                if (_ms == (uint32_t)-1 ||
-                    w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                if (this->_ready<L>(w)) {
                     _c(p, w->buf, w->x.v & 1);
                     if (w->x.v & 2) _d(w->buf);
                     w->x.done = 1;
                     if (w->co) {
-                        _m.unlock();
-                        w->co->sched->add_ready_task(w->co);
+                        this->_unlock<L>();
+                        this->_wake<L>(w->co);
                     }
                     else {
                         _cv.notify_all();
-                        _m.unlock();
+                        this->_unlock<L>();
                     }
                     goto done;
                 }
                 else { /* timeout */
                     if (w->x.v & 2) _d(w->buf);
-                    ::free(w);
+                    co::free(w);
                 }
             }
             // _m.unlock();
@@ -594,19 +1598,21 @@ void pipe_impl::read(void* p) {
     }
     // buffer is empty
     if (this->is_closed()) {
-        _m.unlock();
+        this->_unlock<L>();
         goto enod;
     }
     if (sched) {
         auto   co = sched->running();
         waitx* w  = this->create_waitx(co, p);
-        w->x.v    = (w->buf != p ? 0 : 2);
+        w->x.v    = (w->buf != p ? 0 : 2) | 4;
         _wq.push_back(w);   // wait queue for read
-        _m.unlock();
+        this->_unlock<L>();
 
         co->waitx = (waitx_t*)w;
         if (_ms != (uint32_t)-1) sched->add_timer(_ms);
+        CO_PROBE3(chan_block, this, co->id, 0);
         sched->yield();
+        CO_PROBE3(chan_unblock, this, co->id, sched->timeout() ? 2 : 0);
 
         co->waitx = 0;
         if (!sched->timeout()) {
@@ -616,12 +1622,12 @@ void pipe_impl::read(void* p) {
                     _c(p, w->buf, 1);   // mv
                     _d(w->buf);
                 }
-                ::free(w);
+                co::free(w);
                 goto done;
             }
 
             assert(w->x.done == 2);   // channel closed
-            ::free(w);
+            co::free(w);
             goto enod;
         }
         goto enod;
@@ -629,6 +1635,7 @@ void pipe_impl::read(void* p) {
     else {
         bool   r = true;
         waitx* w = this->create_waitx(nullptr, p);
+        w->x.v   = 4;
         _wq.push_back(w);   // wait for read queue
 
         std::unique_lock<std::mutex> g(_m, std::adopt_lock);
@@ -639,13 +1646,13 @@ void pipe_impl::read(void* p) {
             else {
                 r = _cv.wait_for(g, std::chrono::milliseconds(_ms)) == std::cv_status::no_timeout;
             }
-            decltype(w->state)::value_type state(st_wait);
+            uint8_t state(st_wait);
             if (r || !w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed, std::memory_order_relaxed)) {
                 const auto x = w->x.done;
                 if (x) {
                     g.unlock();
                     g.release();
-                    ::free(w);
+                    co::free(w);
                     if (x == 1) goto done;
                     goto enod;   // x == 2, channel closed
                 }
@@ -665,11 +1672,13 @@ done:
     _done = true;
 }
 
-void pipe_impl::write(void* p, int v) {
+template <bool L>
+void pipe_impl::_write(void* p, int v) {
     auto sched = xx::current_sched();   // gSched;
-    _m.lock();
+    if (L) this->_check_local(sched);
+    this->_lock<L>();
     if (this->is_closed()) {
-        _m.unlock();
+        this->_unlock<L>();
         goto enod;
     }
 
@@ -677,40 +1686,38 @@ void pipe_impl::write(void* p, int v) {
     if (_rx != _wx) {
         this->_write_block(p, v);
         if (_rx == _wx) _full = 1;
-        _m.unlock();
+        this->_unlock<L>();
         goto done;
     }
 
     // buffer is empty
     if (!_buf || !_full) {
-        while (!_wq.empty()) {
+        while (this->_has_reader()) {
             waitx*                         w = (waitx*)_wq.pop_front();   // wait for read
-            decltype(w->state)::value_type state(st_wait);
-            if (_ms == (uint32_t)-1 ||
-                w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            if (this->_ready<L>(w)) {
                 w->x.done = 1;
                 if (w->co) {
                     if (w->x.v & 2) _d(w->buf);
                     _c(w->buf, p, v);
-                    _m.unlock();
-                    w->co->sched->add_ready_task(w->co);
+                    this->_unlock<L>();
+                    this->_wake<L>(w->co);
                 }
                 else {
                     _d(w->buf);
                     _c(w->buf, p, v);
                     _cv.notify_all();
-                    _m.unlock();
+                    this->_unlock<L>();
                 }
                 goto done;
             }
             else { /* timeout */
-                ::free(w);
+                this->_drop(w);
             }
         }
         if (_buf) {
             this->_write_block(p, v);
             if (_rx == _wx) _full = 1;
-            _m.unlock();
+            this->_unlock<L>();
             goto done;
         }
     }
@@ -727,15 +1734,17 @@ void pipe_impl::write(void* p, int v) {
             w->x.v = (uint8_t)v;
         }
         _wq.push_back(w);
-        _m.unlock();
+        this->_unlock<L>();
 
         co->waitx = (waitx_t*)w;
         if (_ms != (uint32_t)-1) sched->add_timer(_ms);
+        CO_PROBE3(chan_block, this, co->id, 1);
         sched->yield();
+        CO_PROBE3(chan_unblock, this, co->id, sched->timeout() ? 3 : 1);
 
         co->waitx = nullptr;
         if (!sched->timeout()) {
-            ::free(w);
+            co::free(w);
             goto done;
         }
         goto enod;   // timeout
@@ -753,62 +1762,253 @@ void pipe_impl::write(void* p, int v) {
             else {
                 r = _cv.wait_for(g, std::chrono::milliseconds(_ms)) == std::cv_status::no_timeout;
             }
-            decltype(w->state)::value_type state(st_wait);
+            uint8_t state(st_wait);
             if (r || !w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed, std::memory_order_relaxed)) {
                 if (w->x.done) {
                     assert(w->x.done == 1);
                     g.unlock();
                     g.release();
-                    ::free(w);
+                    co::free(w);
                     goto done;
                 }
             }
-            else {
-                g.unlock();
-                g.release();
-                goto enod;
+            else {
+                g.unlock();
+                g.release();
+                goto enod;
+            }
+        }
+    }
+
+enod:
+    _done = false;
+    return;
+done:
+    _done = true;
+}
+
+template <bool L>
+inline typename pipe_impl::waitx* pipe_impl::_pop_writer() {
+    while (this->_has_writer()) {
+        waitx* w = (waitx*)_wq.pop_front();
+        if (this->_ready<L>(w)) return w;
+        if (w->x.v & 2) _d(w->buf); /* timeout */
+        co::free(w);
+    }
+    return nullptr;
+}
+
+template <bool L>
+inline void pipe_impl::_wake_writer(waitx* w) {
+    if (w->x.v & 2) _d(w->buf);
+    w->x.done = 1;
+    if (w->co) {
+        this->_wake<L>(w->co);
+    }
+    else {
+        _cv.notify_all();
+    }
+}
+
+template <bool L>
+size_t pipe_impl::_try_read_n(char* p, size_t n) {
+    size_t k = 0;
+    for (; k < n; ++k, p += _blk_size) {
+        if (_rx != _wx) {
+            this->_read_block(p);
+            continue;
+        }
+        if (!_full) break;   // empty
+        waitx* w = this->_pop_writer<L>();
+        if (_buf) {
+            this->_read_block(p);
+            if (w) {
+                this->_write_block(w->buf, w->x.v & 1);
+                this->_wake_writer<L>(w);
+            }
+            else {
+                _full = 0;
+            }
+        }
+        else {
+            if (!w) break;
+            _d(p);
+            _c(p, w->buf, w->x.v & 1);
+            this->_wake_writer<L>(w);
+        }
+    }
+    return k;
+}
+
+template <bool L>
+size_t pipe_impl::_try_write_n(char* p, size_t n, int v) {
+    size_t k = 0;
+    for (; k < n; ++k, p += _blk_size) {
+        if (_rx == _wx && (!_buf || !_full)) { /* empty, hand off to a waiting reader */
+            waitx* w = nullptr;
+            while (this->_has_reader()) {
+                w = (waitx*)_wq.pop_front();
+                if (this->_ready<L>(w)) break;
+                this->_drop(w); /* timeout */
+                w = nullptr;
+            }
+            if (w) {
+                w->x.done = 1;
+                if (w->co) {
+                    if (w->x.v & 2) _d(w->buf);
+                    _c(w->buf, p, v);
+                    this->_wake<L>(w->co);
+                }
+                else {
+                    _d(w->buf);
+                    _c(w->buf, p, v);
+                    _cv.notify_all();
+                }
+                continue;
             }
         }
+        if (!_buf || _full) break;   // full
+        this->_write_block(p, v);
+        if (_rx == _wx) _full = 1;
     }
+    return k;
+}
 
-enod:
-    _done = false;
-    return;
-done:
+// read at least one element, and then those available, up to @n elements.
+template <bool L>
+size_t pipe_impl::_read_n(void* p, size_t n) {
+    if (n == 0) return 0;
+    if (L) this->_check_local(xx::current_sched());
+    this->_lock<L>();
+    size_t k = this->_try_read_n<L>((char*)p, n);
+    this->_unlock<L>();
+    if (k == 0) {
+        this->_read<L>(p);
+        if (!_done) return 0;
+        k = 1;
+        if (n > 1) {
+            this->_lock<L>();
+            k += this->_try_read_n<L>((char*)p + _blk_size, n - 1);
+            this->_unlock<L>();
+        }
+    }
     _done = true;
+    return k;
+}
+
+// write all the @n elements, unless the channel is closed or it has timed out.
+template <bool L>
+size_t pipe_impl::_write_n(void* p, size_t n, int v) {
+    if (L) this->_check_local(xx::current_sched());
+    size_t k = 0;
+    char* s = (char*)p;
+    while (k < n) {
+        this->_lock<L>();
+        if (this->is_closed()) {
+            this->_unlock<L>();
+            break;
+        }
+        k += this->_try_write_n<L>(s + k * _blk_size, n - k, v);
+        this->_unlock<L>();
+        if (k == n) break;
+        this->_write<L>(s + k * _blk_size, v);   // wait for space
+        if (!_done) break;
+        ++k;
+    }
+    _done = (k == n);
+    return k;
+}
+
+// try to read an element without blocking.
+// return 1 if an element was read, 2 if the channel was closed and empty, otherwise 0.
+template <bool L>
+int pipe_impl::_sel_try(void* p) {
+    if (L) this->_check_local(xx::current_sched());
+    int r = 0;
+    this->_lock<L>();
+    if (this->_try_read_n<L>((char*)p, 1) == 1) {
+        r = 1;
+    }
+    else if (this->is_closed() && _rx == _wx && (!_full || !_buf)) {
+        r = 2;
+    }
+    this->_unlock<L>();
+    if (r) _done = (r == 1);
+    return r;
+}
+
+// add a reader sharing the waiting context @sx to the wait queue. It is not added
+// and false is returned if the channel became ready after _sel_try().
+template <bool L>
+bool pipe_impl::_sel_wait(void* p, waitx_t* sx, void** pw) {
+    this->_lock<L>();
+    if (_rx != _wx || (_full && (_buf || this->_has_writer())) || this->is_closed()) {
+        this->_unlock<L>();
+        return false;
+    }
+    waitx* w = this->create_waitx(sx->co, p);
+    w->x.v   = (w->buf != p ? 0 : 2) | 4;
+    w->sel   = sx;
+    _wq.push_back(w);
+    this->_unlock<L>();
+    *pw = w;
+    return true;
+}
+
+// remove the reader from the wait queue if it is still there, and free it.
+// return 1 if an element was read by it, 2 if the channel was closed, otherwise 0.
+template <bool L>
+int pipe_impl::_sel_end(waitx* w, void* p) {
+    this->_lock<L>();
+    const int x = w->x.done;
+    if (x == 0) _wq.erase(w);
+    this->_unlock<L>();
+    if (x == 1 && w->buf != p) {
+        _d(p);
+        _c(p, w->buf, 1);   // mv
+        _d(w->buf);
+    }
+    co::free(w);
+    if (x == 1 || x == 2) {
+        _done = (x == 1);
+        return x;
+    }
+    return 0;
 }
 
-void pipe_impl::close() {
+template <bool L>
+void pipe_impl::_close() {
     decltype(_closed)::value_type closed{0};
     _closed.compare_exchange_strong(closed, 1, std::memory_order_relaxed, std::memory_order_relaxed);
     if (closed == 0) {
-        std::unique_lock<std::mutex> g(_m);
-        if (_rx == _wx && !_full) { /* empty */
-            while (!_wq.empty()) {
+        this->_lock<L>();
+        if (_rx == _wx && (!_full || !_buf)) { /* empty */
+            while (this->_has_reader()) {
                 waitx*                         w = (waitx*)_wq.pop_front();   // wait for read
-                decltype(w->state)::value_type state(st_wait);
-                if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                if (this->_set_ready<L>(w)) {
                     w->x.done = 2;   // channel closed
                     if (w->co) {
-                        w->co->sched->add_ready_task(w->co);
+                        this->_wake<L>(w->co);
                     }
                     else {
                         _cv.notify_all();
                     }
                 }
                 else {
-                    ::free(w);
+                    this->_drop(w);
                 }
             }
         }
+        this->_unlock<L>();
         _closed.store(2, std::memory_order_relaxed);
     }
     else if (closed == 1) {
         while (_closed.load(std::memory_order_relaxed) != 2) co::sleep(1);
     }
 }
-pipe::pipe(uint32_t buf_size, uint32_t blk_size, uint32_t ms, pipe::C&& c, pipe::D&& d)
-    : _p(new pipe_impl(buf_size, blk_size, ms, std::move(c), std::move(d))) {}
+
+pipe::pipe(uint32_t buf_size, uint32_t blk_size, uint32_t ms, pipe::C&& c, pipe::D&& d, bool local)
+    : _p(new pipe_impl(buf_size, blk_size, ms, std::move(c), std::move(d), local)) {}
 
 pipe::pipe(const pipe& p)
     : _p(p._p) {
@@ -831,6 +2031,14 @@ void pipe::write(void* p, int v) const {
     reinterpret_cast<pipe_impl*>(_p)->write(p, v);
 }
 
+size_t pipe::read_n(void* p, size_t n) const {
+    return reinterpret_cast<pipe_impl*>(_p)->read_n(p, n);
+}
+
+size_t pipe::write_n(void* p, size_t n, int v) const {
+    return reinterpret_cast<pipe_impl*>(_p)->write_n(p, n, v);
+}
+
 bool pipe::done() const noexcept {
     return reinterpret_cast<pipe_impl*>(_p)->done();
 }
@@ -868,7 +2076,7 @@ public:
         while (n) {
             _list.pop_front();
             _d(((node*)n)->data);
-            ::free(n);
+            co::free(n);
         };
     }
 
@@ -908,12 +2116,12 @@ public:
 
     inline waitx* create_waitx(Coroutine* co, void* buf) {
         if (co && xx::current_sched()->on_stack(buf)) {
-            auto p = ::malloc(sizeof(waitx) + _blk_size);
+            auto p = co::alloc(sizeof(waitx) + _blk_size);
             assert(p);
             return new (p) waitx(co, (char*)p + sizeof(waitx));
         }
         else {
-            auto p = ::malloc(sizeof(waitx));
+            auto p = co::alloc(sizeof(waitx));
             assert(p);
             return new (p) waitx(co, buf);
         }
@@ -963,7 +2171,7 @@ void pipe_impl_cap::read(void* p) {
         _list.pop_front();
         --_size;
         this->_read_block(p, ((node*)n)->data);
-        ::free(n);
+        co::free(n);
         _m.unlock();
         goto done;
     }
@@ -974,14 +2182,14 @@ void pipe_impl_cap::read(void* p) {
         _list.pop_front();
         --_size;
         this->_read_block(p, ((node*)n)->data);
-        ::free(n);
+        co::free(n);
 
         while (!_wq.empty()) {
             waitx*                         w = (waitx*)_wq.pop_front();   // wait for write
             decltype(w->state)::value_type state(st_wait);
             if (_ms == (uint32_t)-1 ||
                 w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
-                node* n = (node*)::malloc(sizeof(node) + _blk_size);
+                node* n = (node*)co::alloc(sizeof(node) + _blk_size);
                 n->prev = n->next = nullptr;
                 this->_write_block(n->data, w->buf, w->x.v & 1);
                 _list.push_back(n);
@@ -1000,7 +2208,7 @@ void pipe_impl_cap::read(void* p) {
             }
             else { /* timeout */
                 if (w->x.v & 2) _d(w->buf);
-                ::free(w);
+                co::free(w);
             }
         }
 
@@ -1032,12 +2240,12 @@ void pipe_impl_cap::read(void* p) {
                     _c(p, w->buf, 1);   // mv
                     _d(w->buf);
                 }
-                ::free(w);
+                co::free(w);
                 goto done;
             }
 
             assert(w->x.done == 2);   // channel closed
-            ::free(w);
+            co::free(w);
             goto enod;
         }
         goto enod;
@@ -1061,7 +2269,7 @@ void pipe_impl_cap::read(void* p) {
                 if (x) {
                     g.unlock();
                     g.release();
-                    ::free(w);
+                    co::free(w);
                     if (x == 1) goto done;
                     goto enod;   // x == 2, channel closed
                 }
@@ -1091,7 +2299,7 @@ void pipe_impl_cap::write(void* p, int v) {
 
     // buffer is neither empty nor full
     if (!empty() && !full()) {
-        node* n = (node*)::malloc(sizeof(node) + _blk_size);
+        node* n = (node*)co::alloc(sizeof(node) + _blk_size);
         n->prev = n->next = nullptr;
         this->_write_block(n->data, p, v);
         _list.push_back(n);
@@ -1123,10 +2331,10 @@ void pipe_impl_cap::write(void* p, int v) {
                 goto done;
             }
             else { /* timeout */
-                ::free(w);
+                co::free(w);
             }
         }
-        node* n = (node*)::malloc(sizeof(node) + _blk_size);
+        node* n = (node*)co::alloc(sizeof(node) + _blk_size);
         n->prev = n->next = nullptr;
         this->_write_block(n->data, p, v);
         _list.push_back(n);
@@ -1155,7 +2363,7 @@ void pipe_impl_cap::write(void* p, int v) {
 
         co->waitx = nullptr;
         if (!sched->timeout()) {
-            ::free(w);
+            co::free(w);
             goto done;
         }
         goto enod;   // timeout
@@ -1179,7 +2387,7 @@ void pipe_impl_cap::write(void* p, int v) {
                     assert(w->x.done == 1);
                     g.unlock();
                     g.release();
-                    ::free(w);
+                    co::free(w);
                     goto done;
                 }
             }
@@ -1217,7 +2425,7 @@ void pipe_impl_cap::close() {
                     }
                 }
                 else {
-                    ::free(w);
+                    co::free(w);
                 }
             }
         }
@@ -1265,34 +2473,200 @@ bool pipe_cap::is_closed() const noexcept {
 }
 //=======================
 
+struct waitq_impl
+{
+    std::mutex              m;
+    std::condition_variable cv;
+    co::clist               q;   // waitx_t of coroutines, or threads (co is NULL)
+};
+
+waitq::waitq()
+    : _p(new waitq_impl)
+    , _n(0) {}
+
+waitq::~waitq() {
+    const auto p = (waitq_impl*)_p;
+    while (!p->q.empty()) co::free(p->q.pop_front());
+    delete p;
+}
+
+int waitq::wait(bool (*f)(void*), void* arg, uint32_t ms) {
+    const auto p     = (waitq_impl*)_p;
+    const auto sched = xx::current_sched();
+    std::unique_lock<std::mutex> g(p->m);
+    _n.fetch_add(1, std::memory_order_seq_cst);
+    if (f(arg)) {
+        _n.fetch_sub(1, std::memory_order_relaxed);
+        return 1;
+    }
+
+    if (sched) { /* in coroutine */
+        Coroutine* const co = sched->running();
+        waitx_t* const   w  = make_waitx(co);
+        p->q.push_back(w);
+        g.unlock();
+
+        co->waitx = w;
+        if (ms != (uint32_t)-1) sched->add_timer(ms);
+        sched->yield();
+        co->waitx = nullptr;
+        if (sched->timeout()) return -1;   // w will be freed by notify()
+        co::free(w);
+        return 0;
+    }
+    else { /* non-coroutine */
+        waitx_t* const w = make_waitx(nullptr);
+        p->q.push_back(w);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        for (;;) {
+            if (ms == (uint32_t)-1) {
+                p->cv.wait(g);
+            }
+            else if (p->cv.wait_until(g, deadline) == std::cv_status::timeout) {
+                uint8_t state = st_wait;
+                if (w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed,
+                                                     std::memory_order_relaxed)) {
+                    return -1;   // w will be freed by notify()
+                }
+            }
+            if (w->state.load(std::memory_order_relaxed) == st_ready) {
+                co::free(w);
+                return 0;
+            }
+        }
+    }
+}
+
+void waitq::notify() {
+    const auto p = (waitq_impl*)_p;
+    std::lock_guard<std::mutex> g(p->m);
+    while (!p->q.empty()) {
+        waitx_t* const w = (waitx_t*)p->q.pop_front();
+        _n.fetch_sub(1, std::memory_order_relaxed);
+        uint8_t state = st_wait;
+        if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed,
+                                             std::memory_order_relaxed)) {
+            if (w->co) {
+                w->co->sched->add_ready_task(w->co);
+            }
+            else {
+                p->cv.notify_all();
+            }
+            return;
+        }
+        co::free(w);   // timeout
+    }
+}
+
+void waitq::notify_all() {
+    const auto p = (waitq_impl*)_p;
+    std::lock_guard<std::mutex> g(p->m);
+    bool has_thread = false;
+    while (!p->q.empty()) {
+        waitx_t* const w = (waitx_t*)p->q.pop_front();
+        _n.fetch_sub(1, std::memory_order_relaxed);
+        uint8_t state = st_wait;
+        if (w->state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed,
+                                             std::memory_order_relaxed)) {
+            if (w->co) {
+                w->co->sched->add_ready_task(w->co);
+            }
+            else {
+                has_thread = true;
+            }
+        }
+        else {
+            co::free(w);   // timeout
+        }
+    }
+    if (has_thread) p->cv.notify_all();
+}
+
+bool& mpmc_done() {
+    static thread_local bool _done{false};
+    return _done;
+}
+
+//=======================
+
 class pool_impl : public ref_counter {
 public:
-    typedef co::vector<void*> V;
+    // an element in the pool, with the time (ms) it was pushed back
+    struct elem_t
+    {
+        void*   e;
+        int64_t t;
+    };
+    typedef co::vector<elem_t> V;
+
+    // lock and size of the pool of a scheduler, used only in shared mode
+    struct shared_t
+    {
+        std::mutex          m;
+        std::atomic_size_t  n{0};
+        char                _pad[L1_CACHE_LINE_SIZE];
+    };
 
     pool_impl()
         : ref_counter()
-        , _maxcap((size_t)-1) {
+        , _maxcap((size_t)-1)
+        , _maxnum((size_t)-1)
+        , _num(0)
+        , _shared(nullptr)
+        , _wq(nullptr)
+        , _idle_ms(0)
+        , _stop(true, false) {
         this->_make_pools();
     }
 
     pool_impl(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap)
         : ref_counter()
         , _maxcap(cap)
+        , _maxnum((size_t)-1)
+        , _num(0)
+        , _shared(nullptr)
+        , _wq(nullptr)
+        , _idle_ms(0)
+        , _stop(true, false)
+        , _ccb(std::move(ccb))
+        , _dcb(std::move(dcb)) {
+        this->_make_pools();
+    }
+
+    pool_impl(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap, size_t maxnum)
+        : ref_counter()
+        , _maxcap(cap)
+        , _maxnum(maxnum)
+        , _num(0)
+        , _idle_ms(0)
+        , _stop(true, false)
         , _ccb(std::move(ccb))
         , _dcb(std::move(dcb)) {
         this->_make_pools();
+        _shared = new shared_t[_size];
+        _wq     = new waitq;
     }
 
     ~pool_impl() {
+        if (_idle_ms) {
+            _stop.signal();
+            if (xx::is_active()) _ewg.wait();
+        }
         this->clear();
         this->_free_pools();
+        delete[] _shared;
+        delete _wq;
     }
 
     void*  pop();
     void   push(void* p);
+    void   discard(void* p);
     void   clear();
     size_t size() const noexcept;
 
+    void set_check(std::function<bool(void*)>&& f) { _check = std::move(f); }
+    void set_idle_timeout(uint32_t ms);
+
     void _make_pools() {
         _size  = co::sched_num();
         _pools = (V*)::calloc(_size, sizeof(V));
@@ -1303,41 +2677,239 @@ public:
         ::free(_pools);
     }
 
+private:
+    // take an element from the pool of scheduler i, or other schedulers
+    void* _take(size_t i);
+    // count an element to be created, return false if _maxnum is reached
+    bool  _reserve() noexcept;
+    // an element was destroyed, wake up a waiter as it may create a new one
+    void  _release();
+    void* _pop_shared(size_t i);
+    void  _push_shared(size_t i, void* p);
+    // check an element taken from the pool, it is discarded if the check failed
+    bool  _valid(void* e) {
+        if (!_check || _check(e)) return true;
+        this->discard(e);
+        return false;
+    }
+    // destroy elements idle for more than _idle_ms in the pool of scheduler i
+    void  _evict(size_t i);
+
+    int64_t _now() const noexcept { return _idle_ms ? now::ms() : 0; }
+
 private:
     V*                         _pools;
     size_t                     _size;
     size_t                     _maxcap;
+    size_t                     _maxnum;   // max elements created, shared mode only
+    std::atomic_size_t         _num;      // elements created and not destroyed yet
+    shared_t*                  _shared;   // not NULL in shared mode
+    waitq*                     _wq;       // coroutines waiting for an element in shared mode
+    uint32_t                   _idle_ms;  // idle timeout, 0 for never
+    co::event                  _stop;     // stop the eviction coroutines
+    co::wait_group             _ewg;      // eviction coroutines running
     std::function<void*()>     _ccb;
     std::function<void(void*)> _dcb;
+    std::function<bool(void*)> _check;
 };
 
 inline void* pool_impl::pop() {
     auto s = xx::current_sched();   // gSched;
     CHECK(s) << "must be called in coroutine..";
+    if (_shared) return this->_pop_shared(s->id());
     auto& v = _pools[s->id()];
-    return !v.empty() ? v.pop_back() : (_ccb ? _ccb() : nullptr);
+    while (!v.empty()) {
+        void* e = v.pop_back().e;
+        if (this->_valid(e)) return e;
+    }
+    return _ccb ? _ccb() : nullptr;
 }
 
 inline void pool_impl::push(void* p) {
     if (p) {
         auto s = xx::current_sched();   //  gSched;
         CHECK(s) << "must be called in coroutine..";
+        if (_shared) return this->_push_shared(s->id(), p);
         auto& v = _pools[s->id()];
-        (v.size() < _maxcap || !_dcb) ? v.push_back(p) : _dcb(p);
+        (v.size() < _maxcap || !_dcb) ? v.push_back(elem_t{p, this->_now()}) : _dcb(p);
+    }
+}
+
+void pool_impl::discard(void* p) {
+    if (p) {
+        if (_dcb) _dcb(p);
+        if (_shared) this->_release();
+    }
+}
+
+void* pool_impl::_take(size_t i) {
+    for (size_t k = 0; k < _size; ++k) {
+        const size_t j = (i + k) % _size;
+        auto& x = _shared[j];
+        if (x.n.load(std::memory_order_acquire) == 0) continue;
+        std::lock_guard<std::mutex> g(x.m);
+        auto& v = _pools[j];
+        if (!v.empty()) {
+            x.n.store(v.size() - 1, std::memory_order_relaxed);
+            return v.pop_back().e;
+        }
+    }
+    return nullptr;
+}
+
+bool pool_impl::_reserve() noexcept {
+    size_t n = _num.load(std::memory_order_relaxed);
+    while (n < _maxnum) {
+        if (_num.compare_exchange_weak(n, n + 1, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+void pool_impl::_release() {
+    _num.fetch_sub(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_wq->has_waiters()) _wq->notify();
+}
+
+// Take an element from the pool of the current scheduler, or borrow one from
+// other schedulers. A new element is created only if no one is free in all the
+// pools, and the caller waits if _maxnum elements have been created.
+void* pool_impl::_pop_shared(size_t i) {
+    void* e;
+    while ((e = this->_take(i))) {
+        if (this->_valid(e)) return e;
+    }
+    if (!_ccb) return nullptr;
+
+    struct arg_t {
+        pool_impl* p;
+        size_t     i;
+        void*      e;
+        bool       reserved;
+    } a{this, i, nullptr, false};
+    for (;;) {
+        if (!a.reserved && !a.e) {
+            a.reserved = this->_reserve();
+        }
+        if (!a.reserved && !a.e) {
+            _wq->wait(
+                [](void* x) {
+                    auto a = (arg_t*)x;
+                    if ((a->e = a->p->_take(a->i))) return true;
+                    return a->reserved = a->p->_reserve();
+                },
+                &a, (uint32_t)-1);
+        }
+        if (a.e) {
+            if (this->_valid(a.e)) return a.e;
+            a.e = nullptr;
+            continue;
+        }
+        if (a.reserved) {
+            e = _ccb();
+            if (!e) this->_release();
+            return e;
+        }
+    }
+}
+
+void pool_impl::_push_shared(size_t i, void* p) {
+    auto& x = _shared[i];
+    bool pushed = true;
+    {
+        std::lock_guard<std::mutex> g(x.m);
+        auto& v = _pools[i];
+        if (v.size() < _maxcap || !_dcb) {
+            v.push_back(elem_t{p, this->_now()});
+            x.n.store(v.size(), std::memory_order_release);
+        }
+        else {
+            pushed = false;
+        }
+    }
+    if (pushed) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_wq->has_waiters()) _wq->notify();
+    }
+    else {
+        _dcb(p);
+        this->_release();
+    }
+}
+
+// Elements are pushed to the back, so the oldest ones are at the front.
+// Elements pushed before the idle timeout was set have no time, and they are
+// timed from the first check.
+void pool_impl::_evict(size_t i) {
+    const int64_t now = now::ms();
+    const int64_t deadline = now - _idle_ms;
+    V dead;
+    {
+        std::unique_lock<std::mutex> g;
+        if (_shared) g = std::unique_lock<std::mutex>(_shared[i].m);
+        auto& v = _pools[i];
+        size_t k = 0;
+        for (; k < v.size(); ++k) {
+            auto& x = v[k];
+            if (x.t == 0) x.t = now;
+            if (x.t > deadline) break;
+            dead.push_back(x);
+        }
+        if (k > 0) {
+            const size_t n = v.size() - k;
+            if (n > 0) ::memmove(v.data(), v.data() + k, n * sizeof(elem_t));
+            v.resize(n);
+            if (_shared) _shared[i].n.store(n, std::memory_order_relaxed);
+        }
+    }
+    for (auto& x : dead) this->discard(x.e);
+}
+
+// Start an eviction coroutine in each scheduler. They check the pools every
+// half of the timeout, and exit when the pool is destroyed.
+void pool_impl::set_idle_timeout(uint32_t ms) {
+    CHECK(ms > 0 && ms != (uint32_t)-1) << "invalid idle timeout for co::pool: " << ms;
+    CHECK(xx::is_active()) << "co::pool idle timeout must be set when schedulers are running..";
+    CHECK(_idle_ms == 0) << "idle timeout for co::pool was already set..";
+    _idle_ms = ms;
+    const uint32_t interval = ms > 1 ? ms >> 1 : 1;
+    auto& scheds = co::scheds();
+    _ewg.add((uint32_t)scheds.size());
+    for (auto& s : scheds) {
+        s->go([this, interval]() {
+            const size_t i = xx::current_sched()->id();
+            while (!_stop.wait(interval)) this->_evict(i);
+            _ewg.done();
+        });
     }
 }
 
 // Create n coroutines to clear all the pools, n is number of schedulers.
-// clear() blocks untils all the coroutines are done.
+// clear() blocks untils all the coroutines are done. In shared mode, the pools
+// are protected by locks and cleared in the caller directly.
 void pool_impl::clear() {
-    if (xx::is_active()) {
+    if (_shared) {
+        for (size_t i = 0; i < _size; ++i) {
+            V v;
+            {
+                std::lock_guard<std::mutex> g(_shared[i].m);
+                v.swap(_pools[i]);
+                _shared[i].n.store(0, std::memory_order_relaxed);
+            }
+            for (auto& x : v) {
+                if (this->_dcb) this->_dcb(x.e);
+                this->_release();
+            }
+        }
+    }
+    else if (xx::is_active()) {
         auto&          scheds = co::scheds();
         co::wait_group wg((uint32_t)scheds.size());
         for (auto& s : scheds) {
             s->go([this, wg]() {
                 auto& v = this->_pools[xx::current_sched()->id()];
                 if (this->_dcb)
-                    for (auto& e : v) this->_dcb(e);
+                    for (auto& x : v) this->_dcb(x.e);
                 v.clear();
                 wg.done();
             });
@@ -1348,7 +2920,7 @@ void pool_impl::clear() {
         for (size_t i = 0; i < _size; ++i) {
             auto& v = _pools[i];
             if (this->_dcb)
-                for (auto& e : v) this->_dcb(e);
+                for (auto& x : v) this->_dcb(x.e);
             v.clear();
         }
     }
@@ -1357,11 +2929,84 @@ void pool_impl::clear() {
 inline size_t pool_impl::size() const noexcept {
     auto s = xx::current_sched();   // gSched;
     CHECK(s) << "must be called in coroutine..";
+    if (_shared) return _shared[s->id()].n.load(std::memory_order_relaxed);
     return _pools[s->id()].size();
 }
 
 }   // namespace xx
 
+int select::wait(uint32_t ms) {
+    const auto sched = xx::current_sched();
+    CHECK(sched) << "co::select MUST be called in coroutine..";
+    const uint32_t n = (uint32_t)_pipes.size();
+    _done = false;
+    if (n == 0) {
+        if (ms != (uint32_t)-1) co::sleep(ms);
+        return -1;
+    }
+    if (_ws.size() < n) _ws.resize(n);
+    auto pipe = [this](uint32_t i) { return (xx::pipe_impl*)_pipes[i]->_p; };
+
+    // Start from a different channel each time, so a busy channel will not
+    // starve the others.
+    const uint32_t s = _next++ % n;
+    for (;;) {
+        for (uint32_t k = 0; k < n; ++k) {
+            const uint32_t i = (s + k) % n;
+            const int r = pipe(i)->sel_try(_bufs[i]);
+            if (r) {
+                _done = (r == 1);
+                return (int)i;
+            }
+        }
+        if (ms == 0) return -1;
+
+        // Wait on all the channels with a shared waiting context, the first
+        // channel that changes its state from st_wait to st_ready wins.
+        const auto co = sched->running();
+        xx::waitx_t* const sx = xx::make_waitx(co);
+        uint32_t k = 0;
+        for (; k < n; ++k) {
+            const uint32_t i = (s + k) % n;
+            if (!pipe(i)->sel_wait(_bufs[i], sx, &_ws[i])) break;
+        }
+
+        if (k < n) {
+            // A channel became ready. Cancel the waits and try again, unless
+            // we have already been woken up by another channel.
+            uint8_t state = xx::st_wait;
+            if (sx->state.compare_exchange_strong(state, xx::st_ready, std::memory_order_relaxed,
+                                                  std::memory_order_relaxed)) {
+                for (uint32_t j = 0; j < k; ++j) {
+                    const uint32_t i = (s + j) % n;
+                    pipe(i)->sel_end(_ws[i], _bufs[i]);
+                }
+                co::free(sx);
+                continue;
+            }
+        }
+        else if (ms != (uint32_t)-1) {
+            sched->add_timer(ms);
+        }
+
+        co->waitx = sx;
+        sched->yield();
+        co->waitx = nullptr;
+
+        int r = -1;
+        for (uint32_t j = 0; j < k; ++j) {
+            const uint32_t i = (s + j) % n;
+            const int x = pipe(i)->sel_end(_ws[i], _bufs[i]);
+            if (x) {
+                _done = (x == 1);
+                r = (int)i;
+            }
+        }
+        co::free(sx);
+        return r;
+    }
+}
+
 mutex::mutex()
     : _p(new xx::mutex_impl) {}
 
@@ -1390,6 +3035,46 @@ bool mutex::try_lock() const noexcept {
     return reinterpret_cast<xx::mutex_impl*>(_p)->try_lock();
 }
 
+shared_mutex::shared_mutex()
+    : _p(new xx::shared_mutex_impl) {}
+
+shared_mutex::shared_mutex(const shared_mutex& m)
+    : _p(m._p) {
+    if (_p) reinterpret_cast<xx::shared_mutex_impl*>(_p)->ref();
+}
+
+shared_mutex::~shared_mutex() {
+    const auto p = reinterpret_cast<xx::shared_mutex_impl*>(_p);
+    if (p && p->unref() == 0) {
+        delete p;
+        _p = nullptr;
+    }
+}
+
+void shared_mutex::lock() const {
+    reinterpret_cast<xx::shared_mutex_impl*>(_p)->lock();
+}
+
+void shared_mutex::unlock() const {
+    reinterpret_cast<xx::shared_mutex_impl*>(_p)->unlock();
+}
+
+bool shared_mutex::try_lock() const {
+    return reinterpret_cast<xx::shared_mutex_impl*>(_p)->try_lock();
+}
+
+void shared_mutex::lock_shared() const {
+    reinterpret_cast<xx::shared_mutex_impl*>(_p)->lock_shared();
+}
+
+void shared_mutex::unlock_shared() const {
+    reinterpret_cast<xx::shared_mutex_impl*>(_p)->unlock_shared();
+}
+
+bool shared_mutex::try_lock_shared() const {
+    return reinterpret_cast<xx::shared_mutex_impl*>(_p)->try_lock_shared();
+}
+
 event::event(bool manual_reset, bool signaled)
     : _p(new xx::event_impl(manual_reset, signaled)) {}
 
@@ -1418,6 +3103,38 @@ void event::reset() const {
     reinterpret_cast<xx::event_impl*>(_p)->reset();
 }
 
+condition_variable::condition_variable()
+    : _p(new xx::cond_impl) {}
+
+condition_variable::condition_variable(const condition_variable& c)
+    : _p(c._p) {
+    if (_p) reinterpret_cast<xx::cond_impl*>(_p)->ref();
+}
+
+condition_variable::~condition_variable() {
+    const auto p = reinterpret_cast<xx::cond_impl*>(_p);
+    if (p && p->unref() == 0) {
+        delete p;
+        _p = 0;
+    }
+}
+
+void condition_variable::wait(const co::mutex& m) const {
+    (void)reinterpret_cast<xx::cond_impl*>(_p)->wait(reinterpret_cast<xx::mutex_impl*>(m._p), (uint32_t)-1);
+}
+
+bool condition_variable::wait_for(const co::mutex& m, uint32_t ms) const {
+    return reinterpret_cast<xx::cond_impl*>(_p)->wait(reinterpret_cast<xx::mutex_impl*>(m._p), ms);
+}
+
+void condition_variable::notify_one() const {
+    reinterpret_cast<xx::cond_impl*>(_p)->notify_one();
+}
+
+void condition_variable::notify_all() const {
+    reinterpret_cast<xx::cond_impl*>(_p)->notify_all();
+}
+
 sync_event::sync_event(bool manual_reset, bool signaled)
     : _p(new xx::sync_event_impl(manual_reset, signaled)) {}
 
@@ -1477,6 +3194,62 @@ void wait_group::wait() const {
     reinterpret_cast<xx::event_impl*>(_p)->wait((uint32_t)-1);
 }
 
+semaphore::semaphore(uint32_t n)
+    : _p(new xx::semaphore_impl(n)) {}
+
+semaphore::semaphore(const semaphore& s)
+    : _p(s._p) {
+    if (_p) reinterpret_cast<xx::semaphore_impl*>(_p)->ref();
+}
+
+semaphore::~semaphore() {
+    const auto p = reinterpret_cast<xx::semaphore_impl*>(_p);
+    if (p && p->unref() == 0) {
+        delete p;
+        _p = nullptr;
+    }
+}
+
+bool semaphore::acquire(uint32_t n, uint32_t ms) const {
+    return reinterpret_cast<xx::semaphore_impl*>(_p)->acquire(n, ms);
+}
+
+bool semaphore::try_acquire(uint32_t n) const {
+    return reinterpret_cast<xx::semaphore_impl*>(_p)->try_acquire(n);
+}
+
+void semaphore::release(uint32_t n) const {
+    reinterpret_cast<xx::semaphore_impl*>(_p)->release(n);
+}
+
+uint32_t semaphore::count() const {
+    return reinterpret_cast<xx::semaphore_impl*>(_p)->count();
+}
+
+rate_limiter::rate_limiter(double rate, uint32_t burst)
+    : _p(new xx::rate_limiter_impl(rate, burst)) {}
+
+rate_limiter::rate_limiter(const rate_limiter& r)
+    : _p(r._p) {
+    if (_p) reinterpret_cast<xx::rate_limiter_impl*>(_p)->ref();
+}
+
+rate_limiter::~rate_limiter() {
+    const auto p = reinterpret_cast<xx::rate_limiter_impl*>(_p);
+    if (p && p->unref() == 0) {
+        delete p;
+        _p = nullptr;
+    }
+}
+
+bool rate_limiter::acquire(uint32_t n, uint32_t ms) const {
+    return reinterpret_cast<xx::rate_limiter_impl*>(_p)->acquire(n, ms);
+}
+
+void rate_limiter::set_rate(double rate, uint32_t burst) const {
+    reinterpret_cast<xx::rate_limiter_impl*>(_p)->set_rate(rate, burst);
+}
+
 pool::pool()
     : _p(new xx::pool_impl) {}
 
@@ -1496,10 +3269,17 @@ pool::~pool() {
 pool::pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap)
     : _p(new xx::pool_impl(std::move(ccb), std::move(dcb), cap)) {}
 
+pool::pool(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap, size_t max_num)
+    : _p(new xx::pool_impl(std::move(ccb), std::move(dcb), cap, max_num)) {}
+
 void* pool::pop() const {
     return reinterpret_cast<xx::pool_impl*>(_p)->pop();
 }
 
+void pool::discard(void* e) const {
+    reinterpret_cast<xx::pool_impl*>(_p)->discard(e);
+}
+
 void pool::push(void* p) const {
     reinterpret_cast<xx::pool_impl*>(_p)->push(p);
 }
@@ -1508,6 +3288,14 @@ void pool::clear() const {
     reinterpret_cast<xx::pool_impl*>(_p)->clear();
 }
 
+void pool::set_check(std::function<bool(void*)>&& f) const {
+    reinterpret_cast<xx::pool_impl*>(_p)->set_check(std::move(f));
+}
+
+void pool::set_idle_timeout(uint32_t ms) const {
+    reinterpret_cast<xx::pool_impl*>(_p)->set_idle_timeout(ms);
+}
+
 size_t pool::size() const noexcept {
     return reinterpret_cast<xx::pool_impl*>(_p)->size();
 }
@@ -1,24 +1,27 @@
 #include <atomic>
 #ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
 #include "../close.h"
 #include "epoll.h"
 
 namespace co {
 
-Epoll::Epoll(int sched_id) : _signaled(false), _sched_id(sched_id) {
+Epoll::Epoll(int sched_id, int nev)
+    : _uring_fd(-1), _tfd(-1), _no_pwait2(false), _signaled(false), _sched_id(sched_id),
+      _nev(nev) {
     _ep = epoll_create(1024);
     CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
     co::set_cloexec(_ep);
 
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(_efd, -1) << "create eventfd error: " << co::strerror();
 
-    // register ev_read for _pipe_fds[0] to this epoll.
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], 0));
+    // register ev_read for the eventfd to this epoll.
+    CHECK(this->add_ev_read(_efd, 0));
 
-    _ev = (epoll_event*)::calloc(1024, sizeof(epoll_event));
+    _ev = (epoll_event*)::calloc(_nev, sizeof(epoll_event));
 }
 
 Epoll::~Epoll() {
@@ -29,97 +32,75 @@ Epoll::~Epoll() {
     }
 }
 
-bool Epoll::add_ev_read(int fd, int32_t co_id) {
-    if (fd < 0) return false;
-    auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_ev_read()) return true;  // already exists
+// Add the fd to this epoll for both read and write, edge-triggered. It is done
+// only once for the fd, until it is closed. The fd may be still in the epoll of
+// another scheduler, events there are ignored as no coroutine of that scheduler
+// waits on it. It may also come back to this epoll, EEXIST is fine then.
+bool Epoll::register_fd(int fd, SockCtx& ctx) {
+    if (ctx.registered(_sched_id)) return true;
 
-    const bool has_ev_write = ctx.has_ev_write(_sched_id);
     epoll_event ev;
-    ev.events = has_ev_write ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLET);
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
     ev.data.fd = fd;
-
-    const int r = epoll_ctl(_ep, has_ev_write ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
-    if (r == 0) {
-        ctx.add_ev_read(_sched_id, co_id);
+    const int r = epoll_ctl(_ep, EPOLL_CTL_ADD, fd, &ev);
+    if (r == 0 || errno == EEXIST) {
+        ctx.set_registered(_sched_id);
         return true;
-    } else {
-        ELOG << "epoll add ev read error: " << co::strerror() << ", fd: " << fd
-             << ", co: " << co_id;
-        return false;
     }
+    ELOG << "epoll add fd error: " << co::strerror() << ", fd: " << fd;
+    return false;
+}
+
+bool Epoll::add_ev_read(int fd, int32_t co_id) {
+    if (fd < 0) return false;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (ctx.has_ev_read()) return true;  // already exists
+    if (!this->register_fd(fd, ctx)) return false;
+    ctx.add_ev_read(_sched_id, co_id);
+    return true;
 }
 
 bool Epoll::add_ev_write(int fd, int32_t co_id) {
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_write()) return true;  // already exists
+    if (!this->register_fd(fd, ctx)) return false;
+    ctx.add_ev_write(_sched_id, co_id);
+    return true;
+}
 
-    const bool has_ev_read = ctx.has_ev_read(_sched_id);
+bool Epoll::add_ev_uring(int fd) {
     epoll_event ev;
-    ev.events = has_ev_read ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLOUT | EPOLLET);
+    ev.events = EPOLLIN;
     ev.data.fd = fd;
-
-    const int r = epoll_ctl(_ep, has_ev_read ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
-    if (r == 0) {
-        ctx.add_ev_write(_sched_id, co_id);
-        return true;
-    } else {
-        ELOG << "epoll add ev write error: " << co::strerror() << ", fd: " << fd
-             << ", co: " << co_id;
+    if (epoll_ctl(_ep, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        ELOG << "epoll add io_uring fd error: " << co::strerror() << ", fd: " << fd;
         return false;
     }
+    _uring_fd = fd;
+    return true;
 }
 
+// the fd stays in the epoll, only the waiting coroutine is removed
 void Epoll::del_ev_read(int fd) {
     if (fd < 0) return;
-    auto& ctx = co::get_sock_ctx(fd);
-    if (!ctx.has_ev_read()) return;  // not exists
-
-    int r;
-    ctx.del_ev_read();
-    if (!ctx.has_ev_write(_sched_id)) {
-        r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-    } else {
-        epoll_event ev;
-        ev.events = EPOLLOUT | EPOLLET;
-        ev.data.fd = fd;
-        r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
-    }
-
-    if (r != 0 && errno != ENOENT) {
-        ELOG << "epoll del ev_read error: " << co::strerror() << ", fd: " << fd;
-    }
+    co::get_sock_ctx(fd).del_ev_read();
 }
 
 void Epoll::del_ev_write(int fd) {
     if (fd < 0) return;
-    auto& ctx = co::get_sock_ctx(fd);
-    if (!ctx.has_ev_write()) return;  // not exists
-
-    int r;
-    ctx.del_ev_write();
-    if (!ctx.has_ev_read(_sched_id)) {
-        r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-    } else {
-        epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = fd;
-        r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
-    }
-
-    if (r != 0 && errno != ENOENT) {
-        ELOG << "epoll del ev_write error: " << co::strerror() << ", fd: " << fd;
-    }
+    co::get_sock_ctx(fd).del_ev_write();
 }
 
 void Epoll::del_event(int fd) {
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_event()) {
+    if (ctx.registered() || ctx.has_event()) {
         ctx.del_event();
         const int r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-        if (r != 0) ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        if (r != 0 && errno != ENOENT) {
+            ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        }
     }
 }
 
@@ -131,25 +112,64 @@ inline void closesocket(int& fd) {
 }
 
 void Epoll::close() {
+    if (_efd >= 0) co::get_sock_ctx(_efd).del_event();
+    if (_tfd >= 0) co::closesocket(_tfd);
     co::closesocket(_ep);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
+    co::closesocket(_efd);
 }
 
-void Epoll::handle_ev_pipe() {
-    int32_t dummy;
-    while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
+// Wait with a timeout in microseconds by epoll_pwait2 (linux 5.11+). On older
+// kernels, a timerfd in the epoll wakes up the wait. It is edge-triggered, so
+// an expiration after the wait returned shows up only once, and is ignored by
+// the scheduler as no coroutine waits on it.
+int Epoll::wait_fine(int64_t us) {
+#ifdef SYS_epoll_pwait2
+    if (!_no_pwait2) {
+        struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+        const int r = (int)syscall(SYS_epoll_pwait2, _ep, _ev, _nev, &ts, 0, 0);
+        if (r >= 0 || errno != ENOSYS) return r;
+        _no_pwait2 = true;
+    }
+#endif
+
+    if (_tfd == -1) {
+        _tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = _tfd;
+        if (_tfd < 0 || epoll_ctl(_ep, EPOLL_CTL_ADD, _tfd, &ev) != 0) {
+            ELOG << "timerfd for epoll error: " << co::strerror();
+            co::closesocket(_tfd);
+            _tfd = -2;
+        }
+    }
+    if (_tfd < 0) return this->wait((int)((us + 999) / 1000));
+
+    struct itimerspec its = {{0, 0}, {(time_t)(us / 1000000), (long)(us % 1000000) * 1000}};
+    timerfd_settime(_tfd, 0, &its, 0);
+    int n = __sys_api(epoll_wait)(_ep, _ev, _nev, -1);
+    for (int i = 0; i < n; ++i) {
+        if (_ev[i].data.fd == _tfd) {
+            uint64_t v;
+            (void)__sys_api(read)(_tfd, &v, sizeof(v));
+            _ev[i] = _ev[--n];
             break;
         }
     }
+    return n;
+}
+
+void Epoll::handle_ev_pipe() {
+    // a single read resets the counter of the eventfd
+    uint64_t v;
+    while (true) {
+        int r = (int)__sys_api(read)(_efd, &v, sizeof(v));
+        if (r != -1) break;
+        if (errno == EWOULDBLOCK || errno == EAGAIN) break;
+        if (errno == EINTR) continue;
+        ELOG << "eventfd read error: " << co::strerror() << ", fd: " << _efd;
+        break;
+    }
     _signaled.clear(std::memory_order_release);
 }
 
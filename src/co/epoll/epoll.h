@@ -3,6 +3,7 @@
 #pragma once
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "../hook.h"
 #include "../sock_ctx.h"
@@ -16,47 +17,72 @@ namespace co {
  *   - We have to consider about that two different coroutines operates on the
  *     same socket, one for read and one for write.
  *
- *     We use data.u64 of epoll_event to store the user data:
- *       - the higher 32 bits:  id of the coroutine waiting for EV_read.
- *       - the lower  32 bits:  id of the coroutine waiting for EV_write.
+ *     The fd is stored in data.fd of epoll_event, and ids of the coroutines
+ *     waiting for EV_read and EV_write are stored in SockCtx of the fd. When
+ *     an IO event is present, they will be used to resume the coroutines.
  *
- *     When an IO event is present, id in the user data will be used to resume
- *     the corresponding coroutine.
+ *   - A fd is registered edge-triggered for both read and write on the first
+ *     wait, and stays in the epoll until it is closed, so that a wait later
+ *     needs no epoll_ctl.
  */
 class Epoll {
   public:
-    Epoll(int sched_id);
+    // @nev: max number of events returned by a single wait
+    Epoll(int sched_id, int nev = 1024);
     ~Epoll();
 
     bool add_ev_read(int fd, int32_t co_id);
     bool add_ev_write(int fd, int32_t co_id);
     void del_ev_read(int fd);
     void del_ev_write(int fd);
+
+    // remove the fd from this epoll, it MUST be called before the fd is closed
     void del_event(int fd);
 
-    inline int wait(int ms) noexcept { return __sys_api(epoll_wait)(_ep, _ev, 1024, ms); }
+    inline int wait(int ms) noexcept { return __sys_api(epoll_wait)(_ep, _ev, _nev, ms); }
+
+    // wait with a timeout in microseconds, @us >= 0
+    inline int wait_us(int64_t us) noexcept {
+        return us % 1000 == 0 ? this->wait((int)(us / 1000)) : this->wait_fine(us);
+    }
 
-    // write one byte to the pipe to wake up the epoll.
-    inline void signal(char c = 'x') noexcept {
+    // wake up the epoll by writing to the eventfd. Signals are coalesced until
+    // the eventfd is drained by handle_ev_pipe().
+    inline void signal() noexcept {
         if (!_signaled.test_and_set()) {
-            const int r = (int)__sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            const uint64_t v = 1;
+            const int r = (int)__sys_api(write)(_efd, &v, sizeof(v));
+            ELOG_IF(r != sizeof(v)) << "eventfd write error: " << co::strerror();
         }
     }
 
     inline const epoll_event& operator[](int i) const { return _ev[i]; }
     inline int user_data(const epoll_event& ev) const noexcept { return ev.data.fd; }
     inline bool is_ev_pipe(const epoll_event& ev) const noexcept {
-        return ev.data.fd == _pipe_fds[0];
+        return ev.data.fd == _efd;
     }
     void handle_ev_pipe();
     void close();
 
+    // watch a ring fd of io_uring, it is readable when completions are present
+    bool add_ev_uring(int fd);
+    inline bool is_ev_uring(const epoll_event& ev) const noexcept {
+        return ev.data.fd == _uring_fd;
+    }
+
+  private:
+    bool register_fd(int fd, SockCtx& ctx);
+    int wait_fine(int64_t us);
+
   private:
     int _ep;
-    int _pipe_fds[2];
+    int _efd;  // eventfd for waking up the epoll
+    int _uring_fd;
+    int _tfd;          // timerfd for waits in us without epoll_pwait2, -2 if not available
+    bool _no_pwait2;   // epoll_pwait2 is not supported by the kernel
     std::atomic_flag _signaled;
     int _sched_id;
+    int _nev;
     epoll_event* _ev;
 };
 
@@ -0,0 +1,128 @@
+#ifdef __linux__
+#include "io_uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../close.h"
+#include "co/co.h"
+#include "co/log.h"
+
+namespace co {
+
+inline int io_uring_setup(uint32_t entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+inline int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+IoUring::IoUring(uint32_t entries)
+    : _fd(-1), _sqes(0), _sqe_tail(0), _sq_ptr(0), _sq_size(0), _cq_ptr(0), _cq_size(0),
+      _sqes_size(0) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    const int fd = io_uring_setup(entries, &p);
+    if (fd < 0) {
+        WLOG << "io_uring setup failed: " << co::strerror();
+        return;
+    }
+
+    _sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (_cq_size > _sq_size) _sq_size = _cq_size;
+        _cq_size = _sq_size;
+    }
+
+    _sq_ptr = ::mmap(0, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED) goto err;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ptr = _sq_ptr;
+    } else {
+        _cq_ptr = ::mmap(0, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                         IORING_OFF_CQ_RING);
+        if (_cq_ptr == MAP_FAILED) goto err;
+    }
+
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*)::mmap(0, _sqes_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) goto err;
+
+    do {
+        char* const sq = (char*)_sq_ptr;
+        char* const cq = (char*)_cq_ptr;
+        _sq.head = (uint32_t*)(sq + p.sq_off.head);
+        _sq.tail = (uint32_t*)(sq + p.sq_off.tail);
+        _sq.mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+        _sq.entries = (uint32_t*)(sq + p.sq_off.ring_entries);
+        _sq.array = (uint32_t*)(sq + p.sq_off.array);
+        _cq.head = (uint32_t*)(cq + p.cq_off.head);
+        _cq.tail = (uint32_t*)(cq + p.cq_off.tail);
+        _cq.mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+        _cq.cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        _sqe_tail = *_sq.tail;
+        _fd = fd;
+        co::set_cloexec(_fd);
+        return;
+    } while (0);
+
+err:
+    WLOG << "io_uring mmap failed: " << co::strerror();
+    if (_sqes && _sqes != MAP_FAILED) ::munmap(_sqes, _sqes_size);
+    if (_cq_ptr && _cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr) ::munmap(_cq_ptr, _cq_size);
+    if (_sq_ptr && _sq_ptr != MAP_FAILED) ::munmap(_sq_ptr, _sq_size);
+    _sqes = 0;
+    _sq_ptr = _cq_ptr = 0;
+    _close_nocancel(fd);
+}
+
+IoUring::~IoUring() {
+    if (_fd < 0) return;
+    ::munmap(_sqes, _sqes_size);
+    if (_cq_ptr != _sq_ptr) ::munmap(_cq_ptr, _cq_size);
+    ::munmap(_sq_ptr, _sq_size);
+    _close_nocancel(_fd);
+    _fd = -1;
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    uint32_t head = __atomic_load_n(_sq.head, __ATOMIC_ACQUIRE);
+    if (_sqe_tail - head >= *_sq.entries) {
+        this->submit();
+        head = __atomic_load_n(_sq.head, __ATOMIC_ACQUIRE);
+        if (_sqe_tail - head >= *_sq.entries) return 0;
+    }
+    const uint32_t i = _sqe_tail & *_sq.mask;
+    io_uring_sqe* const sqe = &_sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq.array[i] = i;
+    ++_sqe_tail;
+    return sqe;
+}
+
+int IoUring::submit() {
+    if (*_sq.tail != _sqe_tail) __atomic_store_n(_sq.tail, _sqe_tail, __ATOMIC_RELEASE);
+    const uint32_t n = _sqe_tail - __atomic_load_n(_sq.head, __ATOMIC_ACQUIRE);
+    if (n == 0) return 0;
+    for (;;) {
+        const int r = io_uring_enter(_fd, n, 0, 0);
+        if (r >= 0) return r;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EBUSY) {
+            ELOG << "io_uring submit error: " << co::strerror();
+        }
+        return -1;
+    }
+}
+
+}  // namespace co
+
+#endif
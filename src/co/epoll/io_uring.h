@@ -0,0 +1,86 @@
+#pragma once
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+
+#include "co/def.h"
+
+namespace co {
+
+/**
+ * io_uring for Linux, it is set up with raw system calls, no liburing is required.
+ *   - Each scheduler owns a ring, SQEs are queued by coroutines and submitted in
+ *     batch by the scheduler before it waits on the epoll.
+ *   - The ring fd is added to the epoll of the scheduler, it becomes readable
+ *     when completions are present.
+ *   - user_data of a SQE is a pointer to the operation, 0 for operations whose
+ *     completions should be ignored (cancel, e.g.).
+ */
+class IoUring {
+  public:
+    explicit IoUring(uint32_t entries);
+    ~IoUring();
+
+    // return false if io_uring is not supported by the kernel
+    bool ok() const noexcept { return _fd >= 0; }
+
+    int fd() const noexcept { return _fd; }
+
+    // get a SQE to fill, SQEs are submitted if the submission queue is full.
+    // return NULL if no SQE is available.
+    io_uring_sqe* get_sqe();
+
+    // number of SQEs not submitted yet
+    uint32_t pending() const noexcept { return _sqe_tail - *_sq.tail; }
+
+    // submit queued SQEs to the kernel, return number of SQEs submitted or -1 on error
+    int submit();
+
+    // call f(user_data, res) for each completion, return number of completions
+    template <typename F>
+    int reap(F&& f) {
+        int n = 0;
+        uint32_t head = *_cq.head;
+        for (;;) {
+            const uint32_t tail = __atomic_load_n(_cq.tail, __ATOMIC_ACQUIRE);
+            if (head == tail) break;
+            const io_uring_cqe& cqe = _cq.cqes[head & *_cq.mask];
+            void* const ud = (void*)(uintptr_t)cqe.user_data;
+            const int res = cqe.res;
+            __atomic_store_n(_cq.head, ++head, __ATOMIC_RELEASE);
+            if (ud) {
+                f(ud, res);
+                ++n;
+            }
+        }
+        return n;
+    }
+
+  private:
+    int _fd;
+    struct {
+        uint32_t* head;
+        uint32_t* tail;
+        uint32_t* mask;
+        uint32_t* entries;
+        uint32_t* array;
+    } _sq;
+    struct {
+        uint32_t* head;
+        uint32_t* tail;
+        uint32_t* mask;
+        io_uring_cqe* cqes;
+    } _cq;
+    io_uring_sqe* _sqes;
+    uint32_t _sqe_tail;  // local tail of SQEs, published to the kernel in submit()
+    void* _sq_ptr;
+    size_t _sq_size;
+    void* _cq_ptr;
+    size_t _cq_size;
+    size_t _sqes_size;
+    DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+}  // namespace co
+
+#endif
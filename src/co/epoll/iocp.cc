@@ -4,10 +4,10 @@
 
 namespace co {
 
-Iocp::Iocp(int32_t sched_id) : _signaled(), _sched_id(sched_id) {
+Iocp::Iocp(int32_t sched_id, int nev) : _signaled(), _sched_id(sched_id), _nev(nev) {
     _iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
     CHECK(_iocp != 0) << "create iocp failed..";
-    _ev = (OVERLAPPED_ENTRY*)::calloc(1024, sizeof(OVERLAPPED_ENTRY));
+    _ev = (OVERLAPPED_ENTRY*)::calloc(_nev, sizeof(OVERLAPPED_ENTRY));
 }
 
 Iocp::~Iocp() {
@@ -14,7 +14,8 @@ namespace co {
 
 class Iocp {
   public:
-    Iocp(int32_t sched_id);
+    // @nev: max number of events returned by a single wait
+    Iocp(int32_t sched_id, int nev = 1024);
     ~Iocp();
 
     bool add_event(sock_t fd) {
@@ -49,12 +50,15 @@ class Iocp {
 
     inline int wait(int ms) {
         ULONG n = 0;
-        const BOOL r = __sys_api(GetQueuedCompletionStatusEx)(_iocp, _ev, 1024, &n, ms, false);
+        const BOOL r = __sys_api(GetQueuedCompletionStatusEx)(_iocp, _ev, _nev, &n, ms, false);
         if (r == TRUE) return (int)n;
         const uint32_t e = ::GetLastError();
         return e == WAIT_TIMEOUT ? 0 : -1;
     }
 
+    // wait with a timeout in microseconds, rounded up to milliseconds
+    inline int wait_us(int64_t us) { return this->wait((int)((us + 999) / 1000)); }
+
     void signal() noexcept {
         if (!_signaled.test_and_set()) {
             const BOOL r = PostQueuedCompletionStatus(_iocp, 0, 0, 0);
@@ -77,6 +81,7 @@ class Iocp {
     OVERLAPPED_ENTRY* _ev;
     std::atomic_flag _signaled;
     int32_t _sched_id;
+    int _nev;
 };
 
 typedef OVERLAPPED_ENTRY epoll_event;
@@ -5,15 +5,17 @@
 
 namespace co {
 
-Kqueue::Kqueue(int sched_id) : _signaled(false) {
+Kqueue::Kqueue(int sched_id, int nev) : _changes(64), _signaled(false), _nev(nev) {
     _kq = kqueue();
     CHECK_NE(_kq, -1) << "kqueue create error: " << co::strerror();
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], nullptr));
-    _ev = (struct kevent*)::calloc(1024, sizeof(struct kevent));
+    co::set_cloexec(_kq);
+
+    // user event for waking up the kqueue, EV_CLEAR resets it once delivered
+    struct kevent event;
+    EV_SET(&event, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+    CHECK_EQ(__sys_api(kevent)(_kq, &event, 1, 0, 0, 0), 0)
+        << "kqueue add user event error: " << co::strerror();
+    _ev = (struct kevent*)::calloc(_nev, sizeof(struct kevent));
     (void)sched_id;
 }
 
@@ -25,21 +27,38 @@ Kqueue::~Kqueue() {
     }
 }
 
+inline void Kqueue::add_change(int fd, int filter, int flags, void* ud) {
+    struct kevent e;
+    EV_SET(&e, fd, filter, flags, 0, 0, ud);
+    _changes.push_back(e);
+}
+
+// If an EV_ADD of the event is still in the queue, drop it. The fd may be closed
+// before the next wait(), and an error of the add would resume a coroutine that
+// is not waiting for it any more.
+bool Kqueue::cancel_add(int fd, int filter) {
+    for (size_t i = _changes.size(); i > 0; --i) {
+        auto& e = _changes[i - 1];
+        if (e.ident == (uintptr_t)fd && e.filter == filter) {
+            if (!(e.flags & EV_ADD)) return false;
+            // keep the order, changes on the same fd are applied in order
+            struct kevent* p = _changes.data();
+            memmove(p + i - 1, p + i, (_changes.size() - i) * sizeof(*p));
+            _changes.remove_back();
+            return true;
+        }
+    }
+    return false;
+}
+
 bool Kqueue::add_ev_read(int fd, void* p) {
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_read()) return true;  // already exists
 
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, p);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) == 0) {
-        ctx.add_ev_read();
-        return true;
-    } else {
-        ELOG << "kqueue add ev_read error: " << co::strerror() << ", fd: " << fd;
-        return false;
-    }
+    this->add_change(fd, EVFILT_READ, EV_ADD, p);
+    ctx.add_ev_read();
+    return true;
 }
 
 bool Kqueue::add_ev_write(int fd, void* p) {
@@ -47,16 +66,9 @@ bool Kqueue::add_ev_write(int fd, void* p) {
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_write()) return true;  // already exists
 
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_WRITE, EV_ADD, 0, 0, p);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) == 0) {
-        ctx.add_ev_write();
-        return true;
-    } else {
-        ELOG << "kqueue add ev_write error: " << co::strerror() << ", fd: " << fd;
-        return false;
-    }
+    this->add_change(fd, EVFILT_WRITE, EV_ADD, p);
+    ctx.add_ev_write();
+    return true;
 }
 
 void Kqueue::del_ev_read(int fd) {
@@ -65,12 +77,7 @@ void Kqueue::del_ev_read(int fd) {
     if (!ctx.has_ev_read()) return;
 
     ctx.del_ev_read();
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) != 0) {
-        ELOG << "kqueue del ev_read error: " << co::strerror() << ", fd: " << fd;
-    }
+    if (!this->cancel_add(fd, EVFILT_READ)) this->add_change(fd, EVFILT_READ, EV_DELETE, 0);
 }
 
 void Kqueue::del_ev_write(int fd) {
@@ -79,12 +86,7 @@ void Kqueue::del_ev_write(int fd) {
     if (!ctx.has_ev_write()) return;
 
     ctx.del_ev_write();
-    struct kevent event;
-    EV_SET(&event, fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-
-    if (__sys_api(kevent)(_kq, &event, 1, 0, 0, 0) != 0) {
-        ELOG << "kqueue del ev_write error: " << co::strerror() << ", fd: " << fd;
-    }
+    if (!this->cancel_add(fd, EVFILT_WRITE)) this->add_change(fd, EVFILT_WRITE, EV_DELETE, 0);
 }
 
 void Kqueue::del_event(int fd) {
@@ -92,14 +94,11 @@ void Kqueue::del_event(int fd) {
     auto& ctx = co::get_sock_ctx(fd);
     if (!ctx.has_event()) return;
 
-    int i = 0;
-    struct kevent event[2];
-    if (ctx.has_ev_read()) EV_SET(&event[i++], fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-    if (ctx.has_ev_write()) EV_SET(&event[i++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-
+    const bool r = ctx.has_ev_read(), w = ctx.has_ev_write();
     ctx.del_event();
-    if (__sys_api(kevent)(_kq, event, i, 0, 0, 0) != 0) {
-        ELOG << "kqueue del event error: " << co::strerror() << ", fd: " << fd;
+    if (r && !this->cancel_add(fd, EVFILT_READ)) this->add_change(fd, EVFILT_READ, EV_DELETE, 0);
+    if (w && !this->cancel_add(fd, EVFILT_WRITE)) {
+        this->add_change(fd, EVFILT_WRITE, EV_DELETE, 0);
     }
 }
 
@@ -112,24 +111,9 @@ inline void closesocket(int& fd) {
 
 void Kqueue::close() {
     co::closesocket(_kq);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
 }
 
 void Kqueue::handle_ev_pipe() {
-    int32_t dummy;
-    while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
-            break;
-        }
-    }
     _signaled.clear(std::memory_order_release);
 }
 
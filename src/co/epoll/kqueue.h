@@ -10,12 +10,23 @@
 #include "../sock_ctx.h"
 #include "co/co.h"
 #include "co/log.h"
+#include "co/vector.h"
 
 namespace co {
 
+/**
+ * Kqueue for BSD and mac
+ *   - Changes of events are not submitted one by one. They are queued and
+ *     submitted with the changelist of the next wait(), which is done after
+ *     the coroutines that added them were suspended.
+ *   - An error of adding an event is returned by wait() as an event with
+ *     EV_ERROR, and the waiting coroutine is resumed to retry the IO and see
+ *     the error. Errors of deleting events carry no user data and are ignored.
+ */
 class Kqueue {
   public:
-    Kqueue(int sched_id);
+    // @nev: max number of events returned by a single wait
+    Kqueue(int sched_id, int nev = 1024);
     ~Kqueue();
 
     bool add_ev_read(int fd, void* ud);
@@ -30,32 +41,57 @@ class Kqueue {
      */
     void del_event(int fd);
 
+    // submit the queued changes and wait for events
     inline int wait(int ms) noexcept {
+        const int n = (int)_changes.size();
+        int r;
         if (ms >= 0) {
             struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
-            return __sys_api(kevent)(_kq, 0, 0, _ev, 1024, &ts);
+            r = __sys_api(kevent)(_kq, _changes.data(), n, _ev, _nev, &ts);
         } else {
-            return __sys_api(kevent)(_kq, 0, 0, _ev, 1024, 0);
+            r = __sys_api(kevent)(_kq, _changes.data(), n, _ev, _nev, 0);
         }
+        if (n > 0) _changes.clear();
+        return r;
     }
 
-    inline void signal(char c = 'x') noexcept {
+    // wait with a timeout in microseconds, @us >= 0
+    inline int wait_us(int64_t us) noexcept {
+        struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+        const int n = (int)_changes.size();
+        const int r = __sys_api(kevent)(_kq, _changes.data(), n, _ev, _nev, &ts);
+        if (n > 0) _changes.clear();
+        return r;
+    }
+
+    // wake up the kqueue by triggering the user event. Signals are coalesced
+    // until the event is handled by handle_ev_pipe().
+    inline void signal() noexcept {
         if (!_signaled.test_and_set()) {
-            const int r = (int)__sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            struct kevent event;
+            EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+            const int r = __sys_api(kevent)(_kq, &event, 1, 0, 0, 0);
+            ELOG_IF(r != 0) << "kqueue trigger user event error: " << co::strerror();
         }
     }
 
     inline const struct kevent& operator[](int i) const { return _ev[i]; }
     inline void* user_data(const struct kevent& ev) const noexcept { return ev.udata; }
-    inline bool is_ev_pipe(const struct kevent& ev) const noexcept { return ev.udata == 0; }
+    inline bool is_ev_pipe(const struct kevent& ev) const noexcept {
+        return ev.filter == EVFILT_USER;
+    }
     void handle_ev_pipe();
     void close();
 
+  private:
+    void add_change(int fd, int filter, int flags, void* ud);
+    bool cancel_add(int fd, int filter);
+
   private:
     int _kq;
-    int _pipe_fds[2];
+    co::vector<struct kevent> _changes;  // changes to be submitted by wait()
     std::atomic_flag _signaled;
+    int _nev;
     struct kevent* _ev;
 };
 
@@ -15,7 +15,9 @@ void hook_sleep(bool) {}
 #include <dlfcn.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <sys/stat.h>
 
+#include <algorithm>
 #include <atomic>
 
 #include "co/color.h"
@@ -24,6 +26,7 @@ void hook_sleep(bool) {}
 #include "sched.h"
 
 DEF_bool(co_hook_log, false, ">>#1 print log for API hooks");
+DEC_bool(co_file_offload);
 
 #define HOOKLOG TLOG_IF(FLG_co_hook_log)
 
@@ -114,6 +117,14 @@ inline hostent* hent() {
     return &_hents[co::xx::current_sched()->id()];
 }
 
+// buffer for the hostent of the current scheduler
+inline fastream& hbuf() {
+    static co::vector<fastream> _bufs(co::sched_num(), 0);
+    auto& fs = _bufs[co::xx::current_sched()->id()];
+    if (fs.capacity() < 1024) fs.reserve(1024);
+    return fs;
+}
+
 inline co::mutex& smtx() {
     static co::vector<co::mutex> _mtx(co::sched_num(), 0);
 
@@ -125,6 +136,262 @@ inline co::mutex& gmtx() {
     return _mtx;
 }
 
+// Read or write on a regular file in a blocking-I/O thread. Buffers on the
+// shared stack are copied to the heap, as the thread can not access them while
+// the coroutine is suspended.
+struct file_io_t {
+    int fd;
+    bool w;
+    char* buf;
+    size_t n;
+    struct iovec* iov;
+    int iovcnt;
+    int64_t off;  // offset for positional I/O, -1 for the current position
+    ssize_t r;
+    int err;
+};
+
+inline ssize_t _piov(int fd, bool w, const struct iovec* iov, int iovcnt, int64_t off) {
+#ifdef __linux__
+    return w ? ::pwritev(fd, iov, iovcnt, (off_t)off) : ::preadv(fd, iov, iovcnt, (off_t)off);
+#else
+    ssize_t r = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        const ssize_t x = w ? ::pwrite(fd, iov[i].iov_base, iov[i].iov_len, (off_t)off + r)
+                            : ::pread(fd, iov[i].iov_base, iov[i].iov_len, (off_t)off + r);
+        if (x < 0) return r > 0 ? r : x;
+        r += x;
+        if ((size_t)x < iov[i].iov_len) break;
+    }
+    return r;
+#endif
+}
+
+inline bool is_file(int fd) {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+}
+
+static void do_file_io(void* arg) {
+    auto x = (file_io_t*)arg;
+    do {
+        if (x->off >= 0) {
+            x->r = x->iov ? _piov(x->fd, x->w, x->iov, x->iovcnt, x->off)
+                 : x->w   ? ::pwrite(x->fd, x->buf, x->n, (off_t)x->off)
+                          : ::pread(x->fd, x->buf, x->n, (off_t)x->off);
+        } else if (x->iov) {
+            x->r = x->w ? __sys_api(writev)(x->fd, x->iov, x->iovcnt)
+                        : __sys_api(readv)(x->fd, x->iov, x->iovcnt);
+        } else {
+            x->r = x->w ? __sys_api(write)(x->fd, x->buf, x->n)
+                        : __sys_api(read)(x->fd, x->buf, x->n);
+        }
+    } while (x->r < 0 && errno == EINTR);
+    x->err = x->r < 0 ? errno : 0;
+}
+
+static ssize_t file_io(co::xx::Sched* sched, int fd, bool w, void* buf, size_t n,
+                       int64_t off = -1) {
+    const bool bounce = sched->shared_stack() && sched->on_stack(buf);
+    file_io_t x = {fd, w, bounce ? (char*)::malloc(n) : (char*)buf, n, nullptr, 0, off, 0, 0};
+    if (bounce && w) memcpy(x.buf, buf, n);
+
+    auto p = (file_io_t*)::malloc(sizeof(x));
+    *p = x;
+    co::xx::offload(do_file_io, p);
+    x = *p;
+    ::free(p);
+
+    if (bounce) {
+        if (!w && x.r > 0) memcpy(buf, x.buf, x.r);
+        ::free(x.buf);
+    }
+    if (x.r < 0) errno = x.err;
+    return x.r;
+}
+
+static ssize_t file_iov(co::xx::Sched* sched, int fd, bool w, const struct iovec* iov, int iovcnt,
+                        int64_t off = -1) {
+    if (iovcnt <= 0) {
+        if (off >= 0) return _piov(fd, w, iov, iovcnt, off);
+        return w ? __sys_api(writev)(fd, iov, iovcnt) : __sys_api(readv)(fd, iov, iovcnt);
+    }
+
+    // gather all buffers to one on heap if any of them is on the shared stack
+    size_t total = 0;
+    bool bounce = false;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+        if (sched->shared_stack() && sched->on_stack(iov[i].iov_base)) bounce = true;
+    }
+
+    if (bounce) {
+        char* const b = (char*)::malloc(total ? total : 1);
+        if (w) {
+            size_t k = 0;
+            for (int i = 0; i < iovcnt; ++i) {
+                memcpy(b + k, iov[i].iov_base, iov[i].iov_len);
+                k += iov[i].iov_len;
+            }
+        }
+        const ssize_t r = file_io(sched, fd, w, b, total, off);
+        if (!w && r > 0) {
+            size_t k = 0;
+            for (int i = 0; i < iovcnt && k < (size_t)r; ++i) {
+                const size_t m = std::min(iov[i].iov_len, (size_t)r - k);
+                memcpy(iov[i].iov_base, b + k, m);
+                k += m;
+            }
+        }
+        const int e = errno;
+        ::free(b);
+        errno = e;
+        return r;
+    }
+
+    // the iovec array itself may be on the shared stack
+    auto p = (file_io_t*)::malloc(sizeof(file_io_t) + sizeof(struct iovec) * iovcnt);
+    *p = {fd, w, nullptr, 0, (struct iovec*)(p + 1), iovcnt, off, 0, 0};
+    memcpy(p->iov, iov, sizeof(struct iovec) * iovcnt);
+    co::xx::offload(do_file_io, p);
+    const ssize_t r = p->r;
+    const int e = p->err;
+    ::free(p);
+    if (r < 0) errno = e;
+    return r;
+}
+
+namespace co {
+namespace xx {
+
+ssize_t file_pio(int fd, bool w, void* buf, size_t n, int64_t off) {
+    const auto sched = current_sched();
+    if (sched && FLG_co_file_offload) return file_io(sched, fd, w, buf, n, off);
+    return w ? ::pwrite(fd, buf, n, (off_t)off) : ::pread(fd, buf, n, (off_t)off);
+}
+
+ssize_t file_piov(int fd, bool w, const struct iovec* iov, int iovcnt, int64_t off) {
+    const auto sched = current_sched();
+    if (sched && FLG_co_file_offload) return file_iov(sched, fd, w, iov, iovcnt, off);
+    return _piov(fd, w, iov, iovcnt, off);
+}
+
+}  // namespace xx
+}  // namespace co
+
+#ifdef __linux__
+// Resolve @name with co::resolve() and fill the result in @ret, like gethostbyname_r.
+// Strings and addresses of the result are stored in @buf.
+static int co_gethostbyname_r(const char* name, int af, struct hostent* ret, char* buf,
+                              size_t len, struct hostent** res, int* err) {
+    *res = 0;
+    co::vector<fastring> ips;
+    const int r = co::resolve(name, af, ips);
+    if (r != 0) {
+        *err = (r == EAI_NONAME) ? HOST_NOT_FOUND : (r == EAI_AGAIN) ? TRY_AGAIN : NO_RECOVERY;
+        return 0;
+    }
+
+    const int alen = af == AF_INET6 ? 16 : 4;
+    const size_t nlen = strlen(name) + 1;
+    const size_t pad = (uintptr_t)buf & (sizeof(char*) - 1);
+    const size_t need = (pad ? sizeof(char*) - pad : 0) + sizeof(char*) * (ips.size() + 2) +
+                        alen * ips.size() + nlen;
+    if (len < need) {
+        *err = NETDB_INTERNAL;
+        return ERANGE;
+    }
+
+    char** p = (char**)(buf + (pad ? sizeof(char*) - pad : 0));
+    char* a = (char*)(p + ips.size() + 2);
+    ret->h_aliases = p;
+    *p++ = 0;
+    ret->h_addr_list = p;
+    size_t n = 0;
+    for (auto& ip : ips) {
+        if (inet_pton(af, ip.c_str(), a) != 1) continue;
+        p[n++] = a;
+        a += alen;
+    }
+    p[n] = 0;
+    memcpy(a, name, nlen);
+    ret->h_name = a;
+    ret->h_addrtype = af;
+    ret->h_length = alen;
+    *res = ret;
+    *err = 0;
+    return 0;
+}
+#endif
+
+#ifdef __linux__
+// Wait in a coroutine until check() returns non-zero or @ms milliseconds passed
+// (-1 for no timeout). The fds to check were added to @ep, which is readable once
+// any of them is ready. The scheduler watches @ep, so the coroutine is woken up
+// on the first event instead of polling. @ep is closed at last.
+template <typename F>
+static int wait_on_epoll(int ep, int ms, F&& check) {
+    int r;
+    const int64_t deadline = ms < 0 ? 0 : co::now::ms() + ms;
+    {
+        co::io_event ev(ep, co::ev_read);
+        for (;;) {
+            r = check();
+            if (r != 0) break;
+            uint32_t t = (uint32_t)-1;
+            if (ms >= 0) {
+                const int64_t d = deadline - co::now::ms();
+                if (d <= 0) break;
+                t = (uint32_t)d;
+            }
+            if (!ev.wait(t)) {
+                r = check();
+                break;
+            }
+        }
+    }
+    co::close(ep);
+    return r;
+}
+
+// Add @fds to a new epoll. Return -1 if any of them can't be added, e.g. regular
+// files or an fd that appears twice, the caller should fall back to polling then.
+static int poll_to_epoll(const struct pollfd* fds, nfds_t nfds) {
+    const int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) return -1;
+    for (nfds_t i = 0; i < nfds; ++i) {
+        if (fds[i].fd < 0) continue;  // ignored by poll
+        struct epoll_event ev;
+        ev.events = (uint32_t)fds[i].events;  // POLLxx and EPOLLxx are the same
+        ev.data.u64 = 0;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fds[i].fd, &ev) != 0) {
+            __sys_api(close)(ep);
+            return -1;
+        }
+    }
+    return ep;
+}
+
+static int select_to_epoll(int nfds, const fd_set* rs, const fd_set* ws, const fd_set* es) {
+    const int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) return -1;
+    for (int fd = 0; fd < nfds; ++fd) {
+        struct epoll_event ev;
+        ev.events = 0;
+        if (rs && FD_ISSET(fd, rs)) ev.events |= EPOLLIN;
+        if (ws && FD_ISSET(fd, ws)) ev.events |= EPOLLOUT;
+        if (es && FD_ISSET(fd, es)) ev.events |= EPOLLPRI;
+        if (ev.events == 0) continue;
+        ev.data.u64 = 0;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            __sys_api(close)(ep);
+            return -1;
+        }
+    }
+    return ep;
+}
+#endif
+
 extern "C" {
 
 _CO_DEF_SYS_API(socket);
@@ -374,6 +641,7 @@ int _hook(dup2)(int oldfd, int newfd) {
     int r = __sys_api(dup2)(oldfd, newfd);
     if (r != -1 && oldfd != newfd) {
         *g_hook.get_hook_ctx(newfd) = *g_hook.get_hook_ctx(oldfd);
+        co::get_sock_ctx(newfd).del_event();  // the old newfd was closed
     }
 
     HOOKLOG << "hook dup2, oldfd: " << oldfd << ", newfd: " << newfd << ", r: " << r;
@@ -391,6 +659,7 @@ int _hook(dup3)(int oldfd, int newfd, int flags) {
     int r = __sys_api(dup3)(oldfd, newfd, flags);
     if (r != -1) {
         *g_hook.get_hook_ctx(newfd) = *g_hook.get_hook_ctx(oldfd);
+        co::get_sock_ctx(newfd).del_event();  // the old newfd was closed
     }
 
     HOOKLOG << "hook dup3, oldfd: " << oldfd << ", newfd: " << newfd << ", flags: " << flags
@@ -430,6 +699,9 @@ int _hook(close)(int fd) {
         ctx->clear();
         r = co::close(fd);
     } else {
+        // the fd may be waited on in epoll, e.g. epoll_wait() on an epoll fd
+        const auto sched = co::xx::current_sched();
+        sched ? sched->del_io_event(fd) : co::get_sock_ctx(fd).del_event();
         r = __sys_api(close)(fd);
     }
 
@@ -542,6 +814,11 @@ ssize_t _hook(read)(int fd, void* buf, size_t count) {
     const auto sched = co::xx::current_sched();
     auto ctx = g_hook.get_hook_ctx(fd);
     if (!sched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+        if (sched && FLG_co_file_offload && ctx && !ctx->is_sock_or_pipe() && is_file(fd)) {
+            r = file_io(sched, fd, false, buf, count);
+            HOOKLOG << "hook read on file, fd: " << fd << ", r: " << r;
+            return r;
+        }
         return __sys_api(read)(fd, buf, count);
     }
 
@@ -566,6 +843,11 @@ ssize_t _hook(readv)(int fd, const struct iovec* iov, int iovcnt) {
     const auto sched = co::xx::current_sched();
     auto ctx = g_hook.get_hook_ctx(fd);
     if (!sched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+        if (sched && FLG_co_file_offload && ctx && !ctx->is_sock_or_pipe() && is_file(fd)) {
+            r = file_iov(sched, fd, false, iov, iovcnt);
+            HOOKLOG << "hook readv on file, fd: " << fd << ", r: " << r;
+            return r;
+        }
         return __sys_api(readv)(fd, iov, iovcnt);
     }
 
@@ -666,6 +948,11 @@ ssize_t _hook(write)(int fd, const void* buf, size_t count) {
     const auto sched = co::xx::current_sched();
     auto ctx = g_hook.get_hook_ctx(fd);
     if (!sched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+        if (sched && FLG_co_file_offload && ctx && !ctx->is_sock_or_pipe() && is_file(fd)) {
+            r = file_io(sched, fd, true, (void*)buf, count);
+            HOOKLOG << "hook write on file, fd: " << fd << ", r: " << r;
+            return r;
+        }
         return __sys_api(write)(fd, buf, count);
     }
 
@@ -690,6 +977,11 @@ ssize_t _hook(writev)(int fd, const struct iovec* iov, int iovcnt) {
     const auto sched = co::xx::current_sched();
     auto ctx = g_hook.get_hook_ctx(fd);
     if (!sched || !ctx || !ctx->is_sock_or_pipe() || ctx->is_non_blocking()) {
+        if (sched && FLG_co_file_offload && ctx && !ctx->is_sock_or_pipe() && is_file(fd)) {
+            r = file_iov(sched, fd, true, iov, iovcnt);
+            HOOKLOG << "hook writev on file, fd: " << fd << ", r: " << r;
+            return r;
+        }
         return __sys_api(writev)(fd, iov, iovcnt);
     }
 
@@ -809,7 +1101,7 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
 
             if (ms > 0) sched->add_timer(ms);
             sched->yield();
-            sched->del_io_event(fd);
+            sched->del_io_event(fd, fds[0].events == POLLIN ? co::ev_read : co::ev_write);
             if (ms > 0 && sched->timeout()) {
                 r = 0;
                 goto end;
@@ -826,6 +1118,16 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
         goto end;
     }
 
+#ifdef __linux__
+    {
+        const int ep = poll_to_epoll(fds, nfds);
+        if (ep >= 0) {
+            r = wait_on_epoll(ep, ms, [&]() { return __sys_api(poll)(fds, nfds, 0); });
+            goto end;
+        }
+    }
+#endif
+
     // just check poll every x ms
     do {
         r = __sys_api(poll)(fds, nfds, 0);
@@ -874,7 +1176,6 @@ int _hook(select)(int nfds, fd_set* rs, fd_set* ws, fd_set* es, struct timeval*
         goto end;
     }
 
-    // just check select every x ms
     {
         struct timeval o = {0, 0};
         fd_set s[3];
@@ -882,6 +1183,21 @@ int _hook(select)(int nfds, fd_set* rs, fd_set* ws, fd_set* es, struct timeval*
         if (ws) s[1] = *ws;
         if (es) s[2] = *es;
 
+#ifdef __linux__
+        const int ep = select_to_epoll(nfds, rs, ws, es);
+        if (ep >= 0) {
+            r = wait_on_epoll(ep, ms, [&]() {
+                if (rs) *rs = s[0];
+                if (ws) *ws = s[1];
+                if (es) *es = s[2];
+                o.tv_sec = o.tv_usec = 0;
+                return __sys_api(select)(nfds, rs, ws, es, &o);
+            });
+            goto end;
+        }
+#endif
+
+        // just check select every x ms
         t = ms;
         do {
             r = __sys_api(select)(nfds, rs, ws, es, &o);
@@ -1050,10 +1366,8 @@ int _hook(gethostbyname_r)(const char* name, struct hostent* ret, char* buf, siz
     HOOKLOG << "hook gethostbyname_r, name: " << (name ? name : "");
 
     const auto sched = co::xx::current_sched();
-    if (!sched) return __sys_api(gethostbyname_r)(name, ret, buf, len, res, err);
-
-    co::mutex_guard g(smtx());
-    return __sys_api(gethostbyname_r)(name, ret, buf, len, res, err);
+    if (!sched || !name) return __sys_api(gethostbyname_r)(name, ret, buf, len, res, err);
+    return co_gethostbyname_r(name, AF_INET, ret, buf, len, res, err);
 }
 
 int _hook(gethostbyname2_r)(const char* name, int af, struct hostent* ret, char* buf, size_t len,
@@ -1062,10 +1376,8 @@ int _hook(gethostbyname2_r)(const char* name, int af, struct hostent* ret, char*
     HOOKLOG << "hook gethostbyname2_r, name: " << (name ? name : "");
 
     const auto sched = co::xx::current_sched();
-    if (!sched) return __sys_api(gethostbyname2_r)(name, af, ret, buf, len, res, err);
-
-    co::mutex_guard g(smtx());
-    return __sys_api(gethostbyname2_r)(name, af, ret, buf, len, res, err);
+    if (!sched || !name) return __sys_api(gethostbyname2_r)(name, af, ret, buf, len, res, err);
+    return co_gethostbyname_r(name, af, ret, buf, len, res, err);
 }
 
 int _hook(gethostbyaddr_r)(const void* addr, socklen_t addrlen, int type, struct hostent* ret,
@@ -1168,6 +1480,19 @@ struct hostent* _hook(gethostbyname)(const char* name) {
     const auto sched = co::xx::current_sched();
     if (!sched) return __sys_api(gethostbyname)(name);
 
+#ifdef __linux__
+    if (!name) return 0;
+    fastream& fs = hbuf();
+    struct hostent* ent = hent();
+    struct hostent* res = 0;
+    int err = 0;
+    while (co_gethostbyname_r(name, AF_INET, ent, (char*)fs.data(), fs.capacity(), &res, &err) ==
+           ERANGE) {
+        fs.reserve(fs.capacity() << 1);
+    }
+    h_errno = err;
+    return res;
+#else
     co::mutex_guard g(gmtx());
     struct hostent* r = __sys_api(gethostbyname)(name);
     if (!r) return 0;
@@ -1175,6 +1500,7 @@ struct hostent* _hook(gethostbyname)(const char* name) {
     struct hostent* ent = hent();
     *ent = *r;
     return ent;
+#endif
 }
 
 struct hostent* _hook(gethostbyaddr)(const void* addr, socklen_t len, int type) {
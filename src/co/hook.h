@@ -245,5 +245,17 @@ _CO_DEC_SYS_API(kevent);
 
 }  // "C"
 
+namespace co {
+namespace xx {
+
+// pread/pwrite on a regular file, in a blocking-I/O thread if called in coroutine
+ssize_t file_pio(int fd, bool w, void* buf, size_t n, int64_t off);
+
+// preadv/pwritev on a regular file, in a blocking-I/O thread if called in coroutine
+ssize_t file_piov(int fd, bool w, const struct iovec* iov, int iovcnt, int64_t off);
+
+}  // namespace xx
+}  // namespace co
+
 #endif  // #ifdef _WIN32
 #endif  // #ifdef _CO_DISABLE_HOOK
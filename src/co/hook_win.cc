@@ -564,9 +564,27 @@ int WINAPI hook_recv(SOCKET a0, char* a1, int a2, int a3) {
     }
 
     if (ctx->is_overlapped()) {
+        set_skip_iocp(a0, ctx);
+        if (ctx->is_sock_stream() && sched->on_stack(a1)) {
+            // Wait with a zero-byte WSARecv and then recv into @a1 directly, rather
+            // than through a heap copy of the buffer pinned by IOCP.
+            if (!ctx->has_nb_mark()) {
+                set_non_blocking(a0, 1);
+                ctx->set_nb_mark();
+            }
+            r = __sys_api(recv)(a0, a1, a2, a3);
+            if (r >= 0 || WSAGetLastError() != WSAEWOULDBLOCK) goto end;
+
+            co::io_event ev(a0, co::ev_read);
+            do {
+                if (!ev.wait(ctx->recv_timeout())) goto end;  // r = -1
+                r = __sys_api(recv)(a0, a1, a2, a3);
+            } while (r < 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+            goto end;
+        }
+
         co::io_event ev(a0, co::ev_read, a1, a2);
         ev->flags = a3;
-        set_skip_iocp(a0, ctx);
 
         r = __sys_api(WSARecv)(a0, &ev->buf, 1, &ev->n, &ev->flags, &ev->ol, 0);
         if (r == 0) {
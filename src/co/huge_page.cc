@@ -0,0 +1,63 @@
+#include "huge_page.h"
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace co {
+namespace xx {
+
+inline size_t huge_align(size_t n) { return (n + huge_page_size - 1) & ~(huge_page_size - 1); }
+
+#ifdef _WIN32
+// large pages on windows need the SeLockMemoryPrivilege, they are not used
+void* alloc_huge(size_t n) {
+    return VirtualAlloc(0, huge_align(n), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void free_huge(void* p, size_t) { VirtualFree(p, 0, MEM_RELEASE); }
+
+void advise_huge(void*, size_t) {}
+
+#else
+void* alloc_huge(size_t n) {
+    n = huge_align(n);
+#ifdef __linux__
+    void* p = ::mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return p;
+
+    // map 2M more and trim it to a 2M aligned range
+    char* const x = (char*)::mmap(0, n + huge_page_size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (x == (char*)MAP_FAILED) return 0;
+    char* const b = (char*)huge_align((size_t)x);
+    if (b > x) ::munmap(x, b - x);
+    if (b < x + huge_page_size) ::munmap(b + n, x + huge_page_size - b);
+    ::madvise(b, n, MADV_HUGEPAGE);
+    return b;
+#else
+    void* p = ::mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p != MAP_FAILED ? p : 0;
+#endif
+}
+
+void free_huge(void* p, size_t n) { ::munmap(p, huge_align(n)); }
+
+void advise_huge(void* p, size_t n) {
+#ifdef __linux__
+    const uintptr_t b = huge_align((uintptr_t)p);
+    const uintptr_t e = ((uintptr_t)p + n) & ~(uintptr_t)(huge_page_size - 1);
+    if (b < e) ::madvise((void*)b, e - b, MADV_HUGEPAGE);
+#else
+    (void)p;
+    (void)n;
+#endif
+}
+#endif
+
+}  // namespace xx
+}  // namespace co
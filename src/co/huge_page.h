@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace co {
+namespace xx {
+
+// Huge pages for memory touched by many coroutines, shared stacks, coroutine
+// blocks and the log buffer, enabled by co_huge_pages. A huge page needs one
+// TLB entry instead of 512 ones for 4K pages.
+static const size_t huge_page_size = (size_t)2 << 20;
+
+// Map @n bytes (rounded up to 2M) of zero-filled memory. Pages reserved with
+// vm.nr_hugepages are used if any (MAP_HUGETLB), or else the memory is 2M
+// aligned and advised with MADV_HUGEPAGE for transparent huge pages. On other
+// systems, it is memory mapped as usual. Return NULL on failure.
+void* alloc_huge(size_t n);
+
+// unmap memory from alloc_huge(), @n is the size passed to it
+void free_huge(void* p, size_t n);
+
+// advise the 2M aligned part of [p, p + n) with MADV_HUGEPAGE, linux only
+void advise_huge(void* p, size_t n);
+
+}  // namespace xx
+}  // namespace co
@@ -0,0 +1,132 @@
+#include "sched.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+DEC_uint32(co_offload_threads);
+
+namespace co {
+namespace xx {
+
+// a task offloaded from a coroutine, allocated on heap
+struct offload_t {
+    offload_t* next;
+    void (*f)(void*);
+    void* arg;
+    Coroutine* co;
+    int64_t t;  // time (us) the task was queued
+};
+
+// Threads for blocking operations, they are created on the first use and run
+// until the process exits. A done task is sent back to the scheduler of its
+// coroutine as a ready task.
+class offload_pool {
+public:
+    offload_pool()
+        : _head(nullptr), _tail(nullptr), _queued(0), _running(0), _done(0), _wait_us(0) {
+        _threads = FLG_co_offload_threads > 0 ? FLG_co_offload_threads : 1;
+        for (uint32_t i = 0; i < _threads; ++i) {
+            std::thread(&offload_pool::loop, this).detach();
+        }
+    }
+
+    void push(offload_t* t) {
+        t->next = nullptr;
+        t->t = now::us();
+        _queued.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> g(_m);
+            _tail ? (void)(_tail->next = t) : (void)(_head = t);
+            _tail = t;
+        }
+        _cv.notify_one();
+    }
+
+    blocking_pool_stats stats() const noexcept {
+        blocking_pool_stats x;
+        x.threads = _threads;
+        x.queued = _queued.load(std::memory_order_relaxed);
+        x.running = _running.load(std::memory_order_relaxed);
+        x.done = _done.load(std::memory_order_relaxed);
+        x.wait_us = _wait_us.load(std::memory_order_relaxed);
+        return x;
+    }
+
+private:
+    void loop() {
+        for (;;) {
+            offload_t* t;
+            {
+                std::unique_lock<std::mutex> g(_m);
+                while (!_head) _cv.wait(g);
+                t = _head;
+                _head = t->next;
+                if (!_head) _tail = nullptr;
+            }
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            _running.fetch_add(1, std::memory_order_relaxed);
+            _wait_us.fetch_add((uint64_t)(now::us() - t->t), std::memory_order_relaxed);
+            t->f(t->arg);
+            _running.fetch_sub(1, std::memory_order_relaxed);
+            _done.fetch_add(1, std::memory_order_relaxed);
+
+            Coroutine* const co = t->co;
+            ::free(t);
+            co->sched->add_ready_task(co);
+        }
+    }
+
+private:
+    std::mutex _m;
+    std::condition_variable _cv;
+    offload_t* _head;
+    offload_t* _tail;
+    uint32_t _threads;
+    std::atomic_uint64_t _queued;
+    std::atomic_uint64_t _running;
+    std::atomic_uint64_t _done;
+    std::atomic_uint64_t _wait_us;
+};
+
+// never destroyed, the threads may still be running at exit
+static std::atomic<offload_pool*> g_opool{nullptr};
+
+inline offload_pool& opool() {
+    static offload_pool* p = [] {
+        auto x = new offload_pool;
+        g_opool.store(x, std::memory_order_release);
+        return x;
+    }();
+    return *p;
+}
+
+void offload(void (*f)(void*), void* arg) {
+    const auto sched = xx::current_sched();
+    CHECK(sched) << "offload must be called in coroutine..";
+    auto t = (offload_t*)::malloc(sizeof(offload_t));
+    assert(t);
+    t->f = f;
+    t->arg = arg;
+    t->co = sched->running();
+    opool().push(t);
+    sched->yield();
+}
+
+}  // namespace xx
+
+void run_blocking(Closure* cb) {
+    if (!xx::current_sched()) return cb->run();
+    xx::offload([](void* p) { ((Closure*)p)->run(); }, cb);
+}
+
+blocking_pool_stats blocking_stats() {
+    const auto p = xx::g_opool.load(std::memory_order_acquire);
+    if (p) return p->stats();
+    blocking_pool_stats x;
+    memset(&x, 0, sizeof(x));
+    return x;
+}
+
+}  // namespace co
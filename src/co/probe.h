@@ -0,0 +1,37 @@
+#pragma once
+
+// USDT probes of co, for bpftrace, perf, systemtap and so on.
+//   - They are built only with WITH_USDT (cmake) or with_usdt (xmake) on linux,
+//     and expand to nothing otherwise.
+//   - A probe is a single nop in the code until a tracer attaches to it, keep
+//     its arguments cheap, values at hand or simple loads.
+//
+//   bpftrace -e 'usdt:./libco.so:co:resume { @[arg0] = count(); }'
+//   bpftrace -e 'usdt:./server:co:http_begin { printf("%s\n", str(arg0, arg1)); }'
+//
+// probes (provider "co"):
+//   resume(sched_id, co_id)         a coroutine is resumed
+//   yield(sched_id, co_id)          a coroutine is suspended
+//   exit(sched_id, co_id)           a coroutine has terminated
+//   go(sched_id)                    a task is submitted to a scheduler
+//   io_wait(co_id, fd, ev)          a coroutine waits for an I/O event
+//   timer_fire(sched_id, co_id)     a coroutine is resumed by its timer
+//   chan_block(pipe, co_id, rw)     a coroutine blocks on a channel, rw: 0 read, 1 write
+//   chan_unblock(pipe, co_id, rw)   it is resumed, arg2 | 2 if timed out
+//   http_begin(url, url_len, method), http_end(url, url_len, status)
+//   rpc_begin(api), rpc_end(api)
+
+#if defined(HAS_USDT)
+#include <sys/sdt.h>
+
+#define CO_PROBE0(name) DTRACE_PROBE(co, name)
+#define CO_PROBE1(name, a) DTRACE_PROBE1(co, name, a)
+#define CO_PROBE2(name, a, b) DTRACE_PROBE2(co, name, a, b)
+#define CO_PROBE3(name, a, b, c) DTRACE_PROBE3(co, name, a, b, c)
+
+#else
+#define CO_PROBE0(name)
+#define CO_PROBE1(name, a)
+#define CO_PROBE2(name, a, b)
+#define CO_PROBE3(name, a, b, c)
+#endif
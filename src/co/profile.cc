@@ -0,0 +1,295 @@
+#include "sched.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "co/os.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+namespace co {
+namespace xx {
+
+// a CPU sample taken in the SIGPROF handler
+struct prof_sample_t {
+    const void* type;  // type_info of the closure of the coroutine, or NULL
+    uint64_t co;       // id of the running coroutine, 0 if none
+    uint32_t sched;    // id of the scheduler, -1 for other threads
+};
+
+// State of the cpu profiler. The handler only writes to a preallocated array,
+// samples beyond its capacity are dropped.
+struct cpu_prof_t {
+    std::atomic_bool busy;  // a profile is in progress
+    std::atomic_bool on;    // the handler records samples
+    std::atomic_int in;     // number of handlers running
+    std::atomic_size_t n;   // number of samples taken
+    prof_sample_t* v;
+    size_t cap;
+};
+
+static cpu_prof_t g_prof;
+
+// protobuf encoding of the pprof profile.proto
+class pb_writer {
+  public:
+    explicit pb_writer(fastream& s) noexcept : _s(s) {}
+
+    void varint(uint64_t v) {
+        for (; v >= 0x80; v >>= 7) _s.append((char)(v | 0x80));
+        _s.append((char)v);
+    }
+
+    void u64(int f, uint64_t v) {
+        this->varint((uint64_t)(f << 3));
+        this->varint(v);
+    }
+
+    void bytes(int f, const void* p, size_t n) {
+        this->varint((uint64_t)(f << 3 | 2));
+        this->varint(n);
+        _s.append(p, n);
+    }
+
+    void bytes(int f, const fastream& s) { this->bytes(f, s.data(), s.size()); }
+
+  private:
+    fastream& _s;
+};
+
+// string table and functions of a profile, a location is made for each function
+class pb_profile {
+  public:
+    pb_profile() { this->str(""); }
+
+    uint64_t str(const fastring& s) {
+        auto it = _strs.find(s);
+        if (it != _strs.end()) return it->second;
+        const uint64_t i = _strs.size();
+        _strs.insert(std::make_pair(s, i));
+        fastream x(s.size() + 8);
+        pb_writer(x).bytes(6, s.data(), s.size());
+        _tab.append(x.data(), x.size());
+        return i;
+    }
+
+    // id of the function (and its location) named @s
+    uint64_t fn(const fastring& s) {
+        auto it = _fns.find(s);
+        if (it != _fns.end()) return it->second;
+        const uint64_t id = _fns.size() + 1;
+        _fns.insert(std::make_pair(s, id));
+        const uint64_t k = this->str(s);
+        fastream f(32), l(32), x(16);
+        pb_writer(f).u64(1, id);
+        pb_writer(f).u64(2, k);
+        pb_writer(f).u64(3, k);
+        pb_writer(_body).bytes(5, f);
+        pb_writer(x).u64(1, id);
+        pb_writer(l).u64(1, id);
+        pb_writer(l).bytes(4, x);
+        pb_writer(_body).bytes(4, l);
+        return id;
+    }
+
+    fastream& body() noexcept { return _body; }
+    const fastream& strs() const noexcept { return _tab; }
+
+  private:
+    co::hash_map<fastring, uint64_t> _strs;
+    co::hash_map<fastring, uint64_t> _fns;
+    fastream _tab;
+    fastream _body;
+};
+
+// Name of a closure type, demangled if possible. For closures of co like
+// co::xx::Function0<F>, the name of F is used, as pprof drops template arguments.
+static fastring type_name(const void* t) {
+    const char* const s = ((const std::type_info*)t)->name();
+    fastring x;
+#if defined(__GNUC__)
+    int status = 0;
+    char* const p = abi::__cxa_demangle(s, 0, 0, &status);
+    if (p) {
+        x = p;
+        ::free(p);
+    }
+#endif
+    if (x.empty()) x = s;
+
+    const size_t b = x.find('<');
+    if (x.starts_with("co::xx::") && b != x.npos && x.back() == '>') {
+        int depth = 0;
+        size_t e = b + 1;
+        for (; e < x.size() - 1; ++e) {
+            const char c = x[e];
+            if (c == '<' || c == '(' || c == '{') ++depth;
+            if (c == '>' || c == ')' || c == '}') --depth;
+            if (c == ',' && depth == 0) break;
+        }
+        return fastring(x.data() + b + 1, e - b - 1);
+    }
+    return x;
+}
+
+static fastring make_pprof(prof_sample_t* v, size_t n, uint32_t hz, int64_t t, int64_t d) {
+    std::sort(v, v + n, [](const prof_sample_t& a, const prof_sample_t& b) {
+        if (a.sched != b.sched) return a.sched < b.sched;
+        if (a.type != b.type) return a.type < b.type;
+        return a.co < b.co;
+    });
+
+    pb_profile p;
+    fastream& o = p.body();
+    const uint64_t period = 1000000000ULL / hz;
+    const uint64_t k_samples = p.str("samples"), k_count = p.str("count");
+    const uint64_t k_cpu = p.str("cpu"), k_ns = p.str("nanoseconds");
+    const uint64_t k_co = p.str("co");
+    {
+        fastream a(16), b(16);
+        pb_writer(a).u64(1, k_samples);
+        pb_writer(a).u64(2, k_count);
+        pb_writer(b).u64(1, k_cpu);
+        pb_writer(b).u64(2, k_ns);
+        pb_writer(o).bytes(1, a);
+        pb_writer(o).bytes(1, b);
+        pb_writer(o).bytes(11, b);
+    }
+
+    fastring name(64);
+    fastream s(64), ids(32), vals(32), label(16);
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        const prof_sample_t& x = v[i];
+        while (j < n && v[j].sched == x.sched && v[j].type == x.type && v[j].co == x.co) ++j;
+
+        // the stack is [leaf, root], the root is the scheduler or "threads"
+        uint64_t leaf, root;
+        if (x.sched == (uint32_t)-1) {
+            root = p.fn("threads");
+            leaf = p.fn("(thread)");
+        } else {
+            name.clear();
+            name << "sched " << x.sched;
+            root = p.fn(name);
+            leaf = x.type ? p.fn(type_name(x.type)) : p.fn("(scheduler)");
+        }
+
+        s.clear();
+        ids.clear();
+        vals.clear();
+        label.clear();
+        pb_writer(ids).varint(leaf);
+        pb_writer(ids).varint(root);
+        pb_writer(vals).varint(j - i);
+        pb_writer(vals).varint((j - i) * period);
+        pb_writer(s).bytes(1, ids);
+        pb_writer(s).bytes(2, vals);
+        if (x.co) {
+            pb_writer(label).u64(1, k_co);
+            pb_writer(label).u64(3, x.co);
+            pb_writer(s).bytes(3, label);
+        }
+        pb_writer(o).bytes(2, s);
+        i = j;
+    }
+
+    pb_writer(o).u64(9, (uint64_t)t);
+    pb_writer(o).u64(10, (uint64_t)d);
+    pb_writer(o).u64(12, period);
+
+    fastring r(p.strs().size() + o.size());
+    r.append(p.strs().data(), p.strs().size()).append(o.data(), o.size());
+    return r;
+}
+
+#ifndef _WIN32
+static void on_sigprof(int) {
+    auto& g = g_prof;
+    g.in.fetch_add(1);
+    if (g.on.load()) {
+        const size_t i = g.n.fetch_add(1, std::memory_order_relaxed);
+        if (i < g.cap) {
+            prof_sample_t& x = g.v[i];
+            Sched* const s = current_sched();
+            Coroutine* const co = s && s->running_id() ? s->running() : 0;
+            x.type = co ? co->type : 0;
+            x.co = co ? co->id : 0;
+            x.sched = s ? s->id() : (uint32_t)-1;
+        }
+    }
+    g.in.fetch_sub(1);
+}
+
+static void set_prof_timer(uint32_t hz) {
+    struct itimerval t;
+    t.it_interval.tv_sec = 0;
+    t.it_interval.tv_usec = hz ? 1000000 / hz : 0;
+    t.it_value = t.it_interval;
+    setitimer(ITIMER_PROF, &t, 0);
+}
+#endif
+
+}  // namespace xx
+
+fastring cpu_profile(uint32_t ms, uint32_t hz) {
+#ifdef _WIN32
+    (void)ms;
+    (void)hz;
+    return fastring();
+#else
+    auto& g = xx::g_prof;
+    bool busy = false;
+    if (!g.busy.compare_exchange_strong(busy, true)) return fastring();
+
+    // the handler stays installed, it does nothing when the profiler is off
+    static bool installed = [] {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = xx::on_sigprof;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        return sigaction(SIGPROF, &sa, 0) == 0;
+    }();
+    if (!installed) {
+        g.busy.store(false);
+        return fastring();
+    }
+
+    if (hz == 0) hz = 100;
+    if (hz > 1000) hz = 1000;
+    const size_t cap = (size_t)hz * (ms / 1000 + 1) * (os::cpunum() + 1) + 1024;
+    g.v = (xx::prof_sample_t*)::malloc(cap * sizeof(xx::prof_sample_t));
+    assert(g.v);
+    g.cap = cap;
+    g.n.store(0);
+    g.on.store(true);
+
+    const int64_t t = epoch::us() * 1000;
+    const int64_t x = now::ns();
+    xx::set_prof_timer(hz);
+    co::sleep(ms);
+    xx::set_prof_timer(0);
+    const int64_t d = now::ns() - x;
+
+    g.on.store(false);
+    while (g.in.load() != 0);
+    const size_t n = g.n.load();
+    if (n > cap) DLOG << "cpu profile: " << (n - cap) << " samples dropped";
+
+    fastring r = xx::make_pprof(g.v, n < cap ? n : cap, hz, t, d);
+    ::free(g.v);
+    g.v = 0;
+    g.busy.store(false);
+    return r;
+#endif
+}
+
+}  // namespace co
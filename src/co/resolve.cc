@@ -0,0 +1,373 @@
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/log.h"
+#include "co/rand.h"
+#include "co/stl.h"
+#include "co/str.h"
+#include "co/time.h"
+#include "sched.h"
+
+#include <memory>
+#include <mutex>
+
+DEC_uint32(co_dns_timeout);
+DEC_uint32(co_dns_max_ttl);
+DEC_string(co_dns_servers);
+
+namespace co {
+namespace xx {
+
+#ifndef _WIN32
+// Name servers and static hosts, loaded once from /etc/resolv.conf and
+// /etc/hosts. co_dns_servers, if not empty, overrides servers in resolv.conf.
+class dns_conf {
+public:
+    dns_conf() {
+        if (!FLG_co_dns_servers.empty()) {
+            auto v = str::split(FLG_co_dns_servers, ',');
+            for (auto& s : v) this->_add_server(str::strip(s));
+        }
+        else {
+            this->_load_resolv_conf("/etc/resolv.conf");
+        }
+        if (_servers.empty()) this->_add_server("127.0.0.1");
+        this->_load_hosts("/etc/hosts");
+    }
+
+    // server address, sockaddr_in or sockaddr_in6
+    struct server_t
+    {
+        union
+        {
+            sockaddr_in  v4;
+            sockaddr_in6 v6;
+        } addr;
+        int len;
+    };
+
+    const co::vector<server_t>& servers() const noexcept { return _servers; }
+
+    const co::vector<fastring>* hosts(const fastring& key) const {
+        auto it = _hosts.find(key);
+        return it != _hosts.end() ? &it->second : nullptr;
+    }
+
+private:
+    // "ip", "ip:port" or "[ipv6]:port"
+    void _add_server(const fastring& s) {
+        if (s.empty()) return;
+        fastring ip(s);
+        int port = 53;
+        if (s[0] == '[') {
+            const size_t p = s.find(']');
+            if (p == s.npos) return;
+            ip = s.substr(1, p - 1);
+            if (p + 1 < s.size() && s[p + 1] == ':') port = str::to_int32(s.substr(p + 2));
+        }
+        else if (s.find(':') == s.rfind(':') && s.find(':') != s.npos) {
+            const size_t p = s.find(':');
+            ip = s.substr(0, p);
+            port = str::to_int32(s.substr(p + 1));
+        }
+
+        server_t x;
+        if (co::init_addr(&x.addr.v4, ip.c_str(), port)) {
+            x.len = sizeof(x.addr.v4);
+        }
+        else if (co::init_addr(&x.addr.v6, ip.c_str(), port)) {
+            x.len = sizeof(x.addr.v6);
+        }
+        else {
+            WLOG << "invalid dns server: " << s;
+            return;
+        }
+        _servers.push_back(x);
+    }
+
+    static co::vector<fastring> _read_lines(const char* path) {
+        fs::file f;
+        if (!f.open(path, 'r')) return co::vector<fastring>();
+        fastring s = f.read((size_t)f.size());
+        return str::split(s, '\n');
+    }
+
+    void _load_resolv_conf(const char* path) {
+        auto lines = _read_lines(path);
+        for (auto& line : lines) {
+            auto v = str::split(str::strip(line), ' ');
+            if (v.size() >= 2 && v[0] == "nameserver") this->_add_server(str::strip(v[1]));
+        }
+    }
+
+    void _load_hosts(const char* path) {
+        auto lines = _read_lines(path);
+        for (auto& line : lines) {
+            const size_t p = line.find('#');
+            if (p != line.npos) line.resize(p);
+            line.replace("\t", " ");
+            auto v = str::split(str::strip(line), ' ');
+            if (v.size() < 2) continue;
+            in6_addr a;
+            const char t = inet_pton(AF_INET, v[0].c_str(), &a) == 1 ? '4'
+                           : inet_pton(AF_INET6, v[0].c_str(), &a) == 1 ? '6'
+                                                                         : 0;
+            if (!t) continue;
+            for (size_t i = 1; i < v.size(); ++i) {
+                if (v[i].empty()) continue;
+                fastring key(v[i].size() + 2);
+                key.append(t).append(':').append(v[i].lower());
+                _hosts[key].push_back(v[0]);
+            }
+        }
+    }
+
+private:
+    co::vector<server_t>                   _servers;
+    co::hash_map<fastring, co::vector<fastring>> _hosts;
+};
+
+inline dns_conf& dnsconf() {
+    static dns_conf conf;
+    return conf;
+}
+
+// Build a query for host name @name with record type @type (1 for A, 28 for AAAA).
+// Return false if the name is invalid.
+static bool make_query(fastream& q, uint16_t id, const fastring& name, uint16_t type) {
+    const char hdr[12] = {
+        (char)(id >> 8), (char)id, 0x01, 0x00,   // id, flags: recursion desired
+        0x00, 0x01, 0x00, 0x00,                  // qdcount = 1, ancount = 0
+        0x00, 0x00, 0x00, 0x00,                  // nscount = 0, arcount = 0
+    };
+    q.append(hdr, 12);
+    size_t b = 0;
+    while (b < name.size()) {
+        size_t e = name.find('.', b);
+        if (e == name.npos) e = name.size();
+        const size_t n = e - b;
+        if (n == 0 || n > 63) return false;
+        q.append((char)n).append(name.data() + b, n);
+        b = e + 1;
+    }
+    q.append('\0');
+    q.append((char)(type >> 8)).append((char)type).append((char)0).append((char)1);
+    return q.size() <= 512;
+}
+
+// skip a (possibly compressed) name in a DNS message, return the new position or 0
+static size_t skip_name(const uint8_t* m, size_t n, size_t p) {
+    while (p < n) {
+        const uint8_t c = m[p];
+        if (c == 0) return p + 1;
+        if ((c & 0xc0) == 0xc0) return p + 2 <= n ? p + 2 : 0;
+        p += c + 1;
+    }
+    return 0;
+}
+
+inline uint16_t get16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+inline uint32_t get32(const uint8_t* p) { return ((uint32_t)get16(p) << 16) | get16(p + 2); }
+
+// Parse a response, addresses of record type @type are appended to @ips.
+// Return 0 on success, or EAI_NONAME, EAI_AGAIN, EAI_FAIL.
+static int parse_response(const uint8_t* m, size_t n, uint16_t id, uint16_t type,
+                          co::vector<fastring>& ips, uint32_t& ttl) {
+    if (n < 12 || get16(m) != id || !(m[2] & 0x80)) return EAI_FAIL;
+    const int rcode = m[3] & 0x0f;
+    if (rcode == 3) return EAI_NONAME;
+    if (rcode == 2) return EAI_AGAIN;
+    if (rcode != 0) return EAI_FAIL;
+
+    const uint16_t qd = get16(m + 4);
+    const uint16_t an = get16(m + 6);
+    size_t p = 12;
+    for (uint16_t i = 0; i < qd; ++i) {
+        if (!(p = skip_name(m, n, p)) || p + 4 > n) return EAI_FAIL;
+        p += 4;
+    }
+
+    ttl = (uint32_t)-1;
+    char s[INET6_ADDRSTRLEN];
+    for (uint16_t i = 0; i < an; ++i) {
+        if (!(p = skip_name(m, n, p)) || p + 10 > n) return EAI_FAIL;
+        const uint16_t t = get16(m + p);
+        const uint32_t x = get32(m + p + 4);
+        const uint16_t len = get16(m + p + 8);
+        p += 10;
+        if (p + len > n) return EAI_FAIL;
+        if (t == type && (len == 4 || len == 16)) {
+            if (inet_ntop(len == 4 ? AF_INET : AF_INET6, m + p, s, sizeof(s))) {
+                ips.push_back(fastring(s));
+                if (x < ttl) ttl = x;
+            }
+        }
+        p += len;
+    }
+    return ips.empty() ? EAI_NONAME : 0;
+}
+
+// Send the query to each server in turn, the calling coroutine is suspended while
+// waiting for the response.
+static int query(const fastring& name, int af, co::vector<fastring>& ips, uint32_t& ttl, int ms) {
+    const uint16_t type = af == AF_INET6 ? 28 : 1;
+    const uint16_t id = (uint16_t)co::rand();
+    fastream q(64);
+    if (!make_query(q, id, name, type)) return EAI_NONAME;
+
+    int err = EAI_AGAIN;
+    char buf[1024];
+    for (auto& s : dnsconf().servers()) {
+        const sock_t fd = co::udp_socket(s.addr.v4.sin_family);
+        if (fd == (sock_t)-1) continue;
+        int r = co::sendto(fd, q.data(), (int)q.size(), &s.addr, s.len, ms);
+        const int64_t deadline = now::ms() + ms;
+        while (r >= 0) {
+            // responses with a wrong id are dropped, keep waiting until timeout
+            int64_t left = deadline - now::ms();
+            if (left <= 0) break;
+            union { sockaddr_in v4; sockaddr_in6 v6; } from;
+            int len = sizeof(from);
+            r = co::recvfrom(fd, buf, sizeof(buf), &from, &len, (int)left);
+            if (r <= 0) break;
+            if (len != s.len || memcmp(&from, &s.addr, len) != 0) continue;
+            if (r < 12 || get16((uint8_t*)buf) != id) continue;
+            err = parse_response((uint8_t*)buf, r, id, type, ips, ttl);
+            break;
+        }
+        co::close(fd);
+        if (err == 0 || err == EAI_NONAME) break;
+    }
+    return err;
+}
+#endif
+
+// the TTL cache of resolved names, concurrent lookups of a name share one query
+class dns_cache {
+public:
+    struct entry_t
+    {
+        co::vector<fastring> ips;
+        int64_t              expire;
+    };
+
+    struct flight_t
+    {
+        flight_t() : ev(true, false), err(0) {}
+        co::event            ev;
+        int                  err;
+        co::vector<fastring> ips;
+    };
+
+    // Return true if the name is found in the cache or resolved by another
+    // coroutine, otherwise @f is set and the caller should do the query.
+    bool get(const fastring& key, co::vector<fastring>& ips, int& err,
+             std::shared_ptr<flight_t>& f) {
+        std::shared_ptr<flight_t> x;
+        {
+            std::lock_guard<std::mutex> g(_m);
+            auto it = _cache.find(key);
+            if (it != _cache.end()) {
+                if (it->second.expire > now::ms()) {
+                    ips = it->second.ips;
+                    return true;
+                }
+                _cache.erase(it);
+            }
+            auto& y = _flights[key];
+            if (!y) {
+                f = y = std::make_shared<flight_t>();
+                return false;
+            }
+            x = y;
+        }
+        x->ev.wait();
+        err = x->err;
+        if (err == 0) ips = x->ips;
+        return true;
+    }
+
+    void put(const fastring& key, const std::shared_ptr<flight_t>& f, uint32_t ttl) {
+        {
+            std::lock_guard<std::mutex> g(_m);
+            if (f->err == 0 && ttl > 0) {
+                if (ttl > FLG_co_dns_max_ttl) ttl = FLG_co_dns_max_ttl;
+                auto& e = _cache[key];
+                e.ips = f->ips;
+                e.expire = now::ms() + (int64_t)ttl * 1000;
+            }
+            _flights.erase(key);
+        }
+        f->ev.signal();
+    }
+
+private:
+    std::mutex                                              _m;
+    co::hash_map<fastring, entry_t>                         _cache;
+    co::hash_map<fastring, std::shared_ptr<flight_t>>       _flights;
+};
+
+inline dns_cache& dnscache() {
+    static dns_cache c;
+    return c;
+}
+
+}   // namespace xx
+
+int resolve(const char* host, int af, co::vector<fastring>& ips, int ms) {
+    if (!host || !*host) return EAI_NONAME;
+    if (af != AF_INET && af != AF_INET6) return EAI_FAMILY;
+
+    char a[sizeof(in6_addr)];
+    if (inet_pton(af, host, a) == 1) {
+        ips.push_back(fastring(host));
+        return 0;
+    }
+
+#ifndef _WIN32
+    if (xx::current_sched()) {
+        const fastring name(fastring(host).lower());
+        fastring key(name.size() + 2);
+        key.append(af == AF_INET6 ? '6' : '4').append(':').append(name);
+
+        const auto h = xx::dnsconf().hosts(key);
+        if (h) {
+            ips.append(*h);
+            return 0;
+        }
+
+        int err = 0;
+        co::vector<fastring> v;
+        std::shared_ptr<xx::dns_cache::flight_t> f;
+        if (xx::dnscache().get(key, v, err, f)) {
+            if (err == 0) ips.append(v);
+            return err;
+        }
+
+        uint32_t ttl = 0;
+        if (ms < 0) ms = (int)FLG_co_dns_timeout;
+        f->err = xx::query(name, af, f->ips, ttl, ms);
+        xx::dnscache().put(key, f, ttl);
+        if (f->err == 0) ips.append(f->ips);
+        return f->err;
+    }
+#endif
+
+    // not in coroutine, use the system resolver
+    addrinfo hints, *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = af;
+    hints.ai_socktype = SOCK_STREAM;
+    const int r = getaddrinfo(host, nullptr, &hints, &res);
+    if (r != 0) return r;
+    char s[INET6_ADDRSTRLEN];
+    for (auto p = res; p; p = p->ai_next) {
+        const void* x = af == AF_INET ? (void*)&((sockaddr_in*)p->ai_addr)->sin_addr
+                                      : (void*)&((sockaddr_in6*)p->ai_addr)->sin6_addr;
+        if (inet_ntop(af, x, s, sizeof(s))) ips.push_back(fastring(s));
+    }
+    freeaddrinfo(res);
+    return ips.empty() ? EAI_NONAME : 0;
+}
+
+}   // namespace co
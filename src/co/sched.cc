@@ -1,15 +1,80 @@
 #include "sched.h"
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
+#include <typeinfo>
 
 #include "co/os.h"
 #include "co/rand.h"
+#include "co/str.h"
 
-DEF_uint16(co_sched_num, os::cpunum(), ">>#1 number of coroutine schedulers");
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+DEF_uint16(co_sched_num, os::topology().cpu_limit, ">>#1 number of coroutine schedulers");
 DEF_uint32(co_stack_num, 8, ">>#1 number of stacks per scheduler, must be power of 2");
 DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines");
+DEF_string(co_stack_policy, "idx",
+           ">>#1 shared stack a coroutine is bound to when it starts: idx for the one chosen by "
+           "index of the coroutine, lru for a free or the least recently used one, "
+           "see also co::set_stack_policy()");
 DEF_bool(co_sched_log, false, ">>#1 print logs for coroutine schedulers");
+DEF_bool(co_work_steal, false, ">>#1 idle schedulers steal new tasks created by go() from busy ones");
+DEF_bool(co_lockfree_queue, false, ">>#1 use lock-free queues for new and ready tasks of schedulers");
+DEF_bool(co_timer_wheel, false, ">>#1 use a hierarchical timer wheel instead of a multimap for timers");
+DEF_bool(co_coarse_timer, false,
+         ">>#1 read time for timers from the coarse clock, cheaper, but less accurate");
+DEF_bool(co_io_uring, false, ">>#1 use io_uring for co::recv, co::send and co::accept on linux");
+DEF_uint32(co_accept_ex_num, 16,
+           ">>#1 AcceptEx operations kept posted on a listening socket on windows, 0 to disable");
+DEF_uint32(co_epoll_events, 1024, ">>#1 max number of I/O events handled by a single epoll wait");
+DEF_uint32(co_busy_poll_us, 0, ">>#1 spin for microseconds polling the epoll before blocking, 0 to disable");
+DEF_string(co_sched_policy, "cputime",
+           ">>#1 policy of choosing a scheduler for go(): cputime, p2c or least. "
+           "p2c picks the less loaded one of two random schedulers, least scans all");
+DEF_uint32(co_hi_quota, 256,
+           ">>#1 max high-priority tasks run ahead of normal tasks in a scheduler loop, "
+           "the rest run after normal tasks, so that normal tasks will not be starved");
+DEF_uint32(co_watchdog_ms, 0,
+           ">>#1 warn about coroutines running longer than this without yielding, 0 to disable");
+DEF_bool(co_watchdog_dump, false,
+         ">>#1 also dump the stack of the scheduler thread running a long coroutine, not for windows");
+DEF_uint32(co_time_slice_us, 10000, ">>#1 time slice (us) of a coroutine used by co::maybe_yield()");
+DEF_bool(co_sched_affinity, false, ">>#1 pin scheduler i to cpu i, or to the ith cpu in co_sched_cpus");
+DEF_string(co_sched_cpus, "",
+           ">>#1 cpus for pinning schedulers, e.g. 0,2,4-7; schedulers are pinned if not empty");
+DEF_bool(co_sched_numa_local, false,
+         ">>#1 allocate memory of a scheduler from its local numa node, linux only");
+DEF_bool(co_huge_pages, false,
+         ">>#1 map shared stacks, coroutine blocks and the log buffer with 2MB huge pages, "
+         "MAP_HUGETLB or transparent huge pages, linux only");
+DEF_bool(co_dedicated_stack, false,
+         ">>#1 each coroutine runs on its own mmap'ed stack of co_stack_size bytes with a "
+         "guard page, no stack copy on context switch");
+DEF_uint32(co_dns_timeout, 3000, ">>#1 timeout in ms of a DNS query sent to a name server by co::resolve");
+DEF_uint32(co_dns_max_ttl, 300, ">>#1 max seconds a name resolved by co::resolve is cached, 0 to disable the cache");
+DEF_string(co_dns_servers, "",
+           ">>#1 name servers used by co::resolve, e.g. 8.8.8.8,[::1]:53; use /etc/resolv.conf if empty");
+DEF_bool(co_file_offload, false,
+         ">>#1 hooked read/write on regular files in coroutines run in blocking-I/O threads");
+DEF_uint32(co_trim_ms, 3000,
+           ">>#1 release unused pages of coroutine stacks and empty blocks of coroutines every "
+           "N ms when the scheduler is about to block, 0 to disable");
+DEF_bool(co_stack_profile, false,
+         ">>#1 record sizes of stacks saved by coroutines, see co::stack_profile()");
+DEF_bool(co_trace, false,
+         ">>#1 record scheduler events in a ring per scheduler, see co::trace_json()");
+DEF_uint32(co_trace_events, 65536, ">>#1 max events kept in the trace ring of a scheduler");
+DEF_uint32(co_offload_threads, 4, ">>#1 number of threads for co::run_blocking() and file I/O offloaded from coroutines");
 
 #ifdef _MSC_VER
 extern LONG WINAPI _co_on_exception(PEXCEPTION_POINTERS p);
@@ -27,38 +92,206 @@ inline void cleanup_sock() {}
 
 namespace xx {
 
+inline size_t page_size() {
+#ifdef _WIN32
+    static size_t _ps = []() {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return (size_t)si.dwPageSize;
+    }();
+#else
+    static size_t _ps = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    return _ps;
+}
+
+// cpus that can be set in an affinity mask are in [0, max_cpus())
+static int max_cpus() {
+#if defined(_WIN32)
+    return (int)(sizeof(DWORD_PTR) * 8);
+#elif defined(__linux__)
+    return CPU_SETSIZE;
+#else
+    return 1024;  // pinning is not supported, cpus are only parsed
+#endif
+}
+
+// parse the decimal cpu in [b, e), return -1 if it is not a cpu in [0, max)
+static int parse_cpu(const char* b, const char* e, int max) {
+    if (b == e) return -1;
+    int c = 0;
+    for (; b < e; ++b) {
+        if (*b < '0' || *b > '9') return -1;
+        c = c * 10 + (*b - '0');
+        if (c >= max) return -1;
+    }
+    return c;
+}
+
+// parse a cpu list like "0,2,4-7", invalid items are ignored
+static co::vector<int> parse_cpus(const fastring& s) {
+    co::vector<int> v;
+    const int max = max_cpus();
+    auto items = str::split(s, ',');
+    for (size_t i = 0; i < items.size(); ++i) {
+        fastring& x = items[i];
+        x.strip();
+        if (x.empty()) continue;
+        const char* const b = x.data();
+        const char* const e = b + x.size();
+        const char* const p = (const char*)memchr(b, '-', x.size());
+        const int lo = parse_cpu(b, p ? p : e, max);
+        const int hi = p ? parse_cpu(p + 1, e, max) : lo;
+        if (lo < 0 || hi < lo) {
+            WLOG << "invalid item in co_sched_cpus: " << x;
+            continue;
+        }
+        for (int c = lo; c <= hi; ++c) v.push_back(c);
+    }
+    return v;
+}
+
+// pin the current thread to @cpu
+static bool set_affinity(int cpu) {
+    if (cpu < 0 || cpu >= max_cpus()) return false;
+#if defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;  // not supported on mac
+#endif
+}
+
+// Let the kernel allocate pages touched by the current thread from its local
+// numa node, regardless of the memory policy of the process.
+static bool set_numa_local() {
+#ifdef __linux__
+    const int mpol_local = 4;  // MPOL_LOCAL in <linux/mempolicy.h>
+    return syscall(__NR_set_mempolicy, mpol_local, (void*)0, (unsigned long)0) == 0;
+#else
+    return false;
+#endif
+}
+
+// map @size bytes for a stack with a guard page below it, return the stack bottom
+static char* alloc_stack(size_t size) {
+    const size_t ps = page_size();
+#ifdef _WIN32
+    char* p = (char*)VirtualAlloc(0, size + ps, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    CHECK(p) << "alloc stack failed: " << co::strerror();
+    DWORD old;
+    VirtualProtect(p, ps, PAGE_READWRITE | PAGE_GUARD, &old);
+#else
+    char* p = (char*)::mmap(0, size + ps, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(p != (char*)MAP_FAILED) << "alloc stack failed: " << co::strerror();
+    ::mprotect(p, ps, PROT_NONE);
+#endif
+    return p + ps;
+}
+
+static void free_stack(char* p, size_t size) {
+    const size_t ps = page_size();
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(p - ps, 0, MEM_RELEASE);
+#else
+    ::munmap(p - ps, size + ps);
+#endif
+}
+
+// Release whole pages in [p, e) of a stack to the OS. They are zero-filled on
+// the next touch. MADV_DONTNEED drops them at once on linux, while MADV_FREE
+// elsewhere lets the OS take them back lazily.
+static void release_pages(char* p, char* e) {
+    const uintptr_t ps = page_size();
+    const uintptr_t b = ((uintptr_t)p + ps - 1) & ~(ps - 1);
+    const uintptr_t x = (uintptr_t)e & ~(ps - 1);
+    if (x <= b) return;
+#if defined(_WIN32)
+    VirtualFree((void*)b, x - b, MEM_DECOMMIT);
+    VirtualAlloc((void*)b, x - b, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    ::madvise((void*)b, x - b, MADV_DONTNEED);
+#else
+    ::madvise((void*)b, x - b, MADV_FREE);
+#endif
+}
+
 Sched::Sched(uint32_t id, uint32_t sched_num, uint32_t stack_num, uint32_t stack_size)
     : _cputime(0),
       _ev(),
-      _epoll(new Epoll(id)),
+      _epoll(new Epoll(id, (int)FLG_co_epoll_events)),
+#ifdef __linux__
+      _uring(0),
+#endif
       _task_mgr(),
       _timer_mgr(),
       _wait_ms(-1),
+      _wait_us(-1),
       _timeout(false),
-      _bufs(128),
+      _self_signaled(false),
+      _spin_us(FLG_co_busy_poll_us),
+      _hi_quota(FLG_co_hi_quota),
+      _trace(FLG_co_trace ? new TraceRing(FLG_co_trace_events) : 0),
+      _slice_sw(0),
+      _slice_us(0),
+      _buf_pool(),
       _co_pool(),
       _running(0),
       _id(id),
       _sched_num(sched_num),
       _stack_num(stack_num),
       _stack_size(stack_size),
-      _stack((Stack*)::calloc(stack_num, sizeof(Stack))) {
+      _stack((Stack*)::calloc(stack_num, sizeof(Stack))),
+      _huge_stack(0),
+      _dedicated(FLG_co_dedicated_stack),
+      _stack_pool(),
+      _trim_us(0),
+      _stack_used(false),
+      _trim_all(false),
+      _seed(co::rand()),
+      _peers(0),
+      _cpu(-1) {
     _main_co = _co_pool.pop();  // id 0 is reserved for _main_co
     _main_co->sched = this;
     // _stack = (Stack*)::calloc(stack_num, sizeof(Stack));
     assert(_epoll);
     assert(_stack);
+#ifdef __linux__
+    if (FLG_co_io_uring) {
+        _uring = new IoUring(1024);
+        if (!_uring->ok() || !_epoll->add_ev_uring(_uring->fd())) {
+            WLOG << "sched " << id << " fallback to epoll as io_uring is not available";
+            delete _uring;
+            _uring = 0;
+        }
+    }
+#endif
 }
 
 Sched::~Sched() {
     this->stop();
     delete _epoll;
-    for (size_t i = 0; i < _bufs.size(); ++i) {
-        void* p = _bufs[i];
-        god::cast<Buffer*>(&p)->reset();
+#ifdef __linux__
+    delete _uring;
+#endif
+    _buf_pool.clear();
+    for (uint32_t i = 0; i < _stack_num; ++i) {
+        if (_stack[i].p && !this->in_huge_stack(_stack[i].p)) free_stack(_stack[i].p, _stack_size);
+    }
+    if (_huge_stack) free_huge(_huge_stack, (size_t)_stack_num * _stack_size);
+    for (size_t i = 0; i < _stack_pool.size(); ++i) {
+        free_stack(_stack_pool[i]->p, _stack_size);
+        ::free(_stack_pool[i]);
     }
-    _bufs.clear();
+    _stack_pool.clear();
     ::free(_stack);
+    delete _trace.load();
 }
 
 void Sched::stop() {
@@ -79,6 +312,191 @@ void Sched::stop() {
     }
 }
 
+Stack* Sched::pop_stack() {
+    if (!_stack_pool.empty()) {
+        Stack* s = _stack_pool.pop_back();
+        s->trimmed = false;
+        return s;
+    }
+    Stack* s = (Stack*)::malloc(sizeof(Stack));
+    assert(s);
+    s->p = alloc_stack(_stack_size);
+    s->top = s->p + _stack_size;
+    s->co = 0;
+    s->trimmed = false;
+    return s;
+}
+
+char* Sched::map_shared_stack(Stack* s) {
+    if (FLG_co_huge_pages) {
+        if (!_huge_stack) _huge_stack = (char*)alloc_huge((size_t)_stack_num * _stack_size);
+        if (_huge_stack) return _huge_stack + (s - _stack) * _stack_size;
+    }
+    return alloc_stack(_stack_size);
+}
+
+// A deep call may dirty many pages of a stack, and they stay resident after it
+// returned. Pages below the part in use, that is, [ctx, top) of the coroutine
+// owning a shared stack, are released here, except a few ones right below it,
+// which are likely to be used again soon. Dedicated stacks in the pool are not
+// used at all, they are released once, or freed if @all is true. Shared stacks
+// in huge pages are left alone, releasing part of a huge page would split it.
+void Sched::trim(bool all) {
+    const size_t keep = 16 * page_size();
+    if (!_dedicated) {
+        for (uint32_t i = 0; i < _stack_num; ++i) {
+            Stack& s = _stack[i];
+            if (!s.p || this->in_huge_stack(s.p)) continue;
+            char* const low = s.co && s.co->ctx ? (char*)s.co->ctx : s.top;
+            if (low - s.p > (ptrdiff_t)keep) release_pages(s.p, low - keep);
+        }
+    }
+    if (all) {
+        for (size_t i = 0; i < _stack_pool.size(); ++i) {
+            free_stack(_stack_pool[i]->p, _stack_size);
+            ::free(_stack_pool[i]);
+        }
+        _stack_pool.clear();
+        _buf_pool.clear();
+    }
+    for (size_t i = 0; i < _stack_pool.size(); ++i) {
+        Stack* const s = _stack_pool[i];
+        if (!s->trimmed) {
+            release_pages(s->p, s->top - keep);
+            s->trimmed = true;
+        }
+    }
+    const int n = _co_pool.trim();
+    SCHEDLOG << "sched " << _id << " trimmed, coroutine blocks freed: " << n;
+}
+
+void Sched::profile_stack(Coroutine* co, size_t n) {
+    auto& p = _stack_prof;
+    const uint64_t kb = (n + 1023) >> 10;
+    const uint32_t i = kb <= 1 ? 0 : 64 - co::xx::flat::clz(kb - 1);
+    inc(p.hist[i < 15 ? i : 15]);
+    if (n > p.max_bytes.load(std::memory_order_relaxed)) {
+        p.max_bytes.store(n, std::memory_order_relaxed);
+    }
+    const char* site = typeid(*co->cb).name();
+    std::lock_guard<std::mutex> g(p.mtx);
+    auto& x = p.sites[site];
+    ++x.first;
+    if (n > x.second) x.second = n;
+}
+
+void Sched::push_stack(Stack* s) {
+    s->co = 0;
+    if (_stack_pool.size() < 1024) {
+        _stack_pool.push_back(s);
+    } else {
+        free_stack(s->p, _stack_size);
+        ::free(s);
+    }
+}
+
+#ifdef __linux__
+void Sched::handle_uring() {
+    _uring->reap([this](void* ud, int res) {
+        uring_op_t* const op = (uring_op_t*)ud;
+        op->res = res;
+        op->done = 1;
+        decltype(op->x.state)::value_type state{st_wait};
+        if (op->x.state.compare_exchange_strong(state, st_ready, std::memory_order_relaxed,
+                                                std::memory_order_relaxed)) {
+            this->resume(op->x.co);
+        }
+    });
+}
+#endif
+
+int Sched::wait_events() {
+    // time(us) to wait for the next timer, -1 for no timeout
+    int64_t us = _wait_ms == (uint32_t)-1 ? -1 : _wait_ms * 1000LL;
+    if (_wait_us >= 0 && (us < 0 || _wait_us < us)) us = _wait_us;
+
+    // waits that do not block are not traced, there is one in each loop
+    if (unlikely(FLG_co_trace) && us != 0) {
+        this->trace(TraceRing::tr_wait, 0, us < 0 ? (uint32_t)-1 : (uint32_t)((us + 999) / 1000));
+        const int n = this->poll_events(us);
+        this->trace(TraceRing::tr_wake, 0, n > 0 ? (uint32_t)n : 0);
+        return n;
+    }
+    return this->poll_events(us);
+}
+
+int Sched::poll_events(int64_t us) {
+    if (_spin_us > 0 && us != 0) {
+        // spin no longer than the time to wait for the next timer
+        const int64_t max_us = us < 0 ? _spin_us : std::min<int64_t>(_spin_us, us);
+        co::Timer t;
+        do {
+            const int n = _epoll->wait(0);
+            if (n != 0) {
+                if (n > 0) _poll_stats.spin_hits.fetch_add(1, std::memory_order_relaxed);
+                return n;
+            }
+        } while (t.us() < max_us);
+
+        _poll_stats.spin_misses.fetch_add(1, std::memory_order_relaxed);
+        if (us > 0) {
+            us -= t.us();
+            if (us <= 0) return 0;
+        }
+    }
+    if (us != 0) _poll_stats.blocking_waits.fetch_add(1, std::memory_order_relaxed);
+    return us < 0 ? _epoll->wait(-1) : _epoll->wait_us(us);
+}
+
+// number of schedulers blocked in epoll wait, used in work-stealing mode
+static std::atomic_uint32_t g_nidle{0};
+
+// policy of shared stacks for new coroutines, parsed from co_stack_policy when the
+// schedulers start, and changed with co::set_stack_policy()
+enum { stack_idx = 0, stack_lru = 1 };
+static std::atomic_int g_stack_policy{stack_idx};
+
+static int parse_stack_policy(const char* s) {
+    if (strcmp(s, "idx") == 0) return stack_idx;
+    if (strcmp(s, "lru") == 0) return stack_lru;
+    return -1;
+}
+
+void Sched::add_free_task(Closure* cb) {
+    _task_mgr.add_free_task(cb);
+    this->signal();
+    if (g_nidle.load() > 0 && !_idle.load()) this->wake_idle_peer();
+}
+
+void Sched::wake_idle_peer() {
+    const auto& v = *_peers;
+    for (size_t i = 1; i < v.size(); ++i) {
+        Sched* const s = v[(_id + i) % v.size()];
+        if (s->_idle.load(std::memory_order_relaxed) && !s->parked()) {
+            s->_epoll->signal();
+            return;
+        }
+    }
+}
+
+size_t Sched::steal(co::vector<Closure*>& v) {
+    const auto& p = *_peers;
+    const uint32_t n = (uint32_t)p.size();
+    const uint32_t x = co::rand(_seed) % n;
+    for (uint32_t i = 0; i < n; ++i) {
+        Sched* const s = p[(x + i) % n];
+        if (s == this || s->_idle.load(std::memory_order_relaxed)) continue;
+        if (s->_task_mgr.free_task_num() == 0) continue;
+        const size_t k = s->_task_mgr.steal_tasks(v);
+        if (k > 0) {
+            SCHEDLOG << "steal " << k << " tasks from sched " << s->id();
+            this->trace(TraceRing::tr_steal, s->id(), (uint32_t)k);
+            return k;
+        }
+    }
+    return 0;
+}
+
 void Sched::main_func(tb_context_from_t from) {
     ((Coroutine*)from.priv)->ctx = from.ctx;
 #ifdef _MSC_VER
@@ -103,14 +521,45 @@ void Sched::main_func(tb_context_from_t from) {
  *       |             v
  *       <-------- co->cb->run():  run on _stack
  */
+// The stack with the fewest coroutines bound to it is taken. Among them, a free
+// one is preferred as nothing is saved, then the least recently used one, whose
+// owner is the least likely to be resumed soon.
+Stack* Sched::pick_stack() {
+    Stack* r = _stack;
+    for (uint32_t i = 1; i < _stack_num; ++i) {
+        Stack* const s = &_stack[i];
+        if (s->refs != r->refs) {
+            if (s->refs < r->refs) r = s;
+        } else if (!s->co != !r->co) {
+            if (!s->co) r = s;
+        } else if (s->used < r->used) {
+            r = s;
+        }
+    }
+    return r;
+}
+
 void Sched::resume(Coroutine* co) {
     CHECK_EQ(co->sched, this);
     tb_context_from_t from;
+    if (co->ctx == 0 && !_dedicated) {
+        // the policy may be changed at runtime, it applies to new coroutines
+        if (g_stack_policy.load(std::memory_order_relaxed) == stack_lru) {
+            co->stack = this->pick_stack();
+        }
+        ++co->stack->refs;
+    }
     Stack* const s = co->stack;
     _running = co;
+    _running_id.store(co->id, std::memory_order_relaxed);
+    inc(_stats.switches);
+    s->used = _stats.switches.load(std::memory_order_relaxed);
+    this->trace(TraceRing::tr_resume, co->id, 0);
+    CO_PROBE2(resume, _id, co->id);
+    _stack_used = true;
     if (s->p == 0) {
-        // init stack
-        s->p = (char*)::malloc(_stack_size);
+        // init stack, pages are committed lazily by the OS on the first touch
+        s->p = this->map_shared_stack(s);
         s->top = s->p + _stack_size;
         s->co = co;
     }
@@ -129,18 +578,20 @@ void Sched::resume(Coroutine* co) {
 
     } else {
         // remove timer before resume the coroutine
-        if (co->it != _timer_mgr.end()) {
-            SCHEDLOG << "del timer: " << co->it;
-            _timer_mgr.del_timer(co->it);
-            co->it = _timer_mgr.end();
+        if (_timer_mgr.has_timer(co)) {
+            SCHEDLOG << "del timer of co(" << co << ")";
+            _timer_mgr.del_timer(co);
         }
 
         // resume suspended coroutine
         SCHEDLOG << "resume co(" << co << ")" << (void*)co->id
                  << " with load stack: " << co->buf.size();
         if (s->co != co) {
-            // save other co stack
-            this->save_stack(s->co);
+            // save other co stack, the stack is free if the last one on it exited
+            if (s->co) {
+                this->save_stack(s->co);
+                inc(_stats.stack_collisions);
+            }
             // load co statck
             CHECK_EQ(s->top, (char*)co->ctx + co->buf.size());
             memcpy(co->ctx, co->buf.data(), co->buf.size());  // restore stack data
@@ -153,32 +604,108 @@ void Sched::resume(Coroutine* co) {
         // yield() was called in the coroutine, update context for it
         assert(_running == from.priv);
         _running->ctx = from.ctx;
+        this->trace(TraceRing::tr_yield, _running->id, 0);
+        CO_PROBE2(yield, _id, _running->id);
         SCHEDLOG << "yield co(" << _running << ")" << (void*)_running->id;
     } else {
         // the coroutine has terminated, recycle it
+        this->trace(TraceRing::tr_exit, _running->id, 0);
+        CO_PROBE2(exit, _id, _running->id);
         _running->stack->co = 0;
+        if (!_dedicated) --_running->stack->refs;
         SCHEDLOG << "recycle co(" << _running << ")" << (void*)_running->id;
         this->recycle(_running);
     }
+    _running_id.store(0, std::memory_order_relaxed);
+}
+
+bool Sched::maybe_yield() {
+    // The time slice starts at the first call after the coroutine was resumed,
+    // so no clock reading is needed in resume().
+    const uint64_t sw = _stats.switches.load(std::memory_order_relaxed);
+    const int64_t us = now::us();
+    if (sw != _slice_sw) {
+        _slice_sw = sw;
+        _slice_us = us;
+        return false;
+    }
+    if (us - _slice_us < (int64_t)FLG_co_time_slice_us) return false;
+    this->add_ready_task(_running);
+    this->yield();
+    return true;
 }
 
 void Sched::loop() {
     // gSched = this;
     current_sched() = this;
+#ifndef _WIN32
+    _tid = pthread_self();
+#endif
+    if (_cpu >= 0) {
+        if (set_affinity(_cpu)) {
+            SCHEDLOG << "sched " << _id << " is pinned to cpu " << _cpu;
+        } else {
+            WLOG << "failed to pin sched " << _id << " to cpu " << _cpu;
+        }
+    }
+    if (FLG_co_sched_numa_local && !set_numa_local()) {
+        WLOG << "failed to set local numa memory policy for sched " << _id;
+    }
     co::vector<Closure*> new_tasks(512);
     co::vector<Coroutine*> ready_tasks(512);
-    co::Timer timer;
+    co::vector<Closure*> hi_tasks;
+    int64_t t0 = now::us(), t1;  // time the loop starts waiting, and stops waiting
+    const bool steal = FLG_co_work_steal && _peers && _sched_num > 1;
 
     while (!_stopped) {
-        int n = _epoll->wait(_wait_ms);
+#ifdef __linux__
+        if (_uring && _uring->pending() > 0) _uring->submit();
+#endif
+        int n;
+        if (unlikely(FLG_co_trace) && !_trace.load(std::memory_order_relaxed)) {
+            _trace.store(new TraceRing(FLG_co_trace_events), std::memory_order_release);
+        }
+        if (_self_signaled) {
+            _self_signaled = false;
+            _wait_ms = 0;  // tasks were added in this thread, check them without blocking
+        }
+        if (_trim_all.load(std::memory_order_relaxed)) {
+            _trim_all.store(false, std::memory_order_relaxed);
+            _trim_us = t0;
+            _stack_used = false;
+            this->trim(true);
+        } else if (FLG_co_trim_ms > 0 && _stack_used && _wait_ms != 0) {
+            const int64_t d = _trim_us + FLG_co_trim_ms * 1000LL - t0;
+            if (d <= 0) {
+                _trim_us = t0;
+                _stack_used = false;
+                this->trim(false);
+            } else if (_wait_ms > (uint32_t)((d + 999) / 1000)) {
+                _wait_ms = (uint32_t)((d + 999) / 1000);  // wake up to trim the stacks
+            }
+        }
+        if (steal && _wait_ms != 0 && !this->parked()) {
+            // Mark this scheduler as idle before checking peers for the last time,
+            // a producer will either see the idle flag or the task will be stolen here.
+            _idle.store(true);
+            g_nidle.fetch_add(1);
+            if (this->steal(new_tasks) > 0) _wait_ms = 0;  // stolen tasks will run below
+            n = this->wait_events();
+            g_nidle.fetch_sub(1);
+            _idle.store(false);
+        } else {
+            n = this->wait_events();
+        }
+        t1 = now::us();
+        inc(_stats.wait_us, t1 - t0);
         if (_stopped) break;
 
         if (unlikely(n == -1)) {
             if (co::error() != EINTR) ELOG << "epoll wait error: " << co::strerror();
+            t0 = t1;
             continue;
         }
 
-        if (_sched_num > 1) timer.restart();
         SCHEDLOG << "> check I/O tasks ready to resume, num: " << n;
 
         for (int i = 0; i < n; ++i) {
@@ -187,9 +714,24 @@ void Sched::loop() {
                 _epoll->handle_ev_pipe();
                 continue;
             }
+#ifdef __linux__
+            if (_uring && _epoll->is_ev_uring(ev)) {
+                this->handle_uring();
+                continue;
+            }
+#endif
 
 #if defined(_WIN32)
             auto info = xx::per_io_info(ev.lpOverlapped);
+            if (info->state == st_accept) {
+                Coroutine* const c = on_accept_ex_done(info, ev.dwNumberOfBytesTransferred);
+                if (c && c->sched == this) {
+                    this->resume(c);
+                } else if (c) {
+                    c->sched->add_ready_task(c);
+                }
+                continue;
+            }
             auto co = (Coroutine*)info->co;
             decltype(info->state) state(st_wait);
             if (reinterpret_cast<std::atomic_uint8_t*>(&info->state)
@@ -215,13 +757,39 @@ void Sched::loop() {
             if (rco) this->resume(&_co_pool[rco]);
             if (wco) this->resume(&_co_pool[wco]);
 #else
-            this->resume((Coroutine*)_epoll->user_data(ev));
+            // errors of deleting events carry no user data
+            auto co = (Coroutine*)_epoll->user_data(ev);
+            if (co) this->resume(co);
 #endif
         }
 
         SCHEDLOG << "> check tasks ready to resume..";
         do {
             _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            _task_mgr.get_hi_tasks(hi_tasks);
+            if (!_local_ready.empty()) {
+                ready_tasks.append(_local_ready.data(), _local_ready.size());
+                _local_ready.clear();
+            }
+            _stats.ready_tasks.store(new_tasks.size() + ready_tasks.size() + hi_tasks.size(),
+                                     std::memory_order_relaxed);
+
+            // High-priority tasks run first. No more than _hi_quota of them run
+            // ahead of normal tasks, the rest run after normal tasks.
+            size_t quota = _hi_quota, h = 0;
+            if (!hi_tasks.empty()) {
+                SCHEDLOG << ">> resume high-priority new tasks, num: " << hi_tasks.size();
+                for (; h < hi_tasks.size() && quota > 0; ++h, --quota) {
+                    this->resume(this->new_coroutine(hi_tasks[h], 1));
+                }
+            }
+            for (size_t i = 0; i < ready_tasks.size() && quota > 0; ++i) {
+                if (ready_tasks[i]->prio) {
+                    this->resume(ready_tasks[i]);
+                    ready_tasks[i] = 0;
+                    --quota;
+                }
+            }
 
             if (!new_tasks.empty()) {
                 const size_t c = new_tasks.capacity();
@@ -241,23 +809,32 @@ void Sched::loop() {
                 const size_t s = ready_tasks.size();
                 SCHEDLOG << ">> resume ready tasks, num: " << s;
                 for (size_t i = 0; i < s; ++i) {
-                    this->resume(ready_tasks[i]);
+                    if (ready_tasks[i]) this->resume(ready_tasks[i]);
                 }
                 if (c >= 8192 && s <= (c >> 1)) {
                     co::vector<Coroutine*>(s).swap(ready_tasks);
                 }
                 ready_tasks.clear();
             }
+
+            if (!hi_tasks.empty()) {
+                for (; h < hi_tasks.size(); ++h) {
+                    this->resume(this->new_coroutine(hi_tasks[h], 1));
+                }
+                hi_tasks.clear();
+            }
         } while (0);
 
         SCHEDLOG << "> check timedout tasks..";
         do {
             _wait_ms = _timer_mgr.check_timeout(ready_tasks);
+            _wait_us = _timer_mgr.check_us_timeout(ready_tasks);
 
             if (!ready_tasks.empty()) {
                 SCHEDLOG << ">> resume timedout tasks, num: " << ready_tasks.size();
                 _timeout = true;
                 for (size_t i = 0; i < ready_tasks.size(); ++i) {
+                    CO_PROBE2(timer_fire, _id, ready_tasks[i]->id);
                     this->resume(ready_tasks[i]);
                 }
                 _timeout = false;
@@ -266,33 +843,45 @@ void Sched::loop() {
         } while (0);
 
         if (_running) _running = 0;
-        if (_sched_num > 1) _cputime.fetch_add(timer.us(), std::memory_order_relaxed);
+        _stats.timers.store(_timer_mgr.size(), std::memory_order_relaxed);
+        t0 = now::us();
+        inc(_stats.run_us, t0 - t1);
+        if (_sched_num > 1) _cputime.fetch_add(t0 - t1, std::memory_order_relaxed);
     }
 
     _ev.signal();
 }
 
+// the coroutine will be resumed by the timer unless it has been signaled
+inline bool on_timeout(Coroutine* co) {
+    auto w = co->waitx;
+    if (!w) return true;
+    // TODO: is std::memory_order_relaxed safe here?
+    decltype(w->state)::value_type state{st_wait};
+    return w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed,
+                                            std::memory_order_relaxed);
+}
+
 uint32_t TimerManager::check_timeout(co::vector<Coroutine*>& res) {
+    if (_use_wheel) {
+        if (_wheel.size() == 0) return (uint32_t)-1;
+        const uint32_t ms = _wheel.expire(this->_now(), _expired);
+        for (size_t i = 0; i < _expired.size(); ++i) {
+            Coroutine* co = _expired[i]->co;
+            if (on_timeout(co)) res.push_back(co);
+        }
+        _expired.clear();
+        return ms;
+    }
+
     if (_timer.empty()) return (uint32_t)-1;
-    // SCHEDLOG << "timer not empty";
-    int64_t now_ms = now::ms();
+    int64_t now_ms = this->_now();
     auto it = _timer.begin();
     for (; it != _timer.end(); ++it) {
-        // SCHEDLOG << "it:"<< it<<"  ms:"<<it->first <<" now ms:"<<now_ms;
         if (it->first > now_ms) break;
         Coroutine* co = it->second;
         if (co->it != _timer.end()) co->it = _timer.end();
-        if (!co->waitx) {
-            res.push_back(co);
-        } else {
-            auto w = co->waitx;
-            // TODO: is std::memory_order_relaxed safe here?
-            decltype(w->state)::value_type state{st_wait};
-            if (w->state.compare_exchange_strong(state, st_timeout, std::memory_order_relaxed,
-                                                 std::memory_order_relaxed)) {
-                res.push_back(co);
-            }
-        }
+        if (on_timeout(co)) res.push_back(co);
     }
 
     if (it != _timer.begin()) {
@@ -303,6 +892,41 @@ uint32_t TimerManager::check_timeout(co::vector<Coroutine*>& res) {
     return _timer.empty() ? (uint32_t)-1 : (uint32_t)(_timer.begin()->first - now_ms);
 }
 
+int64_t TimerManager::check_us_timeout(co::vector<Coroutine*>& res) {
+    if (_us_timer.empty()) return -1;
+    const int64_t now_us = now::us();
+    auto it = _us_timer.begin();
+    for (; it != _us_timer.end() && it->first <= now_us; ++it) res.push_back(it->second);
+    _us_timer.erase(_us_timer.begin(), it);
+    return _us_timer.empty() ? -1 : _us_timer.begin()->first - now_us;
+}
+
+uint32_t TimerWheel::expire(int64_t now_ms, co::vector<TimerLink*>& res) {
+    while (_jiffies <= now_ms) {
+        const int k = (int)(_jiffies & (N0 - 1));
+        if (k == 0) {
+            for (int i = 0; i < L; ++i) {
+                if (this->_cascade(i, (int)((_jiffies >> (B0 + B * i)) & (N - 1))) != 0) break;
+            }
+        }
+        co::clist& slot = _tv0[k];
+        while (!slot.empty()) {
+            TimerLink* const t = (TimerLink*)slot.pop_front();
+            t->slot = 0;
+            --_count;
+            res.push_back(t);
+        }
+        ++_jiffies;
+        if (_count == 0) return (uint32_t)-1;
+    }
+
+    // find the next non-empty slot before level 0 wraps around
+    const int k = (int)(_jiffies & (N0 - 1));
+    int i = k;
+    while (i < N0 && _tv0[i].empty()) ++i;
+    return (uint32_t)(_jiffies + (i - k) - now_ms);
+}
+
 struct SchedInfo {
     SchedInfo() : cputime(co::sched_num(), 0), seed(co::rand()) {}
     co::vector<int64_t> cputime;
@@ -317,7 +941,72 @@ inline SchedInfo& sched_info() {
 static std::atomic_uint32_t g_nco{0};
 static bool g_main_thread_as_sched;
 
-SchedManager::SchedManager() {
+// Check if scheduler @a is less loaded than @b. Tasks picked up in the last loop
+// iteration come first, then cputime consumed since the last check by this thread.
+inline bool less_loaded(const Sched* a, const Sched* b, SchedInfo& si) {
+    const uint64_t qa = a->ready_num();
+    const uint64_t qb = b->ready_num();
+    if (qa != qb) return qa < qb;
+    const int64_t ta = a->cputime();
+    const int64_t tb = b->cputime();
+    const int64_t da = ta - si.cputime[a->id()];
+    const int64_t db = tb - si.cputime[b->id()];
+    si.cputime[a->id()] = ta;
+    si.cputime[b->id()] = tb;
+    return da <= db;
+}
+
+#ifndef _WIN32
+static void on_watchdog_signal(int) { log::dump_stack(); }
+#endif
+
+Watchdog::Watchdog(const co::vector<Sched*>& scheds, uint32_t ms)
+    : _scheds(scheds), _ms(ms), _ev() {
+#ifndef _WIN32
+    if (FLG_co_watchdog_dump) os::signal(SIGUSR2, on_watchdog_signal, SA_RESTART);
+#endif
+    _thread = std::thread(&Watchdog::loop, this);
+}
+
+Watchdog::~Watchdog() {
+    _ev.signal();
+    if (_thread.joinable()) _thread.join();
+}
+
+void Watchdog::loop() {
+    const size_t n = _scheds.size();
+    co::vector<uint64_t> ids(n, 0);     // coroutine running in the last check
+    co::vector<uint64_t> sws(n, 0);     // context switches in the last check
+    co::vector<int64_t> since(n, 0);    // time(ms) the coroutine was first seen
+    co::vector<bool> warned(n, false);  // the coroutine has been warned
+    const uint32_t interval = _ms >= 4 ? _ms / 4 : 1;
+
+    while (!_ev.wait(interval)) {
+        const int64_t now_ms = now::ms();
+        for (size_t i = 0; i < n; ++i) {
+            Sched* const s = _scheds[i];
+            const uint64_t id = s->running_id();
+            const uint64_t sw = s->stats().switches.load(std::memory_order_relaxed);
+            if (id == 0 || id != ids[i] || sw != sws[i]) {
+                ids[i] = id;
+                sws[i] = sw;
+                since[i] = now_ms;
+                warned[i] = false;
+                continue;
+            }
+            if (!warned[i] && now_ms - since[i] >= _ms) {
+                warned[i] = true;
+                WLOG << "co(" << (void*)id << ") has been running in sched " << s->id()
+                     << " for " << (now_ms - since[i]) << " ms without yielding";
+#ifndef _WIN32
+                if (FLG_co_watchdog_dump) pthread_kill(s->thread(), SIGUSR2);
+#endif
+            }
+        }
+    }
+}
+
+SchedManager::SchedManager() : _watchdog(0) {
     co::init_sock();
 
     const uint32_t ncpu = os::cpunum();
@@ -327,47 +1016,75 @@ SchedManager::SchedManager() {
     if (n == 0 || n > ncpu) n = ncpu;
     if (m == 0 || (m & (m - 1)) != 0) m = 8;
     if (s == 0) s = 1024 * 1024;
+    if (FLG_co_epoll_events == 0) FLG_co_epoll_events = 1024;
 
-    if (n != 1) {
-        if ((n & (n - 1)) == 0) {
-            _next = [](const co::vector<Sched*>& v) {
-                if (g_nco < v.size()) {
-                    const uint32_t i = g_nco++;
-                    if (i < v.size()) return v[i];
-                }
-                auto& si = sched_info();
-                const uint32_t x = god::cast<uint32_t>(v.size() - 1);
-                const uint32_t i = co::rand(si.seed) & x;
-                const uint32_t k = i != x ? i + 1 : 0;
-                const int64_t ti = v[i]->cputime();
-                const int64_t tk = v[k]->cputime();
-                return (si.cputime[k] == tk || ti <= (si.cputime[k] = tk)) ? v[i] : v[k];
-            };
-        } else {
-            _next = [](const co::vector<Sched*>& v) {
-                if (g_nco < v.size()) {
-                    const uint32_t i = g_nco.fetch_add(1);
-                    if (i < v.size()) return v[i];
-                }
-                auto& si = sched_info();
-                const uint32_t x = god::cast<uint32_t>(v.size());
-                const uint32_t i = co::rand(si.seed) % x;
-                const uint32_t k = i != x - 1 ? i + 1 : 0;
-                const int64_t ti = v[i]->cputime();
-                const int64_t tk = v[k]->cputime();
-                return (si.cputime[k] == tk || ti <= (si.cputime[k] = tk)) ? v[i] : v[k];
-            };
+    const int sp = parse_stack_policy(FLG_co_stack_policy.c_str());
+    if (sp < 0) WLOG << "unknown co_stack_policy: " << FLG_co_stack_policy << ", use idx";
+    g_stack_policy.store(sp < 0 ? stack_idx : sp, std::memory_order_relaxed);
+
+    if (n != 1 && FLG_co_sched_policy == "p2c") {
+        _next = [](const co::vector<Sched*>& v, uint32_t x) {
+            if (g_nco < x) {
+                const uint32_t i = g_nco.fetch_add(1);
+                if (i < x) return v[i];
+            }
+            if (x == 1) return v[0];
+            auto& si = sched_info();
+            const uint32_t i = co::rand(si.seed) % x;
+            uint32_t k = co::rand(si.seed) % (x - 1);
+            if (k >= i) ++k;  // k != i
+            return less_loaded(v[i], v[k], si) ? v[i] : v[k];
+        };
+    } else if (n != 1 && FLG_co_sched_policy == "least") {
+        _next = [](const co::vector<Sched*>& v, uint32_t x) {
+            auto& si = sched_info();
+            Sched* s = v[0];
+            for (uint32_t i = 1; i < x; ++i) {
+                if (less_loaded(v[i], s, si)) s = v[i];
+            }
+            return s;
+        };
+    } else if (n != 1) {
+        if (FLG_co_sched_policy != "cputime") {
+            WLOG << "unknown co_sched_policy: " << FLG_co_sched_policy << ", use cputime";
         }
+        // the number of active schedulers may change, mask only if it is a power of 2
+        _next = [](const co::vector<Sched*>& v, uint32_t x) {
+            if (g_nco < x) {
+                const uint32_t i = g_nco.fetch_add(1);
+                if (i < x) return v[i];
+            }
+            auto& si = sched_info();
+            const uint32_t r = co::rand(si.seed);
+            const uint32_t i = (x & (x - 1)) == 0 ? (r & (x - 1)) : r % x;
+            const uint32_t k = i != x - 1 ? i + 1 : 0;
+            const int64_t ti = v[i]->cputime();
+            const int64_t tk = v[k]->cputime();
+            return (si.cputime[k] == tk || ti <= (si.cputime[k] = tk)) ? v[i] : v[k];
+        };
     } else {
-        _next = [](const co::vector<Sched*>& v) { return v[0]; };
+        _next = [](const co::vector<Sched*>& v, uint32_t) { return v[0]; };
+    }
+
+    co::vector<int> cpus;
+    if (!FLG_co_sched_cpus.empty()) {
+        cpus = xx::parse_cpus(FLG_co_sched_cpus);
+    } else if (FLG_co_sched_affinity) {
+        for (uint32_t i = 0; i < ncpu; ++i) cpus.push_back((int)i);
     }
 
     for (uint32_t i = 0; i < n; ++i) {
         Sched* sched = new Sched(i, n, m, s);
-        if (i != 0 || !g_main_thread_as_sched) sched->start();
+        sched->set_peers(&_scheds);
+        if (!cpus.empty()) sched->set_cpu(cpus[i % cpus.size()]);
         _scheds.push_back(sched);
     }
+    _nactive.store(n, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (i != 0 || !g_main_thread_as_sched) _scheds[i]->start();
+    }
 
+    if (FLG_co_watchdog_ms > 0) _watchdog = new Watchdog(_scheds, FLG_co_watchdog_ms);
     is_active() = true;
 }
 
@@ -381,7 +1098,17 @@ inline SchedManager* sched_man() {
     return &_sched_man;
 }
 
+void SchedManager::set_active_num(uint32_t n) {
+    const uint32_t x = (uint32_t)_scheds.size();
+    if (n == 0 || n > x) n = x;
+    for (uint32_t i = 0; i < x; ++i) _scheds[i]->set_parked(i >= n);
+    _nactive.store(n, std::memory_order_relaxed);
+    SCHEDLOG << "active schedulers: " << n << '/' << x;
+}
+
 void SchedManager::stop() {
+    delete _watchdog;
+    _watchdog = 0;
     for (size_t i = 0; i < _scheds.size(); ++i) {
         _scheds[i]->stop();
     }
@@ -393,11 +1120,170 @@ void SchedManager::stop() {
     is_active().exchange(false);
 }
 
+static const uint32_t kMaxClsKeys = 1024;
+static void (*g_cls_dtor[kMaxClsKeys])(void*);
+static std::atomic_uint32_t g_cls_keys{0};
+
+uint32_t cls_key(void (*dtor)(void*)) {
+    const uint32_t k = g_cls_keys.fetch_add(1, std::memory_order_relaxed);
+    CHECK_LT(k, kMaxClsKeys) << "too many coroutine-local storage keys..";
+    g_cls_dtor[k] = dtor;
+    return k;
+}
+
+void* cls_get(uint32_t key) {
+    const auto s = xx::current_sched();
+    CHECK(s && s->running()) << "MUST be called in coroutine..";
+    const auto co = s->running();
+    return key < co->ncls ? co->cls[key] : 0;
+}
+
+void cls_set(uint32_t key, void* p) {
+    const auto s = xx::current_sched();
+    CHECK(s && s->running()) << "MUST be called in coroutine..";
+    const auto co = s->running();
+    if (key >= co->ncls) {
+        if (!p) return;
+        uint32_t n = co->ncls ? co->ncls : 8;
+        while (n <= key) n <<= 1;
+        co->cls = (void**)::realloc(co->cls, n * sizeof(void*));
+        assert(co->cls);
+        memset(co->cls + co->ncls, 0, (n - co->ncls) * sizeof(void*));
+        co->ncls = n;
+    }
+    void* const old = co->cls[key];
+    co->cls[key] = p;
+    if (old && old != p && g_cls_dtor[key]) g_cls_dtor[key](old);
+}
+
+void free_cls(Coroutine* co) {
+    for (uint32_t i = 0; i < co->ncls; ++i) {
+        void* const p = co->cls[i];
+        if (p && g_cls_dtor[i]) g_cls_dtor[i](p);
+    }
+    ::free(co->cls);
+    co->cls = 0;
+    co->ncls = 0;
+}
+
+void TraceRing::copy(co::vector<event_t>& v) const {
+    const uint64_t cap = _mask + 1;
+    const uint64_t w = _w.load(std::memory_order_acquire);
+    uint64_t b = w > cap ? w - cap : 0;
+    v.clear();
+    v.reserve((size_t)(w - b));
+    for (uint64_t i = b; i < w; ++i) v.push_back(_v[i & _mask]);
+
+    // events before @x may be overwritten while copying, including the one
+    // being written now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t e = _w.load(std::memory_order_relaxed);
+    const uint64_t x = e >= cap ? e - cap + 1 : 0;
+    if (x > b) {
+        const size_t n = x - b < w - b ? (size_t)(x - b) : (size_t)(w - b);
+        memmove(v.data(), v.data() + n, (v.size() - n) * sizeof(event_t));
+        v.resize(v.size() - n);
+    }
+}
+
 }  // namespace xx
 
-void go(Closure* cb) { xx::sched_man()->next_sched()->add_new_task(cb); }
+void go(Closure* cb) {
+    const auto s = xx::sched_man()->next_sched();
+    CO_PROBE1(go, s->id());
+    FLG_co_work_steal ? s->add_free_task(cb) : s->add_new_task(cb);
+}
 
-void co::Sched::go(Closure* cb) { ((xx::Sched*)this)->add_new_task(cb); }
+void go_hi(Closure* cb) {
+    const auto s = xx::sched_man()->next_sched();
+    CO_PROBE1(go, s->id());
+    s->add_hi_task(cb);
+}
+
+void go_batch(Closure* const* cbs, size_t n) {
+    if (n == 0) return;
+    const auto& v = xx::sched_man()->scheds();
+    const size_t m = xx::sched_man()->active_num();
+    if (n == 1 || m == 1) return xx::sched_man()->next_sched()->add_new_tasks(cbs, n);
+
+    // split the tasks evenly, start from the scheduler chosen by the policy of go()
+    const size_t k = n < m ? n : m;
+    const size_t x = xx::sched_man()->next_sched()->id();
+    for (size_t i = 0, b = 0; i < k; ++i) {
+        const size_t e = n * (i + 1) / k;
+        v[(x + i) % m]->add_new_tasks(cbs + b, e - b);
+        b = e;
+    }
+}
+
+void co::Sched::go(Closure* cb) {
+    const auto s = (xx::Sched*)this;
+    CO_PROBE1(go, s->id());
+    s->add_new_task(cb);
+}
+
+co::sched_stats co::Sched::stats() const {
+    const auto s = (const xx::Sched*)this;
+    const auto& x = s->stats();
+    const auto& p = s->poll_stats();
+    const auto r = std::memory_order_relaxed;
+    co::sched_stats st;
+    st.id = s->id();
+    st.coroutines = x.coroutines.load(r);
+    st.switches = x.switches.load(r);
+    st.stack_bytes = x.stack_bytes.load(r);
+    st.stack_collisions = x.stack_collisions.load(r);
+    st.ready_tasks = x.ready_tasks.load(r);
+    st.timers = x.timers.load(r);
+    st.wait_us = x.wait_us.load(r);
+    st.run_us = x.run_us.load(r);
+    st.spin_hits = p.spin_hits.load(r);
+    st.spin_misses = p.spin_misses.load(r);
+    st.blocking_waits = p.blocking_waits.load(r);
+    return st;
+}
+
+// add the stack profile of @s to @st, type names are unique, sites with the
+// same name are merged.
+static void add_stack_profile(xx::Sched* s, co::stack_stats& st) {
+    auto& p = s->stack_profile();
+    const auto r = std::memory_order_relaxed;
+    for (int i = 0; i < 16; ++i) {
+        const uint64_t n = p.hist[i].load(r);
+        st.hist[i] += n;
+        st.saves += n;
+    }
+    const uint64_t m = p.max_bytes.load(r);
+    if (m > st.max_bytes) st.max_bytes = m;
+
+    std::lock_guard<std::mutex> g(p.mtx);
+    for (auto& kv : p.sites) {
+        size_t i = 0;
+        while (i < st.sites.size() && st.sites[i].name != kv.first) ++i;
+        if (i == st.sites.size()) st.sites.push_back({kv.first, 0, 0});
+        auto& x = st.sites[i];
+        x.saves += kv.second.first;
+        if (kv.second.second > x.max_bytes) x.max_bytes = kv.second.second;
+    }
+}
+
+static co::stack_stats make_stack_profile(xx::Sched* const* v, size_t n) {
+    co::stack_stats st;
+    st.saves = 0;
+    st.max_bytes = 0;
+    memset(st.hist, 0, sizeof(st.hist));
+    for (size_t i = 0; i < n; ++i) add_stack_profile(v[i], st);
+    std::sort(st.sites.data(), st.sites.data() + st.sites.size(),
+              [](const co::stack_site& a, const co::stack_site& b) {
+                  return a.max_bytes > b.max_bytes;
+              });
+    return st;
+}
+
+co::stack_stats co::Sched::stack_profile() const {
+    xx::Sched* const s = (xx::Sched*)this;
+    return make_stack_profile(&s, 1);
+}
 
 void co::MainSched::loop() { ((xx::Sched*)this)->loop(); }
 
@@ -405,7 +1291,107 @@ const co::vector<co::Sched*>& scheds() {
     return (co::vector<co::Sched*>&)xx::sched_man()->scheds();
 }
 
-int sched_num() { return xx::is_active() ? (int)xx::sched_man()->scheds().size() : os::cpunum(); }
+stack_stats stack_profile() {
+    auto& v = xx::sched_man()->scheds();
+    return make_stack_profile(v.data(), v.size());
+}
+
+// Runs of coroutines and waits of the scheduler are complete events, the others
+// are instant events. Each scheduler is a thread in the trace.
+static void add_trace_json(const xx::Sched* s, co::vector<xx::TraceRing::event_t>& v, fastream& o) {
+    typedef xx::TraceRing R;
+    s->trace_ring()->copy(v);
+    const int tid = s->id();
+    o << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+      << ",\"args\":{\"name\":\"sched " << tid << "\"}}";
+
+    int64_t rs = -1, ws = -1;  // time the run or the wait starts
+    uint64_t rco = 0;
+    uint32_t wms = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        const auto& e = v[i];
+        switch (e.type) {
+            case R::tr_resume:
+                rs = e.us;
+                rco = e.co;
+                continue;
+            case R::tr_yield:
+            case R::tr_exit:
+                if (rs < 0 || rco != e.co) continue;
+                o << ",{\"name\":\"run\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid << ",\"ts\":" << rs
+                  << ",\"dur\":" << (e.us - rs) << ",\"args\":{\"co\":" << e.co << ",\"end\":\""
+                  << (e.type == R::tr_yield ? "yield" : "exit") << "\"}}";
+                rs = -1;
+                continue;
+            case R::tr_wait:
+                ws = e.us;
+                wms = e.arg;
+                continue;
+            case R::tr_wake:
+                if (ws < 0) continue;
+                o << ",{\"name\":\"wait\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid << ",\"ts\":" << ws
+                  << ",\"dur\":" << (e.us - ws) << ",\"args\":{\"timeout_ms\":" << (int)wms
+                  << ",\"events\":" << e.arg << "}}";
+                ws = -1;
+                continue;
+            case R::tr_io:
+                o << ",{\"name\":\"io\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << tid
+                  << ",\"ts\":" << e.us << ",\"args\":{\"co\":" << e.co << ",\"fd\":" << e.arg << "}}";
+                continue;
+            case R::tr_timer:
+                o << ",{\"name\":\"timer\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << tid
+                  << ",\"ts\":" << e.us << ",\"args\":{\"co\":" << e.co << ",\"ms\":" << e.arg << "}}";
+                continue;
+            case R::tr_steal:
+                o << ",{\"name\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << tid
+                  << ",\"ts\":" << e.us << ",\"args\":{\"from\":" << e.co << ",\"tasks\":" << e.arg << "}}";
+                continue;
+        }
+    }
+}
+
+fastring trace_json() {
+    fastream o(4096);
+    o << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    if (xx::is_active()) {
+        co::vector<xx::TraceRing::event_t> v;
+        bool first = true;
+        for (auto& s : xx::sched_man()->scheds()) {
+            if (!s->trace_ring()) continue;
+            if (!first) o << ',';
+            first = false;
+            add_trace_json(s, v, o);
+        }
+    }
+    o << "]}";
+    return o.str();
+}
+
+void trim_memory() {
+    if (!xx::is_active()) return;
+    for (auto& s : xx::sched_man()->scheds()) s->trim_later();
+}
+
+void set_active_sched_num(int n) { xx::sched_man()->set_active_num(n > 0 ? (uint32_t)n : 0); }
+
+int active_sched_num() { return (int)xx::sched_man()->active_num(); }
+
+bool set_stack_policy(const char* policy) {
+    const int x = xx::parse_stack_policy(policy);
+    if (x < 0) return false;
+    (void)xx::sched_man();  // co_stack_policy is parsed when the schedulers start
+    xx::g_stack_policy.store(x, std::memory_order_relaxed);
+    return true;
+}
+
+const char* stack_policy() {
+    (void)xx::sched_man();
+    return xx::g_stack_policy.load(std::memory_order_relaxed) == xx::stack_lru ? "lru" : "idx";
+}
+
+int sched_num() {
+    return xx::is_active() ? (int)xx::sched_man()->scheds().size() : os::topology().cpu_limit;
+}
 
 co::Sched* sched() { return (co::Sched*)xx::current_sched(); }
 
@@ -461,6 +1447,11 @@ void yield() {
     s->yield();
 }
 
+bool maybe_yield() {
+    const auto s = xx::current_sched();
+    return s ? s->maybe_yield() : false;
+}
+
 void resume(void* p) {
     const auto co = (xx::Coroutine*)p;
     co->sched->add_ready_task(co);
@@ -471,6 +1462,17 @@ void sleep(uint32_t ms) {
     s ? s->sleep(ms) : sleep::ms(ms);
 }
 
+void sleep_us(uint32_t us) {
+    const auto s = xx::current_sched();
+    if (s) return s->sleep_us(us);
+#ifdef _WIN32
+    sleep::ms((us + 999) / 1000);
+#else
+    struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    while (::nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
 bool timeout() {
     const auto s = xx::current_sched();
     CHECK(s) << "MUST be called in coroutine..";
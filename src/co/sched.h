@@ -1,7 +1,9 @@
 #pragma once
 
 #include <atomic>
+#include <mutex>
 #include <type_traits>
+#include <typeinfo>
 #ifdef _MSC_VER
 #pragma warning(disable : 4127)
 #endif
@@ -12,14 +14,18 @@
 #include "co/flag.h"
 #include "co/god.h"
 #include "co/log.h"
+#include "co/mem.h"
 #include "co/stl.h"
 #include "co/time.h"
 #include "context/context.h"
+#include "huge_page.h"
+#include "probe.h"
 
 #if defined(_WIN32)
 #include "epoll/iocp.h"
 #elif defined(__linux__)
 #include "epoll/epoll.h"
+#include "epoll/io_uring.h"
 #else
 #include "epoll/kqueue.h"
 #endif
@@ -27,7 +33,29 @@
 DEC_uint16(co_sched_num);
 DEC_uint32(co_stack_num);
 DEC_uint32(co_stack_size);
+DEC_string(co_stack_policy);
 DEC_bool(co_sched_log);
+DEC_bool(co_work_steal);
+DEC_bool(co_lockfree_queue);
+DEC_bool(co_timer_wheel);
+DEC_bool(co_coarse_timer);
+DEC_bool(co_dedicated_stack);
+DEC_bool(co_io_uring);
+DEC_uint32(co_accept_ex_num);
+DEC_uint32(co_epoll_events);
+DEC_uint32(co_busy_poll_us);
+DEC_string(co_sched_policy);
+DEC_uint32(co_hi_quota);
+DEC_uint32(co_watchdog_ms);
+DEC_bool(co_watchdog_dump);
+DEC_uint32(co_time_slice_us);
+DEC_bool(co_sched_affinity);
+DEC_string(co_sched_cpus);
+DEC_bool(co_sched_numa_local);
+DEC_bool(co_huge_pages);
+DEC_bool(co_stack_profile);
+DEC_bool(co_trace);
+DEC_uint32(co_trace_events);
 
 #define SCHEDLOG TLOG_IF(FLG_co_sched_log)
 
@@ -37,12 +65,26 @@ class Sched;
 struct Coroutine;
 typedef co::multimap<int64_t, Coroutine*>::iterator timer_id_t;
 
+// timer node embedded in a coroutine, used by the timer wheel
+struct TimerLink : co::clink {
+    co::clist* slot;  // slot of the timer wheel, NULL if not in the wheel
+    int64_t expire;   // time(ms) the timer expires at
+    Coroutine* co;    // coroutine owns this timer
+};
+
 enum state_t : uint8_t {
     st_wait = 0,     // wait for an event, do not modify
     st_ready = 1,    // ready to resume
     st_timeout = 2,  // timeout
+    st_accept = 3,   // a pre-posted AcceptEx on windows, no coroutine waits for it
 };
 
+#ifdef _WIN32
+// called by the scheduler when a pre-posted AcceptEx is done, return the
+// coroutine waiting in co::accept() for it, or NULL
+Coroutine* on_accept_ex_done(PerIoInfo* info, DWORD n);
+#endif
+
 // waiting context
 struct waitx_t : co::clink {
     explicit inline waitx_t(Coroutine* _co) : co(_co), state(st_wait) {}
@@ -55,15 +97,43 @@ struct waitx_t : co::clink {
 };
 
 inline waitx_t* make_waitx(void* co, size_t n = sizeof(waitx_t)) {
-    auto p = ::malloc(n);
+    auto p = co::alloc(n);
     assert(p);
     return new (p) waitx_t((Coroutine*)co);
 }
 
+#ifdef __linux__
+// An I/O operation submitted to io_uring. It is allocated on heap, as the kernel
+// and the scheduler may access it while the coroutine is suspended.
+struct uring_op_t {
+    waitx_t x;     // waiting context, MUST be the first member
+    int32_t res;   // result of the operation, -errno on error
+    uint8_t done;  // 1 if the operation has completed
+    char s[];      // extra buffer, the kernel can not access the shared stack
+};
+
+inline uring_op_t* make_uring_op(void* co, size_t n = 0) {
+    auto op = (uring_op_t*)co::alloc(sizeof(uring_op_t) + n);
+    assert(op);
+    new (&op->x) waitx_t((Coroutine*)co);
+    op->res = 0;
+    op->done = 0;
+    return op;
+}
+#endif
+
+// Run f(arg) in a thread of the blocking-I/O pool, the calling coroutine is
+// suspended until it is done. f runs in another thread, it MUST NOT access the
+// shared stack of the coroutine, which may be used by other coroutines then.
+void offload(void (*f)(void*), void* arg);
+
 struct Stack {
     char* p;        // stack pointer
     char* top;      // stack top
     Coroutine* co;  // coroutine owns this stack
+    uint32_t refs;  // number of coroutines bound to it
+    uint64_t used;  // value of Stats::switches when a coroutine was resumed on it
+    bool trimmed;   // unused pages were released, for dedicated stacks in the pool
 };
 
 struct Buffer {
@@ -85,7 +155,7 @@ struct Buffer {
 
     inline void reset() {
         if (_h) {
-            ::free(_h);
+            co::free(_h);
             _h = 0;
         }
     }
@@ -93,7 +163,7 @@ struct Buffer {
     inline void append(const void* p, size_t size) {
         const uint32_t n = (uint32_t)size;
         if (!_h) {
-            _h = (H*)::malloc(size + 8);
+            _h = (H*)co::alloc(size + 8);
             assert(_h);
             _h->cap = n;
             _h->size = 0;
@@ -103,7 +173,7 @@ struct Buffer {
         if (_h->cap < _h->size + n) {
             const uint32_t o = _h->cap;
             _h->cap += (o >> 1) + n;
-            _h = (H*)::realloc(_h, _h->cap + 8);
+            _h = (H*)co::realloc(_h, _h->cap + 8);
             assert(_h);
             goto lable;
         }
@@ -116,6 +186,79 @@ struct Buffer {
     H* _h;
 };
 
+/**
+ * Pool of buffers for saving stacks of coroutines, owned by a scheduler.
+ *   - Buffers are grouped by size classes of power of 2, from 256B to 16MB.
+ *     A buffer from the pool is large enough for the stack to save, so the
+ *     buffer will never be reallocated when saving the stack.
+ *   - At most 128 buffers are kept for each class, and at most 32MB in total.
+ */
+class BufferPool {
+  public:
+    static const int B0 = 8;                  // the smallest class is 2^B0 bytes
+    static const int NC = 17;                 // number of size classes
+    static const uint32_t MAX_NUM = 128;      // max buffers kept for each class
+    static const size_t MAX_BYTES = 32 << 20;  // max bytes kept in the pool
+
+    struct Stats {
+        uint64_t hits;    // buffers reused from the pool
+        uint64_t misses;  // buffers allocated with malloc
+        size_t bytes;     // bytes retained in the pool
+    };
+
+    BufferPool() : _stats() {}
+    ~BufferPool() { this->clear(); }
+
+    // get a buffer with capacity >= n, size of the buffer is 0
+    void* pop(size_t n) {
+        int c = 0;
+        while (c < NC && ((size_t)1 << (B0 + c)) < n) ++c;
+        Buffer::H* h;
+        if (c < NC && !_v[c].empty()) {
+            h = (Buffer::H*)_v[c].pop_back();
+            _stats.bytes -= h->cap;
+            ++_stats.hits;
+        } else {
+            const uint32_t cap = c < NC ? (1u << (B0 + c)) : (uint32_t)n;
+            h = (Buffer::H*)co::alloc(cap + 8);
+            assert(h);
+            h->cap = cap;
+            ++_stats.misses;
+        }
+        h->size = 0;
+        return h;
+    }
+
+    // return a buffer to the pool, it will be freed if the pool is full
+    void push(void* p) {
+        Buffer::H* const h = (Buffer::H*)p;
+        const uint32_t cap = h->cap;
+        int c = 0;
+        while (c < NC && (1u << (B0 + c)) < cap) ++c;
+        if (c < NC && (1u << (B0 + c)) == cap && _v[c].size() < MAX_NUM &&
+            _stats.bytes + cap <= MAX_BYTES) {
+            _v[c].push_back(p);
+            _stats.bytes += cap;
+        } else {
+            co::free(p);
+        }
+    }
+
+    void clear() {
+        for (int c = 0; c < NC; ++c) {
+            for (size_t i = 0; i < _v[c].size(); ++i) co::free(_v[c][i]);
+            _v[c].reset();
+        }
+        _stats.bytes = 0;
+    }
+
+    const Stats& stats() const noexcept { return _stats; }
+
+  private:
+    co::vector<void*> _v[NC];
+    Stats _stats;
+};
+
 struct Coroutine {
     Coroutine() = delete;
     ~Coroutine() = delete;
@@ -129,6 +272,7 @@ struct Coroutine {
     };
     tb_context_t ctx;  // coroutine context, points to the stack bottom
     Closure* cb;       // coroutine function
+    const void* type;  // type_info of cb, the creation site for the cpu profiler
     Sched* sched;      // scheduler this coroutine runs in
     Stack* stack;      // stack this coroutine runs on
     union {
@@ -136,174 +280,612 @@ struct Coroutine {
         void* pbuf;
     };
     waitx_t* waitx;  // waiting context
+    uint8_t prio;    // priority, 1 for coroutines created by go_hi()
+    uint32_t ncls;   // number of coroutine-local storage slots
+    void** cls;      // coroutine-local storage slots, indexed by key
     union {
-        timer_id_t it;
-        char _dummy2[sizeof(timer_id_t)];
+        timer_id_t it;   // timer in the multimap
+        TimerLink tl;    // timer in the timer wheel
+        char _dummy2[sizeof(TimerLink)];
     };
 };
 
+// delete values in coroutine-local storage of a coroutine, and free the slots
+void free_cls(Coroutine* co);
+
+/**
+ * Pool of Coroutine structs, which are allocated in blocks of N
+ *   - A Coroutine never moves, and a block can be freed only when all of its
+ *     coroutines are recycled. To let blocks drain after a traffic spike, new
+ *     coroutines are taken from the most occupied block that is not full.
+ *   - Empty blocks are kept for reuse until trim() is called.
+ *   - Blocks are mapped with huge pages if co_huge_pages is true.
+ */
 class CoroutinePool {
   public:
     static const int E = 12;
     static const int N = 1 << E;  // max coroutines per block
     static const int M = 256;
 
-    inline CoroutinePool() : _c(0), _o(0), _v(M), _use_count(M) {
+    inline CoroutinePool()
+        : _c(-1), _n(0), _huge(FLG_co_huge_pages), _v(M), _use_count(M), _top(M), _free(M) {
         _v.resize(M);
         _use_count.resize(M);
+        _top.resize(M);
+        _free.resize(M);
     }
 
     inline ~CoroutinePool() {
         for (size_t i = 0; i < _v.size(); ++i) {
-            if (_v[i]) ::free(_v[i]);
+            if (_v[i]) this->free_block(_v[i]);
         }
         _v.clear();
     }
 
     Coroutine* pop() {
-        int id = 0;
-        if (!_v0.empty()) {
-            id = _v0.pop_back();
-            goto reuse;
+        if (_c < 0 || _use_count[_c] == N) _c = this->next_block();
+        const int q = _c;
+        ++_use_count[q];
+        if (!_free[q].empty()) {
+            auto& co = _v[q][_free[q].pop_back()];
+            co.ctx = 0;
+            return &co;
         }
-        if (!_vc.empty()) {
-            id = _vc.pop_back();
-            goto reuse;
+        const int r = _top[q]++;
+        auto& co = _v[q][r];
+        co.idx = (q << E) + r;
+        return &co;
+    }
+
+    void push(Coroutine* co) {
+        const int q = co->idx >> E;
+        if (_free[q].capacity() == 0) _free[q].reserve(N);
+        _free[q].push_back((uint16_t)(co->idx & (N - 1)));
+        --_use_count[q];
+    }
+
+    // free empty blocks, return number of blocks freed
+    int trim() {
+        int k = 0;
+        for (int q = 0; q < _n; ++q) {
+            if (_v[q] && _use_count[q] == 0) {
+                this->free_block(_v[q]);
+                _v[q] = 0;
+                _top[q] = 0;
+                _free[q].reset();
+                if (q == _c) _c = -1;
+                ++k;
+            }
         }
-        if (_o < N) goto newco;
-        _c = !_blks.empty() ? *_blks.begin() : _c + 1;
-        if (!_blks.empty()) _blks.erase(_blks.begin());
-        _o = 0;
-
-    newco : {
-        if (_c < (int)_v.size()) {
-            if (!_v[_c]) _v[_c] = (Coroutine*)::calloc(N, sizeof(Coroutine));
-        } else {
-            const int c = god::align_up<M>(_c + 1);
+        return k;
+    }
+
+    Coroutine& operator[](int i) const {
+        const int q = i >> E;
+        const int r = i & (N - 1);
+        return _v[q][r];
+    }
+
+  private:
+    // Choose a block for new coroutines: the most occupied one that is not
+    // full, an empty one, or a new one.
+    int next_block() {
+        int best = -1, idle = -1, hole = -1;
+        for (int q = 0; q < _n; ++q) {
+            if (!_v[q]) {
+                if (hole < 0) hole = q;
+                continue;
+            }
+            const int n = _use_count[q];
+            if (n == N) continue;
+            if (n == 0) {
+                if (idle < 0) idle = q;
+            } else if (best < 0 || n > _use_count[best]) {
+                best = q;
+            }
+        }
+        if (best >= 0) return best;
+        if (idle >= 0) return idle;
+
+        const int q = hole >= 0 ? hole : _n++;
+        if (q >= (int)_v.size()) {
+            const int c = god::align_up<M>(q + 1);
             _v.resize(c);
             _use_count.resize(c);
-            _v[_c] = (Coroutine*)::calloc(N, sizeof(Coroutine));
+            _top.resize(c);
+            _free.resize(c);
         }
+        _v[q] = this->alloc_block();
+        assert(_v[q]);
+        return q;
+    }
 
-        auto& co = _v[_c][_o];
-        co.idx = (_c << E) + _o++;
-        _use_count[_c]++;
-        return &co;
+    // zero-filled memory of a block
+    Coroutine* alloc_block() {
+        if (_huge) return (Coroutine*)alloc_huge(N * sizeof(Coroutine));
+        return (Coroutine*)::calloc(N, sizeof(Coroutine));
     }
 
-    reuse : {
-        const int q = id >> E;
-        const int r = id & (N - 1);
-        auto& co = _v[q][r];
-        co.ctx = 0;
-        _use_count[q]++;
-        return &co;
+    void free_block(Coroutine* p) {
+        _huge ? free_huge(p, N * sizeof(Coroutine)) : ::free(p);
     }
+
+    int _c;  // current block, -1 for none
+    int _n;  // number of blocks ever used
+    const bool _huge;  // blocks are mapped with huge pages
+    co::vector<Coroutine*> _v;
+    co::vector<int> _use_count;          // coroutines in use per block
+    co::vector<int> _top;                // slots never used start from here per block
+    co::vector<co::vector<uint16_t>> _free;  // recycled slots per block
+};
+
+// Lock-free multi-producer single-consumer queue (Vyukov's algorithm).
+//   - push() is wait-free and can be called from any thread.
+//   - pop_all() MUST be called in the single consumer thread.
+//   - An element being pushed may be invisible to pop_all() for a short while,
+//     the producer always signals the consumer after push() returns.
+//   - Nodes are taken from segments of K nodes owned by the producer thread, a
+//     push allocates memory only once for K nodes. A segment is freed when all
+//     its nodes have been popped, by the consumer of the last one.
+template <typename T>
+class MpscQueue {
+    static const uint32_t K = 64;
+    struct Seg;
+
+    struct Node {
+        std::atomic<Node*> next;
+        Seg* seg;  // NULL for the first stub node
+        T v;
+    };
+
+    struct Seg {
+        std::atomic_uint32_t refn;  // nodes not freed yet
+        Node nodes[K];
+    };
+
+    // nodes in use of the segment are freed when @n reaches 0
+    static Seg* new_seg(uint32_t n) {
+        Seg* const s = (Seg*)::malloc(sizeof(Seg));
+        assert(s);
+        s->refn.store(n, std::memory_order_relaxed);
+        return s;
     }
 
-    void push(Coroutine* co) {
-        const int idx = co->idx;
-        const int q = idx >> E;
-        if (q == 0) {
-            if (_v0.capacity() == 0) _v0.reserve(N);
-            _v0.push_back(idx);
-            goto end;
+    static void free_nodes(Seg* s, uint32_t n) {
+        if (s->refn.fetch_sub(n, std::memory_order_acq_rel) == n) ::free(s);
+    }
+
+    // the segment of the current thread nodes are taken from
+    struct SegCache {
+        SegCache() : s(0), n(K), dead(false) {}
+
+        // s may have been freed if all its nodes were taken
+        ~SegCache() {
+            if (n < K) free_nodes(s, K - n);
+            dead = true;
         }
-        if (q == _c) {
-            if (_vc.capacity() == 0) _vc.reserve(N);
-            _vc.push_back(idx);
-            goto end;
+
+        Node* pop() {
+            if (unlikely(dead)) {
+                Seg* const t = new_seg(1);
+                t->nodes[0].seg = t;
+                return t->nodes;
+            }
+            if (n == K) {
+                s = new_seg(K);
+                n = 0;
+            }
+            Node* const x = &s->nodes[n++];
+            x->seg = s;
+            return x;
         }
 
-    end:
-        if (--_use_count[q] == 0) {
-            ::free(_v[q]);
-            _v[q] = 0;
-            if (q != _c) {
-                _blks.insert(q);
-            } else {
-                _vc.clear();
-                _o = 0;
-                if (!_blks.empty() && *_blks.begin() < _c) {
-                    _blks.insert(_c);
-                    _c = *_blks.begin();
-                    _blks.erase(_blks.begin());
-                }
+        Seg* s;
+        uint32_t n;  // nodes taken from s
+        bool dead;   // the thread is exiting
+    };
+
+    static Node* new_node(T v) {
+        static thread_local SegCache c;
+        Node* const x = c.pop();
+        x->next.store(0, std::memory_order_relaxed);
+        x->v = v;
+        return x;
+    }
+
+    static void free_node(Node* x) {
+        x->seg ? free_nodes(x->seg, 1) : ::free(x);
+    }
+
+  public:
+    MpscQueue() {
+        _head = (Node*)::calloc(1, sizeof(Node));  // stub node
+        assert(_head);
+        _tail.store(_head, std::memory_order_relaxed);
+    }
+
+    ~MpscQueue() {
+        while (_head) {
+            Node* const next = _head->next.load(std::memory_order_relaxed);
+            free_node(_head);
+            _head = next;
+        }
+    }
+
+    void push(T v) {
+        Node* const n = new_node(v);
+        Node* const prev = _tail.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // push @n elements with a single exchange on the tail
+    void push(const T* p, size_t n) {
+        if (n == 0) return;
+        Node* const first = new_node(p[0]);
+        Node* last = first;
+        for (size_t i = 1; i < n; ++i) {
+            Node* const x = new_node(p[i]);
+            last->next.store(x, std::memory_order_relaxed);
+            last = x;
+        }
+        Node* const prev = _tail.exchange(last, std::memory_order_acq_rel);
+        prev->next.store(first, std::memory_order_release);
+    }
+
+    // move all visible elements to the end of @v, return number of elements moved.
+    // Consecutive nodes from the same segment are freed at once.
+    size_t pop_all(co::vector<T>& v) {
+        size_t k = 0;
+        Seg* s = 0;
+        uint32_t m = 0;
+        for (;;) {
+            Node* const next = _head->next.load(std::memory_order_acquire);
+            if (!next) break;
+            v.push_back(next->v);
+            if (_head->seg != s) {
+                if (m > 0) free_nodes(s, m);
+                s = _head->seg;
+                m = 0;
             }
+            s ? (void)++m : ::free(_head);
+            _head = next;
+            ++k;
         }
+        if (m > 0) free_nodes(s, m);
+        return k;
     }
 
-    Coroutine& operator[](int i) const {
-        const int q = i >> E;
-        const int r = i & (N - 1);
-        return _v[q][r];
+  private:
+    Node* _head;  // consumer side
+    char _x[L1_CACHE_LINE_SIZE - sizeof(Node*)];
+    std::atomic<Node*> _tail;  // producer side
+};
+
+// Trace events of a scheduler, recorded when co_trace is true. The ring is written
+// by the scheduler thread only, and the oldest events are overwritten. Readers
+// copy it without a lock, and drop events that may be overwritten meanwhile.
+class TraceRing {
+  public:
+    enum type_t : uint8_t {
+        tr_resume = 0,  // a coroutine is resumed
+        tr_yield = 1,   // the coroutine yields
+        tr_exit = 2,    // the coroutine has terminated
+        tr_io = 3,      // the coroutine waits for I/O, arg: fd
+        tr_timer = 4,   // the coroutine adds a timer, arg: ms
+        tr_steal = 5,   // tasks are stolen, co: id of the peer, arg: number of tasks
+        tr_wait = 6,    // the scheduler waits for events, arg: ms to wait
+        tr_wake = 7,    // the scheduler wakes up, arg: number of I/O events
+    };
+
+    struct event_t {
+        int64_t us;   // time(us) of the event
+        uint64_t co;  // id of the coroutine
+        uint32_t arg;
+        uint8_t type;
+    };
+
+    // @n: max events kept, rounded up to a power of 2
+    explicit TraceRing(uint32_t n) : _w(0) {
+        uint64_t x = 64;
+        while (x < n) x <<= 1;
+        _mask = x - 1;
+        _v = (event_t*)::calloc(x, sizeof(event_t));
+        assert(_v);
     }
 
+    ~TraceRing() { ::free(_v); }
+
+    inline void add(uint8_t type, uint64_t co, uint32_t arg) {
+        const uint64_t w = _w.load(std::memory_order_relaxed);
+        event_t& e = _v[w & _mask];
+        e.us = now::us();
+        e.co = co;
+        e.arg = arg;
+        e.type = type;
+        _w.store(w + 1, std::memory_order_release);
+    }
+
+    // copy events in the ring to @v, the oldest first (thread-safe)
+    void copy(co::vector<event_t>& v) const;
+
   private:
-    int _c;  // current block
-    int _o;  // offset in the current block [0, S)
-    co::vector<Coroutine*> _v;
-    co::vector<int> _use_count;
-    co::vector<int> _v0;  // id of coroutine in _v[0]
-    co::vector<int> _vc;  // id of coroutine in _v[_c]
-    co::set<int> _blks;   // blocks available
+    std::atomic_uint64_t _w;  // number of events written
+    uint64_t _mask;
+    event_t* _v;
 };
 
-// Task may be added from any thread. We need a mutex here.
+// Task may be added from any thread. We need a mutex or a lock-free queue here.
+//   - Tasks added by add_new_task() are pinned to this scheduler.
+//   - Tasks added by add_free_task() may be stolen by other schedulers, they are
+//     always protected by the mutex.
+//   - New and ready tasks go through lock-free queues if co_lockfree_queue is true.
 class TaskManager {
   public:
-    TaskManager() : _mtx(), _new_tasks(512), _ready_tasks(512) {}
+    TaskManager()
+        : _mtx(),
+          _new_tasks(512),
+          _free_tasks(512),
+          _hi_tasks(),
+          _ready_tasks(512),
+          _nfree(0),
+          _nhi(0),
+          _lockfree(FLG_co_lockfree_queue) {}
     ~TaskManager() = default;
 
     void add_new_task(Closure* cb) {
+        if (_lockfree) return _new_q.push(cb);
         std::lock_guard<std::mutex> g(_mtx);
         _new_tasks.push_back(cb);
     }
 
+    // add @n new tasks with a single lock
+    void add_new_tasks(Closure* const* cbs, size_t n) {
+        if (_lockfree) return _new_q.push(cbs, n);
+        std::lock_guard<std::mutex> g(_mtx);
+        _new_tasks.append(cbs, n);
+    }
+
+    void add_hi_task(Closure* cb) {
+        std::lock_guard<std::mutex> g(_mtx);
+        _hi_tasks.push_back(cb);
+        _nhi.store((uint32_t)_hi_tasks.size(), std::memory_order_release);
+    }
+
+    // get all high-priority new tasks, the lock is skipped if there is none
+    void get_hi_tasks(co::vector<Closure*>& v) {
+        if (_nhi.load(std::memory_order_acquire) == 0) return;
+        std::lock_guard<std::mutex> g(_mtx);
+        _hi_tasks.swap(v);
+        _nhi.store(0, std::memory_order_release);
+    }
+
+    void add_free_task(Closure* cb) {
+        std::lock_guard<std::mutex> g(_mtx);
+        _free_tasks.push_back(cb);
+        _nfree.store((uint32_t)_free_tasks.size(), std::memory_order_release);
+    }
+
     void add_ready_task(Coroutine* co) {
+        if (_lockfree) return _ready_q.push(co);
         std::lock_guard<std::mutex> g(_mtx);
         _ready_tasks.push_back(co);
     }
 
+    // add @n coroutines ready to resume with a single lock
+    void add_ready_tasks(Coroutine* const* cos, size_t n) {
+        if (_lockfree) return _ready_q.push(cos, n);
+        std::lock_guard<std::mutex> g(_mtx);
+        _ready_tasks.append(cos, n);
+    }
+
     void get_all_tasks(co::vector<Closure*>& new_tasks, co::vector<Coroutine*>& ready_tasks) {
+        if (_lockfree) {
+            _new_q.pop_all(new_tasks);
+            _ready_q.pop_all(ready_tasks);
+            if (_nfree.load(std::memory_order_acquire) == 0) return;
+        }
         std::lock_guard<std::mutex> g(_mtx);
-        if (!_new_tasks.empty()) _new_tasks.swap(new_tasks);
+        if (!_new_tasks.empty()) {
+            if (new_tasks.empty()) {
+                _new_tasks.swap(new_tasks);
+            } else {
+                new_tasks.append(_new_tasks.data(), _new_tasks.size());
+                _new_tasks.clear();
+            }
+        }
+        if (!_free_tasks.empty()) {
+            new_tasks.append(_free_tasks.data(), _free_tasks.size());
+            _free_tasks.clear();
+            _nfree.store(0, std::memory_order_release);
+        }
         if (!_ready_tasks.empty()) _ready_tasks.swap(ready_tasks);
     }
 
+    // number of tasks that can be stolen, it may be not accurate
+    uint32_t free_task_num() const noexcept { return _nfree.load(std::memory_order_acquire); }
+
+    // move the newer half (at least one) of the free tasks to @v, return number of tasks stolen
+    size_t steal_tasks(co::vector<Closure*>& v) {
+        std::lock_guard<std::mutex> g(_mtx);
+        const size_t n = _free_tasks.size();
+        if (n == 0) return 0;
+        const size_t k = (n + 1) >> 1;
+        v.append(_free_tasks.data() + (n - k), k);
+        _free_tasks.resize(n - k);
+        _nfree.store((uint32_t)(n - k), std::memory_order_release);
+        return k;
+    }
+
   private:
     std::mutex _mtx;
     co::vector<Closure*> _new_tasks;
+    co::vector<Closure*> _free_tasks;
+    co::vector<Closure*> _hi_tasks;  // high-priority new tasks
     co::vector<Coroutine*> _ready_tasks;
+    std::atomic_uint32_t _nfree;
+    std::atomic_uint32_t _nhi;
+    const bool _lockfree;
+    MpscQueue<Closure*> _new_q;
+    MpscQueue<Coroutine*> _ready_q;
 };
 
 inline fastream& operator<<(fastream& fs, const timer_id_t& id) { return fs << *(void**)(&id); }
 
+/**
+ * Hierarchical timer wheel with a resolution of 1 ms.
+ *   - Level 0 has 256 slots of 1 ms, level 1~4 have 64 slots each, and a slot in
+ *     level i covers 2^(8+6*(i-1)) ms. 5 levels cover all uint32 timeouts.
+ *   - Timers are linked into slots through TimerLink in the coroutine, so add()
+ *     and del() are O(1) and need no memory allocation.
+ *   - Timers in higher levels are moved to lower levels when the lower level
+ *     wraps around (cascade).
+ */
+class TimerWheel {
+  public:
+    static const int B0 = 8;
+    static const int B = 6;
+    static const int N0 = 1 << B0;
+    static const int N = 1 << B;
+    static const int L = 4;  // number of levels above level 0
+
+    TimerWheel() : _jiffies(0), _count(0) {}
+    ~TimerWheel() = default;
+
+    size_t size() const noexcept { return _count; }
+
+    void add(TimerLink* t, int64_t now_ms) {
+        if (_count++ == 0) _jiffies = now_ms;
+        this->_link(t);
+    }
+
+    void del(TimerLink* t) {
+        t->slot->erase(t);
+        t->slot = 0;
+        --_count;
+    }
+
+    // move expired timers to @res, return time(ms) to wait for the next check
+    uint32_t expire(int64_t now_ms, co::vector<TimerLink*>& res);
+
+  private:
+    void _link(TimerLink* t) {
+        const int64_t e = t->expire;
+        const uint64_t d = (uint64_t)(e - _jiffies);
+        co::clist* slot;
+        if (e < _jiffies) {
+            slot = &_tv0[_jiffies & (N0 - 1)];
+        } else if (d < ((uint64_t)1 << B0)) {
+            slot = &_tv0[e & (N0 - 1)];
+        } else if (d < ((uint64_t)1 << (B0 + B * L)) - ((uint64_t)1 << (B0 + B * (L - 1)))) {
+            int i = 0;
+            while (i < L - 1 && d >= ((uint64_t)1 << (B0 + B * (i + 1)))) ++i;
+            slot = &_tv[i][(e >> (B0 + B * i)) & (N - 1)];
+        } else {
+            // it may wrap around to the current top-level slot, which has been cascaded
+            // already. Use the next one instead, the timer is re-linked when it cascades.
+            const int s = B0 + B * (L - 1);
+            slot = &_tv[L - 1][((_jiffies >> s) + 1) & (N - 1)];
+        }
+        slot->push_back(t);
+        t->slot = slot;
+    }
+
+    // re-link timers in the slot @k of level @i, return @k
+    int _cascade(int i, int k) {
+        co::clist l;
+        l.swap(_tv[i][k]);
+        while (!l.empty()) this->_link((TimerLink*)l.pop_front());
+        return k;
+    }
+
+    int64_t _jiffies;  // timers expire before _jiffies have been processed
+    size_t _count;
+    co::clist _tv0[N0];
+    co::clist _tv[L][N];
+};
+
 // Timer must be added in the scheduler thread. We need no lock here.
+//   - Timers are stored in a multimap by default, or in a timer wheel if
+//     co_timer_wheel is true.
+//   - A coroutine has at most one timer, which is stored in the coroutine.
+//   - If co_coarse_timer is true, time is read from the coarse clock, which is
+//     cheaper, but a timer may expire up to a system tick early.
 class TimerManager {
     using timer_type = co::multimap<int64_t, Coroutine*>;
 
   public:
-    inline TimerManager() : _timer(), _it(_timer.end()) {}
+    inline TimerManager()
+        : _timer(), _it(_timer.end()), _use_wheel(FLG_co_timer_wheel), _coarse(FLG_co_coarse_timer) {}
     ~TimerManager() = default;
 
-    inline timer_id_t add_timer(uint32_t ms, Coroutine* co) {
-        return _it = _timer.emplace_hint(_it, now::ms() + ms, co);
+    // initialize the timer of a new coroutine
+    inline void init(Coroutine* co) {
+        if (!_use_wheel) {
+            new (&co->it) timer_id_t(_timer.end());
+        } else {
+            new (&co->tl) TimerLink();
+            co->tl.slot = 0;
+            co->tl.co = co;
+        }
     }
 
-    inline void del_timer(const timer_id_t& it) {
-        if (_it == it) ++_it;
-        _timer.erase(it);
+    // destroy the timer of a coroutine to be recycled
+    inline void fini(Coroutine* co) {
+        if (!_use_wheel) co->it.~timer_id_t();
     }
 
-    inline timer_id_t end() { return _timer.end(); }
+    inline void add_timer(uint32_t ms, Coroutine* co) {
+        const int64_t now_ms = this->_now();
+        if (!_use_wheel) {
+            co->it = _it = _timer.emplace_hint(_it, now_ms + ms, co);
+        } else {
+            co->tl.expire = now_ms + ms;
+            _wheel.add(&co->tl, now_ms);
+        }
+    }
+
+    inline bool has_timer(Coroutine* co) const {
+        return !_use_wheel ? co->it != _timer.end() : co->tl.slot != 0;
+    }
+
+    inline void del_timer(Coroutine* co) {
+        if (!_use_wheel) {
+            if (_it == co->it) ++_it;
+            _timer.erase(co->it);
+            co->it = _timer.end();
+        } else {
+            _wheel.del(&co->tl);
+        }
+    }
 
     // get timedout coroutines, return time(ms) to wait for the next timeout
     uint32_t check_timeout(co::vector<Coroutine*>& res);
 
+    // Add a timer in microseconds. It is only for sleep_us(), as the coroutine
+    // is resumed by nothing else and the timer needs not be deleted.
+    inline void add_us_timer(uint32_t us, Coroutine* co) {
+        _us_timer.emplace(now::us() + us, co);
+    }
+
+    // get coroutines of expired us timers, return time(us) to wait for the next
+    // one, or -1 if there is none.
+    int64_t check_us_timeout(co::vector<Coroutine*>& res);
+
+    // number of pending timers
+    inline size_t size() const noexcept {
+        return (!_use_wheel ? _timer.size() : _wheel.size()) + _us_timer.size();
+    }
+
   private:
+    inline int64_t _now() const { return _coarse ? now::ms_coarse() : now::ms(); }
+
     timer_type _timer;                  // timed-wait tasks: <time_ms, co>
     typename timer_type::iterator _it;  // make insert faster with this hint
+    TimerWheel _wheel;
+    co::vector<TimerLink*> _expired;
+    co::multimap<int64_t, Coroutine*> _us_timer;  // <time_us, co>
+    const bool _use_wheel;
+    const bool _coarse;
 };
 
 // coroutine scheduler, loop in a single thread
@@ -338,36 +920,115 @@ class Sched {
     // add a new task to run as a coroutine later (thread-safe)
     inline void add_new_task(Closure* cb) {
         _task_mgr.add_new_task(cb);
-        _epoll->signal();
+        this->signal();
+    }
+
+    // trim all memory not in use in the scheduler thread later (thread-safe)
+    inline void trim_later() {
+        _trim_all.store(true, std::memory_order_relaxed);
+        this->signal();
+    }
+
+    // add a new high-priority task (thread-safe)
+    inline void add_hi_task(Closure* cb) {
+        _task_mgr.add_hi_task(cb);
+        this->signal();
+    }
+
+    // add @n new tasks, the scheduler is signaled only once (thread-safe)
+    inline void add_new_tasks(Closure* const* cbs, size_t n) {
+        _task_mgr.add_new_tasks(cbs, n);
+        this->signal();
     }
 
+    // add a new task that may be stolen by idle schedulers (thread-safe)
+    void add_free_task(Closure* cb);
+
     // add a coroutine ready to resume (thread-safe)
     inline void add_ready_task(Coroutine* co) {
         _task_mgr.add_ready_task(co);
-        _epoll->signal();
+        this->signal();
+    }
+
+    // add @n coroutines of this scheduler ready to resume, with one lock and one
+    // signal (thread-safe)
+    inline void add_ready_tasks(Coroutine* const* cos, size_t n) {
+        _task_mgr.add_ready_tasks(cos, n);
+        this->signal();
+    }
+
+    // add a coroutine of this scheduler ready to resume. It MUST be called in the
+    // scheduler thread, no lock is required.
+    inline void add_local_ready_task(Coroutine* co) {
+        _local_ready.push_back(co);
+        _self_signaled = true;
+    }
+
+    // wake up the scheduler. In the scheduler's own thread, no syscall is made,
+    // the next epoll wait just does not block.
+    inline void signal();
+
+    // record a trace event if co_trace is true
+    inline void trace(uint8_t type, uint64_t co, uint32_t arg) {
+        if (unlikely(FLG_co_trace)) {
+            TraceRing* const r = _trace.load(std::memory_order_relaxed);
+            if (r) r->add(type, co, arg);
+        }
+    }
+
+    // trace events of this scheduler, NULL if co_trace has never been true
+    inline const TraceRing* trace_ring() const noexcept {
+        return _trace.load(std::memory_order_acquire);
     }
 
     // sleep for milliseconds in the current coroutine
     inline void sleep(uint32_t ms) {
+        this->trace(TraceRing::tr_timer, _running->id, ms);
         if (_wait_ms > ms) _wait_ms = ms;
-        (void)_timer_mgr.add_timer(ms, _running);
+        _timer_mgr.add_timer(ms, _running);
         SCHEDLOG << "co(" << _running << ")" << (void*)_running->id << " sleep(" << ms << " ms)";
         this->yield();
     }
 
+    // sleep for microseconds in the current coroutine
+    inline void sleep_us(uint32_t us) {
+        this->trace(TraceRing::tr_timer, _running->id, (us + 999) / 1000);
+        if (_wait_us < 0 || _wait_us > us) _wait_us = us;
+        _timer_mgr.add_us_timer(us, _running);
+        SCHEDLOG << "co(" << _running << ")" << (void*)_running->id << " sleep(" << us << " us)";
+        this->yield();
+    }
+
     // add a timer for the current coroutine
     inline void add_timer(uint32_t ms) {
+        this->trace(TraceRing::tr_timer, _running->id, ms);
         if (_wait_ms > ms) _wait_ms = ms;
-        _running->it = _timer_mgr.add_timer(ms, _running);
-        SCHEDLOG << "co(" << _running << ")" << (void*)_running->id << " add timer " << _running->it
-                 << " (" << ms << " ms)";
+        _timer_mgr.add_timer(ms, _running);
+        SCHEDLOG << "co(" << _running << ")" << (void*)_running->id << " add timer (" << ms
+                 << " ms)";
+    }
+
+    // yield the current coroutine if it has run longer than a time slice, it
+    // will be resumed in the next loop of the scheduler. Return true if yielded.
+    bool maybe_yield();
+
+    // id of the coroutine running in this scheduler, 0 if none (thread-safe)
+    inline uint64_t running_id() const noexcept {
+        return _running_id.load(std::memory_order_relaxed);
     }
 
+#ifndef _WIN32
+    // native handle of the scheduler thread, valid after the thread started
+    inline pthread_t thread() const noexcept { return _tid; }
+#endif
+
     // check whether the current coroutine has timed out
     inline bool timeout() const noexcept { return _timeout; }
 
     // add an IO event on a socket to epoll for the current coroutine.
     inline bool add_io_event(sock_t fd, _ev_t ev) {
+        this->trace(TraceRing::tr_io, _running->id, (uint32_t)fd);
+        CO_PROBE3(io_wait, _running->id, (int64_t)fd, (int)ev);
         SCHEDLOG << "co(" << _running << ")" << (void*)_running->id << " add io event fd: " << fd
                  << " ev: " << (int)ev;
 #if defined(_WIN32)
@@ -395,9 +1056,74 @@ class Sched {
         _epoll->del_event(fd);
     }
 
+    // check if the running coroutine shares its stack with other coroutines
+    inline bool shared_stack() const noexcept { return !_dedicated; }
+
+#ifdef __linux__
+    // io_uring of this scheduler, NULL if io_uring is not enabled or not supported
+    inline IoUring* uring() const noexcept { return _uring; }
+
+    // resume coroutines whose io_uring operations have completed
+    void handle_uring();
+#endif
+
+    // statistics of epoll waits, used to tune the busy-poll mode
+    struct PollStats {
+        std::atomic_uint64_t spin_hits{0};    // events found while spinning
+        std::atomic_uint64_t spin_misses{0};  // spun without events, then blocked
+        std::atomic_uint64_t blocking_waits{0};  // waits that may block the thread
+    };
+    inline const PollStats& poll_stats() const noexcept { return _poll_stats; }
+
+    // runtime metrics, updated only by the scheduler thread and readable from
+    // any thread. Use inc() instead of fetch_add() to avoid locked instructions.
+    struct Stats {
+        std::atomic_uint64_t coroutines{0};
+        std::atomic_uint64_t switches{0};
+        std::atomic_uint64_t stack_bytes{0};
+        std::atomic_uint64_t stack_collisions{0};
+        std::atomic_uint64_t ready_tasks{0};
+        std::atomic_uint64_t timers{0};
+        std::atomic_uint64_t wait_us{0};
+        std::atomic_uint64_t run_us{0};
+    };
+    inline const Stats& stats() const noexcept { return _stats; }
+
+    static inline void inc(std::atomic_uint64_t& x, uint64_t n = 1) noexcept {
+        x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // sizes of stacks saved, updated only when co_stack_profile is true. The
+    // sites are keyed by name of the closure type, see co::stack_site.
+    struct StackProfile {
+        std::atomic_uint64_t max_bytes{0};
+        std::atomic_uint64_t hist[16]{};
+        std::mutex mtx;  // for sites
+        co::hash_map<const char*, std::pair<uint64_t, uint64_t>> sites;  // <saves, max bytes>
+    };
+    inline StackProfile& stack_profile() noexcept { return _stack_prof; }
+
+    // statistics of the pool of buffers for saving stacks
+    inline const BufferPool::Stats& buf_stats() const noexcept { return _buf_pool.stats(); }
+
+    // number of tasks picked up in the last loop iteration, used for load balancing
+    inline uint64_t ready_num() const noexcept {
+        return _stats.ready_tasks.load(std::memory_order_relaxed);
+    }
+
     // cputime of this scheduler (us)
     inline int64_t cputime() const noexcept { return _cputime.load(std::memory_order_relaxed); }
 
+    // schedulers that idle schedulers may steal tasks from, used in work-stealing mode
+    inline void set_peers(const co::vector<Sched*>* peers) noexcept { _peers = peers; }
+
+    // a parked scheduler takes no new tasks from go() and does not steal tasks
+    inline void set_parked(bool x) noexcept { _parked.store(x, std::memory_order_relaxed); }
+    inline bool parked() const noexcept { return _parked.load(std::memory_order_relaxed); }
+
+    // pin the scheduler thread to @cpu, it takes effect when the thread starts
+    inline void set_cpu(int cpu) noexcept { _cpu = cpu; }
+
     // start the scheduler thread
     inline void start() { std::thread(&Sched::loop, this).detach(); }
 
@@ -411,43 +1137,93 @@ class Sched {
     // entry function for coroutine
     static void main_func(tb_context_from_t from);
 
+    // wait for I/O events on the epoll, spin for a while before blocking in
+    // busy-poll mode. Return number of events, or -1 on error.
+    int wait_events();
+
+    // wait for at most @us microseconds (-1 for no timeout) in wait_events()
+    int poll_events(int64_t us);
+
+    // steal free tasks from a busy peer to @v, return number of tasks stolen
+    size_t steal(co::vector<Closure*>& v);
+
+    // wake up an idle peer, so that it can steal tasks from this scheduler
+    void wake_idle_peer();
+
     // save stack for the coroutine
     inline void save_stack(Coroutine* co) {
         if (co) {
             SCHEDLOG << "co(" << co << ")" << (void*)co->id
                      << " save stack: " << co->stack->top - (char*)co->ctx;
-            if (!co->pbuf && !_bufs.empty()) co->pbuf = _bufs.pop_back();
+            const size_t n = co->stack->top - (char*)co->ctx;
+            if (co->buf.capacity() < n) {
+                if (co->pbuf) _buf_pool.push(co->pbuf);
+                co->pbuf = _buf_pool.pop(n);
+            }
             co->buf.clear();
-            co->buf.append(co->ctx, co->stack->top - (char*)co->ctx);
+            co->buf.append(co->ctx, n);
+            inc(_stats.stack_bytes, n);
+            if (unlikely(FLG_co_stack_profile)) this->profile_stack(co, n);
         }
     }
 
+    // record size of a stack saved, for co_stack_profile
+    void profile_stack(Coroutine* co, size_t n);
+
     // pop a Coroutine from the pool
-    Coroutine* new_coroutine(Closure* cb) {
+    Coroutine* new_coroutine(Closure* cb, uint8_t prio = 0) {
         Coroutine* co = _co_pool.pop();
         ++co->use_count;
         co->cb = cb;
+        co->type = &typeid(*cb);
+        co->prio = prio;
         if (!co->sched) {
             co->sched = this;
             co->sched_id = this->_id;
-            co->stack = &_stack[co->idx & (_stack_num - 1)];
+            if (!_dedicated) co->stack = &_stack[co->idx & (_stack_num - 1)];
+        }
+        if (_dedicated) {
+            co->stack = this->pop_stack();
+            co->stack->co = co;
         }
-        new (&co->it) timer_id_t(_timer_mgr.end());
+        _timer_mgr.init(co);
+        inc(_stats.coroutines);
         return co;
     }
 
+    // get a shared stack for a coroutine about to start, with co_stack_policy lru
+    Stack* pick_stack();
+
+    // get a dedicated stack from the pool, or create a new one
+    Stack* pop_stack();
+
+    // Memory of the shared stack @s. With co_huge_pages, the shared stacks are
+    // mapped at once in huge pages, without guard pages between them.
+    char* map_shared_stack(Stack* s);
+
+    bool in_huge_stack(const char* p) const noexcept {
+        return _huge_stack && p >= _huge_stack && p < _huge_stack + (size_t)_stack_num * _stack_size;
+    }
+
+    // push a dedicated stack back to the pool, or free it if the pool is full
+    void push_stack(Stack* s);
+
+    // release memory not in use, see co::trim_memory() for @all
+    void trim(bool all);
+
     void recycle(Coroutine* co) {
-        co->it.~timer_id_t();
+        _timer_mgr.fini(co);
+        _stats.coroutines.store(_stats.coroutines.load(std::memory_order_relaxed) - 1,
+                                std::memory_order_relaxed);
+        if (_dedicated) {
+            this->push_stack(co->stack);
+            co->stack = 0;
+        }
         if (co->pbuf) {
-            if (co->buf.capacity() > 8192 || _bufs.size() >= 128) {
-                co->buf.reset();
-                goto end;
-            }
-            _bufs.push_back(co->pbuf);
+            _buf_pool.push(co->pbuf);
             co->pbuf = 0;
         }
-
-    end:
+        if (co->cls) free_cls(co);
         _co_pool.push(co);
     }
 
@@ -455,13 +1231,33 @@ class Sched {
     std::atomic_int64_t _cputime{0};
     co::sync_event _ev;
     Epoll* _epoll;
+#ifdef __linux__
+    IoUring* _uring;
+#endif
     std::atomic_bool _stopped{false};
+    std::atomic_bool _idle{false};  // blocked in epoll wait with nothing to do
+    std::atomic_bool _parked{false};  // see co::set_active_sched_num()
 
     TaskManager _task_mgr;
     TimerManager _timer_mgr;
     uint32_t _wait_ms;  // time the epoll to wait for
+    int64_t _wait_us;   // time(us) to the next us timer, -1 if none
     bool _timeout;
-    co::vector<void*> _bufs;
+    bool _self_signaled;  // signaled in the scheduler thread, do not block in epoll
+    co::vector<Coroutine*> _local_ready;  // ready tasks added in the scheduler thread
+    uint32_t _spin_us;    // time to spin before blocking in epoll wait
+    uint32_t _hi_quota;   // max high-priority tasks run ahead of others per iteration
+    PollStats _poll_stats;
+    Stats _stats;
+    StackProfile _stack_prof;
+    std::atomic<TraceRing*> _trace;  // created when co_trace is true, kept until the end
+    std::atomic_uint64_t _running_id{0};  // read by the watchdog
+    uint64_t _slice_sw;   // context switches when the time slice starts
+    int64_t _slice_us;    // time(us) the time slice starts
+#ifndef _WIN32
+    pthread_t _tid;       // the scheduler thread
+#endif
+    BufferPool _buf_pool;  // buffers for saving stacks
     CoroutinePool _co_pool;
     Coroutine* _running;   // the current running coroutine
     Coroutine* _main_co;   // save the main context
@@ -470,6 +1266,31 @@ class Sched {
     uint32_t _stack_num;   // number of stacks per scheduler
     uint32_t _stack_size;  // size of the stack
     Stack* _stack;         // stack array
+    char* _huge_stack;     // memory of the shared stacks in huge pages, or NULL
+    bool _dedicated;       // each coroutine runs on its own stack
+    co::vector<Stack*> _stack_pool;  // dedicated stacks to reuse
+    int64_t _trim_us;      // time(us) the stacks were trimmed last time
+    bool _stack_used;      // coroutines ran since the last trim
+    std::atomic_bool _trim_all;  // co::trim_memory() was called
+    uint32_t _seed;        // seed for choosing a peer to steal from
+    const co::vector<Sched*>* _peers;
+    int _cpu;              // cpu the scheduler thread is pinned to, -1 for none
+};
+
+// Watchdog checks the schedulers periodically, and warns about coroutines
+// that have been running without yielding longer than co_watchdog_ms.
+class Watchdog {
+  public:
+    Watchdog(const co::vector<Sched*>& scheds, uint32_t ms);
+    ~Watchdog();
+
+  private:
+    void loop();
+
+    const co::vector<Sched*>& _scheds;
+    const uint32_t _ms;
+    co::sync_event _ev;
+    std::thread _thread;
 };
 
 class SchedManager {
@@ -477,15 +1298,28 @@ class SchedManager {
     SchedManager();
     ~SchedManager();
 
-    inline Sched* next_sched() const noexcept { return _next(_scheds); }
+    inline Sched* next_sched() const noexcept {
+        return _next(_scheds, _nactive.load(std::memory_order_relaxed));
+    }
 
     inline const co::vector<Sched*>& scheds() const noexcept { return _scheds; }
 
+    // number of schedulers taking new tasks, they are the first ones in scheds()
+    inline uint32_t active_num() const noexcept {
+        return _nactive.load(std::memory_order_relaxed);
+    }
+
+    // park schedulers except the first @n ones, and unpark the first @n ones
+    void set_active_num(uint32_t n);
+
     void stop();
 
   private:
-    std::function<Sched*(const co::vector<Sched*>&)> _next;
+    // choose a scheduler from the first n ones in v
+    std::function<Sched*(const co::vector<Sched*>& v, uint32_t n)> _next;
     co::vector<Sched*> _scheds;
+    std::atomic_uint32_t _nactive{0};
+    Watchdog* _watchdog;
 };
 
 inline std::atomic_bool& is_active() noexcept {
@@ -498,4 +1332,12 @@ inline Sched*& current_sched() noexcept {
     return _sched;
 }
 
+inline void Sched::signal() {
+    if (current_sched() == this) {
+        _self_signaled = true;
+    } else {
+        _epoll->signal();
+    }
+}
+
 }}  // namespace co::xx
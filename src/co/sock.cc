@@ -2,6 +2,12 @@
 #include "close.h"
 #include "sched.h"
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#else
+#include <sys/uio.h>
+#endif
+
 #ifdef __APPLE__
 #include <dlfcn.h>
 
@@ -21,6 +27,139 @@ int _close_nocancel(int fd) {
 
 namespace co {
 
+#ifdef __linux__
+namespace xx {
+
+// Submit an I/O operation to io_uring and wait for its completion in the current
+// coroutine. @prep fills the SQE. Return result of the operation, -errno on error.
+// If the operation can not be queued, -EAGAIN is returned.
+template <typename F>
+static int uring_io(Sched* sched, uring_op_t* op, F&& prep, int ms) {
+    IoUring* const ring = sched->uring();
+    io_uring_sqe* sqe = ring->get_sqe();
+    if (!sqe) return -EAGAIN;
+    prep(sqe);
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    op->x.state = st_wait;
+    op->done = 0;
+
+    Coroutine* const co = sched->running();
+    co->waitx = &op->x;
+    if (ms != -1) sched->add_timer((uint32_t)ms);
+    sched->yield();
+
+    if (!op->done) {
+        // Timed out, cancel the operation and wait for its completion, as the
+        // kernel may still access the buffer. If the kernel takes no more SQEs
+        // for now, retry later, unless the operation completes meanwhile.
+        while (!op->done && !(sqe = ring->get_sqe())) {
+            op->x.state = st_wait;
+            sched->add_timer(1);
+            sched->yield();
+        }
+        if (!op->done) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)op;
+            op->x.state = st_wait;
+            sched->yield();
+        }
+        if (op->res < 0) op->res = -ETIMEDOUT;
+    }
+    co->waitx = 0;
+    return op->res;
+}
+
+static int uring_recv(Sched* sched, sock_t fd, void* buf, int n, int ms) {
+    // the kernel can not write to the shared stack when the coroutine is suspended
+    const bool bounce = sched->shared_stack() && sched->on_stack(buf);
+    uring_op_t* const op = make_uring_op(sched->running(), bounce ? n : 0);
+    char* const p = bounce ? op->s : (char*)buf;
+    int r;
+    do {
+        r = uring_io(sched, op, [&](io_uring_sqe* e) {
+            e->opcode = IORING_OP_RECV;
+            e->fd = fd;
+            e->addr = (uint64_t)(uintptr_t)p;
+            e->len = (uint32_t)n;
+        }, ms);
+        if (r == -EAGAIN) {
+            io_event ev(fd, ev_read);
+            if (!ev.wait(ms)) { r = -errno; break; }
+        }
+    } while (r == -EAGAIN || r == -EINTR);
+
+    if (r > 0 && bounce) memcpy(buf, op->s, r);
+    co::free(op);
+    if (r < 0) { errno = -r; return -1; }
+    return r;
+}
+
+static int uring_send(Sched* sched, sock_t fd, const void* buf, int n, int ms) {
+    const bool bounce = sched->shared_stack() && sched->on_stack(buf);
+    uring_op_t* const op = make_uring_op(sched->running(), bounce ? n : 0);
+    if (bounce) memcpy(op->s, buf, n);
+    const char* p = bounce ? op->s : (const char*)buf;
+    int remain = n, r;
+    do {
+        r = uring_io(sched, op, [&](io_uring_sqe* e) {
+            e->opcode = IORING_OP_SEND;
+            e->fd = fd;
+            e->addr = (uint64_t)(uintptr_t)p;
+            e->len = (uint32_t)remain;
+        }, ms);
+        if (r > 0) {
+            remain -= r;
+            p += r;
+        } else if (r == -EAGAIN) {
+            io_event ev(fd, ev_write);
+            if (!ev.wait(ms)) { r = -errno; break; }
+        } else if (r != -EINTR) {
+            break;
+        }
+    } while (remain > 0);
+
+    co::free(op);
+    if (remain == 0) return n;
+    errno = r < 0 ? -r : EIO;
+    return -1;
+}
+
+static sock_t uring_accept(Sched* sched, sock_t fd, void* addr, int* addrlen) {
+    struct addr_t {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+    uring_op_t* const op = make_uring_op(sched->running(), sizeof(addr_t));
+    addr_t* const a = (addr_t*)op->s;
+    int r;
+    do {
+        a->len = sizeof(a->addr);
+        r = uring_io(sched, op, [&](io_uring_sqe* e) {
+            e->opcode = IORING_OP_ACCEPT;
+            e->fd = fd;
+            e->addr = (uint64_t)(uintptr_t)&a->addr;
+            e->addr2 = (uint64_t)(uintptr_t)&a->len;
+            e->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        }, -1);
+        if (r == -EAGAIN) {
+            io_event ev(fd, ev_read);
+            ev.wait();
+        }
+    } while (r == -EAGAIN || r == -EINTR);
+
+    if (r >= 0 && addr && addrlen) {
+        memcpy(addr, &a->addr, *addrlen < (int)a->len ? *addrlen : (int)a->len);
+        *addrlen = (int)a->len;
+    }
+    co::free(op);
+    if (r < 0) { errno = -r; return -1; }
+    return r;
+}
+
+} // xx
+#endif
+
 void set_nonblock(sock_t fd) {
     __sys_api(fcntl)(fd, F_SETFL, __sys_api(fcntl)(fd, F_GETFL) | O_NONBLOCK);
 }
@@ -106,6 +245,9 @@ int listen(sock_t fd, int backlog) {
 sock_t accept(sock_t fd, void* addr, int* addrlen) {
     const auto sched = xx::current_sched();//xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
+#ifdef __linux__
+    if (sched->uring()) return xx::uring_accept(sched, fd, addr, addrlen);
+#endif
 
     io_event ev(fd, ev_read);
     do {
@@ -157,6 +299,9 @@ int connect(sock_t fd, const void* addr, int addrlen, int ms) {
 int recv(sock_t fd, void* buf, int n, int ms) {
     const auto sched = xx::current_sched();//xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
+#ifdef __linux__
+    if (sched->uring()) return xx::uring_recv(sched, fd, buf, n, ms);
+#endif
 
     io_event ev(fd, ev_read);
     do {
@@ -174,6 +319,18 @@ int recv(sock_t fd, void* buf, int n, int ms) {
 int recvn(sock_t fd, void* buf, int n, int ms) {
     char* p = (char*) buf;
     int remain = n;
+#ifdef __linux__
+    const auto sched = xx::current_sched();
+    if (sched && sched->uring()) {
+        do {
+            int r = xx::uring_recv(sched, fd, p, remain, ms);
+            if (r <= 0) return r;
+            remain -= r;
+            p += r;
+        } while (remain > 0);
+        return n;
+    }
+#endif
     io_event ev(fd, ev_read);
     do {
         int r = (int) __sys_api(recv)(fd, p, remain, 0);
@@ -213,6 +370,9 @@ int recvfrom(sock_t fd, void* buf, int n, void* addr, int* addrlen, int ms) {
 int send(sock_t fd, const void* buf, int n, int ms) {
     const auto sched = xx::current_sched();//xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
+#ifdef __linux__
+    if (sched->uring()) return xx::uring_send(sched, fd, buf, n, ms);
+#endif
 
     const char* p = (const char*) buf;
     int remain = n;
@@ -235,6 +395,123 @@ int send(sock_t fd, const void* buf, int n, int ms) {
     } while (true);
 }
 
+int sendv(sock_t fd, const struct iovec* iov, int n, int ms) {
+    const auto sched = xx::current_sched();//xx::gSched;
+    CHECK(sched) << "must be called in coroutine..";
+
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+    size_t remain = total;
+    if (remain == 0) return 0;
+
+    // iov is copied only if it was partially sent
+    struct iovec* v = 0;
+    const struct iovec* p = iov;
+    io_event ev(fd, ev_write);
+
+    do {
+        ssize_t r = __sys_api(writev)(fd, p, n);
+        if (r == (ssize_t)remain) break;
+
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) goto err;
+            } else if (errno != EINTR) {
+                goto err;
+            }
+        } else {
+            remain -= r;
+            if (!v) {
+                v = (struct iovec*) ::malloc(sizeof(*v) * n);
+                memcpy(v, p, sizeof(*v) * n);
+                p = v;
+            }
+            struct iovec* x = (struct iovec*)p;
+            while ((size_t)r >= x->iov_len) { r -= x->iov_len; ++x; --n; }
+            x->iov_base = (char*)x->iov_base + r;
+            x->iov_len -= r;
+            p = x;
+        }
+    } while (true);
+
+    if (v) ::free(v);
+    return (int)total;
+
+  err:
+    if (v) ::free(v);
+    return -1;
+}
+
+// read the file in chunks and send them, used if sendfile is not available
+static int64_t sendfile_by_read(sock_t fd, int file, int64_t off, int64_t n, int ms) {
+    const size_t N = 64 * 1024;
+    char* const buf = (char*) ::malloc(n < (int64_t)N ? (size_t)n : N);
+    int64_t remain = n;
+    while (remain > 0) {
+        const size_t k = remain < (int64_t)N ? (size_t)remain : N;
+        const ssize_t r = ::pread(file, buf, k, (off_t)off);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            if (r == 0) errno = EIO;
+            break;
+        }
+        if (co::send(fd, buf, (int)r, ms) != (int)r) break;
+        off += r;
+        remain -= r;
+    }
+    ::free(buf);
+    return remain == 0 ? n : -1;
+}
+
+int64_t sendfile(sock_t fd, int file, int64_t off, int64_t n, int ms) {
+    const auto sched = xx::current_sched();//xx::gSched;
+    CHECK(sched) << "must be called in coroutine..";
+    if (n <= 0) return 0;
+
+#if defined(__linux__) || defined(__APPLE__)
+    int64_t remain = n;
+    io_event ev(fd, ev_write);
+
+    do {
+#ifdef __linux__
+        off_t o = (off_t)off;
+        const size_t k = remain < (1 << 30) ? (size_t)remain : (1 << 30);
+        ssize_t r = ::sendfile(fd, file, &o, k);
+        if (r == 0) { errno = EIO; return -1; } // end of file
+        if (r > 0) {
+            off += r;
+            remain -= r;
+            continue;
+        }
+#else
+        // on mac, bytes sent are returned in len, even if EAGAIN was returned
+        off_t len = (off_t)remain;
+        int r = ::sendfile(file, fd, (off_t)off, &len, 0, 0);
+        if (len > 0) {
+            off += len;
+            remain -= len;
+            if (remain == 0 || r == 0) continue;
+        } else if (r == 0) {
+            errno = EIO;
+            return -1;
+        }
+#endif
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno == EINVAL || errno == ENOSYS || errno == ENOTSUP) {
+            // the file does not support sendfile
+            return sendfile_by_read(fd, file, off, remain, ms) < 0 ? -1 : n;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (remain > 0);
+    return n;
+
+#else
+    return sendfile_by_read(fd, file, off, n, ms);
+#endif
+}
+
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
     const auto sched = xx::current_sched();//xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
@@ -260,6 +537,44 @@ int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int
     } while (true);
 }
 
+#ifdef __linux__
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    const auto sched = xx::current_sched();
+    CHECK(sched) << "must be called in coroutine..";
+
+    io_event ev(fd, ev_read);
+    do {
+        int r = ::recvmmsg(fd, msgs, (unsigned int)n, MSG_DONTWAIT, 0);
+        if (r != -1) return r;
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (true);
+}
+
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    const auto sched = xx::current_sched();
+    CHECK(sched) << "must be called in coroutine..";
+
+    int sent = 0;
+    io_event ev(fd, ev_write);
+    do {
+        int r = ::sendmmsg(fd, msgs + sent, (unsigned int)(n - sent), MSG_DONTWAIT);
+        if (r > 0) {
+            sent += r;
+            if (sent == n) return n;
+        } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (true);
+}
+#endif
+
 } // co
 
 #endif
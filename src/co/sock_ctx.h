@@ -60,9 +60,18 @@ class SockCtx {
         _wev.c = co_id;
     }
 
+    // The fd is added to epoll of a scheduler (edge-triggered, for both read
+    // and write) on the first wait, and it stays there until it is closed. A
+    // wait later needs no epoll_ctl, only the waiting coroutine is recorded.
+    inline bool registered(int sched_id) const noexcept { return _reg == sched_id + 1; }
+    inline bool registered() const noexcept { return _reg != 0; }
+    inline void set_registered(int sched_id) noexcept { _reg = sched_id + 1; }
+
+    // called when the fd is closed
     inline void del_event() noexcept {
         _r64 = 0;
         _w64 = 0;
+        _reg = 0;
     }
     inline void del_ev_read() noexcept { _r64 = 0; }
     inline void del_ev_write() noexcept { _w64 = 0; }
@@ -101,6 +110,7 @@ class SockCtx {
         S _wev;
         uint64_t _w64;
     };
+    int32_t _reg;  // id of the scheduler plus 1, 0 if not registered
 };
 
 #else
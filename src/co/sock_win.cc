@@ -1,7 +1,10 @@
 #ifdef _WIN32
 
 #include "sched.h"
+#include <io.h>
 #include <ws2spi.h>
+#include <atomic>
+#include <mutex>
 
 namespace co {
 
@@ -29,9 +32,234 @@ sock_t socket(int domain, int type, int protocol) {
     return fd;
 }
 
+namespace xx {
+
+// AcceptEx operations kept posted on a listening socket. The first co::accept()
+// on a socket posts FLG_co_accept_ex_num of them, and each one taken by
+// co::accept() is replaced with a new one, so connections arriving in a burst
+// are accepted by the system, without waiting for a coroutine to post AcceptEx.
+//   - An operation is a PerIoInfo with state st_accept, info->co points to the
+//     pool, and info->s holds the accepted socket and the addresses.
+//   - co::close() on the listening socket closes the pool, operations still in
+//     flight are freed by the scheduler when they are aborted.
+struct accept_pool {
+    accept_pool(sock_t fd, int af) : fd(fd), af(af), refs(1), posted(0), closed(false) {}
+    sock_t fd;
+    int af;
+    uint32_t refs;    // the map, co::accept() in progress and operations not freed
+    uint32_t posted;  // operations posted and not done yet
+    bool closed;
+    std::mutex mtx;
+    co::deque<PerIoInfo*> done;      // operations done and not taken yet
+    co::vector<Coroutine*> waiters;  // coroutines waiting in co::accept()
+};
+
+const int kAddrLen = sizeof(sockaddr_in6) + 16;
+
+struct accept_buf {
+    sock_t connfd;
+    char addrs[kAddrLen * 2];
+};
+
+inline accept_buf* get_accept_buf(PerIoInfo* info) { return (accept_buf*)info->s; }
+
+struct accept_pools {
+    std::mutex mtx;
+    co::hash_map<sock_t, accept_pool*> m;
+};
+
+inline accept_pools& pools() {
+    static accept_pools* const p = new accept_pools();
+    return *p;
+}
+
+// co::close() looks up the map only if there is any pool
+std::atomic<uint32_t> g_npools(0);
+
+// call with p->mtx held, return true if the pool should be deleted
+inline bool unref(accept_pool* p, uint32_t n = 1) { return (p->refs -= n) == 0; }
+
+inline void free_accept_op(PerIoInfo* info) {
+    __sys_api(closesocket)(get_accept_buf(info)->connfd);
+    ::free(info);
+}
+
+// post an AcceptEx on the listening socket, return 0 or the error code
+int post_accept(accept_pool* p) {
+    const sock_t connfd = co::tcp_socket(p->af);
+    if (connfd == (sock_t)-1) return WSAGetLastError();
+
+    auto info = (PerIoInfo*)::calloc(1, sizeof(PerIoInfo) + sizeof(accept_buf));
+    auto b = get_accept_buf(info);
+    info->co = p;
+    info->state = st_accept;
+    b->connfd = connfd;
+    {
+        std::lock_guard<std::mutex> g(p->mtx);
+        if (p->closed) {
+            free_accept_op(info);
+            return WSAENOTSOCK;
+        }
+        ++p->refs;
+        ++p->posted;
+    }
+
+    if (accept_ex(p->fd, connfd, b->addrs, 0, kAddrLen, kAddrLen, 0, &info->ol) == FALSE) {
+        const int e = WSAGetLastError();
+        if (e != ERROR_IO_PENDING) {
+            bool dead;
+            {
+                std::lock_guard<std::mutex> g(p->mtx);
+                --p->posted;
+                dead = unref(p);
+            }
+            free_accept_op(info);
+            if (dead) delete p;
+            return e;
+        }
+    }
+    return 0;
+}
+
+// get the pool of @fd with a reference held, create it if not exists
+accept_pool* get_accept_pool(sock_t fd, int af) {
+    auto& x = pools();
+    accept_pool* p;
+    bool created = false;
+    {
+        std::lock_guard<std::mutex> g(x.mtx);
+        auto& v = x.m[fd];
+        if (!v) {
+            v = new accept_pool(fd, af);
+            created = true;
+            g_npools.fetch_add(1, std::memory_order_relaxed);
+        }
+        p = v;
+        std::lock_guard<std::mutex> h(p->mtx);
+        ++p->refs;
+    }
+    if (created) {
+        for (uint32_t i = 0; i < FLG_co_accept_ex_num; ++i) {
+            if (post_accept(p) != 0) break;
+        }
+    }
+    return p;
+}
+
+void close_accept_pool(sock_t fd) {
+    accept_pool* p;
+    {
+        auto& x = pools();
+        std::lock_guard<std::mutex> g(x.mtx);
+        auto it = x.m.find(fd);
+        if (it == x.m.end()) return;
+        p = it->second;
+        x.m.erase(it);
+        g_npools.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    co::vector<PerIoInfo*> ops;
+    co::vector<Coroutine*> waiters;
+    bool dead;
+    {
+        std::lock_guard<std::mutex> g(p->mtx);
+        p->closed = true;
+        for (auto info : p->done) ops.push_back(info);
+        p->done.clear();
+        waiters.swap(p->waiters);
+        dead = unref(p, 1 + (uint32_t)ops.size());
+    }
+    for (auto info : ops) free_accept_op(info);
+    for (auto c : waiters) c->sched->add_ready_task(c);
+    if (dead) delete p;
+}
+
+Coroutine* on_accept_ex_done(PerIoInfo* info, DWORD) {
+    auto p = (accept_pool*)info->co;
+    bool dead;
+    {
+        std::lock_guard<std::mutex> g(p->mtx);
+        --p->posted;
+        if (!p->closed) {
+            p->done.push_back(info);
+            return p->waiters.empty() ? 0 : p->waiters.pop_back();
+        }
+        dead = unref(p);
+    }
+    free_accept_op(info);
+    if (dead) delete p;
+    return 0;
+}
+
+// take a connection accepted by the operations posted on @fd
+sock_t accept_posted(Sched* sched, sock_t fd, int af, void* addr, int* addrlen) {
+    accept_pool* const p = get_accept_pool(fd, af);
+    PerIoInfo* info = 0;
+    int e = 0;
+    for (;;) {
+        std::unique_lock<std::mutex> g(p->mtx);
+        if (!p->done.empty()) {
+            info = p->done.front();
+            p->done.pop_front();
+            break;
+        }
+        if (p->closed) {
+            e = WSAENOTSOCK;
+            break;
+        }
+        if (p->posted == 0) {
+            // nothing in flight, posting failed before
+            g.unlock();
+            if ((e = post_accept(p)) != 0) break;
+            continue;
+        }
+        p->waiters.push_back(sched->running());
+        g.unlock();
+        sched->yield();
+    }
+    // AcceptEx can not be posted on the socket, drop the pool
+    if (!info && e != WSAENOTSOCK) close_accept_pool(fd);
+
+    sock_t connfd = (sock_t)-1;
+    if (info) {
+        post_accept(p);  // replace the operation taken
+        auto b = get_accept_buf(info);
+        // https://docs.microsoft.com/en-us/windows/win32/api/mswsock/nf-mswsock-acceptex
+        int r = ::setsockopt(b->connfd, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char*)&fd, sizeof(fd));
+        if (r == 0) {
+            sockaddr *serv = 0, *peer = 0;
+            int serv_len = sizeof(sockaddr_in6), peer_len = sizeof(sockaddr_in6);
+            get_accept_ex_addrs(b->addrs, 0, kAddrLen, kAddrLen, &serv, &serv_len, &peer, &peer_len);
+            if (addr && addrlen) {
+                if (peer_len <= *addrlen) memcpy(addr, peer, peer_len);
+                *addrlen = peer_len;
+            }
+            connfd = b->connfd;
+            set_skip_iocp_on_success(connfd);
+            ::free(info);
+        } else {
+            e = WSAGetLastError();
+            ELOG << "acceptex set SO_UPDATE_ACCEPT_CONTEXT failed, sock: " << b->connfd;
+            free_accept_op(info);
+        }
+    }
+
+    bool dead;
+    {
+        std::lock_guard<std::mutex> g(p->mtx);
+        dead = unref(p, info ? 2 : 1);
+    }
+    if (dead) delete p;
+    if (connfd == (sock_t)-1) co::error(e);
+    return connfd;
+}
+
+}  // namespace xx
+
 int close(sock_t fd, int ms) {
     if (fd == (sock_t)-1) return 0;
 
+    if (xx::g_npools.load(std::memory_order_relaxed) > 0) xx::close_accept_pool(fd);
     co::get_sock_ctx(fd).del_event();
     const auto sched = xx::current_sched();
     if (sched && ms > 0) sched->sleep(ms);
@@ -107,6 +335,7 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
         af = get_address_family(fd);
         ctx.set_address_family(af);
     }
+    if (FLG_co_accept_ex_num > 0) return xx::accept_posted(sched, fd, af, addr, addrlen);
 
     sock_t connfd = co::tcp_socket(af);
     if (connfd == (sock_t)-1) return connfd;
@@ -200,20 +429,26 @@ int recv(sock_t fd, void* buf, int n, int ms) {
     const auto sched = xx::current_sched();
     CHECK(sched) << "must be called in coroutine..";
 
-    int r, e;
-    io_event ev(fd, ev_read);
-    do {
-        r = __sys_api(recv)(fd, (char*)buf, n, 0);
-        if (r != -1) return r;
+    int r = __sys_api(recv)(fd, (char*)buf, n, 0);
+    if (r != -1) return r;
 
-        e = WSAGetLastError();
-        if (e == WSAEWOULDBLOCK) {
+    // The io_event (and its PerIoInfo) is made only if we have to wait. It waits
+    // with a zero-byte WSARecv, no buffer is pinned while the socket is idle.
+    int e = WSAGetLastError();
+    if (e != WSAEWOULDBLOCK) goto err;
+    {
+        io_event ev(fd, ev_read);
+        do {
             if (!ev.wait(ms)) return -1;
-        } else {
-            co::error(e);
-            return -1;
-        }
-    } while (true);
+            r = __sys_api(recv)(fd, (char*)buf, n, 0);
+            if (r != -1) return r;
+            e = WSAGetLastError();
+        } while (e == WSAEWOULDBLOCK);
+    }
+
+  err:
+    co::error(e);
+    return -1;
 }
 
 int recvn(sock_t fd, void* buf, int n, int ms) {
@@ -222,26 +457,39 @@ int recvn(sock_t fd, void* buf, int n, int ms) {
 
     char* p = (char*)buf;
     int remain = n, r, e;
-    io_event ev(fd, ev_read);
-
     do {
         r = __sys_api(recv)(fd, p, remain, 0);
         if (r == remain) return n;
         if (r == 0) return 0;
+        if (r == -1) break;
+        remain -= r;
+        p += r;
+    } while (true);
 
-        if (r == -1) {
-            e = WSAGetLastError();
-            if (e == WSAEWOULDBLOCK) {
-                if (!ev.wait(ms)) return -1;
+    // wait only if the data is not ready, see co::recv()
+    e = WSAGetLastError();
+    if (e != WSAEWOULDBLOCK) goto err;
+    {
+        io_event ev(fd, ev_read);
+        do {
+            if (!ev.wait(ms)) return -1;
+            r = __sys_api(recv)(fd, p, remain, 0);
+            if (r == remain) return n;
+            if (r == 0) return 0;
+
+            if (r == -1) {
+                e = WSAGetLastError();
+                if (e != WSAEWOULDBLOCK) goto err;
             } else {
-                co::error(e);
-                return -1;
+                remain -= r;
+                p += r;
             }
-        } else {
-            remain -= r;
-            p += r;
-        }
-    } while (true);
+        } while (true);
+    }
+
+  err:
+    co::error(e);
+    return -1;
 }
 
 int recvfrom(sock_t fd, void* buf, int n, void* addr, int* addrlen, int ms) {
@@ -287,25 +535,66 @@ int send(sock_t fd, const void* buf, int n, int ms) {
 
     const char* p = (const char*)buf;
     int remain = n, r, e;
-    io_event ev(fd, ev_write);
-
     do {
         r = __sys_api(send)(fd, p, remain, 0);
         if (r == remain) return n;
+        if (r == -1) break;
+        remain -= r;
+        p += r;
+    } while (true);
 
-        if (r == -1) {
-            e = WSAGetLastError();
-            if (e == WSAEWOULDBLOCK) {
-                if (!ev.wait(ms)) return -1;
+    // wait only if the send buffer is full, see co::recv()
+    e = WSAGetLastError();
+    if (e != WSAEWOULDBLOCK) goto err;
+    {
+        io_event ev(fd, ev_write);
+        do {
+            if (!ev.wait(ms)) return -1;
+            r = __sys_api(send)(fd, p, remain, 0);
+            if (r == remain) return n;
+
+            if (r == -1) {
+                e = WSAGetLastError();
+                if (e != WSAEWOULDBLOCK) goto err;
             } else {
-                co::error(e);
-                return -1;
+                remain -= r;
+                p += r;
             }
-        } else {
-            remain -= r;
-            p += r;
-        }
-    } while (true);
+        } while (true);
+    }
+
+  err:
+    co::error(e);
+    return -1;
+}
+
+int sendv(sock_t fd, const struct iovec* iov, int n, int ms) {
+    int total = 0;
+    for (int i = 0; i < n; ++i) {
+        if (iov[i].iov_len == 0) continue;
+        const int r = co::send(fd, iov[i].iov_base, (int)iov[i].iov_len, ms);
+        if (r < 0) return r;
+        total += r;
+    }
+    return total;
+}
+
+int64_t sendfile(sock_t fd, int file, int64_t off, int64_t n, int ms) {
+    const size_t N = 64 * 1024;
+    if (n <= 0) return 0;
+    if (_lseeki64(file, off, SEEK_SET) < 0) return -1;
+
+    char* const buf = (char*) ::malloc(n < (int64_t)N ? (size_t)n : N);
+    int64_t remain = n;
+    while (remain > 0) {
+        const unsigned int k = remain < (int64_t)N ? (unsigned int)remain : (unsigned int)N;
+        const int r = _read(file, buf, k);
+        if (r <= 0) break;
+        if (co::send(fd, buf, r, ms) != r) break;
+        remain -= r;
+    }
+    ::free(buf);
+    return remain == 0 ? n : -1;
 }
 
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
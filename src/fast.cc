@@ -117,4 +117,64 @@ u64toa_end:
     return len;
 }
 
+// A double which is a short decimal, like 3.25 or 0.001, parses back from m*10^-k
+// if m is the integer nearest to v*10^k and m/10^k == v, as both m and 10^k are
+// exact and the division is correctly rounded. k is the most decimal places
+// that keep m below 10^15, where the neighbors of m are too far from v to also
+// parse back to it. Then a shorter decimal of v, if any, is m without its
+// trailing zeros. Return 0 if @v is not a short decimal.
+inline int dtoa_short(double v, char* buf, int mdp) {
+    static const double p10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    };
+
+    char* p = buf;
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (!(v >= 1e-3 && v < 1e15)) return 0;  // printed with exponent, or 0, nan
+
+    int e = 0;  // digits of the integer part
+    while (v >= p10[e]) ++e;
+    int k = 15 - e;
+    if (k > mdp) k = mdp;
+
+    uint64_t m = (uint64_t)(v * p10[k] + 0.5);
+    if ((double)m / p10[k] != v) return 0;
+    if (m == 0) return 0;
+    if (k >= 8 && m % 100000000 == 0) m /= 100000000, k -= 8;
+    if (k >= 4 && m % 10000 == 0) m /= 10000, k -= 4;
+    if (k >= 2 && m % 100 == 0) m /= 100, k -= 2;
+    if (k >= 1 && m % 10 == 0) m /= 10, k -= 1;
+
+    char s[24];
+    const int n = u64toa(m, s);
+    if (k == 0) {
+        memcpy(p, s, n);
+        p += n;
+        *p++ = '.';
+        *p++ = '0';
+    } else if (n > k) {
+        memcpy(p, s, n - k);
+        p += n - k;
+        *p++ = '.';
+        memcpy(p, s + n - k, k);
+        p += k;
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', k - n);
+        p += k - n;
+        memcpy(p, s, n);
+        p += n;
+    }
+    return (int)(p - buf);
+}
+
+int dtoa(double v, char* buf, int mdp) {
+    const int n = dtoa_short(v, buf, mdp);
+    return n > 0 ? n : milo::dtoa(v, buf, mdp);
+}
+
 }  // namespace fast
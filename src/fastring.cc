@@ -1,10 +1,35 @@
 #include "co/fastring.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#define STR_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define STR_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include <limits.h>
 #include <stdint.h>
 
 namespace str {
 
+inline uint32_t _first_bit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
 inline bool _has_null(size_t x) {
     const size_t o = (size_t)-1 / 255;
     return (x - o) & ~x & (o * 0x80);
@@ -36,19 +61,129 @@ char* memrchr(const char* s, char c, size_t n) {
     return nullptr;
 }
 
+char* memany(const char* s, size_t n, const char* c, size_t m) {
+    if (m <= 1) return m == 1 ? (char*)memchr(s, *c, n) : nullptr;
+
+    const char* const e = s + n;
+    if (m <= 4) {
+        // compare with 4 bytes at a time, some of them may be repeated
+#if defined(STR_SSE2)
+        const __m128i v0 = _mm_set1_epi8(c[0]);
+        const __m128i v1 = _mm_set1_epi8(c[1]);
+        const __m128i v2 = _mm_set1_epi8(c[m > 2 ? 2 : 0]);
+        const __m128i v3 = _mm_set1_epi8(c[m - 1]);
+        for (; e - s >= 16; s += 16) {
+            const __m128i x = _mm_loadu_si128((const __m128i*)s);
+            const __m128i a = _mm_or_si128(_mm_cmpeq_epi8(x, v0), _mm_cmpeq_epi8(x, v1));
+            const __m128i b = _mm_or_si128(_mm_cmpeq_epi8(x, v2), _mm_cmpeq_epi8(x, v3));
+            const uint32_t r = (uint32_t)_mm_movemask_epi8(_mm_or_si128(a, b));
+            if (r) return (char*)s + _first_bit(r);
+        }
+#elif defined(STR_NEON)
+        const uint8x16_t v0 = vdupq_n_u8((uint8_t)c[0]);
+        const uint8x16_t v1 = vdupq_n_u8((uint8_t)c[1]);
+        const uint8x16_t v2 = vdupq_n_u8((uint8_t)c[m > 2 ? 2 : 0]);
+        const uint8x16_t v3 = vdupq_n_u8((uint8_t)c[m - 1]);
+        for (; e - s >= 16; s += 16) {
+            const uint8x16_t x = vld1q_u8((const uint8_t*)s);
+            const uint8x16_t a = vorrq_u8(vceqq_u8(x, v0), vceqq_u8(x, v1));
+            const uint8x16_t b = vorrq_u8(vceqq_u8(x, v2), vceqq_u8(x, v3));
+            const uint64_t r = vget_lane_u64(
+                vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vorrq_u8(a, b)), 4)), 0);
+            if (r) {
+                const uint32_t lo = (uint32_t)r;
+                const uint32_t i = lo ? _first_bit(lo) : 32 + _first_bit((uint32_t)(r >> 32));
+                return (char*)s + (i >> 2);
+            }
+        }
+#endif
+    }
+
+    unsigned char bs[256] = {0};
+    for (size_t i = 0; i < m; ++i) bs[(unsigned char)c[i]] = 1;
+    for (; s < e; ++s) {
+        if (bs[(unsigned char)*s]) return (char*)s;
+    }
+    return nullptr;
+}
+
 #define RETURN_TYPE void*
 #define AVAILABLE(h, h_l, j, n_l) ((j) <= (h_l) - (n_l))
 #include "two_way.h"
 
+// search a short needle (2 <= m < LONG_NEEDLE_THRESHOLD) in [s, s + n) with
+// SIMD, n >= m. Positions where both the first and the last byte of the needle
+// match are found 16 (or 32 with AVX2) at a time, and then verified with
+// memcmp. It stops when less than a block left, and @s, @n are updated to the
+// rest of the string, which is searched by the caller.
+inline char* _memmem_simd(const char*& s, size_t& n, const char* p, size_t m) {
+    const char* const e = s + n - m + 1;  // candidates are in [s, e)
+#if defined(STR_SSE2)
+#ifdef __AVX2__
+    const __m256i yf = _mm256_set1_epi8(p[0]);
+    const __m256i yl = _mm256_set1_epi8(p[m - 1]);
+    for (; e - s >= 32; s += 32) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(s + m - 1));
+        uint32_t r = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, yf), _mm256_cmpeq_epi8(b, yl)));
+        while (r) {
+            const char* const x = s + _first_bit(r);
+            if (::memcmp(x + 1, p + 1, m - 2) == 0) return (char*)x;
+            r &= r - 1;
+        }
+    }
+#endif
+    const __m128i vf = _mm_set1_epi8(p[0]);
+    const __m128i vl = _mm_set1_epi8(p[m - 1]);
+    for (; e - s >= 16; s += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)s);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(s + m - 1));
+        uint32_t r = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, vf), _mm_cmpeq_epi8(b, vl)));
+        while (r) {
+            const char* const x = s + _first_bit(r);
+            if (::memcmp(x + 1, p + 1, m - 2) == 0) return (char*)x;
+            r &= r - 1;
+        }
+    }
+#elif defined(STR_NEON)
+    const uint8x16_t vf = vdupq_n_u8((uint8_t)p[0]);
+    const uint8x16_t vl = vdupq_n_u8((uint8_t)p[m - 1]);
+    for (; e - s >= 16; s += 16) {
+        const uint8x16_t a = vld1q_u8((const uint8_t*)s);
+        const uint8x16_t b = vld1q_u8((const uint8_t*)(s + m - 1));
+        const uint8x16_t c = vandq_u8(vceqq_u8(a, vf), vceqq_u8(b, vl));
+        // 4 bits for each byte
+        uint64_t r =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(c), 4)), 0);
+        while (r) {
+            const uint32_t lo = (uint32_t)r;
+            const uint32_t i = (lo ? _first_bit(lo) : 32 + _first_bit((uint32_t)(r >> 32))) >> 2;
+            if (::memcmp(s + i + 1, p + 1, m - 2) == 0) return (char*)s + i;
+            r &= ~((uint64_t)0xf << (i << 2));
+        }
+    }
+#endif
+    n = e - s + m - 1;
+    return nullptr;
+}
+
 char* memmem(const char* s, size_t n, const char* p, size_t m) {
     if (n < m) return nullptr;
     if (n == 0 || m == 0) return (char*)s;
 
     typedef unsigned char* S;
     if (m < LONG_NEEDLE_THRESHOLD) {
+        if (m == 1) return (char*)memchr(s, *p, n);
+#if defined(STR_SSE2) || defined(STR_NEON)
+        char* const r = _memmem_simd(s, n, p, m);
+        if (r) return r;
+        if (n < m) return nullptr;
+#endif
         const char* const b = s;
         s = (const char*)memchr(s, *p, n);
-        if (!s || m == 1) return (char*)s;
+        if (!s) return nullptr;
 
         n -= s - b;
         return n < m ? nullptr : (char*)two_way_short_needle((S)s, n, (S)p, m);
@@ -278,11 +413,8 @@ fastring& fastring::tolower() {
 
 size_t fastring::find_first_of(const char* s, size_t pos, size_t n) const {
     if (pos < _size && n > 0) {
-        unsigned char bs[256] = {0};
-        for (size_t i = 0; i < n; ++i) bs[(unsigned char)s[i]] = 1;
-        for (size_t i = pos; i < _size; ++i) {
-            if (bs[(unsigned char)_p[i]]) return i;
-        }
+        const char* const p = str::memany(_p + pos, _size - pos, s, n);
+        if (p) return p - _p;
     }
     return npos;
 }
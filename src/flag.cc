@@ -1,8 +1,10 @@
 #include "co/flag.h"
 
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <utility>
 
 #include "co/color.h"
@@ -30,9 +32,11 @@ struct Mod {
     void add_flag(char iden, const char* name, const char* value, const char* help,
                   const char* file, int line, void* addr, const char* alias);
 
-    std::shared_ptr<Flag> find_flag(const char* name);
+    Flag* find_flag(const char* name);
 
     fastring set_flag_value(const char* name, const fastring& value);
+    fastring update_flag_value(const char* name, const fastring& value);
+    fastring on_change(const char* name, std::function<void()>&& cb);
     fastring set_bool_flags(const char* name);
     fastring alias(const char* name, const char* new_name);
 
@@ -41,13 +45,14 @@ struct Mod {
     void print_help();
 
     void make_config(const fastring& exe);
-    void parse_config(const fastring& config);
+    fastring parse_config(const fastring& config, bool reload = false);
     co::vector<fastring> parse_commandline(int argc, char** argv);
     co::vector<fastring> analyze_args(const co::vector<fastring>& args,
                                       co::map<fastring, fastring>& kv, co::vector<fastring>& bools);
 
     co::map<const char*, std::shared_ptr<Flag>> flags;
     co::vector<fastring> alias_holder;
+    std::mutex mtx;  // for flags updated at runtime
 };
 
 inline Mod& mod() {
@@ -74,6 +79,7 @@ struct Flag {
     const char* file;   // file where the flag is defined
     int line;           // line of the file where the flag is defined
     void* addr;         // point to the flag variable
+    co::vector<std::function<void()>> cbs;  // called when the value is updated
 };
 
 Flag::Flag(char iden, const char* name, const char* alias, const char* value, const char* help,
@@ -101,29 +107,50 @@ Flag::Flag(char iden, const char* name, const char* alias, const char* value, co
     }
 }
 
+// Store @v to the flag variable atomically. Other threads may read the flag
+// as a plain variable without any lock, they will never see a partial value.
+template <typename T>
+inline void store(void* addr, T v) {
+    static_assert(sizeof(std::atomic<T>) == sizeof(T), "");
+    static_cast<std::atomic<T>*>(addr)->store(v, std::memory_order_release);
+}
+
+// the value is not changed if @v is invalid
 fastring Flag::set_value(const fastring& v) {
     switch (this->iden) {
         case 's':
             *static_cast<fastring*>(this->addr) = v;
             return fastring();
-        case 'b':
-            *static_cast<bool*>(this->addr) = str::to_bool(v);
+        case 'b': {
+            const bool x = str::to_bool(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
-        case 'i':
-            *static_cast<int32_t*>(this->addr) = str::to_int32(v);
+        }
+        case 'i': {
+            const int32_t x = str::to_int32(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
-        case 'u':
-            *static_cast<uint32_t*>(this->addr) = str::to_uint32(v);
+        }
+        case 'u': {
+            const uint32_t x = str::to_uint32(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
-        case 'I':
-            *static_cast<int64_t*>(this->addr) = str::to_int64(v);
+        }
+        case 'I': {
+            const int64_t x = str::to_int64(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
-        case 'U':
-            *static_cast<uint64_t*>(this->addr) = str::to_uint64(v);
+        }
+        case 'U': {
+            const uint64_t x = str::to_uint64(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
-        case 'd':
-            *static_cast<double*>(this->addr) = str::to_double(v);
+        }
+        case 'd': {
+            const double x = str::to_double(v);
+            if (co::error() == 0) store(this->addr, x);
             break;
+        }
         default:
             return "unknown flag type";
     }
@@ -231,18 +258,20 @@ void Mod::add_flag(char iden, const char* name, const char* value, const char* h
     }
 }
 
-inline std::shared_ptr<Flag> Mod::find_flag(const char* name) {
+// flags are never removed, a raw pointer is enough
+inline Flag* Mod::find_flag(const char* name) {
     auto it = flags.find(name);
-    return it != flags.end() ? it->second : nullptr;
+    return it != flags.end() ? it->second.get() : nullptr;
 }
 
 fastring Mod::alias(const char* name, const char* new_name) {
     fastring e;
-    auto f = this->find_flag(name);
-    if (!f) {
+    auto it = flags.find(name);
+    if (it == flags.end()) {
         e << "flag not found: " << name;
         return e;
     }
+    auto f = it->second;
 
     if (!*new_name) {
         e << "new name is empty";
@@ -271,6 +300,49 @@ fastring Mod::set_flag_value(const char* name, const fastring& value) {
     return e;
 }
 
+// Update a flag at runtime. Non-string flags are stored atomically, callbacks
+// are called out of the lock if the value has been changed.
+fastring Mod::update_flag_value(const char* name, const fastring& value) {
+    fastring e;
+    co::vector<std::function<void()>> cbs;
+    {
+        std::lock_guard<std::mutex> g(mtx);
+        auto f = this->find_flag(name);
+        if (!f) {
+            e << "flag not defined: " << name;
+            return e;
+        }
+
+        const fastring old = f->get_value();
+        if (f->iden == 's') {
+            if (old != value) e << "string flag can't be updated at runtime: " << name;
+            return e;
+        }
+
+        e = f->set_value(value);
+        if (!e.empty()) {
+            e << ": " << value;
+            return e;
+        }
+        if (f->get_value() != old) cbs = f->cbs;
+    }
+
+    for (auto& cb : cbs) cb();
+    return e;
+}
+
+fastring Mod::on_change(const char* name, std::function<void()>&& cb) {
+    fastring e;
+    std::lock_guard<std::mutex> g(mtx);
+    auto f = this->find_flag(name);
+    if (f) {
+        f->cbs.push_back(std::move(cb));
+    } else {
+        e << "flag not defined: " << name;
+    }
+    return e;
+}
+
 // set_bool_flags("abc"):  -abc -> true  or  -a, -b, -c -> true
 fastring Mod::set_bool_flags(const char* name) {
     fastring e;
@@ -449,7 +521,7 @@ co::vector<fastring> Mod::analyze_args(const co::vector<fastring>& args,
 
         // flag: -a, -a b, or -j4
         {
-            std::shared_ptr<Flag> f;
+            Flag* f;
             fastring next;
             fastring name = arg.substr(bp);
 
@@ -609,18 +681,21 @@ fastring getline(co::vector<fastring>& lines, size_t& n) {
     return line;
 }
 
-void Mod::parse_config(const fastring& config) {
-    fs::file f(config, 'r');
+// The program exits on any error, unless @reload is true. In that case, errors
+// are returned, one per line, and flags are updated with update_flag_value().
+fastring Mod::parse_config(const fastring& config, bool reload) {
+    fastring err;
+    fs::mmap_file f(config, fs::mmap_file::sequential);
     if (!f) {
+        if (reload) return err << "can't open config file: " << config;
         std::cout << "can't open config file: " << config << std::endl;
         ::exit(0);
     }
 
-    fastring data = f.read((size_t)f.size());
     char sep = '\n';
-    if (data.find('\n') == data.npos && data.find('\r') != data.npos) sep = '\r';
+    if (!memchr(f.data(), '\n', f.size()) && memchr(f.data(), '\r', f.size())) sep = '\r';
 
-    auto lines = str::split(data, sep);
+    auto lines = str::split(f.data(), f.size(), sep);
     size_t lineno = 0;  // line number
 
     for (size_t i = 0; i < lines.size();) {
@@ -630,6 +705,10 @@ void Mod::parse_config(const fastring& config) {
 
         size_t p = s.find('=');
         if (p == 0 || p == s.npos) {
+            if (reload) {
+                err << "invalid config: " << s << ", at " << config << ':' << (lineno + 1) << '\n';
+                continue;
+            }
             std::cout << "invalid config: " << s << ", at " << config << ':' << (lineno + 1)
                       << std::endl;
             ::exit(0);
@@ -639,6 +718,12 @@ void Mod::parse_config(const fastring& config) {
         fastring val = str::trim(s.substr(p + 1), " \t", 'l');
         remove_quotes_and_comments(val);
 
+        if (reload) {
+            fastring e = this->update_flag_value(flg.c_str(), val);
+            if (!e.empty()) err << e << ", at " << config << ':' << (lineno + 1) << '\n';
+            continue;
+        }
+
         fastring e = this->set_flag_value(flg.c_str(), val);
         if (!e.empty()) {
             if (!e.starts_with("flag not defined")) {
@@ -650,6 +735,7 @@ void Mod::parse_config(const fastring& config) {
             }
         }
     }
+    return err;
 }
 
 void add_flag(char iden, const char* name, const char* value, const char* help, const char* file,
@@ -678,4 +764,18 @@ fastring set_value(const char* name, const fastring& value) {
 
 fastring alias(const char* name, const char* new_name) { return xx::mod().alias(name, new_name); }
 
+fastring update(const char* name, const fastring& value) {
+    return xx::mod().update_flag_value(name, value);
+}
+
+fastring on_change(const char* name, std::function<void()>&& cb) {
+    return xx::mod().on_change(name, std::move(cb));
+}
+
+fastring reload(const fastring& path) {
+    fastring e = xx::mod().parse_config(path.empty() ? FLG_config : path, true);
+    if (e.ends_with('\n')) e.resize(e.size() - 1);
+    return e;
+}
+
 }  // namespace flag
@@ -7,11 +7,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "./co/close.h"
+#include "co/flag.h"
+
+DEC_bool(co_file_offload);
 
 namespace fs {
 
@@ -77,7 +83,7 @@ bool _rmdir(fastring& s) {
         if (is_dot_or_dotdot(e->d_name)) continue;  // ignore . and ..
         s.resize(n);
         s.append('/').append(e->d_name);
-        if (fs::isdir(s.c_str())) {
+        if (e->d_type == DT_DIR || (e->d_type == DT_UNKNOWN && fs::isdir(s.c_str()))) {
             if (!_rmdir(s)) goto err;
         } else {
             if (::unlink(s.c_str()) != 0 && errno != ENOENT) goto err;
@@ -207,6 +213,34 @@ void file::close() {
     }
 }
 
+// Go through the hooks if file I/O in coroutines is offloaded to the blocking-I/O
+// threads, otherwise call the system API directly.
+inline ssize_t _read(int fd, void* s, size_t n) {
+    return FLG_co_file_offload ? ::read(fd, s, n) : __sys_api(read)(fd, s, n);
+}
+
+inline ssize_t _write(int fd, const void* s, size_t n) {
+    return FLG_co_file_offload ? ::write(fd, s, n) : __sys_api(write)(fd, s, n);
+}
+
+#ifdef _CO_DISABLE_HOOK
+inline ssize_t _pio(int fd, bool w, void* s, size_t n, int64_t off) {
+    return w ? ::pwrite(fd, s, n, (off_t)off) : ::pread(fd, s, n, (off_t)off);
+}
+
+inline ssize_t _piov(int fd, bool w, const struct iovec* iov, int n, int64_t off) {
+    return w ? ::pwritev(fd, iov, n, (off_t)off) : ::preadv(fd, iov, n, (off_t)off);
+}
+#else
+inline ssize_t _pio(int fd, bool w, void* s, size_t n, int64_t off) {
+    return co::xx::file_pio(fd, w, s, n, off);
+}
+
+inline ssize_t _piov(int fd, bool w, const struct iovec* iov, int n, int64_t off) {
+    return co::xx::file_piov(fd, w, iov, n, off);
+}
+#endif
+
 static int g_seekfrom[3] = {SEEK_SET, SEEK_CUR, SEEK_END};
 
 void file::seek(int64_t off, int whence) {
@@ -216,6 +250,22 @@ void file::seek(int64_t off, int whence) {
     }
 }
 
+bool file::preallocate(int64_t n) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+#if defined(__linux__)
+    return ::fallocate(p->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)n) == 0;
+#elif defined(__APPLE__)
+    fstore_t st = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)n, 0};
+    if (::fcntl(p->fd, F_PREALLOCATE, &st) != -1) return true;
+    st.fst_flags = F_ALLOCATEALL;
+    return ::fcntl(p->fd, F_PREALLOCATE, &st) != -1;
+#else
+    (void)n;
+    return false;
+#endif
+}
+
 size_t file::read(void* s, size_t n) {
     fctx* p = (fctx*)_p;
     if (!p || p->fd == nullfd) return 0;
@@ -226,7 +276,7 @@ size_t file::read(void* s, size_t n) {
 
     while (true) {
         size_t toread = (remain < N ? remain : N);
-        auto r = __sys_api(read)(p->fd, c, toread);
+        auto r = _read(p->fd, c, toread);
         if (r > 0) {
             remain -= (size_t)r;
             if (remain == 0) return n;
@@ -245,6 +295,82 @@ fastring file::read(size_t n) {
     return s;
 }
 
+// pread or pwrite until @n bytes are done, or the end of the file was reached
+static size_t pio(int fd, bool w, void* s, size_t n, int64_t off) {
+    char* c = (char*)s;
+    size_t remain = n;
+    const size_t N = 1u << 30;  // 1G
+
+    while (remain > 0) {
+        const size_t x = (remain < N ? remain : N);
+        auto r = _pio(fd, w, c, x, off);
+        if (r > 0) {
+            remain -= (size_t)r;
+            c += (size_t)r;
+            off += r;
+        } else if (r == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    return n - remain;
+}
+
+// preadv or pwritev, the rest are done buffer by buffer after a partial transfer
+static size_t piov(int fd, bool w, const struct iovec* iov, int n, int64_t off) {
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+
+    ssize_t r;
+    do {
+        r = _piov(fd, w, iov, n, off);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0 || (size_t)r == total) return r > 0 ? (size_t)r : 0;
+
+    size_t done = (size_t)r, skip = done;
+    for (int i = 0; i < n; ++i) {
+        const size_t len = iov[i].iov_len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        const size_t x = pio(fd, w, (char*)iov[i].iov_base + skip, len - skip, off + done);
+        done += x;
+        if (x < len - skip) break;
+        skip = 0;
+    }
+    return done;
+}
+
+size_t file::pread(void* s, size_t n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return pio(p->fd, false, s, n, off);
+}
+
+fastring file::pread(size_t n, int64_t off) {
+    fastring s(n + 1);
+    s.resize(this->pread((void*)s.data(), n, off));
+    return s;
+}
+
+size_t file::preadv(const struct iovec* iov, int n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return piov(p->fd, false, iov, n, off);
+}
+
+size_t file::pwrite(const void* s, size_t n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return pio(p->fd, true, (void*)s, n, off);
+}
+
+size_t file::pwritev(const struct iovec* iov, int n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return piov(p->fd, true, iov, n, off);
+}
+
 size_t file::write(const void* s, size_t n) {
     fctx* p = (fctx*)_p;
     if (!p || p->fd == nullfd) return 0;
@@ -255,7 +381,7 @@ size_t file::write(const void* s, size_t n) {
 
     while (true) {
         size_t towrite = (remain < N ? remain : N);
-        auto r = __sys_api(write)(p->fd, c, towrite);
+        auto r = _write(p->fd, c, towrite);
         if (r >= 0) {
             remain -= (size_t)r;
             if (remain == 0) return n;
@@ -266,17 +392,141 @@ size_t file::write(const void* s, size_t n) {
     }
 }
 
-#undef nullfd
+bool mmap_file::open(const char* path, int adv) {
+    this->close();
+    if (!path || !*path) return false;
+
+    const int fd = xx::open(path, 'r');
+    if (fd == nullfd) return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) goto err;
+    if (st.st_size == 0) {
+        _p = "";
+        _n = 0;
+        _close_nocancel(fd);
+        return true;
+    }
+
+    do {
+        void* x = ::mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (x == MAP_FAILED) goto err;
+        _p = (const char*)x;
+        _n = (size_t)st.st_size;
+        _close_nocancel(fd);  // the mapping keeps a reference to the file
+    } while (0);
+
+    if (adv & sequential) ::madvise((void*)_p, _n, MADV_SEQUENTIAL);
+    if (adv & random) ::madvise((void*)_p, _n, MADV_RANDOM);
+    if (adv & willneed) ::madvise((void*)_p, _n, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (adv & hugepage) ::madvise((void*)_p, _n, MADV_HUGEPAGE);
+#endif
+    return true;
+
+err:
+    _close_nocancel(fd);
+    return false;
+}
+
+void mmap_file::close() {
+    if (_p) {
+        if (_n > 0) ::munmap((void*)_p, _n);
+        _p = 0;
+        _n = 0;
+    }
+}
+
+#ifdef __linux__
+// a record returned by getdents64, the same as struct linux_dirent64
+struct dent_t {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// entries are read with getdents64 in large batches, to save syscalls on
+// directories with lots of files.
+static const int kDirBufSize = 128 * 1024;
+
+struct dctx {
+    size_t n;
+    int fd;
+    int pos;    // offset of the next record in buf
+    int end;    // size of the records in buf
+    char* buf;  // allocated on the first read
+    dent_t* e;
+};
+
+inline bool _is_open(dctx* d) { return d->fd != nullfd; }
+
+inline int _dirfd(dctx* d) { return d->fd; }
+
+inline bool _opendir(dctx* d, const char* path) {
+    d->fd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    d->pos = d->end = 0;
+    return d->fd != nullfd;
+}
+
+inline void _closedir(dctx* d) {
+    _close_nocancel(d->fd);
+    d->fd = nullfd;
+}
+
+static dent_t* _readdir(dctx* d) {
+    if (d->pos >= d->end) {
+        if (!d->buf) {
+            d->buf = (char*)::malloc(kDirBufSize);
+            assert(d->buf);
+        }
+        const long r = ::syscall(SYS_getdents64, d->fd, d->buf, kDirBufSize);
+        if (r <= 0) return nullptr;
+        d->pos = 0;
+        d->end = (int)r;
+    }
+    dent_t* const e = (dent_t*)(d->buf + d->pos);
+    d->pos += e->d_reclen;
+    return e;
+}
+
+#else
+typedef struct dirent dent_t;
 
 struct dctx {
     size_t n;
     DIR* d;
-    struct dirent* e;
+    char* buf;  // not used
+    dent_t* e;
 };
 
+inline bool _is_open(dctx* d) { return d->d != nullptr; }
+
+inline int _dirfd(dctx* d) { return ::dirfd(d->d); }
+
+inline bool _opendir(dctx* d, const char* path) { return (d->d = ::opendir(path)) != nullptr; }
+
+inline void _closedir(dctx* d) {
+    ::closedir(d->d);
+    d->d = nullptr;
+}
+
+inline dent_t* _readdir(dctx* d) { return ::readdir(d->d); }
+#endif
+
+// move to the next entry except . and .., return false at the end
+inline bool _next(dctx* d) {
+    while ((d->e = _readdir(d))) {
+        if (!is_dot_or_dotdot(d->e->d_name)) return true;
+    }
+    return false;
+}
+
 dir::~dir() {
     if (_p) {
         this->close();
+        ::free(((dctx*)_p)->buf);
         ::free(_p);
         _p = 0;
     }
@@ -293,6 +543,7 @@ bool dir::open(const char* path) {
     if (!d || d->n < x) {
         _p = ::realloc(_p, x);
         assert(_p);
+        if (!d) memset(_p, 0, sizeof(dctx));
         d = (dctx*)_p;
         memcpy(d + 1, path, n);
         d->n = x;
@@ -300,30 +551,23 @@ bool dir::open(const char* path) {
         memcpy(d + 1, path, n);
     }
 
-    d->d = ::opendir(path);
     d->e = nullptr;
-    return d->d;
+    return _opendir(d, path);
 }
 
 void dir::close() {
     dctx* d = (dctx*)_p;
-    if (d && d->d) {
-        ::closedir(d->d);
-        d->d = nullptr;
-    }
+    if (d && _is_open(d)) _closedir(d);
 }
 
 const char* dir::path() const { return _p ? ((char*)_p + sizeof(dctx)) : ""; }
 
 co::vector<fastring> dir::all() const {
     dctx* d = (dctx*)_p;
-    if (!d || !d->d) return co::vector<fastring>();
+    if (!d || !_is_open(d)) return co::vector<fastring>();
 
     co::vector<fastring> r(8);
-    while ((d->e = ::readdir(d->d))) {
-        char* const p = d->e->d_name;
-        if (!is_dot_or_dotdot(p)) r.push_back(p);
-    }
+    while (_next(d)) r.push_back(d->e->d_name);
     return r;
 }
 
@@ -335,28 +579,49 @@ fastring dir::iterator::operator*() const {
 dir::iterator& dir::iterator::operator++() {
     dctx* d = (dctx*)_p;
     if (d) {
-        assert(d->d);
-        while ((d->e = ::readdir(d->d))) {
-            char* const p = d->e->d_name;
-            if (!is_dot_or_dotdot(p)) break;
-        }
-        if (!d->e) _p = nullptr;
+        assert(_is_open(d));
+        if (!_next(d)) _p = nullptr;
     }
     return *this;
 }
 
-dir::iterator dir::begin() const {
+dir::type_t dir::iterator::type() const {
     dctx* d = (dctx*)_p;
-    if (d && d->d) {
-        while ((d->e = ::readdir(d->d))) {
-            char* const p = d->e->d_name;
-            if (!is_dot_or_dotdot(p)) break;
-        }
-        if (d->e) return dir::iterator(_p);
+    assert(d);
+    switch (d->e->d_type) {
+    case DT_REG:
+        return dir::regular;
+    case DT_DIR:
+        return dir::directory;
+    case DT_LNK:
+        return dir::symlink;
+    case DT_UNKNOWN:
+        break;
+    default:
+        return dir::other;
     }
+
+    struct stat st;
+    if (::fstatat(_dirfd(d), d->e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) return dir::unknown;
+    if (S_ISREG(st.st_mode)) return dir::regular;
+    if (S_ISDIR(st.st_mode)) return dir::directory;
+    if (S_ISLNK(st.st_mode)) return dir::symlink;
+    return dir::other;
+}
+
+uint64_t dir::iterator::ino() const {
+    assert(_p);
+    return (uint64_t)((dctx*)_p)->e->d_ino;
+}
+
+dir::iterator dir::begin() const {
+    dctx* d = (dctx*)_p;
+    if (d && _is_open(d) && _next(d)) return dir::iterator(_p);
     return dir::iterator(nullptr);
 }
 
+#undef nullfd
+
 }  // namespace fs
 
 #endif
@@ -0,0 +1,91 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "co/fs.h"
+#include "co/vector.h"
+
+namespace fs {
+namespace {
+
+typedef std::function<bool(const fastring&, dir::type_t)> F;
+
+inline void join(fastring& s, const fastring& base, const fastring& name) {
+    s.clear();
+    s.append(base);
+    if (!s.empty() && s.back() != '/' && s.back() != '\\') s.append('/');
+    s.append(name);
+}
+
+// read entries of the directory @path, subdirectories to be entered are pushed
+// to @subdirs.
+void read_dir(const fastring& path, const F& f, co::vector<fastring>& subdirs) {
+    dir d(path);
+    fastring s(path.size() + 64);
+    for (auto it = d.begin(); it != d.end(); ++it) {
+        join(s, path, *it);
+        const dir::type_t t = it.type();
+        if (f(s, t) && t == dir::directory) subdirs.push_back(s);
+    }
+}
+
+void walk_serial(const char* path, const F& f) {
+    co::vector<fastring> dirs(32);
+    dirs.push_back(path);
+    while (!dirs.empty()) {
+        const fastring x = dirs.pop_back();
+        read_dir(x, f, dirs);
+    }
+}
+
+// Directories to be read are kept in a shared stack, and @n threads take them
+// from it. The walk is done when the stack is empty and no thread is busy.
+class walker {
+  public:
+    walker(const char* path, const F& f) : _f(f), _dirs(64), _busy(0) {
+        _dirs.push_back(path);
+    }
+
+    void run(int n) {
+        co::vector<std::thread> v(n);
+        for (int i = 0; i < n; ++i) v.emplace_back(&walker::loop, this);
+        for (auto& t : v) t.join();
+    }
+
+  private:
+    void loop() {
+        co::vector<fastring> subdirs(32);
+        std::unique_lock<std::mutex> g(_m);
+        for (;;) {
+            while (_dirs.empty() && _busy > 0) _cv.wait(g);
+            if (_dirs.empty()) break;
+
+            const fastring x = _dirs.pop_back();
+            ++_busy;
+            g.unlock();
+            read_dir(x, _f, subdirs);
+            g.lock();
+            --_busy;
+
+            for (auto& s : subdirs) _dirs.push_back(std::move(s));
+            subdirs.clear();
+            if (!_dirs.empty() || _busy == 0) _cv.notify_all();
+        }
+    }
+
+    const F& _f;
+    co::vector<fastring> _dirs;
+    int _busy;
+    std::mutex _m;
+    std::condition_variable _cv;
+};
+
+}  // namespace
+
+void walk(const char* path, const F& f, int threads) {
+    if (!path || !*path) return;
+    if (threads <= 1) return walk_serial(path, f);
+    walker(path, f).run(threads);
+}
+
+}  // namespace fs
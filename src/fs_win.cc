@@ -1,6 +1,8 @@
 #ifdef _WIN32
 #include "co/fs.h"
 
+#include "co/co/sock.h"  // for struct iovec
+
 #ifdef _MSC_VER
 #pragma warning(disable : 4800)
 #endif
@@ -341,6 +343,14 @@ void file::seek(int64_t off, int whence) {
     }
 }
 
+bool file::preallocate(int64_t n) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return false;
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = n;
+    return SetFileInformationByHandle(p->fd, FileAllocationInfo, &info, sizeof(info)) == TRUE;
+}
+
 size_t file::read(void* s, size_t n) {
     fctx* p = (fctx*)_p;
     if (!p || p->fd == nullfd) return 0;
@@ -368,6 +378,69 @@ fastring file::read(size_t n) {
     return s;
 }
 
+// ReadFile or WriteFile at offset @off until @n bytes are done, the file
+// position is moved on windows
+static size_t pio(HANDLE fd, bool w, void* s, size_t n, int64_t off) {
+    char* c = (char*)s;
+    size_t remain = n;
+    const size_t N = 1u << 30;  // 1G
+
+    while (remain > 0) {
+        DWORD r = 0;
+        const DWORD x = (DWORD)(remain < N ? remain : N);
+        OVERLAPPED o;
+        memset(&o, 0, sizeof(o));
+        o.Offset = (DWORD)off;
+        o.OffsetHigh = (DWORD)(off >> 32);
+        const BOOL ok = w ? WriteFile(fd, c, x, &r, &o) : ReadFile(fd, c, x, &r, &o);
+        if (!ok || r == 0) break;
+        remain -= r;
+        c += r;
+        off += r;
+    }
+    return n - remain;
+}
+
+static size_t piov(HANDLE fd, bool w, const struct iovec* iov, int n, int64_t off) {
+    size_t done = 0;
+    for (int i = 0; i < n; ++i) {
+        const size_t x = pio(fd, w, iov[i].iov_base, iov[i].iov_len, off + done);
+        done += x;
+        if (x < iov[i].iov_len) break;
+    }
+    return done;
+}
+
+size_t file::pread(void* s, size_t n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return pio(p->fd, false, s, n, off);
+}
+
+fastring file::pread(size_t n, int64_t off) {
+    fastring s(n + 1);
+    s.resize(this->pread((void*)s.data(), n, off));
+    return s;
+}
+
+size_t file::preadv(const struct iovec* iov, int n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return piov(p->fd, false, iov, n, off);
+}
+
+size_t file::pwrite(const void* s, size_t n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return pio(p->fd, true, (void*)s, n, off);
+}
+
+size_t file::pwritev(const struct iovec* iov, int n, int64_t off) {
+    fctx* p = (fctx*)_p;
+    if (!p || p->fd == nullfd) return 0;
+    return piov(p->fd, true, iov, n, off);
+}
+
 size_t file::write(const void* s, size_t n) {
     fctx* p = (fctx*)_p;
     if (!p || p->fd == nullfd) return 0;
@@ -389,6 +462,54 @@ size_t file::write(const void* s, size_t n) {
     }
 }
 
+// Advices are not supported on windows, except that willneed prefetches the
+// whole file (windows 8+).
+bool mmap_file::open(const char* path, int adv) {
+    this->close();
+    if (!path || !*path) return false;
+
+    HANDLE fd = xx::open(path, 'r');
+    if (fd == nullfd) return false;
+
+    LARGE_INTEGER size;
+    HANDLE m = 0;
+    void* x = 0;
+    if (!GetFileSizeEx(fd, &size)) goto end;
+    if (size.QuadPart == 0) {
+        _p = "";
+        _n = 0;
+        goto end;
+    }
+
+    // the view keeps a reference to the file, handles can be closed then
+    m = CreateFileMappingW(fd, 0, PAGE_READONLY, 0, 0, 0);
+    if (m) x = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (x) {
+        _p = (const char*)x;
+        _n = (size_t)size.QuadPart;
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+        if (adv & willneed) {
+            WIN32_MEMORY_RANGE_ENTRY e = {x, _n};
+            PrefetchVirtualMemory(GetCurrentProcess(), 1, &e, 0);
+        }
+#endif
+    }
+
+end:
+    (void)adv;
+    if (m) CloseHandle(m);
+    CloseHandle(fd);
+    return _p != 0;
+}
+
+void mmap_file::close() {
+    if (_p) {
+        if (_n > 0) UnmapViewOfFile(_p);
+        _p = 0;
+        _n = 0;
+    }
+}
+
 #undef nullfd
 
 struct dctx {
@@ -480,6 +601,17 @@ dir::iterator& dir::iterator::operator++() {
     return *this;
 }
 
+dir::type_t dir::iterator::type() const {
+    assert(_p);
+    const DWORD x = ((dctx*)_p)->e.dwFileAttributes;
+    if (x & FILE_ATTRIBUTE_REPARSE_POINT) return dir::symlink;
+    if (x & FILE_ATTRIBUTE_DIRECTORY) return dir::directory;
+    if (x & FILE_ATTRIBUTE_DEVICE) return dir::other;
+    return dir::regular;
+}
+
+uint64_t dir::iterator::ino() const { return 0; }
+
 dir::iterator dir::begin() const {
     dctx* d = (dctx*)_p;
     if (d && d->d != INVALID_HANDLE_VALUE) {
@@ -0,0 +1,124 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "co/fs.h"
+
+namespace fs {
+namespace {
+
+// The background writer of async_fstream. It owns the file and a buffer, and
+// the caller swaps its full buffer with the idle one here.
+struct writer_t {
+    explicit writer_t(size_t cap) : buf(cap), busy(false), stop(false) {}
+
+    ~writer_t() {
+        if (t.joinable()) {
+            {
+                std::lock_guard<std::mutex> g(m);
+                stop = true;
+            }
+            cv.notify_all();
+            t.join();
+        }
+    }
+
+    void start() { t = std::thread(&writer_t::loop, this); }
+
+    // data submitted before the stop is still written
+    void loop() {
+        std::unique_lock<std::mutex> g(m);
+        for (;;) {
+            while (!busy && !stop) cv.wait(g);
+            if (!busy) break;
+            g.unlock();
+            f.write(buf.data(), buf.size());
+            buf.clear();
+            g.lock();
+            busy = false;
+            cv.notify_all();
+        }
+    }
+
+    // swap @s with the idle buffer and wake up the writer, wait first if the
+    // writer is still busy with the last one.
+    void submit(fastream& s) {
+        std::unique_lock<std::mutex> g(m);
+        while (busy) cv.wait(g);
+        buf.swap(s);
+        busy = true;
+        cv.notify_all();
+    }
+
+    // wait until the writer is idle, the file can be written by the caller then
+    void wait() {
+        std::unique_lock<std::mutex> g(m);
+        while (busy) cv.wait(g);
+    }
+
+    fs::file f;
+    fastream buf;
+    bool busy;
+    bool stop;
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread t;
+};
+
+}  // namespace
+
+async_fstream::async_fstream(size_t cap) : _s(cap), _cap(cap), _p(0) {}
+
+async_fstream::async_fstream(const char* path, char mode, size_t cap)
+    : _s(cap), _cap(cap), _p(0) {
+    this->open(path, mode);
+}
+
+async_fstream::~async_fstream() { this->close(); }
+
+async_fstream::operator bool() const { return _p && (bool)((writer_t*)_p)->f; }
+
+bool async_fstream::open(const char* path, char mode) {
+    this->close();
+    auto w = new writer_t(_cap);
+    if (!w->f.open(path, mode == 'w' ? 'w' : 'a')) {
+        delete w;
+        return false;
+    }
+    w->start();
+    _p = w;
+    return true;
+}
+
+void async_fstream::_submit(const void* s, size_t n) {
+    auto w = (writer_t*)_p;
+    if (!_s.empty()) w ? w->submit(_s) : _s.clear();
+    if (n == 0) return;
+    if (n <= _cap) {
+        _s.append(s, n);
+    } else if (w) {
+        // too large for a buffer, write it directly after the pending data
+        w->wait();
+        w->f.write(s, n);
+    }
+}
+
+void async_fstream::flush() {
+    auto w = (writer_t*)_p;
+    if (w) {
+        if (!_s.empty()) w->submit(_s);
+        w->wait();
+    } else {
+        _s.clear();
+    }
+}
+
+void async_fstream::close() {
+    this->flush();
+    if (_p) {
+        delete (writer_t*)_p;
+        _p = 0;
+    }
+}
+
+}  // namespace fs
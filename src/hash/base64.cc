@@ -1,81 +1,294 @@
 #include "co/hash/base64.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define B64_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define B64_NEON
+#include <arm_neon.h>
+#endif
+
 static const char* entab = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-fastring base64_encode(const void* p, size_t n) {
-    const size_t k = n / 3;
-    const int r = (int)(n - k * 3);  // r = n % 3
+static const int8_t detab[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1, -1, 0,  1,  2,  3,  4,  5,  6,
+    7,  8,  9,  10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+    49, 50, 51, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
 
-    fastring v;
-    v.resize((k + !!r) * 4);  // size: 4k or 4k + 4
-    char* x = (char*)v.data();
+namespace {
+
+// The SIMD code follows the algorithms of W. Muła and D. Lemire, "Faster Base64
+// Encoding and Decoding Using AVX2 Instructions". enc_simd() and dec_simd()
+// process as many blocks as they can and return the number of input bytes
+// consumed, the rest is left to the scalar code.
+#if defined(B64_AVX2)
+#if defined(__GNUC__) || defined(__clang__)
+#define B64_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define B64_TARGET_AVX2
+#endif
+
+// 24 bytes -> 32 chars, 28 bytes are read from @s
+B64_TARGET_AVX2
+size_t enc_avx2(const uint8_t* s, size_t n, char* x) {
+    const __m256i shuf = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+    );
+    const __m256i lut = _mm256_setr_epi8(
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0
+    );
+    const uint8_t* const b = s;
+    for (; n >= 28; n -= 24, s += 24, x += 32) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)s)),
+            _mm_loadu_si128((const __m128i*)(s + 12)), 1
+        );
+        // split every 3 bytes into 4 indexes of 6 bits
+        v = _mm256_shuffle_epi8(v, shuf);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t1, t3);
 
-    unsigned char a, b, c;
+        // index -> ascii, by adding an offset looked up by the range of the index
+        __m256i r = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        r = _mm256_sub_epi8(r, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25)));
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, r));
+        _mm256_storeu_si256((__m256i*)x, v);
+    }
+    return s - b;
+}
+
+// 32 chars -> 24 bytes, 32 bytes are written to @x. It stops at the first
+// block with any character out of the base64 alphabet, including '=' and '\r'.
+B64_TARGET_AVX2
+size_t dec_avx2(const uint8_t* s, size_t n, char* x) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+    );
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+    );
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+    );
+    const __m256i shuf = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+    );
+    const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+    const __m256i m0f = _mm256_set1_epi8(0x0f);
+    const __m256i m2f = _mm256_set1_epi8(0x2f);
+
+    const uint8_t* const b = s;
+    for (; n >= 32; n -= 32, s += 32, x += 24) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)s);
+        const __m256i hn = _mm256_and_si256(_mm256_srli_epi32(v, 4), m0f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(v, m0f));
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hn);
+        if (!_mm256_testz_si256(lo, hi)) break;
+
+        // ascii -> index, '/' is the only one that shares the high nibble with '+'
+        const __m256i eq2f = _mm256_cmpeq_epi8(v, m2f);
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq2f, hn)));
+
+        // pack every 4 indexes of 6 bits into 3 bytes
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, shuf);
+        v = _mm256_permutevar8x32_epi32(v, perm);
+        _mm256_storeu_si256((__m256i*)x, v);
+    }
+    return s - b;
+}
+
+bool has_avx2() {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    if (!((r[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6) return false;  // OS saves ymm
+    __cpuidex(r, 7, 0);
+    return (r[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline size_t enc_simd(const uint8_t* s, size_t n, char* x) {
+    static const bool avx2 = has_avx2();
+    return avx2 && n >= 28 ? enc_avx2(s, n, x) : 0;
+}
+
+// 32 more bytes are reserved, as dec_avx2() writes 8 bytes more than decoded
+inline size_t dec_simd(const uint8_t* s, size_t n, char* x) {
+    static const bool avx2 = has_avx2();
+    return avx2 && n >= 48 ? dec_avx2(s, n - 16, x) : 0;
+}
+
+#elif defined(B64_NEON)
+inline uint8x16x4_t load_tab(const uint8_t* p) {
+    uint8x16x4_t t;
+    t.val[0] = vld1q_u8(p);
+    t.val[1] = vld1q_u8(p + 16);
+    t.val[2] = vld1q_u8(p + 32);
+    t.val[3] = vld1q_u8(p + 48);
+    return t;
+}
+
+// 48 bytes -> 64 chars
+inline size_t enc_simd(const uint8_t* s, size_t n, char* x) {
+    const uint8x16x4_t t = load_tab((const uint8_t*)entab);
+    const uint8x16_t m = vdupq_n_u8(0x3f);
+    const uint8_t* const b = s;
+    for (; n >= 48; n -= 48, s += 48, x += 64) {
+        const uint8x16x3_t v = vld3q_u8(s);
+        uint8x16x4_t r;
+        r.val[0] = vshrq_n_u8(v.val[0], 2);
+        r.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(v.val[1], 4), vshlq_n_u8(v.val[0], 4)), m);
+        r.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(v.val[2], 6), vshlq_n_u8(v.val[1], 2)), m);
+        r.val[3] = vandq_u8(v.val[2], m);
+        r.val[0] = vqtbl4q_u8(t, r.val[0]);
+        r.val[1] = vqtbl4q_u8(t, r.val[1]);
+        r.val[2] = vqtbl4q_u8(t, r.val[2]);
+        r.val[3] = vqtbl4q_u8(t, r.val[3]);
+        vst4q_u8((uint8_t*)x, r);
+    }
+    return s - b;
+}
+
+// ascii -> index, 0xff for characters out of the base64 alphabet
+inline uint8x16_t dec_lookup(const uint8x16x4_t& t0, const uint8x16x4_t& t1, uint8x16_t c) {
+    const uint8x16_t r = vqtbl4q_u8(t0, c);
+    return vqtbx4q_u8(r, t1, vsubq_u8(c, vdupq_n_u8(64)));
+}
+
+// 64 chars -> 48 bytes
+inline size_t dec_simd(const uint8_t* s, size_t n, char* x) {
+    if (n < 72) return 0;
+    n -= 8;
+    const uint8x16x4_t t0 = load_tab((const uint8_t*)detab);
+    const uint8x16x4_t t1 = load_tab((const uint8_t*)detab + 64);
+    const uint8_t* const b = s;
+    for (; n >= 64; n -= 64, s += 64, x += 48) {
+        const uint8x16x4_t v = vld4q_u8(s);
+        const uint8x16_t a = dec_lookup(t0, t1, v.val[0]);
+        const uint8x16_t b1 = dec_lookup(t0, t1, v.val[1]);
+        const uint8x16_t c = dec_lookup(t0, t1, v.val[2]);
+        const uint8x16_t d = dec_lookup(t0, t1, v.val[3]);
+
+        // chars >= 128 are looked up as 0 by vqtbl4q, check the high bit of them
+        const uint8x16_t h = vorrq_u8(vorrq_u8(v.val[0], v.val[1]), vorrq_u8(v.val[2], v.val[3]));
+        const uint8x16_t e = vorrq_u8(vorrq_u8(vorrq_u8(a, b1), vorrq_u8(c, d)), vandq_u8(h, vdupq_n_u8(0x80)));
+        if (vmaxvq_u8(e) > 63) break;
+
+        uint8x16x3_t r;
+        r.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b1, 4));
+        r.val[1] = vorrq_u8(vshlq_n_u8(b1, 4), vshrq_n_u8(c, 2));
+        r.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8((uint8_t*)x, r);
+    }
+    return s - b;
+}
+
+#else
+inline size_t enc_simd(const uint8_t*, size_t, char*) { return 0; }
+inline size_t dec_simd(const uint8_t*, size_t, char*) { return 0; }
+#endif
+
+}  // namespace
+
+size_t base64_encode(const void* p, size_t n, char* x) {
     const unsigned char* s = (const unsigned char*)p;
+    char* const b = x;
+    const size_t k = enc_simd(s, n, x);
+    s += k, n -= k, x += k / 3 * 4;
+
+    const int r = (int)(n % 3);
     const unsigned char* e = s + n - r;
+    unsigned char a, c, d;
 
     for (; s < e; s += 3, x += 4) {
         a = s[0];
-        b = s[1];
-        c = s[2];
+        c = s[1];
+        d = s[2];
         x[0] = entab[a >> 2];
-        x[1] = entab[((a << 4) | (b >> 4)) & 0x3f];
-        x[2] = entab[((b << 2) | (c >> 6)) & 0x3f];
-        x[3] = entab[c & 0x3f];
+        x[1] = entab[((a << 4) | (c >> 4)) & 0x3f];
+        x[2] = entab[((c << 2) | (d >> 6)) & 0x3f];
+        x[3] = entab[d & 0x3f];
     }
 
     switch (r) {
         case 1:
-            c = s[0];
-            x[0] = entab[c >> 2];
-            x[1] = entab[(c & 0x03) << 4];
+            d = s[0];
+            x[0] = entab[d >> 2];
+            x[1] = entab[(d & 0x03) << 4];
             x[2] = '=';
             x[3] = '=';
+            x += 4;
             break;
         case 2:
             a = s[0];
-            b = s[1];
+            c = s[1];
             x[0] = entab[a >> 2];
-            x[1] = entab[((a & 0x03) << 4) | (b >> 4)];
-            x[2] = entab[(b & 0x0f) << 2];
+            x[1] = entab[((a & 0x03) << 4) | (c >> 4)];
+            x[2] = entab[(c & 0x0f) << 2];
             x[3] = '=';
+            x += 4;
             break;
     }
 
-    return v;
+    return x - b;
 }
 
-static const int8_t detab[256] = {
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
-    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1, -1, 0,  1,  2,  3,  4,  5,  6,
-    7,  8,  9,  10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
-    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
-    49, 50, 51, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-};
+fastring base64_encode(const void* p, size_t n) {
+    fastring v;
+    v.resize(base64_encoded_size(n));
+    base64_encode(p, n, (char*)v.data());
+    return v;
+}
 
-fastring base64_decode(const void* p, size_t n) {
-    if (unlikely(n < 4)) return fastring();
+size_t base64_decode(const void* p, size_t n, char* x) {
+    if (unlikely(n < 4)) return n == 0 ? 0 : (size_t)-1;
 
-    fastring v(n * 3 >> 2);  // size <= n * 3/4
-    char* x = (char*)v.data();
+    char* const b = x;
     int m = 0;
     const unsigned char* s = (const unsigned char*)p;
     const unsigned char* e = s + n;
 
     while (s + 8 <= e) {
-        m = (detab[s[0]] << 18) | (detab[s[1]] << 12) | (detab[s[2]] << 6) | (detab[s[3]]);
-        if (unlikely(m < 0)) goto err;
+        const size_t k = dec_simd(s, e - s, x);
+        if (k > 0) {
+            s += k, x += k / 4 * 3;
+        } else {
+            m = (detab[s[0]] << 18) | (detab[s[1]] << 12) | (detab[s[2]] << 6) | (detab[s[3]]);
+            if (unlikely(m < 0)) goto err;
 
-        x[0] = (char)((m & 0x00ff0000) >> 16);
-        x[1] = (char)((m & 0x0000ff00) >> 8);
-        x[2] = (char)(m & 0x000000ff);
-        s += 4, x += 3;
+            x[0] = (char)((m & 0x00ff0000) >> 16);
+            x[1] = (char)((m & 0x0000ff00) >> 8);
+            x[2] = (char)(m & 0x000000ff);
+            s += 4, x += 3;
+        }
 
         if (unlikely(*s == '\r')) {
             if (*++s != '\n') goto err;
@@ -115,9 +328,17 @@ fastring base64_decode(const void* p, size_t n) {
         }
     } while (0);
 
-    v.resize(x - v.data());
-    return v;
+    return x - b;
 
 err:
-    return fastring();
+    return (size_t)-1;
+}
+
+fastring base64_decode(const void* p, size_t n) {
+    if (unlikely(n < 4)) return fastring();
+    fastring v(base64_decoded_size(n));
+    const size_t r = base64_decode(p, n, (char*)v.data());
+    if (r == (size_t)-1) return fastring();
+    v.resize(r);
+    return v;
 }
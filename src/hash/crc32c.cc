@@ -0,0 +1,108 @@
+#include "co/hash/crc32c.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+// tables for slicing-by-8, the reflected polynomial is 0x82f63b78
+struct Table {
+    Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82f63b78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    }
+    uint32_t t[8][256];
+};
+
+uint32_t crc32c_sw(const uint8_t* p, size_t n, uint32_t c) {
+    static const Table _t;
+    const auto& t = _t.t;
+    for (; n > 0 && ((size_t)p & 7); --n) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t a, b;
+        memcpy(&a, p, 4);
+        memcpy(&b, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        a = __builtin_bswap32(a);
+        b = __builtin_bswap32(b);
+#endif
+        a ^= c;
+        c = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^
+            t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+    }
+    for (; n > 0; --n) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+    return c;
+}
+
+#if defined(CRC32C_X86)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32c_hw(const uint8_t* p, size_t n, uint32_t c) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t x = c;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        x = _mm_crc32_u64(x, v);
+    }
+    c = (uint32_t)x;
+#endif
+    for (; n >= 4; n -= 4, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        c = _mm_crc32_u32(c, v);
+    }
+    for (; n > 0; --n) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+bool has_crc_insn() {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 1);
+    return (r[2] >> 20) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#elif defined(CRC32C_ARM)
+uint32_t crc32c_hw(const uint8_t* p, size_t n, uint32_t c) {
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __crc32cd(c, v);
+    }
+    for (; n > 0; --n) c = __crc32cb(c, *p++);
+    return c;
+}
+
+inline bool has_crc_insn() { return true; }
+#endif
+
+}  // namespace
+
+uint32_t crc32c(const void* s, size_t n, uint32_t crc) {
+    const uint8_t* p = (const uint8_t*)s;
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    static const bool hw = has_crc_insn();
+    if (hw) return ~crc32c_hw(p, n, ~crc);
+#endif
+    return ~crc32c_sw(p, n, ~crc);
+}
@@ -307,3 +307,241 @@ void md5sum(const void* s, size_t n, char res[32]) {
 #undef hex_tb
     }
 }
+
+/*
+ * Multi-buffer md5: 4 inputs are hashed at the same time, one in each 32-bit
+ * lane of a SSE2 or NEON register. Each lane runs its own input block by
+ * block, and takes the next input once it is done.
+ */
+#if defined(__SSE2__) || defined(_M_X64)
+#define MD5_LANES
+#include <emmintrin.h>
+typedef __m128i v128_t;
+#define VSET1(x) _mm_set1_epi32((int)(x))
+#define VADD(x, y) _mm_add_epi32(x, y)
+#define VAND(x, y) _mm_and_si128(x, y)
+#define VOR(x, y) _mm_or_si128(x, y)
+#define VXOR(x, y) _mm_xor_si128(x, y)
+#define VORN(x, y) _mm_or_si128(x, _mm_xor_si128(y, _mm_set1_epi32(-1)))
+#define VROTL(x, s) _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#define VLOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define VSTORE(p, x) _mm_storeu_si128((__m128i*)(p), x)
+#define VSET(a, b, c, d) _mm_setr_epi32((int)(a), (int)(b), (int)(c), (int)(d))
+#elif defined(__ARM_NEON)
+#define MD5_LANES
+#include <arm_neon.h>
+typedef uint32x4_t v128_t;
+#define VSET1(x) vdupq_n_u32(x)
+#define VADD(x, y) vaddq_u32(x, y)
+#define VAND(x, y) vandq_u32(x, y)
+#define VOR(x, y) vorrq_u32(x, y)
+#define VXOR(x, y) veorq_u32(x, y)
+#define VORN(x, y) vornq_u32(x, y)
+#define VROTL(x, s) vsriq_n_u32(vshlq_n_u32(x, s), x, 32 - (s))
+#define VLOAD(p) vld1q_u32(p)
+#define VSTORE(p, x) vst1q_u32(p, x)
+static inline uint32x4_t VSET(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    const uint32_t x[4] = {a, b, c, d};
+    return vld1q_u32(x);
+}
+#endif
+
+#ifdef MD5_LANES
+#define VF(x, y, z) VXOR(z, VAND(x, VXOR(y, z)))
+#define VG(x, y, z) VXOR(y, VAND(z, VXOR(x, y)))
+#define VH(x, y, z) VXOR(VXOR(x, y), z)
+#define VI(x, y, z) VXOR(y, VORN(x, z))
+
+#define VSTEP(f, a, b, c, d, x, t, s)                    \
+    (a) = VADD(VADD(a, f(b, c, d)), VADD(x, VSET1(t))); \
+    (a) = VROTL(a, s);                                   \
+    (a) = VADD(a, b);
+
+namespace {
+
+inline uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+struct md5_lane_t {
+    const uint8_t* p;  // the input
+    size_t nb;         // full blocks of the input
+    size_t nt;         // blocks in the padded tail, 1 or 2
+    size_t i;          // the next block
+    size_t job;        // index of the input, -1 if the lane is idle
+    uint8_t tail[128];
+
+    void init(size_t k, const void* s, size_t n) {
+        p = (const uint8_t*)s;
+        nb = n >> 6;
+        i = 0;
+        job = k;
+        const size_t r = n & 63;
+        nt = r < 56 ? 1 : 2;
+        memcpy(tail, p + (nb << 6), r);
+        tail[r] = 0x80;
+        memset(tail + r + 1, 0, (nt << 6) - r - 1);
+        const uint64_t bits = (uint64_t)n << 3;
+        for (int j = 0; j < 8; ++j) tail[(nt << 6) - 8 + j] = (uint8_t)(bits >> (j * 8));
+    }
+
+    const uint8_t* block() const { return i < nb ? p + (i << 6) : tail + ((i - nb) << 6); }
+    bool done() const { return i == nb + nt; }
+};
+
+// run a 64-byte block for each lane, the state of lane j is (a[j], b[j], c[j], d[j])
+void md5_body4(uint32_t* sa, uint32_t* sb, uint32_t* sc, uint32_t* sd, const uint8_t* const* p) {
+    v128_t X[16];
+    for (int j = 0; j < 16; ++j) {
+        X[j] = VSET(le32(p[0] + j * 4), le32(p[1] + j * 4), le32(p[2] + j * 4), le32(p[3] + j * 4));
+    }
+
+    v128_t a = VLOAD(sa), b = VLOAD(sb), c = VLOAD(sc), d = VLOAD(sd);
+    const v128_t saved_a = a, saved_b = b, saved_c = c, saved_d = d;
+
+        /* Round 1 */
+        VSTEP(VF, a, b, c, d, X[0], 0xd76aa478, 7)
+        VSTEP(VF, d, a, b, c, X[1], 0xe8c7b756, 12)
+        VSTEP(VF, c, d, a, b, X[2], 0x242070db, 17)
+        VSTEP(VF, b, c, d, a, X[3], 0xc1bdceee, 22)
+        VSTEP(VF, a, b, c, d, X[4], 0xf57c0faf, 7)
+        VSTEP(VF, d, a, b, c, X[5], 0x4787c62a, 12)
+        VSTEP(VF, c, d, a, b, X[6], 0xa8304613, 17)
+        VSTEP(VF, b, c, d, a, X[7], 0xfd469501, 22)
+        VSTEP(VF, a, b, c, d, X[8], 0x698098d8, 7)
+        VSTEP(VF, d, a, b, c, X[9], 0x8b44f7af, 12)
+        VSTEP(VF, c, d, a, b, X[10], 0xffff5bb1, 17)
+        VSTEP(VF, b, c, d, a, X[11], 0x895cd7be, 22)
+        VSTEP(VF, a, b, c, d, X[12], 0x6b901122, 7)
+        VSTEP(VF, d, a, b, c, X[13], 0xfd987193, 12)
+        VSTEP(VF, c, d, a, b, X[14], 0xa679438e, 17)
+        VSTEP(VF, b, c, d, a, X[15], 0x49b40821, 22)
+
+        /* Round 2 */
+        VSTEP(VG, a, b, c, d, X[1], 0xf61e2562, 5)
+        VSTEP(VG, d, a, b, c, X[6], 0xc040b340, 9)
+        VSTEP(VG, c, d, a, b, X[11], 0x265e5a51, 14)
+        VSTEP(VG, b, c, d, a, X[0], 0xe9b6c7aa, 20)
+        VSTEP(VG, a, b, c, d, X[5], 0xd62f105d, 5)
+        VSTEP(VG, d, a, b, c, X[10], 0x02441453, 9)
+        VSTEP(VG, c, d, a, b, X[15], 0xd8a1e681, 14)
+        VSTEP(VG, b, c, d, a, X[4], 0xe7d3fbc8, 20)
+        VSTEP(VG, a, b, c, d, X[9], 0x21e1cde6, 5)
+        VSTEP(VG, d, a, b, c, X[14], 0xc33707d6, 9)
+        VSTEP(VG, c, d, a, b, X[3], 0xf4d50d87, 14)
+        VSTEP(VG, b, c, d, a, X[8], 0x455a14ed, 20)
+        VSTEP(VG, a, b, c, d, X[13], 0xa9e3e905, 5)
+        VSTEP(VG, d, a, b, c, X[2], 0xfcefa3f8, 9)
+        VSTEP(VG, c, d, a, b, X[7], 0x676f02d9, 14)
+        VSTEP(VG, b, c, d, a, X[12], 0x8d2a4c8a, 20)
+
+        /* Round 3 */
+        VSTEP(VH, a, b, c, d, X[5], 0xfffa3942, 4)
+        VSTEP(VH, d, a, b, c, X[8], 0x8771f681, 11)
+        VSTEP(VH, c, d, a, b, X[11], 0x6d9d6122, 16)
+        VSTEP(VH, b, c, d, a, X[14], 0xfde5380c, 23)
+        VSTEP(VH, a, b, c, d, X[1], 0xa4beea44, 4)
+        VSTEP(VH, d, a, b, c, X[4], 0x4bdecfa9, 11)
+        VSTEP(VH, c, d, a, b, X[7], 0xf6bb4b60, 16)
+        VSTEP(VH, b, c, d, a, X[10], 0xbebfbc70, 23)
+        VSTEP(VH, a, b, c, d, X[13], 0x289b7ec6, 4)
+        VSTEP(VH, d, a, b, c, X[0], 0xeaa127fa, 11)
+        VSTEP(VH, c, d, a, b, X[3], 0xd4ef3085, 16)
+        VSTEP(VH, b, c, d, a, X[6], 0x04881d05, 23)
+        VSTEP(VH, a, b, c, d, X[9], 0xd9d4d039, 4)
+        VSTEP(VH, d, a, b, c, X[12], 0xe6db99e5, 11)
+        VSTEP(VH, c, d, a, b, X[15], 0x1fa27cf8, 16)
+        VSTEP(VH, b, c, d, a, X[2], 0xc4ac5665, 23)
+
+        /* Round 4 */
+        VSTEP(VI, a, b, c, d, X[0], 0xf4292244, 6)
+        VSTEP(VI, d, a, b, c, X[7], 0x432aff97, 10)
+        VSTEP(VI, c, d, a, b, X[14], 0xab9423a7, 15)
+        VSTEP(VI, b, c, d, a, X[5], 0xfc93a039, 21)
+        VSTEP(VI, a, b, c, d, X[12], 0x655b59c3, 6)
+        VSTEP(VI, d, a, b, c, X[3], 0x8f0ccc92, 10)
+        VSTEP(VI, c, d, a, b, X[10], 0xffeff47d, 15)
+        VSTEP(VI, b, c, d, a, X[1], 0x85845dd1, 21)
+        VSTEP(VI, a, b, c, d, X[8], 0x6fa87e4f, 6)
+        VSTEP(VI, d, a, b, c, X[15], 0xfe2ce6e0, 10)
+        VSTEP(VI, c, d, a, b, X[6], 0xa3014314, 15)
+        VSTEP(VI, b, c, d, a, X[13], 0x4e0811a1, 21)
+        VSTEP(VI, a, b, c, d, X[4], 0xf7537e82, 6)
+        VSTEP(VI, d, a, b, c, X[11], 0xbd3af235, 10)
+        VSTEP(VI, c, d, a, b, X[2], 0x2ad7d2bb, 15)
+        VSTEP(VI, b, c, d, a, X[9], 0xeb86d391, 21)
+
+    VSTORE(sa, VADD(a, saved_a));
+    VSTORE(sb, VADD(b, saved_b));
+    VSTORE(sc, VADD(c, saved_c));
+    VSTORE(sd, VADD(d, saved_d));
+}
+
+}  // namespace
+
+#undef VF
+#undef VG
+#undef VH
+#undef VI
+#undef VSTEP
+
+void md5digest_n(size_t k, const void* const* s, const size_t* n, char (*res)[16]) {
+    static const uint8_t zero[64] = {0};
+    md5_lane_t lane[4];
+    alignas(16) uint32_t a[4], b[4], c[4], d[4];
+    const uint8_t* p[4];
+    size_t next = 0;
+
+    auto start = [&](int j) {
+        if (next < k) {
+            lane[j].init(next, s[next], n[next]);
+            ++next;
+            a[j] = 0x67452301;
+            b[j] = 0xefcdab89;
+            c[j] = 0x98badcfe;
+            d[j] = 0x10325476;
+        } else {
+            lane[j].job = (size_t)-1;
+        }
+    };
+
+    for (int j = 0; j < 4; ++j) start(j);
+
+    while (true) {
+        int active = 0;
+        for (int j = 0; j < 4; ++j) {
+            if (lane[j].job != (size_t)-1) {
+                p[j] = lane[j].block();
+                ++active;
+            } else {
+                p[j] = zero;
+            }
+        }
+        if (active == 0) break;
+
+        md5_body4(a, b, c, d, p);
+
+        for (int j = 0; j < 4; ++j) {
+            md5_lane_t& l = lane[j];
+            if (l.job == (size_t)-1) continue;
+            ++l.i;
+            if (l.done()) {
+                uint8_t* r = (uint8_t*)res[l.job];
+                const uint32_t v[4] = {a[j], b[j], c[j], d[j]};
+                for (int x = 0; x < 4; ++x) {
+                    r[x * 4] = (uint8_t)v[x];
+                    r[x * 4 + 1] = (uint8_t)(v[x] >> 8);
+                    r[x * 4 + 2] = (uint8_t)(v[x] >> 16);
+                    r[x * 4 + 3] = (uint8_t)(v[x] >> 24);
+                }
+                start(j);
+            }
+        }
+    }
+}
+
+#else
+void md5digest_n(size_t k, const void* const* s, const size_t* n, char (*res)[16]) {
+    for (size_t i = 0; i < k; ++i) md5digest(s[i], n[i], res[i]);
+}
+#endif
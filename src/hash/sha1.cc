@@ -0,0 +1,109 @@
+#include "co/hash/sha1.h"
+
+void sha1_init(sha1_ctx_t* p) {
+    p->state[0] = 0x67452301;
+    p->state[1] = 0xefcdab89;
+    p->state[2] = 0x98badcfe;
+    p->state[3] = 0x10325476;
+    p->state[4] = 0xc3d2e1f0;
+    p->count = 0;
+}
+
+#define rol(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// process one 64-byte block
+static void sha1_block(uint32_t* state, const uint8_t* p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i, p += 4) {
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (int i = 16; i < 80; ++i) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f, k, t;
+    for (int i = 0; i < 80; ++i) {
+        if (i < 20) {
+            f = d ^ (b & (c ^ d));
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (d & (b | c));
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+#undef rol
+
+void sha1_update(sha1_ctx_t* p, const void* s, size_t n) {
+    const uint8_t* data = (const uint8_t*)s;
+    const uint32_t pos = (uint32_t)p->count & 0x3F;
+    p->count += n;
+
+    if (pos) {
+        const size_t k = 64 - pos;
+        if (n < k) {
+            memcpy(p->buffer + pos, data, n);
+            return;
+        }
+        memcpy(p->buffer + pos, data, k);
+        sha1_block(p->state, p->buffer);
+        data += k;
+        n -= k;
+    }
+
+    for (; n >= 64; n -= 64, data += 64) sha1_block(p->state, data);
+    if (n > 0) memcpy(p->buffer, data, n);
+}
+
+void sha1_final(sha1_ctx_t* p, uint8_t res[20]) {
+    uint64_t nbits = (p->count << 3);
+    uint32_t pos = (uint32_t)p->count & 0x3F;
+    unsigned i;
+
+    p->buffer[pos++] = 0x80;
+    while (pos != (64 - 8)) {
+        pos &= 0x3F;
+        if (pos == 0) sha1_block(p->state, p->buffer);
+        p->buffer[pos++] = 0;
+    }
+    for (i = 0; i < 8; ++i) {
+        p->buffer[pos++] = (uint8_t)(nbits >> 56);
+        nbits <<= 8;
+    }
+    sha1_block(p->state, p->buffer);
+
+    for (i = 0; i < 5; ++i) {
+        *res++ = (uint8_t)(p->state[i] >> 24);
+        *res++ = (uint8_t)(p->state[i] >> 16);
+        *res++ = (uint8_t)(p->state[i] >> 8);
+        *res++ = (uint8_t)(p->state[i]);
+    }
+}
+
+void sha1sum(const void* s, size_t n, char res[40]) {
+    uint8_t buf[20];
+    sha1digest(s, n, (char*)buf);
+
+    static const char hex_tb[] = "0123456789abcdef";
+    for (int i = 0; i < 20; ++i) {
+        res[i << 1] = hex_tb[buf[i] >> 4];
+        res[(i << 1) + 1] = hex_tb[buf[i] & 0x0f];
+    }
+}
@@ -7,6 +7,19 @@
 
 #include "co/hash/sha256.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define SHA256_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#define SHA256_ARM
+#include <arm_neon.h>
+#endif
+
 void sha256_init(sha256_ctx_t* p) {
     p->state[0] = 0x6a09e667;
     p->state[1] = 0xbb67ae85;
@@ -84,28 +97,175 @@ inline void sha256_transform(uint32_t* state, const uint32_t* data) {
 #undef s0
 #undef s1
 
-inline void sha256_write_byte_block(sha256_ctx_t* p) {
+inline void sha256_sw(uint32_t* state, const uint8_t* p) {
     uint32_t data32[16];
     unsigned i;
     for (i = 0; i < 16; i++)
-        data32[i] = ((uint32_t)(p->buffer[i * 4]) << 24) +
-                    ((uint32_t)(p->buffer[i * 4 + 1]) << 16) +
-                    ((uint32_t)(p->buffer[i * 4 + 2]) << 8) + ((uint32_t)(p->buffer[i * 4 + 3]));
-    sha256_transform(p->state, data32);
+        data32[i] = ((uint32_t)(p[i * 4]) << 24) + ((uint32_t)(p[i * 4 + 1]) << 16) +
+                    ((uint32_t)(p[i * 4 + 2]) << 8) + ((uint32_t)(p[i * 4 + 3]));
+    sha256_transform(state, data32);
+}
+
+#if defined(SHA256_X86)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sha,sse4.1")))
+#endif
+static void sha256_hw(uint32_t* state, const uint8_t* p, size_t n) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i s0, s1, t, m0, m1, m2, m3, save0, save1;
+
+    // the state is kept as ABEF and CDGH for the sha256rnds2 instruction
+    t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xb1);
+    s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b);
+    s0 = _mm_alignr_epi8(t, s1, 8);
+    s1 = _mm_blend_epi16(s1, t, 0xf0);
+
+// 4 rounds with the message words @m
+#define RND4(m, i)                                                         \
+    t = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)(K + (i) * 4))); \
+    s1 = _mm_sha256rnds2_epu32(s1, s0, t);                                \
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(t, 0x0e))
+
+// W[i] from W[i-4] (@a), W[i-3] (@b), W[i-2] (@c) and W[i-1] (@d), saved in @a
+#define SCHED(a, b, c, d) \
+    a = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(a, b), _mm_alignr_epi8(d, c, 4)), d)
+
+    for (; n > 0; --n, p += 64) {
+        save0 = s0;
+        save1 = s1;
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), mask);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), mask);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), mask);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), mask);
+        RND4(m0, 0);
+        RND4(m1, 1);
+        RND4(m2, 2);
+        RND4(m3, 3);
+        for (int i = 4; i < 16; i += 4) {
+            SCHED(m0, m1, m2, m3);
+            RND4(m0, i);
+            SCHED(m1, m2, m3, m0);
+            RND4(m1, i + 1);
+            SCHED(m2, m3, m0, m1);
+            RND4(m2, i + 2);
+            SCHED(m3, m0, m1, m2);
+            RND4(m3, i + 3);
+        }
+        s0 = _mm_add_epi32(s0, save0);
+        s1 = _mm_add_epi32(s1, save1);
+    }
+
+#undef RND4
+#undef SCHED
+
+    t = _mm_shuffle_epi32(s0, 0x1b);
+    s1 = _mm_shuffle_epi32(s1, 0xb1);
+    _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(t, s1, 0xf0));
+    _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(s1, t, 8));
+}
+
+// SHA-NI is in leaf 7 (ebx bit 29), SSSE3 and SSE4.1 are in leaf 1 (ecx bit 9, 19)
+static bool has_sha_insn() {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    const unsigned int c = r[2];
+    __cpuidex(r, 7, 0);
+    const unsigned int b = r[1];
+#else
+    unsigned int x[4];
+    if (__get_cpuid_max(0, 0) < 7) return false;
+    __cpuid(1, x[0], x[1], x[2], x[3]);
+    const unsigned int c = x[2];
+    __cpuid_count(7, 0, x[0], x[1], x[2], x[3]);
+    const unsigned int b = x[1];
+#endif
+    return ((b >> 29) & 1) && ((c >> 9) & 1) && ((c >> 19) & 1);
+}
+
+#elif defined(SHA256_ARM)
+static void sha256_hw(uint32_t* state, const uint8_t* p, size_t n) {
+    uint32x4_t s0 = vld1q_u32(state), s1 = vld1q_u32(state + 4);
+    uint32x4_t save0, save1, m0, m1, m2, m3, t, x;
+
+#define RND4(m, i)                         \
+    t = vaddq_u32(m, vld1q_u32(K + (i) * 4)); \
+    x = s0;                                \
+    s0 = vsha256hq_u32(s0, s1, t);         \
+    s1 = vsha256h2q_u32(s1, x, t)
+
+#define SCHED(a, b, c, d) a = vsha256su1q_u32(vsha256su0q_u32(a, b), c, d)
+
+    for (; n > 0; --n, p += 64) {
+        save0 = s0;
+        save1 = s1;
+        m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+        m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16)));
+        m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 32)));
+        m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 48)));
+        RND4(m0, 0);
+        RND4(m1, 1);
+        RND4(m2, 2);
+        RND4(m3, 3);
+        for (int i = 4; i < 16; i += 4) {
+            SCHED(m0, m1, m2, m3);
+            RND4(m0, i);
+            SCHED(m1, m2, m3, m0);
+            RND4(m1, i + 1);
+            SCHED(m2, m3, m0, m1);
+            RND4(m2, i + 2);
+            SCHED(m3, m0, m1, m2);
+            RND4(m3, i + 3);
+        }
+        s0 = vaddq_u32(s0, save0);
+        s1 = vaddq_u32(s1, save1);
+    }
+
+#undef RND4
+#undef SCHED
+
+    vst1q_u32(state, s0);
+    vst1q_u32(state + 4, s1);
+}
+
+static inline bool has_sha_insn() { return true; }
+#endif
+
+// process @n 64-byte blocks
+static void sha256_blocks(uint32_t* state, const uint8_t* p, size_t n) {
+#if defined(SHA256_X86) || defined(SHA256_ARM)
+    static const bool hw = has_sha_insn();
+    if (hw) return sha256_hw(state, p, n);
+#endif
+    for (; n > 0; --n, p += 64) sha256_sw(state, p);
 }
 
 void sha256_update(sha256_ctx_t* p, const void* s, size_t n) {
     const uint8_t* data = (const uint8_t*)s;
-    uint32_t pos = (uint32_t)p->count & 0x3F;
-    while (n > 0) {
-        p->buffer[pos++] = *data++;
-        ++p->count;
-        --n;
-        if (pos == 64) {
-            pos = 0;
-            sha256_write_byte_block(p);
+    const uint32_t pos = (uint32_t)p->count & 0x3F;
+    p->count += n;
+
+    if (pos) {
+        const size_t k = 64 - pos;
+        if (n < k) {
+            memcpy(p->buffer + pos, data, n);
+            return;
         }
+        memcpy(p->buffer + pos, data, k);
+        sha256_blocks(p->state, p->buffer, 1);
+        data += k;
+        n -= k;
     }
+
+    if (n >= 64) {
+        sha256_blocks(p->state, data, n >> 6);
+        data += n & ~(size_t)0x3F;
+        n &= 0x3F;
+    }
+
+    if (n > 0) memcpy(p->buffer, data, n);
 }
 
 void sha256_final(sha256_ctx_t* p, uint8_t res[32]) {
@@ -116,14 +276,14 @@ void sha256_final(sha256_ctx_t* p, uint8_t res[32]) {
     p->buffer[pos++] = 0x80;
     while (pos != (64 - 8)) {
         pos &= 0x3F;
-        if (pos == 0) sha256_write_byte_block(p);
+        if (pos == 0) sha256_blocks(p->state, p->buffer, 1);
         p->buffer[pos++] = 0;
     }
     for (i = 0; i < 8; ++i) {
         p->buffer[pos++] = (uint8_t)(nbits >> 56);
         nbits <<= 8;
     }
-    sha256_write_byte_block(p);
+    sha256_blocks(p->state, p->buffer, 1);
 
     for (i = 0; i < 8; ++i) {
         *res++ = (uint8_t)(p->state[i] >> 24);
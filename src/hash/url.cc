@@ -1,5 +1,17 @@
 #include "co/hash/url.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define URL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define URL_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #if 0
 char* init_url_encode_table() {
     static char tb[256] = { 0 };
@@ -33,45 +45,129 @@ inline int hex2int(char c) {
     return -1;
 }
 
+inline uint32_t first_bit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+// Length of the run of characters at the beginning of @p that are not encoded,
+// 16 bytes are checked at a time. The characters not encoded are those in
+// [0x21, 0x7e], except  " % < > \ ^ ` { | }
+static size_t unencoded_run(const uint8_t* p, size_t n) {
+    size_t i = 0;
+#if defined(URL_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i v2 = _mm_or_si128(v, _mm_set1_epi8(2));
+        // bytes >= 0x80 are negative and less than 0x21
+        __m128i x = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+        x = _mm_or_si128(x, _mm_andnot_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7e)), _mm_cmpgt_epi8(v, _mm_set1_epi8(0x7a))
+        ));
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(v, _mm_set1_epi8('%')));
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(v2, _mm_set1_epi8('>')));  // < >
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(v2, _mm_set1_epi8('^')));  // \ ^
+        const uint32_t r = (uint32_t)_mm_movemask_epi8(x);
+        if (r) return i + first_bit(r);
+    }
+#elif defined(URL_NEON)
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t v = vld1q_u8(p + i);
+        const uint8x16_t v2 = vorrq_u8(v, vdupq_n_u8(2));
+        uint8x16_t x = vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x21)), vcgtq_u8(v, vdupq_n_u8(0x7e)));
+        x = vorrq_u8(x, vandq_u8(vcgtq_u8(v, vdupq_n_u8(0x7a)), vcltq_u8(v, vdupq_n_u8(0x7e))));
+        x = vorrq_u8(x, vceqq_u8(v, vdupq_n_u8('"')));
+        x = vorrq_u8(x, vceqq_u8(v, vdupq_n_u8('%')));
+        x = vorrq_u8(x, vceqq_u8(v, vdupq_n_u8('`')));
+        x = vorrq_u8(x, vceqq_u8(v2, vdupq_n_u8('>')));
+        x = vorrq_u8(x, vceqq_u8(v2, vdupq_n_u8('^')));
+        const uint64_t r =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(x), 4)), 0);
+        if (r) {
+            const uint32_t lo = (uint32_t)r;
+            return i + ((lo ? first_bit(lo) : 32 + first_bit((uint32_t)(r >> 32))) >> 2);
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (!unencoded(p[i])) break;
+    }
+    return i;
+}
+
+size_t url_encode(const void* s, size_t n, char* out) {
+    const uint8_t* p = (const uint8_t*)s;
+    char* x = out;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t k = unencoded_run(p + i, n - i);
+        if (k > 0) {
+            memcpy(x, p + i, k);
+            x += k;
+            if ((i += k) == n) break;
+        }
+        const uint8_t c = p[i];
+        x[0] = '%';
+        x[1] = "0123456789ABCDEF"[c >> 4];
+        x[2] = "0123456789ABCDEF"[c & 0x0F];
+        x += 3;
+    }
+    return x - out;
+}
+
 fastring url_encode(const void* s, size_t n) {
     fastring dst(n + 32);
-    const char* p = (const char*)s;
-
-    char c;
+    const uint8_t* p = (const uint8_t*)s;
     for (size_t i = 0; i < n; ++i) {
-        c = p[i];
-        if (unencoded(c)) {
-            dst.append(c);
-            continue;
+        const size_t k = unencoded_run(p + i, n - i);
+        if (k > 0) {
+            dst.append(p + i, k);
+            if ((i += k) == n) break;
         }
+        const uint8_t c = p[i];
         dst.append('%');
-        dst.append("0123456789ABCDEF"[static_cast<uint8_t>(c) >> 4]);
-        dst.append("0123456789ABCDEF"[static_cast<uint8_t>(c) & 0x0F]);
+        dst.append("0123456789ABCDEF"[c >> 4]);
+        dst.append("0123456789ABCDEF"[c & 0x0F]);
     }
-
     return dst;
 }
 
-fastring url_decode(const void* s, size_t n) {
-    fastring dst(n);
+size_t url_decode(const void* s, size_t n, char* out) {
     const char* p = (const char*)s;
-
-    char c;
-    for (size_t i = 0; i < n; ++i) {
-        c = p[i];
-        if (c != '%') {
-            dst.append(c);
-            continue;
+    const char* const e = p + n;
+    char* x = out;
+    while (p < e) {
+        // copy the run before the next '%', memmove() as @out may be @s
+        const char* q = (const char*)memchr(p, '%', e - p);
+        if (!q) q = e;
+        if (q > p) {
+            if (x != p) memmove(x, p, q - p);
+            x += q - p;
+            p = q;
+            if (p == e) break;
         }
 
-        if (i + 2 >= n) return fastring();  // invalid encode
-        const int h4 = hex2int(p[i + 1]);
-        const int l4 = hex2int(p[i + 2]);
-        if (h4 < 0 || l4 < 0) return fastring();  // invalid encode
+        if (p + 2 >= e) return (size_t)-1;  // invalid encode
+        const int h4 = hex2int(p[1]);
+        const int l4 = hex2int(p[2]);
+        if (h4 < 0 || l4 < 0) return (size_t)-1;  // invalid encode
 
-        dst.append((char)((h4 << 4) | l4));
-        i += 2;
+        *x++ = (char)((h4 << 4) | l4);
+        p += 3;
     }
+    return x - out;
+}
 
+fastring url_decode(const void* s, size_t n) {
+    fastring dst(n);
+    const size_t r = url_decode(s, n, (char*)dst.data());
+    if (r == (size_t)-1) return fastring();
+    dst.resize(r);
     return dst;
 }
@@ -0,0 +1,112 @@
+#include "co/intern.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+
+namespace co {
+namespace {
+
+struct entry_t {
+    uint32_t h;
+    uint32_t n;
+    char s[];
+};
+
+// A hash table with linear probing. Entries are never removed, a slot is set
+// only once with a release store after the entry was made, so lookups need no
+// lock. A table is replaced by a larger one when it is half full, the old one is
+// kept as readers may still be on it.
+struct table_t {
+    uint32_t mask;
+    uint32_t size;
+    table_t* prev;
+    std::atomic<entry_t*> slot[];
+};
+
+struct alignas(64) shard_t {
+    shard_t() : tb(0) {}
+    std::atomic<table_t*> tb;
+    std::mutex mtx;
+};
+
+static const uint32_t kShards = 16;
+
+inline uint32_t fnv1a(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+inline table_t* new_table(uint32_t cap, table_t* prev) {
+    auto tb = (table_t*)::calloc(1, sizeof(table_t) + sizeof(std::atomic<entry_t*>) * cap);
+    tb->mask = cap - 1;
+    tb->size = prev ? prev->size : 0;
+    tb->prev = prev;
+    return tb;
+}
+
+inline entry_t* find(const table_t* tb, const char* s, uint32_t n, uint32_t h) {
+    for (uint32_t i = h & tb->mask;; i = (i + 1) & tb->mask) {
+        entry_t* const e = tb->slot[i].load(std::memory_order_acquire);
+        if (!e) return 0;
+        if (e->h == h && e->n == n && memcmp(e->s, s, n) == 0) return e;
+    }
+}
+
+inline void put(table_t* tb, entry_t* e) {
+    uint32_t i = e->h & tb->mask;
+    while (tb->slot[i].load(std::memory_order_relaxed)) i = (i + 1) & tb->mask;
+    tb->slot[i].store(e, std::memory_order_release);
+}
+
+// the shards are never freed, interned strings are valid until the program exits
+inline shard_t* shards() {
+    static shard_t* const s = new shard_t[kShards];
+    return s;
+}
+
+std::atomic<size_t> g_count(0);
+
+}  // namespace
+
+interned intern(const char* s, size_t n) {
+    const uint32_t h = fnv1a(s, n);
+    shard_t& x = shards()[(h >> 24) & (kShards - 1)];
+
+    table_t* tb = x.tb.load(std::memory_order_acquire);
+    entry_t* e = tb ? find(tb, s, (uint32_t)n, h) : 0;
+    if (!e) {
+        std::lock_guard<std::mutex> g(x.mtx);
+        tb = x.tb.load(std::memory_order_relaxed);
+        e = tb ? find(tb, s, (uint32_t)n, h) : 0;
+        if (!e) {
+            if (!tb || ((tb->size + 1) << 1) > tb->mask + 1) {
+                table_t* const t = new_table(tb ? (tb->mask + 1) << 1 : 64, tb);
+                if (tb) {
+                    for (uint32_t i = 0; i <= tb->mask; ++i) {
+                        entry_t* const o = tb->slot[i].load(std::memory_order_relaxed);
+                        if (o) put(t, o);
+                    }
+                }
+                x.tb.store(t, std::memory_order_release);
+                tb = t;
+            }
+
+            e = (entry_t*)::malloc(sizeof(entry_t) + n + 1);
+            e->h = h;
+            e->n = (uint32_t)n;
+            memcpy(e->s, s, n);
+            e->s[n] = '\0';
+            put(tb, e);
+            ++tb->size;
+            g_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return interned{e->s, e->n, e->h};
+}
+
+size_t interned_count() { return g_count.load(std::memory_order_relaxed); }
+
+}  // namespace co
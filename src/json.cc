@@ -1,6 +1,26 @@
 #include "co/json.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JSON_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <float.h>
+#include <stdlib.h>
+
 #include <algorithm>
+#include <atomic>
+
+#include "co/byte_order.h"
+#include "co/mem.h"
+#include "co/vector.h"
 
 namespace json {
 namespace xx {
@@ -11,32 +31,32 @@ class Alloc {
     static const uint32_t N = 8192;
     Alloc() : _stack(), _ustack(32), _fs(256) {}
 
-    void* alloc() { return !_a[0].empty() ? (void*)_a[0].pop_back() : ::malloc(16); }
+    void* alloc() { return !_a[0].empty() ? (void*)_a[0].pop_back() : co::alloc(16); }
 
-    void free(void* p) { _a[0].size() < (8 * (N - R)) ? _a[0].push_back(p) : ::free(p); }
+    void free(void* p) { _a[0].size() < (8 * (N - R)) ? _a[0].push_back(p) : co::free(p); }
 
     void* alloc(uint32_t n) {
         void* p;
         const uint32_t x = (n - 1) >> 4;
         switch (x) {
             case 0:
-                p = !_a[0].empty() ? (void*)_a[0].pop_back() : ::malloc(16);
+                p = !_a[0].empty() ? (void*)_a[0].pop_back() : co::alloc(16);
                 break;
             case 1:
-                p = !_a[1].empty() ? (void*)_a[1].pop_back() : ::malloc(32);
+                p = !_a[1].empty() ? (void*)_a[1].pop_back() : co::alloc(32);
                 break;
             case 2:
             case 3:
-                p = !_a[2].empty() ? (void*)_a[2].pop_back() : ::malloc(64);
+                p = !_a[2].empty() ? (void*)_a[2].pop_back() : co::alloc(64);
                 break;
             case 4:
             case 5:
             case 6:
             case 7:
-                p = !_a[3].empty() ? (void*)_a[3].pop_back() : ::malloc(128);
+                p = !_a[3].empty() ? (void*)_a[3].pop_back() : co::alloc(128);
                 break;
             default:
-                p = ::malloc(n);
+                p = co::alloc(n);
         }
         return p;
     }
@@ -45,23 +65,23 @@ class Alloc {
         const uint32_t x = (n - 1) >> 4;
         switch (x) {
             case 0:
-                _a[0].size() < (8 * (N - R)) ? _a[0].push_back(p) : ::free(p);
+                _a[0].size() < (8 * (N - R)) ? _a[0].push_back(p) : co::free(p);
                 break;
             case 1:
-                _a[1].size() < (4 * (N - R)) ? _a[1].push_back(p) : ::free(p);
+                _a[1].size() < (4 * (N - R)) ? _a[1].push_back(p) : co::free(p);
                 break;
             case 2:
             case 3:
-                _a[2].size() < (2 * (N - R)) ? _a[2].push_back(p) : ::free(p);
+                _a[2].size() < (2 * (N - R)) ? _a[2].push_back(p) : co::free(p);
                 break;
             case 4:
             case 5:
             case 6:
             case 7:
-                _a[3].size() < (N - R) ? _a[3].push_back(p) : ::free(p);
+                _a[3].size() < (N - R) ? _a[3].push_back(p) : co::free(p);
                 break;
             default:
-                ::free(p);
+                co::free(p);
         }
     }
 
@@ -76,6 +96,8 @@ class Alloc {
         return _null;
     }
 
+    Json::_H* mark(Json::_H* h) const { return h; }
+
   private:
     Array _a[4];
     Array _stack;
@@ -98,39 +120,373 @@ char* alloc_string(const void* p, size_t n) {
     return s;
 }
 
-inline void* alloc_array(void** p, uint32_t n) {
-    auto h = (Array::_H*)::malloc(sizeof(Array::_H) + sizeof(void*) * n);
+inline void* alloc_array(void* m, void** p, uint32_t n) {
+    auto h = (Array::_H*)m;
     h->cap = n;
     h->size = n;
+    h->index = 0;
     memcpy(h->p, p, sizeof(void*) * n);
     return h;
 }
 
+inline void* alloc_array(void** p, uint32_t n) {
+    return alloc_array(::malloc(sizeof(Array::_H) + sizeof(void*) * n), p, n);
+}
+
+// Memory of an Arena. Small blocks are allocated from 64k chunks aligned to their
+// size, a node can find its arena from its address. Large blocks are allocated
+// separately. Nothing is freed before clear().
+class ArenaImpl {
+  public:
+    static const size_t kChunk = 64 * 1024;
+    static const size_t kLarge = 8 * 1024;
+
+    ArenaImpl() : _chunk(0), _large(0), _p(0), _e(0), _dirty(false) {}
+    ~ArenaImpl();
+
+    void* alloc(size_t n) {
+        n = (n + 7) & ~(size_t)7;
+        if (n <= (size_t)(_e - _p)) {
+            char* p = _p;
+            _p += n;
+            return p;
+        }
+        return this->alloc_slow(n);
+    }
+
+    // the arena of a node allocated by alloc()
+    static ArenaImpl* of(const void* p) {
+        return ((block_t*)((uintptr_t)p & ~(uintptr_t)(kChunk - 1)))->arena;
+    }
+
+    // A document is dirty if it may hold values not in the arena, they are
+    // found by walking the tree when it is released.
+    bool dirty() const { return _dirty.load(std::memory_order_relaxed); }
+    void set_dirty() {
+        if (!this->dirty()) _dirty.store(true, std::memory_order_relaxed);
+    }
+
+    void clear();
+
+  private:
+    struct block_t {
+        ArenaImpl* arena;
+        block_t* next;
+    };
+
+    void* alloc_slow(size_t n);
+
+    block_t* _chunk;  // the current chunk, linked to the previous ones
+    block_t* _large;
+    char* _p;
+    char* _e;
+    std::atomic_bool _dirty;
+};
+
+inline void* alloc_chunk(size_t n) {
+#ifdef _WIN32
+    return _aligned_malloc(n, n);
+#else
+    void* p = 0;
+    return posix_memalign(&p, n, n) == 0 ? p : 0;
+#endif
+}
+
+inline void free_chunk(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    ::free(p);
+#endif
+}
+
+ArenaImpl::~ArenaImpl() {
+    this->clear();
+    if (_chunk) free_chunk(_chunk);
+}
+
+void* ArenaImpl::alloc_slow(size_t n) {
+    if (n > kLarge) {
+        auto b = (block_t*)::malloc(sizeof(block_t) + n);
+        b->arena = this;
+        b->next = _large;
+        _large = b;
+        return b + 1;
+    }
+    auto c = (block_t*)alloc_chunk(kChunk);
+    c->arena = this;
+    c->next = _chunk;
+    _chunk = c;
+    _p = (char*)(c + 1) + n;
+    _e = (char*)c + kChunk;
+    return c + 1;
+}
+
+void ArenaImpl::clear() {
+    for (block_t* b = _large; b;) {
+        block_t* x = b->next;
+        ::free(b);
+        b = x;
+    }
+    _large = 0;
+    if (_chunk) {
+        for (block_t* c = _chunk->next; c;) {
+            block_t* x = c->next;
+            free_chunk(c);
+            c = x;
+        }
+        _chunk->next = 0;
+        _p = (char*)(_chunk + 1);
+        _e = (char*)_chunk + kChunk;
+    }
+    _dirty.store(false, std::memory_order_relaxed);
+}
+
+// Hash index of the keys of an object, with linear probing. A slot holds the
+// position of the key in the array plus 1, or 0 if it is empty, and the hash of
+// the key, keys are compared only if the hashes are equal. For repeated keys,
+// only the first one is indexed, the same as a linear search.
+struct Index {
+    struct slot_t {
+        uint32_t pos;
+        uint32_t hash;
+    };
+    uint32_t mask;
+    uint32_t size;
+    slot_t slot[];
+};
+
+// the same as Key::hash()
+inline uint32_t key_hash(const char* s) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (; *s; ++s) h = (h ^ (uint8_t)*s) * 16777619u;
+    return h;
+}
+
+inline uint32_t key_hash(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+// whether the null-terminated key @k is equal to @s (len: @n)
+inline bool key_eq(const char* k, const char* s, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (k[i] != s[i] || !k[i]) return false;
+    }
+    return k[n] == '\0';
+}
+
+// return the slot of @key, or the empty slot where it should be put. @h is the
+// hash of the key.
+inline Index::slot_t* index_slot(Index* x, const Array& a, const char* key, uint32_t h) {
+    uint32_t i = h & x->mask;
+    for (uint32_t k; (k = x->slot[i].pos); i = (i + 1) & x->mask) {
+        if (x->slot[i].hash == h && strcmp((const char*)a[k - 1], key) == 0) break;
+    }
+    return &x->slot[i];
+}
+
+// add the key at position @i to the index, if it is not there
+inline void index_put(Index* x, const Array& a, uint32_t i) {
+    const char* key = (const char*)a[i];
+    const uint32_t h = key_hash(key);
+    Index::slot_t* p = index_slot(x, a, key, h);
+    if (p->pos == 0) p->pos = i + 1, p->hash = h, ++x->size;
+}
+
+// (re)build the index, or drop it if the object is small. The index of an object
+// in the arena @r is allocated from the arena.
+void index_build(Array& a, ArenaImpl* r = 0) {
+    if (!r) ::free(a.index());
+    a.index() = 0;
+    const uint32_t n = a.size() >> 1;
+    if (n < kIndexMin) return;
+
+    uint32_t cap = kIndexMin << 2;
+    while (cap < (n << 2)) cap <<= 1;
+    const size_t size = sizeof(Index) + sizeof(Index::slot_t) * cap;
+    auto x = (Index*)(r ? memset(r->alloc(size), 0, size) : ::calloc(1, size));
+    x->mask = cap - 1;
+    for (uint32_t i = 0; i < a.size(); i += 2) index_put(x, a, i);
+    a.index() = x;
+}
+
+void index_add(Array& a) {
+    auto x = (Index*)a.index();
+    if (!x || ((x->size + 1) << 1) > x->mask + 1) return index_build(a);
+    index_put(x, a, a.size() - 2);
+}
+
+// index an object created as a whole, by the parser, copy, etc.
+inline void index_object(Array& a, ArenaImpl* r = 0) {
+    if (a.size() >= (kIndexMin << 1)) index_build(a, r);
+}
+
+// position of @key in the array of an object, or -1 if not found
+inline int find_key(const Array& a, const char* key) {
+    auto x = (Index*)a.index();
+    if (x) return (int)index_slot(x, a, key, key_hash(key))->pos - 1;
+    for (uint32_t i = 0; i < a.size(); i += 2) {
+        if (strcmp(key, (const char*)a[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// find_key() with a key that is not null-terminated
+inline int find_key(const Array& a, co::strview key) {
+    auto x = (Index*)a.index();
+    if (x) {
+        const uint32_t h = key_hash(key.data(), key.size());
+        for (uint32_t i = h & x->mask, k; (k = x->slot[i].pos); i = (i + 1) & x->mask) {
+            if (x->slot[i].hash == h && key_eq((const char*)a[k - 1], key.data(), key.size())) {
+                return (int)k - 1;
+            }
+        }
+        return -1;
+    }
+    for (uint32_t i = 0; i < a.size(); i += 2) {
+        if (key_eq((const char*)a[i], key.data(), key.size())) return (int)i;
+    }
+    return -1;
+}
+
+// find_key() with the hash @h of the key computed in advance
+inline int find_key(const Array& a, const char* key, uint32_t h) {
+    auto x = (Index*)a.index();
+    if (x) return (int)index_slot(x, a, key, h)->pos - 1;
+    for (uint32_t i = 0; i < a.size(); i += 2) {
+        if (strcmp(key, (const char*)a[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// find_key() with a key made at compile time
+inline int find_key(const Array& a, const Key& key) {
+    auto x = (Index*)a.index();
+    if (x) {
+        for (uint32_t i = key.h & x->mask, k; (k = x->slot[i].pos); i = (i + 1) & x->mask) {
+            if (x->slot[i].hash == key.h && key_eq((const char*)a[k - 1], key.s, key.n)) {
+                return (int)k - 1;
+            }
+        }
+        return -1;
+    }
+    for (uint32_t i = 0; i < a.size(); i += 2) {
+        if (key_eq((const char*)a[i], key.s, key.n)) return (int)i;
+    }
+    return -1;
+}
+
 }  // namespace xx
 
 using _H = Json::_H;
-using _A = xx::Alloc;
 typedef const char* S;
 typedef void* void_ptr_t;
-inline S find_quote(S b, S e) { return (S)memchr(b, '"', e - b); }
-inline S find_slash(S b, S e) { return (S)memchr(b, '\\', e - b); }
 
-inline char* make_key(_A& a, const void* p, size_t n) {
+inline uint32_t first_bit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+// find the first '"' or '\\' in [p, e), and also control characters if @ctl is
+// true, return e if not found.
+//   - 16 bytes are checked at a time with SSE2 on x86 or NEON on arm.
+template <bool ctl>
+inline S find_special(S p, S e) {
+#if defined(JSON_SSE2)
+    const __m128i vq = _mm_set1_epi8('"');
+    const __m128i vs = _mm_set1_epi8('\\');
+    const __m128i vc = _mm_set1_epi8(0x1f);
+    for (; e - p >= 16; p += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, vq), _mm_cmpeq_epi8(x, vs));
+        if (ctl) m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(x, vc), x));  // x <= 0x1f
+        const uint32_t r = (uint32_t)_mm_movemask_epi8(m);
+        if (r) return p + first_bit(r);
+    }
+#elif defined(JSON_NEON)
+    const uint8x16_t vq = vdupq_n_u8('"');
+    const uint8x16_t vs = vdupq_n_u8('\\');
+    const uint8x16_t vc = vdupq_n_u8(0x20);
+    for (; e - p >= 16; p += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8_t*)p);
+        uint8x16_t m = vorrq_u8(vceqq_u8(x, vq), vceqq_u8(x, vs));
+        if (ctl) m = vorrq_u8(m, vcltq_u8(x, vc));
+        // 4 bits for each byte
+        const uint64_t r =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (r) {
+            const uint32_t lo = (uint32_t)r;
+            return p + ((lo ? first_bit(lo) : 32 + first_bit((uint32_t)(r >> 32))) >> 2);
+        }
+    }
+#endif
+    for (; p < e; ++p) {
+        const uint8_t c = (uint8_t)*p;
+        if (c == '"' || c == '\\' || (ctl && c < 0x20)) return p;
+    }
+    return e;
+}
+
+// @a: xx::Alloc, or the Parser which may allocate from an arena
+template <class A>
+inline char* make_key(A& a, const void* p, size_t n) {
     char* s = (char*)a.alloc((uint32_t)n + 1);
     memcpy(s, p, n);
     s[n] = '\0';
     return s;
 }
 
-inline char* make_key(_A& a, const char* p) { return make_key(a, p, strlen(p)); }
+template <class A>
+inline char* make_key(A& a, const char* p) {
+    return make_key(a, p, strlen(p));
+}
+
+template <class A>
+inline _H* make_string(A& a, const void* p, size_t n) {
+    _H* h = (_H*)a.alloc();
+    h->type = Json::t_string;
+    h->size = (uint32_t)n;
+    h->s = make_key(a, p, n);
+    return a.mark(h);
+}
+
+template <class A>
+inline _H* make_bool(A& a, bool v) {
+    return a.mark(new (a.alloc()) _H(v));
+}
+
+template <class A>
+inline _H* make_int(A& a, int64_t v) {
+    return a.mark(new (a.alloc()) _H(v));
+}
+
+template <class A>
+inline _H* make_double(A& a, double v) {
+    return a.mark(new (a.alloc()) _H(v));
+}
+
+template <class A>
+inline _H* make_object(A& a) {
+    return a.mark(new (a.alloc()) _H(Json::_obj_t()));
+}
+
+template <class A>
+inline _H* make_array(A& a) {
+    return a.mark(new (a.alloc()) _H(Json::_arr_t()));
+}
 
-inline _H* make_string(_A& a, const void* p, size_t n) { return new (a.alloc()) _H(p, n); }
+// set on the root node of a document parsed with an arena
+static const uint32_t kArenaRoot = 512;
 
-inline _H* make_bool(_A& a, bool v) { return new (a.alloc()) _H(v); }
-inline _H* make_int(_A& a, int64_t v) { return new (a.alloc()) _H(v); }
-inline _H* make_double(_A& a, double v) { return new (a.alloc()) _H(v); }
-inline _H* make_object(_A& a) { return new (a.alloc()) _H(Json::_obj_t()); }
-inline _H* make_array(_A& a) { return new (a.alloc()) _H(Json::_arr_t()); }
+// reference count of a shared node, strings are not shared as they use the size
+inline std::atomic<uint32_t>& refs(_H* h) { return *(std::atomic<uint32_t>*)&h->size; }
 
 // json parser
 //   @b: beginning of the string
@@ -138,9 +494,35 @@ inline _H* make_array(_A& a) { return new (a.alloc()) _H(Json::_arr_t()); }
 // return the current position, or nullptr on any error
 class Parser {
   public:
-    Parser() : _a(xx::jalloc()) {}
+    // @insitu: strings are unescaped in the source and pointed to, @r must be set
+    explicit Parser(xx::ArenaImpl* r = 0, bool insitu = false)
+        : _a(xx::jalloc()), _r(r), _insitu(insitu) {}
     ~Parser() = default;
 
+    // nodes, strings and arrays are allocated from the arena if it is set
+    void* alloc() { return _r ? _r->alloc(sizeof(_H)) : _a.alloc(); }
+    void* alloc(uint32_t n) { return _r ? _r->alloc(n) : _a.alloc(n); }
+
+    void* alloc_array(void** p, uint32_t n) {
+        if (!_r) return xx::alloc_array(p, n);
+        return xx::alloc_array(_r->alloc(sizeof(xx::Array::_H) + sizeof(void*) * n), p, n);
+    }
+
+    _H* mark(_H* h) const {
+        if (_r) h->type |= Json::t_arena;
+        return h;
+    }
+
+    // a string node pointing to the source, the string is terminated in place
+    _H* make_insitu(S p, size_t n) {
+        ((char*)p)[n] = '\0';
+        _H* h = (_H*)_r->alloc(sizeof(_H));
+        h->type = Json::t_string | Json::t_arena;
+        h->size = (uint32_t)n;
+        h->s = (char*)p;
+        return h;
+    }
+
     bool parse(S b, S e, void_ptr_t& v);
     S parse_string(S b, S e, void_ptr_t& v);
     S parse_unicode(S b, S e, fastream& s);
@@ -152,18 +534,27 @@ class Parser {
 
   private:
     xx::Alloc& _a;
+    xx::ArenaImpl* _r;
+    bool _insitu;
 };
 
 inline S Parser::parse_key(S b, S e, void_ptr_t& key) {
     if (*b++ != '"') return 0;
     S p = (S)memchr(b, '"', e - b);
-    if (p) key = make_key(_a, b, p - b);
+    if (p) {
+        if (_insitu) {
+            *(char*)p = '\0';
+            key = (void*)b;
+        } else {
+            key = make_key(*this, b, p - b);
+        }
+    }
     return p;
 }
 
 inline S Parser::parse_false(S b, S e, void_ptr_t& v) {
     if (e - b >= 5 && b[1] == 'a' && b[2] == 'l' && b[3] == 's' && b[4] == 'e') {
-        v = make_bool(_a, false);
+        v = make_bool(*this, false);
         return b + 4;
     }
     return 0;
@@ -171,14 +562,17 @@ inline S Parser::parse_false(S b, S e, void_ptr_t& v) {
 
 inline S Parser::parse_true(S b, S e, void_ptr_t& v) {
     if (e - b >= 4 && b[1] == 'r' && b[2] == 'u' && b[3] == 'e') {
-        v = make_bool(_a, true);
+        v = make_bool(*this, true);
         return b + 3;
     }
     return 0;
 }
 
+// A null member of a document in an arena may be assigned a value later without
+// being reset, the document is marked dirty then.
 inline S Parser::parse_null(S b, S e, void_ptr_t& v) {
     if (e - b >= 4 && b[1] == 'u' && b[2] == 'l' && b[3] == 'l') {
+        if (_r) _r->set_dirty();
         v = 0;
         return b + 3;
     }
@@ -283,7 +677,7 @@ bool Parser::parse(S b, S e, void_ptr_t& val) {
 obj_beg:
     u.push_back(psize);   // prev size
     u.push_back(pstate);  // prev state
-    s.push_back(make_object(_a));
+    s.push_back(make_object(*this));
     size = s.size();  // current size
     state = '{';
 
@@ -337,7 +731,7 @@ obj_val_end:
 arr_beg:
     u.push_back(psize);   // prev size
     u.push_back(pstate);  // prev state
-    s.push_back(make_array(_a));
+    s.push_back(make_array(*this));
     size = s.size();  // current size
     state = '[';
 
@@ -379,9 +773,10 @@ arr_val_end:
 arr_end:
 obj_end:
     if (s.size() > size) {
-        void* p = xx::alloc_array(s.data() + size, s.size() - size);
+        void* p = this->alloc_array(s.data() + size, s.size() - size);
         s.resize(size);
         ((_H*)s.back())->p = p;
+        if (state == '{') xx::index_object((xx::Array&)((_H*)s.back())->p, _r);
     }
 
     pstate = u.pop_back();  // prev state
@@ -427,7 +822,7 @@ err:
     while (s.size() > 0) {
         if (s.size() > size) {
             if (state == '{' && ((s.size() - size) & 1)) s.push_back(0);
-            void* p = xx::alloc_array(s.data() + size, s.size() - size);
+            void* p = this->alloc_array(s.data() + size, s.size() - size);
             s.resize(size);
             ((_H*)s.back())->p = p;
         }
@@ -445,40 +840,43 @@ err:
 }
 #include "json.h.in"
 
+// The closing quote and escapes are found in a single pass.
 S Parser::parse_string(S b, S e, void_ptr_t& v) {
-    S p, q;
-    if ((p = find_quote(++b, e)) == 0) return 0;
-    q = find_slash(b, p);
-    if (q == 0) {
-        v = make_string(_a, b, p - b);
+    S p = find_special<false>(++b, e);
+    if (p == e) return 0;
+    if (*p == '"') {
+        v = _insitu ? make_insitu(b, p - b) : make_string(*this, b, p - b);
         return p;
     }
 
+    // an unescaped string is shorter, it is copied back to the source for insitu
+    const S x = b;
     fastream& s = _a.stream();
     do {
-        s.append(b, q - b);
-        if (++q == e) return 0;
+        s.append(b, p - b);
+        if (++p == e) return 0;
 
-        char c = g_s2e_tb[(uint8_t)*q];
+        char c = g_s2e_tb[(uint8_t)*p];
         if (c == 0) return 0;  // invalid escape
 
-        if (*q != 'u') {
+        if (*p != 'u') {
             s.append(c);
         } else {
-            q = parse_unicode(q + 1, e, s);
-            if (q == 0) return 0;
-        }
-
-        b = q + 1;
-        if (b > p) {
-            p = find_quote(b, e);
+            p = parse_unicode(p + 1, e, s);
             if (p == 0) return 0;
         }
 
-        q = find_slash(b, p);
-        if (q == 0) {
+        b = p + 1;
+        p = find_special<false>(b, e);
+        if (p == e) return 0;
+        if (*p == '"') {
             s.append(b, p - b);
-            v = make_string(_a, s.data(), s.size());
+            if (_insitu) {
+                memcpy((char*)x, s.data(), s.size());
+                v = make_insitu(x, s.size());
+            } else {
+                v = make_string(*this, s.data(), s.size());
+            }
             return p;
         }
     } while (true);
@@ -546,10 +944,36 @@ S Parser::parse_unicode(S b, S e, fastream& s) {
     return b;
 }
 
+// load 8 bytes in little endian order
+inline uint64_t load8(S p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline bool is_8digits(uint64_t v) {
+    return !(((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) & 0x8080808080808080ULL);
+}
+
+// convert 8 digits to an integer with SWAR, see
+//   https://lemire.me/blog/2022/01/21/swar-explained-parsing-eight-digits/
+inline uint32_t parse_8digits(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)v;
+}
+
+// [b, e) was checked by parse_number()
 inline int64_t str2int(S b, S e) {
     uint64_t v = 0;
     S p = b;
     if (*p == '-') ++p;
+    for (; e - p >= 8; p += 8) v = v * 100000000 + parse_8digits(load8(p));
     for (; p < e; ++p) v = v * 10 + *p - '0';
     return *b != '-' ? v : -(int64_t)v;
 }
@@ -562,8 +986,143 @@ inline bool str2double(S b, double& d) {
 
 inline bool is_digit(char c) { return '0' <= c && c <= '9'; }
 
-S Parser::parse_number(S b, S e, void_ptr_t& v) {
-    bool is_double = false;
+// high 64 bits of a * b, the low 64 bits are stored in @lo
+inline uint64_t mul128(uint64_t a, uint64_t b, uint64_t& lo) {
+#if defined(__SIZEOF_INT128__)
+    const __uint128_t r = (__uint128_t)a * b;
+    lo = (uint64_t)r;
+    return (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    lo = _umul128(a, b, &hi);
+    return hi;
+#else
+    const uint64_t a0 = (uint32_t)a, a1 = a >> 32;
+    const uint64_t b0 = (uint32_t)b, b1 = b >> 32;
+    const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    const uint64_t m = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    lo = (m << 32) | (uint32_t)p00;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (m >> 32);
+#endif
+}
+
+inline int clz64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long r;
+    _BitScanReverse64(&r, x);
+    return 63 - (int)r;
+#elif defined(_MSC_VER)
+    unsigned long r;
+    if (x >> 32) {
+        _BitScanReverse(&r, (uint32_t)(x >> 32));
+        return 31 - (int)r;
+    }
+    _BitScanReverse(&r, (uint32_t)x);
+    return 63 - (int)r;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// i * 10^q to a double, with the Clinger fast path or the Eisel-Lemire algorithm.
+// Return false if the result can't be decided this way.
+//   - https://arxiv.org/abs/2101.11408
+//   - -325 <= q <= 308, i > 0
+inline bool compute_double(uint64_t i, int q, bool neg, double& d) {
+    static const double kPow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+#if !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD == 0
+    // i and 10^q are exact doubles, the result is rounded correctly.
+    if (-22 <= q && q <= 22 && i <= (1ULL << 53)) {
+        d = q < 0 ? (double)i / kPow10[-q] : (double)i * kPow10[q];
+        if (neg) d = -d;
+        return true;
+    }
+#endif
+
+    const uint64_t* const f = g_pow5_tb[q + 325];
+    const int64_t exponent = ((((int64_t)152170 + 65536) * q) >> 16) + 1024 + 63;
+    int lz = clz64(i);
+    i <<= lz;
+
+    uint64_t lower, upper = mul128(i, f[0], lower);
+    if ((upper & 0x1FF) == 0x1FF && lower + i < lower) {
+        uint64_t low, middle = mul128(i, f[1], low);
+        middle += lower;
+        if (middle < lower) ++upper;
+        if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && low + i < low) return false;
+        lower = middle;
+    }
+
+    const uint64_t upperbit = upper >> 63;
+    uint64_t mantissa = upper >> (upperbit + 9);
+    lz += (int)(1 ^ upperbit);
+    if (lower == 0 && (upper & 0x1FF) == 0 && (mantissa & 3) == 1) return false;  // halfway
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (1ULL << 53)) {
+        mantissa = 1ULL << 52;
+        --lz;
+    }
+    mantissa &= ~(1ULL << 52);
+    const uint64_t real_exponent = (uint64_t)(exponent - lz);
+    if (real_exponent < 1 || real_exponent > 2046) return false;
+
+    mantissa |= real_exponent << 52;
+    mantissa |= (uint64_t)neg << 63;
+    memcpy(&d, &mantissa, sizeof(d));
+    return true;
+}
+
+// Parse a double from [b, e), which was checked by parse_number(). Return false
+// if it has more than 19 significant digits, or the exponent is out of range,
+// or it can't be decided by compute_double(), then strtod() should be used.
+inline bool fast_str2double(S b, S e, double& d) {
+    const bool neg = *b == '-';
+    S p = b + neg;
+    S s = p;  // the first significant digit
+    while (s < e && (*s == '0' || *s == '.')) ++s;
+
+    uint64_t i = 0;
+    int64_t q = 0;  // decimal exponent
+    for (; p < e && is_digit(*p); ++p) i = i * 10 + (*p - '0');
+    S x = p;  // the point
+    if (p < e && *p == '.') {
+        for (++p; e - p >= 8 && is_8digits(load8(p)); p += 8) {
+            i = i * 100000000 + parse_8digits(load8(p));
+        }
+        for (; p < e && is_digit(*p); ++p) i = i * 10 + (*p - '0');
+        q = -(int64_t)(p - x - 1);
+    }
+
+    // i may overflow with more than 19 significant digits
+    if (p - s - (s <= x && x < p) > 19) return false;
+
+    if (p < e) {  // 'e' or 'E'
+        const bool eneg = *++p == '-';
+        if (*p == '-' || *p == '+') ++p;
+        int64_t x = 0;
+        for (; p < e; ++p) {
+            if (x < 100000) x = x * 10 + (*p - '0');
+        }
+        q += eneg ? -x : x;
+    }
+
+    if (i == 0) {
+        d = neg ? -0.0 : 0.0;
+        return true;
+    }
+    if (q < -325 || q > 308) return false;
+    return compute_double(i, (int)q, neg, d);
+}
+
+// Parse a number from [b, e), it is an int in @i if @is_double is false, otherwise
+// a double in @d. Return position of the last character, or null on error.
+inline S scan_number(S b, S e, bool& is_double, int64_t& i, double& d, xx::Alloc& a) {
+    is_double = false;
     S p = b;
 
     if (*p == '-' && ++p == e) return 0;
@@ -606,28 +1165,35 @@ digit_end : {
         int m = ::memcmp(b, (*b != '-' ? "18446744073709551615" : "-9223372036854775808"), 20);
         if (m < 0) goto to_int;
         if (m > 0) goto to_dbl;
-        v = make_int(_a, *b != '-' ? UINT64_MAX : INT64_MIN);
+        i = *b != '-' ? UINT64_MAX : INT64_MIN;
         return p - 1;
     }
 
 to_int:
-    v = make_int(_a, str2int(b, p));
+    i = str2int(b, p);
     return p - 1;
 
 to_dbl:
-    double d;
+    is_double = true;
+    if (fast_str2double(b, p, d)) return p - 1;
     if (p == e && *p != '\0') {
-        fastream& fs = _a.stream();
+        fastream& fs = a.stream();
         fs.append(b, p - b);
         b = fs.c_str();
     }
-    if (str2double(b, d)) {
-        v = make_double(_a, d);
-        return p - 1;
-    }
+    if (str2double(b, d)) return p - 1;
     return 0;
 }
 
+S Parser::parse_number(S b, S e, void_ptr_t& v) {
+    bool is_double;
+    int64_t i;
+    double d;
+    S p = scan_number(b, e, is_double, i, d, _a);
+    if (p) v = is_double ? make_double(*this, d) : make_int(*this, i);
+    return p;
+}
+
 bool Json::parse_from(const char* s, size_t n) {
     if (_h) this->reset();
     Parser parser;
@@ -636,82 +1202,52 @@ bool Json::parse_from(const char* s, size_t n) {
     return r;
 }
 
+bool Json::parse_from(const char* s, size_t n, Arena& a) {
+    if (_h) this->reset();
+    Parser parser((xx::ArenaImpl*)a._p);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (_h) _h->type |= kArenaRoot;
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::parse_insitu(char* s, size_t n, Arena& a) {
+    if (_h) this->reset();
+    Parser parser((xx::ArenaImpl*)a._p, true);
+    bool r = parser.parse(s, s + n, *(void**)&_h);
+    if (_h) _h->type |= kArenaRoot;
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+Arena::Arena() : _p(new xx::ArenaImpl()) {}
+
+Arena::~Arena() { delete (xx::ArenaImpl*)_p; }
+
+void Arena::clear() { ((xx::ArenaImpl*)_p)->clear(); }
+
+// find the first character to be escaped in [b, e), return e if not found.
 inline const char* find_escapse(const char* b, const char* e, char& c) {
-#if 1
-    char c0, c1, c2, c3, c4, c5, c6, c7;
-    for (;;) {
-        if (b + 8 <= e) {
-            if ((c0 = g_e2s_tb[(uint8_t)b[0]])) {
-                c = c0;
-                return b;
-            }
-            if ((c1 = g_e2s_tb[(uint8_t)b[1]])) {
-                c = c1;
-                return b + 1;
-            }
-            if ((c2 = g_e2s_tb[(uint8_t)b[2]])) {
-                c = c2;
-                return b + 2;
-            }
-            if ((c3 = g_e2s_tb[(uint8_t)b[3]])) {
-                c = c3;
-                return b + 3;
-            }
-            if ((c4 = g_e2s_tb[(uint8_t)b[4]])) {
-                c = c4;
-                return b + 4;
-            }
-            if ((c5 = g_e2s_tb[(uint8_t)b[5]])) {
-                c = c5;
-                return b + 5;
-            }
-            if ((c6 = g_e2s_tb[(uint8_t)b[6]])) {
-                c = c6;
-                return b + 6;
-            }
-            if ((c7 = g_e2s_tb[(uint8_t)b[7]])) {
-                c = c7;
-                return b + 7;
-            }
-            b += 8;
-        } else {
-            if (b + 4 <= e) {
-                if ((c0 = g_e2s_tb[(uint8_t)b[0]])) {
-                    c = c0;
-                    return b;
-                }
-                if ((c1 = g_e2s_tb[(uint8_t)b[1]])) {
-                    c = c1;
-                    return b + 1;
-                }
-                if ((c2 = g_e2s_tb[(uint8_t)b[2]])) {
-                    c = c2;
-                    return b + 2;
-                }
-                if ((c3 = g_e2s_tb[(uint8_t)b[3]])) {
-                    c = c3;
-                    return b + 3;
-                }
-                b += 4;
-            }
-            for (; b < e; ++b) {
-                if ((c = g_e2s_tb[(uint8_t)*b])) return b;
-            }
-            return e;
-        }
+    for (;; ++b) {
+        b = find_special<true>(b, e);
+        if (b == e) return e;
+        if ((c = g_e2s_tb[(uint8_t)*b])) return b;
     }
-#else
-    for (const char* p = b; p < e; ++p) {
-        if ((c = g_e2s_tb[(uint8_t)*p])) return p;
+}
+
+inline void append_escaped(fastream& fs, S s, S e) {
+    char c;
+    for (S p; (p = find_escapse(s, e, c)) < e;) {
+        fs.append(s, p - s).append('\\').append(c);
+        s = p + 1;
     }
-    return e;
-#endif
+    if (s != e) fs.append(s, e - s);
 }
 
 fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
     if (!_h) return fs.append("null", 4);
 
-    switch (_h->type) {
+    switch (_h->type & 0xff) {
         case t_string: {
             fs << '"';
             const uint32_t len = _h->size;
@@ -719,13 +1255,7 @@ fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
             S s = _h->s;
             S e = trunc ? s + 32 : s + len;
 
-            char c;
-            for (S p; (p = find_escapse(s, e, c)) < e;) {
-                fs.append(s, p - s).append('\\').append(c);
-                s = p + 1;
-            }
-
-            if (s != e) fs.append(s, e - s);
+            append_escaped(fs, s, e);
             if (trunc) fs.append(3, '.');
             fs << '"';
             break;
@@ -775,7 +1305,7 @@ fastream& Json::_json2str(fastream& fs, bool debug, int mdp) const {
 fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
     if (!_h) return fs.append("null", 4);
 
-    switch (_h->type) {
+    switch (_h->type & 0xff) {
         case t_object: {
             fs << '{';
             if (_h->p) {
@@ -818,81 +1348,747 @@ fastream& Json::_json2pretty(fastream& fs, int indent, int n, int mdp) const {
     return fs;
 }
 
-bool Json::has_member(const char* key) const {
-    if (this->is_object()) {
-        for (auto it = this->begin(); it != this->end(); ++it) {
-            if (strcmp(key, it.key()) == 0) return true;
-        }
-    }
-    return false;
+Writer& Writer::key(const char* s, size_t n) {
+    this->_sep();
+    _s.append('"');
+    append_escaped(_s, s, s + n);
+    _pretty ? _s.append("\": ", 3) : _s.append("\":", 2);
+    _key = true;
+    return *this;
 }
 
-Json& Json::operator[](const char* key) const {
-    assert(!_h || _h->type & t_object);
-    for (auto it = this->begin(); it != this->end(); ++it) {
-        if (strcmp(key, it.key()) == 0) return it.value();
+Writer& Writer::value(const char* s, size_t n) {
+    this->_sep();
+    _s.append('"');
+    append_escaped(_s, s, s + n);
+    _s.append('"');
+    return *this;
+}
+
+Writer& Writer::value(const Json& v) {
+    this->_sep();
+    _pretty ? v._json2pretty(_s, 4, (_n + 1) * 4, _mdp) : v._json2str(_s, false, _mdp);
+    return *this;
+}
+
+// MessagePack
+//   https://github.com/msgpack/msgpack/blob/master/spec.md
+namespace mp {
+
+void pack_int(fastream& s, int64_t v) {
+    if (v >= 0) return pack_uint(s, (uint64_t)v);
+    if (v >= -32) {
+        s.append((char)v);  // negative fixint
+    } else if (v >= -128) {
+        s.append((char)0xd0).append((char)v);
+    } else if (v >= -32768) {
+        s.append((char)0xd1).append(hton16((uint16_t)v));
+    } else if (v >= INT32_MIN) {
+        s.append((char)0xd2).append(hton32((uint32_t)v));
+    } else {
+        s.append((char)0xd3).append(hton64((uint64_t)v));
     }
+}
 
-    if (!_h) {
-        ((Json*)this)->_h = make_object(xx::jalloc());
-        new (&_h->p) xx::Array(8);
+void pack_uint(fastream& s, uint64_t v) {
+    if (v < 128) {
+        s.append((char)v);
+    } else if (v <= 0xff) {
+        s.append((char)0xcc).append((char)v);
+    } else if (v <= 0xffff) {
+        s.append((char)0xcd).append(hton16((uint16_t)v));
+    } else if (v <= 0xffffffff) {
+        s.append((char)0xce).append(hton32((uint32_t)v));
+    } else {
+        s.append((char)0xcf).append(hton64(v));
     }
-    if (!_h->p) new (&_h->p) xx::Array(8);
+}
 
-    auto& a = _array();
-    a.push_back(make_key(xx::jalloc(), key));
-    a.push_back(0);
-    return *(Json*)&a.back();
+void pack_double(fastream& s, double v) {
+    uint64_t u;
+    memcpy(&u, &v, 8);
+    s.append((char)0xcb).append(hton64(u));
 }
 
-Json& Json::get(uint32_t i) const {
-    if (this->is_array() && _array().size() > i) {
-        return *(Json*)&_array()[i];
+// @fix: the fix type, used if n < lim
+// @c:   type with 16 bit length, c + 1 is the type with 32 bit length
+inline void pack_len(fastream& s, uint8_t fix, uint32_t lim, uint8_t c, uint32_t n) {
+    if (n < lim) {
+        s.append((char)(fix | n));
+    } else if (n <= 0xffff) {
+        s.append((char)c).append(hton16((uint16_t)n));
+    } else {
+        s.append((char)(c + 1)).append(hton32(n));
     }
-    return xx::jalloc().null();
 }
 
-Json& Json::get(const char* key) const {
-    if (this->is_object()) {
-        for (auto it = this->begin(); it != this->end(); ++it) {
-            if (strcmp(key, it.key()) == 0) return it.value();
-        }
+void pack_str(fastream& s, const char* p, uint32_t n) {
+    if (n < 32 || n > 0xff) {
+        pack_len(s, 0xa0, 32, 0xda, n);
+    } else {
+        s.append((char)0xd9).append((char)n);
     }
-    return xx::jalloc().null();
+    s.append(p, n);
 }
 
-void Json::remove(const char* key) {
-    if (this->is_object()) {
-        const uint32_t n = _h->p ? _array().size() : 0;
-        if (n > 0) {
-            auto& a = _array();
-            for (uint32_t i = 0; i < n; i += 2) {
-                const auto s = (const char*)a[i];
-                if (strcmp(key, s) == 0) {
-                    xx::jalloc().free((void*)s, (uint32_t)strlen(s) + 1);
-                    ((Json&)a[i + 1]).reset();
-                    a.remove_pair(i);
-                    return;
+void pack_array(fastream& s, uint32_t n) { pack_len(s, 0x90, 16, 0xdc, n); }
+void pack_map(fastream& s, uint32_t n) { pack_len(s, 0x80, 16, 0xde, n); }
+
+}  // namespace mp
+
+fastream& Json::_json2pack(fastream& fs) const {
+    if (!_h) return fs.append((char)0xc0);
+
+    switch (_h->type & 0xff) {
+        case t_string:
+            mp::pack_str(fs, _h->s, _h->size);
+            break;
+
+        case t_object: {
+            const uint32_t n = this->object_size();
+            mp::pack_map(fs, n);
+            if (n > 0) {
+                auto& a = _array();
+                for (uint32_t i = 0; i < a.size(); i += 2) {
+                    mp::pack_str(fs, (S)a[i], (uint32_t)strlen((S)a[i]));
+                    ((Json*)&a[i + 1])->_json2pack(fs);
                 }
             }
+            break;
         }
-    }
-}
 
-void Json::erase(const char* key) {
-    if (this->is_object()) {
-        const uint32_t n = _h->p ? _array().size() : 0;
-        if (n > 0) {
-            auto& a = _array();
-            for (uint32_t i = 0; i < n; i += 2) {
-                const auto s = (const char*)a[i];
-                if (strcmp(key, s) == 0) {
-                    xx::jalloc().free((void*)s, (uint32_t)strlen(s) + 1);
-                    ((Json&)a[i + 1]).reset();
-                    a.erase_pair(i);
-                    return;
+        case t_array: {
+            const uint32_t n = this->array_size();
+            mp::pack_array(fs, n);
+            if (n > 0) {
+                auto& a = _array();
+                for (uint32_t i = 0; i < a.size(); ++i) {
+                    ((Json*)&a[i])->_json2pack(fs);
                 }
             }
+            break;
+        }
+
+        case t_int:
+            mp::pack_int(fs, _h->i);
+            break;
+        case t_bool:
+            mp::pack_bool(fs, _h->b);
+            break;
+        case t_double:
+            mp::pack_double(fs, _h->d);
+            break;
+    }
+
+    return fs;
+}
+
+// MessagePack unpacker
+//   - On error, values already unpacked are kept in the tree, so that the
+//     caller can free them by resetting the root.
+class Unpacker {
+  public:
+    Unpacker(S b, S e) : _a(xx::jalloc()), _b(b), _e(e) {}
+    ~Unpacker() = default;
+
+    bool unpack(void_ptr_t& v, int depth);
+    bool done() const { return _b == _e; }
+
+  private:
+    template <typename T>
+    bool read(T& v) {
+        if (unlikely((size_t)(_e - _b) < sizeof(T))) return false;
+        memcpy(&v, _b, sizeof(T));
+        _b += sizeof(T);
+        return true;
+    }
+
+    bool read_len(uint8_t c, uint32_t& n);
+    bool unpack_string(void_ptr_t& v, uint32_t n);
+    bool unpack_key(void_ptr_t& k);
+    bool unpack_array(void_ptr_t& v, uint32_t n, int depth);
+    bool unpack_object(void_ptr_t& v, uint32_t n, int depth);
+
+  private:
+    xx::Alloc& _a;
+    S _b;
+    S _e;
+};
+
+static const int kMaxUnpackDepth = 512;
+
+// read length of the extended str, bin, array or map type @c
+inline bool Unpacker::read_len(uint8_t c, uint32_t& n) {
+    switch (c) {
+        case 0xc4:
+        case 0xd9: {
+            uint8_t x;
+            if (!this->read(x)) return false;
+            n = x;
+            return true;
+        }
+        case 0xc5:
+        case 0xda:
+        case 0xdc:
+        case 0xde: {
+            uint16_t x;
+            if (!this->read(x)) return false;
+            n = ntoh16(x);
+            return true;
+        }
+        default: {
+            uint32_t x;
+            if (!this->read(x)) return false;
+            n = ntoh32(x);
+            return true;
+        }
+    }
+}
+
+inline bool Unpacker::unpack_string(void_ptr_t& v, uint32_t n) {
+    if (unlikely((size_t)(_e - _b) < n)) return false;
+    v = make_string(_a, _b, n);
+    _b += n;
+    return true;
+}
+
+inline bool Unpacker::unpack_key(void_ptr_t& k) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    uint32_t n;
+    if ((c & 0xe0) == 0xa0) {
+        n = c & 0x1f;
+    } else if (c == 0xd9 || c == 0xda || c == 0xdb) {
+        if (!this->read_len(c, n)) return false;
+    } else {
+        return false;
+    }
+
+    // keys are null-terminated strings in Json
+    if (unlikely((size_t)(_e - _b) < n || memchr(_b, '\0', n))) return false;
+    k = make_key(_a, _b, n);
+    _b += n;
+    return true;
+}
+
+bool Unpacker::unpack_array(void_ptr_t& v, uint32_t n, int depth) {
+    if (unlikely(depth >= kMaxUnpackDepth)) return false;
+    if (unlikely((size_t)(_e - _b) < n)) return false;  // 1 byte at least for each element
+    _H* h = make_array(_a);
+    v = h;
+    if (n == 0) return true;
+
+    auto& a = *new (&h->p) xx::Array(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        void_ptr_t x = 0;
+        const bool r = this->unpack(x, depth + 1);
+        a.push_back(x);
+        if (!r) return false;
+    }
+    return true;
+}
+
+bool Unpacker::unpack_object(void_ptr_t& v, uint32_t n, int depth) {
+    if (unlikely(depth >= kMaxUnpackDepth)) return false;
+    if (unlikely((size_t)(_e - _b) < (size_t)n * 2)) return false;
+    _H* h = make_object(_a);
+    v = h;
+    if (n == 0) return true;
+
+    auto& a = *new (&h->p) xx::Array(n << 1);
+    for (uint32_t i = 0; i < n; ++i) {
+        void_ptr_t k = 0, x = 0;
+        if (!this->unpack_key(k)) return false;
+        const bool r = this->unpack(x, depth + 1);
+        a.push_back(k);
+        a.push_back(x);
+        if (!r) return false;
+    }
+    xx::index_object(a);
+    return true;
+}
+
+bool Unpacker::unpack(void_ptr_t& v, int depth) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    if (c < 0x80) {
+        v = make_int(_a, c);
+        return true;
+    }
+    if (c >= 0xe0) {
+        v = make_int(_a, (int8_t)c);
+        return true;
+    }
+    if (c < 0x90) return this->unpack_object(v, c & 0x0f, depth);
+    if (c < 0xa0) return this->unpack_array(v, c & 0x0f, depth);
+    if (c < 0xc0) return this->unpack_string(v, c & 0x1f);
+
+    uint32_t n;
+    switch (c) {
+        case 0xc0:
+            v = 0;
+            return true;
+        case 0xc2:
+        case 0xc3:
+            v = make_bool(_a, c == 0xc3);
+            return true;
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:
+        case 0xd9:
+        case 0xda:
+        case 0xdb:
+            return this->read_len(c, n) && this->unpack_string(v, n);
+        case 0xdc:
+        case 0xdd:
+            return this->read_len(c, n) && this->unpack_array(v, n, depth);
+        case 0xde:
+        case 0xdf:
+            return this->read_len(c, n) && this->unpack_object(v, n, depth);
+        case 0xca: {
+            uint32_t u;
+            float f;
+            if (!this->read(u)) return false;
+            u = ntoh32(u);
+            memcpy(&f, &u, 4);
+            v = make_double(_a, f);
+            return true;
+        }
+        case 0xcb: {
+            uint64_t u;
+            double d;
+            if (!this->read(u)) return false;
+            u = ntoh64(u);
+            memcpy(&d, &u, 8);
+            v = make_double(_a, d);
+            return true;
+        }
+        case 0xcc:
+        case 0xd0: {
+            uint8_t u;
+            if (!this->read(u)) return false;
+            v = make_int(_a, c == 0xcc ? (int64_t)u : (int64_t)(int8_t)u);
+            return true;
+        }
+        case 0xcd:
+        case 0xd1: {
+            uint16_t u;
+            if (!this->read(u)) return false;
+            u = ntoh16(u);
+            v = make_int(_a, c == 0xcd ? (int64_t)u : (int64_t)(int16_t)u);
+            return true;
+        }
+        case 0xce:
+        case 0xd2: {
+            uint32_t u;
+            if (!this->read(u)) return false;
+            u = ntoh32(u);
+            v = make_int(_a, c == 0xce ? (int64_t)u : (int64_t)(int32_t)u);
+            return true;
+        }
+        case 0xcf:
+        case 0xd3: {
+            uint64_t u;
+            if (!this->read(u)) return false;
+            v = make_int(_a, (int64_t)ntoh64(u));  // uint64 is kept as int64, like parse()
+            return true;
+        }
+        default:
+            return false;  // 0xc1 or ext types
+    }
+}
+
+namespace mp {
+
+template <typename T>
+inline bool read_be(S& b, S e, T& v) {
+    if (unlikely((size_t)(e - b) < sizeof(T))) return false;
+    memcpy(&v, b, sizeof(T));
+    b += sizeof(T);
+    return true;
+}
+
+inline bool Reader::_read_len(uint8_t c, uint32_t& n) {
+    switch (c) {
+        case 0xc4:
+        case 0xd9: {
+            uint8_t x;
+            if (!read_be(_b, _e, x)) return false;
+            n = x;
+            return true;
+        }
+        case 0xc5:
+        case 0xda:
+        case 0xdc:
+        case 0xde: {
+            uint16_t x;
+            if (!read_be(_b, _e, x)) return false;
+            n = ntoh16(x);
+            return true;
+        }
+        default: {
+            uint32_t x;
+            if (!read_be(_b, _e, x)) return false;
+            n = ntoh32(x);
+            return true;
+        }
+    }
+}
+
+bool Reader::read(int64_t& v) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    if (c < 0x80 || c >= 0xe0) {
+        v = c < 0x80 ? (int64_t)c : (int64_t)(int8_t)c;
+        return true;
+    }
+
+    switch (c) {
+        case 0xc0:
+        case 0xc2:
+        case 0xc3:
+            v = c == 0xc3;
+            return true;
+        case 0xca:
+        case 0xcb: {
+            double d;
+            --_b;
+            if (!this->read(d)) return false;
+            v = (int64_t)d;
+            return true;
+        }
+        case 0xcc:
+        case 0xd0: {
+            uint8_t u;
+            if (!read_be(_b, _e, u)) return false;
+            v = c == 0xcc ? (int64_t)u : (int64_t)(int8_t)u;
+            return true;
+        }
+        case 0xcd:
+        case 0xd1: {
+            uint16_t u;
+            if (!read_be(_b, _e, u)) return false;
+            u = ntoh16(u);
+            v = c == 0xcd ? (int64_t)u : (int64_t)(int16_t)u;
+            return true;
+        }
+        case 0xce:
+        case 0xd2: {
+            uint32_t u;
+            if (!read_be(_b, _e, u)) return false;
+            u = ntoh32(u);
+            v = c == 0xce ? (int64_t)u : (int64_t)(int32_t)u;
+            return true;
+        }
+        case 0xcf:
+        case 0xd3: {
+            uint64_t u;
+            if (!read_be(_b, _e, u)) return false;
+            v = (int64_t)ntoh64(u);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool Reader::read(double& v) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b;
+    if (c == 0xca) {
+        uint32_t u;
+        float f;
+        if (!read_be(++_b, _e, u)) return false;
+        u = ntoh32(u);
+        memcpy(&f, &u, 4);
+        v = f;
+        return true;
+    }
+    if (c == 0xcb) {
+        uint64_t u;
+        if (!read_be(++_b, _e, u)) return false;
+        u = ntoh64(u);
+        memcpy(&v, &u, 8);
+        return true;
+    }
+
+    int64_t x;
+    if (!this->read(x)) return false;
+    v = (double)x;
+    return true;
+}
+
+bool Reader::read(bool& v) {
+    int64_t x;
+    if (!this->read(x)) return false;
+    v = x != 0;
+    return true;
+}
+
+bool Reader::read_str(const char*& p, uint32_t& n) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    if ((c & 0xe0) == 0xa0) {
+        n = c & 0x1f;
+    } else if (c == 0xc0) {
+        n = 0;
+    } else if ((0xc4 <= c && c <= 0xc6) || (0xd9 <= c && c <= 0xdb)) {
+        if (!this->_read_len(c, n)) return false;
+    } else {
+        return false;
+    }
+
+    if (unlikely((size_t)(_e - _b) < n)) return false;
+    p = _b;
+    _b += n;
+    return true;
+}
+
+bool Reader::read(fastring& v) {
+    const char* p;
+    uint32_t n;
+    if (!this->read_str(p, n)) return false;
+    v.assign(p, n);
+    return true;
+}
+
+bool Reader::read(std::string& v) {
+    const char* p;
+    uint32_t n;
+    if (!this->read_str(p, n)) return false;
+    v.assign(p, n);
+    return true;
+}
+
+bool Reader::read_array(uint32_t& n) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    if ((c & 0xf0) == 0x90) {
+        n = c & 0x0f;
+        return true;
+    }
+    if (c == 0xc0) {
+        n = 0;
+        return true;
+    }
+    return (c == 0xdc || c == 0xdd) && this->_read_len(c, n);
+}
+
+bool Reader::read_map(uint32_t& n) {
+    if (unlikely(_b == _e)) return false;
+    const uint8_t c = (uint8_t)*_b++;
+    if ((c & 0xf0) == 0x80) {
+        n = c & 0x0f;
+        return true;
+    }
+    if (c == 0xc0) {
+        n = 0;
+        return true;
+    }
+    return (c == 0xde || c == 0xdf) && this->_read_len(c, n);
+}
+
+bool Reader::skip() {
+    uint64_t m = 1;  // values left to skip
+    uint32_t n;
+    const char* p;
+    while (m > 0) {
+        --m;
+        if (unlikely(_b == _e)) return false;
+        const uint8_t c = (uint8_t)*_b;
+        if (c < 0x80 || c >= 0xe0 || c == 0xc0 || c == 0xc2 || c == 0xc3) {
+            ++_b;
+        } else if ((c & 0xf0) == 0x90 || c == 0xdc || c == 0xdd) {
+            if (!this->read_array(n)) return false;
+            m += n;
+        } else if ((c & 0xf0) == 0x80 || c == 0xde || c == 0xdf) {
+            if (!this->read_map(n)) return false;
+            m += (uint64_t)n << 1;
+        } else if ((c & 0xe0) == 0xa0 || (0xc4 <= c && c <= 0xc6) || (0xd9 <= c && c <= 0xdb)) {
+            if (!this->read_str(p, n)) return false;
+        } else {
+            static const uint8_t kSize[] = {
+                4, 8,        // 0xca, 0xcb
+                1, 2, 4, 8,  // 0xcc - 0xcf
+                1, 2, 4, 8,  // 0xd0 - 0xd3
+            };
+            if (c < 0xca || c > 0xd3) return false;  // 0xc1 or ext types
+            const uint8_t k = kSize[c - 0xca];
+            if (unlikely((size_t)(_e - _b) <= k)) return false;
+            _b += k + 1;
+        }
+    }
+    return true;
+}
+
+}  // namespace mp
+
+bool Json::unpack_from(const void* p, size_t n) {
+    if (_h) this->reset();
+    Unpacker u((S)p, (S)p + n);
+    bool r = u.unpack(*(void**)&_h, 0) && u.done();
+    if (unlikely(!r && _h)) this->reset();
+    return r;
+}
+
+bool Json::has_member(co::strview key) const {
+    return this->is_object() && _h->p && xx::find_key(_array(), key) >= 0;
+}
+
+bool Json::has_member(const Key& key) const {
+    return this->is_object() && _h->p && xx::find_key(_array(), key) >= 0;
+}
+
+Json& Json::operator[](co::strview key) const {
+    assert(!_h || _h->type & t_object);
+    if (_h && (_h->type & t_shared)) ((Json*)this)->_unshare();
+    if (_h && _h->p) {
+        const int i = xx::find_key(_array(), key);
+        if (i >= 0) return *(Json*)&_array()[i + 1];
+    }
+
+    if (_h && (_h->type & t_arena)) ((Json*)this)->_unarena();
+    if (!_h) {
+        ((Json*)this)->_h = make_object(xx::jalloc());
+        new (&_h->p) xx::Array(8);
+    }
+    if (!_h->p) new (&_h->p) xx::Array(8);
+
+    auto& a = _array();
+    a.push_back(make_key(xx::jalloc(), key.data(), key.size()));
+    a.push_back(0);
+    if (a.size() >= (xx::kIndexMin << 1)) xx::index_add(a);
+    return *(Json*)&a.back();
+}
+
+Json& Json::operator[](const Key& key) const {
+    assert(!_h || _h->type & t_object);
+    if (_h && (_h->type & t_shared)) ((Json*)this)->_unshare();
+    if (_h && _h->p) {
+        const int i = xx::find_key(_array(), key);
+        if (i >= 0) return *(Json*)&_array()[i + 1];
+    }
+    return this->operator[](co::strview(key.s, key.n));
+}
+
+Json& Json::get(uint32_t i) const {
+    if (this->is_array() && _array().size() > i) {
+        return *(Json*)&_array()[i];
+    }
+    return xx::jalloc().null();
+}
+
+Json& Json::get(co::strview key) const {
+    if (this->is_object() && _h->p) {
+        const int i = xx::find_key(_array(), key);
+        if (i >= 0) return *(Json*)&_array()[i + 1];
+    }
+    return xx::jalloc().null();
+}
+
+Json& Json::get(const Key& key) const {
+    if (this->is_object() && _h->p) {
+        const int i = xx::find_key(_array(), key);
+        if (i >= 0) return *(Json*)&_array()[i + 1];
+    }
+    return xx::jalloc().null();
+}
+
+Json& Json::at(const Path& path) const {
+    if (unlikely(!path._ok)) return xx::jalloc().null();
+    const Json* r = this;
+    for (size_t k = 0; k < path._segs.size(); ++k) {
+        const auto& s = path._segs[k];
+        const _H* h = r->_h;
+        if (!h || !h->p) return xx::jalloc().null();
+        if (h->type & t_object) {
+            auto& a = r->_array();
+            const int i = xx::find_key(a, path._keys.data() + s.key, s.hash);
+            if (i < 0) return xx::jalloc().null();
+            r = (const Json*)&a[i + 1];
+        } else if (h->type & t_array) {
+            auto& a = r->_array();
+            if (s.index >= a.size()) return xx::jalloc().null();
+            r = (const Json*)&a[s.index];
+        } else {
+            return xx::jalloc().null();
+        }
+    }
+    return *(Json*)r;
+}
+
+// Segments are separated by '/', "~1" is unescaped to '/' and "~0" to '~'. A
+// segment of digits without leading zeros is also an array index.
+bool Path::_parse(const char* s, size_t n) {
+    _keys.clear();
+    _segs.clear();
+    if (n == 0) return true;
+    if (*s != '/') return false;
+
+    const char* e = s + n;
+    for (const char* p = s + 1;; ++p) {
+        seg_t seg;
+        seg.key = (uint32_t)_keys.size();
+        for (; p < e && *p != '/'; ++p) {
+            if (*p != '~') {
+                _keys.append(*p);
+            } else if (p + 1 < e && (p[1] == '0' || p[1] == '1')) {
+                _keys.append(*++p == '0' ? '~' : '/');
+            } else {
+                return false;
+            }
+        }
+
+        const char* k = _keys.data() + seg.key;
+        const size_t m = _keys.size() - seg.key;
+        seg.index = (uint32_t)-1;
+        if (m > 0 && m <= 9 && (m == 1 || *k != '0')) {
+            uint32_t x = 0;
+            size_t i = 0;
+            for (; i < m && '0' <= k[i] && k[i] <= '9'; ++i) x = x * 10 + (k[i] - '0');
+            if (i == m) seg.index = x;
+        }
+        _keys.append('\0');
+        seg.hash = xx::key_hash(_keys.data() + seg.key);
+        _segs.push_back(seg);
+        if (p >= e) break;
+    }
+    return true;
+}
+
+// Members are moved by remove() and erase(), the index is rebuilt then.
+void Json::remove(const char* key) {
+    if (this->is_object() && _h->p) {
+        auto& a = _array();
+        const int i = xx::find_key(a, key);
+        if (i >= 0) {
+            if (unlikely(_h->type & (t_arena | t_shared))) {
+                this->_cow();
+                return this->remove(key);
+            }
+            const auto s = (const char*)a[i];
+            xx::jalloc().free((void*)s, (uint32_t)strlen(s) + 1);
+            ((Json&)a[i + 1]).reset();
+            a.remove_pair(i);
+            if (a.index()) xx::index_build(a);
+        }
+    }
+}
+
+void Json::erase(const char* key) {
+    if (this->is_object() && _h->p) {
+        auto& a = _array();
+        const int i = xx::find_key(a, key);
+        if (i >= 0) {
+            if (unlikely(_h->type & (t_arena | t_shared))) {
+                this->_cow();
+                return this->erase(key);
+            }
+            const auto s = (const char*)a[i];
+            xx::jalloc().free((void*)s, (uint32_t)strlen(s) + 1);
+            ((Json&)a[i + 1]).reset();
+            a.erase_pair(i);
+            if (a.index()) xx::index_build(a);
         }
     }
 }
@@ -912,6 +2108,7 @@ beg:
         goto beg;
     }
 
+    if (unlikely(_h->type & t_shared)) this->_unshare();
     auto& a = _array();
     if (i < a.size()) {
         return *(Json*)&a[i];
@@ -936,16 +2133,121 @@ beg:
         goto beg;
     }
 
-    for (auto it = this->begin(); it != this->end(); ++it) {
-        if (strcmp(key, it.key()) == 0) return it.value();
+    if (unlikely(_h->type & t_shared)) this->_unshare();
+    if (_h->p) {
+        const int i = xx::find_key(_array(), key);
+        if (i >= 0) return *(Json*)&_array()[i + 1];
     }
 
     this->add_member(key, Json());
     return *(Json*)&_array().back();
 }
 
+// A node in an arena is not freed, members not in the arena are freed if the
+// document is dirty. A member released may be replaced by a value not in the
+// arena, the arena is marked dirty then.
+void Json::_arena_reset() {
+    auto r = xx::ArenaImpl::of(_h);
+    if (r->dirty() && (_h->type & (t_array | t_object)) && _h->p) {
+        auto& a = _array();
+        const uint32_t step = (_h->type & t_object) ? 2 : 1;
+        for (uint32_t i = step - 1; i < a.size(); i += step) ((Json&)a[i]).reset();
+    }
+    if (!(_h->type & kArenaRoot)) r->set_dirty();
+    _h = 0;
+}
+
+// Move an object or array in an arena to the heap before it is modified, the keys
+// are copied, the members stay where they are.
+void Json::_unarena() {
+    xx::ArenaImpl::of(_h)->set_dirty();
+    auto& j = xx::jalloc();
+    _H* h;
+    if (_h->type & t_object) {
+        h = make_object(j);
+        if (_h->p) {
+            auto& s = _array();
+            auto& a = *new (&h->p) xx::Array(s.size());
+            for (uint32_t i = 0; i < s.size(); i += 2) {
+                a.push_back(make_key(j, (const char*)s[i]));
+                a.push_back(s[i + 1]);
+            }
+            xx::index_object(a);
+        }
+    } else {
+        h = make_array(j);
+        if (_h->p) {
+            auto& s = _array();
+            auto& a = *new (&h->p) xx::Array(s.size());
+            for (uint32_t i = 0; i < s.size(); ++i) a.push_back(s[i]);
+        }
+    }
+    _h = h;
+}
+
+// Copy a shared object or array before it is modified, the keys and strings are
+// copied, other members are shared by both. It is not copied if this is the only
+// owner, no one else can take a reference then.
+void Json::_unshare() {
+    if (refs(_h).load(std::memory_order_acquire) == 1) {
+        _h->type &= ~t_shared;
+        return;
+    }
+
+    auto& j = xx::jalloc();
+    _H* h = (_h->type & t_object) ? make_object(j) : make_array(j);
+    if (_h->p) {
+        auto& s = _array();
+        auto& a = *new (&h->p) xx::Array(s.size());
+        const uint32_t step = (_h->type & t_object) ? 2 : 1;
+        for (uint32_t i = 0; i < s.size(); i += step) {
+            if (step == 2) a.push_back(make_key(j, (const char*)s[i]));
+            _H* x = (_H*)s[i + step - 1];
+            if (x && (x->type & t_string)) {
+                x = make_string(j, x->s, x->size);
+            } else if (x) {
+                refs(x).fetch_add(1, std::memory_order_relaxed);
+            }
+            a.push_back(x);
+        }
+        if (step == 2) xx::index_object(a);
+    }
+    this->reset();
+    _h = h;
+}
+
+// Mark the nodes not shared yet, the members of a shared node are all shared. A
+// node in an arena is copied to the heap first, as the arena may be cleared.
+static void share_tree(Json& x) {
+    _H*& h = *(_H**)&x;
+    if (!h) return;
+    if (h->type & Json::t_arena) x = x.dup();
+    if (h->type & (Json::t_shared | Json::t_string)) return;
+
+    if ((h->type & (Json::t_array | Json::t_object)) && h->p) {
+        auto& a = *(xx::Array*)&h->p;
+        const uint32_t step = (h->type & Json::t_object) ? 2 : 1;
+        for (uint32_t i = step - 1; i < a.size(); i += step) share_tree(*(Json*)&a[i]);
+    }
+    h->type |= Json::t_shared;
+    refs(h).store(1, std::memory_order_relaxed);
+}
+
+Json& Json::share() {
+    share_tree(*this);
+    return *this;
+}
+
 void Json::reset() {
     if (_h) {
+        if (unlikely(_h->type & t_arena)) return this->_arena_reset();
+        if (unlikely(_h->type & t_shared)) {
+            if (refs(_h).fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                _h = 0;
+                return;
+            }
+            _h->type &= ~t_shared;
+        }
         auto& a = xx::jalloc();
         switch (_h->type) {
             case t_object:
@@ -974,8 +2276,12 @@ void Json::reset() {
 
 void* Json::_dup() const {
     _H* h = 0;
+    if (_h && (_h->type & t_shared)) {
+        refs(_h).fetch_add(1, std::memory_order_relaxed);
+        return _h;
+    }
     if (_h) {
-        switch (_h->type) {
+        switch (_h->type & 0xff) {
             case t_object:
                 h = make_object(xx::jalloc());
                 if (_h->p) {
@@ -984,6 +2290,7 @@ void* Json::_dup() const {
                         a.push_back(make_key(xx::jalloc(), it.key()));
                         a.push_back(it.value()._dup());
                     }
+                    xx::index_object(a);
                 }
                 break;
             case t_array:
@@ -1000,13 +2307,22 @@ void* Json::_dup() const {
                 break;
             default:
                 h = (_H*)xx::jalloc().alloc();
-                h->type = _h->type;
+                h->type = _h->type & 0xff;
                 h->i = _h->i;
         }
     }
     return h;
 }
 
+// take the string of @x as a key, a string in an arena is copied
+inline char* steal_key(Json& x) {
+    _H* h = *(_H**)&x;
+    if (h->type & Json::t_arena) return make_key(xx::jalloc(), h->s, h->size);
+    char* s = h->s;
+    h->s = 0;
+    return s;
+}
+
 Json::Json(std::initializer_list<Json> v) {
     const bool is_obj = std::all_of(v.begin(), v.end(), [](const Json& x) {
         return x.is_array() && x.array_size() == 2 && x[0].is_string();
@@ -1018,11 +2334,11 @@ Json::Json(std::initializer_list<Json> v) {
         if (n > 0) {
             auto& a = *new (&_h->p) xx::Array(n);
             for (auto& x : v) {
-                a.push_back(x[0]._h->s);
-                x[0]._h->s = 0;
+                a.push_back(steal_key(x[0]));
                 a.push_back(x[1]._h);
                 x[1]._h = 0;
             }
+            xx::index_object(a);
         }
 
     } else {
@@ -1060,13 +2376,974 @@ Json object(std::initializer_list<Json> v) {
         auto& a = *new (&h->p) xx::Array(n);
         for (auto& x : v) {
             assert(x.is_array() && x.size() == 2 && x[0].is_string());
-            a.push_back((*(Json::_H**)&x[0])->s);
-            (*(_H**)&x[0])->s = 0;
+            a.push_back(steal_key(x[0]));
             a.push_back(*(_H**)&x[1]);
             *(_H**)&x[1] = 0;
         }
+        xx::index_object(a);
     }
     return r;
 }
 
+namespace xx {
+
+// An entry of the index of Lazy: a bracket, colon, comma or string. @end is the
+// index of the closing bracket for '{' and '[', or position of the closing quote
+// for a string.
+struct lazy_node_t {
+    uint32_t pos;
+    uint32_t end;
+};
+
+struct LazyDoc {
+    const char* s;
+    uint32_t n;
+    bool ok;
+    co::vector<lazy_node_t> v;
+    co::vector<uint32_t> stack;  // indexes of the open brackets
+};
+
+bool lazy_index(LazyDoc& d) {
+    auto& v = d.v;
+    auto& st = d.stack;
+    v.clear();
+    st.clear();
+    const S b = d.s, e = d.s + d.n;
+    for (S p = b; p < e; ++p) {
+        switch (*p) {
+            case '"': {
+                S q = p + 1;
+                while (true) {
+                    q = find_special<false>(q, e);
+                    if (q == e) return false;
+                    if (*q == '"') break;
+                    if ((q += 2) >= e) return false;  // skip the escaped character
+                }
+                v.push_back(lazy_node_t{(uint32_t)(p - b), (uint32_t)(q - b)});
+                p = q;
+                break;
+            }
+            case '{':
+            case '[':
+                st.push_back((uint32_t)v.size());
+                v.push_back(lazy_node_t{(uint32_t)(p - b), 0});
+                break;
+            case '}':
+            case ']': {
+                if (st.empty()) return false;
+                const uint32_t k = st.pop_back();
+                if (b[v[k].pos] != (*p == '}' ? '{' : '[')) return false;
+                v[k].end = (uint32_t)v.size();
+                v.push_back(lazy_node_t{(uint32_t)(p - b), 0});
+                break;
+            }
+            case ':':
+            case ',':
+                v.push_back(lazy_node_t{(uint32_t)(p - b), 0});
+                break;
+        }
+    }
+    return st.empty();
+}
+
+inline uint32_t lazy_skip_ws(const LazyDoc& d, uint32_t p) {
+    while (p < d.n && is_white_space(d.s[p])) ++p;
+    return p;
+}
+
+// the entry @t is the value at @p if it is an object, array or string
+inline bool lazy_is_entry(const LazyDoc& d, uint32_t p, uint32_t t) {
+    if (t >= d.v.size() || d.v[t].pos != p) return false;
+    const char c = d.s[p];
+    return c == '{' || c == '[' || c == '"';
+}
+
+// index of the first entry after the value at @p
+inline uint32_t lazy_next(const LazyDoc& d, uint32_t p, uint32_t t) {
+    if (!lazy_is_entry(d, p, t)) return t;  // number, bool or null
+    return d.s[p] != '"' ? d.v[t].end + 1 : t + 1;
+}
+
+inline bool lazy_is(const LazyDoc& d, uint32_t t, char c) {
+    return t < d.v.size() && d.s[d.v[t].pos] == c;
+}
+
+// compare the key at the entry @t with @key, a key with escapes is parsed first
+inline bool lazy_key_eq(const LazyDoc& d, uint32_t t, const char* key, size_t n) {
+    const char* p = d.s + d.v[t].pos + 1;
+    const size_t m = d.s + d.v[t].end - p;
+    if (!memchr(p, '\\', m)) return m == n && memcmp(p, key, n) == 0;
+    Json x = json::parse(p - 1, m + 2);
+    return x.is_string() && x.string_size() == n && memcmp(x.as_c_str(), key, n) == 0;
+}
+
+}  // namespace xx
+
+using Cursor = Lazy::Cursor;
+
+bool Lazy::parse(const char* s, size_t n) {
+    if (!_p) _p = new xx::LazyDoc();
+    auto& d = *(xx::LazyDoc*)_p;
+    d.s = s;
+    d.n = (uint32_t)n;
+    d.ok = n <= UINT32_MAX && xx::lazy_index(d);
+    return d.ok;
+}
+
+Lazy::~Lazy() { delete (xx::LazyDoc*)_p; }
+
+Cursor Lazy::root() const {
+    auto d = (const xx::LazyDoc*)_p;
+    if (!d || !d->ok) return Cursor();
+    const uint32_t p = xx::lazy_skip_ws(*d, 0);
+    return p < d->n ? Cursor(d, p, 0) : Cursor();
+}
+
+int Cursor::type() const {
+    if (!_d) return Json::t_null;
+    auto& d = *(const xx::LazyDoc*)_d;
+    switch (d.s[_p]) {
+        case '{':
+            return Json::t_object;
+        case '[':
+            return Json::t_array;
+        case '"':
+            return Json::t_string;
+        case 't':
+        case 'f':
+            return Json::t_bool;
+        case 'n':
+            return Json::t_null;
+        default:
+            return this->to_json().type();  // int or double
+    }
+}
+
+Cursor Cursor::get(uint32_t i) const {
+    if (!_d) return Cursor();
+    auto& d = *(const xx::LazyDoc*)_d;
+    if (d.s[_p] != '[' || !xx::lazy_is_entry(d, _p, _t)) return Cursor();
+
+    const uint32_t end = d.v[_t].end;
+    uint32_t p = xx::lazy_skip_ws(d, _p + 1), t = _t + 1;
+    if (p == d.v[end].pos) return Cursor();  // empty array
+    for (uint32_t k = 0;; ++k) {
+        if (k == i) return Cursor(_d, p, t);
+        t = xx::lazy_next(d, p, t);
+        if (t >= end || !xx::lazy_is(d, t, ',')) return Cursor();
+        p = xx::lazy_skip_ws(d, d.v[t].pos + 1);
+        ++t;
+    }
+}
+
+Cursor Cursor::get(const char* key) const {
+    if (!_d) return Cursor();
+    auto& d = *(const xx::LazyDoc*)_d;
+    if (d.s[_p] != '{' || !xx::lazy_is_entry(d, _p, _t)) return Cursor();
+
+    const uint32_t end = d.v[_t].end;
+    const size_t n = strlen(key);
+    for (uint32_t t = _t + 1; t < end;) {
+        if (!xx::lazy_is(d, t, '"') || !xx::lazy_is(d, t + 1, ':')) break;
+        const uint32_t p = xx::lazy_skip_ws(d, d.v[t + 1].pos + 1);
+        if (xx::lazy_key_eq(d, t, key, n)) return Cursor(_d, p, t + 2);
+        t = xx::lazy_next(d, p, t + 2);
+        if (t >= end || !xx::lazy_is(d, t, ',')) break;
+        ++t;
+    }
+    return Cursor();
+}
+
+uint32_t Cursor::size() const {
+    if (!_d) return 0;
+    auto& d = *(const xx::LazyDoc*)_d;
+    const char c = d.s[_p];
+    if ((c != '{' && c != '[') || !xx::lazy_is_entry(d, _p, _t)) return 0;
+
+    const uint32_t end = d.v[_t].end;
+    if (xx::lazy_skip_ws(d, _p + 1) == d.v[end].pos) return 0;
+    uint32_t n = 1;
+    for (uint32_t t = _t + 1; t < end;) {
+        const char x = d.s[d.v[t].pos];
+        if (x == ',') ++n;
+        t = (x == '{' || x == '[') ? d.v[t].end + 1 : t + 1;
+    }
+    return n;
+}
+
+uint32_t Cursor::_end() const {
+    auto& d = *(const xx::LazyDoc*)_d;
+    if (xx::lazy_is_entry(d, _p, _t)) {
+        return d.s[_p] != '"' ? d.v[d.v[_t].end].pos + 1 : d.v[_t].end + 1;
+    }
+    uint32_t e = _t < d.v.size() ? d.v[_t].pos : d.n;
+    while (e > _p && is_white_space(d.s[e - 1])) --e;
+    return e;
+}
+
+fastring Cursor::as_string() const {
+    if (!_d) return fastring();
+    auto& d = *(const xx::LazyDoc*)_d;
+    if (d.s[_p] == '"' && xx::lazy_is_entry(d, _p, _t)) {
+        const char* p = d.s + _p + 1;
+        const size_t n = d.v[_t].end - _p - 1;
+        if (!memchr(p, '\\', n)) return fastring(p, n);
+    }
+    return this->to_json().as_string();
+}
+
+fastring Cursor::raw() const {
+    if (!_d) return fastring();
+    return fastring(((const xx::LazyDoc*)_d)->s + _p, this->_end() - _p);
+}
+
+Json Cursor::to_json() const {
+    if (!_d) return Json();
+    return json::parse(((const xx::LazyDoc*)_d)->s + _p, this->_end() - _p);
+}
+
+namespace xx {
+
+// State of a StreamParser. Objects and arrays are built on stacks like the Parser,
+// a token split between chunks is buffered in _tok.
+class StreamImpl {
+  public:
+    StreamImpl() : _s(16), _u(16), _tok(64) { this->init(); }
+    ~StreamImpl() { this->clear(); }
+
+    int feed(S b, S e);
+    int finish();
+
+    void* take() {
+        void* v = _root;
+        _root = 0;
+        return v;
+    }
+
+    // free the nodes parsed, and be ready for a new document
+    void clear();
+
+  private:
+    // what is expected next
+    enum {
+        x_value,
+        x_elem_first,  // the first element of an array, or ']'
+        x_key,
+        x_key_first,  // the first key of an object, or '}'
+        x_colon,
+        x_next,  // ',' or the end of the object or array
+        x_done,
+        x_error,
+    };
+
+    void init() {
+        _size = 0;
+        _state = 0;
+        _x = x_value;
+        _tk = 0;
+        _esc = false;
+        _root = 0;
+        _tok.clear();
+    }
+
+    S token(S t, S b, S e);
+    bool end_token(S b, S e);
+    void push(void* v);
+    void open(bool obj);
+    bool close(char c);
+
+    int fail() {
+        this->clear();
+        _x = x_error;
+        return -1;
+    }
+
+    Array _s;         // |node|key|value|...
+    Array _u;         // |prev size|prev state|...
+    uint32_t _size;   // size of _s at the beginning of the current object or array
+    uint32_t _state;  // '{', '[', or 0 at the top level
+    int _x;
+    char _tk;   // the token being read: '"' string, 'k' key, '0' number, 'a' literal
+    bool _esc;  // a string was split after a backslash
+    fastream _tok;
+    void* _root;
+};
+
+inline bool is_num_char(char c) {
+    return is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// Read the current token from @b, @t is where it began in this chunk, or null if
+// it began in a previous chunk. Return the position after the token, @e if it is
+// not complete, or null on error.
+S StreamImpl::token(S t, S b, S e) {
+    S p = b;
+    if (_tk == '"' || _tk == 'k') {
+        if (p == t) {
+            ++p;  // the opening quote
+        } else if (_esc) {
+            _esc = false;
+            ++p;
+        }
+        while (true) {
+            p = find_special<false>(p, e);
+            if (p == e) break;
+            if (*p == '"') {
+                ++p;
+                goto end;
+            }
+            if (++p == e) {
+                _esc = true;
+                break;
+            }
+            ++p;
+        }
+    } else {
+        const bool num = _tk == '0';
+        while (p < e && (num ? is_num_char(*p) : ('a' <= *p && *p <= 'z'))) ++p;
+        if (p < e) goto end;
+    }
+    _tok.append(b, e - b);
+    return e;
+
+end:
+    if (t) return this->end_token(t, p) ? p : 0;
+    _tok.append(b, p - b);
+    _tok.c_str();
+    return this->end_token(_tok.data(), _tok.data() + _tok.size()) ? p : 0;
+}
+
+// the token [b, e) is complete
+bool StreamImpl::end_token(S b, S e) {
+    Parser parser;
+    void* v = 0;
+    S p = e - 1;
+    const size_t n = e - b;
+    switch (_tk) {
+        case 'k':
+            p = parser.parse_key(b, e, v);
+            break;
+        case '"':
+            p = parser.parse_string(b, e, v);
+            break;
+        case '0':
+            p = parser.parse_number(b, e, v);
+            break;
+        default:
+            if (n == 4 && memcmp(b, "true", 4) == 0) {
+                v = make_bool(jalloc(), true);
+            } else if (n == 5 && memcmp(b, "false", 5) == 0) {
+                v = make_bool(jalloc(), false);
+            } else if (n != 4 || memcmp(b, "null", 4) != 0) {
+                p = 0;
+            }
+    }
+
+    const char k = _tk;
+    _tk = 0;
+    _tok.clear();
+    if (p != e - 1) {
+        if (k == 'k') {
+            if (v) jalloc().free(v, (uint32_t)strlen((char*)v) + 1);
+        } else {
+            ((Json&)v).reset();
+        }
+        return false;
+    }
+    if (k == 'k') {
+        _s.push_back(v);
+        _x = x_colon;
+    } else {
+        this->push(v);
+    }
+    return true;
+}
+
+void StreamImpl::push(void* v) {
+    if (_state == 0) {
+        _root = v;
+        _x = x_done;
+    } else {
+        _s.push_back(v);
+        _x = x_next;
+    }
+}
+
+void StreamImpl::open(bool obj) {
+    _u.push_back((void*)(size_t)_size);
+    _u.push_back((void*)(size_t)_state);
+    _s.push_back(obj ? make_object(jalloc()) : make_array(jalloc()));
+    _size = _s.size();
+    _state = obj ? '{' : '[';
+    _x = obj ? x_key_first : x_elem_first;
+}
+
+bool StreamImpl::close(char c) {
+    if (c != (_state == '{' ? '}' : ']')) return false;
+    if (_s.size() > _size) {
+        void* p = alloc_array(_s.data() + _size, _s.size() - _size);
+        _s.resize(_size);
+        ((_H*)_s.back())->p = p;
+        if (_state == '{') index_object((Array&)((_H*)_s.back())->p);
+    }
+    _state = (uint32_t)(size_t)_u.pop_back();
+    _size = (uint32_t)(size_t)_u.pop_back();
+    if (_state == 0) {
+        _root = _s.pop_back();
+        _x = x_done;
+    } else {
+        _x = x_next;
+    }
+    return true;
+}
+
+int StreamImpl::feed(S b, S e) {
+    if (_x == x_error) return -1;
+    S t = 0;  // beginning of the token in this chunk
+    while (b < e) {
+        if (_tk) {
+            b = this->token(t, b, e);
+            if (!b) return this->fail();
+            continue;
+        }
+
+        const char c = *b;
+        if (is_white_space(c)) {
+            ++b;
+            continue;
+        }
+
+        switch (_x) {
+            case x_elem_first:
+                if (c == ']') {
+                    this->close(c);
+                    ++b;
+                    continue;
+                }
+                // fall through
+            case x_value:
+                switch (c) {
+                    case '{':
+                    case '[':
+                        this->open(c == '{');
+                        ++b;
+                        continue;
+                    case '"':
+                        _tk = '"';
+                        break;
+                    case 't':
+                    case 'f':
+                    case 'n':
+                        _tk = 'a';
+                        break;
+                    default:
+                        if (c != '-' && !is_digit(c)) return this->fail();
+                        _tk = '0';
+                }
+                t = b;
+                continue;
+            case x_key_first:
+                if (c == '}') {
+                    this->close(c);
+                    ++b;
+                    continue;
+                }
+                // fall through
+            case x_key:
+                if (c != '"') return this->fail();
+                _tk = 'k';
+                t = b;
+                continue;
+            case x_colon:
+                if (c != ':') return this->fail();
+                _x = x_value;
+                ++b;
+                continue;
+            case x_next:
+                if (c == ',') {
+                    _x = _state == '{' ? x_key : x_value;
+                } else if (!this->close(c)) {
+                    return this->fail();
+                }
+                ++b;
+                continue;
+            default:
+                return this->fail();  // not whitespace after the document
+        }
+    }
+    return _x == x_done ? 1 : 0;
+}
+
+int StreamImpl::finish() {
+    if (_tk == '0' || _tk == 'a') {
+        _tok.c_str();
+        if (!this->end_token(_tok.data(), _tok.data() + _tok.size())) return this->fail();
+    }
+    if (_x != x_done || _tk) return this->fail();
+    return 1;
+}
+
+// close the objects and arrays being built like the Parser on errors, then free them
+void StreamImpl::clear() {
+    while (_s.size() > 0) {
+        if (_s.size() > _size) {
+            if (_state == '{' && ((_s.size() - _size) & 1)) _s.push_back(0);
+            void* p = alloc_array(_s.data() + _size, _s.size() - _size);
+            _s.resize(_size);
+            ((_H*)_s.back())->p = p;
+        }
+        _state = (uint32_t)(size_t)_u.pop_back();
+        _size = (uint32_t)(size_t)_u.pop_back();
+        if (_state == 0) {
+            void* v = _s.pop_back();
+            ((Json&)v).reset();
+        }
+    }
+    if (_root) ((Json&)_root).reset();
+    this->init();
+}
+
+}  // namespace xx
+
+StreamParser::StreamParser() : _p(new xx::StreamImpl()) {}
+
+StreamParser::~StreamParser() { delete (xx::StreamImpl*)_p; }
+
+int StreamParser::feed(const void* p, size_t n) {
+    return ((xx::StreamImpl*)_p)->feed((S)p, (S)p + n);
+}
+
+int StreamParser::finish() { return ((xx::StreamImpl*)_p)->finish(); }
+
+Json StreamParser::value() {
+    Json r;
+    *(void**)&r = ((xx::StreamImpl*)_p)->take();
+    return r;
+}
+
+void StreamParser::reset() { ((xx::StreamImpl*)_p)->clear(); }
+
+inline S skip_ws(S b, S e) {
+    while (b < e && is_white_space(*b)) ++b;
+    return b;
+}
+
+// SAX parser, it works like the Parser, but calls the handler instead of making
+// nodes. Keys are not unescaped, the same as the Parser.
+class Sax {
+  public:
+    explicit Sax(SaxHandler& h) : _h(h), _a(xx::jalloc()) {}
+
+    bool parse(S b, S e);
+
+  private:
+    S parse_scalar(S b, S e);
+    S parse_string(S b, S e);
+
+    SaxHandler& _h;
+    xx::Alloc& _a;
+    Parser _p;
+    fastream _s;   // unescaped string
+    fastream _st;  // states of the objects and arrays: '{' or '['
+};
+
+// parse a string, number, bool or null, return position of its last character
+S Sax::parse_scalar(S b, S e) {
+    switch (*b) {
+        case '"':
+            return this->parse_string(b, e);
+        case 't':
+            if (e - b >= 4 && memcmp(b, "true", 4) == 0) return _h.on_bool(true) ? b + 3 : 0;
+            return 0;
+        case 'f':
+            if (e - b >= 5 && memcmp(b, "false", 5) == 0) return _h.on_bool(false) ? b + 4 : 0;
+            return 0;
+        case 'n':
+            if (e - b >= 4 && memcmp(b, "null", 4) == 0) return _h.on_null() ? b + 3 : 0;
+            return 0;
+        default: {
+            bool is_double;
+            int64_t i;
+            double d;
+            S p = scan_number(b, e, is_double, i, d, _a);
+            if (p == 0) return 0;
+            return (is_double ? _h.on_double(d) : _h.on_int(i)) ? p : 0;
+        }
+    }
+}
+
+S Sax::parse_string(S b, S e) {
+    S p = find_special<false>(++b, e);
+    if (p == e) return 0;
+    if (*p == '"') return _h.on_string(b, p - b) ? p : 0;
+
+    _s.clear();
+    do {
+        _s.append(b, p - b);
+        if (++p == e) return 0;
+
+        char c = g_s2e_tb[(uint8_t)*p];
+        if (c == 0) return 0;  // invalid escape
+
+        if (*p != 'u') {
+            _s.append(c);
+        } else {
+            p = _p.parse_unicode(p + 1, e, _s);
+            if (p == 0) return 0;
+        }
+
+        b = p + 1;
+        p = find_special<false>(b, e);
+        if (p == e) return 0;
+        if (*p == '"') {
+            _s.append(b, p - b);
+            return _h.on_string(_s.data(), _s.size()) ? p : 0;
+        }
+    } while (true);
+}
+
+bool Sax::parse(S b, S e) {
+    char state = 0;
+    S p;
+    b = skip_ws(b, e);
+    if (b == e) return false;
+
+val_beg:
+    if (*b == '{') {
+        if (!_h.on_object_begin()) return false;
+        _st.append(state);
+        state = '{';
+        b = skip_ws(b + 1, e);
+        if (b == e) return false;
+        if (*b == '}') goto obj_end;
+        goto key_beg;
+    }
+    if (*b == '[') {
+        if (!_h.on_array_begin()) return false;
+        _st.append(state);
+        state = '[';
+        b = skip_ws(b + 1, e);
+        if (b == e) return false;
+        if (*b == ']') goto arr_end;
+        goto val_beg;
+    }
+    b = this->parse_scalar(b, e);
+    if (b == 0) return false;
+
+val_end:
+    b = skip_ws(b + 1, e);
+    if (state == 0) return b == e;
+    if (b == e) return false;
+    if (*b == ',') {
+        b = skip_ws(b + 1, e);
+        if (b == e) return false;
+        if (state == '[') goto val_beg;
+        goto key_beg;
+    }
+    if (*b == '}' && state == '{') goto obj_end;
+    if (*b == ']' && state == '[') goto arr_end;
+    return false;
+
+key_beg:
+    if (*b != '"') return false;
+    p = (S)memchr(b + 1, '"', e - b - 1);
+    if (p == 0 || !_h.on_key(b + 1, p - b - 1)) return false;
+    b = skip_ws(p + 1, e);
+    if (b == e || *b != ':') return false;
+    b = skip_ws(b + 1, e);
+    if (b == e) return false;
+    goto val_beg;
+
+obj_end:
+    if (!_h.on_object_end()) return false;
+    goto pop;
+
+arr_end:
+    if (!_h.on_array_end()) return false;
+
+pop:
+    state = _st.data()[_st.size() - 1];
+    _st.resize(_st.size() - 1);
+    goto val_end;
+}
+
+bool sax(const char* s, size_t n, SaxHandler& h) {
+    Sax x(h);
+    return x.parse(s, s + n);
+}
+
+// read a bool, number or null at @b, and move @b to the end of it. Return its type,
+// or -1 on error. A bool is also stored in @i.
+inline int read_scalar(S& b, S e, int64_t& i, double& d) {
+    switch (*b) {
+        case 't':
+            if (e - b < 4 || memcmp(b, "true", 4) != 0) return -1;
+            b += 4;
+            i = 1;
+            return Json::t_bool;
+        case 'f':
+            if (e - b < 5 || memcmp(b, "false", 5) != 0) return -1;
+            b += 5;
+            i = 0;
+            return Json::t_bool;
+        case 'n':
+            if (e - b < 4 || memcmp(b, "null", 4) != 0) return -1;
+            b += 4;
+            return Json::t_null;
+        default: {
+            bool is_double;
+            S p = scan_number(b, e, is_double, i, d, xx::jalloc());
+            if (p == 0) return -1;
+            b = p + 1;
+            return is_double ? Json::t_double : Json::t_int;
+        }
+    }
+}
+
+// return position of the closing quote of the string at @b, or null on error
+inline S skip_string(S b, S e) {
+    for (S p = b + 1;; p += 2) {
+        p = find_special<false>(p, e);
+        if (p == e) return 0;
+        if (*p == '"') return p;
+        if (p + 1 == e) return 0;  // the escaped character is skipped
+    }
+}
+
+bool Reader::done() {
+    _b = skip_ws(_b, _e);
+    return _b == _e;
+}
+
+bool Reader::read(int64_t& v) {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    double d;
+    switch (read_scalar(b, _e, v, d)) {
+        case -1:
+            return false;
+        case Json::t_null:
+            v = 0;
+            break;
+        case Json::t_double:
+            v = (int64_t)d;
+            break;
+    }
+    _b = b;
+    return true;
+}
+
+bool Reader::read(double& v) {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    int64_t i;
+    switch (read_scalar(b, _e, i, v)) {
+        case -1:
+            return false;
+        case Json::t_null:
+            v = 0;
+            break;
+        case Json::t_bool:
+        case Json::t_int:
+            v = (double)i;
+            break;
+    }
+    _b = b;
+    return true;
+}
+
+bool Reader::read(bool& v) {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    int64_t i;
+    double d;
+    switch (read_scalar(b, _e, i, d)) {
+        case -1:
+            return false;
+        case Json::t_null:
+            v = false;
+            break;
+        case Json::t_double:
+            v = d != 0;
+            break;
+        default:
+            v = i != 0;
+    }
+    _b = b;
+    return true;
+}
+
+// @p points to the string in the text, or the unescaped string in a buffer of the
+// thread, which is valid until the next read.
+bool Reader::_read_str(const char*& p, size_t& n) {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    if (*b != '"') {
+        if (_e - b < 4 || memcmp(b, "null", 4) != 0) return false;
+        _b = b + 4;
+        p = b;
+        n = 0;
+        return true;
+    }
+
+    S q = find_special<false>(++b, _e);
+    if (q == _e) return false;
+    if (*q == '"') {
+        p = b;
+        n = q - b;
+        _b = q + 1;
+        return true;
+    }
+
+    fastream& s = xx::jalloc().stream();
+    Parser parser;
+    do {
+        s.append(b, q - b);
+        if (++q == _e) return false;
+
+        char c = g_s2e_tb[(uint8_t)*q];
+        if (c == 0) return false;  // invalid escape
+
+        if (*q != 'u') {
+            s.append(c);
+        } else {
+            q = parser.parse_unicode(q + 1, _e, s);
+            if (q == 0) return false;
+        }
+
+        b = q + 1;
+        q = find_special<false>(b, _e);
+        if (q == _e) return false;
+    } while (*q != '"');
+
+    s.append(b, q - b);
+    p = s.data();
+    n = s.size();
+    _b = q + 1;
+    return true;
+}
+
+bool Reader::read(fastring& v) {
+    const char* p;
+    size_t n;
+    if (!this->_read_str(p, n)) return false;
+    v.assign(p, n);
+    return true;
+}
+
+bool Reader::read(std::string& v) {
+    const char* p;
+    size_t n;
+    if (!this->_read_str(p, n)) return false;
+    v.assign(p, n);
+    return true;
+}
+
+bool Reader::_begin(char c) {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    if (*b == c) {
+        _b = b + 1;
+        _first = true;
+        return true;
+    }
+    if (_e - b < 4 || memcmp(b, "null", 4) != 0) return false;
+    _b = b + 4;
+    _null = true;
+    return true;
+}
+
+int Reader::next_key(const char*& p, uint32_t& n) {
+    if (_null) {
+        _null = _first = false;
+        return 0;
+    }
+
+    S b = skip_ws(_b, _e);
+    if (b == _e) return -1;
+    if (*b == '}') {
+        _b = b + 1;
+        _first = false;
+        return 0;
+    }
+    if (!_first) {
+        if (*b != ',') return -1;
+        b = skip_ws(b + 1, _e);
+        if (b == _e) return -1;
+    }
+    if (*b != '"') return -1;
+
+    S q = (S)memchr(b + 1, '"', _e - b - 1);
+    if (q == 0) return -1;
+    p = b + 1;
+    n = (uint32_t)(q - b - 1);
+    b = skip_ws(q + 1, _e);
+    if (b == _e || *b != ':') return -1;
+    _b = b + 1;
+    _first = false;
+    return 1;
+}
+
+int Reader::next() {
+    if (_null) {
+        _null = _first = false;
+        return 0;
+    }
+
+    S b = skip_ws(_b, _e);
+    if (b == _e) return -1;
+    if (*b == ']') {
+        _b = b + 1;
+        _first = false;
+        return 0;
+    }
+    if (!_first) {
+        if (*b != ',') return -1;
+        ++b;
+    }
+    _b = b;
+    _first = false;
+    return 1;
+}
+
+bool Reader::skip() {
+    S b = skip_ws(_b, _e);
+    if (b == _e) return false;
+    if (*b == '"') {
+        b = skip_string(b, _e);
+        if (b == 0) return false;
+        _b = b + 1;
+        return true;
+    }
+    if (*b != '{' && *b != '[') {
+        int64_t i;
+        double d;
+        if (read_scalar(b, _e, i, d) < 0) return false;
+        _b = b;
+        return true;
+    }
+
+    int depth = 0;
+    for (S p = b; p < _e; ++p) {
+        switch (*p) {
+            case '"':
+                p = skip_string(p, _e);
+                if (p == 0) return false;
+                break;
+            case '{':
+            case '[':
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    _b = p + 1;
+                    return true;
+                }
+                break;
+        }
+    }
+    return false;
+}
+
 }  // namespace json
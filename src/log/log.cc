@@ -3,8 +3,10 @@
 #include <atomic>
 
 #include "../co/hook.h"
+#include "../co/huge_page.h"
 #include "co/co.h"
 #include "co/fs.h"
+#include "co/intern.h"
 #include "co/os.h"
 #include "co/str.h"
 #include "co/time.h"
@@ -12,6 +14,8 @@
 #ifdef _WIN32
 #include "StackWalker.hpp"
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <unistd.h>
 #ifdef HAS_BACKTRACE_H
@@ -21,10 +25,22 @@
 #endif
 #include <time.h>
 
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable : 4722)
 #endif
 
+DEC_bool(co_huge_pages);
+
 static fastring* g_log_dir;
 static fastring* g_log_file_name;
 static void _at_mod_init() {
@@ -39,9 +55,20 @@ DEF_uint32(log_max_size, 4096, ">>#0 max size of a single log");
 DEF_uint64(log_max_file_size, 256 << 20, ">>#0 max size of log file, default: 256MB");
 DEF_uint32(log_max_file_num, 8, ">>#0 max number of log files");
 DEF_uint32(log_max_buffer_size, 32 << 20, ">>#0 max size of log buffer, default: 32MB");
-DEF_uint32(log_flush_ms, 128, ">>#0 flush the log buffer every n ms");
+DEF_uint32(log_flush_ms, 128,
+           ">>#0 max time in ms that logs wait in the buffer, flushed sooner if logs come fast");
 DEF_bool(log_console, false, ">>#0 also logging to terminal");
 DEF_bool(log_daily, false, ">>#0 if true, enable daily log rotation");
+DEF_bool(log_async_write, false,
+         ">>#0 if true, write log files in a separate thread, so that slow disk I/O does not "
+         "block the logger thread");
+DEF_bool(log_compress, false,
+         ">>#0 if true, compress rotated log files to xx.log.gz in background, zlib required");
+DEF_uint32(log_ring_size, 0,
+           ">>#0 if > 0, write level logs to a ring buffer of this size in the mapped file "
+           "log_dir/xx.ring instead of the log file");
+DEF_uint32(log_file_prealloc, 0,
+           ">>#0 preallocate disk space for log files n bytes at a time, 0 to disable");
 
 // When this value is true, the above flags should have been initialized,
 // and we are safe to start the logging thread.
@@ -104,19 +131,9 @@ inline void signal_safe_sleep(int ms) {
 // time for logs: "0723 17:00:00.123"
 class LogTime {
   public:
-    enum {
-        t_len = 17,  // length of time
-        t_min = 8,   // position of minute
-        t_sec = t_min + 3,
-        t_ms = t_sec + 3,
-    };
+    enum { t_len = 17 };
 
-    LogTime() : _start(0) {
-        for (int i = 0; i < 60; ++i) {
-            const auto p = (uint8_t*)&_tb[i];
-            p[0] = (uint8_t)('0' + i / 10);
-            p[1] = (uint8_t)('0' + i % 10);
-        }
+    LogTime() : _start(0), _ms(0) {
         memset(_buf, 0, sizeof(_buf));
         this->update();
     }
@@ -125,75 +142,57 @@ class LogTime {
     const char* get() const { return _buf; }
     uint32_t day() const { return *(uint32_t*)_buf; }
     int64_t sec() const { return _start; }
+    int64_t ms() const { return _ms; }
 
   private:
     time_t _start;
-    struct tm _tm;
-    int16_t _tb[64];
+    int64_t _ms;
     char _buf[24];  // save the time string
 };
 
+// the coarse clock is enough here, logs are stamped with the time strings
+// updated by the logger thread in batches anyway
 void LogTime::update() {
-    const int64_t now_ms = epoch::ms();
-    const time_t now_sec = now_ms / 1000;
-    const int dt = (int)(now_sec - _start);
-    if (dt == 0) goto set_ms;
-    if (unlikely(dt < 0 || dt >= 60 || _start == 0)) goto reset;
-
-    _tm.tm_sec += dt;
-    if (_tm.tm_min < 59 || _tm.tm_sec < 60) {
-        _start = now_sec;
-        if (_tm.tm_sec >= 60) {
-            _tm.tm_min++;
-            _tm.tm_sec -= 60;
-            *(uint16_t*)(_buf + t_min) = _tb[_tm.tm_min];
-        }
-        const auto p = (char*)(_tb + _tm.tm_sec);
-        _buf[t_sec] = p[0];
-        _buf[t_sec + 1] = p[1];
-        goto set_ms;
-    }
-
-reset : {
-    _start = now_sec;
-#ifdef _WIN32
-    _localtime64_s(&_tm, &_start);
-#else
-    localtime_r(&_start, &_tm);
-#endif
-    strftime(_buf, 16, "%m%d %H:%M:%S.", &_tm);
-}
-
-set_ms : {
-    const auto p = _buf + t_ms;
-    uint32_t ms = (uint32_t)(now_ms - _start * 1000);
-    uint32_t x = ms / 100;
-    p[0] = (char)('0' + x);
-    ms -= x * 100;
-    x = ms / 10;
-    p[1] = (char)('0' + x);
-    p[2] = (char)('0' + (ms - x * 10));
-}
+    _ms = epoch::ms_coarse();
+    _start = (time_t)(_ms / 1000);
+    memcpy(_buf, co::timestr::logtime(_ms), t_len);
 }
 
 // the local file that logs will be written to
 class LogFile {
   public:
-    LogFile() : _file(256), _path(256), _path_base(256), _day(0), _checked(false) {}
+    LogFile()
+        : _file(256),
+          _path(256),
+          _path_base(256),
+          _size(0),
+          _sec(0),
+          _alloc(0),
+          _day(0),
+          _checked(false) {}
 
     fs::file& open(const char* topic, int level);
     void write(const char* p, size_t n);
     void write(const char* topic, const char* p, size_t n);
     void close() { _file.close(); }
 
+    // data written at the beginning of the file each time it is opened
+    void set_head(const char* p, size_t n) { _head.assign(p, n); }
+
   private:
     bool check_config(const char* topic, int level);
+    void check_size(size_t n);
+    void preallocate(size_t n);
 
   private:
     fs::file _file;
     fastring _path;
     fastring _path_base;             // prefix of the log path: log_dir/log_file_name
     co::deque<fastring> _old_paths;  // paths of old log files
+    fastring _head;
+    int64_t _size;                   // size of the file, -1 if it does not exist
+    int64_t _sec;                    // time of the last stat() of the file
+    int64_t _alloc;                  // bytes of disk space preallocated
     uint32_t _day;
     bool _checked;
 };
@@ -250,12 +249,129 @@ inline uint32_t get_day_from_path(const fastring& path) {
     return x;
 }
 
-// compress log file with the xz command
-// inline void compress_file(const fastring& path) {
-//     fastring cmd(path.size() + 8);
-//     cmd.append("xz ").append(path);
-//     os::system(cmd);
-// }
+#ifdef HAS_ZLIB
+// Rotated log files are compressed to xx.log.gz one by one in a background
+// thread, with the lowest cpu and I/O priority, so that it neither slows down
+// the logger thread nor competes with it for the disk.
+class Compressor {
+  public:
+    Compressor() : _ev(false, false) {
+        std::thread(&Compressor::loop, this).detach();
+    }
+
+    void add(const fastring& path) {
+        {
+            std::lock_guard<std::mutex> g(_mtx);
+            _paths.push_back(path);
+        }
+        _ev.signal();
+    }
+
+  private:
+    void loop();
+    bool compress(const fastring& path, const fastring& gz);
+
+    std::mutex _mtx;
+    co::deque<fastring> _paths;
+    co::sync_event _ev;
+};
+
+inline void set_background_priority() {
+#if defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    const int tid = (int)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, (id_t)tid, 19);
+    syscall(SYS_ioprio_set, 1, tid, 3 << 13);  // IOPRIO_CLASS_IDLE of the thread
+#elif defined(__APPLE__)
+    setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
+
+void Compressor::loop() {
+    set_background_priority();
+    fastring path, gz;
+    for (;;) {
+        _ev.wait();
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> g(_mtx);
+                if (_paths.empty()) break;
+                path = std::move(_paths.front());
+                _paths.pop_front();
+            }
+            gz.clear();
+            gz.append(path).append(".gz");
+            if (this->compress(path, gz)) {
+                // the log file may have been removed as an old one meanwhile
+                if (fs::exists(path)) {
+                    fs::remove(path);
+                } else {
+                    fs::remove(gz);
+                }
+            }
+        }
+    }
+}
+
+// compress @path to a temporary file, and rename it to @gz when done
+bool Compressor::compress(const fastring& path, const fastring& gz) {
+    fs::file in(path, 'r');
+    if (!in) return false;
+
+    fastring tmp(gz.size() + 4);
+    tmp.append(gz).append(".tmp");
+    fs::file out(tmp, 'w');
+    if (!out) return false;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        return false;
+    }
+
+    const size_t N = 64 * 1024;
+    char* const ibuf = (char*)::malloc(N * 2);
+    char* const obuf = ibuf + N;
+    int r = Z_OK;
+    bool ok = true;
+    while (ok && r != Z_STREAM_END) {
+        const size_t n = in.read(ibuf, N);
+        const int flush = n < N ? Z_FINISH : Z_NO_FLUSH;
+        z.next_in = (Bytef*)ibuf;
+        z.avail_in = (uInt)n;
+        do {
+            z.next_out = (Bytef*)obuf;
+            z.avail_out = (uInt)N;
+            r = deflate(&z, flush);
+            const size_t m = N - z.avail_out;
+            if (r == Z_STREAM_ERROR || out.write(obuf, m) != m) {
+                ok = false;
+                break;
+            }
+        } while (z.avail_out == 0);
+        if (flush == Z_FINISH && r != Z_STREAM_END) ok = false;
+    }
+    deflateEnd(&z);
+    ::free(ibuf);
+    out.close();
+
+    if (!ok || !fs::mv(tmp, gz)) {
+        fs::remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+// compress the log file in background
+inline void compress_file(const fastring& path) {
+    static Compressor* c = new Compressor();
+    c->add(path);
+}
+#else
+inline void compress_file(const fastring&) {}
+#endif
 
 fs::file& LogFile::open(const char* topic, int level) {
     if (!_checked) {
@@ -289,6 +405,7 @@ fs::file& LogFile::open(const char* topic, int level) {
                 if (fs::fsize(_path) >= FLG_log_max_file_size ||
                     (FLG_log_daily && get_day_from_path(path) != _day)) {
                     fs::mv(_path, path);  // rename xx.log to xx_0808_15_30_08.123.log
+                    if (FLG_log_compress) compress_file(path);
                     new_file = true;
                 }
             } else {
@@ -308,7 +425,9 @@ fs::file& LogFile::open(const char* topic, int level) {
             _old_paths.push_back(s);
 
             while (!_old_paths.empty() && _old_paths.size() > FLG_log_max_file_num) {
-                fs::remove(_old_paths.front());
+                auto& x = _old_paths.front();
+                fs::remove(x);
+                if (FLG_log_compress) fs::remove(x + ".gz");
                 _old_paths.pop_front();
             }
 
@@ -331,10 +450,41 @@ fs::file& LogFile::open(const char* topic, int level) {
         s.clear();
         s << "cann't open the file: " << _path << '\n';
         log2stderr(s.data(), s.size());
+    } else {
+        if (!_head.empty() && level != xx::fatal) _file.write(_head.data(), _head.size());
+        _size = _file.size();
+        _sec = m.log_time->sec();
+        _alloc = 0;
     }
     return _file;
 }
 
+// The size of the file is counted in memory after @n bytes were written, and
+// updated by stat() every few seconds, in case the file was truncated, moved or
+// removed by others. The file is closed and reopened later if it is too large,
+// or does not exist any more.
+void LogFile::check_size(size_t n) {
+    _size += n;
+    const int64_t sec = mod().log_time->sec();
+    if (sec >= _sec + 3) {
+        _sec = sec;
+        _size = _file.size();  // -1 if not exists
+    }
+    if ((uint64_t)_size >= (uint64_t)FLG_log_max_file_size) _file.close();
+}
+
+// Disk space is allocated in large chunks ahead of the writes, no more than the
+// max size of the file, so that the file system need not find new blocks for
+// each write. It is not done again for the file if not supported.
+void LogFile::preallocate(size_t n) {
+    const int64_t size = _size + (int64_t)n;
+    if (FLG_log_file_prealloc == 0 || size <= _alloc) return;
+    int64_t x = size + FLG_log_file_prealloc;
+    if ((uint64_t)x > FLG_log_max_file_size) x = (int64_t)FLG_log_max_file_size;
+    if (x < size) x = size;
+    _alloc = _file.preallocate(x) ? x : INT64_MAX;
+}
+
 void LogFile::write(const char* p, size_t n) {
     auto& m = mod();
     if (FLG_log_daily) {
@@ -346,9 +496,9 @@ void LogFile::write(const char* p, size_t n) {
     }
 
     if (_file || this->open(nullptr, 0)) {
+        this->preallocate(n);
         _file.write(p, n);
-        const uint64_t size = _file.size();  // -1 if not exists
-        if (size >= (uint64_t)FLG_log_max_file_size) _file.close();
+        this->check_size(n);
     }
 }
 
@@ -362,12 +512,236 @@ void LogFile::write(const char* topic, const char* p, size_t n) {
         }
     }
     if (_file || this->open(topic, 0)) {
+        this->preallocate(n);
         _file.write(p, n);
-        const uint64_t size = _file.size();  // -1 if not exists
-        if (size >= (uint64_t)FLG_log_max_file_size) _file.close();
+        this->check_size(n);
+    }
+}
+
+// A ring buffer in a file mapped into memory. Level logs are copied into it by
+// the threads calling LOG, without any system call, and they are kept by the
+// system if the process crashes. It is continued if the file exists.
+//
+// The file is a head of 64 bytes followed by the ring:
+//   head:   "co_ring" | u64 cap | u64 pos (bytes reserved since the file was created)
+//   record: u32 len | u32 tag | data, aligned to 8 bytes, not across the end
+// The tag, (uint32_t)(pos >> 3) of the record, is set after the data, a record
+// is valid only if its tag matches its position. A len with the highest bit set
+// marks padding to the end of the ring.
+class LogRing {
+  public:
+    static const size_t H = 64;  // size of the head
+
+    struct Head {
+        char magic[8];
+        uint64_t cap;
+        std::atomic<uint64_t> pos;
+    };
+
+    LogRing() : _h(0), _p(0), _cap(0) {}
+
+    bool open(const char* path, uint64_t cap);
+    void push(const char* s, size_t n);
+
+    // push logs in @p, a line a time
+    void push_lines(const char* p, size_t n) {
+        const char* const e = p + n;
+        while (p < e) {
+            const char* q = (const char*)memchr(p, '\n', e - p);
+            q = q ? q + 1 : e;
+            this->push(p, q - p);
+            p = q;
+        }
+    }
+
+  private:
+    Head* _h;
+    char* _p;
+    uint64_t _cap;
+};
+
+bool LogRing::open(const char* path, uint64_t cap) {
+    // power of 2, 1M at least, 2G at most
+    uint64_t x = 1u << 20;
+    while (x < cap && x < (1u << 31)) x <<= 1;
+    cap = x;
+    const uint64_t size = H + cap;
+
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER x;
+    const bool reset = !GetFileSizeEx(f, &x) || (uint64_t)x.QuadPart != size;
+    HANDLE m = CreateFileMappingA(f, 0, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, 0);
+    void* p = m ? MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size) : 0;
+    if (m) CloseHandle(m);
+    CloseHandle(f);
+    if (!p) return false;
+#else
+    const int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    const bool reset = fs::fsize(path) != (int64_t)size;
+    void* p = 0;
+    if (!reset || ::ftruncate(fd, (off_t)size) == 0) {
+        p = ::mmap(0, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) p = 0;
+    }
+    ::close(fd);
+    if (!p) return false;
+#endif
+
+    _h = (Head*)p;
+    _p = (char*)p + H;
+    _cap = cap;
+    if (reset || memcmp(_h->magic, "co_ring", 8) != 0 || _h->cap != cap) {
+        memset(p, 0, H);
+        memcpy(_h->magic, "co_ring", 8);
+        _h->cap = cap;
+        _h->pos.store(0);
     }
+    return true;
 }
 
+void LogRing::push(const char* s, size_t n) {
+    const uint64_t need = god::align_up<8>((uint64_t)n + 8);
+    uint64_t p = _h->pos.load(std::memory_order_relaxed), off;
+    for (;;) {
+        off = p & (_cap - 1);
+        const uint64_t x = off + need <= _cap ? p + need : p - off + _cap + need;
+        if (_h->pos.compare_exchange_weak(p, x, std::memory_order_relaxed)) break;
+    }
+
+    char* r = _p + off;
+    if (off + need > _cap) {
+        *(uint32_t*)r = 0x80000000u;
+        ((std::atomic<uint32_t>*)(r + 4))->store((uint32_t)(p >> 3), std::memory_order_release);
+        p += _cap - off;
+        r = _p;
+    }
+    memcpy(r + 8, s, n);
+    *(uint32_t*)r = (uint32_t)n;
+    ((std::atomic<uint32_t>*)(r + 4))->store((uint32_t)(p >> 3), std::memory_order_release);
+}
+
+// set time of a log at @p by the current thread, when the time strings kept by
+// the logger thread are out of date
+inline void set_log_time(char* p) {
+    static thread_local LogTime t;
+    t.update();
+    memcpy(p, t.get(), LogTime::t_len);
+}
+
+// A block of level logs of a thread, see ThreadLog.
+struct Block {
+    std::atomic<uint32_t> size;  // bytes written
+    std::atomic<Block*> next;
+    uint32_t cap;
+    char* data() { return (char*)(this + 1); }
+};
+
+inline Block* new_block(uint32_t cap) {
+    auto b = (Block*)::malloc(sizeof(Block) + cap);
+    b->size.store(0, std::memory_order_relaxed);
+    b->next.store(0, std::memory_order_relaxed);
+    b->cap = cap;
+    return b;
+}
+
+// Level logs of a thread, in a list of blocks. The thread appends logs to the
+// last block, and the logger thread takes them from the first one, no lock is
+// needed. The size of a block does not change after the next one was linked.
+struct ThreadLog {
+    ThreadLog(uint32_t cap, bool binary)
+        : tail(new_block(cap)), cap(cap), binary(binary), dropped(false), wbytes(0), head(tail),
+          pos(0), rbytes(0), dead(false), next(0) {}
+
+    // written by the thread
+    Block* tail;
+    uint32_t cap;  // size of a block
+    bool binary;   // binary logs, see BLOG
+    bool dropped;  // logs were dropped as the buffer was full
+    std::atomic<size_t> wbytes;
+
+    // written by the logger thread
+    alignas(64) Block* head;
+    uint32_t pos;  // read position in head
+    std::atomic<size_t> rbytes;
+
+    std::atomic_bool dead;  // the thread has exited
+    ThreadLog* next;        // in the list of the logger
+};
+
+// Logs of the current thread. They are plain pointers rather than thread_local
+// objects with destructors, so that destructors of other thread_local objects can
+// still log when the thread exits. The guard releases them then: ThreadLogs are
+// marked dead and freed by the logger thread after the logs in them were written.
+// Logs after that go to a SharedLog.
+static thread_local ThreadLog* t_log;                 // level logs
+static thread_local ThreadLog* t_blog;                // binary logs
+static thread_local co::vector<ThreadLog*>* t_tlogs;  // logs of topics, by Topic::id
+static thread_local fastream* t_stream;               // to make level and topic logs
+static thread_local fastream* t_bstream;              // to make binary logs
+static thread_local bool t_exiting;
+
+inline void release_thread_log(ThreadLog* t) {
+    if (t) t->dead.store(true, std::memory_order_release);
+}
+
+struct ThreadLogGuard {
+    ~ThreadLogGuard() {
+        t_exiting = true;
+        release_thread_log(t_log);
+        release_thread_log(t_blog);
+        t_log = t_blog = 0;
+        if (t_tlogs) {
+            for (size_t i = 0; i < t_tlogs->size(); ++i) release_thread_log((*t_tlogs)[i]);
+            delete t_tlogs;
+            t_tlogs = 0;
+        }
+        delete t_stream;
+        delete t_bstream;
+        t_stream = t_bstream = 0;
+    }
+};
+
+// made before the logs of the current thread, so it is destroyed after thread_local
+// objects made later, which may log in their destructors
+inline void guard_thread_logs() {
+    static thread_local ThreadLogGuard g;
+    (void)g;
+}
+
+// A ThreadLog for threads that are exiting, whose own ThreadLogs were released.
+// It is shared by these threads, and logs are pushed to it under the lock.
+struct SharedLog {
+    SharedLog() : p(0) {}
+    std::mutex mtx;
+    ThreadLog* p;
+};
+
+// create a ThreadLog and put it at the front of the list @l
+inline ThreadLog* new_thread_log(std::atomic<ThreadLog*>& l, uint32_t cap, bool binary = false) {
+    auto t = new ThreadLog(cap, binary);
+    t->next = l.load(std::memory_order_relaxed);
+    while (!l.compare_exchange_weak(t->next, t, std::memory_order_release,
+                                    std::memory_order_relaxed));
+    return t;
+}
+
+// A topic registered by log::register_topic(). Each thread pushes logs of the
+// topic to its own ThreadLog, no lock or lookup of the topic is needed. Topics
+// are never freed, the handles are valid until the program exits.
+struct Topic {
+    Topic(const char* s, uint32_t i) : name(s), id(i), threads(0), next(0), buf() {}
+    const char* name;
+    uint32_t id;
+    std::atomic<ThreadLog*> threads;
+    SharedLog shared;  // for exiting threads
+    Topic* next;   // in the list of the logger
+    fastream buf;  // to collect logs of all threads
+};
+
 class Logger {
   public:
     static const uint32_t N = 128 * 1024;
@@ -381,8 +755,16 @@ class Logger {
 
     void push_level_log(char* s, size_t n);
     void push_topic_log(const char* topic, char* s, size_t n);
+    void push_topic_log(Topic* topic, char* s, size_t n);
+    Topic* register_topic(const char* topic);
+    void push_binary_log(char* s, size_t n);
+    uint32_t register_blog_site(int level, const char* file, unsigned line, const char* fmt,
+                                const char* types);
     void push_fatal_log(char* s, size_t n);
 
+    // the ring buffer for level logs, null if log_ring_size is 0
+    LogRing* ring() const { return _ring.load(std::memory_order_acquire); }
+
     void set_write_cb(const std::function<void(const void*, size_t)>& cb, int flags) {
         _llog.write_cb = cb;
         _llog.write_flags = flags;
@@ -395,14 +777,19 @@ class Logger {
 
   private:
     struct alignas(64) LevelLog {
-        LevelLog() : x(), buf(), sec(0), bytes(0), write_cb(), write_flags(0) {}
-        struct alignas(64) X {
-            std::mutex m;
-            fastream buf;       // logs will be pushed to this buffer
-            char time_str[24];  // "0723 17:00:00.123"
-        };
-        X x;
-        fastream buf;  // to swap out logs
+        LevelLog()
+            : threads(0), time_idx(0), idle(false), buf(), advised(0), sec(0), bytes(0),
+              write_cb(), write_flags(0) {}
+        std::atomic<ThreadLog*> threads;  // logs of all threads
+        SharedLog shared;                 // for exiting threads
+        // The logger thread updates the time string not in use and switches to it.
+        char time_str[2][24];  // "0723 17:00:00.123"
+        std::atomic_int time_idx;
+        // The logger thread sleeps long when there are no logs, the time strings
+        // are out of date then, threads that log wake it up.
+        std::atomic_bool idle;
+        fastream buf;  // to collect logs of all threads
+        const char* advised;  // buf advised with huge pages, see co_huge_pages
         int64_t sec;
         size_t bytes;
         std::function<void(const void*, size_t)> write_cb;
@@ -416,29 +803,98 @@ class Logger {
         size_t bytes;  // write bytes
     };
 
+    // topics are interned, and compared by pointer
     typedef const char* Key;
+    struct KeyHash {
+        size_t operator()(Key k) const noexcept { return (size_t)k >> 3; }
+    };
+    struct KeyEq {
+        bool operator()(Key x, Key y) const noexcept { return x == y; }
+    };
+
+    // Binary logs are written to log_dir/blog/. Call sites are written at the
+    // beginning of each file, and before the logs when new sites are registered.
+    struct alignas(64) BinaryLog {
+        BinaryLog() : threads(0), ms(0), nsites(0), written(0), wsize(0) {}
+        std::atomic<ThreadLog*> threads;  // logs of all threads
+        SharedLog shared;                 // for exiting threads
+        std::atomic<int64_t> ms;          // time of the logs
+        std::mutex mtx;
+        fastream sites;                   // records of all call sites
+        std::atomic<uint32_t> nsites;     // number of call sites
+        uint32_t written;                 // number of call sites written
+        size_t wsize;                     // bytes of call sites written
+        fastream buf;                     // to collect logs of all threads
+        LogFile file;
+    };
+
+    // Log files are written in the writer thread if log_async_write is true.
+    // The logger thread copies logs to a job and goes on collecting logs, it
+    // waits only when too many bytes are not written yet.
+    struct alignas(64) AsyncWriter {
+        AsyncWriter() : bytes(0), tid(0), state(0) {}
+        struct Job {
+            LogFile* f;
+            const char* topic;
+            size_t head;  // size of the file head at the beginning of buf, or -1
+            fastream buf;
+        };
+        std::mutex mtx;
+        co::deque<Job> jobs;
+        co::vector<fastream> bufs;  // buffers of jobs done, to be reused
+        size_t bytes;               // bytes of jobs not done
+        co::sync_event ev;          // signaled when new jobs were added
+        co::sync_event done;        // signaled when jobs were done
+        uint32_t tid;               // id of the writer thread
+        std::atomic_int state;      // 0: not started, 1: running, 2: stopping, 3: stopped
+    };
 
     struct alignas(64) TopicLog {
-        TopicLog() : write_flags(0) {}
+        TopicLog() : topics(0), write_flags(0) {}
         struct alignas(64) X {
             std::mutex m;
-            co::hash_map<Key, fastream> buf;
+            co::hash_map<Key, fastream, KeyHash, KeyEq> buf;
             char time_str[24];
         };
         X x[A];
-        co::hash_map<Key, fastream> buf[A];
-        co::hash_map<Key, PerTopic> pts;
+        co::hash_map<Key, fastream, KeyHash, KeyEq> buf[A];
+        co::hash_map<Key, PerTopic, KeyHash, KeyEq> pts;
+        std::mutex reg_mtx;
+        co::hash_map<Key, Topic*, KeyHash, KeyEq> reg;  // registered topics
+        std::atomic<Topic*> topics;     // registered topics, new ones at the front
         std::function<void(const char*, const void*, size_t)> write_cb;
         int write_flags;
     };
 
+    ThreadLog* thread_log();
+    ThreadLog* thread_log(Topic* topic);
+    ThreadLog* binary_thread_log();
+    void push_log(ThreadLog* t, const char* s, size_t n);
+    void push_shared_log(SharedLog& x, std::atomic<ThreadLog*>& l, uint32_t cap, bool binary,
+                         const char* s, size_t n);
+    void append_log(ThreadLog* t, const char* s, size_t n);
+    void collect_logs(std::atomic<ThreadLog*>& l, fastream& buf, bool signal_safe);
+    void set_level_time();
     void write_level_logs(const char* p, size_t n);
+    size_t write_registered_topic_logs(bool signal_safe);
+    void clear_topic_buf(fastream& s, PerTopic& pt);
+    size_t write_binary_logs(bool signal_safe);
+    bool idle() const { return _llog.idle.load(std::memory_order_acquire); }
+    void wake_up() { _log_event.signal(); }
     void write_topic_logs(LogFile& f, const char* topic, const char* p, size_t n);
+    void write_file(LogFile& f, const char* topic, const char* p, size_t n, const char* h = 0,
+                    size_t hn = 0);
+    void stop_writer(bool signal_safe);
+    void open_ring();
     void thread_fun();
+    void writer_fun();
 
   private:
     LevelLog _llog;
     TopicLog _tlog;
+    BinaryLog _blog;
+    AsyncWriter _writer;
+    std::atomic<LogRing*> _ring;
     co::sync_event _log_event;
     LogTime& _time;
     LogFile& _file;
@@ -446,8 +902,8 @@ class Logger {
 };
 
 Logger::Logger(LogTime& t, LogFile& f)
-    : _llog(), _tlog(), _log_event(true, false), _time(t), _file(f), _stop(-2) {
-    memcpy(_llog.x.time_str, _time.get(), 24);
+    : _llog(), _tlog(), _blog(), _writer(), _ring(0), _log_event(true, false), _time(t), _file(f), _stop(-2) {
+    memcpy(_llog.time_str[0], _time.get(), 24);
     _llog.sec = _time.sec();
     for (int i = 0; i < A; ++i) {
         memcpy(_tlog.x[i].time_str, _time.get(), 24);
@@ -470,9 +926,10 @@ bool Logger::start() {
 
         do {
             _time.update();
-            memcpy(_llog.x.time_str, _time.get(), 24);
+            memcpy(_llog.time_str[0], _time.get(), 24);
+            _llog.time_idx.store(0);
+            _blog.ms.store(_time.ms());
             _llog.sec = _time.sec();
-            _llog.x.buf.reserve(N);
             _llog.buf.reserve(N);
             for (int i = 0; i < A; ++i) {
                 memcpy(_tlog.x[i].time_str, _time.get(), 24);
@@ -480,6 +937,10 @@ bool Logger::start() {
         } while (0);
 
         _stop.store(0);
+        if (FLG_log_async_write) {
+            _writer.state.store(1);
+            std::thread(&Logger::writer_fun, this).detach();
+        }
         ::printf("logger start, before thread\n");
         std::thread(&Logger::thread_fun, this).detach();
         ::printf("logger start, after thread\n");
@@ -491,6 +952,32 @@ bool Logger::start() {
     return true;
 }
 
+// open the ring buffer log_dir/xx.ring for level logs
+void Logger::open_ring() {
+    auto& d = *g_log_dir;
+    auto& f = *g_log_file_name;
+    fastring path(d.size() + 64);
+    if (!d.empty()) {
+        if (!fs::exists(d)) fs::mkdir((char*)d.c_str(), true);
+        path.append(d);
+        if (path.back() != '/' && path.back() != '\\') path.append('/');
+    }
+    fastring name(f.empty() ? *mod().exename : f);
+    name.remove_suffix(".log");
+    name.remove_suffix(".exe");
+    path.append(name).append(".ring");
+
+    auto r = new LogRing();
+    if (r->open(path.c_str(), FLG_log_ring_size)) {
+        _ring.store(r, std::memory_order_release);
+    } else {
+        delete r;
+        fastring x(path.size() + 32);
+        x << "cann't open the ring buffer: " << path << '\n';
+        log2stderr(x.data(), x.size());
+    }
+}
+
 // if signal_safe is true, try to call only async-signal-safe api in this function
 // according to:  http://man7.org/linux/man-pages/man7/signal-safety.7.html
 void Logger::stop(bool signal_safe) {
@@ -507,17 +994,15 @@ void Logger::stop(bool signal_safe) {
 #else
         while (_stop.load(std::memory_order_relaxed) != 2) signal_safe_sleep(1);
 #endif
+        this->stop_writer(signal_safe);
 
         do {
-            // it may be not safe if logs are still being pushed to the buffer
-            auto& x = _llog.x;
-            !signal_safe ? x.m.lock() : signal_safe_sleep(1);
-            if (!x.buf.empty()) {
-                x.buf.swap(_llog.buf);
+            // logs pushed by other threads from now on may be lost
+            this->collect_logs(_llog.threads, _llog.buf, signal_safe);
+            if (!_llog.buf.empty()) {
                 this->write_level_logs(_llog.buf.data(), _llog.buf.size());
                 _llog.buf.clear();
             }
-            if (!signal_safe) x.m.unlock();
         } while (0);
 
         for (int i = 0; i < A; ++i) {
@@ -536,6 +1021,8 @@ void Logger::stop(bool signal_safe) {
                 d.clear();
             }
         }
+        this->write_registered_topic_logs(signal_safe);
+        this->write_binary_logs(signal_safe);
 
         // co::atomic_swap(&_stop, 3);
         _stop.exchange(3);
@@ -566,26 +1053,163 @@ void Logger::push_level_log(char* s, size_t n) {
         p[2] = '.';
         p[3] = '\n';
     }
-    {
-        std::lock_guard<std::mutex> g(_llog.x.m);
-        if (!_stop) {
-            memcpy(s + 1, _llog.x.time_str, LogTime::t_len);  // log time
+    if (_stop.load(std::memory_order_relaxed)) return;
 
-            auto& buf = _llog.x.buf;
-            if (unlikely(buf.size() + n >= FLG_log_max_buffer_size)) {
-                const char* p = strchr(buf.data() + (buf.size() >> 1) + 7, '\n');
-                const size_t len = buf.data() + buf.size() - p - 1;
-                memcpy((char*)(buf.data()), "......\n", 7);
-                memcpy((char*)(buf.data()) + 7, p + 1, len);
-                buf.resize(len + 7);
-            }
+    if (unlikely(this->idle())) {
+        set_log_time(s + 1);
+        this->wake_up();
+    } else {
+        const int i = _llog.time_idx.load(std::memory_order_acquire);
+        memcpy(s + 1, _llog.time_str[i], LogTime::t_len);  // log time
+    }
+    // copy the log to the ring directly, if it needn't go through the logger thread
+    LogRing* const r = this->ring();
+    if (r && !_llog.write_cb && !FLG_log_console) {
+        r->push(s, n);
+        return;
+    }
+    ThreadLog* const t = this->thread_log();
+    if (t) {
+        this->push_log(t, s, n);
+    } else {
+        this->push_shared_log(_llog.shared, _llog.threads, N, false, s, n);
+    }
+}
 
-            buf.append(s, n);
-            if (buf.size() > (buf.capacity() >> 1)) _log_event.signal();
+// a binary log with id 0, written when logs were dropped
+static const blog_head_t g_blog_dropped = {0, blog_head_size, 0, 0};
+
+// push a log to @t of the current thread, drop it if the logger thread can't
+// keep up, "......" is written instead
+inline void Logger::push_log(ThreadLog* t, const char* s, size_t n) {
+    const char* const d = t->binary ? (const char*)&g_blog_dropped : "......\n";
+    const uint32_t dn = t->binary ? blog_head_size : 7;
+    const size_t w = t->wbytes.load(std::memory_order_relaxed);
+    const size_t pending = w - t->rbytes.load(std::memory_order_acquire);
+    if (unlikely(pending + n + dn >= FLG_log_max_buffer_size)) {
+        if (!t->dropped) t->dropped = true, _log_event.signal();
+        return;
+    }
+
+    size_t m = n;
+    if (unlikely(t->dropped)) {
+        t->dropped = false;
+        this->append_log(t, d, dn);
+        m += dn;
+    }
+    this->append_log(t, s, n);
+    t->wbytes.store(w + m, std::memory_order_release);
+    if (pending < (N >> 1) && pending + m >= (N >> 1)) _log_event.signal();
+}
+
+// push a log of an exiting thread to the ThreadLog shared in @x, it is created and
+// put to the list @l on first use
+void Logger::push_shared_log(SharedLog& x, std::atomic<ThreadLog*>& l, uint32_t cap,
+                             bool binary, const char* s, size_t n) {
+    std::lock_guard<std::mutex> g(x.mtx);
+    if (!x.p) x.p = new_thread_log(l, cap, binary);
+    this->push_log(x.p, s, n);
+}
+
+// ThreadLog of the current thread, it is created and put to the list on first use.
+// Null if the thread is exiting and its ThreadLog was released.
+inline ThreadLog* Logger::thread_log() {
+    ThreadLog* const t = t_log;
+    if (t || t_exiting) return t;
+    guard_thread_logs();
+    return t_log = new_thread_log(_llog.threads, N);
+}
+
+// ThreadLog of the current thread for a registered topic, or null as thread_log()
+inline ThreadLog* Logger::thread_log(Topic* topic) {
+    co::vector<ThreadLog*>* v = t_tlogs;
+    if (unlikely(!v)) {
+        if (t_exiting) return 0;
+        guard_thread_logs();
+        v = t_tlogs = new co::vector<ThreadLog*>();
+    }
+    if (unlikely(v->size() <= topic->id)) v->resize(topic->id + 1);
+    ThreadLog*& t = (*v)[topic->id];
+    if (unlikely(!t)) t = new_thread_log(topic->threads, N >> 1);
+    return t;
+}
+
+// ThreadLog of the current thread for binary logs, or null as thread_log()
+inline ThreadLog* Logger::binary_thread_log() {
+    ThreadLog* const t = t_blog;
+    if (t || t_exiting) return t;
+    guard_thread_logs();
+    return t_blog = new_thread_log(_blog.threads, N >> 1, true);
+}
+
+// called by the owner thread of @t only
+inline void Logger::append_log(ThreadLog* t, const char* s, size_t n) {
+    Block* b = t->tail;
+    const uint32_t size = b->size.load(std::memory_order_relaxed);
+    if (size + n <= b->cap) {
+        memcpy(b->data() + size, s, n);
+        b->size.store(size + (uint32_t)n, std::memory_order_release);
+        return;
+    }
+
+    Block* x = new_block(n > t->cap ? (uint32_t)n : t->cap);
+    memcpy(x->data(), s, n);
+    x->size.store((uint32_t)n, std::memory_order_relaxed);
+    b->next.store(x, std::memory_order_release);
+    t->tail = x;
+}
+
+// Take logs of all threads in the list @l to @buf, logs of a thread are in order.
+// Called by the logger thread only, or by stop() after the logger thread stopped.
+// Blocks and ThreadLogs of exited threads are not freed if @signal_safe is true.
+void Logger::collect_logs(std::atomic<ThreadLog*>& l, fastream& buf, bool signal_safe) {
+    ThreadLog* prev = 0;
+    ThreadLog* t = l.load(std::memory_order_acquire);
+    while (t) {
+        const bool dead = t->dead.load(std::memory_order_acquire);
+        size_t r = 0;
+        for (;;) {
+            Block* b = t->head;
+            Block* next = b->next.load(std::memory_order_acquire);
+            const uint32_t size = b->size.load(std::memory_order_acquire);
+            if (size > t->pos) {
+                buf.append(b->data() + t->pos, size - t->pos);
+                r += size - t->pos;
+                t->pos = size;
+            }
+            if (!next) break;
+            if (!signal_safe) ::free(b);
+            t->head = next;
+            t->pos = 0;
+        }
+        if (r > 0) t->rbytes.store(t->rbytes.load(std::memory_order_relaxed) + r,
+                                   std::memory_order_release);
+
+        ThreadLog* const next = t->next;
+        if (dead && !signal_safe) {
+            // new threads are put at the front of the list, a ThreadLog at the
+            // front is removed by CAS
+            ThreadLog* x = t;
+            if (prev ? (prev->next = next, true) : l.compare_exchange_strong(x, next)) {
+                ::free(t->head);
+                delete t;
+                t = next;
+                continue;
+            }
         }
+        prev = t;
+        t = next;
     }
 }
 
+// update the time string of level logs
+inline void Logger::set_level_time() {
+    const int i = !_llog.time_idx.load(std::memory_order_relaxed);
+    memcpy(_llog.time_str[i], _time.get(), LogTime::t_len);
+    _llog.time_idx.store(i, std::memory_order_release);
+    _blog.ms.store(_time.ms(), std::memory_order_relaxed);
+}
+
 void Logger::push_topic_log(const char* topic, char* s, size_t n) {
     // if (unlikely(!g_thread_started)) {
     //     std::call_once(g_flag, [this]() {
@@ -605,13 +1229,19 @@ void Logger::push_topic_log(const char* topic, char* s, size_t n) {
         p[3] = '\n';
     }
 
-    auto& x = _tlog.x[murmur_hash(topic, strlen(topic)) & (A - 1)];
+    const co::interned k = co::intern(topic);
+    auto& x = _tlog.x[k.h & (A - 1)];
     {
         std::lock_guard<std::mutex> g(x.m);
         if (!_stop) {
-            memcpy(s, x.time_str, LogTime::t_len);
+            if (unlikely(this->idle())) {
+                set_log_time(s);
+                this->wake_up();
+            } else {
+                memcpy(s, x.time_str, LogTime::t_len);
+            }
 
-            auto& buf = x.buf[topic];
+            auto& buf = x.buf[k.s];
             if (unlikely(buf.size() + n >= FLG_log_max_buffer_size)) {
                 const char* p = strchr(buf.data() + (buf.size() >> 1) + 7, '\n');
                 const size_t len = buf.data() + buf.size() - p - 1;
@@ -638,9 +1268,201 @@ void Logger::push_fatal_log(char* s, size_t n) {
     abort();
 }
 
+void Logger::push_topic_log(Topic* topic, char* s, size_t n) {
+    if (unlikely(!g_thread_started.test_and_set())) {
+        this->start();
+    }
+    if (unlikely(n > FLG_log_max_size)) {
+        n = FLG_log_max_size;
+        char* const p = s + n - 4;
+        p[0] = '.';
+        p[1] = '.';
+        p[2] = '.';
+        p[3] = '\n';
+    }
+    if (_stop.load(std::memory_order_relaxed)) return;
+
+    if (unlikely(this->idle())) {
+        set_log_time(s);
+        this->wake_up();
+    } else {
+        const int i = _llog.time_idx.load(std::memory_order_acquire);
+        memcpy(s, _llog.time_str[i], LogTime::t_len);
+    }
+    ThreadLog* const t = this->thread_log(topic);
+    if (t) {
+        this->push_log(t, s, n);
+    } else {
+        this->push_shared_log(topic->shared, topic->threads, N >> 1, false, s, n);
+    }
+}
+
+Topic* Logger::register_topic(const char* topic) {
+    topic = co::intern(topic).s;
+    std::lock_guard<std::mutex> g(_tlog.reg_mtx);
+    auto& t = _tlog.reg[topic];
+    if (!t) {
+        t = new Topic(topic, (uint32_t)(_tlog.reg.size() - 1));
+        t->next = _tlog.topics.load(std::memory_order_relaxed);
+        _tlog.topics.store(t, std::memory_order_release);
+    }
+    return t;
+}
+
+// @s is a record of a binary log, its size was set by blog_push()
+void Logger::push_binary_log(char* s, size_t n) {
+    if (unlikely(!g_thread_started.test_and_set())) {
+        this->start();
+    }
+    if (_stop.load(std::memory_order_relaxed)) return;
+
+    int64_t ms;
+    if (unlikely(this->idle())) {
+        ms = epoch::ms();
+        this->wake_up();
+    } else {
+        ms = _blog.ms.load(std::memory_order_relaxed);
+    }
+    const uint32_t tid = (uint32_t)co::thread_id();
+    memcpy(s + 8, &ms, 8);
+    memcpy(s + 16, &tid, 4);
+    ThreadLog* const t = this->binary_thread_log();
+    if (t) {
+        this->push_log(t, s, n);
+    } else {
+        this->push_shared_log(_blog.shared, _blog.threads, N >> 1, true, s, n);
+    }
+}
+
+// A call site is written as a record with the highest bit of the id set, and
+// the level, line, file, types and format as the data.
+uint32_t Logger::register_blog_site(int level, const char* file, unsigned line, const char* fmt,
+                                    const char* types) {
+    std::lock_guard<std::mutex> g(_blog.mtx);
+    const uint32_t id = _blog.nsites.load(std::memory_order_relaxed) + 1;
+    const size_t pos = _blog.sites.size();
+    _blog.sites.append(id | 0x80000000u).append((uint32_t)0).append((char)level);
+    _blog.sites.append((uint32_t)line);
+    _blog.sites.append(file).append('\0').append(types).append('\0').append(fmt).append('\0');
+    const uint32_t n = (uint32_t)(_blog.sites.size() - pos);
+    memcpy((char*)_blog.sites.data() + pos + 4, &n, 4);
+    _blog.nsites.store(id, std::memory_order_release);
+    return id;
+}
+
+// write binary logs, called by the logger thread, or by stop()
+size_t Logger::write_binary_logs(bool signal_safe) {
+    auto& b = _blog;
+    this->collect_logs(b.threads, b.buf, signal_safe);
+    const size_t bytes = b.buf.size();
+
+    // call sites of the logs collected have been registered
+    const uint32_t n = b.nsites.load(std::memory_order_acquire);
+    if (n > b.written && (!signal_safe || b.mtx.try_lock())) {
+        if (!signal_safe) b.mtx.lock();
+        const size_t pos = b.wsize;
+        this->write_file(b.file, "blog", b.sites.data() + pos, b.sites.size() - pos,
+                         b.sites.data(), b.sites.size());
+        b.wsize = b.sites.size();
+        b.written = b.nsites.load(std::memory_order_relaxed);
+        b.mtx.unlock();
+    }
+    if (!b.buf.empty()) {
+        this->write_file(b.file, "blog", b.buf.data(), b.buf.size());
+        b.buf.clear();
+    }
+    return bytes;
+}
+
+// Write @n bytes of @p to the file @f, or pass them to the writer thread if it
+// is running. If @h is not null, it is set as the head of the file first.
+void Logger::write_file(LogFile& f, const char* topic, const char* p, size_t n, const char* h,
+                        size_t hn) {
+    auto& w = _writer;
+    if (w.state.load(std::memory_order_acquire) != 1) {
+        if (h) f.set_head(h, hn);
+        f.write(topic, p, n);
+        return;
+    }
+
+    const size_t x = n + (h ? hn : 0);
+    fastream s;
+    {
+        std::unique_lock<std::mutex> g(w.mtx);
+        while (w.bytes > 0 && w.bytes + x > FLG_log_max_buffer_size) {
+            g.unlock();
+            w.done.wait(8);
+            g.lock();
+        }
+        w.bytes += x;
+        if (!w.bufs.empty()) s = w.bufs.pop_back();
+    }
+
+    s.reserve(x);
+    if (h) s.append(h, hn);
+    s.append(p, n);
+    {
+        std::lock_guard<std::mutex> g(w.mtx);
+        w.jobs.push_back(AsyncWriter::Job{&f, topic, h ? hn : (size_t)-1, std::move(s)});
+    }
+    w.ev.signal();
+}
+
+// Stop the writer thread after the logger thread stopped, jobs not done will
+// be done before it exits.
+void Logger::stop_writer(bool signal_safe) {
+    auto& w = _writer;
+    int state = 1;
+    if (!w.state.compare_exchange_strong(state, 2)) return;
+    if (!signal_safe) w.ev.signal();
+    if (w.tid == (uint32_t)co::thread_id()) return;  // called in the writer thread
+    while (w.state.load(std::memory_order_acquire) != 3) signal_safe_sleep(1);
+}
+
+void Logger::writer_fun() {
+    auto& w = _writer;
+    w.tid = (uint32_t)co::thread_id();
+    co::deque<AsyncWriter::Job> jobs;
+    for (;;) {
+        const bool stop = w.state.load(std::memory_order_acquire) != 1;
+        if (!stop) w.ev.wait(FLG_log_flush_ms);
+        {
+            std::lock_guard<std::mutex> g(w.mtx);
+            jobs.swap(w.jobs);
+        }
+        if (jobs.empty() && !stop) continue;
+
+        size_t n = 0;
+        for (auto& j : jobs) {
+            size_t h = 0;
+            if (j.head != (size_t)-1) j.f->set_head(j.buf.data(), h = j.head);
+            j.f->write(j.topic, j.buf.data() + h, j.buf.size() - h);
+            n += j.buf.size();
+        }
+        {
+            std::lock_guard<std::mutex> g(w.mtx);
+            w.bytes -= n;
+            for (auto& j : jobs) {
+                if (w.bufs.size() >= A) break;
+                j.buf.clear();
+                w.bufs.push_back(std::move(j.buf));
+            }
+        }
+        jobs.clear();
+        w.done.signal();
+        if (stop) break;
+    }
+    w.state.store(3, std::memory_order_release);
+}
+
 void Logger::write_level_logs(const char* p, size_t n) {
     if (!_llog.write_cb || (_llog.write_flags & log::log2local)) {
-        _file.write(p, n);
+        LogRing* const r = this->ring();
+        if (r) {
+            r->push_lines(p, n);
+        } else {
+            this->write_file(_file, nullptr, p, n);
+        }
     }
     if (_llog.write_cb) _llog.write_cb(p, n);
     if (FLG_log_console) fwrite(p, 1, n, stderr);
@@ -648,12 +1470,51 @@ void Logger::write_level_logs(const char* p, size_t n) {
 
 void Logger::write_topic_logs(LogFile& f, const char* topic, const char* p, size_t n) {
     if (!_tlog.write_cb || (_tlog.write_flags & log::log2local)) {
-        f.write(topic, p, n);
+        this->write_file(f, topic, p, n);
     }
     if (_tlog.write_cb) _tlog.write_cb(topic, p, n);
     if (FLG_log_console) fwrite(p, 1, n, stderr);
 }
 
+// write logs of registered topics, called by the logger thread, or by stop()
+size_t Logger::write_registered_topic_logs(bool signal_safe) {
+    size_t bytes = 0;
+    for (Topic* t = _tlog.topics.load(std::memory_order_acquire); t; t = t->next) {
+        this->collect_logs(t->threads, t->buf, signal_safe);
+        bytes += t->buf.size();
+        auto& pt = _tlog.pts[t->name];
+        if (!t->buf.empty()) {
+            this->write_topic_logs(pt.file, t->name, t->buf.data(), t->buf.size());
+        }
+        if (signal_safe) {
+            t->buf.clear();
+        } else {
+            this->clear_topic_buf(t->buf, pt);
+        }
+    }
+    return bytes;
+}
+
+// clear the buffer of a topic after the logs were written, and shrink it if it
+// is much larger than needed in the last minute
+void Logger::clear_topic_buf(fastream& s, PerTopic& pt) {
+    if (pt.bytes < s.size()) pt.bytes = s.size();
+
+    s.clear();
+    s.reserve(N >> 1);
+    const int64_t sec = _time.sec();
+    if (pt.sec == 0) pt.sec = sec;
+    if (pt.sec + 60 <= sec) {
+        pt.sec = sec;
+        const auto cap = s.capacity();
+        if (cap > N && pt.bytes < (cap >> 1)) {
+            s.reset();
+            s.reserve(god::align_up<N>(pt.bytes));
+        }
+        pt.bytes = 0;
+    }
+}
+
 void Logger::thread_fun() {
     ::printf("run in logger thread, %d\n", g_dummy);
     bool signaled;
@@ -662,18 +1523,33 @@ void Logger::thread_fun() {
         ::printf("wait\n");
         _log_event.wait(8);
     }
+    bool ring_checked = false;
+    bool idle = false;
+    int empty = 0;  // rounds without logs in a row
+    uint32_t ms = FLG_log_flush_ms;
+    int64_t last = _time.ms();
     while (!_stop) {
-        signaled = _log_event.wait(FLG_log_flush_ms);
+        signaled = _log_event.wait(ms);
         if (_stop) break;
+        size_t bytes = 0;  // bytes of logs in this round
+
+        // opened here like log files, flags should have been parsed by now, logs
+        // pushed before are written to the ring in order
+        if (!ring_checked) {
+            ring_checked = true;
+            if (FLG_log_ring_size > 0) this->open_ring();
+        }
 
         // level logs
         do {
             _time.update();
-            {
-                auto& x = _llog.x;
-                std::lock_guard<std::mutex> g(x.m);
-                memcpy(x.time_str, _time.get(), LogTime::t_len);
-                if (!x.buf.empty()) x.buf.swap(_llog.buf);
+            this->set_level_time();
+            this->collect_logs(_llog.threads, _llog.buf, false);
+            bytes += _llog.buf.size();
+            if (FLG_co_huge_pages && _llog.buf.capacity() >= co::xx::huge_page_size &&
+                _llog.buf.data() != _llog.advised) {
+                _llog.advised = _llog.buf.data();
+                co::xx::advise_huge(_llog.buf.data(), _llog.buf.capacity());
             }
 
             if (!_llog.buf.empty()) {
@@ -711,26 +1587,37 @@ void Logger::thread_fun() {
             for (auto it = buf.begin(); it != buf.end(); ++it) {
                 auto& pt = _tlog.pts[it->first];
                 auto& s = it->second;
+                bytes += s.size();
                 if (!s.empty()) {
                     this->write_topic_logs(pt.file, it->first, s.data(), s.size());
                 }
-                if (pt.bytes < s.size()) pt.bytes = s.size();
-
-                s.clear();
-                s.reserve(N >> 1);
-                sec = _time.sec();
-                if (pt.sec == 0) pt.sec = sec;
-                if (pt.sec + 60 <= sec) {
-                    pt.sec = sec;
-                    const auto cap = s.capacity();
-                    if (cap > N && pt.bytes < (cap >> 1)) {
-                        s.reset();
-                        s.reserve(god::align_up<N>(pt.bytes));
-                    }
-                    pt.bytes = 0;
-                }
+                this->clear_topic_buf(s, pt);
             }
         }
+        bytes += this->write_registered_topic_logs(false);
+        bytes += this->write_binary_logs(false);
+
+        // All time strings are up to date now. Flush sooner if logs come fast,
+        // so that less logs are dropped when the buffers are full. Go idle after
+        // two rounds without logs, and take a quick round then for logs pushed
+        // at the same time.
+        const int64_t t = _time.ms();
+        if (bytes > 0 || (idle && signaled)) {
+            empty = 0;
+            if (idle) idle = false, _llog.idle.store(false, std::memory_order_release);
+            const uint64_t rate = bytes / (uint64_t)(t > last ? t - last : 1);  // bytes per ms
+            const uint64_t x = rate > 0 ? (FLG_log_max_buffer_size >> 3) / rate : FLG_log_flush_ms;
+            ms = x < FLG_log_flush_ms ? (x > 0 ? (uint32_t)x : 1) : FLG_log_flush_ms;
+        } else if (idle) {
+            ms = FLG_log_flush_ms > 1000 ? FLG_log_flush_ms : 1000;
+        } else if (++empty >= 2) {
+            idle = true;
+            _llog.idle.store(true);
+            ms = 1;
+        } else {
+            ms = FLG_log_flush_ms;
+        }
+        last = t;
 
         if (signaled) _log_event.reset();
     }
@@ -874,7 +1761,12 @@ class ExceptHandler {
     int handle_exception(void* e);  // for windows only
 
     static void write_fatal_message(const char* p, size_t n) {
-        mod().log_file->write(p, n);
+        LogRing* const r = mod().logger->ring();
+        if (r) {
+            r->push(p, n);
+        } else {
+            mod().log_file->write(p, n);
+        }
         mod().log_fatal->write(p, n);
     }
 
@@ -1100,42 +1992,87 @@ Mod::~Mod() {
     delete exename;
 }
 
-inline fastream& log_stream() {
-    static thread_local fastream _s(256);
-    return _s;
+// the stream of the current thread, an exiting thread makes one for each log,
+// and frees it with free_exiting_stream()
+inline fastream& make_stream(fastream*& s) {
+    if (s) return *s;
+    if (!t_exiting) guard_thread_logs();
+    return *(s = new fastream(256));
+}
+
+inline void free_exiting_stream(fastream*& s, size_t n) {
+    if (unlikely(t_exiting) && n == 0) {
+        delete s;
+        s = 0;
+    }
+}
+
+inline fastream& log_stream() { return make_stream(t_stream); }
+
+// " 12345 ", id of the current thread in logs, made once in each thread
+struct ThreadIdStr {
+    ThreadIdStr() {
+        s[0] = ' ';
+        n = fast::u32toa((uint32_t)co::thread_id(), s + 1) + 1;
+        s[n++] = ' ';
+    }
+    char s[16];
+    uint32_t n;
+};
+
+inline const ThreadIdStr& thread_id_str() {
+    static thread_local ThreadIdStr _t;
+    return _t;
 }
 
 LevelLogSaver::LevelLogSaver(const char* fname, unsigned fnlen, unsigned line, int level)
     : _s(log_stream()) {
+    const auto& t = thread_id_str();
     _n = _s.size();
     _s.resize(_n + (LogTime::t_len + 1));  // make room for: "I0523 17:00:00.123"
     _s[_n] = "TDIWE"[level];
-    (_s << ' ' << co::thread_id() << ' ').append(fname, fnlen) << ':' << line << "] ";
+    _s.append(t.s, t.n).append(fname, fnlen) << ':' << line << "] ";
 }
 
 LevelLogSaver::LevelLogSaver(const char* fname, unsigned line, int level) : _s(log_stream()) {
+    const auto& t = thread_id_str();
     _n = _s.size();
     _s.resize(_n + (LogTime::t_len + 1));  // make room for: "I0523 17:00:00.123"
     _s[_n] = "TDIWE"[level];
-    _s << ' ' << co::thread_id() << ' ' << fname << ':' << line << "] ";
+    _s.append(t.s, t.n) << fname << ':' << line << "] ";
+}
+
+// the time, thread id and "file:line] " are copied with a single resize
+LevelLogSaver::LevelLogSaver(int level, const char* s, size_t n) : _s(log_stream()) {
+    const auto& t = thread_id_str();
+    const size_t x = LogTime::t_len + 1;  // "I0523 17:00:00.123"
+    _n = _s.size();
+    _s.resize(_n + x + t.n + n);
+    char* p = (char*)_s.data() + _n;
+    p[0] = "TDIWE"[level];
+    memcpy(p + x, t.s, t.n);
+    memcpy(p + x + t.n, s, n);
 }
 
 LevelLogSaver::~LevelLogSaver() {
     _s << '\n';
     mod().logger->push_level_log((char*)_s.data() + _n, _s.size() - _n);
     _s.resize(_n);
+    free_exiting_stream(t_stream, _n);
 }
 
 FatalLogSaver::FatalLogSaver(const char* fname, unsigned fnlen, unsigned line) : _s(log_stream()) {
+    const auto& t = thread_id_str();
     _s.resize(LogTime::t_len + 1);
     _s.front() = 'F';
-    (_s << ' ' << co::thread_id() << ' ').append(fname, fnlen) << ':' << line << "] ";
+    _s.append(t.s, t.n).append(fname, fnlen) << ':' << line << "] ";
 }
 
 FatalLogSaver::FatalLogSaver(const char* fname, unsigned line) : _s(log_stream()) {
+    const auto& t = thread_id_str();
     _s.resize(LogTime::t_len + 1);
     _s.front() = 'F';
-    _s << ' ' << co::thread_id() << ' ' << fname << ':' << line << "] ";
+    _s.append(t.s, t.n) << fname << ':' << line << "] ";
 }
 
 FatalLogSaver::~FatalLogSaver() {
@@ -1144,29 +2081,239 @@ FatalLogSaver::~FatalLogSaver() {
 }
 
 TLogSaver::TLogSaver(const char* fname, unsigned fnlen, unsigned line, const char* topic)
-    : _s(log_stream()), _topic(topic) {
+    : _s(log_stream()), _topic(topic), _t(0) {
+    const auto& t = thread_id_str();
     _n = _s.size();
     _s.resize(_n + (LogTime::t_len));  // make room for: "0523 17:00:00.123"
-    (_s << ' ' << co::thread_id() << ' ').append(fname, fnlen) << ':' << line << "] ";
+    _s.append(t.s, t.n).append(fname, fnlen) << ':' << line << "] ";
 }
 
 TLogSaver::TLogSaver(const char* fname, unsigned line, const char* topic)
-    : _s(log_stream()), _topic(topic) {
+    : _s(log_stream()), _topic(topic), _t(0) {
+    const auto& t = thread_id_str();
     _n = _s.size();
     _s.resize(_n + (LogTime::t_len));  // make room for: "0523 17:00:00.123"
-    _s << ' ' << co::thread_id() << ' ' << fname << ':' << line << "] ";
+    _s.append(t.s, t.n) << fname << ':' << line << "] ";
+}
+
+TLogSaver::TLogSaver(const char* fname, unsigned fnlen, unsigned line, Topic* topic)
+    : TLogSaver(fname, fnlen, line, topic->name) {
+    _t = topic;
+}
+
+TLogSaver::TLogSaver(const char* fname, unsigned line, Topic* topic)
+    : TLogSaver(fname, line, topic->name) {
+    _t = topic;
 }
 
 TLogSaver::~TLogSaver() {
     _s << '\n';
-    mod().logger->push_topic_log(_topic, (char*)_s.data() + _n, _s.size() - _n);
+    if (_t) {
+        mod().logger->push_topic_log(_t, (char*)_s.data() + _n, _s.size() - _n);
+    } else {
+        mod().logger->push_topic_log(_topic, (char*)_s.data() + _n, _s.size() - _n);
+    }
     _s.resize(_n);
+    free_exiting_stream(t_stream, _n);
+}
+
+uint32_t blog_site(int level, const char* file, unsigned line, const char* fmt,
+                   const char* types) {
+    return mod().logger->register_blog_site(level, file, line, fmt, types);
+}
+
+fastream& blog_stream() { return make_stream(t_bstream); }
+
+void blog_push(fastream& s) {
+    const uint32_t n = (uint32_t)s.size();
+    memcpy((char*)s.data() + 4, &n, 4);
+    mod().logger->push_binary_log((char*)s.data(), s.size());
+    free_exiting_stream(t_bstream, 0);
 }
 
 }  // namespace xx
 
 void exit() { xx::mod().logger->stop(); }
 
+namespace xx {
+
+// a call site of binary logs
+struct blog_site_t {
+    char level;
+    uint32_t line;
+    const char* file;
+    const char* types;
+    const char* fmt;
+};
+
+// find a string ends with '\0' in [@p, @e), return the position after it, or
+// NULL if not found
+inline const char* blog_str_end(const char* p, const char* e) {
+    const char* x = (const char*)memchr(p, '\0', e - p);
+    return x ? x + 1 : nullptr;
+}
+
+// append the value of type @c at @p to @s, return the position after it, or
+// NULL if the data is truncated
+inline const char* blog_value(char c, const char* p, const char* e, fastream& s) {
+    if (c == 'b' || c == 'c') {
+        if (p >= e) return nullptr;
+        c == 'b' ? (void)(s << (*p ? "true" : "false")) : (void)s.append(*p);
+        return p + 1;
+    }
+    if (c == 's') {
+        uint32_t n;
+        if (e - p < 4) return nullptr;
+        memcpy(&n, p, 4);
+        if ((size_t)(e - p - 4) < n) return nullptr;
+        s.append(p + 4, n);
+        return p + 4 + n;
+    }
+
+    if (e - p < 8) return nullptr;
+    uint64_t x;
+    memcpy(&x, p, 8);
+    switch (c) {
+    case 'i':
+        s << (int64_t)x;
+        break;
+    case 'u':
+        s << x;
+        break;
+    case 'd': {
+        double d;
+        memcpy(&d, p, 8);
+        s << d;
+        break;
+    }
+    default:
+        s << (void*)(uintptr_t)x;
+    }
+    return p + 8;
+}
+
+// "0723 17:00:00.123"
+inline void blog_time(int64_t ms, fastream& s) {
+    s.append(co::timestr::logtime(ms), LogTime::t_len);
+}
+
+}  // namespace xx
+
+bool decode_binary(const void* p, size_t n, fastream& s) {
+    co::hash_map<uint32_t, xx::blog_site_t> sites;
+    const char* b = (const char*)p;
+    const char* const e = b + n;
+    while (b < e) {
+        uint32_t id, m;
+        if (e - b < 8) return false;
+        memcpy(&id, b, 4);
+        memcpy(&m, b + 4, 4);
+        if (m < 8 || (size_t)(e - b) < m) return false;
+        const char* x = b + 8;
+        const char* const end = b + m;
+        b = end;
+
+        if (id & 0x80000000u) {
+            xx::blog_site_t site;
+            if (end - x < 5) return false;
+            site.level = *x;
+            memcpy(&site.line, x + 1, 4);
+            site.file = x + 5;
+            if (!(x = xx::blog_str_end(site.file, end))) return false;
+            site.types = x;
+            if (!(x = xx::blog_str_end(site.types, end))) return false;
+            site.fmt = x;
+            if (!xx::blog_str_end(site.fmt, end)) return false;
+            sites[id & 0x7fffffffu] = site;
+            continue;
+        }
+
+        if (m < xx::blog_head_size) return false;
+        if (id == 0) {
+            s << "......\n";
+            continue;
+        }
+
+        int64_t ms;
+        uint32_t tid;
+        memcpy(&ms, x, 8);
+        memcpy(&tid, x + 8, 4);
+        x += xx::blog_head_size - 8;
+
+        auto it = sites.find(id);
+        if (it == sites.end()) {
+            s << "?";
+            xx::blog_time(ms, s);
+            s << ' ' << tid << " unknown call site " << id << '\n';
+            continue;
+        }
+
+        const auto& site = it->second;
+        s.append("TDIWE"[site.level < 5 ? site.level : 4]);
+        xx::blog_time(ms, s);
+        s << ' ' << tid << ' ' << site.file << ':' << site.line << "] ";
+
+        // replace "{}" with the values, the remaining values are appended
+        const char* t = site.types;
+        for (const char* f = site.fmt; *f; ++f) {
+            if (f[0] == '{' && f[1] == '}' && *t) {
+                if (!(x = xx::blog_value(*t++, x, end, s))) return false;
+                ++f;
+            } else {
+                s.append(*f);
+            }
+        }
+        for (; *t; ++t) {
+            s.append(' ');
+            if (!(x = xx::blog_value(*t, x, end, s))) return false;
+        }
+        s.append('\n');
+    }
+    return true;
+}
+
+namespace xx {
+
+// append records of the ring in [@beg, @end) to @s, @base is the position of the
+// ring in the lap. A record whose tag does not match is skipped 8 bytes a time.
+static void read_ring(const char* p, uint64_t base, uint64_t beg, uint64_t end, fastream& s) {
+    uint64_t o = beg;
+    while (o + 8 <= end) {
+        uint32_t len, tag;
+        memcpy(&len, p + o, 4);
+        memcpy(&tag, p + o + 4, 4);
+        if (tag != (uint32_t)((base + o) >> 3)) {
+            o += 8;
+            continue;
+        }
+        if (len & 0x80000000u) break;  // padding to the end
+        if (o + 8 + len > end) break;
+        s.append(p + o + 8, len);
+        o += god::align_up<8>((uint64_t)len + 8);
+    }
+}
+
+}  // namespace xx
+
+bool decode_ring(const void* p, size_t n, fastream& s) {
+    const size_t H = xx::LogRing::H;
+    const char* const b = (const char*)p;
+    if (n < H || memcmp(b, "co_ring", 8) != 0) return false;
+    uint64_t cap, pos;
+    memcpy(&cap, b + 8, 8);
+    memcpy(&pos, b + 16, 8);
+    if (cap == 0 || (cap & (cap - 1)) || n < H + cap) return false;
+
+    // the last lap [w, cap) first, then the current one [0, w)
+    const uint64_t lap = pos & ~(cap - 1);
+    const uint64_t w = pos & (cap - 1);
+    if (lap > 0) xx::read_ring(b + H, lap - cap, w, cap, s);
+    xx::read_ring(b + H, lap, 0, w, s);
+    return true;
+}
+
+xx::Topic* register_topic(const char* topic) { return xx::mod().logger->register_topic(topic); }
+
 void set_write_cb(const std::function<void(const void*, size_t)>& cb, int flags) {
     xx::mod().logger->set_write_cb(cb, flags);
 }
@@ -1175,6 +2322,11 @@ void set_write_cb(const std::function<void(const char*, const void*, size_t)>& c
     xx::mod().logger->set_write_cb(cb, flags);
 }
 
+void dump_stack() {
+    xx::StackTrace st;
+    st.dump_stack(0, 1);
+}
+
 }}  // namespace _xx::log
 
 #ifdef _WIN32
@@ -0,0 +1,409 @@
+#include "co/mem.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace co {
+
+#ifdef CO_SYS_MALLOC
+void* alloc(size_t n) { return ::malloc(n); }
+void free(void* p) { ::free(p); }
+void* realloc(void* p, size_t n) { return ::realloc(p, n); }
+
+#else
+namespace xx {
+
+static const uint32_t slab_bits = 16;
+static const size_t slab_size = (size_t)1 << slab_bits;  // 64K
+static const size_t slab_head = 128;                     // size of the slab header
+static const size_t max_small = 2048;                    // max size of a small block
+static const uint32_t num_classes = 24;
+
+// 16, 32, ..., 128, then 4 classes for each power of 2: 160, 192, 224, 256, ... 2048
+inline uint32_t size_class(size_t n) {
+    if (n <= 128) return n == 0 ? 0 : (uint32_t)((n - 1) >> 4);
+    const uint64_t u = n - 1;
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanReverse64(&r, u);
+    const uint32_t e = (uint32_t)r;
+#else
+    const uint32_t e = 63 - (uint32_t)__builtin_clzll(u);
+#endif
+    return 8 + (e - 7) * 4 + (uint32_t)((u >> (e - 2)) & 3);
+}
+
+inline uint32_t class_size(uint32_t c) {
+    if (c < 8) return (c + 1) << 4;
+    const uint32_t e = (c - 8) / 4 + 7;
+    return (5 + (c - 8) % 4) << (e - 2);
+}
+
+struct node_t {
+    node_t* next;
+};
+
+struct tcache_t;
+
+// A slab of blocks of the same size class, the header is at the beginning of
+// the 64K aligned memory. It belongs to a thread cache for its lifetime.
+struct slab_t {
+    tcache_t* owner;
+    slab_t* prev;
+    slab_t* next;
+    node_t* free;     // blocks freed by the owner
+    char* top;        // the next block never allocated
+    char* end;        // the last position a block fits in
+    uint32_t cls;
+    uint32_t size;
+    uint32_t used;    // blocks in use, including those in the remote list
+    bool full;        // the slab is in the full list
+
+    // Blocks freed by other threads. The lowest bit is set when the slab is in
+    // the full list, the thread that frees a block to such a slab notifies the
+    // owner, without touching the slab after the push.
+    alignas(64) std::atomic<uintptr_t> remote;
+};
+
+static_assert(sizeof(slab_t) <= slab_head, "");
+
+inline slab_t* slab_of(const void* p) {
+    return (slab_t*)((uintptr_t)p & ~(uintptr_t)(slab_size - 1));
+}
+
+// Bitmap of live slabs, a pointer not in any slab is from ::malloc. It is a
+// two-level table of 64K leaves, each covers 4G of the address space, 2^48 bytes
+// in all. Slabs are never placed above that, see new_slab().
+static std::atomic<std::atomic_uint64_t*> g_slabs[1 << 16];
+static const int addr_bits = 48;
+
+// @i is the address >> slab_bits, null if it is above the bitmap
+inline std::atomic_uint64_t* slab_bits_of(uintptr_t i, bool make) {
+    if (((uint64_t)i >> (addr_bits - slab_bits)) != 0) return 0;
+    auto& x = g_slabs[i >> 16];
+    std::atomic_uint64_t* m = x.load(std::memory_order_acquire);
+    if (m || !make) return m;
+    auto const p = (std::atomic_uint64_t*)::calloc(1024, sizeof(uint64_t));
+    if (x.compare_exchange_strong(m, p, std::memory_order_acq_rel)) return p;
+    ::free(p);
+    return m;
+}
+
+inline bool is_slab(const void* p) {
+    const uintptr_t i = (uintptr_t)p >> slab_bits;
+    std::atomic_uint64_t* const m = slab_bits_of(i, false);
+    return m && ((m[(i & 0xffff) >> 6].load(std::memory_order_relaxed) >> (i & 63)) & 1);
+}
+
+inline void mark_slab(slab_t* s, bool on) {
+    const uintptr_t i = (uintptr_t)s >> slab_bits;
+    std::atomic_uint64_t* const m = slab_bits_of(i, true);
+    const uint64_t b = (uint64_t)1 << (i & 63);
+    if (on) {
+        m[(i & 0xffff) >> 6].fetch_or(b, std::memory_order_release);
+    } else {
+        m[(i & 0xffff) >> 6].fetch_and(~b, std::memory_order_release);
+    }
+}
+
+inline void* alloc_aligned(size_t n) {
+#ifdef _WIN32
+    return _aligned_malloc(n, n);
+#else
+    void* p = 0;
+    return posix_memalign(&p, n, n) == 0 ? p : 0;
+#endif
+}
+
+inline void free_aligned(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    ::free(p);
+#endif
+}
+
+// Slabs of a thread. Caches are never destroyed, a cache of an exited thread is
+// kept in a pool with its slabs, and is reused by the next new thread.
+struct tcache_t {
+    slab_t* avail[num_classes];  // the head is the slab blocks are allocated from
+    slab_t* full[num_classes];   // slabs with no free block
+    std::atomic_uint32_t pending;  // bit c is set if a full slab of class c got remote frees
+    tcache_t* next;                // next cache in the pool
+
+    void* alloc(uint32_t c) {
+        slab_t* const s = avail[c];
+        if (s) {
+            node_t* const x = s->free;
+            if (x) {
+                s->free = x->next;
+                ++s->used;
+                return x;
+            }
+            if (s->top <= s->end) {
+                void* const p = s->top;
+                s->top += s->size;
+                ++s->used;
+                return p;
+            }
+        }
+        return this->alloc_slow(c);
+    }
+
+    void free(slab_t* s, void* p) {
+        node_t* const x = (node_t*)p;
+        x->next = s->free;
+        s->free = x;
+        --s->used;
+        const uint32_t c = s->cls;
+        if (s->full) {
+            s->full = false;
+            unlink(full[c], s);
+            drain(s);
+            push_after_head(avail[c], s);
+        } else if (s->used == 0 && s != avail[c]) {
+            unlink(avail[c], s);
+            release(s);
+        }
+    }
+
+    void* alloc_slow(uint32_t c);
+
+    // move full slabs that got blocks from other threads back to the avail list
+    void reclaim(uint32_t c);
+
+    // release empty slabs, done when the thread exits
+    void trim();
+
+    slab_t* new_slab(uint32_t c);
+
+    static void release(slab_t* s) {
+        mark_slab(s, false);
+        free_aligned(s);
+    }
+
+    // move blocks of the remote list to the local free list, the full flag is cleared
+    static void drain(slab_t* s) {
+        node_t* x = (node_t*)(s->remote.exchange(0, std::memory_order_acquire) & ~(uintptr_t)1);
+        while (x) {
+            node_t* const n = x->next;
+            x->next = s->free;
+            s->free = x;
+            --s->used;
+            x = n;
+        }
+    }
+
+    static void push(slab_t*& h, slab_t* s) {
+        s->prev = 0;
+        s->next = h;
+        if (h) h->prev = s;
+        h = s;
+    }
+
+    static void push_after_head(slab_t*& h, slab_t* s) {
+        if (!h) return push(h, s);
+        s->prev = h;
+        s->next = h->next;
+        if (h->next) h->next->prev = s;
+        h->next = s;
+    }
+
+    static void unlink(slab_t*& h, slab_t* s) {
+        if (s->prev) s->prev->next = s->next;
+        if (s->next) s->next->prev = s->prev;
+        if (h == s) h = s->next;
+        s->prev = s->next = 0;
+    }
+};
+
+slab_t* tcache_t::new_slab(uint32_t c) {
+    slab_t* const s = (slab_t*)alloc_aligned(slab_size);
+    if (!s) return 0;
+    if (((uint64_t)(uintptr_t)s >> addr_bits) != 0) { /* not covered by the bitmap */
+        free_aligned(s);
+        return 0;
+    }
+    s->owner = this;
+    s->prev = s->next = 0;
+    s->free = 0;
+    s->cls = c;
+    s->size = class_size(c);
+    s->used = 0;
+    s->top = (char*)s + slab_head;
+    s->end = (char*)s + slab_size - s->size;
+    s->full = false;
+    new (&s->remote) std::atomic<uintptr_t>(0);
+    mark_slab(s, true);
+    return s;
+}
+
+void* tcache_t::alloc_slow(uint32_t c) {
+    // full slabs that got blocks back from other threads
+    const uint32_t b = 1u << c;
+    if (pending.load(std::memory_order_relaxed) & b) {
+        pending.fetch_and(~b);
+        this->reclaim(c);
+    }
+
+    // move slabs used up to the full list, the full flag is set only if no
+    // block has been freed by other threads.
+    while (slab_t* const s = avail[c]) {
+        if (s->remote.load(std::memory_order_relaxed)) drain(s);
+        if (s->free || s->top <= s->end) return this->alloc(c);
+        unlink(avail[c], s);
+        uintptr_t e = 0;
+        if (s->remote.compare_exchange_strong(e, 1, std::memory_order_acq_rel)) {
+            s->full = true;
+            push(full[c], s);
+        } else {
+            drain(s);
+            push(avail[c], s);
+        }
+    }
+
+    slab_t* const s = this->new_slab(c);
+    if (!s) return 0;
+    push(avail[c], s);
+    return this->alloc(c);
+}
+
+void tcache_t::reclaim(uint32_t c) {
+    for (slab_t* s = full[c]; s;) {
+        slab_t* const next = s->next;
+        if (s->remote.load(std::memory_order_relaxed) > 1) {
+            unlink(full[c], s);
+            s->full = false;
+            drain(s);
+            push(avail[c], s);
+        }
+        s = next;
+    }
+}
+
+void tcache_t::trim() {
+    for (uint32_t c = 0; c < num_classes; ++c) {
+        this->reclaim(c);
+        for (slab_t* s = avail[c]; s;) {
+            slab_t* const next = s->next;
+            drain(s);
+            if (s->used == 0) {
+                unlink(avail[c], s);
+                release(s);
+            }
+            s = next;
+        }
+    }
+}
+
+// pool of caches of exited threads
+static std::atomic_flag g_pool_lock = ATOMIC_FLAG_INIT;
+static tcache_t* g_pool;
+
+inline void lock_pool() {
+    while (g_pool_lock.test_and_set(std::memory_order_acquire));
+}
+
+inline void unlock_pool() { g_pool_lock.clear(std::memory_order_release); }
+
+static tcache_t* pop_tcache() {
+    lock_pool();
+    tcache_t* t = g_pool;
+    if (t) g_pool = t->next;
+    unlock_pool();
+    if (!t) {
+        t = (tcache_t*)::calloc(1, sizeof(tcache_t));
+        new (&t->pending) std::atomic_uint32_t(0);
+    }
+    return t;
+}
+
+static void push_tcache(tcache_t* t) {
+    lock_pool();
+    t->next = g_pool;
+    g_pool = t;
+    unlock_pool();
+}
+
+static thread_local tcache_t* t_cache;
+static thread_local bool t_exited;
+
+struct tcache_guard {
+    tcache_guard() {}
+    ~tcache_guard() {
+        tcache_t* const t = t_cache;
+        t_cache = 0;
+        t_exited = true;
+        t->trim();
+        push_tcache(t);
+    }
+};
+
+inline tcache_t* tcache() {
+    tcache_t* const t = t_cache;
+    if (t || t_exited) return t;
+    static thread_local tcache_guard g;
+    (void)g;
+    return t_cache = pop_tcache();
+}
+
+}  // namespace xx
+
+void* alloc(size_t n) {
+    if (n <= xx::max_small) {
+        const uint32_t c = xx::size_class(n);
+        xx::tcache_t* const t = xx::tcache();
+        if (t) return t->alloc(c);
+
+        // the thread is exiting, its cache is gone, borrow one from the pool
+        xx::tcache_t* const x = xx::pop_tcache();
+        void* const p = x->alloc(c);
+        xx::push_tcache(x);
+        return p;
+    }
+    return ::malloc(n);
+}
+
+void free(void* p) {
+    if (!p) return;
+    if (!xx::is_slab(p)) return ::free(p);
+
+    xx::slab_t* const s = xx::slab_of(p);
+    if (s->owner == xx::t_cache) return s->owner->free(s, p);
+
+    // the slab may be released by the owner once the block is pushed
+    xx::tcache_t* const t = s->owner;
+    const uint32_t b = 1u << s->cls;
+    xx::node_t* const x = (xx::node_t*)p;
+    uintptr_t h = s->remote.load(std::memory_order_relaxed);
+    do {
+        x->next = (xx::node_t*)(h & ~(uintptr_t)1);
+    } while (!s->remote.compare_exchange_weak(h, (uintptr_t)x | (h & 1), std::memory_order_release,
+                                              std::memory_order_relaxed));
+    if (h & 1) t->pending.fetch_or(b);
+}
+
+void* realloc(void* p, size_t n) {
+    if (!p) return co::alloc(n);
+    if (!xx::is_slab(p)) return ::realloc(p, n);
+
+    const size_t o = xx::slab_of(p)->size;
+    if (n <= o) return p;
+    void* const x = co::alloc(n);
+    if (x) {
+        memcpy(x, p, o);
+        co::free(p);
+    }
+    return x;
+}
+#endif
+
+}  // namespace co
@@ -0,0 +1,261 @@
+#include "co/metrics.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "co/co.h"
+#include "co/vector.h"
+
+namespace co {
+namespace xx {
+
+uint32_t next_metric_shard() {
+    static std::atomic_uint32_t n{0};
+    return n.fetch_add(1, std::memory_order_relaxed) % metric_shards;
+}
+
+// metrics and collectors registered, never destroyed, as metrics may be
+// static objects destroyed after it.
+struct metric_registry {
+    std::mutex mtx;
+    co::vector<metric*> metrics;
+    co::vector<std::function<void(fastream&)>> collectors;
+};
+
+inline metric_registry& registry() {
+    static metric_registry* r = new metric_registry;
+    return *r;
+}
+
+metric::metric(type_t type, const char* name, const char* help)
+    : _name(name), _help(help), _type(type) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> g(r.mtx);
+    r.metrics.push_back(this);
+}
+
+metric::~metric() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> g(r.mtx);
+    auto& v = r.metrics;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (v[i] == this) {
+            v.remove(i);
+            break;
+        }
+    }
+}
+
+fastring metric::base_name() const {
+    const size_t p = _name.find('{');
+    return p == _name.npos ? _name : fastring(_name.data(), p);
+}
+
+// write name{labels,k="v"} of a sample, @suffix is appended to the base name
+static void write_name(fastream& s, const fastring& name, const char* suffix, const char* k,
+                       const char* v) {
+    const size_t p = name.find('{');
+    const size_t n = p == name.npos ? name.size() : p;
+    s.append(name.data(), n).append(suffix);
+    if (p == name.npos) {
+        if (k) s << '{' << k << "=\"" << v << "\"}";
+        return;
+    }
+    if (!k) {
+        s.append(name.data() + n, name.size() - n);
+        return;
+    }
+    // insert the label before '}'
+    s.append(name.data() + n, name.size() - n - 1);
+    if (name[name.size() - 2] != '{') s << ',';
+    s << k << "=\"" << v << "\"}";
+}
+
+static const char* type_name(metric::type_t t) {
+    switch (t) {
+    case metric::t_counter:
+        return "counter";
+    case metric::t_gauge:
+        return "gauge";
+    default:
+        return "histogram";
+    }
+}
+
+// runtime metrics of co
+static void write_co_metrics(fastream& s) {
+    auto& v = co::scheds();
+    co::vector<co::sched_stats> st(v.size());
+    for (size_t i = 0; i < v.size(); ++i) st.push_back(v[i]->stats());
+
+    struct item_t {
+        const char* name;
+        const char* type;
+        const char* help;
+        size_t off;
+    };
+    static const item_t items[] = {
+        {"co_sched_coroutines", "gauge", "number of coroutines alive",
+         offsetof(co::sched_stats, coroutines)},
+        {"co_sched_switches_total", "counter", "context switches into coroutines",
+         offsetof(co::sched_stats, switches)},
+        {"co_sched_stack_bytes_total", "counter", "bytes of shared stacks saved",
+         offsetof(co::sched_stats, stack_bytes)},
+        {"co_sched_stack_collisions_total", "counter",
+         "coroutines resumed on a shared stack used by another one",
+         offsetof(co::sched_stats, stack_collisions)},
+        {"co_sched_timers", "gauge", "number of pending timers",
+         offsetof(co::sched_stats, timers)},
+        {"co_sched_wait_us_total", "counter", "time blocked or polling in waits for events",
+         offsetof(co::sched_stats, wait_us)},
+        {"co_sched_run_us_total", "counter", "time spent in handling events and coroutines",
+         offsetof(co::sched_stats, run_us)},
+    };
+    for (const auto& x : items) {
+        s << "# HELP " << x.name << ' ' << x.help << '\n';
+        s << "# TYPE " << x.name << ' ' << x.type << '\n';
+        for (size_t i = 0; i < st.size(); ++i) {
+            const uint64_t n = *(const uint64_t*)((const char*)&st[i] + x.off);
+            s << x.name << "{sched=\"" << st[i].id << "\"} " << n << '\n';
+        }
+    }
+
+    const co::blocking_pool_stats b = co::blocking_stats();
+    s << "# HELP co_blocking_threads threads of the blocking pool\n"
+      << "# TYPE co_blocking_threads gauge\n"
+      << "co_blocking_threads " << b.threads << '\n'
+      << "# HELP co_blocking_queued tasks waiting in the blocking pool\n"
+      << "# TYPE co_blocking_queued gauge\n"
+      << "co_blocking_queued " << b.queued << '\n'
+      << "# HELP co_blocking_done_total tasks done in the blocking pool\n"
+      << "# TYPE co_blocking_done_total counter\n"
+      << "co_blocking_done_total " << b.done << '\n'
+      << "# HELP co_blocking_wait_us_total time tasks waited in the blocking pool\n"
+      << "# TYPE co_blocking_wait_us_total counter\n"
+      << "co_blocking_wait_us_total " << b.wait_us << '\n';
+}
+
+}  // namespace xx
+
+namespace metrics {
+
+uint64_t counter::value() const {
+    uint64_t n = 0;
+    _s.each([&n](const shard_t& s) { n += s.n.load(std::memory_order_relaxed); });
+    return n;
+}
+
+void counter::write(fastream& s) const {
+    xx::write_name(s, this->name(), "", 0, 0);
+    s << ' ' << this->value() << '\n';
+}
+
+void gauge::write(fastream& s) const {
+    xx::write_name(s, this->name(), "", 0, 0);
+    s << ' ' << this->value() << '\n';
+}
+
+uint64_t histogram::merge(uint64_t* b) const {
+    memset(b, 0, sizeof(uint64_t) * xx::metric_buckets);
+    _s.each([b](const shard_t& s) {
+        for (uint32_t i = 0; i < xx::metric_buckets; ++i) {
+            b[i] += s.b[i].load(std::memory_order_relaxed);
+        }
+    });
+    uint64_t n = 0;
+    for (uint32_t i = 0; i < xx::metric_buckets; ++i) n += b[i];
+    return n;
+}
+
+uint64_t histogram::count() const {
+    uint64_t b[xx::metric_buckets];
+    return this->merge(b);
+}
+
+uint64_t histogram::sum() const {
+    uint64_t n = 0;
+    _s.each([&n](const shard_t& s) { n += s.sum.load(std::memory_order_relaxed); });
+    return n;
+}
+
+uint64_t histogram::percentile(double q) const {
+    uint64_t b[xx::metric_buckets];
+    const uint64_t n = this->merge(b);
+    if (n == 0) return 0;
+    uint64_t k = (uint64_t)(q * n + 0.5);
+    if (k == 0) k = 1;
+    if (k > n) k = n;
+    uint64_t c = 0;
+    for (uint32_t i = 0; i < xx::metric_buckets; ++i) {
+        c += b[i];
+        if (c >= k) return upper(i);
+    }
+    return upper(xx::metric_buckets - 1);
+}
+
+void histogram::write(fastream& s) const {
+    uint64_t b[xx::metric_buckets];
+    const uint64_t n = this->merge(b);
+
+    // buckets at 1, 2, 4, ... upto the largest bucket used, a power of 2 is the
+    // upper bound of the last sub-bucket of its range.
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < xx::metric_buckets; ++i) {
+        if (b[i]) last = i;
+    }
+    char le[24];
+    uint64_t c = 0;
+    uint32_t i = 0;
+    for (uint64_t x = 1;; x <<= 1) {
+        while (i < xx::metric_buckets && upper(i) <= x) c += b[i++];
+        const size_t m = fast::u64toa(x, le);
+        le[m] = '\0';
+        xx::write_name(s, this->name(), "_bucket", "le", le);
+        s << ' ' << c << '\n';
+        if (i > last) break;
+    }
+    xx::write_name(s, this->name(), "_bucket", "le", "+Inf");
+    s << ' ' << n << '\n';
+    xx::write_name(s, this->name(), "_sum", 0, 0);
+    s << ' ' << this->sum() << '\n';
+    xx::write_name(s, this->name(), "_count", 0, 0);
+    s << ' ' << n << '\n';
+}
+
+void add_collector(std::function<void(fastream&)>&& f) {
+    auto& r = xx::registry();
+    std::lock_guard<std::mutex> g(r.mtx);
+    r.collectors.push_back(std::move(f));
+}
+
+fastring text() {
+    fastream s(4096);
+    auto& r = xx::registry();
+    {
+        std::lock_guard<std::mutex> g(r.mtx);
+        // samples of a metric name are grouped under a HELP and a TYPE line
+        typedef std::pair<fastring, const xx::metric*> item_t;
+        co::vector<item_t> v(r.metrics.size());
+        for (size_t i = 0; i < r.metrics.size(); ++i) {
+            v.push_back(item_t(r.metrics[i]->base_name(), r.metrics[i]));
+        }
+        std::sort(v.data(), v.data() + v.size(), [](const item_t& a, const item_t& b) {
+            return a.first != b.first ? a.first < b.first : a.second->name() < b.second->name();
+        });
+
+        for (size_t i = 0; i < v.size(); ++i) {
+            const xx::metric* m = v[i].second;
+            if (i == 0 || v[i].first != v[i - 1].first) {
+                s << "# HELP " << v[i].first << ' ' << m->help() << '\n';
+                s << "# TYPE " << v[i].first << ' ' << xx::type_name(m->type()) << '\n';
+            }
+            m->write(s);
+        }
+        for (size_t i = 0; i < r.collectors.size(); ++i) r.collectors[i](s);
+    }
+    xx::write_co_metrics(s);
+    return s.str();
+}
+
+}  // namespace metrics
+}  // namespace co
@@ -0,0 +1,139 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "co/json.h"
+
+namespace json {
+namespace {
+
+typedef std::function<bool(size_t, Json&)> F;
+
+// chunks are at least this large, unless it is the end of the input
+static const size_t kChunkSize = 256 * 1024;
+
+inline bool is_blank(const char* p, const char* e) {
+    for (; p < e; ++p) {
+        if (*p != ' ' && *p != '\t' && *p != '\r') return false;
+    }
+    return true;
+}
+
+// Parse the lines in [b, e), @b is the beginning of a line, @s is the input.
+// @f is called for each document, return false on any error or if @f stopped.
+template <class G>
+bool parse_range(const char* s, const char* b, const char* e, const G& f) {
+    Json v;
+    while (b < e) {
+        const char* p = (const char*)memchr(b, '\n', e - b);
+        if (!p) p = e;
+        if (!is_blank(b, p)) {
+            if (!v.parse_from(b, p - b)) return false;
+            if (!f((size_t)(b - s), v)) return false;
+            v.reset();
+        }
+        b = p + 1;
+    }
+    return true;
+}
+
+// The input is taken chunk by chunk by @n threads, a chunk ends at the end of a
+// line. For the ordered mode, each thread keeps the documents of its chunk, and
+// passes them to @f when all the chunks before it are done.
+class line_parser {
+  public:
+    line_parser(const char* s, size_t n, const F& f, bool ordered)
+        : _s(s), _e(s + n), _p(s), _f(f), _ordered(ordered), _seq(0), _turn(0), _ok(true) {
+        _chunk = n / 64;
+        if (_chunk < kChunkSize) _chunk = kChunkSize;
+    }
+
+    bool run(int n) {
+        co::vector<std::thread> v(n);
+        for (int i = 0; i < n; ++i) v.emplace_back(&line_parser::loop, this);
+        for (auto& t : v) t.join();
+        return _ok;
+    }
+
+  private:
+    // take the next chunk, return false if there is none
+    bool next(const char*& b, const char*& e, size_t& seq) {
+        std::lock_guard<std::mutex> g(_m);
+        if (_p == _e || !_ok) return false;
+        b = _p;
+        if ((size_t)(_e - b) <= _chunk) {
+            e = _e;
+        } else {
+            e = (const char*)memchr(b + _chunk, '\n', _e - b - _chunk);
+            e = e ? e + 1 : _e;
+        }
+        _p = e;
+        seq = _seq++;
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> g(_m);
+        _ok = false;
+        _cv.notify_all();
+    }
+
+    void loop() {
+        const char* b;
+        const char* e;
+        size_t seq;
+        co::vector<std::pair<size_t, Json>> docs;
+        while (this->next(b, e, seq)) {
+            if (!_ordered) {
+                if (!parse_range(_s, b, e, _f)) return this->stop();
+                continue;
+            }
+
+            const bool r = parse_range(_s, b, e, [&docs](size_t pos, Json& v) {
+                docs.emplace_back(pos, std::move(v));
+                return true;
+            });
+            {
+                std::unique_lock<std::mutex> g(_m);
+                while (_turn != seq && _ok) _cv.wait(g);
+                if (!_ok) return;
+            }
+
+            // it is our turn, documents before the error are still delivered
+            bool ok = r;
+            for (size_t i = 0; i < docs.size(); ++i) {
+                if (!_f(docs[i].first, docs[i].second)) {
+                    ok = false;
+                    break;
+                }
+            }
+            docs.clear();
+            if (!ok) return this->stop();
+
+            std::lock_guard<std::mutex> g(_m);
+            ++_turn;
+            _cv.notify_all();
+        }
+    }
+
+    const char* const _s;
+    const char* const _e;
+    const char* _p;
+    size_t _chunk;
+    const F& _f;
+    const bool _ordered;
+    size_t _seq;
+    size_t _turn;
+    bool _ok;
+    std::mutex _m;
+    std::condition_variable _cv;
+};
+
+}  // namespace
+
+bool parse_lines(const char* s, size_t n, const F& f, int threads, bool ordered) {
+    if (threads <= 1 || n <= kChunkSize) return parse_range(s, s, s + n, f);
+    return line_parser(s, n, f, ordered).run(threads);
+}
+
+}  // namespace json
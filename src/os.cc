@@ -2,11 +2,18 @@
 
 #include "co/os.h"
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
+#include <sys/sysctl.h>
+#else
+#include <sched.h>
 #endif
 
 namespace os {
@@ -80,6 +87,153 @@ void daemon() {
     (void)r;
 }
 
+namespace {
+
+// read the first line of a small file to @s, return false on error
+bool read_line(const char* path, char* s, int n) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    const bool r = fgets(s, n, f) != nullptr;
+    fclose(f);
+    return r;
+}
+
+long read_long(const char* path, long def) {
+    char s[32];
+    return read_line(path, s, sizeof(s)) ? strtol(s, nullptr, 10) : def;
+}
+
+// call @f(id) for each cpu in a list like "0-3,8,10-11", return the count
+template <typename F>
+int each_in_list(const char* s, F&& f) {
+    int n = 0;
+    while (*s >= '0' && *s <= '9') {
+        char* e;
+        const long b = strtol(s, &e, 10);
+        long x = b;
+        if (*e == '-') x = strtol(e + 1, &e, 10);
+        for (long i = b; i <= x; ++i, ++n) f((int)i);
+        if (*e != ',') break;
+        s = e + 1;
+    }
+    return n;
+}
+
+// parse a cache size like "2048K"
+size_t parse_size(const char* s) {
+    char* e;
+    size_t n = (size_t)strtoull(s, &e, 10);
+    if (*e == 'K') n <<= 10;
+    if (*e == 'M') n <<= 20;
+    return n;
+}
+
+// Get the cpu quota from the cgroup of the process, in cpus. The cgroup path in
+// /proc/self/cgroup is tried first, then the root, as a container may see its
+// own cgroup mounted at /sys/fs/cgroup.
+double cgroup_cpu_quota() {
+    char v1[256] = "", v2[256] = "", s[320];
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        while (fgets(s, sizeof(s), f)) {
+            char* p = strchr(s, ':');
+            char* q = p ? strchr(p + 1, ':') : nullptr;
+            if (!q) continue;
+            q[strcspn(q, "\n")] = '\0';
+            *q++ = '\0';
+            if (p[1] == '\0') {  // "0::/path" for v2
+                snprintf(v2, sizeof(v2), "%s", q);
+            } else {
+                for (char* c = p + 1; c;) {  // controllers, e.g. "cpu,cpuacct"
+                    char* e = strchr(c, ',');
+                    if (e) *e++ = '\0';
+                    if (strcmp(c, "cpu") == 0) snprintf(v1, sizeof(v1), "%s", q);
+                    c = e;
+                }
+            }
+        }
+        fclose(f);
+    }
+
+    if (strcmp(v2, "/") == 0) v2[0] = '\0';
+    if (strcmp(v1, "/") == 0) v1[0] = '\0';
+    const char* dirs[2];
+    dirs[0] = v2;
+    dirs[1] = "";
+    for (const char* x : dirs) {
+        snprintf(s, sizeof(s), "/sys/fs/cgroup%s/cpu.max", x);
+        char m[64];
+        if (read_line(s, m, sizeof(m))) {  // "max 100000" or "400000 100000"
+            if (strncmp(m, "max", 3) == 0) return 0;
+            char* e;
+            const double quota = strtod(m, &e);
+            const double period = strtod(e, nullptr);
+            return quota > 0 && period > 0 ? quota / period : 0;
+        }
+    }
+
+    dirs[0] = v1;
+    for (const char* x : dirs) {
+        snprintf(s, sizeof(s), "/sys/fs/cgroup/cpu%s/cpu.cfs_quota_us", x);
+        const long quota = read_long(s, -2);
+        if (quota == -2) continue;
+        snprintf(s, sizeof(s), "/sys/fs/cgroup/cpu%s/cpu.cfs_period_us", x);
+        const long period = read_long(s, 0);
+        return quota > 0 && period > 0 ? (double)quota / period : 0;
+    }
+    return 0;
+}
+
+void detect(topology_t& t) {
+    char s[256];
+    if (!read_line("/sys/devices/system/cpu/online", s, sizeof(s))) return;
+
+    // a core is identified by its package id and core id
+    uint64_t* ids = (uint64_t*)::malloc(sizeof(uint64_t) * t.cpus);
+    int n = 0;
+    each_in_list(s, [&](int cpu) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        const long core = read_long(path, -1);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        const long pkg = read_long(path, -1);
+        if (core >= 0 && pkg >= 0 && n < t.cpus) ids[n++] = ((uint64_t)pkg << 32) | (uint32_t)core;
+    });
+    std::sort(ids, ids + n);
+    const int cores = (int)(std::unique(ids, ids + n) - ids);
+    ::free(ids);
+    if (cores > 0) t.cores = cores;
+
+    if (read_line("/sys/devices/system/node/online", s, sizeof(s))) {
+        const int x = each_in_list(s, [](int) {});
+        if (x > 0) t.numa_nodes = x;
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        const long level = read_long(path, 0);
+        if (level == 0) break;
+        if (level != 2 && level != 3) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (!read_line(path, s, sizeof(s)) || strncmp(s, "Instruction", 11) == 0) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if (!read_line(path, s, sizeof(s))) continue;
+        (level == 2 ? t.l2_size : t.l3_size) = parse_size(s);
+    }
+
+    t.cpu_quota = cgroup_cpu_quota();
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        const int x = CPU_COUNT(&set);
+        if (x > 0 && x < t.cpu_limit) t.cpu_limit = x;
+    }
+}
+
+}  // namespace
+
 #else
 fastring exepath() {
     fastring s(128);
@@ -97,8 +251,43 @@ fastring exepath() {
 }
 
 void daemon() {}
+
+namespace {
+
+long sysctl_long(const char* name) {
+    int64_t v = 0;
+    size_t n = sizeof(v);
+    return sysctlbyname(name, &v, &n, nullptr, 0) == 0 ? (long)v : 0;
+}
+
+void detect(topology_t& t) {
+    const long cores = sysctl_long("hw.physicalcpu");
+    if (cores > 0) t.cores = (int)cores;
+    t.l2_size = (size_t)sysctl_long("hw.l2cachesize");
+    t.l3_size = (size_t)sysctl_long("hw.l3cachesize");
+}
+
+}  // namespace
 #endif
 
+const topology_t& topology() {
+    static topology_t t = []() {
+        topology_t t;
+        memset(&t, 0, sizeof(t));
+        t.cpus = t.cores = t.cpu_limit = os::cpunum();
+        t.numa_nodes = 1;
+        detect(t);
+        if (t.cores > t.cpus) t.cores = t.cpus;
+        t.smt = t.cpus / t.cores;
+        if (t.cpu_quota > 0) {
+            const int x = (int)ceil(t.cpu_quota);
+            if (x < t.cpu_limit) t.cpu_limit = x;
+        }
+        return t;
+    }();
+    return t;
+}
+
 sig_handler_t signal(int sig, sig_handler_t handler, int flag) {
     struct sigaction sa, old;
     memset(&sa, 0, sizeof(sa));
@@ -103,6 +103,46 @@ int cpunum() {
     return (int)info.dwNumberOfProcessors;
 }
 
+const topology_t& topology() {
+    static topology_t t = []() {
+        topology_t t;
+        memset(&t, 0, sizeof(t));
+        t.cpus = t.cores = t.cpu_limit = os::cpunum();
+        t.numa_nodes = 1;
+
+        DWORD n = 0;
+        GetLogicalProcessorInformation(NULL, &n);
+        auto v = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*)::malloc(n);
+        if (v && GetLogicalProcessorInformation(v, &n)) {
+            int cores = 0, nodes = 0;
+            for (size_t i = 0; i < n / sizeof(*v); ++i) {
+                auto& x = v[i];
+                if (x.Relationship == RelationProcessorCore) {
+                    ++cores;
+                } else if (x.Relationship == RelationNumaNode) {
+                    ++nodes;
+                } else if (x.Relationship == RelationCache && x.Cache.Type != CacheInstruction) {
+                    if (x.Cache.Level == 2 && !t.l2_size) t.l2_size = x.Cache.Size;
+                    if (x.Cache.Level == 3 && !t.l3_size) t.l3_size = x.Cache.Size;
+                }
+            }
+            if (cores > 0 && cores <= t.cpus) t.cores = cores;
+            if (nodes > 0) t.numa_nodes = nodes;
+        }
+        ::free(v);
+        t.smt = t.cpus / t.cores;
+
+        DWORD_PTR pm, sm;
+        if (GetProcessAffinityMask(GetCurrentProcess(), &pm, &sm)) {
+            int x = 0;
+            for (; pm; pm &= pm - 1) ++x;
+            if (x > 0 && x < t.cpu_limit) t.cpu_limit = x;
+        }
+        return t;
+    }();
+    return t;
+}
+
 size_t pagesize() {
     SYSTEM_INFO info;
     GetSystemInfo(&info);
@@ -1,46 +1,57 @@
 #include "co/rand.h"
 
-#include <math.h>
+#include <string.h>
 
 #include <random>
 
-#include "co/god.h"
-
 #ifdef _WIN32
 #include <intrin.h>
+#endif
 
-inline uint32_t _get_mask(uint32_t x) { /* x > 1 */
-    unsigned long r;
-    _BitScanReverse(&r, x - 1);
-    return (2u << r) - 1;
+namespace co {
+
+// 64x64 -> 128 bit multiplication, return high 64 bits xor low 64 bits
+#if defined(__SIZEOF_INT128__)
+inline uint64_t _mum(uint64_t a, uint64_t b) {
+    const __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)(r >> 64) ^ (uint64_t)r;
+}
+
+#elif defined(_WIN32) && defined(_M_X64)
+inline uint64_t _mum(uint64_t a, uint64_t b) {
+    uint64_t hi;
+    const uint64_t lo = _umul128(a, b, &hi);
+    return hi ^ lo;
 }
 
 #else
-inline uint32_t _get_mask(uint32_t x) { /* x > 1 */
-    return (2u << (31 - __builtin_clz(x - 1))) - 1;
+inline uint64_t _mum(uint64_t a, uint64_t b) {
+    const uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    const uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return hi ^ lo;
 }
 #endif
 
-namespace co {
-
+// wyrand, see https://github.com/wangyi-fudan/wyhash. It passes BigCrush and
+// PractRand, with only 8 bytes of state, which is much smaller and faster than
+// std::mt19937.
 class Rand {
   public:
-    Rand() : _mt(std::random_device{}()) {
-        const uint32_t seed = _mt();
-        _seed = (0 < seed && seed < 2147483647u) ? seed : 23u;
+    Rand() {
+        std::random_device rd;
+        _seed = ((uint64_t)rd() << 32) | rd();
     }
 
-    // _seed = _seed * A % M
-    uint32_t next() {
-        static const uint32_t M = 2147483647u;  // 2^31-1
-        static const uint64_t A = 16385;        // 2^14+1
-        const uint64_t p = _seed * A;
-        _seed = static_cast<uint32_t>((p >> 31) + (p & M));
-        return _seed > M ? (_seed -= M) : _seed;
+    uint64_t next() {
+        _seed += 0xa0761d6478bd642full;
+        return _mum(_seed, _seed ^ 0xe7037ed1a0b428dbull);
     }
 
-    std::mt19937& mt19937() { return _mt; }
-
     struct Cache {
         constexpr Cache() : s(), p(0) {}
         fastring s;
@@ -50,21 +61,31 @@ class Rand {
     Cache& cache() { return _cache; }
 
   private:
-    std::mt19937 _mt;
-    uint32_t _seed;
+    uint64_t _seed;
     Cache _cache;
 };
 
 static thread_local Rand g_rand;
 
-uint32_t rand() { return g_rand.next(); }
+// 0 < result < 2^31-1, as a seed of co::rand(seed) may be initialized with it
+uint32_t rand() {
+    static const uint64_t M = 2147483647u;  // 2^31-1
+    return (uint32_t)(((g_rand.next() >> 32) * (M - 1)) >> 32) + 1;
+}
+
+uint64_t rand64() { return g_rand.next(); }
 
-inline void _gen_random_bytes(uint8_t* p, uint32_t n) {
-    auto& r = g_rand.mt19937();
-    const uint32_t x = (n >> 2) << 2;
-    uint32_t i = 0;
-    for (; i < x; i += 4) *(uint32_t*)(p + i) = r();
-    if (i < n) *(uint32_t*)(p + i) = r();
+void rand_bytes(void* p, size_t n) {
+    auto& r = g_rand;
+    char* s = (char*)p;
+    for (; n >= 8; n -= 8, s += 8) {
+        const uint64_t x = r.next();
+        memcpy(s, &x, 8);
+    }
+    if (n > 0) {
+        const uint64_t x = r.next();
+        memcpy(s, &x, n);
+    }
 }
 
 const char kS[] = "_-0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -75,26 +96,19 @@ const char* const pAZ = kS + 38;
 // A thread-safe C++ implement for nanoid
 // Inspired by github.com/mcmikecreations/nanoid_cpp.
 // Also see https://github.com/ai/nanoid for details.
+//   - There are 64 symbols, each 64-bit random number makes 10 of them.
 fastring randstr(int n) {
     if (unlikely(n <= 0)) return fastring();
 
-    const uint32_t mask = 63;
-    const uint32_t p = mask * n;
-    const uint32_t r = p / 40;
-    const uint32_t step = r + !!(p - r * 40);  // ceil(1.6 * mask * n / 64)
-    fastring bytes(god::align_up<4>(step));
-    fastring res(n);
-    int pos = 0;
-
+    fastring res(n + 1);
     res.resize(n);
-    while (true) {
-        _gen_random_bytes((uint8_t*)bytes.data(), step);
-        for (size_t i = 0; i < step; ++i) {
-            const size_t index = bytes[i] & mask;
-            res[pos] = kS[index];
-            if (++pos == n) return res;
-        }
+    char* p = (char*)res.data();
+    for (int i = 0; i < n;) {
+        uint64_t x = g_rand.next();
+        const int k = n - i < 10 ? n - i : 10;
+        for (int j = 0; j < k; ++j, x >>= 6) p[i++] = kS[x & 63];
     }
+    return res;
 }
 
 const char* _expand(const char* p, uint32_t& len) {
@@ -158,6 +172,8 @@ const char* _expand(const char* p, uint32_t& len) {
     return s.data();
 }
 
+// Each 64-bit random number makes 2 symbols, without rejection: a 32-bit
+// random number x is mapped to (x * len) >> 32, the bias is at most len / 2^32.
 fastring randstr(const char* s, int n) {
     if (!s || !*s || n <= 0) return fastring();
 
@@ -166,23 +182,17 @@ fastring randstr(const char* s, int n) {
     if (!p || len == 0 || len > 255) return fastring();
     if (len == 1) return fastring(n, *p);
 
-    const uint32_t mask = _get_mask(len);
-    const uint32_t step = (uint32_t)::ceil(1.6 * (mask * n) / len);
-    fastring bytes(god::align_up<4>(step));
     fastring res(n + 1);
-    int pos = 0;
-
     res.resize(n);
-    while (true) {
-        _gen_random_bytes((uint8_t*)bytes.data(), step);
-        for (size_t i = 0; i < step; ++i) {
-            const size_t index = bytes[i] & mask;
-            if (index < len) {
-                res[pos] = p[index];
-                if (++pos == n) return res;
-            }
-        }
+    char* r = (char*)res.data();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const uint64_t x = g_rand.next();
+        r[i] = p[((x & 0xffffffffu) * len) >> 32];
+        r[i + 1] = p[((x >> 32) * len) >> 32];
     }
+    if (i < n) r[i] = p[((g_rand.next() >> 32) * len) >> 32];
+    return res;
 }
 
 }  // namespace co
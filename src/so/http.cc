@@ -1,4 +1,25 @@
 #include "./http.h"
+#include "./http_cache.h"
+#include "./idle.h"
+#include "./router.h"
+#include "../co/probe.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HTTP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HTTP_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include <atomic>
 #include <cstdlib>
@@ -9,17 +30,37 @@
 #include "co/fs.h"
 #include "co/god.h"
 #include "co/http.h"
+#include "co/metrics.h"
 #include "co/path.h"
+#include "co/small_string.h"
 #include "co/stl.h"
+#include "co/str.h"
 #include "co/tcp.h"
 #include "co/time.h"
 
 #ifdef HAS_LIBCURL
 #include <curl/curl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#endif
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
 #endif
 
 DEF_uint32(http_max_header_size, 4096, ">>#2 max size of http header");
 DEF_uint32(http_max_body_size, 8 << 20, ">>#2 max size of http body, default: 8M");
+DEF_uint32(http_stream_body_size, 0,
+           ">>#2 bodies larger than this are streamed to on_req(), see Req::read_body(), "
+           "0 for never");
 DEF_uint32(http_timeout, 3000, ">>#2 send or recv timeout in ms for http client");
 DEF_uint32(http_conn_timeout, 3000, ">>#2 connect timeout in ms for http client");
 DEF_uint32(http_recv_timeout, 3000, ">>#2 recv timeout in ms for http server");
@@ -28,6 +69,16 @@ DEF_uint32(http_conn_idle_sec, 180,
            ">>#2 if a connection was idle for this seconds, the server may reset it");
 DEF_uint32(http_max_idle_conn, 128, ">>#2 max idle connections for http server");
 DEF_bool(http_log, true, ">>#2 enable http server log if true");
+DEF_bool(http2, true, ">>#2 enable HTTP/2 for http server if true");
+DEF_bool(http_curl_multi, true,
+         ">>#2 http clients in a scheduler share a curl multi handle driven by the "
+         "scheduler, connections are shared then, linux only");
+DEF_uint32(http_compress_size, 0,
+           ">>#2 response bodies not smaller than this are compressed with gzip for clients "
+           "accepting it, 0: disabled, zlib required");
+DEF_int32(http_compress_level, 6, ">>#2 gzip compression level of http responses, 1-9");
+DEF_uint32(http_compress_cache_size, 128,
+           ">>#2 compressed bodies of responses with an ETag cached by each scheduler, 0: disabled");
 
 #define HTTPLOG LOG_IF(FLG_http_log)
 
@@ -67,6 +118,10 @@ struct curl_ctx_t {
             ::free(arr);
             arr = 0;
         }
+        if (ev) {
+            delete ev;
+            ev = 0;
+        }
     }
 
     void add_header(uint32_t k) {
@@ -97,6 +152,7 @@ struct curl_ctx_t {
     CURL* easy;
     struct curl_slist* l;
     fs::file upfile;  // for PUT, the file to upload
+    co::event* ev;    // signaled when a transfer on the multi handle is done
     bool header_updated;
     char err[CURL_ERROR_SIZE];
 };
@@ -118,8 +174,152 @@ void init_easy_opts(CURL* e, curl_ctx_t* ctx) {
     curl_easy_setopt(e, CURLOPT_CONNECTTIMEOUT_MS, FLG_http_conn_timeout);
     curl_easy_setopt(e, CURLOPT_TIMEOUT_MS, FLG_http_timeout);
     curl_easy_setopt(e, CURLOPT_ERRORBUFFER, ctx->err);
+    curl_easy_setopt(e, CURLOPT_PRIVATE, (void*)ctx);
+}
+
+#ifdef __linux__
+// Transfers of clients in a scheduler share a curl multi handle, with its pool of
+// connections, and HTTP/2 streams on them. Sockets of curl are added to an epoll,
+// that is watched by the scheduler, like the hooked poll(). A coroutine drives
+// the transfers while there are any. Schedulers live as long as the process, the
+// multi handles are not freed.
+class Multi {
+  public:
+    Multi() : _deadline(-1), _n(0), _driving(false), _waiting(false) {
+        _m = curl_multi_init();
+        CHECK(_m) << "curl_multi_init failed..";
+        _ep = epoll_create1(EPOLL_CLOEXEC);
+        _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        CHECK(_ep >= 0 && _efd >= 0) << "create epoll for curl failed: " << co::strerror();
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = _efd;
+        epoll_ctl(_ep, EPOLL_CTL_ADD, _efd, &ev);
+        curl_multi_setopt(_m, CURLMOPT_SOCKETFUNCTION, &Multi::on_socket);
+        curl_multi_setopt(_m, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(_m, CURLMOPT_TIMERFUNCTION, &Multi::on_timer);
+        curl_multi_setopt(_m, CURLMOPT_TIMERDATA, this);
+    }
+
+    static Multi* instance() {
+        static thread_local Multi* m = new Multi();
+        return m;
+    }
+
+    // run a transfer, it waits in the current coroutine until the transfer is done
+    void perform(curl_ctx_t* ctx);
+
+  private:
+    static int on_socket(CURL* e, curl_socket_t s, int what, void* userp, void* sockp);
+    static int on_timer(CURLM* m, long ms, void* userp);
+    void drive();
+    void action(curl_socket_t s, int mask);
+
+  private:
+    CURLM* _m;
+    int _ep;
+    int _efd;           // wakes up the driver, when curl needs to be called earlier
+    int64_t _deadline;  // when curl wants to be called for timeouts, -1 for never
+    int _n;             // transfers in progress
+    bool _driving;
+    bool _waiting;
+};
+
+int Multi::on_socket(CURL*, curl_socket_t s, int what, void* userp, void* sockp) {
+    Multi* const m = (Multi*)userp;
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(m->_ep, EPOLL_CTL_DEL, s, 0);
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+    ev.data.fd = s;
+    if (sockp) {
+        epoll_ctl(m->_ep, EPOLL_CTL_MOD, s, &ev);
+    } else {
+        epoll_ctl(m->_ep, EPOLL_CTL_ADD, s, &ev);
+        curl_multi_assign(m->_m, s, (void*)1);
+    }
+    return 0;
 }
 
+int Multi::on_timer(CURLM*, long ms, void* userp) {
+    Multi* const m = (Multi*)userp;
+    m->_deadline = ms < 0 ? -1 : co::now::ms() + ms;
+    if (m->_waiting) {
+        const uint64_t one = 1;
+        (void)::write(m->_efd, &one, sizeof(one));
+    }
+    return 0;
+}
+
+// let curl do the work on a socket, and wake up the transfers done
+void Multi::action(curl_socket_t s, int mask) {
+    int running = 0;
+    curl_multi_socket_action(_m, s, mask, &running);
+
+    CURLMsg* msg;
+    int left;
+    while ((msg = curl_multi_info_read(_m, &left))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL* const e = msg->easy_handle;
+        curl_ctx_t* ctx = 0;
+        curl_easy_getinfo(e, CURLINFO_PRIVATE, (char**)&ctx);
+        curl_multi_remove_handle(_m, e);
+        --_n;
+        ctx->ev->signal();
+    }
+}
+
+void Multi::drive() {
+    struct epoll_event evs[64];
+    co::io_event ev(_ep, co::ev_read);
+    while (_n > 0) {
+        // the scheduler wakes us up on the next event, only after the epoll was drained
+        const int r = epoll_wait(_ep, evs, 64, 0);
+        if (r > 0) {
+            for (int i = 0; i < r; ++i) {
+                const int fd = evs[i].data.fd;
+                if (fd == _efd) {
+                    uint64_t x;
+                    (void)::read(_efd, &x, sizeof(x));
+                    continue;
+                }
+                const uint32_t e = evs[i].events;
+                const int mask = ((e & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                                 ((e & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                                 ((e & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+                this->action(fd, mask);
+            }
+            continue;
+        }
+
+        if (_deadline >= 0 && co::now::ms() >= _deadline) {
+            _deadline = -1;
+            this->action(CURL_SOCKET_TIMEOUT, 0);
+            continue;
+        }
+
+        const int64_t t = _deadline < 0 ? -1 : _deadline - co::now::ms();
+        _waiting = true;
+        ev.wait(t < 0 ? (uint32_t)-1 : (uint32_t)t);
+        _waiting = false;
+    }
+    _driving = false;
+}
+
+void Multi::perform(curl_ctx_t* ctx) {
+    if (!ctx->ev) ctx->ev = new co::event();
+    curl_multi_add_handle(_m, ctx->easy);
+    ++_n;
+    if (!_driving) {
+        _driving = true;
+        co::sched()->go(&Multi::drive, this);
+    }
+    ctx->ev->wait();
+}
+#endif
+
 Client::Client(const char* serv_url) : _ctx(0) { this->reset(serv_url); }
 
 Client::~Client() {
@@ -263,6 +463,9 @@ void Client::perform() {
         curl_easy_setopt(_ctx->easy, CURLOPT_HTTPHEADER, _ctx->l);
         _ctx->header_updated = false;
     }
+#ifdef __linux__
+    if (FLG_http_curl_multi) return Multi::instance()->perform(_ctx);
+#endif
     curl_easy_perform(_ctx->easy);
 }
 
@@ -392,8 +595,8 @@ inline const char* version_str(int v) { return g_v[v]; }
 static const char* g_m[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS"};
 inline const char* method_str(int m) { return g_m[m]; }
 
-static const co::hash_map<fastring, int>& method_map() {
-    static co::hash_map<fastring, int> _method_map{
+static const co::flat_hash_map<co::small_string, int>& method_map() {
+    static co::flat_hash_map<co::small_string, int> _method_map{
         {"GET", kGet}, {"POST", kPost},     {"HEAD", kHead},
         {"PUT", kPut}, {"DELETE", kDelete}, {"OPTIONS", kOptions},
     };
@@ -486,49 +689,527 @@ inline const char* status_str(int n) {
     };
 }
 
+constexpr char upper(char c) { return ('a' <= c && c <= 'z') ? (char)(c - 32) : c; }
+
+// FNV-1a hash of the upper case string
+constexpr uint32_t header_hash(const char* s, uint32_t h = 2166136261u) {
+    return *s ? header_hash(s + 1, (h ^ (uint8_t)upper(*s)) * 16777619u) : h;
+}
+
+inline uint32_t header_hash_rt(const char* s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (uint8_t)upper(*s)) * 16777619u;
+    return h;
+}
+
+// compare an upper case key with a string, case-insensitive
+inline bool header_eq(const char* u, const char* s) {
+    for (; *u && *u == upper(*s); ++u, ++s);
+    return *u == '\0' && *s == '\0';
+}
+
+// common headers, they are stored in http_req_t::slots
+static const struct {
+    const char* key;
+    uint32_t hash;
+} g_slots[] = {
+    {"HOST", header_hash("HOST")},
+    {"CONNECTION", header_hash("CONNECTION")},
+    {"CONTENT-LENGTH", header_hash("CONTENT-LENGTH")},
+    {"CONTENT-TYPE", header_hash("CONTENT-TYPE")},
+    {"TRANSFER-ENCODING", header_hash("TRANSFER-ENCODING")},
+    {"EXPECT", header_hash("EXPECT")},
+    {"ACCEPT-ENCODING", header_hash("ACCEPT-ENCODING")},
+    {"COOKIE", header_hash("COOKIE")},
+};
+
+inline int header_slot(uint32_t h, const char* key) {
+    for (int i = 0; i < (int)(sizeof(g_slots) / sizeof(g_slots[0])); ++i) {
+        if (g_slots[i].hash == h && header_eq(g_slots[i].key, key)) return i;
+    }
+    return -1;
+}
+
+// status lines like "HTTP/1.1 200 OK\r\n", for status codes in [100, 600)
+class status_lines {
+  public:
+    status_lines() : _s(64 * 1024) {
+        for (int v = 0; v < 2; ++v) {
+            for (int i = 100; i < 600; ++i) {
+                const size_t o = _s.size();
+                _s << version_str(v) << ' ' << i << ' ' << status_str(i) << "\r\n";
+                _x[v][i - 100] = (uint32_t)o;
+                _n[v][i - 100] = (uint16_t)(_s.size() - o);
+            }
+        }
+    }
+
+    // append the status line to @s
+    void append(fastring& s, int version, int status) const {
+        if (100 <= status && status < 600 && (uint32_t)version < 2) {
+            s.append(_s.data() + _x[version][status - 100], _n[version][status - 100]);
+        } else {
+            s << version_str(version) << ' ' << status << ' ' << status_str(status) << "\r\n";
+        }
+    }
+
+  private:
+    fastring _s;
+    uint32_t _x[2][500];
+    uint16_t _n[2][500];
+};
+
+inline const status_lines& status_line() {
+    static status_lines _s;
+    return _s;
+}
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n", it is formatted at most once per
+// second in each thread.
+const fastring& date_header() {
+    static thread_local fastring _s(48);
+    static thread_local time_t _t = 0;
+
+    const time_t now = ::time(0);
+    if (now != _t) {
+        _t = now;
+        _s.clear();
+        _s.append("Date: ", 6).append(co::timestr::http_date((int64_t)now * 1000), 29);
+        _s.append("\r\n", 2);
+    }
+    return _s;
+}
+
+// the key is converted to upper case in place, so that we needn't do it on lookup
 inline void http_req_t::add_header(uint32_t k, uint32_t v) {
-    if (arr_cap < arr_size + 2) {
-        arr = (uint32_t*)::realloc(arr, (arr_cap + 32) << 2);
+    char* const key = (char*)buf->data() + k;
+    uint32_t h = 2166136261u;
+    for (char* p = key; *p; ++p) {
+        *p = upper(*p);
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+
+    const int i = header_slot(h, key);
+    if (i >= 0) {
+        if (slots[i] == 0) slots[i] = v;
+        return;
+    }
+
+    if (arr_cap < arr_size + 3) {
+        arr = (uint32_t*)::realloc(arr, (arr_cap + 48) << 2);
         assert(arr);
-        arr_cap += 32;
+        arr_cap += 48;
     }
+    arr[arr_size++] = h;
     arr[arr_size++] = k;
     arr[arr_size++] = v;
 }
 
 const char* http_req_t::header(const char* key) const {
-    fastring& s = fastring_cache();
-    fastring x(key);
-    x.toupper();
+    const uint32_t h = header_hash_rt(key);
+    const int x = header_slot(h, key);
+    if (x >= 0) return slots[x] ? buf->data() + slots[x] : g_empty;
 
-    for (uint32_t i = 0; i < arr_size; i += 2) {
-        s.clear();
-        s.append(buf->data() + arr[i]).toupper();
-        if (s == x) return buf->data() + arr[i + 1];
+    for (uint32_t i = 0; i < arr_size; i += 3) {
+        if (arr[i] == h && header_eq(buf->data() + arr[i + 1], key)) {
+            return buf->data() + arr[i + 2];
+        }
     }
-
     return g_empty;
 }
 
+bool accepts_gzip(const char* v) {
+    for (const char* p = v; *p;) {
+        while (*p == ' ' || *p == ',') ++p;
+        const char* e = p;
+        while (*e && *e != ',') ++e;
+        const char* q = p;
+        while (q < e && *q != ';' && *q != ' ') ++q;
+        if ((q - p == 4 && strncasecmp(p, "gzip", 4) == 0) || (q - p == 1 && *p == '*')) {
+            const char* x = q;
+            while (x < e && *x != 'q') ++x;
+            return x == e || x + 1 == e || x[1] != '=' || atof(x + 2) > 0;
+        }
+        p = e;
+    }
+    return false;
+}
+
+#ifdef HAS_ZLIB
+// value of a header added to the response, @key is in lower case
+static co::strview res_header(const fastring& h, const char* key, size_t n) {
+    const char* p = h.data();
+    const char* const e = p + h.size();
+    while (p < e) {
+        const char* q = (const char*)memchr(p, '\r', e - p);
+        if (!q) q = e;
+        if ((size_t)(q - p) > n && p[n] == ':' && strncasecmp(p, key, n) == 0) {
+            const char* v = p + n + 1;
+            while (v < q && *v == ' ') ++v;
+            return co::strview(v, q - v);
+        }
+        p = q + 2;
+    }
+    return co::strview();
+}
+
+// images, audio, video and archives are compressed already
+static bool compressible(co::strview t) {
+    if (t.starts_with("image/")) return t.starts_with("image/svg");
+    if (t.starts_with("audio/") || t.starts_with("video/")) return false;
+    return !t.ends_with("zip") && !t.ends_with("zstd") && !t.ends_with("compressed");
+}
+
+// A deflate stream of a scheduler, reset for each response, as initializing it
+// allocates about 256k.
+class Gzip {
+  public:
+    Gzip() : _init(false) {}
+    ~Gzip() {
+        if (_init) deflateEnd(&_z);
+    }
+
+    bool compress(const void* s, size_t n, fastring& out) {
+        if (!_init) {
+            memset(&_z, 0, sizeof(_z));
+            int l = FLG_http_compress_level;
+            l = l < 1 ? 1 : (l > 9 ? 9 : l);
+            if (deflateInit2(&_z, l, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            _init = true;
+        } else {
+            deflateReset(&_z);
+        }
+        out.clear();
+        out.reserve(deflateBound(&_z, (uLong)n));
+        _z.next_in = (Bytef*)s;
+        _z.avail_in = (uInt)n;
+        _z.next_out = (Bytef*)out.data();
+        _z.avail_out = (uInt)out.capacity();
+        if (deflate(&_z, Z_FINISH) != Z_STREAM_END) return false;
+        out.resize(_z.total_out);
+        return true;
+    }
+
+  private:
+    z_stream _z;
+    bool _init;
+};
+
+struct gzipped_t {
+    fastring src;  // the original body
+    fastring body;
+};
+
+// Compress the body of a response, return NULL if it is not compressed. Bodies of
+// responses with an ETag are cached, keyed by the host, the url and the ETag. The
+// original body is kept in the entry and compared on a hit, as handlers may reuse
+// an ETag for different bodies.
+static const fastring* gzip_body(http_res_t* res, const void* s, size_t n) {
+    if (res->status != 0 && res->status != 200) return nullptr;
+    const fastring& h = res->header;
+    if (!h.empty()) {
+        if (!res_header(h, "content-encoding", 16).empty()) return nullptr;
+        if (!compressible(res_header(h, "content-type", 12))) return nullptr;
+    }
+
+    static thread_local Gzip gz;
+    static thread_local fastring zbuf;
+    static thread_local std::unique_ptr<co::lru_map<fastring, gzipped_t>> cache;
+    const fastring* z = nullptr;
+
+    const co::strview etag = h.empty() ? co::strview() : res_header(h, "etag", 4);
+    const bool cached = !etag.empty() && res->req && FLG_http_compress_cache_size > 0 &&
+                        n <= (1 << 20);
+    fastring key;
+    if (cached) {
+        if (!cache) cache.reset(new co::lru_map<fastring, gzipped_t>(FLG_http_compress_cache_size));
+        const fastring& url = res->req->url;
+        const char* host = res->req->header("Host");
+        key.reserve(url.size() + etag.size() + 32);
+        key.append(host).append('\n').append(url).append('\n').append(etag);
+        auto it = cache->find(key);
+        if (it != cache->end()) {
+            const fastring& x = it->second.src;
+            if (x.size() == n && memcmp(x.data(), s, n) == 0) {
+                z = &it->second.body;
+            } else {
+                cache->erase(it);  // the ETag was reused for another body
+            }
+        }
+    }
+
+    if (!z) {
+        if (!gz.compress(s, n, zbuf) || zbuf.size() >= n) return nullptr;
+        z = &zbuf;
+        if (cached) cache->insert(std::move(key), gzipped_t{fastring(s, n), zbuf});
+    }
+    res->add_header("Content-Encoding", "gzip");
+    res->add_header("Vary", "Accept-Encoding");
+    return z;
+}
+#endif
+
 void http_res_t::set_body(const void* s, size_t n) {
+    if (file_len > 0) this->close_file();
+#ifdef HAS_ZLIB
+    if (accept_gzip && FLG_http_compress_size > 0 && n >= FLG_http_compress_size) {
+        const fastring* z = gzip_body(this, s, n);
+        if (z) s = z->data(), n = z->size();
+    }
+#endif
     body_size = n;
+    this->write_header((int64_t)n);
+    buf->append(s, n);
+}
+
+void http_res_t::write_header(int64_t n) {
     if (status == 0) status = 200;
     buf->clear();
-    (*buf) << version_str(version) << ' ' << status << ' ' << status_str(status) << "\r\n"
-           << "Content-Length: " << n << "\r\n"
-           << header << "\r\n";
-    buf->append(s, n);
+    status_line().append(*buf, version, status);
+    buf->append(date_header());
+    buf->append("Content-Length: ", 16) << n;
+    buf->append("\r\n", 2).append(header).append("\r\n", 2);
+}
+
+// The header is sent with the first chunk, Transfer-Encoding instead of
+// Content-Length. HTTP/1.0 and HTTP/2 responses have the chunks buffered in @buf.
+bool http_res_t::write_chunk(const void* s, size_t n) {
+    if (chunked < 0) return false;
+    if (chunked == 0) {
+        chunked = (conn && version == kHTTP11) ? 1 : 2;
+        buf->clear();
+        if (chunked == 1) {
+            if (status == 0) status = 200;
+            status_line().append(*buf, version, status);
+            buf->append(date_header());
+            buf->append("Transfer-Encoding: chunked\r\n", 28);
+            buf->append(header).append("\r\n", 2);
+        }
+    }
+    if (chunked == 2) {
+        buf->append(s, n);
+        return true;
+    }
+
+    if (n > 0) { /* a chunk of size 0 would end the body */
+        char x[24];
+        const int m = snprintf(x, sizeof(x), "%llx\r\n", (unsigned long long)n);
+        buf->append(x, m);
+        body_size += n;
+    }
+    if (buf->empty()) return true;
+
+    // responses of pipelined requests are sent first, the data is not copied
+    auto c = (tcp::Connection*)conn;
+    fastring* const b = (pending && !pending->empty()) ? &pending->append(*buf) : buf;
+    struct iovec v[3];
+    v[0].iov_base = (void*)b->data();
+    v[0].iov_len = b->size();
+    v[1].iov_base = (void*)s;
+    v[1].iov_len = n;
+    v[2].iov_base = (void*)"\r\n";
+    v[2].iov_len = 2;
+    const int r = c->sendv(v, n > 0 ? 3 : 1, FLG_http_send_timeout);
+    b->clear();
+    buf->clear();
+    if (r <= 0) {
+        chunked = -1;
+        return false;
+    }
+    return true;
+}
+
+bool http_res_t::end_chunks() {
+    if (chunked == 2) {
+        fastring b;
+        b.swap(*buf);
+        this->set_body(b.data(), b.size());
+        return true;
+    }
+    if (chunked < 0) return false;
+    const int r = ((tcp::Connection*)conn)->send("0\r\n\r\n", 5, FLG_http_send_timeout);
+    return r > 0;
+}
+
+bool http_res_t::set_file(const char* path, int64_t off, int64_t len) {
+    if (file_len > 0) this->close_file();
+#ifdef _WIN32
+    const int fd = ::_open(path, _O_RDONLY | _O_BINARY);
+    if (fd < 0) return false;
+    struct _stati64 st;
+    const bool ok = ::_fstati64(fd, &st) == 0 && (st.st_mode & _S_IFREG);
+#else
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    const bool ok = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+#endif
+    const int64_t size = (int64_t)st.st_size;
+    if (!ok || off < 0 || off > size) {
+#ifdef _WIN32
+        ::_close(fd);
+#else
+        ::close(fd);
+#endif
+        return false;
+    }
+
+    if (len < 0 || len > size - off) len = size - off;
+    body_size = 0;
+    this->write_header(len);
+    file_fd = fd;
+    file_off = off;
+    file_len = len;
+    if (len == 0) this->close_file();
+    return true;
+}
+
+void http_res_t::close_file() {
+#ifdef _WIN32
+    ::_close(file_fd);
+#else
+    ::close(file_fd);
+#endif
+    file_fd = -1;
+    file_len = 0;
 }
 
 const char* Req::header(const char* key) const { return _p->header(key); }
 
 const char* Req::body() const { return _p->buf->data() + _p->body; }
 
+int http_req_t::read_body(void* s, int n, int ms) {
+    if (n <= 0 || stream_len <= 0) return 0;
+    if (n > stream_len) n = (int)stream_len;
+    if (stream_pos < stream_end) {
+        const size_t x = stream_end - stream_pos;
+        if ((size_t)n > x) n = (int)x;
+        memcpy(s, buf->data() + stream_pos, n);
+        stream_pos += n;
+        stream_len -= n;
+        return n;
+    }
+
+    const int r = ((tcp::Connection*)conn)->recv(s, n, ms < 0 ? FLG_http_recv_timeout : ms);
+    if (r <= 0) {
+        if (r == 0) ELOG << "http client closed the connection before the body ended";
+        return -1;
+    }
+    stream_len -= r;
+    return r;
+}
+
+bool Req::is_body_streamed() const { return _p->stream_size > 0; }
+
+int64_t Req::content_length() const {
+    return _p->stream_size > 0 ? _p->stream_size : (int64_t)_p->body_size;
+}
+
+int Req::read_body(void* s, int n, int ms) const { return _p->read_body(s, n, ms); }
+
+json::Arena& Req::arena() const {
+    if (!_p->arena) _p->arena = new json::Arena();
+    return *_p->arena;
+}
+
+void free_http_req(http_req_t* req) {
+    req->url.~fastring();
+    ::free(req->arr);
+    delete req->arena;
+    ::free(req);
+}
+
+inline void free_http_res(http_res_t* res) {
+    if (res->file_len > 0) res->close_file();
+    res->header.~fastring();
+    ::free(res);
+}
+
+// Objects of connections cached by each thread, a new connection takes them
+// from the cache instead of the heap. Like the buffer pool of the scheduler, the
+// cache keeps at most kMaxNum objects of each kind, and what grew too large is
+// freed before it is put back.
+class conn_cache {
+  public:
+    static const uint32_t kMaxNum = 128;
+    static const size_t kMaxBufSize = 16 * 1024;  // max capacity of a cached buffer
+    static const size_t kMaxStrSize = 4096;       // max capacity of url or header
+    static const uint32_t kMaxArrCap = 192;       // max capacity of the header index
+
+    conn_cache() : _reqs(8), _res(8), _bufs(8) {}
+
+    ~conn_cache() {
+        for (size_t i = 0; i < _reqs.size(); ++i) free_http_req(_reqs[i]);
+        for (size_t i = 0; i < _res.size(); ++i) free_http_res(_res[i]);
+    }
+
+    static conn_cache& get() {
+        static thread_local conn_cache _c;
+        return _c;
+    }
+
+    http_req_t* pop_req() {
+        if (!_reqs.empty()) return _reqs.pop_back();
+        return (http_req_t*)::calloc(1, sizeof(http_req_t));
+    }
+
+    http_res_t* pop_res() {
+        if (!_res.empty()) return _res.pop_back();
+        return (http_res_t*)::calloc(1, sizeof(http_res_t));
+    }
+
+    void push_req(http_req_t* req) {
+        if (_reqs.size() >= kMaxNum) return free_http_req(req);
+        req->clear();
+        if (req->url.capacity() > kMaxStrSize) req->url.reset();
+        if (req->arr_cap > kMaxArrCap) {
+            ::free(req->arr);
+            req->arr = 0;
+            req->arr_cap = 0;
+        }
+        if (req->arena) {
+            delete req->arena;
+            req->arena = 0;
+        }
+        req->method = req->version = req->body = 0;
+        _reqs.push_back(req);
+    }
+
+    void push_res(http_res_t* res) {
+        if (_res.size() >= kMaxNum) return free_http_res(res);
+        res->clear();
+        if (res->header.capacity() > kMaxStrSize) res->header.reset();
+        res->version = 0;
+        _res.push_back(res);
+    }
+
+    // @s is empty, it gets the capacity of a cached buffer if there is one
+    void pop_buf(fastring& s) {
+        if (!_bufs.empty()) s.swap(_bufs.pop_back());
+    }
+
+    void push_buf(fastring& s) {
+        if (s.capacity() == 0 || s.capacity() > kMaxBufSize || _bufs.size() >= kMaxNum) return;
+        s.clear();
+        _bufs.push_back(std::move(s));
+    }
+
+  private:
+    co::vector<http_req_t*> _reqs;
+    co::vector<http_res_t*> _res;
+    co::vector<fastring> _bufs;
+};
+
+http_req_t* new_http_req() { return conn_cache::get().pop_req(); }
+http_res_t* new_http_res() { return conn_cache::get().pop_res(); }
+void recycle_http_req(http_req_t* req) { conn_cache::get().push_req(req); }
+void recycle_http_res(http_res_t* res) { conn_cache::get().push_res(res); }
+
 Req::~Req() {
     if (_p) {
-        _p->url.~fastring();
-        ::free(_p->arr);
-        ::free(_p);
+        recycle_http_req(_p);
         _p = 0;
     }
 }
@@ -537,35 +1218,90 @@ void Res::add_header(const char* k, const char* v) { _p->add_header(k, v); }
 
 void Res::add_header(const char* k, int v) { _p->add_header(k, v); }
 
+void Res::add_header(co::strview k, co::strview v) { _p->add_header(k, v); }
+
 void Res::set_body(const void* s, size_t n) { _p->set_body(s, n); }
 
+bool Res::write_chunk(const void* s, size_t n) { return _p->write_chunk(s, n); }
+
+bool Res::set_file(const char* path, int64_t off, int64_t len) {
+    return _p->set_file(path, off, len);
+}
+
 Res::~Res() {
     if (_p) {
-        _p->header.~fastring();
-        ::free(_p);
+        recycle_http_res(_p);
         _p = 0;
     }
 }
 
 // @x  beginning of http header
+inline uint32_t first_bit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+// find the first @a or @b in [p, e), return e if not found
+//   - 16 bytes are checked at a time with SSE2 on x86 or NEON on arm.
+inline const char* find_either(const char* p, const char* e, char a, char b) {
+#if defined(HTTP_SSE2)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; e - p >= 16; p += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)p);
+        const __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb));
+        const uint32_t r = (uint32_t)_mm_movemask_epi8(m);
+        if (r) return p + first_bit(r);
+    }
+#elif defined(HTTP_NEON)
+    const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+    const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+    for (; e - p >= 16; p += 16) {
+        const uint8x16_t x = vld1q_u8((const uint8_t*)p);
+        const uint8x16_t m = vorrq_u8(vceqq_u8(x, va), vceqq_u8(x, vb));
+        // 4 bits for each byte
+        const uint64_t r =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (r) {
+            const uint32_t lo = (uint32_t)r;
+            return p + ((lo ? first_bit(lo) : 32 + first_bit((uint32_t)(r >> 32))) >> 2);
+        }
+    }
+#endif
+    for (; p < e; ++p) {
+        if (*p == a || *p == b) return p;
+    }
+    return e;
+}
+
 int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req) {
-    fastring& m = *buf;
-    size_t p, k, v;
+    char* const m = (char*)buf->data();
+    const char* const e = m + size;
+    size_t k, v;
+    const char* p;
 
     while (x < size) {
-        p = m.find('\r', x, size - x);  // header end
-        if (p == m.npos || m[p + 1] != '\n') return 400;
-        m[p] = '\0';  // make value null-terminated
+        // the key ends with ':', a line without ':' is invalid
+        p = find_either(m + x, e, ':', '\r');
+        if (p == e || *p != ':') return 400;
 
-        k = x;  // key
-        v = m.find(':', x, p - x);
-        if (v == m.npos) return 400;
+        k = x;
+        v = p - m;
         m[v] = '\0';  // make key null-terminated
         while (m[++v] == ' ')
             ;
+
+        p = (const char*)memchr(m + v, '\r', e - (m + v));  // header end
+        if (p == 0 || p[1] != '\n') return 400;
+        m[p - m] = '\0';  // make value null-terminated
         req->add_header((uint32_t)k, (uint32_t)v);
 
-        x = p + 2;
+        x = p - m + 2;
     }
     return 0;
 }
@@ -583,10 +1319,8 @@ int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
         p = m.find(' ', 0, x);
         if (p == m.npos) return 400;
 
-        auto& s = fastring_cache();
-        s.clear();
-        s.append(m.data(), p).toupper();
-        auto it = mm.find(s);
+        co::small_string s(m.data(), p);
+        auto it = mm.find(s.toupper());
         if (it != mm.end()) {
             req->method = it->second;
         } else {
@@ -627,10 +1361,15 @@ int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
             req->body_size = 0;
             return 0;
         } else {
-            int n = atoi(v);
-            if (n >= 0) {
-                if ((uint32_t)n > FLG_http_max_body_size) return 413;
-                req->body_size = n;
+            int64_t n = -1;
+            if (str::parse_int64(v, strlen(v), n) && n >= 0) {
+                if (FLG_http_stream_body_size > 0 && n > (int64_t)FLG_http_stream_body_size) {
+                    req->body_size = 0;
+                    req->stream_size = req->stream_len = n;  // read by Req::read_body()
+                    return 0;
+                }
+                if ((uint64_t)n > FLG_http_max_body_size) return 413;
+                req->body_size = (uint32_t)n;
                 return 0;
             }
             ELOG << "http parse error, invalid content-length: " << v;
@@ -646,12 +1385,37 @@ class ServerImpl {
 
     void on_req(std::function<void(const Req&, Res&)>&& f) { _on_req = std::move(f); }
 
+    void route(Method m, const char* pattern, Server::Handler&& f) {
+        CHECK(!_started) << "http routes MUST be added before the server started..";
+        CHECK(_router.add(m, pattern, std::move(f))) << "bad or duplicate http route: " << pattern;
+    }
+
+    void cache(uint32_t ttl_ms, uint32_t stale_ms, const char* vary, size_t capacity) {
+        CHECK(!_started) << "http cache MUST be set before the server started..";
+        _cache = std::make_shared<ResponseCache>(ttl_ms, stale_ms, vary, capacity);
+    }
+
+    void websocket(const char* path, Server::WsHandler&& f) {
+        CHECK(!_started) << "websocket MUST be added before the server started..";
+        CHECK(f != nullptr) << "websocket handler not set for " << path;
+        _ws[fastring(path)] = std::move(f);
+    }
+
+    // the websocket handler for the path of @url, or NULL
+    const Server::WsHandler* websocket_handler(const fastring& url) const {
+        const size_t q = url.find('?');
+        auto it = _ws.find(q == url.npos ? url : fastring(url.data(), q));
+        return it != _ws.end() ? &it->second : nullptr;
+    }
+
     void start(const char* ip, int port, const char* key, const char* ca);
 
     void on_connection(tcp::Connection conn);
 
     void exit() {
         _stopped.store(true);
+        if (_idle) _idle->stop();
+        if (_cache) _cache->stop();
         _serv.exit();
     }
 
@@ -660,8 +1424,12 @@ class ServerImpl {
   private:
     std::atomic_bool _started;
     std::atomic_bool _stopped;
+    std::shared_ptr<idle::Tracker> _idle;
+    std::shared_ptr<ResponseCache> _cache;
     tcp::Server _serv;
     std::function<void(const Req&, Res&)> _on_req;
+    Router _router;
+    co::hash_map<fastring, Server::WsHandler> _ws;
 };
 
 Server::Server() { _p = new ServerImpl(); }
@@ -689,11 +1457,44 @@ void Server::start(const char* ip, int port, const char* key, const char* ca) {
 
 void Server::exit() { ((ServerImpl*)_p)->exit(); }
 
+Server& Server::route(Method m, const char* pattern, Handler&& f) {
+    ((ServerImpl*)_p)->route(m, pattern, std::move(f));
+    return *this;
+}
+
+Server& Server::cache(uint32_t ttl_ms, uint32_t stale_ms, const char* vary, size_t capacity) {
+    ((ServerImpl*)_p)->cache(ttl_ms, stale_ms, vary, capacity);
+    return *this;
+}
+
+Server& Server::websocket(const char* path, WsHandler&& f) {
+    ((ServerImpl*)_p)->websocket(path, std::move(f));
+    return *this;
+}
+
 void ServerImpl::start(const char* ip, int port, const char* key, const char* ca) {
+    // requests go to the routes first, then to the callback set by on_req()
+    if (!_router.empty()) {
+        auto f = std::move(_on_req);
+        _on_req = [this, f](const Req& req, Res& res) {
+            const int r = _router.dispatch(req, res);
+            if (r == 404 && f) return f(req, res);
+            if (r != 0) res.set_status(r);
+        };
+    }
     CHECK(_on_req != nullptr) << "req callback not set..";
+
+    // the cache is in front of the routes and on_req()
+    if (_cache) {
+        auto c = _cache;
+        c->set_handler(std::move(_on_req));
+        _on_req = [c](const Req& req, Res& res) { c->serve(req, res); };
+    }
     _started.store(true);
+    _idle = idle::Tracker::start(FLG_http_conn_idle_sec, FLG_http_max_idle_conn);
     _serv.on_connection(&ServerImpl::on_connection, this);
     _serv.on_exit([this]() { delete this; });
+    if (FLG_http2 && key && *key && ca && *ca) _serv.set_alpn("h2,http/1.1");
     _serv.start(ip, port, key, ca);
 }
 
@@ -714,61 +1515,100 @@ void send_error_message(int err, http_res_t* res, void* conn) {
     res->clear();
 }
 
+static co::metrics::histogram g_req_us(
+    "co_http_server_request_us", "time of http requests handled by on_req() in microseconds");
+
+static co::metrics::counter g_res_num[] = {
+    {"co_http_server_responses_total{code=\"2xx\"}", "http responses by status class"},
+    {"co_http_server_responses_total{code=\"3xx\"}", "http responses by status class"},
+    {"co_http_server_responses_total{code=\"4xx\"}", "http responses by status class"},
+    {"co_http_server_responses_total{code=\"5xx\"}", "http responses by status class"},
+};
+
+void record_req(int status, int64_t us) {
+    g_req_us.observe(us > 0 ? (uint64_t)us : 0);
+    const int k = status == 0 ? 0 : status / 100 - 2;  // 200 if not set
+    if (0 <= k && k < 4) g_res_num[k].inc();
+}
+
 void ServerImpl::on_connection(tcp::Connection conn) {
     char c;
     int r = 0;
+    int64_t t = 0;
     size_t pos = 0, total_len = 0;
     fastring buf;
+    fastring s;    // the response, reused by requests on the connection
+    fastring out;  // responses to pipelined requests, not sent yet
+    conn_cache& cache = conn_cache::get();
+    cache.pop_buf(buf);
+    cache.pop_buf(s);
     Req req;
     Res res;
     auto& preq = *(http_req_t**)&req;
     auto& pres = *(http_res_t**)&res;
+    auto tracker = _idle;
+    std::unique_ptr<idle::conn_t> ic(new idle::conn_t());
+
+    // send the pending responses, before we have to wait for the client
+    auto flush = [&]() {
+        if (out.empty()) return true;
+        const int n = conn.send(out.data(), (int)out.size(), FLG_http_send_timeout);
+        out.clear();
+        return n > 0;
+    };
+
+    if (FLG_http2 && strcmp(conn.alpn(), "h2") == 0) {
+        serve_http2(conn, buf, 0, _on_req, _stopped);
+        goto end;
+    }
 
     while (true) {
         { /* recv http header and body */
-        recv_beg:
-            if (buf.capacity() == 0) {
-                // try to recieve a single byte
-                r = conn.recv(&c, 1, FLG_http_conn_idle_sec * 1000);
-                if (r == 0) goto recv_zero_err;
-                if (r < 0) {
-                    if (!co::timeout()) goto recv_err;
+            if (buf.empty()) {
+                // wait for the next request, the idle tracker shuts down the
+                // socket if the connection was idle for too long
+                tracker->add(ic.get(), conn.socket());
+                r = conn.recv(&c, 1, -1);
+                if (!tracker->del(ic.get())) {
                     if (_stopped) {
                         conn.reset();
                         goto end;
                     }  // server stopped
-                    if (_serv.conn_num() > FLG_http_max_idle_conn) goto idle_err;
-                    goto recv_beg;
+                    goto idle_err;
                 }
-                buf.reserve(4096);
+                if (r == 0) goto recv_zero_err;
+                if (r < 0) goto recv_err;
+                if (buf.capacity() == 0) buf.reserve(4096);
                 buf.append(c);
             }
 
-            // recv until the entire http header was done.
-            while ((pos = buf.find("\r\n\r\n")) == buf.npos) {
+            // recv until the entire http header was done. Bytes checked before
+            // will not be scanned again.
+            pos = 0;
+            while ((pos = buf.find("\r\n\r\n", pos)) == buf.npos) {
                 if (buf.size() > FLG_http_max_header_size) goto header_too_long_err;
+                pos = buf.size() > 3 ? buf.size() - 3 : 0;
                 buf.reserve(buf.size() + 1024);
                 r = conn.recv((void*)(buf.data() + buf.size()), (int)(buf.capacity() - buf.size()),
                               FLG_http_recv_timeout);
                 if (r == 0) goto recv_zero_err;
-                if (r < 0) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_serv.conn_num() > FLG_http_max_idle_conn) goto idle_err;
-                    if (buf.empty()) {
-                        buf.reset();
-                        goto recv_beg;
-                    }
-                    goto recv_err;
-                }
+                if (r < 0) goto recv_err;
                 buf.resize(buf.size() + r);
             }
 
+            // HTTP/2 with prior knowledge
+            if (pos == 14 && FLG_http2 && buf.starts_with("PRI * HTTP/2.0\r\n\r\n", 18)) {
+                if (!flush()) goto send_err;
+                serve_http2(conn, buf, 0, _on_req, _stopped);
+                goto end;
+            }
+
             buf[pos + 2] = '\0';  // make header null-terminated
             HTTPLOG << "http recv req: " << buf.data();
 
             // parse http header
-            if (preq == 0) preq = (http_req_t*)::calloc(1, sizeof(http_req_t));
-            if (pres == 0) pres = (http_res_t*)::calloc(1, sizeof(http_res_t));
+            if (preq == 0) preq = cache.pop_req();
+            if (pres == 0) pres = cache.pop_res();
 
             r = parse_http_req(&buf, pos + 2, preq);
             if (r != 0) { /* parse error */
@@ -776,13 +1616,31 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 goto parse_err;
             } else {
                 pres->version = preq->version;
+                pres->accept_gzip =
+                    FLG_http_compress_size > 0 && accepts_gzip(preq->header("Accept-Encoding"));
+                pres->req = preq;
             }
 
             // try to recv the remain part of http body
             preq->body = (uint32_t)(pos + 4);  // beginning of http body
-            if (preq->body_size > 0) {
+            if (preq->stream_len > 0) { /* the body will be read in on_req() */
+                const size_t n = buf.size() - (pos + 4);
+                preq->stream_pos = pos + 4;
+                preq->stream_end =
+                    pos + 4 + ((int64_t)n < preq->stream_len ? n : (size_t)preq->stream_len);
+                preq->conn = &conn;
+                total_len = preq->stream_end;
+                if (!flush()) goto send_err;
+                if (preq->stream_end - preq->stream_pos < (size_t)preq->stream_len &&
+                    strcmp(preq->header("Expect"), "100-continue") == 0) {
+                    send_error_message(100, pres, &conn);
+                }
+                goto handle_req;
+
+            } else if (preq->body_size > 0) {
                 total_len = pos + 4 + preq->body_size;
                 if (buf.size() < total_len) {
+                    if (!flush()) goto send_err;
                     buf.reserve(total_len);
                     r = conn.recvn((void*)(buf.data() + buf.size()), (int)(total_len - buf.size()),
                                    FLG_http_recv_timeout);
@@ -798,6 +1656,7 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                     total_len = pos + 4;
                     goto handle_req;  // no Transfer-Encoding
                 }
+                if (!flush()) goto send_err;
                 if (strcmp(te, "chunked") != 0) { /* Transfer-Encoding is not "chunked" */
                     send_error_message(501, pres, &conn);
                     goto reset_conn;
@@ -893,7 +1752,8 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
     handle_req : { /* handle the http request */
         bool need_close = false;
-        fastring s(4096);
+        if (s.capacity() == 0) s.reserve(4096);
+        s.clear();
         s.append(preq->header("Connection"));
         if (!s.empty()) pres->add_header("Connection", s.c_str());
 
@@ -903,16 +1763,88 @@ void ServerImpl::on_connection(tcp::Connection conn) {
             if (s.empty() || s.tolower() != "keep-alive") need_close = true;
         }
 
+        // upgrade to WebSocket, the connection is served by the handler until it returns
+        if (!_ws.empty() && preq->method == kGet && preq->stream_len == 0 &&
+            *preq->header("Upgrade")) {
+            const Server::WsHandler* const f = this->websocket_handler(preq->url);
+            if (f) {
+                if (!flush()) goto send_err;
+                fastring rest(buf.data() + total_len, buf.size() - total_len);
+                if (!serve_websocket(conn, req, rest, *f)) {
+                    send_error_message(400, pres, &conn);
+                    goto reset_conn;
+                }
+                goto end;
+            }
+        }
+
+        // upgrade to HTTP/2, the request will be served on stream 1
+        if (FLG_http2 && preq->version == kHTTP11 && preq->stream_len == 0 &&
+            strcmp(preq->header("Upgrade"), "h2c") == 0 && *preq->header("HTTP2-Settings")) {
+            if (!flush()) goto send_err;
+            static const char x[] =
+                "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            r = conn.send(x, sizeof(x) - 1, FLG_http_send_timeout);
+            if (r <= 0) goto send_err;
+            fastring rest(buf.data() + total_len, buf.size() - total_len);
+            buf.resize(total_len);
+            http_req_t* const up = preq;
+            preq = 0;
+            serve_http2(conn, rest, up, _on_req, _stopped);
+            goto end;
+        }
+
         s.clear();
         pres->buf = &s;
+        pres->conn = &conn;
+        pres->pending = &out;
+        CO_PROBE3(http_begin, preq->url.data(), preq->url.size(), (int)preq->method);
+        t = now::us();
         _on_req(req, res);
-        if (s.empty()) pres->set_body("", 0);
+        record_req(pres->status, now::us() - t);
+        CO_PROBE3(http_end, preq->url.data(), preq->url.size(), (int)pres->status);
+        const int chunked = pres->chunked;
+        if (chunked != 0 && !pres->end_chunks()) goto send_err;
+        if (s.empty() && chunked != 1) pres->set_body("", 0);
+
+        if (preq->stream_len > 0) { /* discard the rest of the streamed body */
+            if (preq->stream_len > (1 << 20)) {
+                need_close = true;
+            } else {
+                char x[1024];
+                while ((r = preq->read_body(x, sizeof(x), FLG_http_recv_timeout)) > 0);
+                if (r < 0) need_close = true;
+            }
+        }
 
-        r = conn.send(s.data(), (int)s.size(), FLG_http_send_timeout);
-        if (r <= 0) goto send_err;
+        // If the next request is already in the buffer, the response is delayed and
+        // sent together with the following ones.
+        if (chunked == 1) { /* sent by write_chunk() already */
+            HTTPLOG << "http send chunked res, status: " << pres->status
+                    << ", body size: " << pres->body_size;
+        } else if (!need_close && pres->file_len == 0 && buf.size() > total_len &&
+                   buf.find("\r\n\r\n", total_len) != buf.npos &&
+                   out.size() + s.size() <= 65536) {
+            out.append(s);
+        } else if (out.empty()) {
+            r = conn.send(s.data(), (int)s.size(), FLG_http_send_timeout);
+            if (r <= 0) goto send_err;
+        } else {
+            out.append(s);
+            if (!flush()) goto send_err;
+        }
 
-        s.resize(s.size() - pres->body_size);
-        HTTPLOG << "http send res: " << s;
+        if (pres->file_len > 0) {
+            const int64_t n = pres->file_len;
+            const int64_t x = conn.sendfile(pres->file_fd, pres->file_off, n, FLG_http_send_timeout);
+            pres->close_file();
+            if (x != n) goto send_err;
+        }
+
+        if (chunked != 1) {
+            s.resize(s.size() - pres->body_size);
+            HTTPLOG << "http send res: " << s;
+        }
         if (need_close) {
             conn.close();
             goto end;
@@ -927,8 +1859,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
         preq->clear();
         pres->clear();
+        if (s.capacity() > (1 << 20)) s.reset();  // do not keep a large buffer
         total_len = 0;
-        if (_stopped) goto reset_conn;
+        if (_stopped) {
+            flush();
+            goto reset_conn;
+        }
     }
 
 recv_zero_err:
@@ -949,6 +1885,7 @@ body_too_long_err:
     goto reset_conn;
 parse_err:
     ELOG << "http parse error: " << r;
+    if (!flush()) goto send_err;
     send_error_message(r, pres, &conn);
     goto reset_conn;
 recv_err:
@@ -963,9 +1900,51 @@ chunk_err:
 reset_conn:
     conn.reset(3000);
 end:
+    cache.push_buf(buf);
+    cache.push_buf(s);
     return;
 }
 
+bool serve_metrics(const Req& req, Res& res) {
+    const fastring& url = req.url();
+    const size_t n = sizeof("/metrics") - 1;
+    if (!url.starts_with("/metrics", n)) return false;
+    if (url.size() > n && url[n] != '?') return false;
+    res.set_status(200);
+    res.add_header("Content-Type", "text/plain; version=0.0.4");
+    res.set_body(co::metrics::text());
+    return true;
+}
+
+bool serve_pprof(const Req& req, Res& res) {
+    const fastring& url = req.url();
+    const size_t n = sizeof("/debug/pprof/profile") - 1;
+    if (!url.starts_with("/debug/pprof/profile", n)) return false;
+    if (url.size() > n && url[n] != '?') return false;
+
+    uint32_t sec = 30;
+    const size_t p = url.find("seconds=");
+    if (p != url.npos) {
+        uint32_t x = 0;
+        for (size_t i = p + 8; i < url.size() && '0' <= url[i] && url[i] <= '9'; ++i) {
+            if (x < 3600) x = x * 10 + (url[i] - '0');
+        }
+        if (x > 0) sec = x < 3600 ? x : 3600;
+    }
+
+    const fastring s = co::cpu_profile(sec * 1000);
+    if (s.empty()) {
+        res.set_status(503);
+        res.set_body("cpu profile not available, maybe another one is in progress");
+        return true;
+    }
+    res.set_status(200);
+    res.add_header("Content-Type", "application/octet-stream");
+    res.add_header("Content-Disposition", "attachment; filename=\"profile\"");
+    res.set_body(s);
+    return true;
+}
+
 }  // namespace http
 
 namespace so {
@@ -1008,6 +1987,13 @@ void easy(const char* root_dir, const char* ip, int port, const char* key, const
             }
         }
 
+        // large files are sent with sendfile, without being cached
+        if (fs::fsize(path) > (1 << 20)) {
+            res.set_status(200);
+            if (!res.set_file(path.c_str())) res.set_status(404);
+            return;
+        }
+
         fs::file f(path.c_str(), 'r');
         if (!f) {
             res.set_status(404);
@@ -1,6 +1,16 @@
 #pragma once
 
+#include <string.h>
+
+#include <atomic>
+#include <functional>
+
 #include "co/fastring.h"
+#include "co/json.h"
+
+namespace tcp {
+class Connection;
+}  // namespace tcp
 
 namespace http {
 
@@ -10,12 +20,18 @@ struct http_req_t {
 
     void add_header(uint32_t k, uint32_t v);
     const char* header(const char* key) const;
+    int read_body(void* s, int n, int ms);
 
     void clear() {
         body_size = 0;
         url.clear();
         buf = 0;
         arr_size = 0;
+        memset(slots, 0, sizeof(slots));
+        stream_size = stream_len = 0;
+        stream_pos = stream_end = 0;
+        conn = 0;
+        if (arena) arena->clear();
     }
 
     // DO NOT change orders of the members here.
@@ -25,11 +41,30 @@ struct http_req_t {
     uint32_t body_size;
     fastring url;
     fastring* buf;  // http data: | header | \r\n\r\n | body |
-    uint32_t* arr;  // array of header index: [<k,v>]
+    uint32_t* arr;  // array of header index: [<hash,k,v>], keys are upper case
     uint32_t arr_size;
     uint32_t arr_cap;
+    uint32_t slots[8];  // value index of the common headers, 0 if not present
+    int64_t stream_size;  // length of a streamed body
+    int64_t stream_len;   // bytes of the streamed body that are not read yet
+    size_t stream_pos;    // the buffered part of the streamed body:
+    size_t stream_end;    //   [buf->data() + stream_pos, buf->data() + stream_end)
+    void* conn;
+    json::Arena* arena;  // for documents of the request, created by Req::arena()
 };
 
+// free a request allocated with calloc, and what it owns
+void free_http_req(http_req_t* req);
+
+// Requests and responses are cached by each thread, new_*() takes a cleared one
+// from the cache of the current thread, or callocs a new one if it is empty.
+// recycle_*() puts it back, it is freed if the cache is full.
+struct http_res_t;
+http_req_t* new_http_req();
+http_res_t* new_http_res();
+void recycle_http_req(http_req_t* req);
+void recycle_http_res(http_res_t* res);
+
 struct http_res_t {
     http_res_t() = delete;
     ~http_res_t() = delete;
@@ -44,13 +79,35 @@ struct http_res_t {
         header << k << ": " << v << "\r\n";
     }
 
+    void add_header(co::strview k, co::strview v) {
+        if (header.capacity() == 0) header.reserve(128);
+        header << k << ": " << v << "\r\n";
+    }
+
     void set_body(const void* s, size_t n);
+    void write_header(int64_t content_length);
+
+    bool set_file(const char* path, int64_t off, int64_t len);
+    void close_file();
+
+    // send a chunk of the body, or buffer it if the response can't be streamed
+    bool write_chunk(const void* s, size_t n);
+
+    // called after on_req(), end the chunks sent, or set the chunks buffered as
+    // the body, return false on send error
+    bool end_chunks();
 
     void clear() {
         status = 0;
         buf = 0;
         header.clear();
         body_size = 0;
+        if (file_len > 0) this->close_file();
+        accept_gzip = false;
+        req = 0;
+        chunked = 0;
+        conn = 0;
+        pending = 0;
     }
 
     // DO NOT change orders of the members here.
@@ -59,9 +116,44 @@ struct http_res_t {
     fastring* buf;
     fastring header;
     size_t body_size;
+    int file_fd;  // valid only if file_len > 0
+    int64_t file_off;
+    int64_t file_len;
+    bool accept_gzip;  // the client accepts gzip, see FLG_http_compress_size
+    int chunked;       // 0: no chunk, 1: chunks sent, 2: chunks buffered, -1: send error
+    void* conn;        // the tcp::Connection of HTTP/1.1, chunks are buffered without it
+    fastring* pending; // responses of pipelined requests, sent before the chunks
+    const http_req_t* req;  // the request, set with accept_gzip
 };
 
+// check whether "Accept-Encoding: @v" accepts gzip
+bool accepts_gzip(const char* v);
+
 int parse_http_req(fastring* buf, size_t size, http_req_t* req);
+int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req);
 void send_error_message(int err, http_res_t* res, void* conn);
+const fastring& date_header();
+
+class Req;
+class Res;
+class WebSocket;
+
+// record a request handled by on_req() in metrics of the server, @us is the
+// time it took.
+void record_req(int status, int64_t us);
+
+// Serve a HTTP/2 connection until it is closed, @buf holds data already received.
+//   - The connection is moved to the HTTP/2 session.
+//   - @upgraded is the request upgraded from HTTP/1.1 with "Upgrade: h2c", or NULL.
+//     It is owned by the session then, and its buffer is moved too.
+void serve_http2(tcp::Connection& conn, fastring& buf, http_req_t* upgraded,
+                 const std::function<void(const Req&, Res&)>& cb, const std::atomic_bool& stopped);
+
+// Upgrade the connection to WebSocket and run @f on it until it returns, @rest
+// holds data received after the request.
+//   - The connection is moved and closed, unless @req is not a valid handshake.
+//     false is returned then, and nothing is sent.
+bool serve_websocket(tcp::Connection& conn, const Req& req, fastring& rest,
+                     const std::function<void(const Req&, WebSocket&)>& f);
 
 }  // namespace http
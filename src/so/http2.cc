@@ -0,0 +1,1194 @@
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "./http.h"
+#include "../co/probe.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/hash.h"
+#include "co/http.h"
+#include "co/log.h"
+#include "co/stl.h"
+#include "co/tcp.h"
+#include "co/time.h"
+
+DEC_uint32(http_max_header_size);
+DEC_uint32(http_max_body_size);
+DEC_uint32(http_send_timeout);
+DEC_uint32(http_conn_idle_sec);
+DEC_uint32(http_compress_size);
+DEC_bool(http_log);
+
+DEF_uint32(http2_max_streams, 128, ">>#2 max concurrent streams of a HTTP/2 connection");
+DEF_uint32(http2_window_size, 1 << 20, ">>#2 initial flow-control window size of HTTP/2 streams");
+
+#define HTTPLOG LOG_IF(FLG_http_log)
+
+namespace http {
+namespace h2 {
+
+enum frame_type_t {
+    kData = 0,
+    kHeaders = 1,
+    kPriority = 2,
+    kRstStream = 3,
+    kSettings = 4,
+    kPushPromise = 5,
+    kPing = 6,
+    kGoaway = 7,
+    kWindowUpdate = 8,
+    kContinuation = 9,
+};
+
+enum frame_flag_t {
+    kEndStream = 0x01,
+    kAck = 0x01,
+    kEndHeaders = 0x04,
+    kPadded = 0x08,
+    kPriorityFlag = 0x20,
+};
+
+enum error_code_t {
+    kNoError = 0,
+    kProtocolError = 1,
+    kInternalError = 2,
+    kFlowControlError = 3,
+    kStreamClosed = 5,
+    kFrameSizeError = 6,
+    kRefusedStream = 7,
+    kCancel = 8,
+    kCompressionError = 9,
+    kEnhanceYourCalm = 11,
+};
+
+enum settings_t {
+    kHeaderTableSize = 1,
+    kEnablePush = 2,
+    kMaxConcurrentStreams = 3,
+    kInitialWindowSize = 4,
+    kMaxFrameSize = 5,
+};
+
+static const char g_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const uint32_t kFrameSize = 16384;   // max frame size we accept
+static const int64_t kMaxWindow = 0x7fffffff;
+static const int64_t kConnWindow = 16 << 20;  // receive window of a connection
+
+/**
+ * ===========================================================================
+ * HPACK, see https://datatracker.ietf.org/doc/html/rfc7541
+ * ===========================================================================
+ */
+
+static const struct {
+    const char* name;
+    const char* value;
+} g_static[] = {
+    {"", ""},
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const uint32_t kStaticSize = sizeof(g_static) / sizeof(g_static[0]) - 1;
+
+// code lengths of the canonical huffman code, the last one is EOS
+static const uint8_t g_huff_len[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28,
+    30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6,  10, 10, 12, 13, 6,  8,  11, 10, 10, 8,  11,
+    8,  6,  6,  6,  5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8,  15, 6,  12, 10, 13, 6,
+    7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+    8,  7,  8,  13, 19, 13, 14, 6,  15, 5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,
+    6,  5,  6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7,  15, 11, 14, 13, 28, 20, 22, 20, 20,
+    22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23, 23, 23, 21,
+    22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23,
+    22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26,
+    28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27,
+    26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30,
+};
+
+// decoder of the canonical huffman code, it decodes one bit at a time
+class huffman {
+  public:
+    huffman() {
+        memset(_count, 0, sizeof(_count));
+        for (int i = 0; i < 257; ++i) ++_count[g_huff_len[i]];
+
+        uint32_t code = 0, k = 0;
+        for (int len = 1; len <= 30; ++len) {
+            _first[len] = code;
+            _offset[len] = k;
+            k += _count[len];
+            code = (code + _count[len]) << 1;
+        }
+
+        uint32_t n[31];
+        memcpy(n, _offset, sizeof(n));
+        for (int len = 1; len <= 30; ++len) {
+            for (int i = 0; i < 257; ++i) {
+                if (g_huff_len[i] == len) _sym[n[len]++] = (uint16_t)i;
+            }
+        }
+    }
+
+    bool decode(const uint8_t* p, size_t n, fastring& s) const {
+        uint32_t code = 0, len = 0;
+        for (size_t i = 0; i < n; ++i) {
+            for (int b = 7; b >= 0; --b) {
+                code = (code << 1) | ((p[i] >> b) & 1);
+                if (++len > 30) return false;
+                const uint32_t x = code - _first[len];
+                if (x < _count[len]) {
+                    const uint16_t c = _sym[_offset[len] + x];
+                    if (c == 256) return false;  // EOS
+                    s.append((char)c);
+                    code = len = 0;
+                }
+            }
+        }
+        // padding: at most 7 bits of 1
+        return len <= 7 && code == (1u << len) - 1;
+    }
+
+  private:
+    uint32_t _count[31];
+    uint32_t _first[31];
+    uint32_t _offset[31];
+    uint16_t _sym[257];
+};
+
+inline const huffman& huff() {
+    static huffman _h;
+    return _h;
+}
+
+inline bool read_int(const uint8_t*& p, const uint8_t* e, int prefix, uint32_t& v) {
+    const uint32_t m = (1u << prefix) - 1;
+    v = *p++ & m;
+    if (v < m) return true;
+    for (int s = 0; s < 28; s += 7) {
+        if (p == e) return false;
+        const uint8_t b = *p++;
+        v += (uint32_t)(b & 0x7f) << s;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline bool read_str(const uint8_t*& p, const uint8_t* e, fastring& s) {
+    if (p == e) return false;
+    const bool h = (*p & 0x80) != 0;
+    uint32_t n;
+    if (!read_int(p, e, 7, n) || (uint32_t)(e - p) < n) return false;
+    s.clear();
+    if (h) {
+        if (!huff().decode(p, n, s)) return false;
+    } else {
+        s.append(p, n);
+    }
+    p += n;
+    return true;
+}
+
+inline void put_int(fastring& s, uint8_t x, int prefix, uint32_t v) {
+    const uint32_t m = (1u << prefix) - 1;
+    if (v < m) {
+        s.append((char)(x | v));
+        return;
+    }
+    s.append((char)(x | m));
+    for (v -= m; v >= 128; v >>= 7) s.append((char)((v & 0x7f) | 0x80));
+    s.append((char)v);
+}
+
+inline void put_str(fastring& s, const char* p, size_t n) {
+    put_int(s, 0, 7, (uint32_t)n);
+    s.append(p, n);
+}
+
+// literal header field without indexing, the name is indexed if it is in the static table
+inline void put_header(fastring& s, const char* k, size_t kn, const char* v, size_t vn) {
+    for (uint32_t i = 1; i <= kStaticSize; ++i) {
+        if (strlen(g_static[i].name) == kn && memcmp(g_static[i].name, k, kn) == 0) {
+            put_int(s, 0, 4, i);
+            put_str(s, v, vn);
+            return;
+        }
+    }
+    s.append('\0');
+    put_str(s, k, kn);
+    put_str(s, v, vn);
+}
+
+class hpack_decoder {
+  public:
+    hpack_decoder() : _size(0), _max(4096) {}
+
+    // decode a header block, @f(name, value) will be called for each header field
+    template <typename F>
+    bool decode(const uint8_t* p, size_t n, F&& f) {
+        const uint8_t* const e = p + n;
+        uint32_t x;
+        fastring k, v;
+        while (p < e) {
+            const uint8_t c = *p;
+            if (c & 0x80) { /* indexed header field */
+                if (!read_int(p, e, 7, x) || !this->get(x, &k, &v)) return false;
+            } else if ((c & 0xe0) == 0x20) { /* dynamic table size update */
+                if (!read_int(p, e, 5, x) || x > 4096) return false;
+                _max = x;
+                this->evict(0);
+                continue;
+            } else { /* literal header field */
+                const bool index = (c & 0xc0) == 0x40;
+                if (!read_int(p, e, index ? 6 : 4, x)) return false;
+                if (x == 0) {
+                    if (!read_str(p, e, k)) return false;
+                } else if (!this->get(x, &k, 0)) {
+                    return false;
+                }
+                if (!read_str(p, e, v)) return false;
+                if (index) this->add(k, v);
+            }
+            if (!f(k, v)) return false;
+        }
+        return true;
+    }
+
+  private:
+    bool get(uint32_t i, fastring* k, fastring* v) const {
+        if (i == 0) return false;
+        if (i <= kStaticSize) {
+            *k = g_static[i].name;
+            if (v) *v = g_static[i].value;
+            return true;
+        }
+        i -= kStaticSize + 1;
+        if (i >= _tab.size()) return false;
+        *k = _tab[i].first;
+        if (v) *v = _tab[i].second;
+        return true;
+    }
+
+    void add(const fastring& k, const fastring& v) {
+        const size_t n = k.size() + v.size() + 32;
+        this->evict(n);
+        if (n > _max) return;  // the table is emptied
+        _tab.push_front(std::make_pair(k, v));
+        _size += n;
+    }
+
+    // evict entries until there is room for @n bytes
+    void evict(size_t n) {
+        while (!_tab.empty() && _size + n > _max) {
+            auto& x = _tab.back();
+            _size -= x.first.size() + x.second.size() + 32;
+            _tab.pop_back();
+        }
+    }
+
+    co::deque<std::pair<fastring, fastring>> _tab;  // the newest is at the front
+    size_t _size;
+    size_t _max;
+};
+
+/**
+ * ===========================================================================
+ * HTTP/2 connection
+ * ===========================================================================
+ */
+
+inline void put_frame(fastring& s, uint32_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    char b[9] = {
+        (char)(len >> 16), (char)(len >> 8), (char)len,       (char)type,     (char)flags,
+        (char)(id >> 24),  (char)(id >> 16), (char)(id >> 8), (char)id,
+    };
+    s.append(b, 9);
+}
+
+inline uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline void put_u32(fastring& s, uint32_t v) {
+    char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+    s.append(b, 4);
+}
+
+struct stream_t {
+    explicit stream_t(uint32_t id)
+        : id(id),
+          state(0),
+          status(0),
+          hlen(0),
+          unacked(0),
+          send_window(0),
+          body_pos(0),
+          file_fd(-1),
+          file_off(0),
+          file_len(0),
+          upreq(0) {}
+
+    ~stream_t() {
+        if (upreq) free_http_req(upreq);
+        if (file_fd >= 0) {
+#ifdef _WIN32
+            ::_close(file_fd);
+#else
+            ::close(file_fd);
+#endif
+        }
+    }
+
+    enum {
+        kHeadersDone = 1,  // the request header was received
+        kRemoteEnd = 2,    // the client will not send more data
+        kHandling = 4,     // the request is being handled in a coroutine
+        kResReady = 8,     // the response is ready to be sent
+        kHeaderSent = 16,  // the response header was sent
+        kReset = 32,       // the stream was reset by either side
+    };
+
+    uint32_t id;
+    uint32_t state;
+    uint32_t status;  // if not 0, the request will not be passed to the user
+    uint32_t hlen;    // header length of the request in @buf
+    int64_t unacked;  // bytes of data received, but not acknowledged with WINDOW_UPDATE
+    int64_t send_window;
+    fastring buf;     // the request in HTTP/1.1 format, and then the response body
+    fastring hblock;  // header block of the request, or the response
+    size_t body_pos;  // position of the response body in @buf
+    int file_fd;
+    int64_t file_off;
+    int64_t file_len;
+    http_req_t* upreq;  // request upgraded from HTTP/1.1, owned by the stream
+};
+
+class session {
+  public:
+    session(tcp::Connection& conn, const std::function<void(const Req&, Res&)>& cb,
+            const std::atomic_bool& stopped)
+        : _conn(std::move(conn)),
+          _cb(cb),
+          _stopped(stopped),
+          _pos(0),
+          _last_id(0),
+          _cont_id(0),
+          _nstream(0),
+          _send_window(65535),
+          _init_window(65535),
+          _unacked(0),
+          _max_frame(kFrameSize),
+          _closing(false),
+          _dead(false),
+          _goaway(false),
+          _ev(false, false) {}
+
+    ~session() {
+        for (auto& x : _streams) delete x.second;
+    }
+
+    void run(fastring& buf, http_req_t* upgraded, const fastring& settings);
+
+  private:
+    bool recv(size_t n);
+    bool on_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t n);
+    bool on_headers(stream_t* st, uint8_t flags, const uint8_t* p, uint32_t n);
+    bool on_data(uint32_t id, uint8_t flags, const uint8_t* p, uint32_t n);
+    bool on_settings(const uint8_t* p, uint32_t n);
+    bool decode_headers(stream_t* st);
+    void dispatch(stream_t* st);
+    void handle(stream_t* st);
+    void writer();
+    void fill(fastring& out);
+    void remove(stream_t* st);
+    void reset(stream_t* st, uint32_t err);
+    void goaway(uint32_t err);
+
+    void signal() { _ev.signal(); }
+
+  private:
+    tcp::Connection _conn;
+    const std::function<void(const Req&, Res&)>& _cb;
+    const std::atomic_bool& _stopped;
+    fastring _in;
+    size_t _pos;                                // data before it in _in were processed
+    fastring _ctl;                              // control frames to be sent
+    co::hash_map<uint32_t, stream_t*> _streams;
+    co::deque<stream_t*> _ready;  // streams with responses to be sent
+    hpack_decoder _dec;
+    uint32_t _last_id;  // the last stream created by the client
+    uint32_t _cont_id;  // the stream expecting CONTINUATION frames
+    uint32_t _nstream;
+    int64_t _send_window;
+    int64_t _init_window;
+    int64_t _unacked;
+    uint32_t _max_frame;  // max frame size accepted by the client
+    bool _closing;
+    bool _dead;
+    bool _goaway;
+    co::event _ev;
+    co::wait_group _wg;
+};
+
+bool session::recv(size_t n) {
+    if (_in.size() - _pos >= n) return true;
+    if (_pos > 0) {
+        _in.trim(_pos, 'l');
+        _pos = 0;
+    }
+
+    while (_in.size() < n) {
+        _in.reserve(n > 8192 ? n : 8192);
+        const int r = _conn.recv((void*)(_in.data() + _in.size()), (int)(_in.capacity() - _in.size()),
+                                  FLG_http_conn_idle_sec * 1000);
+        if (r == 0) {
+            LOG << "http2 client close the connection: " << co::peer(_conn.socket());
+            return false;
+        }
+        if (r < 0) {
+            if (!co::timeout()) {
+                ELOG << "http2 recv error: " << _conn.strerror();
+                return false;
+            }
+            if (_streams.empty() || _stopped) {
+                LOG << "http2 close idle connection: " << co::peer(_conn.socket());
+                this->goaway(kNoError);
+                return false;
+            }
+            continue;
+        }
+        _in.resize(_in.size() + r);
+    }
+    return true;
+}
+
+void session::run(fastring& buf, http_req_t* upgraded, const fastring& settings) {
+    _in.swap(buf);
+
+    // our settings, and a larger window for the connection
+    const uint32_t window = FLG_http2_window_size < kMaxWindow ? FLG_http2_window_size : kMaxWindow;
+    put_frame(_ctl, 12, kSettings, 0, 0);
+    _ctl.append("\x00\x03", 2);
+    put_u32(_ctl, FLG_http2_max_streams);
+    _ctl.append("\x00\x04", 2);
+    put_u32(_ctl, window);
+    put_frame(_ctl, 4, kWindowUpdate, 0, 0);
+    put_u32(_ctl, (uint32_t)(kConnWindow - 65535));
+
+    _wg.add(1);
+    co::sched()->go(&session::writer, this);
+
+    if (!settings.empty() && !this->on_settings((const uint8_t*)settings.data(), (uint32_t)settings.size())) {
+        goto end;
+    }
+
+    if (upgraded) { /* the upgraded request is on stream 1 */
+        stream_t* st = new stream_t(1);
+        st->state = stream_t::kHeadersDone | stream_t::kRemoteEnd;
+        st->send_window = _init_window;
+        st->buf.swap(*upgraded->buf);
+        upgraded->buf = &st->buf;
+        st->upreq = upgraded;
+        _streams[1] = st;
+        _last_id = 1;
+        ++_nstream;
+        this->dispatch(st);
+    }
+
+    if (!this->recv(24)) goto end;
+    if (memcmp(_in.data(), g_preface, 24) != 0) {
+        ELOG << "http2 invalid connection preface";
+        this->goaway(kProtocolError);
+        goto end;
+    }
+    _pos = 24;
+
+    while (true) {
+        if (!this->recv(9)) break;
+        const uint8_t* h = (const uint8_t*)_in.data() + _pos;
+        const uint32_t len = ((uint32_t)h[0] << 16) | ((uint32_t)h[1] << 8) | h[2];
+        const uint8_t type = h[3], flags = h[4];
+        const uint32_t id = get_u32(h + 5) & 0x7fffffff;
+        if (len > kFrameSize) {
+            ELOG << "http2 frame too large: " << len;
+            this->goaway(kFrameSizeError);
+            break;
+        }
+        if (!this->recv(9 + len)) break;
+        _pos += 9;
+        const uint8_t* p = (const uint8_t*)_in.data() + _pos;
+        _pos += len;
+        if (!this->on_frame(type, flags, id, p, len)) break;
+        if (!_ctl.empty()) this->signal();
+    }
+
+end:
+    _closing = true;
+    this->signal();
+    _wg.wait();
+    _conn.close();
+}
+
+bool session::on_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t n) {
+    if (_cont_id != 0 && (type != kContinuation || id != _cont_id)) {
+        ELOG << "http2 CONTINUATION expected on stream " << _cont_id;
+        this->goaway(kProtocolError);
+        return false;
+    }
+
+    switch (type) {
+        case kData:
+            return this->on_data(id, flags, p, n);
+
+        case kHeaders: {
+            if (id == 0 || !(id & 1)) goto protocol_err;
+            auto it = _streams.find(id);
+            stream_t* st = it != _streams.end() ? it->second : 0;
+            if (st == 0) {
+                if (id <= _last_id) goto stream_closed;  // the stream was closed
+                _last_id = id;
+                st = new stream_t(id);
+                st->send_window = _init_window;
+                _streams[id] = st;
+                if (++_nstream > FLG_http2_max_streams) {
+                    st->status = 503;
+                    this->reset(st, kRefusedStream);
+                }
+            } else if (st->state & stream_t::kRemoteEnd) {
+                goto stream_closed;
+            }
+
+            if (flags & kPadded) {
+                if (n < 1 || p[0] >= n) goto protocol_err;
+                n -= p[0] + 1;
+                ++p;
+            }
+            if (flags & kPriorityFlag) {
+                if (n < 5) goto protocol_err;
+                p += 5;
+                n -= 5;
+            }
+            if (flags & kEndStream) st->state |= stream_t::kRemoteEnd;
+            return this->on_headers(st, flags, p, n);
+        }
+
+        case kContinuation: {
+            auto it = _streams.find(id);
+            if (_cont_id == 0 || it == _streams.end()) goto protocol_err;
+            return this->on_headers(it->second, flags, p, n);
+        }
+
+        case kPriority:
+            if (n != 5) goto frame_size_err;
+            return true;
+
+        case kRstStream: {
+            if (n != 4 || id == 0) goto protocol_err;
+            auto it = _streams.find(id);
+            if (it != _streams.end()) {
+                stream_t* st = it->second;
+                st->state |= stream_t::kReset;
+                if (!(st->state & (stream_t::kHandling | stream_t::kResReady))) this->remove(st);
+                this->signal();
+            }
+            return true;
+        }
+
+        case kSettings:
+            if (id != 0) goto protocol_err;
+            if (flags & kAck) return true;
+            if (n % 6 != 0) goto frame_size_err;
+            if (!this->on_settings(p, n)) return false;
+            put_frame(_ctl, 0, kSettings, kAck, 0);
+            return true;
+
+        case kPing:
+            if (id != 0) goto protocol_err;
+            if (n != 8) goto frame_size_err;
+            if (!(flags & kAck)) {
+                put_frame(_ctl, 8, kPing, kAck, 0);
+                _ctl.append(p, 8);
+            }
+            return true;
+
+        case kGoaway:
+            // requests in progress are still served, the client closes the connection later
+            _goaway = true;
+            return true;
+
+        case kWindowUpdate: {
+            if (n != 4) goto frame_size_err;
+            const uint32_t x = get_u32(p) & 0x7fffffff;
+            if (id == 0) {
+                if (x == 0) goto protocol_err;
+                _send_window += x;
+                if (_send_window > kMaxWindow) {
+                    this->goaway(kFlowControlError);
+                    return false;
+                }
+            } else {
+                auto it = _streams.find(id);
+                if (it == _streams.end()) return true;
+                stream_t* st = it->second;
+                st->send_window += x;
+                if (x == 0 || st->send_window > kMaxWindow) this->reset(st, kFlowControlError);
+            }
+            this->signal();
+            return true;
+        }
+
+        case kPushPromise:
+            goto protocol_err;
+
+        default:
+            return true;  // unknown frames are ignored
+    }
+
+protocol_err:
+    ELOG << "http2 protocol error, frame type: " << (int)type << ", stream: " << id;
+    this->goaway(kProtocolError);
+    return false;
+frame_size_err:
+    ELOG << "http2 invalid frame size, frame type: " << (int)type << ", size: " << n;
+    this->goaway(kFrameSizeError);
+    return false;
+stream_closed:
+    ELOG << "http2 frame on closed stream: " << id;
+    this->goaway(kStreamClosed);
+    return false;
+}
+
+bool session::on_headers(stream_t* st, uint8_t flags, const uint8_t* p, uint32_t n) {
+    st->hblock.append(p, n);
+    if (st->hblock.size() > 64 * 1024) {
+        ELOG << "http2 header block too large, stream: " << st->id;
+        this->goaway(kEnhanceYourCalm);
+        return false;
+    }
+    if (!(flags & kEndHeaders)) {
+        _cont_id = st->id;
+        return true;
+    }
+    _cont_id = 0;
+
+    if (!this->decode_headers(st)) {
+        ELOG << "http2 header decode error, stream: " << st->id;
+        this->goaway(kCompressionError);
+        return false;
+    }
+    st->hblock.clear();
+    if ((st->state & stream_t::kRemoteEnd) && !(st->state & stream_t::kReset)) this->dispatch(st);
+    return true;
+}
+
+// a header name must be a lowercase token, see RFC 7540 8.1.2 and RFC 7230 3.2.6
+static bool is_header_name(const fastring& k) {
+    for (size_t i = 0; i < k.size(); ++i) {
+        const char c = k[i];
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) continue;
+        if (c == '\0' || !strchr("!#$%&'*+-.^_`|~", c)) return false;
+    }
+    return !k.empty();
+}
+
+// Convert the request header to HTTP/1.1 format, so that we can use parse_http_req().
+// Trailers are decoded to keep the HPACK state, and then discarded.
+bool session::decode_headers(stream_t* st) {
+    const bool trailer = (st->state & stream_t::kHeadersDone) != 0;
+    fastring method, path, authority;
+    fastring& s = st->buf;
+    bool malformed = false;
+
+    const bool r = _dec.decode(
+        (const uint8_t*)st->hblock.data(), st->hblock.size(),
+        [&](const fastring& k, const fastring& v) {
+            if (trailer || malformed) return true;
+            if (k.empty() || v.find_first_of("\r\n\0", 0, 3) != v.npos) {
+                malformed = true;
+                return true;
+            }
+            if (k[0] == ':') {
+                if (k == ":method") {
+                    method = v;
+                } else if (k == ":path") {
+                    path = v;
+                } else if (k == ":authority") {
+                    authority = v;
+                } else if (k != ":scheme") {
+                    malformed = true;
+                }
+                return true;
+            }
+            // a CR, LF or ':' in the name could inject headers into the request
+            if (!is_header_name(k)) {
+                malformed = true;
+                return true;
+            }
+            // connection-specific headers and content-length are dropped
+            if (k == "connection" || k == "keep-alive" || k == "proxy-connection" ||
+                k == "transfer-encoding" || k == "upgrade" || k == "content-length") {
+                return true;
+            }
+            s << k << ": " << v << "\r\n";
+            return true;
+        });
+    if (!r) return false;
+    if (trailer) return true;
+
+    st->state |= stream_t::kHeadersDone;
+    if (malformed || method.empty() || path.empty()) {
+        st->status = 400;
+        s.clear();
+        return true;
+    }
+
+    fastring x(method.size() + path.size() + authority.size() + s.size() + 32);
+    x << method << ' ' << path << " HTTP/1.1\r\n";
+    if (!authority.empty()) x << "host: " << authority << "\r\n";
+    x << s;
+    if (x.size() > FLG_http_max_header_size) {
+        st->status = 431;
+        s.clear();
+        return true;
+    }
+    st->hlen = (uint32_t)x.size();
+    s.swap(x);
+    return true;
+}
+
+bool session::on_data(uint32_t id, uint8_t flags, const uint8_t* p, uint32_t n) {
+    if (id == 0) {
+        this->goaway(kProtocolError);
+        return false;
+    }
+
+    // the whole frame is counted in flow control, the window is
+    // replenished once half of it is consumed
+    _unacked += n;
+    if (_unacked >= kConnWindow / 2) {
+        put_frame(_ctl, 4, kWindowUpdate, 0, 0);
+        put_u32(_ctl, (uint32_t)_unacked);
+        _unacked = 0;
+    }
+
+    auto it = _streams.find(id);
+    if (it == _streams.end()) {
+        if (id > _last_id) {
+            this->goaway(kProtocolError);
+            return false;
+        }
+        return true;  // the stream was closed
+    }
+
+    stream_t* st = it->second;
+    if (!(st->state & stream_t::kHeadersDone) || (st->state & stream_t::kRemoteEnd)) {
+        this->reset(st, kStreamClosed);
+        return true;
+    }
+
+    const uint32_t total = n;
+    if (flags & kPadded) {
+        if (n < 1 || p[0] >= n) {
+            this->goaway(kProtocolError);
+            return false;
+        }
+        n -= p[0] + 1;
+        ++p;
+    }
+
+    if (st->status == 0) {
+        if (st->buf.size() + n - st->hlen > FLG_http_max_body_size) {
+            st->status = 413;
+            st->buf.clear();
+        } else {
+            st->buf.append(p, n);
+        }
+    }
+
+    if (flags & kEndStream) {
+        st->state |= stream_t::kRemoteEnd;
+        if (!(st->state & stream_t::kReset)) this->dispatch(st);
+    } else {
+        st->unacked += total;
+        if (st->unacked >= FLG_http2_window_size / 2) {
+            put_frame(_ctl, 4, kWindowUpdate, 0, st->id);
+            put_u32(_ctl, (uint32_t)st->unacked);
+            st->unacked = 0;
+        }
+    }
+    return true;
+}
+
+bool session::on_settings(const uint8_t* p, uint32_t n) {
+    for (uint32_t i = 0; i + 6 <= n; i += 6) {
+        const uint16_t k = (uint16_t)((p[i] << 8) | p[i + 1]);
+        const uint32_t v = get_u32(p + i + 2);
+        if (k == kInitialWindowSize) {
+            if (v > (uint32_t)kMaxWindow) {
+                this->goaway(kFlowControlError);
+                return false;
+            }
+            const int64_t d = (int64_t)v - _init_window;
+            for (auto& x : _streams) x.second->send_window += d;
+            _init_window = v;
+            this->signal();
+        } else if (k == kMaxFrameSize) {
+            if (v < kFrameSize || v > 0xffffff) {
+                this->goaway(kProtocolError);
+                return false;
+            }
+            _max_frame = v < 4 * kFrameSize ? v : 4 * kFrameSize;
+        } else if (k == kEnablePush && v > 1) {
+            this->goaway(kProtocolError);
+            return false;
+        }
+    }
+    return true;
+}
+
+void session::dispatch(stream_t* st) {
+    st->state |= stream_t::kHandling;
+    _wg.add(1);
+    co::sched()->go(&session::handle, this, st);
+}
+
+void session::handle(stream_t* st) {
+    Req req;
+    Res res;
+    auto& preq = *(http_req_t**)&req;
+    auto& pres = *(http_res_t**)&res;
+    fastring out(256);
+    uint32_t method = kGet;
+
+    pres = new_http_res();
+    pres->buf = &out;
+    pres->version = kHTTP20;
+
+    if (st->upreq) {
+        preq = st->upreq;
+        st->upreq = 0;
+        preq->version = kHTTP20;
+        method = preq->method;
+        pres->accept_gzip =
+            FLG_http_compress_size > 0 && accepts_gzip(preq->header("Accept-Encoding"));
+        pres->req = preq;
+        CO_PROBE3(http_begin, preq->url.data(), preq->url.size(), (int)method);
+        const int64_t t = now::us();
+        _cb(req, res);
+        record_req(pres->status, now::us() - t);
+        CO_PROBE3(http_end, preq->url.data(), preq->url.size(), (int)pres->status);
+    } else if (st->status == 0) {
+        fastring& b = st->buf;
+        const uint32_t body_size = (uint32_t)(b.size() - st->hlen);
+        if (body_size > 0) {
+            fastring x(b.size() + 32);
+            x.append(b.data(), st->hlen) << "content-length: " << body_size << "\r\n";
+            x.append("\r\n", 2).append(b.data() + st->hlen, body_size);
+            b.swap(x);
+        } else {
+            b.append("\r\n", 2);
+        }
+
+        const size_t pos = b.find("\r\n\r\n");
+        b[pos + 2] = '\0';
+        preq = new_http_req();
+        const int e = parse_http_req(&b, pos + 2, preq);
+        if (e == 0) {
+            HTTPLOG << "http2 recv req, stream " << st->id << ": " << b.data();
+            preq->version = kHTTP20;
+            preq->body = (uint32_t)(pos + 4);
+            method = preq->method;
+            pres->accept_gzip =
+                FLG_http_compress_size > 0 && accepts_gzip(preq->header("Accept-Encoding"));
+            pres->req = preq;
+            CO_PROBE3(http_begin, preq->url.data(), preq->url.size(), (int)method);
+            const int64_t t = now::us();
+            _cb(req, res);
+            record_req(pres->status, now::us() - t);
+            CO_PROBE3(http_end, preq->url.data(), preq->url.size(), (int)pres->status);
+        } else {
+            pres->status = e;
+        }
+    } else {
+        pres->status = st->status;
+    }
+    if (pres->chunked) pres->end_chunks();
+    if (out.empty()) pres->set_body("", 0);
+
+    // the response header
+    fastring& h = st->hblock;
+    h.clear();
+    {
+        const uint32_t status = pres->status;
+        uint32_t i = 8;
+        for (; i <= 14; ++i) {
+            if ((uint32_t)atoi(g_static[i].value) == status) break;
+        }
+        if (i <= 14) {
+            put_int(h, 0x80, 7, i);
+        } else {
+            char b[12];
+            const int n = snprintf(b, sizeof(b), "%u", status);
+            put_header(h, ":status", 7, b, n);
+        }
+
+        const fastring& d = date_header();  // "Date: xxx\r\n"
+        put_header(h, "date", 4, d.data() + 6, d.size() - 8);
+
+        const int64_t len = pres->file_len > 0 ? pres->file_len : (int64_t)pres->body_size;
+        char b[24];
+        const int n = snprintf(b, sizeof(b), "%lld", (long long)len);
+        put_header(h, "content-length", 14, b, n);
+
+        // headers added by the user, names are converted to lower case
+        fastring& x = pres->header;
+        fastring k;
+        for (size_t p = 0; p < x.size();) {
+            const size_t e = x.find("\r\n", p);
+            if (e == x.npos) break;
+            const size_t c = x.find(':', p, e - p);
+            if (c != x.npos) {
+                k.clear();
+                k.append(x.data() + p, c - p).tolower();
+                size_t v = c + 1;
+                while (v < e && x[v] == ' ') ++v;
+                if (k != "connection" && k != "keep-alive" && k != "transfer-encoding" &&
+                    k != "upgrade" && k != "content-length") {
+                    put_header(h, k.data(), k.size(), x.data() + v, e - v);
+                }
+            }
+            p = e + 2;
+        }
+    }
+
+    // the response body, no body for HEAD requests
+    st->buf.swap(out);
+    st->body_pos = st->buf.size() - pres->body_size;
+    if (pres->file_len > 0) {
+        st->file_fd = pres->file_fd;
+        st->file_off = pres->file_off;
+        st->file_len = pres->file_len;
+        pres->file_len = 0;  // the file will be closed with the stream
+    }
+    if (method == kHead) {
+        st->body_pos = st->buf.size();
+        st->file_len = 0;
+    }
+
+    st->state &= ~stream_t::kHandling;
+    st->state |= stream_t::kResReady;
+    _ready.push_back(st);
+    this->signal();
+    _wg.done();
+}
+
+inline int read_at(int fd, void* buf, int n, int64_t off) {
+#ifdef _WIN32
+    if (_lseeki64(fd, off, SEEK_SET) < 0) return -1;
+    return _read(fd, buf, (unsigned int)n);
+#else
+    int r;
+    do { r = (int)::pread(fd, buf, (size_t)n, (off_t)off); } while (r < 0 && errno == EINTR);
+    return r;
+#endif
+}
+
+// Put frames of the responses into @out, as many as the flow-control windows allow.
+// Streams blocked by the windows are kept in the ready queue.
+void session::fill(fastring& out) {
+    static const size_t N = 64 * 1024;
+    for (size_t i = 0; i < _ready.size() && out.size() < N;) {
+        stream_t* st = _ready[i];
+        if (st->state & stream_t::kReset) {
+            _ready.erase(_ready.begin() + i);
+            this->remove(st);
+            continue;
+        }
+
+        int64_t remain = st->file_len > 0 ? st->file_len : (int64_t)(st->buf.size() - st->body_pos);
+        if (!(st->state & stream_t::kHeaderSent)) {
+            const fastring& h = st->hblock;
+            const uint8_t es = remain == 0 ? kEndStream : 0;
+            for (size_t p = 0;;) {
+                const size_t n = h.size() - p < _max_frame ? h.size() - p : _max_frame;
+                const bool last = p + n == h.size();
+                put_frame(out, (uint32_t)n, p == 0 ? kHeaders : kContinuation,
+                          (uint8_t)((p == 0 ? es : 0) | (last ? kEndHeaders : 0)), st->id);
+                out.append(h.data() + p, n);
+                p += n;
+                if (last) break;
+            }
+            st->state |= stream_t::kHeaderSent;
+        }
+
+        while (remain > 0 && _send_window > 0 && st->send_window > 0 && out.size() < N) {
+            int64_t n = remain < (int64_t)_max_frame ? remain : (int64_t)_max_frame;
+            if (n > _send_window) n = _send_window;
+            if (n > st->send_window) n = st->send_window;
+
+            const size_t o = out.size();
+            put_frame(out, (uint32_t)n, kData, n == remain ? kEndStream : 0, st->id);
+            if (st->file_len > 0) {
+                out.reserve(o + 9 + n);
+                const int r = read_at(st->file_fd, (char*)out.data() + o + 9, (int)n, st->file_off);
+                if (r != (int)n) {
+                    ELOG << "http2 read file error, stream: " << st->id;
+                    out.resize(o);
+                    st->state |= stream_t::kReset;
+                    put_frame(out, 4, kRstStream, 0, st->id);
+                    put_u32(out, kInternalError);
+                    break;
+                }
+                out.resize(o + 9 + n);
+                st->file_off += n;
+                st->file_len -= n;
+            } else {
+                out.append(st->buf.data() + st->body_pos, (size_t)n);
+                st->body_pos += (size_t)n;
+            }
+            remain -= n;
+            _send_window -= n;
+            st->send_window -= n;
+        }
+
+        if (remain == 0 || (st->state & stream_t::kReset)) {
+            _ready.erase(_ready.begin() + i);
+            this->remove(st);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void session::writer() {
+    fastring out(16 * 1024);
+    while (!_dead) {
+        _ev.wait();
+        while (true) {
+            out.clear();
+            if (!_ctl.empty()) {
+                out.append(_ctl);
+                _ctl.clear();
+            }
+            if (!_closing || _goaway) this->fill(out);
+            if (out.empty()) break;
+            if (_conn.send(out.data(), (int)out.size(), FLG_http_send_timeout) <= 0) {
+                ELOG << "http2 send error: " << _conn.strerror();
+                _dead = true;
+                break;
+            }
+        }
+        if (_closing) break;
+    }
+    _wg.done();
+}
+
+void session::remove(stream_t* st) {
+    _streams.erase(st->id);
+    --_nstream;
+    delete st;
+}
+
+void session::reset(stream_t* st, uint32_t err) {
+    put_frame(_ctl, 4, kRstStream, 0, st->id);
+    put_u32(_ctl, err);
+    st->state |= stream_t::kReset | stream_t::kRemoteEnd;
+    if (!(st->state & (stream_t::kHandling | stream_t::kResReady))) this->remove(st);
+    this->signal();
+}
+
+void session::goaway(uint32_t err) {
+    put_frame(_ctl, 8, kGoaway, 0, 0);
+    put_u32(_ctl, _last_id);
+    put_u32(_ctl, err);
+}
+
+}  // namespace h2
+
+void serve_http2(tcp::Connection& conn, fastring& buf, http_req_t* upgraded,
+                 const std::function<void(const Req&, Res&)>& cb, const std::atomic_bool& stopped) {
+    fastring settings;
+    if (upgraded) {
+        // the HTTP2-Settings header is the payload of a SETTINGS frame, in base64url
+        fastring s(upgraded->header("HTTP2-Settings"));
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (s[i] == '-') s[i] = '+';
+            else if (s[i] == '_') s[i] = '/';
+        }
+        while (s.size() % 4 != 0) s.append('=');
+        settings = base64_decode(s.data(), s.size());
+    }
+
+    // Coroutines of a scheduler share stacks, objects used by the stream coroutines
+    // and the writer can't live on the stack of this coroutine.
+    auto x = new h2::session(conn, cb, stopped);
+    x->run(buf, upgraded, settings);
+    delete x;
+}
+
+}  // namespace http
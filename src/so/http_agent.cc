@@ -0,0 +1,471 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "./http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/http.h"
+#include "co/log.h"
+#include "co/stl.h"
+#include "co/tcp.h"
+
+DEC_uint32(http_timeout);
+DEC_uint32(http_conn_timeout);
+
+DEF_uint32(http_agent_pool_size, 64,
+           ">>#2 max idle connections to a host in each scheduler for http::Agent");
+DEF_uint32(http_agent_idle_sec, 30,
+           ">>#2 http::Agent closes pooled connections idle for more than this seconds");
+
+namespace http {
+
+/**
+ * ===========================================================================
+ * native HTTP client
+ *   - openssl required for https.
+ * ===========================================================================
+ */
+
+struct agent_conn_t {
+    agent_conn_t(const char* host, int port, bool use_ssl) : c(host, port, use_ssl), nreq(0) {}
+
+    tcp::Client c;
+    uint32_t nreq;  // requests done on this connection
+};
+
+// Connection pools, one for each host. They are never destroyed, as agents to
+// the same host will come again, and idle connections are closed by co::pool.
+class agent_pools {
+  public:
+    co::pool* get(const fastring& host, int port, bool use_ssl) {
+        fastring key(host.size() + 16);
+        key << host << ':' << port << (use_ssl ? ":s" : "");
+
+        std::lock_guard<std::mutex> g(_mtx);
+        co::pool*& p = _m[key];
+        if (p == 0) {
+            fastring h(host);
+            p = new co::pool(
+                [h, port, use_ssl]() { return (void*)new agent_conn_t(h.c_str(), port, use_ssl); },
+                [](void* p) { delete (agent_conn_t*)p; }, FLG_http_agent_pool_size);
+            if (FLG_http_agent_idle_sec > 0) p->set_idle_timeout(FLG_http_agent_idle_sec * 1000);
+        }
+        return p;
+    }
+
+  private:
+    std::mutex _mtx;
+    co::hash_map<fastring, co::pool*> _m;
+};
+
+inline agent_pools& pools() {
+    static agent_pools* p = new agent_pools();
+    return *p;
+}
+
+struct agent_ctx_t {
+    agent_ctx_t() : pool(0), port(0), use_ssl(false), status(0), hdr(0) {}
+
+    ~agent_ctx_t() {
+        if (hdr) {
+            hdr->url.~fastring();
+            ::free(hdr->arr);
+            ::free(hdr);
+        }
+    }
+
+    int perform(const char* method, const char* url, const void* data, size_t size);
+
+    // send the request and recv the response on connection @c
+    //   - return 1 on success, -1 on error, 0 if the connection was closed by
+    //     the server before any response arrived.
+    int request(agent_conn_t* c, const fastring& req, const void* data, size_t size, bool head);
+
+    int recv_header(tcp::Client& c, bool& closed);
+    bool recv_body(tcp::Client& c, size_t hlen, bool head);
+    bool recv_chunked(tcp::Client& c, size_t hlen);
+    int recv_more(tcp::Client& c, fastring& s, size_t n);
+
+    void set_error(const char* s, tcp::Client* c = 0) {
+        err.clear();
+        err << s;
+        if (c) err << ": " << c->strerror();
+    }
+
+    fastring host;
+    fastring host_header;  // "Host: host[:port]\r\n"
+    co::pool* pool;
+    int port;
+    bool use_ssl;
+    bool keep_alive;  // whether the connection can be reused
+    int status;
+    fastring headers;  // headers added by the user
+    fastring header;   // header part of the response
+    fastring body;
+    fastring buf;      // copy of the response header for parsing, and data received after it
+    fastring err;
+    http_req_t* hdr;   // index of the response headers, in @buf
+};
+
+inline bool is_default_port(int port, bool use_ssl) { return port == (use_ssl ? 443 : 80); }
+
+Agent::Agent(const char* serv_url) {
+    auto p = new agent_ctx_t();
+    _p = p;
+
+    fastring s(serv_url);
+    if (s.starts_with("https://")) {
+        p->use_ssl = true;
+        s.trim(8, 'l');
+    } else if (s.starts_with("http://")) {
+        s.trim(7, 'l');
+    }
+    s.trim('/', 'r');
+
+    size_t x;
+    if (s.starts_with('[')) { /* ipv6 */
+        x = s.find(']');
+        CHECK(x != s.npos) << "invalid server url: " << serv_url;
+        p->host.append(s.data() + 1, x - 1);
+        x = s.find(':', x);
+    } else {
+        x = s.find(':');
+        p->host.append(s.data(), x != s.npos ? x : s.size());
+    }
+    p->port = x != s.npos ? atoi(s.data() + x + 1) : (p->use_ssl ? 443 : 80);
+    CHECK(!p->host.empty() && p->port > 0) << "invalid server url: " << serv_url;
+
+    p->host_header << "Host: ";
+    if (p->host.find(':') != p->host.npos) {
+        p->host_header << '[' << p->host << ']';
+    } else {
+        p->host_header << p->host;
+    }
+    if (!is_default_port(p->port, p->use_ssl)) p->host_header << ':' << p->port;
+    p->host_header << "\r\n";
+}
+
+Agent::~Agent() {
+    if (_p) {
+        delete (agent_ctx_t*)_p;
+        _p = 0;
+    }
+}
+
+void Agent::add_header(const char* key, const char* val) {
+    ((agent_ctx_t*)_p)->headers << key << ": " << val << "\r\n";
+}
+
+void Agent::add_header(const char* key, int val) {
+    ((agent_ctx_t*)_p)->headers << key << ": " << val << "\r\n";
+}
+
+void Agent::add_header(co::strview key, co::strview val) {
+    ((agent_ctx_t*)_p)->headers << key << ": " << val << "\r\n";
+}
+
+void Agent::remove_header(const char* key) {
+    fastring& h = ((agent_ctx_t*)_p)->headers;
+    fastring k(key), x;
+    k.tolower();
+    fastring s(h.size());
+    for (size_t p = 0; p < h.size();) {
+        const size_t e = h.find("\r\n", p);
+        if (e == h.npos) break;
+        const size_t c = h.find(':', p, e - p);
+        x.clear();
+        x.append(h.data() + p, c != h.npos ? c - p : 0).tolower();
+        if (x != k) s.append(h.data() + p, e + 2 - p);
+        p = e + 2;
+    }
+    h.swap(s);
+}
+
+int Agent::perform(const char* method, const char* url, const void* data, size_t size) {
+    return ((agent_ctx_t*)_p)->perform(method, url, data, size);
+}
+
+int Agent::status() const { return ((agent_ctx_t*)_p)->status; }
+
+const char* Agent::strerror() const { return ((agent_ctx_t*)_p)->err.c_str(); }
+
+const char* Agent::header(const char* key) const {
+    auto p = (agent_ctx_t*)_p;
+    return p->status != 0 ? p->hdr->header(key) : "";
+}
+
+const fastring& Agent::header() const { return ((agent_ctx_t*)_p)->header; }
+
+const fastring& Agent::body() const { return ((agent_ctx_t*)_p)->body; }
+
+int agent_ctx_t::perform(const char* method, const char* url, const void* data, size_t size) {
+    CHECK(co::sched()) << "http::Agent must be used in coroutine..";
+    if (pool == 0) pool = pools().get(host, port, use_ssl);
+    status = 0;
+    header.clear();
+    body.clear();
+    err.clear();
+
+    const bool head = strcmp(method, "HEAD") == 0;
+    const bool has_body = size > 0 || strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0;
+    fastring req(host_header.size() + headers.size() + strlen(url) + 64);
+    req << method << ' ' << url << " HTTP/1.1\r\n" << host_header << headers;
+    if (has_body) req << "Content-Length: " << size << "\r\n";
+    req << "\r\n";
+    if (size > 0 && size <= 4096) req.append(data, size);
+
+    // A kept-alive connection may have been closed by the server, the request is
+    // retried then. It ends at a new connection, as the pool is limited.
+    while (true) {
+        auto c = (agent_conn_t*)pool->pop();
+        const bool reused = c->nreq > 0;
+        const int r = this->request(c, req, size > 4096 ? data : 0, size > 4096 ? size : 0, head);
+        if (r > 0) {
+            ++c->nreq;
+            if (keep_alive) {
+                pool->push(c);
+            } else {
+                pool->discard(c);
+            }
+            return status;
+        }
+        pool->discard(c);
+        if (r < 0 || !reused) {
+            status = 0;
+            if (r == 0) this->set_error("server closed the connection");
+            return 0;
+        }
+    }
+}
+
+int agent_ctx_t::request(agent_conn_t* x, const fastring& req, const void* data, size_t size,
+                         bool head) {
+    tcp::Client& c = x->c;
+    if (!c.connected() && !c.connect(FLG_http_conn_timeout)) {
+        this->set_error("connect failed", &c);
+        return -1;
+    }
+
+    if (c.send(req.data(), (int)req.size(), FLG_http_timeout) <= 0 ||
+        (size > 0 && c.send(data, (int)size, FLG_http_timeout) <= 0)) {
+        this->set_error("send failed", &c);
+        return x->nreq > 0 ? 0 : -1;
+    }
+
+    buf.clear();
+
+    // skip 1xx responses, the server may send them before the final response
+    while (true) {
+        bool closed = false;
+        const int n = this->recv_header(c, closed);
+        if (n < 0) return closed && x->nreq > 0 ? 0 : -1;
+        if (status >= 200 || status == 101) return this->recv_body(c, (size_t)n, head) ? 1 : -1;
+        buf.trim((size_t)n, 'l');
+    }
+}
+
+// recv more data to @s, return what tcp::Client::recv() returns
+int agent_ctx_t::recv_more(tcp::Client& c, fastring& s, size_t n) {
+    s.reserve(s.size() + (n > 4096 ? n : 4096));
+    const int r = c.recv((void*)(s.data() + s.size()), (int)(s.capacity() - s.size()), FLG_http_timeout);
+    if (r <= 0) {
+        this->set_error(r == 0 ? "server closed the connection" : "recv failed", r == 0 ? 0 : &c);
+        return r;
+    }
+    s.resize(s.size() + r);
+    return r;
+}
+
+// recv and parse the response header, return length of the header, or -1 on error.
+// @closed is set to true if the server closed the connection before sending anything.
+int agent_ctx_t::recv_header(tcp::Client& c, bool& closed) {
+    size_t pos = 0;
+    if (buf.capacity() == 0) buf.reserve(4096);
+    while ((pos = buf.find("\r\n\r\n", pos)) == buf.npos) {
+        if (buf.size() > 64 * 1024) {
+            this->set_error("response header too long");
+            return -1;
+        }
+        pos = buf.size() > 3 ? buf.size() - 3 : 0;
+        const size_t n = buf.size();
+        const int r = this->recv_more(c, buf, 4096);
+        if (r <= 0) {
+            closed = n == 0 && (r == 0 || !co::timeout());  // closed or reset
+            return -1;
+        }
+    }
+
+    // status line: HTTP/1.1 200 OK
+    const char* const s = buf.data();
+    if (pos < 12 || memcmp(s, "HTTP/1.", 7) != 0 || s[8] != ' ') {
+        this->set_error("invalid response");
+        return -1;
+    }
+    const int v = s[7] - '0';
+    status = atoi(s + 9);
+    if (status < 100 || status > 999 || (v != 0 && v != 1)) {
+        status = 0;
+        this->set_error("invalid response");
+        return -1;
+    }
+
+    header.clear();
+    header.append(s, pos + 4);
+
+    if (hdr == 0) hdr = (http_req_t*)::calloc(1, sizeof(http_req_t));
+    hdr->clear();
+    hdr->buf = &buf;
+    buf[pos + 2] = '\0';
+    const size_t x = buf.find('\n') + 1;
+    if (parse_http_headers(&buf, pos + 2, x, hdr) != 0) {
+        status = 0;
+        this->set_error("invalid response header");
+        return -1;
+    }
+
+    // HTTP/1.0 is kept alive only with "Connection: keep-alive"
+    fastring conn(hdr->header("CONNECTION"));
+    conn.tolower();
+    keep_alive = v == 1 ? conn != "close" : conn == "keep-alive";
+    return (int)(pos + 4);
+}
+
+bool agent_ctx_t::recv_body(tcp::Client& c, size_t hlen, bool head) {
+    bool ok = true;
+    if (head || status == 204 || status == 304 || status == 101) {
+        keep_alive = keep_alive && status != 101 && buf.size() == hlen;
+        goto end;
+    }
+
+    {
+        const char* te = hdr->header("TRANSFER-ENCODING");
+        if (*te) {
+            if (fastring(te).tolower() != "chunked") {
+                this->set_error("unsupported transfer encoding");
+                return false;
+            }
+            ok = this->recv_chunked(c, hlen);
+            goto end;
+        }
+    }
+
+    {
+        const char* cl = hdr->header("CONTENT-LENGTH");
+        if (*cl) {
+            const int64_t n = atoll(cl);
+            if (n < 0) {
+                this->set_error("invalid content-length");
+                return false;
+            }
+            const size_t m = buf.size() - hlen;
+            if ((int64_t)m >= n) {
+                body.append(buf.data() + hlen, (size_t)n);
+                keep_alive = keep_alive && (int64_t)m == n;  // no pipelining, extra data is invalid
+            } else {
+                body.reserve((size_t)n);
+                body.append(buf.data() + hlen, m);
+                const int r = c.recvn((void*)(body.data() + m), (int)(n - m), FLG_http_timeout);
+                if (r <= 0) {
+                    this->set_error(r == 0 ? "server closed the connection" : "recv failed",
+                                    r == 0 ? 0 : &c);
+                    return false;
+                }
+                body.resize((size_t)n);
+            }
+            goto end;
+        }
+    }
+
+    // no length, the body ends when the server closes the connection
+    keep_alive = false;
+    body.append(buf.data() + hlen, buf.size() - hlen);
+    while (true) {
+        body.reserve(body.size() + 8192);
+        const int r = c.recv((void*)(body.data() + body.size()), (int)(body.capacity() - body.size()),
+                             FLG_http_timeout);
+        if (r == 0) break;
+        if (r < 0) {
+            this->set_error("recv failed", &c);
+            return false;
+        }
+        body.resize(body.size() + r);
+    }
+
+end:
+    // keep the parsed header, and drop data after it
+    buf.resize(hlen);
+    return ok;
+}
+
+// see https://datatracker.ietf.org/doc/html/rfc9112#section-7.1
+bool agent_ctx_t::recv_chunked(tcp::Client& c, size_t hlen) {
+    fastring s(buf.data() + hlen, buf.size() - hlen);
+    size_t p = 0, x;
+    while (true) {
+        // chunk size line:  1a[;xxx]\r\n
+        while ((x = s.find("\r\n", p)) == s.npos) {
+            if (s.size() - p > 1024) goto chunk_err;
+            if (this->recv_more(c, s, 1024) <= 0) return false;
+        }
+
+        size_t n = 0;
+        int k = 0;
+        for (size_t i = p; i < x && s[i] != ';'; ++i) {
+            const char ch = s[i];
+            const int d = ('0' <= ch && ch <= '9')   ? ch - '0'
+                          : ('a' <= ch && ch <= 'f') ? ch - 'a' + 10
+                          : ('A' <= ch && ch <= 'F') ? ch - 'A' + 10
+                                                     : -1;
+            if (d < 0 || ++k > 15) goto chunk_err;
+            n = (n << 4) + d;
+        }
+        if (k == 0) goto chunk_err;
+        p = x + 2;
+
+        if (n == 0) { /* the last chunk, skip trailers */
+            while ((x = s.find("\r\n", p)) != p) {
+                if (x == s.npos) {
+                    if (s.size() - p > 64 * 1024) goto chunk_err;
+                    if (this->recv_more(c, s, 1024) <= 0) return false;
+                    continue;
+                }
+                p = x + 2;
+            }
+            keep_alive = keep_alive && s.size() == p + 2;
+            return true;
+        }
+
+        // chunk data followed by \r\n
+        if (s.size() - p < n + 2) {
+            body.append(s.data() + p, s.size() - p);
+            const size_t m = n + 2 - (s.size() - p);
+            body.reserve(body.size() + m);
+            const int r = c.recvn((void*)(body.data() + body.size()), (int)m, FLG_http_timeout);
+            if (r <= 0) {
+                this->set_error(r == 0 ? "server closed the connection" : "recv failed", r == 0 ? 0 : &c);
+                return false;
+            }
+            body.resize(body.size() + m);
+            if (body[body.size() - 2] != '\r' || body.back() != '\n') goto chunk_err;
+            body.resize(body.size() - 2);
+            s.clear();
+            p = 0;
+        } else {
+            if (s[p + n] != '\r' || s[p + n + 1] != '\n') goto chunk_err;
+            body.append(s.data() + p, n);
+            p += n + 2;
+            if (p > 8192) {
+                s.trim(p, 'l');
+                p = 0;
+            }
+        }
+    }
+
+chunk_err:
+    this->set_error("invalid chunked data");
+    return false;
+}
+
+}  // namespace http
@@ -0,0 +1,216 @@
+#include "./http_cache.h"
+
+#include <string.h>
+
+#include "./http.h"
+#include "co/str.h"
+#include "co/time.h"
+
+namespace http {
+
+static const size_t kMaxBodySize = 1 << 20;
+
+ResponseCache::ResponseCache(uint32_t ttl_ms, uint32_t stale_ms, const char* vary, size_t capacity)
+    : _ttl(ttl_ms), _stale(stale_ms), _map(capacity), _stopped(false) {
+    _vary_auth = _vary_cookie = false;
+    if (vary && *vary) {
+        auto v = str::split(vary, ',');
+        for (size_t i = 0; i < v.size(); ++i) {
+            v[i].trim();
+            if (v[i].empty()) continue;
+            if (strcasecmp(v[i].c_str(), "Authorization") == 0) _vary_auth = true;
+            if (strcasecmp(v[i].c_str(), "Cookie") == 0) _vary_cookie = true;
+            _vary.push_back(std::move(v[i]));
+        }
+    }
+}
+
+// Responses to requests with credentials may be for the user only. They are not
+// shared unless the credentials are in the key.
+bool ResponseCache::bypass(const Req& req) const {
+    if (!_vary_auth && *req.header("Authorization")) return true;
+    if (!_vary_cookie && *req.header("Cookie")) return true;
+    return false;
+}
+
+// the url and values of the vary headers, separated by '\0'
+void ResponseCache::make_key(const Req& req, fastring& key) const {
+    key.append(req.url());
+    for (size_t i = 0; i < _vary.size(); ++i) {
+        key.append('\0').append(req.header(_vary[i].c_str()));
+    }
+}
+
+// Only responses of status 200 with a body set by set_body() are cached, not
+// those with cookies, or marked not to be stored or shared. @h is the headers
+// added by the handler.
+static bool cacheable(const http_res_t* res, co::strview h) {
+    if (res->chunked != 0 || res->file_len > 0) return false;
+    if (res->status != 0 && res->status != 200) return false;
+    if (res->body_size > kMaxBodySize) return false;
+
+    const char* p = h.data();
+    const char* const e = p + h.size();
+    while (p < e) {
+        const char* q = (const char*)memchr(p, '\r', e - p);
+        if (!q) q = e;
+        if (q - p > 10 && strncasecmp(p, "set-cookie:", 11) == 0) return false;
+        if (q - p > 13 && strncasecmp(p, "cache-control:", 14) == 0) {
+            fastring v(p + 14, q - p - 14);
+            v.tolower();
+            if (v.find("no-store") != v.npos || v.find("no-cache") != v.npos ||
+                v.find("private") != v.npos) {
+                return false;
+            }
+        }
+        p = q + 2;
+    }
+    return true;
+}
+
+void ResponseCache::put(const entry_t& e, http_res_t* res) {
+    res->status = e.status;
+    res->header.append(e.header);
+    res->set_body(e.body.data(), e.body.size());
+}
+
+void ResponseCache::serve(const Req& req, Res& res) {
+    const Method m = req.method();
+    if ((m != kGet && m != kHead) || req.body_size() > 0 || req.is_body_streamed() ||
+        this->bypass(req)) {
+        return _f(req, res);
+    }
+
+    http_res_t* const pres = *(http_res_t**)&res;
+    fastring key(req.url().size() + 32);
+    this->make_key(req, key);
+
+    // HEAD requests are served from the cache, but never fill it, as the handler
+    // may not set the body for them.
+    enum { a_call, a_hit, a_update, a_fill, a_wait };
+    for (int n = 0;; ++n) {
+        int a = a_call;
+        std::shared_ptr<const entry_t> e;
+        co::event* ev = 0;
+        const int64_t now = now::ms_coarse();
+        _map.visit_or_insert(key, [&](slot_t& s) {
+            if (s.e && now < s.stale) {
+                e = s.e;
+                a = a_hit;
+                if (now >= s.expire && !s.updating && m == kGet &&
+                    !_stopped.load(std::memory_order_relaxed)) {
+                    s.updating = true;
+                    a = a_update;
+                }
+            } else if (now < s.pass_until) {
+                a = a_call;
+            } else if (s.updating) {
+                // requests wait for the one filling the entry, but not for an update
+                // of a stale entry that expired meanwhile
+                if (s.ev && n == 0) {
+                    ev = new co::event(*s.ev);
+                    a = a_wait;
+                }
+            } else if (m == kGet) {
+                s.updating = true;
+                s.ev = ev = new co::event(true, false);
+                a = a_fill;
+            }
+        });
+
+        switch (a) {
+          case a_hit:
+            return put(*e, pres);
+          case a_update:
+            this->update(key, req);
+            return put(*e, pres);
+          case a_fill:
+            return this->fill(key, req, res, ev);
+          case a_wait:
+            ev->wait();
+            delete ev;
+            continue;  // try again, only once
+          default:
+            return _f(req, res);
+        }
+    }
+}
+
+void ResponseCache::fill(const fastring& key, const Req& req, Res& res, co::event* ev) {
+    http_res_t* const pres = *(http_res_t**)&res;
+    const size_t hlen = pres->header.size();
+    const bool gz = pres->accept_gzip;
+    pres->accept_gzip = false;  // bodies are cached not compressed
+    _f(req, res);
+    pres->accept_gzip = gz;
+
+    const co::strview h(pres->header.data() + hlen, pres->header.size() - hlen);
+    std::shared_ptr<entry_t> e;
+    if (cacheable(pres, h)) {
+        e = std::make_shared<entry_t>();
+        e->status = 200;
+        e->header.append(h);
+        if (!pres->buf->empty()) {
+            e->body.append(pres->buf->data() + pres->buf->size() - pres->body_size, pres->body_size);
+        }
+    }
+
+    const int64_t now = now::ms_coarse();
+    _map.visit(key, [&](slot_t& s) {
+        if (e) {
+            s.e = e;
+            s.expire = now + _ttl;
+            s.stale = s.expire + _stale;
+            s.pass_until = 0;
+        } else {
+            s.e.reset();
+            s.pass_until = now + _ttl;
+        }
+        s.updating = false;
+        s.ev = 0;
+    });
+    if (ev) {
+        ev->signal();
+        delete ev;
+    }
+
+    // the body may be compressed now
+    if (e && gz) {
+        pres->header.resize(hlen);
+        put(*e, pres);
+    }
+}
+
+void ResponseCache::update(const fastring& key, const Req& req) {
+    fastring s(256);
+    s << "GET " << req.url() << " HTTP/1.1\r\n";
+    for (size_t i = 0; i < _vary.size(); ++i) {
+        const char* const v = req.header(_vary[i].c_str());
+        if (*v) s << _vary[i] << ": " << v << "\r\n";
+    }
+    s.append("\r\n", 2);
+
+    auto self = this->shared_from_this();
+    go([self, key, s]() mutable {
+        Req req;
+        Res res;
+        auto& preq = *(http_req_t**)&req;
+        auto& pres = *(http_res_t**)&res;
+        fastring out(256);
+        pres = new_http_res();
+        pres->buf = &out;
+        pres->version = kHTTP11;
+        preq = new_http_req();
+
+        const size_t pos = s.size() - 4;
+        s[pos + 2] = '\0';
+        if (parse_http_req(&s, pos + 2, preq) == 0) {
+            preq->body = (uint32_t)(pos + 4);
+            self->fill(key, req, res, 0);
+        } else {
+            self->_map.visit(key, [](slot_t& x) { x.updating = false; });
+        }
+    });
+}
+
+}  // namespace http
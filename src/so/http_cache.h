@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "co/co.h"
+#include "co/fastring.h"
+#include "co/http.h"
+#include "co/vector.h"
+
+namespace http {
+
+struct http_res_t;
+
+// Responses cached in front of the callback of http::Server, see Server::cache().
+// Entries are kept in a co::sharded_lru_map, keyed by the url and the values of
+// the vary headers. Each key has a slot in the map, the entry in it is immutable
+// and shared by the requests served from it.
+class ResponseCache : public std::enable_shared_from_this<ResponseCache> {
+  public:
+    ResponseCache(uint32_t ttl_ms, uint32_t stale_ms, const char* vary, size_t capacity);
+
+    // set the callback the cache is in front of, it MUST be called before serve()
+    void set_handler(std::function<void(const Req&, Res&)>&& f) { _f = std::move(f); }
+
+    // serve a request from the cache, or call the handler
+    void serve(const Req& req, Res& res);
+
+    // no more background updates after it was called
+    void stop() { _stopped.store(true, std::memory_order_relaxed); }
+
+  private:
+    struct entry_t {
+        uint32_t status;
+        fastring header;  // headers added by the handler
+        fastring body;    // not compressed
+    };
+
+    struct slot_t {
+        slot_t() : pass_until(0), expire(0), stale(0), ev(0), updating(false) {}
+        std::shared_ptr<const entry_t> e;
+        int64_t pass_until;  // not cacheable, requests go to the handler until then
+        int64_t expire;      // e is fresh until then
+        int64_t stale;       // e may be served stale until then
+        co::event* ev;       // signaled when the entry being filled is done
+        bool updating;       // a request is filling or updating the entry
+    };
+
+    void make_key(const Req& req, fastring& key) const;
+
+    // the request goes to the handler without the cache
+    bool bypass(const Req& req) const;
+
+    // call the handler, and store the response in the slot of @key
+    void fill(const fastring& key, const Req& req, Res& res, co::event* ev);
+
+    // update a stale entry in a new coroutine, the request is made of the url
+    // and the vary headers
+    void update(const fastring& key, const Req& req);
+
+    static void put(const entry_t& e, http_res_t* res);
+
+  private:
+    uint32_t _ttl;
+    uint32_t _stale;
+    co::vector<fastring> _vary;
+    bool _vary_auth;    // Authorization is in _vary
+    bool _vary_cookie;  // Cookie is in _vary
+    co::sharded_lru_map<fastring, slot_t> _map;
+    std::function<void(const Req&, Res&)> _f;
+    std::atomic_bool _stopped;
+};
+
+}  // namespace http
@@ -0,0 +1,114 @@
+#include "./idle.h"
+
+#include "../co/hook.h"
+#include "co/co.h"
+#include "co/time.h"
+
+namespace idle {
+
+// co::shutdown() removes io events of the fd from the current scheduler, which
+// is not the one the owner is waiting on. The system API is called directly,
+// the owner is woken up by the io event and recv() returns 0.
+inline void shut(sock_t fd) {
+#ifdef _WIN32
+    __sys_api(shutdown)(fd, SD_BOTH);
+#else
+    __sys_api(shutdown)(fd, SHUT_RDWR);
+#endif
+}
+
+Tracker::Tracker(uint32_t sec, uint32_t max)
+    : _n(co::sched_num()), _ttl(sec * 1000LL), _max(max), _count(0), _stopped(false) {
+    _lists = new list_t[_n];
+}
+
+Tracker::~Tracker() { delete[] _lists; }
+
+std::shared_ptr<Tracker> Tracker::start(uint32_t sec, uint32_t max) {
+    auto t = std::make_shared<Tracker>(sec, max);
+    go([t]() { t->loop(); });
+    return t;
+}
+
+// shut down the socket with the lock of @l held, the owner removes itself from
+// the list before closing it, so the fd can't be reused here.
+void Tracker::reap(list_t& l, conn_t* c) {
+    l.l.erase(c);
+    c->reaped = true;
+    --_count;
+    shut(c->fd);
+}
+
+void Tracker::add(conn_t* c, sock_t fd) {
+    const int id = co::sched_id();
+    c->since = now::ms();
+    c->fd = fd;
+    c->slot = id >= 0 ? id % _n : 0;
+    c->reaped = false;
+
+    list_t& l = _lists[c->slot];
+    {
+        std::lock_guard<std::mutex> g(l.mtx);
+        if (_stopped.load(std::memory_order_relaxed)) {
+            c->reaped = true;
+            shut(fd);
+            return;
+        }
+        l.l.push_back(c);
+    }
+    if (++_count > _max) this->reap_oldest();
+}
+
+bool Tracker::del(conn_t* c) {
+    list_t& l = _lists[c->slot];
+    std::lock_guard<std::mutex> g(l.mtx);
+    if (c->reaped) return false;
+    l.l.erase(c);
+    --_count;
+    return true;
+}
+
+// find the list with the oldest connection at the front, and reap it
+void Tracker::reap_oldest() {
+    int k = -1;
+    int64_t since = 0;
+    for (int i = 0; i < _n; ++i) {
+        std::lock_guard<std::mutex> g(_lists[i].mtx);
+        auto c = (conn_t*)_lists[i].l.front();
+        if (c && (k < 0 || c->since < since)) k = i, since = c->since;
+    }
+    if (k < 0) return;
+
+    list_t& l = _lists[k];
+    std::lock_guard<std::mutex> g(l.mtx);
+    auto c = (conn_t*)l.l.front();
+    if (c && _count.load(std::memory_order_relaxed) > _max) this->reap(l, c);
+}
+
+void Tracker::stop() {
+    _stopped.store(true);
+    for (int i = 0; i < _n; ++i) {
+        list_t& l = _lists[i];
+        std::lock_guard<std::mutex> g(l.mtx);
+        while (!l.l.empty()) this->reap(l, (conn_t*)l.l.front());
+    }
+}
+
+void Tracker::loop() {
+    while (!_stopped.load(std::memory_order_relaxed)) {
+        const int64_t t = now::ms();
+        int64_t next = t + 1000;
+        if (_ttl > 0) {
+            for (int i = 0; i < _n; ++i) {
+                list_t& l = _lists[i];
+                std::lock_guard<std::mutex> g(l.mtx);
+                conn_t* c;
+                while ((c = (conn_t*)l.l.front()) && c->since + _ttl <= t) this->reap(l, c);
+                if (c && c->since + _ttl < next) next = c->since + _ttl;
+            }
+        }
+        co::sleep((uint32_t)(next > t ? next - t : 1));
+    }
+}
+
+}  // namespace idle
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "co/clist.h"
+#include "co/co/sock.h"
+
+// Idle connections of a server, kept in LRU lists by the time they became idle.
+// A reaper coroutine shuts down the sockets idle for too long, and the oldest
+// ones when there are too many idle connections. The connection coroutine, which
+// waits in recv() without a timeout, then wakes up and closes the connection.
+namespace idle {
+
+// an idle connection, it MUST NOT live on the stack of a coroutine, as stacks
+// are shared by coroutines and the list links would be overwritten
+struct conn_t : co::clink {
+    int64_t since;  // time in ms when it became idle
+    sock_t fd;
+    int slot;     // index of the list it was put in
+    bool reaped;  // the socket was shut down by the tracker
+};
+
+class Tracker {
+  public:
+    // @sec: max idle seconds of a connection, 0 for no limit
+    // @max: max number of idle connections
+    Tracker(uint32_t sec, uint32_t max);
+    ~Tracker();
+
+    // create a tracker and start the reaper coroutine, which holds a reference
+    // of the tracker until stop() was called
+    static std::shared_ptr<Tracker> start(uint32_t sec, uint32_t max);
+
+    // @c becomes idle, put it at the back of the list of the current scheduler
+    void add(conn_t* c, sock_t fd);
+
+    // @c is active again, return false if it was reaped while idle
+    bool del(conn_t* c);
+
+    // reap all idle connections and stop the reaper
+    void stop();
+
+  private:
+    struct list_t {
+        std::mutex mtx;
+        co::clist l;
+    };
+
+    void reap(list_t& l, conn_t* c);
+    void reap_oldest();
+    void loop();
+
+    list_t* _lists;
+    int _n;
+    int64_t _ttl;
+    uint32_t _max;
+    std::atomic<uint32_t> _count;
+    std::atomic_bool _stopped;
+};
+
+}  // namespace idle
@@ -0,0 +1,154 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "co/def.h"
+
+namespace lz4 {
+
+static const int kHashBits = 12;
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;  // the last 5 bytes are always literals
+static const size_t kMFLimit = 12;      // the last match starts 12 bytes before the end
+static const size_t kMaxOffset = 65535;
+
+typedef uint8_t u8;
+
+inline uint32_t read32(const u8* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint32_t hash(uint32_t v) { return (v * 2654435761U) >> (32 - kHashBits); }
+
+// write the remaining length (after the 4 bits in the token)
+inline u8* put_len(u8* op, size_t n) {
+    for (; n >= 255; n -= 255) *op++ = 255;
+    *op++ = (u8)n;
+    return op;
+}
+
+inline u8* put_literals(u8* op, u8* token, const u8* p, size_t n) {
+    if (n >= 15) {
+        *token = 15 << 4;
+        op = put_len(op, n - 15);
+    } else {
+        *token = (u8)(n << 4);
+    }
+    memcpy(op, p, n);
+    return op + n;
+}
+
+size_t compress(const void* src, size_t n, void* dst) {
+    const u8* const beg = (const u8*)src;
+    const u8* const end = beg + n;
+    const u8* anchor = beg;
+    u8* op = (u8*)dst;
+
+    if (n > kMFLimit) {
+        const u8* const mflimit = end - kMFLimit;
+        const u8* const matchlimit = end - kLastLiterals;
+        uint32_t table[1 << kHashBits];
+        memset(table, 0, sizeof(table));
+
+        const u8* ip = beg + 1;
+        uint32_t misses = 0;
+        while (ip < mflimit) {
+            const uint32_t seq = read32(ip);
+            const uint32_t h = hash(seq);
+            const u8* ref = beg + table[h];
+            table[h] = (uint32_t)(ip - beg);
+
+            if (ref >= ip || (size_t)(ip - ref) > kMaxOffset || read32(ref) != seq) {
+                ip += 1 + (misses++ >> 6);  // skip faster on incompressible data
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > beg && ip[-1] == ref[-1]) --ip, --ref;
+
+            const u8* p = ip + kMinMatch;
+            const u8* q = ref + kMinMatch;
+            while (p < matchlimit && *p == *q) ++p, ++q;
+
+            u8* token = op++;
+            op = put_literals(op, token, anchor, ip - anchor);
+
+            const size_t off = ip - ref;
+            *op++ = (u8)off;
+            *op++ = (u8)(off >> 8);
+
+            const size_t ml = p - ip - kMinMatch;
+            if (ml >= 15) {
+                *token |= 15;
+                op = put_len(op, ml - 15);
+            } else {
+                *token |= (u8)ml;
+            }
+
+            anchor = ip = p;
+            if (ip < mflimit) table[hash(read32(ip - 2))] = (uint32_t)(ip - 2 - beg);
+        }
+    }
+
+    u8* token = op++;
+    op = put_literals(op, token, anchor, end - anchor);
+    return op - (u8*)dst;
+}
+
+ptrdiff_t decompress(const void* src, size_t n, void* dst, size_t cap) {
+    const u8* ip = (const u8*)src;
+    const u8* const iend = ip + n;
+    u8* const beg = (u8*)dst;
+    u8* const oend = beg + cap;
+    u8* op = beg;
+
+    while (true) {
+        if (unlikely(ip >= iend)) return -1;
+        const u8 token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            u8 b;
+            do {
+                if (unlikely(ip >= iend)) return -1;
+                lit += (b = *ip++);
+            } while (b == 255);
+        }
+        if (unlikely(lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break;  // the last sequence has no match
+
+        if (unlikely(iend - ip < 2)) return -1;
+        const size_t off = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (unlikely(off == 0 || off > (size_t)(op - beg))) return -1;
+
+        size_t ml = token & 15;
+        if (ml == 15) {
+            u8 b;
+            do {
+                if (unlikely(ip >= iend)) return -1;
+                ml += (b = *ip++);
+            } while (b == 255);
+        }
+        ml += kMinMatch;
+        if (unlikely(ml > (size_t)(oend - op))) return -1;
+
+        const u8* match = op - off;
+        if (off >= ml) {
+            memcpy(op, match, ml);
+            op += ml;
+        } else {
+            for (size_t i = 0; i < ml; ++i) *op++ = *match++;  // overlapped
+        }
+    }
+
+    return op - beg;
+}
+
+}  // namespace lz4
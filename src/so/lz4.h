@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+// LZ4 block format, compatible with LZ4_compress_default() and
+// LZ4_decompress_safe() of liblz4.
+//   https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+namespace lz4 {
+
+// max size of the compressed data of @n bytes
+inline size_t compress_bound(size_t n) { return n + n / 255 + 16; }
+
+// compress @n bytes from @src to @dst, which has at least compress_bound(n) bytes.
+// return size of the compressed data.
+size_t compress(const void* src, size_t n, void* dst);
+
+// decompress @n bytes from @src to @dst, which has @cap bytes.
+// return size of the decompressed data, or -1 if the data is malformed or
+// @dst is not large enough.
+ptrdiff_t decompress(const void* src, size_t n, void* dst, size_t cap);
+
+}  // namespace lz4
@@ -0,0 +1,138 @@
+#include "./router.h"
+
+#include <string.h>
+
+namespace http {
+
+Router::node_t::~node_t() {
+    for (size_t i = 0; i < statics.size(); ++i) delete statics[i];
+    delete param;
+    delete rest;
+}
+
+bool Router::has_handler(const node_t* n) {
+    for (int i = 0; i <= kOptions; ++i) {
+        if (n->h[i]) return true;
+    }
+    return false;
+}
+
+// binary search in the sorted literal children
+const Router::node_t* Router::find_static(const node_t* n, co::strview seg) {
+    size_t b = 0, e = n->statics.size();
+    while (b < e) {
+        const size_t m = (b + e) >> 1;
+        const int r = co::strview(n->statics[m]->seg).compare(seg);
+        if (r == 0) return n->statics[m];
+        r < 0 ? (void)(b = m + 1) : (void)(e = m);
+    }
+    return 0;
+}
+
+Router::node_t* Router::add_static(node_t* n, co::strview seg) {
+    node_t* x = (node_t*)find_static(n, seg);
+    if (x) return x;
+
+    x = new node_t();
+    x->seg.append(seg);
+    auto& v = n->statics;
+    v.push_back(x);
+    for (size_t i = v.size() - 1; i > 0 && co::strview(v[i - 1]->seg).compare(seg) > 0; --i) {
+        v[i] = v[i - 1];
+        v[i - 1] = x;
+    }
+    return x;
+}
+
+bool Router::add(Method m, const char* pattern, Server::Handler&& f) {
+    if ((int)m < 0 || (int)m > kOptions || !f) return false;
+
+    node_t* n = _root;
+    int nparams = 0;
+    const char* p = pattern;
+    while (*p) {
+        if (*p == '/') { ++p; continue; }
+        const char* q = strchr(p, '/');
+        if (!q) q = p + strlen(p);
+        const co::strview seg(p, q - p);
+        p = q;
+
+        if (seg[0] == ':' || seg[0] == '*') {
+            const co::strview name = seg.substr(1);
+            if (name.empty() || ++nparams > Params::kMaxParams) return false;
+            if (seg[0] == '*') {
+                while (*p == '/') ++p;
+                if (*p) return false;  // "*name" MUST be the last segment
+            }
+            node_t*& x = seg[0] == ':' ? n->param : n->rest;
+            if (!x) {
+                x = new node_t();
+                x->seg.append(name);
+            } else if (!(co::strview(x->seg) == name)) {
+                return false;  // the same position with different names
+            }
+            n = x;
+        } else {
+            n = add_static(n, seg);
+        }
+    }
+
+    if (n->h[m]) return false;
+    n->h[m] = std::move(f);
+    _empty = false;
+    return true;
+}
+
+// match the path from @p to @e under node @n, return the node found or NULL
+const Router::node_t* Router::match(const node_t* n, const char* p, const char* e, Params& ps) {
+    while (p < e && *p == '/') ++p;
+    if (p == e) {
+        if (has_handler(n)) return n;
+        if (n->rest && has_handler(n->rest)) {
+            ps._names[ps._n] = n->rest->seg;
+            ps._vals[ps._n++] = co::strview(p, 0);
+            return n->rest;
+        }
+        return 0;
+    }
+
+    const char* q = (const char*)memchr(p, '/', e - p);
+    if (!q) q = e;
+    const node_t* r;
+    if (!n->statics.empty()) {
+        const node_t* x = find_static(n, co::strview(p, q - p));
+        if (x && (r = match(x, q, e, ps))) return r;
+    }
+    if (n->param) {
+        ps._names[ps._n] = n->param->seg;
+        ps._vals[ps._n++] = co::strview(p, q - p);
+        if ((r = match(n->param, q, e, ps))) return r;
+        --ps._n;
+    }
+    if (n->rest && has_handler(n->rest)) {
+        ps._names[ps._n] = n->rest->seg;
+        ps._vals[ps._n++] = co::strview(p, e - p);
+        return n->rest;
+    }
+    return 0;
+}
+
+int Router::dispatch(const Req& req, Res& res) const {
+    const fastring& url = req.url();
+    const char* const p = url.data();
+    const char* e = (const char*)memchr(p, '?', url.size());
+    if (!e) e = p + url.size();
+
+    Params ps;
+    const node_t* n = match(_root, p, e, ps);
+    if (!n) return 404;
+
+    const Method m = req.method();
+    const Server::Handler* h = &n->h[m];
+    if (!*h && m == kHead) h = &n->h[kGet];
+    if (!*h) return 405;
+    (*h)(req, res, ps);
+    return 0;
+}
+
+}  // namespace http
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "co/fastring.h"
+#include "co/http.h"
+#include "co/vector.h"
+
+namespace http {
+
+// Routes of http::Server, compiled into a tree of path segments. Each node has
+// literal children sorted by the segment, and at most one ":name" child and one
+// "*name" child. Requests are matched with backtracking, literal segments first.
+class Router {
+  public:
+    Router() : _root(new node_t()), _empty(true) {}
+    ~Router() { delete _root; }
+
+    // return false if the pattern is invalid, or conflicts with another route
+    bool add(Method m, const char* pattern, Server::Handler&& f);
+
+    bool empty() const { return _empty; }
+
+    // handle a request, return 0 if a route was found, otherwise 404 or 405
+    int dispatch(const Req& req, Res& res) const;
+
+  private:
+    struct node_t {
+        node_t() : param(0), rest(0) {}
+        ~node_t();
+
+        fastring seg;                 // the literal segment, or name of the parameter
+        co::vector<node_t*> statics;  // literal children, sorted by seg
+        node_t* param;                // the ":name" child
+        node_t* rest;                 // the "*name" child
+        Server::Handler h[kOptions + 1];
+    };
+
+    static bool has_handler(const node_t* n);
+    static node_t* add_static(node_t* n, co::strview seg);
+    static const node_t* find_static(const node_t* n, co::strview seg);
+    static const node_t* match(const node_t* n, const char* p, const char* e, Params& ps);
+
+  private:
+    node_t* _root;
+    bool _empty;
+
+    DISALLOW_COPY_AND_ASSIGN(Router);
+};
+
+}  // namespace http
@@ -3,11 +3,15 @@
 #include <atomic>
 
 #include "./http.h"
+#include "./idle.h"
+#include "./lz4.h"
+#include "../co/probe.h"
 #include "co/co.h"
 #include "co/fastream.h"
 #include "co/fastring.h"
 #include "co/hash.h"
 #include "co/http.h"
+#include "co/metrics.h"
 #include "co/str.h"
 #include "co/tcp.h"
 #include "co/time.h"
@@ -20,6 +24,18 @@ DEF_int32(rpc_conn_idle_sec, 180,
           ">>#2 connection may be closed if no data was recieved for n seconds");
 DEF_uint32(rpc_max_idle_conn, 128, ">>#2 max idle connections");
 DEF_bool(rpc_log, true, ">>#2 enable rpc log if true");
+DEF_uint32(rpc_max_async_calls, 256,
+           ">>#2 max calls with request id processed concurrently on a connection");
+DEF_bool(rpc_binary, true, ">>#2 rpc client packs requests in MessagePack instead of json text");
+DEF_uint32(rpc_compress_size, 0,
+           ">>#2 rpc messages not smaller than this size are compressed with lz4, 0: disabled");
+DEF_bool(rpc_method_id, false,
+         ">>#2 rpc client sends hash of the api in the header, servers dispatch by it");
+DEF_bool(rpc_deadline, false,
+         ">>#2 rpc client sends its recv timeout in the header as the deadline of calls, "
+         "servers drop requests that expired");
+DEF_uint32(rpc_stream_window, 64,
+           ">>#2 messages of a rpc stream sent before the client has consumed them");
 DEC_uint32(http_max_header_size);
 
 #define RPCLOG LOG_IF(FLG_rpc_log)
@@ -27,17 +43,102 @@ DEC_uint32(http_max_header_size);
 namespace rpc {
 
 struct Header {
-    uint16_t flags;  // reserved, 0
-    uint16_t magic;  // 0x7777
-    uint32_t len;    // body len
-};                   // 8 bytes
+    uint16_t flags;     // kHasId, kHasMethod, kHasDeadline, kBinary, kLz4, kAcceptLz4
+    uint16_t magic;     // 0x7777
+    uint32_t len;       // body len
+    uint32_t id;        // request id, the response carries the same id
+    uint32_t method;    // method id of the request, follows id if kHasMethod is set
+    uint32_t deadline;  // ms the client waits for the response, follows id or method
+};  // 8 bytes, 12 bytes with an id, 4 more bytes for each of method id and deadline
 
 static const uint16_t kMagic = 0x7777;
+static const uint16_t kHasId = 0x0100;   // 1 in network byte order
+static const uint16_t kBinary = 0x0200;  // 2 in network byte order
+static const uint16_t kLz4 = 0x0400;     // 4, the body is compressed with lz4
+static const uint16_t kAcceptLz4 = 0x0800;  // 8, the client accepts compressed responses
+static const uint16_t kHasMethod = 0x1000;  // 16, the method id follows id
+static const uint16_t kHasDeadline = 0x2000;  // 32, the deadline follows id or method id
+static const uint16_t kStream = 0x4000;  // 64, the frame belongs to the stream of the id
+static const uint16_t kEnd = 0x8000;     // 128, the last frame of a stream, or a cancel
+static const uint16_t kAck = 0x0001;     // 256, the client consumed n messages of a stream
+static const int kHeaderSize = 8;       // size of the header without id
+
+inline int header_size(uint16_t flags) {
+    if (!(flags & kHasId)) return kHeaderSize;
+    return 12 + ((flags & kHasMethod) ? 4 : 0) + ((flags & kHasDeadline) ? 4 : 0);
+}
+
+inline int header_size(const Header& h) { return header_size(h.flags); }
 
-inline void set_header(const void* header, uint32_t msg_len) {
-    ((Header*)header)->flags = 0;
+// id of the method "service.method", the same on all platforms
+inline uint32_t method_id(const char* name, size_t n) { return (uint32_t)hash64(name, n); }
+
+// requests without id were sent by old clients, the responses have no id too
+inline void set_header(const void* header, uint32_t msg_len, uint16_t flags = 0, uint32_t id = 0) {
+    ((Header*)header)->flags = flags;
     ((Header*)header)->magic = kMagic;
     ((Header*)header)->len = hton32(msg_len);
+    if (flags & kHasId) ((Header*)header)->id = id;
+}
+
+inline void set_header(const void* header, uint32_t msg_len, uint16_t flags, uint32_t id,
+                       uint32_t method) {
+    set_header(header, msg_len, flags, id);
+    if (flags & kHasMethod) ((Header*)header)->method = method;
+}
+
+inline void set_header(const void* header, uint32_t msg_len, uint16_t flags, uint32_t id,
+                       uint32_t method, uint32_t deadline) {
+    set_header(header, msg_len, flags, id, method);
+    if (flags & kHasDeadline) {
+        uint32_t* const p = (flags & kHasMethod) ? &((Header*)header)->deadline
+                                                 : &((Header*)header)->method;
+        *p = hton32(deadline);
+    }
+}
+
+// the body is MessagePack if kBinary is set, otherwise json text
+inline json::Json decode(uint16_t flags, const char* p, size_t n) {
+    return (flags & kBinary) ? json::unpack(p, n) : json::parse(p, n);
+}
+
+// decode a request into the arena of the connection, MessagePack is not parsed
+// with an arena
+inline void decode(uint16_t flags, const char* p, size_t n, json::Arena& a, json::Json& v) {
+    if (flags & kBinary) {
+        v = json::unpack(p, n);
+    } else if (!v.parse_from(p, n, a)) {
+        v.reset();
+    }
+}
+
+inline void encode(uint16_t flags, const json::Json& v, fastring& s) {
+    (flags & kBinary) ? (void)v.pack(s) : (void)v.str(s);
+}
+
+// Compress the body of @s (after the header of @hlen bytes) if it is not smaller than
+// FLG_rpc_compress_size. The compressed body begins with size of the original body
+// (4 bytes, network byte order). Return kLz4 if the body was compressed.
+inline uint16_t compress(fastring& s, size_t hlen) {
+    const size_t n = s.size() - hlen;
+    if (FLG_rpc_compress_size == 0 || n < FLG_rpc_compress_size) return 0;
+
+    fastring z(hlen + 4 + lz4::compress_bound(n));
+    const size_t m = lz4::compress(s.data() + hlen, n, (char*)z.data() + hlen + 4);
+    if (m + 4 >= n) return 0;  // not compressible
+    z.resize(hlen + 4 + m);
+    store_be32(&z[hlen], (uint32_t)n);
+    s.swap(z);
+    return kLz4;
+}
+
+// decompress the body of @n bytes at @p to @s, return false on error
+inline bool decompress(const char* p, size_t n, fastring& s) {
+    if (n < 4) return false;
+    const uint32_t m = load_be32(p);
+    if (m > (uint32_t)FLG_rpc_max_msg_size) return false;
+    s.resize(m);
+    return lz4::decompress(p + 4, n - 4, (char*)s.data(), m) == (ptrdiff_t)m;
 }
 
 class ServerImpl {
@@ -48,6 +149,7 @@ class ServerImpl {
         using std::placeholders::_1;
         using std::placeholders::_2;
         _methods["ping"] = &ServerImpl::ping;
+        this->add_method_id("ping");
     }
 
     ~ServerImpl() = default;
@@ -56,9 +158,25 @@ class ServerImpl {
         _services[s->name()] = s;
         for (auto& x : s->methods()) {
             _methods[x.first] = x.second;
+            this->add_method_id(x.first);
         }
     }
 
+    // Methods are also indexed by method_id() of the name. Ids shared by different
+    // names are not used, requests with them fall back to the "api" field.
+    void add_method_id(const char* name) {
+        const uint32_t id = method_id(name, strlen(name));
+        if (_bad_ids.count(id)) return;
+        auto r = _method_ids.emplace(id, method_t{name, &_methods[name]});
+        if (!r.second && strcmp(r.first->second.name, name) != 0) {
+            WLOG << "rpc method id conflicts: " << name << ", " << r.first->second.name;
+            _method_ids.erase(r.first);
+            _bad_ids.insert(id);
+        }
+    }
+
+    void add_stream(const char* api, Server::StreamFun&& f) { _streams[api] = std::move(f); }
+
     Service::Fun* find_method(const char* name) {
         auto it = _methods.find(name);
         return it != _methods.end() ? &it->second : nullptr;
@@ -69,6 +187,8 @@ class ServerImpl {
     void start(const char* ip, int port, const char* url, const char* key, const char* ca) {
         _url = url;
         _started.store(true, std::memory_order_relaxed);
+        _idle = idle::Tracker::start(FLG_rpc_conn_idle_sec > 0 ? FLG_rpc_conn_idle_sec : 0,
+                                     FLG_rpc_max_idle_conn);
         _tcp_serv.on_connection(&ServerImpl::on_connection, this);
         _tcp_serv.on_exit([this]() { delete this; });
         _tcp_serv.start(ip, port, key, ca);
@@ -78,17 +198,36 @@ class ServerImpl {
 
     void exit() {
         _stopped.store(true, std::memory_order_relaxed);
+        if (_idle) _idle->stop();
         _tcp_serv.exit();
     }
 
     void process(json::Json& req, json::Json& res);
+    void process(uint32_t mid, json::Json& req, json::Json& res);
 
   private:
+    struct method_t {
+        const char* name;
+        Service::Fun* fun;
+    };
+    struct async_ctx_t;
+    struct async_call_t;
+    struct stream_t;
+    void process_async(async_call_t* c);
+    void process_stream(stream_t* s);
+    static void end_stream(async_ctx_t* ctx, uint16_t flags, uint32_t id, const char* err);
+    bool open_stream(async_ctx_t* ctx, const Header& h, int64_t expire, json::Json&& req);
+
     tcp::Server _tcp_serv;
     std::atomic_bool _started;
     std::atomic_bool _stopped;
+    std::shared_ptr<idle::Tracker> _idle;
     co::hash_map<const char*, std::shared_ptr<Service>> _services;
     co::hash_map<const char*, Service::Fun> _methods;
+    co::hash_map<uint32_t, method_t> _method_ids;
+    co::hash_set<uint32_t> _bad_ids;
+    co::hash_map<const char*, Server::StreamFun> _streams;
+    friend class Writer;
     fastring _url;
 };
 
@@ -113,36 +252,292 @@ void Server::start(const char* ip, int port, const char* url, const char* key, c
 
 void Server::exit() { ((ServerImpl*)_p)->exit(); }
 
+Server& Server::add_stream(const char* api, StreamFun f) {
+    ((ServerImpl*)_p)->add_stream(api, std::move(f));
+    return *this;
+}
+
+static co::metrics::histogram g_call_us(
+    "co_rpc_server_call_us", "time of rpc calls handled by methods in microseconds");
+
+static co::metrics::counter g_call_err(
+    "co_rpc_server_errors_total", "rpc calls with no method to handle them");
+
+static co::metrics::counter g_call_expired(
+    "co_rpc_server_expired_total", "rpc requests dropped as their deadline has passed");
+
+// deadline of the call handled in the current coroutine, in ms since epoch,
+// or -1 if the client sent no deadline
+static co::cls<int64_t> g_deadline;
+
+inline void set_deadline(int64_t t) {
+    int64_t* p = g_deadline.get();
+    if (!p) {
+        if (t < 0) return;
+        g_deadline.set(p = new int64_t);
+    }
+    *p = t;
+}
+
+int deadline() {
+    const int64_t* const p = g_deadline.get();
+    if (!p || *p < 0) return -1;
+    const int64_t r = *p - now::ms();
+    return r > 0 ? (int)r : 0;
+}
+
 void ServerImpl::process(json::Json& req, json::Json& res) {
     auto& x = req.get("api");
     if (x.is_string()) {
         auto m = this->find_method(x.as_c_str());
         if (m) {
+            CO_PROBE1(rpc_begin, x.as_c_str());
+            const int64_t t = now::us();
             (*m)(req, res);
+            g_call_us.observe((uint64_t)(now::us() - t));
+            CO_PROBE1(rpc_end, x.as_c_str());
         } else {
+            g_call_err.inc();
             res.add_member("error", "api not found");
         }
     } else {
+        g_call_err.inc();
         res.add_member("error", "bad req: no string filed 'api'");
     }
 }
 
+// dispatch by the method id first, the name is still checked as ids may collide
+void ServerImpl::process(uint32_t mid, json::Json& req, json::Json& res) {
+    auto it = _method_ids.find(mid);
+    if (it != _method_ids.end()) {
+        auto& x = req.get("api");
+        if (x.is_string() && strcmp(x.as_c_str(), it->second.name) == 0) {
+            CO_PROBE1(rpc_begin, it->second.name);
+            const int64_t t = now::us();
+            (*it->second.fun)(req, res);
+            g_call_us.observe((uint64_t)(now::us() - t));
+            CO_PROBE1(rpc_end, it->second.name);
+            return;
+        }
+    }
+    this->process(req, res);
+}
+
 using http::http_req_t;
 using http::http_res_t;
 
-void ServerImpl::on_connection(tcp::Connection conn) {
+// A stream in progress on a connection. The client grants credits as it consumes
+// messages, the handler waits when they run out.
+struct ServerImpl::stream_t {
+    stream_t(async_ctx_t* ctx, const Header& h, int64_t expire, const char* name,
+             Server::StreamFun* fun, json::Json&& req)
+        : ctx(ctx), flags(h.flags), id(h.id), expire(expire), name(name), fun(fun),
+          req(std::move(req)), credit(FLG_rpc_stream_window > 0 ? FLG_rpc_stream_window : 1),
+          cancelled(false) {}
+
+    async_ctx_t* ctx;
+    uint16_t flags;
+    uint32_t id;
+    int64_t expire;
+    const char* name;  // name of the method
+    Server::StreamFun* fun;
+    json::Json req;
+    co::event ev;     // signaled on credits or cancel
+    uint32_t credit;  // messages that can be sent
+    bool cancelled;   // the client closed the stream
+};
+
+// Requests with id may be processed concurrently in coroutines, on the scheduler
+// of the connection. Responses are sent in the order they are done. As coroutines
+// share stacks, the connection is held here on the heap.
+struct ServerImpl::async_ctx_t {
+    explicit async_ctx_t(tcp::Connection&& c)
+        : conn(std::move(c)), n(0), sending(false), broken(false) {}
+
+    // wait for the calls in progress, before the connection is closed, streams
+    // are cancelled as no more credits will arrive
+    void wait() {
+        while (n > 0) {
+            for (auto& x : streams) {
+                x.second->cancelled = true;
+                x.second->ev.signal();
+            }
+            ev.wait(100);
+        }
+    }
+
+    // Send a response, or queue it if another coroutine is sending. The sender
+    // sends the queued responses before it returns, those done during a send go
+    // out together in the next one. All coroutines of the connection run in the
+    // same scheduler, no lock is needed. @s may be swapped with the queue.
+    bool send(fastring& s) {
+        if (broken) return false;
+        if (sending) {
+            out.append(s);
+            return true;
+        }
+
+        sending = true;
+        while (true) {
+            if (conn.send(s.data(), (int)s.size(), FLG_rpc_send_timeout) <= 0) {
+                ELOG << "rpc send error: " << conn.strerror();
+                broken = true;
+                out.clear();
+                break;
+            }
+            if (out.empty()) break;
+            s.swap(out);
+            out.clear();
+        }
+        sending = false;
+        return !broken;
+    }
+
+    tcp::Connection conn;
+    co::hash_map<uint32_t, stream_t*> streams;
+    fastring out;   // responses waiting for the current send
+    co::event ev;   // signaled when n becomes 0
+    uint32_t n;     // calls in progress
+    bool sending;   // a coroutine is sending responses
+    bool broken;    // a send failed
+};
+
+struct ServerImpl::async_call_t {
+    async_call_t(async_ctx_t* ctx, const Header& h, int64_t expire, json::Json&& req)
+        : ctx(ctx), flags(h.flags), id(h.id), method(h.method), expire(expire),
+          req(std::move(req)) {}
+
+    async_ctx_t* ctx;
+    uint16_t flags;
+    uint32_t id;
+    uint32_t method;
+    int64_t expire;  // deadline of the call in ms since epoch, -1 for none
+    json::Json req;
+};
+
+void ServerImpl::process_async(async_call_t* c) {
+    async_ctx_t* const ctx = c->ctx;
+    uint16_t flags = c->flags & (kHasId | kBinary);
+    const bool accept_lz4 = c->flags & kAcceptLz4;
+    const uint32_t id = c->id;
+    json::Json res;
+
+    // the call may have waited in the scheduler until its deadline
+    if (c->expire >= 0 && now::ms() >= c->expire) {
+        g_call_expired.inc();
+        RPCLOG << "rpc drop expired req, id: " << id;
+        delete c;
+        if (--ctx->n == 0) ctx->ev.signal();
+        return;
+    }
+
+    set_deadline(c->expire);
+    if (c->flags & kHasMethod) {
+        this->process(c->method, c->req, res);
+    } else {
+        this->process(c->req, res);
+    }
+    delete c;
+
+    fastring s(256);
+    s.resize(12);
+    encode(flags, res, s);
+    if (accept_lz4) flags |= compress(s, 12);
+    set_header(s.data(), (uint32_t)(s.size() - 12), flags, id);
+    if (ctx->send(s)) RPCLOG << "rpc send res: " << res;
+    if (--ctx->n == 0) ctx->ev.signal();
+}
+
+bool Writer::write(const json::Json& msg) {
+    auto s = (ServerImpl::stream_t*)_p;
+    while (s->credit == 0 && !s->cancelled && !s->ctx->broken) {
+        if (!s->ev.wait(FLG_rpc_send_timeout)) {
+            ELOG << "rpc stream write timeout, id: " << s->id;
+            return false;
+        }
+    }
+    if (s->cancelled || s->ctx->broken) return false;
+    --s->credit;
+
+    uint16_t flags = kHasId | kStream | (s->flags & kBinary);
+    fastring buf(256);
+    buf.resize(12);
+    encode(flags, msg, buf);
+    if (s->flags & kAcceptLz4) flags |= compress(buf, 12);
+    set_header(buf.data(), (uint32_t)(buf.size() - 12), flags, s->id);
+    return s->ctx->send(buf);
+}
+
+// the stream ends with a frame of kEnd, carrying {} or {"error": ...}
+void ServerImpl::end_stream(async_ctx_t* ctx, uint16_t flags, uint32_t id, const char* err) {
+    json::Json res = json::object();
+    if (err) res.add_member("error", err);
+    flags = kHasId | kStream | kEnd | (flags & kBinary);
+    fastring buf(32);
+    buf.resize(12);
+    encode(flags, res, buf);
+    set_header(buf.data(), (uint32_t)(buf.size() - 12), flags, id);
+    ctx->send(buf);
+}
+
+void ServerImpl::process_stream(stream_t* s) {
+    async_ctx_t* const ctx = s->ctx;
+    CO_PROBE1(rpc_begin, s->name);
+    set_deadline(s->expire);
+    {
+        Writer w(s);
+        (*s->fun)(s->req, w);
+    }
+    CO_PROBE1(rpc_end, s->name);
+    if (!s->cancelled) end_stream(ctx, s->flags, s->id, nullptr);
+    RPCLOG << "rpc stream end, id: " << s->id;
+    ctx->streams.erase(s->id);
+    delete s;
+    if (--ctx->n == 0) ctx->ev.signal();
+}
+
+// start the stream of a request, return false if the connection is broken
+bool ServerImpl::open_stream(async_ctx_t* ctx, const Header& h, int64_t expire,
+                             json::Json&& req) {
+    const char* err = nullptr;
+    auto& api = req.get("api");
+    auto it = api.is_string() ? _streams.find(api.as_c_str()) : _streams.end();
+    if (it == _streams.end()) {
+        g_call_err.inc();
+        err = "api not found";
+    } else if (ctx->n >= FLG_rpc_max_async_calls || ctx->streams.count(h.id)) {
+        err = "too many calls";
+    }
+    if (err) {
+        end_stream(ctx, h.flags, h.id, err);
+        return !ctx->broken;
+    }
+
+    auto s = new stream_t(ctx, h, expire, it->first, &it->second, std::move(req));
+    ctx->streams[h.id] = s;
+    ++ctx->n;
+    co::sched()->go(&ServerImpl::process_stream, this, s);
+    return true;
+}
+
+void ServerImpl::on_connection(tcp::Connection tc) {
     int kind = 0;  // 0: init, 1: RPC, 2: HTTP
-    int r = 0, len = 0;
-    union {
-        Header header;
-        char c;
-    };
-    fastring buf;
+    int r = 0, len = 0, hlen = kHeaderSize;
+    Header header;
+    const char* p = 0;
+    fastring buf, zbuf, s, x;
+    json::Arena arena;  // for requests, cleared after the response was sent
     json::Json req, res;
+    uint16_t flags = 0;
+    int64_t expire = -1;
+    async_ctx_t& actx = *new async_ctx_t(std::move(tc));
+    tcp::Connection& conn = actx.conn;
 
     size_t pos = 0, total_len = 0;
     http_req_t* preq = 0;
     http_res_t* pres = 0;
+    auto tracker = _idle;
+    std::unique_ptr<idle::conn_t> ic(new idle::conn_t());
 
     while (true) {
         switch (kind) {
@@ -155,37 +550,54 @@ void ServerImpl::on_connection(tcp::Connection conn) {
         }
 
     init:
-        r = conn.recvn(&header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
+        r = conn.peek(&p, 4, FLG_rpc_conn_idle_sec * 1000);
         if (unlikely(r == 0)) goto recv_zero_err;
         if (unlikely(r < 0)) goto recv_err;
         buf.reserve(4096);
 
         // if the first 4 bytes is "POST", it is a HTTP request, otherwise it is a RPC request
-        if (*(uint32_t*)&header != *(uint32_t*)"POST") goto rpc;
+        if (memcmp(p, "POST", 4) != 0) goto rpc;
         goto http;
 
     rpc:
         do {
         recv_rpc_beg:
-            // recv req from the client
-            if (kind == 1) {
-                r = conn.recvn(&header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
-                if (unlikely(r == 0)) goto recv_zero_err;
-                if (unlikely(r < 0)) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_stopped) {
-                        conn.reset();
-                        goto end;
-                    }  // server stopped
-                    if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
-                    buf.reset();
-                    goto recv_rpc_beg;
-                }
-            } else {
-                kind = 1;
+            // wait for the next req, the idle tracker shuts down the socket if
+            // the connection was idle for too long
+            kind = 1;
+            tracker->add(ic.get(), conn.socket());
+            r = conn.peek(&p, 1, -1);
+            if (!tracker->del(ic.get())) {
+                if (_stopped) {
+                    actx.wait();
+                    conn.reset();
+                    goto end;
+                }  // server stopped
+                goto idle_err;
             }
+            if (unlikely(r == 0)) goto recv_zero_err;
+            if (unlikely(r < 0)) goto recv_err;
+
+            // recv req from the client, the body is usually buffered with the header
+            r = conn.recvn(&header, kHeaderSize, FLG_rpc_recv_timeout);
+            if (unlikely(r == 0)) goto recv_zero_err;
+            if (unlikely(r < 0)) goto recv_err;
 
             if (unlikely(header.magic != kMagic)) goto magic_err;
+            hlen = header_size(header);
+            if (hlen > kHeaderSize) {
+                r = conn.recvn(&header.id, hlen - kHeaderSize, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+            }
+
+            // the deadline is relative to the arrival of the request, as clocks of
+            // the client and server may differ
+            expire = -1;
+            if ((header.flags & (kHasId | kHasDeadline)) == (kHasId | kHasDeadline)) {
+                if (!(header.flags & kHasMethod)) header.deadline = header.method;
+                expire = now::ms() + ntoh32(header.deadline);
+            }
 
             len = ntoh32(header.len);
             if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
@@ -196,21 +608,84 @@ void ServerImpl::on_connection(tcp::Connection conn) {
             if (unlikely(r == 0)) goto recv_zero_err;
             if (unlikely(r < 0)) goto recv_err;
 
-            req = json::parse(buf.data(), buf.size());
+            // credits and cancels of streams, sent by the client
+            if ((header.flags & (kHasId | kStream)) == (kHasId | kStream) &&
+                (header.flags & (kAck | kEnd))) {
+                auto it = actx.streams.find(header.id);
+                if (it != actx.streams.end()) {
+                    if (header.flags & kEnd) {
+                        it->second->cancelled = true;
+                    } else if (len == 4) {
+                        it->second->credit += load_be32(buf.data());
+                    }
+                    it->second->ev.signal();
+                }
+                goto recv_rpc_beg;
+            }
+
+            // requests that expired are dropped before they are decoded, the client
+            // has given up the call already
+            if (expire >= 0 && now::ms() >= expire) {
+                g_call_expired.inc();
+                RPCLOG << "rpc drop expired req, id: " << header.id;
+                goto recv_rpc_beg;
+            }
+
+            if (header.flags & kLz4) {
+                if (!decompress(buf.data(), buf.size(), zbuf)) goto lz4_err;
+                buf.swap(zbuf);
+            }
+
+            // streams always run in coroutines, as their handlers wait for credits
+            if (hlen > kHeaderSize && (header.flags & kStream)) {
+                req = decode(header.flags, buf.data(), buf.size());
+                if (req.is_null()) goto json_parse_err;
+                RPCLOG << "rpc recv stream req: " << req;
+                if (actx.broken) goto reset_conn;
+                if (!this->open_stream(&actx, header, expire, std::move(req))) goto reset_conn;
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+
+            // Calls with id are processed in coroutines, unless too many of them are
+            // in progress, then the client has to wait. Requests of them outlive
+            // this loop, they are not parsed with the arena.
+            if (hlen > kHeaderSize && actx.n < FLG_rpc_max_async_calls) {
+                req = decode(header.flags, buf.data(), buf.size());
+                if (req.is_null()) goto json_parse_err;
+                RPCLOG << "rpc recv req: " << req;
+                if (actx.broken) goto reset_conn;
+                ++actx.n;
+                co::sched()->go(&ServerImpl::process_async, this,
+                                new async_call_t(&actx, header, expire, std::move(req)));
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+
+            decode(header.flags, buf.data(), buf.size(), arena, req);
             if (req.is_null()) goto json_parse_err;
             RPCLOG << "rpc recv req: " << req;
 
             // call rpc and send response to the client
             res.reset();
-            this->process(req, res);
+            set_deadline(expire);
+            if (header.flags & kHasMethod) {
+                this->process(header.method, req, res);
+            } else {
+                this->process(req, res);
+            }
 
-            buf.resize(sizeof(Header));
-            res.str(buf);
-            set_header(buf.data(), (uint32_t)(buf.size() - sizeof(Header)));
+            flags = header.flags & (kHasId | kBinary);
+            hlen = header_size(flags);
+            buf.resize(hlen);
+            encode(flags, res, buf);
+            if (header.flags & kAcceptLz4) flags |= compress(buf, hlen);
+            set_header(buf.data(), (uint32_t)(buf.size() - hlen), flags, header.id);
 
-            r = conn.send(buf.data(), (int)buf.size(), FLG_rpc_send_timeout);
-            if (unlikely(r <= 0)) goto send_err;
+            if (unlikely(!actx.send(buf))) goto reset_conn;
             RPCLOG << "rpc send res: " << res;
+            req.reset();
+            arena.clear();
 
             if (_stopped) goto reset_conn;
             goto recv_rpc_beg;
@@ -219,46 +694,31 @@ void ServerImpl::on_connection(tcp::Connection conn) {
     http:
         do {
         recv_http_beg:
-            if (kind == 2) {
-                if (buf.capacity() == 0) {
-                    // try to recieve a single byte
-                    r = conn.recv(&c, 1, FLG_rpc_conn_idle_sec * 1000);
-                    if (r == 0) goto recv_zero_err;
-                    if (r < 0) {
-                        if (!co::timeout()) goto recv_err;
-                        if (_stopped) {
-                            conn.reset();
-                            goto end;
-                        }  // server stopped
-                        if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
-                        goto recv_http_beg;
-                    }
-                    buf.reserve(4096);
-                    buf.append(c);
-                }
-            } else {
-                kind = 2;
-                buf.append(&header, sizeof(header));
+            // wait for the next request, it may be buffered already
+            kind = 2;
+            tracker->add(ic.get(), conn.socket());
+            r = conn.peek(&p, 1, -1);
+            if (!tracker->del(ic.get())) {
+                if (_stopped) {
+                    conn.reset();
+                    goto end;
+                }  // server stopped
+                goto idle_err;
             }
+            if (r == 0) goto recv_zero_err;
+            if (r < 0) goto recv_err;
 
             // recv until the entire http header was done.
-            while ((pos = buf.find("\r\n\r\n")) == buf.npos) {
-                if (buf.size() > FLG_http_max_header_size) goto header_too_long_err;
-                buf.reserve(buf.size() + 1024);
-                r = conn.recv((void*)(buf.data() + buf.size()), (int)(buf.capacity() - buf.size()),
-                              FLG_rpc_recv_timeout);
-                if (r == 0) goto recv_zero_err;
-                if (r < 0) {
-                    if (!co::timeout()) goto recv_err;
-                    if (_tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
-                    if (buf.empty()) {
-                        buf.reset();
-                        goto recv_http_beg;
-                    }
-                    goto recv_err;
-                }
-                buf.resize(buf.size() + r);
+            r = conn.read_until("\r\n\r\n", &p, (int)FLG_http_max_header_size,
+                                FLG_rpc_recv_timeout);
+            if (r == 0) goto recv_zero_err;
+            if (r < 0) {
+                if (co::error() == EMSGSIZE) goto header_too_long_err;
+                goto recv_err;
             }
+            buf.clear();
+            buf.append(p, r);
+            pos = r - 4;
 
             buf[pos + 2] = '\0';  // make header null-terminated
             RPCLOG << "rpc recv http header: " << buf.data();
@@ -305,8 +765,8 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
             { /* handle the http request */
                 bool need_close = false;
-                fastring x;
-                fastring s(4096);
+                if (s.capacity() == 0) s.reserve(4096);
+                s.clear();
                 s.append(preq->header("Connection"));
                 if (!s.empty()) pres->add_header("Connection", s.c_str());
 
@@ -319,14 +779,15 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 s.clear();
                 pres->buf = &s;
 
-                req = json::parse(preq->buf->data() + preq->body, preq->body_size);
+                decode(0, preq->buf->data() + preq->body, preq->body_size, arena, req);
                 if (req.is_null()) goto json_parse_err;
                 RPCLOG << "rpc recv http body: " << req;
 
                 res.reset();
                 this->process(req, res);
 
-                x = res.str();
+                x.clear();
+                res.str(x);
                 pres->status = 200;
                 pres->add_header("Content-Type", "application/json");
                 pres->set_body(x.data(), x.size());
@@ -335,20 +796,18 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 if (r <= 0) goto send_err;
 
                 RPCLOG << "rpc send http res: " << s;
+                req.reset();
+                arena.clear();
                 if (need_close) {
                     conn.close();
                     goto end;
                 }
             }
 
-            if (buf.size() == total_len) {
-                buf.clear();
-            } else {
-                buf.trim(total_len, 'l');
-            }
-
+            buf.clear();
             preq->clear();
             pres->clear();
+            if (s.capacity() > (1 << 20)) s.reset();  // do not keep a large buffer
             total_len = 0;
             if (_stopped) goto reset_conn;
             goto recv_http_beg;
@@ -357,10 +816,12 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
 recv_zero_err:
     LOG << "rpc client close the connection, connfd: " << conn.socket();
+    actx.wait();
     conn.close();
     goto end;
 idle_err:
     ELOG << "rpc close idle connection, connfd: " << conn.socket();
+    actx.wait();
     conn.reset();
     goto end;
 magic_err:
@@ -381,34 +842,97 @@ send_err:
 json_parse_err:
     ELOG << "rpc json parse error: " << buf;
     goto reset_conn;
+lz4_err:
+    ELOG << "rpc lz4 decompress error, body len: " << len;
+    goto reset_conn;
 http_parse_err:
     ELOG << "rpc http parse error: " << r;
     http::send_error_message(r, pres, &conn);
     goto reset_conn;
 reset_conn:
+    actx.wait();
     conn.reset(3000);
 end:
-    if (preq) ::free(preq);
+    actx.wait();
+    delete &actx;
+    if (preq) http::free_http_req(preq);
     if (pres) ::free(pres);
 }
 
+// A client holds one connection to the server, that can be shared by coroutines
+// in the same scheduler. Requests are sent with ids, and a reader coroutine is
+// created to dispatch responses by id while there are calls waiting.
 class ClientImpl {
   public:
-    ClientImpl(const char* ip, int port, bool use_ssl) : _tcp_cli(ip, port, use_ssl) {}
+    ClientImpl(const char* ip, int port, bool use_ssl)
+        : _tcp_cli(ip, port, use_ssl), _id(0), _reading(false), _broken(false) {}
 
-    ClientImpl(const ClientImpl& c) : _tcp_cli(c._tcp_cli) {}
+    ClientImpl(const ClientImpl& c)
+        : _tcp_cli(c._tcp_cli), _id(0), _reading(false), _broken(false) {}
 
-    ~ClientImpl() = default;
+    ~ClientImpl() {
+        this->close();
+        while (_reading) _ev.wait(100);
+    }
 
     void call(const json::Json& req, json::Json& res);
 
-    void close() { _tcp_cli.disconnect(); }
+    // a stream in progress, it is owned by the Stream object of the caller
+    struct stream_t {
+        explicit stream_t(ClientImpl* c) : cli(c), id(0), consumed(0), done(false) {}
+        ClientImpl* cli;
+        co::deque<json::Json> msgs;  // received but not consumed
+        json::Json res;              // the last frame
+        co::event ev;                // signaled on messages or the end
+        uint32_t id;
+        uint32_t consumed;  // messages consumed since the last ack
+        bool done;          // no more messages will arrive
+    };
+
+    stream_t* open(const json::Json& req);
+    bool next(stream_t* s, json::Json& msg);
+    void cancel(stream_t* s);
+
+    // the connection is closed by the reader if it is running
+    void close() {
+        if (_reading) {
+            _broken = true;
+        } else {
+            _tcp_cli.disconnect();
+        }
+    }
 
   private:
-    tcp::Client _tcp_cli;
-    fastream _fs;
+    // a call waiting for the response, it is not on the stack of the caller, as
+    // it is touched by the reader
+    struct call_t {
+        call_t() : done(false) {}
+        json::Json res;
+        co::event ev;
+        bool done;
+    };
 
     bool connect();
+    void read();
+    int fill(size_t n);
+    bool waiting() const { return !_calls.empty() || !_streams.empty(); }
+
+    // Send a request, and register the call @x or the stream @s before sending, as
+    // the response may arrive before send() returns. Frames that register nothing
+    // are not sent if the client is not connected.
+    bool send(const char* p, size_t n, uint32_t id, call_t* x, stream_t* s);
+
+  private:
+    tcp::Client _tcp_cli;
+    fastring _buf;   // data received by the reader, from _pos
+    size_t _pos;
+    co::mutex _mtx;  // for connect and send
+    co::hash_map<uint32_t, call_t*> _calls;
+    co::hash_map<uint32_t, stream_t*> _streams;
+    co::event _ev;   // signaled when the reader exits
+    uint32_t _id;
+    bool _reading;   // the reader is running
+    bool _broken;    // the connection will be closed by the reader
 };
 
 Client::Client(const char* ip, int port, bool use_ssl) { _p = new ClientImpl(ip, port, use_ssl); }
@@ -423,6 +947,23 @@ void Client::call(const json::Json& req, json::Json& res) {
 
 void Client::close() { return ((ClientImpl*)_p)->close(); }
 
+Stream Client::stream(const json::Json& req) { return Stream(((ClientImpl*)_p)->open(req)); }
+
+Stream::~Stream() {
+    if (_p) {
+        auto s = (ClientImpl::stream_t*)_p;
+        s->cli->cancel(s);
+        delete s;
+    }
+}
+
+bool Stream::next(json::Json& msg) {
+    auto s = (ClientImpl::stream_t*)_p;
+    return s->cli->next(s, msg);
+}
+
+const json::Json& Stream::result() const { return ((ClientImpl::stream_t*)_p)->res; }
+
 void Client::ping() {
     json::Json req({{"api", "ping"}}), res;
     this->call(req, res);
@@ -431,63 +972,256 @@ void Client::ping() {
 bool ClientImpl::connect() { return _tcp_cli.connect(FLG_rpc_conn_timeout); }
 
 void ClientImpl::call(const json::Json& req, json::Json& res) {
-    int r = 0, len = 0;
-    Header header;
-    if (!_tcp_cli.connected() && !this->connect()) return;
+    std::unique_ptr<call_t> x(new call_t());
+    const uint32_t id = ++_id;
+
+    uint16_t flags = FLG_rpc_binary ? (kHasId | kBinary) : kHasId;
+    uint32_t mid = 0;
+    if (FLG_rpc_deadline && FLG_rpc_recv_timeout > 0) flags |= kHasDeadline;
+    if (FLG_rpc_method_id) {
+        auto& api = req.get("api");
+        if (api.is_string()) {
+            flags |= kHasMethod;
+            mid = method_id(api.as_c_str(), api.string_size());
+        }
+    }
 
-    // send request
-    do {
-        _fs.resize(sizeof(Header));
-        req.str(_fs);
-        set_header((void*)_fs.data(), (uint32_t)(_fs.size() - sizeof(Header)));
+    const int hlen = header_size(flags);
+    fastring s(256);
+    s.resize(hlen);
+    encode(flags, req, s);
+    if (FLG_rpc_compress_size > 0) flags |= kAcceptLz4 | compress(s, hlen);
+    set_header(s.data(), (uint32_t)(s.size() - hlen), flags, id, mid,
+               (uint32_t)FLG_rpc_recv_timeout);
+
+    if (!this->send(s.data(), s.size(), id, x.get(), nullptr)) return;
+    RPCLOG << "rpc send req: " << req;
+
+    x->ev.wait(FLG_rpc_recv_timeout);
+    if (x->done) {
+        res = std::move(x->res);
+    } else if (_calls.erase(id) > 0) {
+        ELOG << "rpc recv error: timeout, id: " << id;
+    }
+}
 
-        r = _tcp_cli.send(_fs.data(), (int)_fs.size(), FLG_rpc_send_timeout);
-        if (unlikely(r <= 0)) goto send_err;
+bool ClientImpl::send(const char* p, size_t n, uint32_t id, call_t* x, stream_t* s) {
+    co::mutex_guard g(_mtx);
+    if (_broken) {
+        if (_reading) {
+            ELOG << "rpc connection is broken, closing..";
+            return false;
+        }
+        _tcp_cli.disconnect();
+        _broken = false;
+    }
+    if (!_tcp_cli.connected() && (!(x || s) || !this->connect())) return false;
+
+    if (x) _calls[id] = x;
+    if (s) _streams[id] = s;
+    const int r = _tcp_cli.send(p, (int)n, FLG_rpc_send_timeout);
+    if (unlikely(r <= 0)) {
+        ELOG << "rpc send error: " << _tcp_cli.strerror();
+        if (x) _calls.erase(id);
+        if (s) _streams.erase(id);
+        this->close();
+        _broken = _reading;
+        return false;
+    }
 
-        RPCLOG << "rpc send req: " << req;
-    } while (0);
+    if (!_reading && (x || s)) {
+        _reading = true;
+        co::sched()->go(&ClientImpl::read, this);
+    }
+    return true;
+}
 
-    // wait for response
-    do {
-        r = _tcp_cli.recvn(&header, sizeof(header), FLG_rpc_recv_timeout);
-        if (unlikely(r == 0)) goto recv_zero_err;
-        if (unlikely(r < 0)) goto recv_err;
+ClientImpl::stream_t* ClientImpl::open(const json::Json& req) {
+    stream_t* const s = new stream_t(this);
+    s->id = ++_id;
+
+    uint16_t flags = FLG_rpc_binary ? (kHasId | kStream | kBinary) : (kHasId | kStream);
+    fastring buf(256);
+    buf.resize(12);
+    encode(flags, req, buf);
+    if (FLG_rpc_compress_size > 0) flags |= kAcceptLz4 | compress(buf, 12);
+    set_header(buf.data(), (uint32_t)(buf.size() - 12), flags, s->id);
+
+    if (this->send(buf.data(), buf.size(), s->id, nullptr, s)) {
+        RPCLOG << "rpc send stream req: " << req;
+    } else {
+        s->done = true;
+    }
+    return s;
+}
+
+// Credits are granted to the server when half of the window was consumed, the
+// server sends no more than FLG_rpc_stream_window messages ahead of the client.
+bool ClientImpl::next(stream_t* s, json::Json& msg) {
+    while (s->msgs.empty() && !s->done) {
+        if (!s->ev.wait(FLG_rpc_recv_timeout)) {
+            ELOG << "rpc recv error: stream timeout, id: " << s->id;
+            this->cancel(s);
+        }
+    }
+    if (s->msgs.empty()) return false;
+
+    msg = std::move(s->msgs.front());
+    s->msgs.pop_front();
+    const uint32_t half = FLG_rpc_stream_window > 1 ? FLG_rpc_stream_window / 2 : 1;
+    if (++s->consumed >= half && !s->done) {
+        char b[16];
+        set_header(b, 4, kHasId | kStream | kAck, s->id);
+        store_be32(b + 12, s->consumed);
+        this->send(b, 16, s->id, nullptr, nullptr);
+        s->consumed = 0;
+    }
+    return true;
+}
+
+// tell the server to stop a stream that has not ended
+void ClientImpl::cancel(stream_t* s) {
+    if (s->done) return;
+    s->done = true;
+    _streams.erase(s->id);
+    char b[12];
+    set_header(b, 0, kHasId | kStream | kEnd, s->id);
+    this->send(b, 12, s->id, nullptr, nullptr);
+}
+
+// make sure there are at least n bytes in _buf after _pos
+//   - return 1 on success, 0 if the reader should exit as no call is waiting,
+//     -1 on error.
+int ClientImpl::fill(size_t n) {
+    if (_buf.size() - _pos >= n) return 1;
+    if (_pos > 0) {
+        _buf.trim(_pos, 'l');
+        _pos = 0;
+    }
+
+    while (_buf.size() < n) {
+        _buf.reserve(n > 4096 ? n : 4096);
+        const int r = _tcp_cli.recv((void*)(_buf.data() + _buf.size()),
+                                    (int)(_buf.capacity() - _buf.size()), FLG_rpc_recv_timeout);
+        if (unlikely(r == 0)) {
+            ELOG << "rpc server close the connection..";
+            return -1;
+        }
+        if (unlikely(r < 0)) {
+            if (!co::timeout()) {
+                ELOG << "rpc recv error: " << _tcp_cli.strerror();
+                return -1;
+            }
+            if (_broken) return -1;
+            if (!this->waiting()) return _buf.empty() ? 0 : -1;
+            continue;
+        }
+        _buf.resize(_buf.size() + r);
+    }
+    return 1;
+}
+
+void ClientImpl::read() {
+    int r, hlen, len = 0;
+    Header header;
+    _buf.clear();
+    _pos = 0;
+
+    while (this->waiting() && !_broken) {
+        if ((r = this->fill(kHeaderSize)) <= 0) goto end;
+        memcpy(&header, _buf.data() + _pos, kHeaderSize);
         if (unlikely(header.magic != kMagic)) goto magic_err;
+        hlen = header_size(header);
+        if (unlikely(hlen == kHeaderSize)) goto no_id_err;
+        if ((r = this->fill(hlen)) <= 0) goto end;
+        memcpy(&header.id, _buf.data() + _pos + kHeaderSize, hlen - kHeaderSize);
 
         len = ntoh32(header.len);
         if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
+        if ((r = this->fill(hlen + len)) <= 0) goto end;
+
+        {
+            const char* p = _buf.data() + _pos + hlen;
+            _pos += hlen + len;
+            call_t* x = nullptr;
+            stream_t* s = nullptr;
+            if (header.flags & kStream) {
+                auto it = _streams.find(header.id);
+                if (it == _streams.end()) continue;  // the stream was cancelled
+                s = it->second;
+                if (header.flags & kEnd) _streams.erase(it);
+            } else {
+                auto it = _calls.find(header.id);
+                if (it == _calls.end()) continue;  // the call has timed out
+                x = it->second;
+                _calls.erase(it);
+            }
 
-        _fs.resize(len);
-        r = _tcp_cli.recvn((char*)_fs.data(), len, FLG_rpc_recv_timeout);
-        if (unlikely(r == 0)) goto recv_zero_err;
-        if (unlikely(r < 0)) goto recv_err;
+            json::Json res;
+            fastring z;
+            if ((header.flags & kLz4) && !decompress(p, len, z)) {
+                ELOG << "rpc lz4 decompress error, body len: " << len;
+            } else {
+                if (header.flags & kLz4) p = z.data(), len = (int)z.size();
+                res = decode(header.flags, p, len);
+                if (res.is_null()) {
+                    if (header.flags & kBinary) {
+                        ELOG << "rpc unpack error, body len: " << len;
+                    } else {
+                        ELOG << "rpc json parse error: " << fastring(p, len);
+                    }
+                } else {
+                    RPCLOG << "rpc recv res: " << res;
+                }
+            }
 
-        res = json::parse(_fs.c_str(), _fs.size());
-        if (res.is_null()) goto json_parse_err;
-        RPCLOG << "rpc recv res: " << res;
-        return;
-    } while (0);
+            if (x) {
+                x->res = std::move(res);
+                x->done = true;
+                x->ev.signal();
+            } else {
+                if (header.flags & kEnd) {
+                    s->res = std::move(res);
+                    s->done = true;
+                } else if (!res.is_null()) {
+                    s->msgs.push_back(std::move(res));
+                }
+                s->ev.signal();
+            }
+        }
+    }
+    r = _broken ? -1 : 0;
+    goto end;
 
 magic_err:
     ELOG << "rpc recv error: bad magic number: " << header.magic;
-    goto err_end;
+    r = -1;
+    goto end;
+no_id_err:
+    ELOG << "rpc recv error: no request id in the response";
+    r = -1;
+    goto end;
 msg_too_long_err:
     ELOG << "rpc recv error: body too long: " << len;
-    goto err_end;
-recv_zero_err:
-    ELOG << "rpc server close the connection..";
-    goto err_end;
-recv_err:
-    ELOG << "rpc recv error: " << _tcp_cli.strerror();
-    goto err_end;
-send_err:
-    ELOG << "rpc send error: " << _tcp_cli.strerror();
-    goto err_end;
-json_parse_err:
-    ELOG << "rpc json parse error: " << _fs;
-    goto err_end;
-err_end:
-    _tcp_cli.disconnect();
+    r = -1;
+    goto end;
+end:
+    if (r < 0) {
+        {
+            co::mutex_guard g(_mtx);
+            _tcp_cli.disconnect();
+            _broken = false;
+        }
+        for (auto& x : _calls) x.second->ev.signal();
+        _calls.clear();
+        for (auto& x : _streams) {
+            x.second->done = true;
+            x.second->ev.signal();
+        }
+        _streams.clear();
+    }
+    _reading = false;
+    _ev.signal();
 }
 
 }  // namespace rpc
@@ -0,0 +1,336 @@
+#include <atomic>
+
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/metrics.h"
+#include "co/rand.h"
+#include "co/rpc.h"
+#include "co/str.h"
+#include "co/time.h"
+
+DEC_int32(rpc_recv_timeout);
+
+DEF_uint32(rpc_cluster_pool_size, 64,
+           ">>#2 max idle clients to a server in each scheduler for rpc::Cluster");
+DEF_uint32(rpc_eject_errors, 3, ">>#2 rpc::Cluster ejects a server after n failed calls in a row");
+DEF_uint32(rpc_eject_ms, 10000, ">>#2 rpc::Cluster ejects a bad server for n milliseconds");
+DEF_double(rpc_eject_slow_ratio, 5.0,
+           ">>#2 rpc::Cluster ejects a server n times slower than the fastest one, 0: disabled");
+DEF_double(rpc_hedge_pct, 0,
+           ">>#2 rpc::Cluster sends a backup request to another server if no response arrived "
+           "in this percentile of latencies, e.g. 95, 0: disabled");
+DEF_double(rpc_hedge_budget, 0.05, ">>#2 max ratio of backup requests to calls of rpc::Cluster");
+
+namespace rpc {
+namespace {
+
+struct node_t {
+    node_t(fastring&& ip, int port, bool use_ssl)
+        : ip(std::move(ip)),
+          port(port),
+          pool(
+              [this, use_ssl]() {
+                  return (void*)new Client(this->ip.c_str(), this->port, use_ssl);
+              },
+              [](void* p) { delete (Client*)p; }, FLG_rpc_cluster_pool_size),
+          out(0),
+          lat(0),
+          errors(0),
+          eject_until(0) {}
+
+    // lower is better, the latency is in us, 0 for servers not called yet
+    uint64_t score() const {
+        const uint64_t l = (uint64_t)lat.load(std::memory_order_relaxed);
+        return (out.load(std::memory_order_relaxed) + 1) * (l + 100);
+    }
+
+    // a server comes back with stats reset when the ejection expires
+    bool available(int64_t now) {
+        int64_t t = eject_until.load(std::memory_order_relaxed);
+        if (t == 0) return true;
+        if (now < t) return false;
+        if (eject_until.compare_exchange_strong(t, 0, std::memory_order_relaxed)) {
+            lat.store(0, std::memory_order_relaxed);
+            errors.store(0, std::memory_order_relaxed);
+            LOG << "rpc cluster: server " << ip << ':' << port << " is back";
+        }
+        return true;
+    }
+
+    fastring ip;
+    int port;
+    co::pool pool;
+    std::atomic<uint32_t> out;          // outstanding calls
+    std::atomic<int64_t> lat;           // moving average of latency in us
+    std::atomic<uint32_t> errors;       // failed calls in a row
+    std::atomic<int64_t> eject_until;   // time in ms, 0 if not ejected
+};
+
+// Latencies of successful calls in log-linear buckets of metrics::histogram. The
+// hedging delay is computed every 1024 calls, and the counts are halved then, so
+// that old samples fade out.
+class lat_hist_t {
+  public:
+    lat_hist_t() : _n(0), _delay(0) {
+        for (uint32_t i = 0; i < co::xx::metric_buckets; ++i) _b[i].store(0);
+    }
+
+    void observe(uint64_t us) {
+        _b[co::metrics::histogram::bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        if ((_n.fetch_add(1, std::memory_order_relaxed) & 1023) == 1023) this->update();
+    }
+
+    // the delay in us, 0 before enough calls were observed
+    int64_t delay() const { return _delay.load(std::memory_order_relaxed); }
+
+  private:
+    void update() {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < co::xx::metric_buckets; ++i) total += _b[i].load();
+        const uint64_t k = (uint64_t)(total * (FLG_rpc_hedge_pct / 100));
+        uint64_t x = 0;
+        for (uint32_t i = 0; i < co::xx::metric_buckets; ++i) {
+            x += _b[i].load();
+            if (x > k) {
+                _delay.store((int64_t)co::metrics::histogram::upper(i));
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < co::xx::metric_buckets; ++i) {
+            _b[i].store(_b[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint32_t> _b[co::xx::metric_buckets];
+    std::atomic<uint32_t> _n;
+    std::atomic<int64_t> _delay;
+};
+
+// a hedged call, shared by the caller and coroutines calling the servers
+struct hedge_t {
+    json::Json req;
+    json::Json res;
+    co::event ev;  // signaled when a call is done
+    int pending;   // calls running
+    bool done;     // a response was received
+};
+
+class ClusterImpl {
+  public:
+    ClusterImpl(const co::vector<fastring>& addrs, bool use_ssl);
+    ~ClusterImpl();
+
+    void call(const json::Json& req, json::Json& res);
+
+    // hedged calls may outlive the cluster object in coroutines
+    void ref() { _refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void unref() {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+  private:
+    node_t* pick(node_t* exclude = 0);
+    bool call(node_t* n, const json::Json& req, json::Json& res);
+    void update(node_t* n, int64_t us, bool ok);
+    void hedged_call(const json::Json& req, json::Json& res);
+    void go_call(node_t* n, const std::shared_ptr<hedge_t>& h);
+    void earn_budget();
+    bool take_budget();
+
+  private:
+    co::vector<node_t*> _nodes;
+    lat_hist_t _lat;
+    std::atomic<int64_t> _budget;  // backup requests allowed, in 1/1000
+    std::atomic<uint32_t> _refs;
+};
+
+// "ip:port", "[ipv6]:port", or "unix:/path", "shm:name" without a port
+void parse_addr(const fastring& s, fastring& ip, int& port) {
+    port = 0;
+    if (s.starts_with("unix:") || s.starts_with("shm:")) {
+        ip = s;
+        return;
+    }
+    const size_t p = s.rfind(':');
+    CHECK(p != s.npos && p > 0) << "rpc cluster: bad server address: " << s;
+    ip = (s[0] == '[' && s[p - 1] == ']') ? s.substr(1, p - 2) : s.substr(0, p);
+    port = str::to_int32(s.c_str() + p + 1);
+    CHECK(co::error() == 0 && port > 0 && port < 65536) << "rpc cluster: bad port: " << s;
+}
+
+ClusterImpl::ClusterImpl(const co::vector<fastring>& addrs, bool use_ssl) : _budget(0), _refs(1) {
+    CHECK(!addrs.empty()) << "rpc cluster: no server";
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        fastring ip;
+        int port;
+        parse_addr(addrs[i], ip, port);
+        _nodes.push_back(new node_t(std::move(ip), port, use_ssl));
+    }
+}
+
+ClusterImpl::~ClusterImpl() {
+    for (size_t i = 0; i < _nodes.size(); ++i) delete _nodes[i];
+}
+
+// power of two choices among available servers, or any server if all are ejected.
+// A server is excluded for backup requests, NULL is returned if no other one is
+// available then.
+node_t* ClusterImpl::pick(node_t* exclude) {
+    const uint32_t n = (uint32_t)_nodes.size();
+    if (n == 1) return exclude ? nullptr : _nodes[0];
+
+    const int64_t now = now::ms();
+    uint32_t i = co::rand() % n;
+    uint32_t j = co::rand() % (n - 1);
+    if (j >= i) ++j;
+    node_t* a = _nodes[i];
+    node_t* b = _nodes[j];
+    const bool ua = a != exclude && a->available(now);
+    const bool ub = b != exclude && b->available(now);
+    if (ua && ub) return a->score() <= b->score() ? a : b;
+    if (ua) return a;
+    if (ub) return b;
+
+    for (uint32_t k = 1; k < n; ++k) {
+        node_t* const x = _nodes[(i + k) % n];
+        if (x != exclude && x->available(now)) return x;
+    }
+    return exclude ? nullptr : a;
+}
+
+void ClusterImpl::update(node_t* n, int64_t us, bool ok) {
+    // a failed call counts as a timeout, or a server refusing connections
+    // would look the fastest one
+    if (!ok && us < FLG_rpc_recv_timeout * 1000LL) us = FLG_rpc_recv_timeout * 1000LL;
+
+    // moving average with weight 1/8 for the new sample
+    const int64_t l = n->lat.load(std::memory_order_relaxed);
+    const int64_t v = l == 0 ? us : l + (us - l) / 8;
+    n->lat.store(v > 0 ? v : 1, std::memory_order_relaxed);
+
+    bool eject = false;
+    if (ok) {
+        n->errors.store(0, std::memory_order_relaxed);
+    } else if (n->errors.fetch_add(1, std::memory_order_relaxed) + 1 >= FLG_rpc_eject_errors) {
+        eject = true;
+    }
+
+    // compare with the fastest one of other available servers
+    const int64_t now = now::ms();
+    int64_t best = 0;
+    bool others = false;
+    for (size_t i = 0; i < _nodes.size(); ++i) {
+        node_t* const x = _nodes[i];
+        if (x == n || !x->available(now)) continue;
+        others = true;
+        const int64_t t = x->lat.load(std::memory_order_relaxed);
+        if (t > 0 && (best == 0 || t < best)) best = t;
+    }
+    if (!others) return;
+    if (!eject && FLG_rpc_eject_slow_ratio > 0 && best > 0) {
+        eject = (double)v > (double)best * FLG_rpc_eject_slow_ratio;
+    }
+
+    if (eject) {
+        int64_t e = 0;
+        if (n->eject_until.compare_exchange_strong(e, now + FLG_rpc_eject_ms)) {
+            WLOG << "rpc cluster: eject server " << n->ip << ':' << n->port << " for "
+                 << FLG_rpc_eject_ms << " ms, errors: " << n->errors.load() << ", latency: " << v
+                 << " us, best: " << best << " us";
+        }
+    }
+}
+
+bool ClusterImpl::call(node_t* n, const json::Json& req, json::Json& res) {
+    Client* const c = (Client*)n->pool.pop();
+    json::Json r;
+
+    n->out.fetch_add(1, std::memory_order_relaxed);
+    const int64_t beg = now::us();
+    c->call(req, r);
+    const int64_t us = now::us() - beg;
+    n->out.fetch_sub(1, std::memory_order_relaxed);
+
+    n->pool.push(c);
+    const bool ok = !r.is_null();
+    this->update(n, us, ok);
+    if (ok) {
+        if (FLG_rpc_hedge_pct > 0) _lat.observe((uint64_t)us);
+        res = std::move(r);
+    }
+    return ok;
+}
+
+void ClusterImpl::call(const json::Json& req, json::Json& res) {
+    if (FLG_rpc_hedge_pct > 0 && _nodes.size() > 1) return this->hedged_call(req, res);
+    this->call(this->pick(), req, res);
+}
+
+// each call earns a fraction of a backup request, at most 10 are saved up
+void ClusterImpl::earn_budget() {
+    if (_budget.load(std::memory_order_relaxed) < 10 * 1000) {
+        _budget.fetch_add((int64_t)(FLG_rpc_hedge_budget * 1000), std::memory_order_relaxed);
+    }
+}
+
+bool ClusterImpl::take_budget() {
+    int64_t b = _budget.load(std::memory_order_relaxed);
+    while (b >= 1000) {
+        if (_budget.compare_exchange_weak(b, b - 1000, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+void ClusterImpl::go_call(node_t* n, const std::shared_ptr<hedge_t>& h) {
+    this->ref();
+    ++h->pending;
+    co::sched()->go([this, n, h]() {
+        json::Json r;
+        if (this->call(n, h->req, r) && !h->done) {
+            h->done = true;
+            h->res = std::move(r);
+        }
+        --h->pending;
+        h->ev.signal();
+        this->unref();
+    });
+}
+
+// The request is sent to a server in a new coroutine. If no response arrived in
+// the percentile delay, a backup request is sent to another server within the
+// budget, and the first response wins. The slower call can't be cancelled on the
+// server, its response is dropped on arrival. Coroutines of a call run in the
+// same scheduler, the shared state needs no lock.
+void ClusterImpl::hedged_call(const json::Json& req, json::Json& res) {
+    std::shared_ptr<hedge_t> h(new hedge_t());
+    h->req = req.dup();
+    h->pending = 0;
+    h->done = false;
+
+    node_t* const a = this->pick();
+    this->go_call(a, h);
+    this->earn_budget();
+
+    const int64_t delay = _lat.delay();
+    if (delay > 0 && !h->ev.wait((uint32_t)((delay + 999) / 1000)) && !h->done) {
+        node_t* const b = this->pick(a);
+        if (b && this->take_budget()) this->go_call(b, h);
+    }
+
+    while (!h->done && h->pending > 0) h->ev.wait();
+    if (h->done) res = std::move(h->res);
+}
+
+}  // namespace
+
+Cluster::Cluster(const co::vector<fastring>& addrs, bool use_ssl) {
+    _p = new ClusterImpl(addrs, use_ssl);
+}
+
+Cluster::~Cluster() { ((ClusterImpl*)_p)->unref(); }
+
+void Cluster::call(const json::Json& req, json::Json& res) { ((ClusterImpl*)_p)->call(req, res); }
+
+}  // namespace rpc
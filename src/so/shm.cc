@@ -0,0 +1,404 @@
+#include "./shm.h"
+
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/time.h"
+
+DEF_uint32(shm_ring_size, 1 << 20,
+           ">>#2 size of each ring of a shm connection, rounded up to a power of 2");
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "../co/hook.h"
+#include "co/co.h"
+
+namespace shm {
+
+// a sleeping peer is found dead (or reaped) when a wait times out in this slice
+static const int kPollMs = 200;
+static const uint32_t kMagic = 0x6d687363;  // "cshm"
+static const size_t kRingsSize = sizeof(ring_t) * 2;
+
+struct hello_t {
+    uint32_t magic;
+    uint32_t cap;
+};
+
+inline void notify(int fd) {
+    const uint64_t v = 1;
+    (void)__sys_api(write)(fd, &v, sizeof(v));
+}
+
+inline void drain(int fd) {
+    uint64_t v;
+    (void)__sys_api(read)(fd, &v, sizeof(v));
+}
+
+// The rendezvous socket in the abstract namespace can be connected by any local
+// user, so both ends accept only a peer running as the same user.
+static bool same_user(sock_t fd) {
+    struct ucred c;
+    socklen_t n = sizeof(c);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &c, &n) != 0) return false;
+    if (c.uid != ::geteuid()) {
+        errno = EACCES;
+        return false;
+    }
+    return true;
+}
+
+// memory of a connection: |ring s2c|ring c2s|data s2c|data c2s|
+// eventfds: client data, client space, server data, server space
+Pipe::Pipe(bool server, char* mem, uint32_t cap, const int* efd, sock_t sock)
+    : _mem(mem), _mask(cap - 1), _sock(sock) {
+    ring_t* const s2c = (ring_t*)mem;
+    ring_t* const c2s = s2c + 1;
+    char* const ds2c = mem + kRingsSize;
+    char* const dc2s = ds2c + cap;
+    _rx = server ? c2s : s2c;
+    _tx = server ? s2c : c2s;
+    _rxd = server ? dc2s : ds2c;
+    _txd = server ? ds2c : dc2s;
+    const int o = server ? 2 : 0;
+    _data = efd[o];
+    _space = efd[o + 1];
+    _peer_data = efd[2 - o];
+    _peer_space = efd[3 - o];
+}
+
+void Pipe::close() {
+    if (!_mem) return;
+    _tx->closed.store(1, std::memory_order_release);
+    _rx->closed.store(1, std::memory_order_release);
+    notify(_peer_data);
+    notify(_peer_space);
+    co::close(_data);
+    co::close(_space);
+    co::close(_peer_data);
+    co::close(_peer_space);
+    ::munmap(_mem, kRingsSize + (_mask + 1) * 2);
+    _mem = 0;
+}
+
+bool Pipe::ready(bool tx, uint64_t pos) const {
+    if (tx) {
+        return _tx->head.load(std::memory_order_acquire) != pos ||
+               _tx->closed.load(std::memory_order_acquire);
+    }
+    return _rx->tail.load(std::memory_order_acquire) != pos ||
+           _rx->closed.load(std::memory_order_acquire);
+}
+
+bool Pipe::peer_alive() const {
+    char c;
+    const int r = (int)__sys_api(recv)(_sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// The waiting flag is set before the ring is checked again, and the peer checks
+// the flag after it moved the ring, so one of them must see the other.
+bool Pipe::wait(bool tx, uint64_t pos, int64_t deadline) {
+    std::atomic<uint32_t>& flag = tx ? _tx->wwait : _rx->rwait;
+    const int efd = tx ? _space : _data;
+    flag.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    drain(efd);
+
+    bool r = true;
+    co::io_event ev(efd, co::ev_read);
+    while (!this->ready(tx, pos)) {
+        int ms = kPollMs;
+        if (deadline >= 0) {
+            const int64_t left = deadline - now::ms();
+            if (left <= 0) {
+                errno = ETIMEDOUT;
+                r = false;
+                break;
+            }
+            if (left < ms) ms = (int)left;
+        }
+        if (ev.wait(ms)) {
+            drain(efd);
+        } else if (errno != ETIMEDOUT) {
+            r = false;
+            break;
+        } else if (!this->peer_alive()) {
+            _rx->closed.store(1, std::memory_order_release);
+            _tx->closed.store(1, std::memory_order_release);
+        }
+    }
+    flag.store(0, std::memory_order_relaxed);
+    return r;
+}
+
+// The positions are in memory shared with the peer, a broken or hostile peer may
+// set them to anything. It is a protocol error if they are more than a ring apart.
+void Pipe::corrupted() {
+    _rx->closed.store(1, std::memory_order_release);
+    _tx->closed.store(1, std::memory_order_release);
+    errno = EPROTO;
+}
+
+int Pipe::recv(void* buf, int n, int ms) {
+    const int64_t deadline = ms >= 0 ? now::ms() + ms : -1;
+    while (true) {
+        const uint64_t h = _rx->head.load(std::memory_order_relaxed);
+        const uint64_t t = _rx->tail.load(std::memory_order_acquire);
+        if (t - h > _mask + 1) {
+            this->corrupted();
+            return -1;
+        }
+        if (t != h) {
+            const size_t k = (size_t)(t - h) < (size_t)n ? (size_t)(t - h) : (size_t)n;
+            const size_t o = (size_t)(h & _mask);
+            const size_t x = (_mask + 1) - o;
+            if (k <= x) {
+                memcpy(buf, _rxd + o, k);
+            } else {
+                memcpy(buf, _rxd + o, x);
+                memcpy((char*)buf + x, _rxd, k - x);
+            }
+            _rx->head.store(h + k, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_rx->wwait.load(std::memory_order_relaxed)) notify(_peer_space);
+            return (int)k;
+        }
+
+        // the peer may write data before it closed the connection
+        if (_rx->closed.load(std::memory_order_acquire)) {
+            if (_rx->tail.load(std::memory_order_acquire) != t) continue;
+            return 0;
+        }
+        if (!this->wait(false, t, deadline)) return -1;
+    }
+}
+
+template <typename F>
+int64_t Pipe::put(int64_t n, int ms, F&& fill) {
+    const int64_t deadline = ms >= 0 ? now::ms() + ms : -1;
+    const uint64_t cap = _mask + 1;
+    int64_t done = 0;
+    while (done < n) {
+        if (_tx->closed.load(std::memory_order_acquire)) {
+            errno = EPIPE;
+            return -1;
+        }
+        const uint64_t h = _tx->head.load(std::memory_order_acquire);
+        const uint64_t t = _tx->tail.load(std::memory_order_relaxed);
+        if (t - h > cap) {
+            this->corrupted();
+            return -1;
+        }
+        if (t - h == cap) {
+            if (!this->wait(true, h, deadline)) return -1;
+            continue;
+        }
+
+        // copy to the contiguous free space from the tail
+        const size_t o = (size_t)(t & _mask);
+        size_t k = (size_t)(cap - (t - h));
+        if (k > cap - o) k = (size_t)(cap - o);
+        if ((int64_t)k > n - done) k = (size_t)(n - done);
+        const int64_t r = fill(_txd + o, k);
+        if (r < 0) return -1;
+
+        _tx->tail.store(t + r, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_tx->rwait.load(std::memory_order_relaxed)) notify(_peer_data);
+        done += r;
+    }
+    return n;
+}
+
+int Pipe::send(const void* buf, int n, int ms) {
+    const char* p = (const char*)buf;
+    return (int)this->put(n, ms, [&p](char* dst, size_t k) {
+        memcpy(dst, p, k);
+        p += k;
+        return (int64_t)k;
+    });
+}
+
+int Pipe::sendv(const struct iovec* iov, int n, int ms) {
+    int64_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+    size_t i = 0, off = 0;
+    return (int)this->put(total, ms, [&](char* dst, size_t k) {
+        size_t m = 0;
+        while (m < k) {
+            if (off == iov[i].iov_len) {
+                ++i;
+                off = 0;
+                continue;
+            }
+            size_t x = iov[i].iov_len - off;
+            if (x > k - m) x = k - m;
+            memcpy(dst + m, (const char*)iov[i].iov_base + off, x);
+            m += x;
+            off += x;
+        }
+        return (int64_t)k;
+    });
+}
+
+// the file is read into the ring directly
+int64_t Pipe::sendfile(int fd, int64_t off, int64_t len, int ms) {
+    return this->put(len, ms, [fd, &off](char* dst, size_t k) {
+        const int64_t r = (int64_t)::pread(fd, dst, k, off);
+        if (r == 0) errno = EIO;  // the file is shorter than expected
+        if (r <= 0) return (int64_t)-1;
+        off += r;
+        return r;
+    });
+}
+
+inline uint32_t ring_cap() {
+    uint32_t n = FLG_shm_ring_size < 4096 ? 4096 : FLG_shm_ring_size;
+    uint32_t cap = 4096;
+    while (cap < n && cap < (1u << 30)) cap <<= 1;
+    return cap;
+}
+
+static bool send_fds(sock_t fd, const hello_t& h, const int* fds, int n, int ms) {
+    char cbuf[CMSG_SPACE(sizeof(int) * 8)];
+    struct iovec iov = {(void*)&h, sizeof(h)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * n);
+
+    co::io_event ev(fd, co::ev_write);
+    while (true) {
+        const ssize_t r = __sys_api(sendmsg)(fd, &msg, MSG_NOSIGNAL);
+        if (r == (ssize_t)sizeof(h)) return true;
+        if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+        if (!ev.wait(ms)) return false;
+    }
+}
+
+// return number of fds received, or -1 on error
+static int recv_fds(sock_t fd, hello_t& h, int* fds, int n, int ms) {
+    char cbuf[CMSG_SPACE(sizeof(int) * 8)];
+    struct iovec iov = {(void*)&h, sizeof(h)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    co::io_event ev(fd, co::ev_read);
+    ssize_t r;
+    while (true) {
+        r = __sys_api(recvmsg)(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (r >= 0) break;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (!ev.wait(ms)) return -1;
+    }
+
+    int k = 0;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        const int m = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < m; ++i) {
+            int x;
+            memcpy(&x, CMSG_DATA(c) + sizeof(int) * i, sizeof(int));
+            if (k < n) {
+                fds[k++] = x;
+            } else {
+                ::close(x);
+            }
+        }
+    }
+    if (r != (ssize_t)sizeof(h)) {
+        if (r == 0) errno = ECONNRESET;
+        for (int i = 0; i < k; ++i) ::close(fds[i]);
+        return -1;
+    }
+    return k;
+}
+
+Pipe* accept(sock_t fd, int ms) {
+    const uint32_t cap = ring_cap();
+    const size_t size = kRingsSize + (size_t)cap * 2;
+    int fds[5] = {-1, -1, -1, -1, -1};
+    char* mem = (char*)MAP_FAILED;
+
+    do {
+        if (!same_user(fd)) break;
+        fds[4] = memfd_create("co.shm", MFD_CLOEXEC);
+        if (fds[4] == -1 || ::ftruncate(fds[4], (off_t)size) != 0) break;
+        mem = (char*)::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[4], 0);
+        if (mem == (char*)MAP_FAILED) break;
+        new (mem) ring_t();
+        new (mem + sizeof(ring_t)) ring_t();
+
+        int i = 0;
+        for (; i < 4; ++i) {
+            if ((fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) break;
+        }
+        if (i < 4) break;
+
+        const hello_t h = {kMagic, cap};
+        if (!send_fds(fd, h, fds, 5, ms)) break;
+        ::close(fds[4]);
+        return new Pipe(true, mem, cap, fds, fd);
+    } while (0);
+
+    const int e = errno;
+    if (mem != (char*)MAP_FAILED) ::munmap(mem, size);
+    for (int i = 0; i < 5; ++i) {
+        if (fds[i] != -1) ::close(fds[i]);
+    }
+    errno = e;
+    return nullptr;
+}
+
+Pipe* connect(sock_t fd, int ms) {
+    if (!same_user(fd)) return nullptr;
+    hello_t h;
+    int fds[5];
+    const int n = recv_fds(fd, h, fds, 5, ms);
+    if (n < 0) return nullptr;
+
+    char* mem = (char*)MAP_FAILED;
+    do {
+        struct stat st;
+        if (n != 5 || h.magic != kMagic || h.cap < 4096 || (h.cap & (h.cap - 1))) {
+            errno = EPROTO;
+            break;
+        }
+        const size_t size = kRingsSize + (size_t)h.cap * 2;
+        if (::fstat(fds[4], &st) != 0) break;
+        if ((size_t)st.st_size != size) {
+            errno = EPROTO;
+            break;
+        }
+        mem = (char*)::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[4], 0);
+        if (mem == (char*)MAP_FAILED) break;
+        ::close(fds[4]);
+        return new Pipe(false, mem, h.cap, fds, fd);
+    } while (0);
+
+    const int e = errno;
+    for (int i = 0; i < n; ++i) ::close(fds[i]);
+    errno = e;
+    return nullptr;
+}
+
+}  // namespace shm
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "co/co/sock.h"
+
+// Shared memory transport for tcp::Server and tcp::Client on the same host, used
+// by endpoints like "shm:name". A connection is set up on the unix domain socket
+// "@co.shm.name": the server maps a memfd holding two SPSC byte rings, one for
+// each direction, and passes it with four eventfds to the client. Data is then
+// copied into and out of the rings without syscalls, an eventfd is written only
+// when the peer is waiting for data or space. The socket is kept open to detect
+// a dead or reaped peer. Only a peer running as the same user is accepted on either
+// end. It is supported on linux only.
+namespace shm {
+
+// the rendezvous address of a shm endpoint, "unix:@co.shm.name"
+inline fastring unix_path(const char* name) { return fastring("unix:@co.shm.").append(name); }
+
+// name of a shm endpoint "shm:name" or "shm://name", or NULL for other endpoints
+inline const char* endpoint_name(const char* ip) {
+    if (strncmp(ip, "shm:", 4) != 0) return nullptr;
+    return (ip[4] == '/' && ip[5] == '/') ? ip + 6 : ip + 4;
+}
+
+struct ring_t {
+    alignas(64) std::atomic<uint64_t> tail;  // bytes written, by the producer
+    std::atomic<uint32_t> rwait;             // the consumer waits for data
+    alignas(64) std::atomic<uint64_t> head;  // bytes read, by the consumer
+    std::atomic<uint32_t> wwait;             // the producer waits for space
+    alignas(64) std::atomic<uint32_t> closed;
+};
+
+// one end of a shm connection, it MUST be used in the scheduler it was created in
+class Pipe {
+  public:
+    Pipe(bool server, char* mem, uint32_t cap, const int* efd, sock_t sock);
+    ~Pipe() { this->close(); }
+
+    // recv at most n bytes, return 0 if the peer closed the connection
+    int recv(void* buf, int n, int ms);
+
+    // send all n bytes, return n on success, -1 on timeout or error
+    int send(const void* buf, int n, int ms);
+    int sendv(const struct iovec* iov, int n, int ms);
+    int64_t sendfile(int fd, int64_t off, int64_t len, int ms);
+
+    // mark both rings closed and wake up the peer, the socket is not closed
+    void close();
+
+  private:
+    // copy at most n bytes into the tx ring with @fill(dst, n), until all n bytes
+    // are written, fill returns bytes copied, or -1 on error
+    template <typename F>
+    int64_t put(int64_t n, int ms, F&& fill);
+
+    // wait for data in the rx ring (tx == false) or space in the tx ring
+    bool wait(bool tx, uint64_t pos, int64_t deadline);
+    bool ready(bool tx, uint64_t pos) const;
+    bool peer_alive() const;
+
+    // the peer broke the rings, close the connection and set errno to EPROTO
+    void corrupted();
+
+  private:
+    char* _mem;
+    ring_t* _rx;
+    ring_t* _tx;
+    char* _rxd;
+    char* _txd;
+    uint64_t _mask;
+    int _data;        // eventfd written by the peer when data arrives in the rx ring
+    int _space;       // eventfd written by the peer when the tx ring has space
+    int _peer_data;   // eventfd the peer waits on for data
+    int _peer_space;  // eventfd the peer waits on for space
+    sock_t _sock;
+};
+
+// server side of the handshake on an accepted socket, return NULL on error
+Pipe* accept(sock_t fd, int ms);
+
+// client side of the handshake on a connected socket, return NULL on error
+Pipe* connect(sock_t fd, int ms);
+
+}  // namespace shm
@@ -2,11 +2,38 @@
 #include "co/ssl.h"
 
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <mutex>
+
+// kernel TLS, openssl 3.0+ on linux
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+#define _CO_KTLS
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #include "co/co.h"
 #include "co/fastream.h"
+#include "co/flag.h"
 #include "co/log.h"
+#include "co/stl.h"
+#include "co/time.h"
+#include "../co/hook.h"
+
+DEC_bool(ssl_offload_handshake);
 
 namespace ssl {
 
@@ -66,6 +93,275 @@ int use_certificate_file(C* c, const char* path) {
 
 int check_private_key(const C* c) { return SSL_CTX_check_private_key((const SSL_CTX*)c); }
 
+// wire format of the protocols (length-prefixed), attached to the SSL_CTX
+static int alpn_index() {
+    static const int i = SSL_CTX_get_ex_new_index(
+        0, 0, 0, 0, [](void*, void* p, CRYPTO_EX_DATA*, int, long, void*) { ::free(p); });
+    return i;
+}
+
+static int alpn_select_cb(SSL*, const unsigned char** out, unsigned char* outlen,
+                          const unsigned char* in, unsigned int inlen, void* arg) {
+    const unsigned char* p = (const unsigned char*)arg;
+    unsigned char* o;
+    const int r = SSL_select_next_proto(&o, outlen, p + 1, *p, in, inlen);
+    if (r != OPENSSL_NPN_NEGOTIATED) return SSL_TLSEXT_ERR_NOACK;
+    *out = o;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+int set_alpn(C* c, const char* protos) {
+    const size_t n = strlen(protos);
+    if (n == 0 || n > 254) return 0;
+
+    // the first byte is size of the wire format
+    unsigned char* p = (unsigned char*)::malloc(n + 2);
+    unsigned char* w = p + 1;
+    for (const char* s = protos;;) {
+        const char* e = strchr(s, ',');
+        const size_t k = e ? (size_t)(e - s) : strlen(s);
+        if (k == 0 || k > 255) {
+            ::free(p);
+            return 0;
+        }
+        *w++ = (unsigned char)k;
+        memcpy(w, s, k);
+        w += k;
+        if (!e) break;
+        s = e + 1;
+    }
+    *p = (unsigned char)(w - p - 1);
+
+    if (SSL_CTX_set_alpn_protos((SSL_CTX*)c, p + 1, *p) != 0) {
+        ::free(p);
+        return 0;
+    }
+    ::free(SSL_CTX_get_ex_data((SSL_CTX*)c, alpn_index()));
+    SSL_CTX_set_ex_data((SSL_CTX*)c, alpn_index(), p);
+    SSL_CTX_set_alpn_select_cb((SSL_CTX*)c, alpn_select_cb, p);
+    return 1;
+}
+
+const char* get_alpn(const S* s, unsigned int* n) {
+    const unsigned char* p = 0;
+    SSL_get0_alpn_selected((const SSL*)s, &p, n);
+    return *n > 0 ? (const char*)p : 0;
+}
+
+int enable_ktls(C* c) {
+#ifdef _CO_KTLS
+    SSL_CTX_set_options((SSL_CTX*)c, SSL_OP_ENABLE_KTLS);
+    return 1;
+#else
+    (void)c;
+    return 0;
+#endif
+}
+
+bool ktls_send(const S* s) {
+#ifdef _CO_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio((const SSL*)s)) != 0;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+bool ktls_recv(const S* s) {
+#ifdef _CO_KTLS
+    return BIO_get_ktls_recv(SSL_get_rbio((const SSL*)s)) != 0;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+// session ticket keys of a server, attached to the SSL_CTX
+struct ticket_key_t {
+    unsigned char name[16];
+    unsigned char aes[32];
+    unsigned char hmac[32];
+};
+
+struct ticket_keys_t {
+    std::mutex mtx;
+    int64_t ttl;  // in ms
+    int64_t t;    // when the current key was made
+    bool has_prev;
+    ticket_key_t cur;
+    ticket_key_t prev;
+
+    // make a new key if the current one has expired
+    bool rotate() {
+        const int64_t now = now::ms();
+        if (t != 0 && now - t < ttl) return true;
+        ticket_key_t k;
+        if (RAND_bytes((unsigned char*)&k, sizeof(k)) != 1) return false;
+        if (t != 0) {
+            prev = cur;
+            has_prev = true;
+        }
+        cur = k;
+        t = now;
+        return true;
+    }
+};
+
+static int ticket_index() {
+    static const int i = SSL_CTX_get_ex_new_index(
+        0, 0, 0, 0, [](void*, void* p, CRYPTO_EX_DATA*, int, long, void*) {
+            delete (ticket_keys_t*)p;
+        });
+    return i;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX hmac_ctx_t;
+
+static int hmac_init(hmac_ctx_t* h, unsigned char* key) {
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key, 32);
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"sha256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    return EVP_MAC_CTX_set_params(h, params);
+}
+#else
+typedef HMAC_CTX hmac_ctx_t;
+
+static int hmac_init(hmac_ctx_t* h, unsigned char* key) {
+    return HMAC_Init_ex(h, key, 32, EVP_sha256(), nullptr);
+}
+#endif
+
+// Return 1 if the ticket is encrypted by the current key, 2 if by the previous
+// key (openssl will issue a new ticket), or 0 if the key is unknown.
+static int ticket_key_cb(SSL* s, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* ctx,
+                         hmac_ctx_t* hctx, int enc) {
+    auto keys = (ticket_keys_t*)SSL_CTX_get_ex_data(SSL_get_SSL_CTX(s), ticket_index());
+    std::lock_guard<std::mutex> g(keys->mtx);
+    if (enc) {
+        if (!keys->rotate()) return -1;
+        ticket_key_t& k = keys->cur;
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) return -1;
+        memcpy(name, k.name, sizeof(k.name));
+        if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, k.aes, iv) != 1) return -1;
+        return hmac_init(hctx, k.hmac) == 1 ? 1 : -1;
+    }
+
+    ticket_key_t* k = 0;
+    int r = 1;
+    if (memcmp(name, keys->cur.name, sizeof(keys->cur.name)) == 0) {
+        k = &keys->cur;
+    } else if (keys->has_prev && memcmp(name, keys->prev.name, sizeof(keys->prev.name)) == 0) {
+        k = &keys->prev;
+        r = 2;
+    }
+    if (!k) return 0;
+    if (hmac_init(hctx, k->hmac) != 1) return -1;
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, k->aes, iv) != 1) return -1;
+    // the previous key expires when the next key is made
+    if (r == 1 && now::ms() - keys->t >= keys->ttl) r = 2;
+    return r;
+}
+
+int set_ticket_key_rotation(C* c, int sec) {
+    if (sec <= 0) return 0;
+    auto keys = (ticket_keys_t*)SSL_CTX_get_ex_data((SSL_CTX*)c, ticket_index());
+    if (!keys) {
+        keys = new ticket_keys_t();
+        keys->t = 0;
+        keys->has_prev = false;
+        if (!keys->rotate()) {
+            delete keys;
+            return 0;
+        }
+        SSL_CTX_set_ex_data((SSL_CTX*)c, ticket_index(), keys);
+    }
+    {
+        std::lock_guard<std::mutex> g(keys->mtx);
+        keys->ttl = (int64_t)sec * 1000;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb((SSL_CTX*)c, ticket_key_cb);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb((SSL_CTX*)c, ticket_key_cb);
+#endif
+    // a ticket lives in two key periods at most
+    SSL_CTX_set_timeout((SSL_CTX*)c, (long)sec * 2);
+    return 1;
+}
+
+// client sessions keyed by "host:port", they are shared by all client SSL_CTXs
+struct session_cache_t {
+    ~session_cache_t() {
+        for (auto& x : m) SSL_SESSION_free(x.second);
+    }
+
+    void put(const fastring& key, SSL_SESSION* sess) {
+        std::lock_guard<std::mutex> g(mtx);
+        auto& x = m[key];
+        if (x) SSL_SESSION_free(x);
+        x = sess;
+    }
+
+    // return a copy of the session, or NULL
+    SSL_SESSION* get(const fastring& key) {
+        std::lock_guard<std::mutex> g(mtx);
+        auto it = m.find(key);
+        return it != m.end() ? SSL_SESSION_dup(it->second) : 0;
+    }
+
+    std::mutex mtx;
+    co::hash_map<fastring, SSL_SESSION*> m;
+};
+
+static session_cache_t& session_cache() {
+    static session_cache_t* c = new session_cache_t();
+    return *c;
+}
+
+static int session_index() {
+    static const int i = SSL_get_ex_new_index(
+        0, 0, 0, 0, [](void*, void* p, CRYPTO_EX_DATA*, int, long, void*) {
+            delete (fastring*)p;
+        });
+    return i;
+}
+
+// A new session (or TLS 1.3 ticket) was received. SSLs never share a session with
+// the cache, as openssl marks the session of a SSL not resumable if the SSL is freed
+// without close_notify sent.
+static int new_session_cb(SSL* s, SSL_SESSION* sess) {
+    auto key = (fastring*)SSL_get_ex_data(s, session_index());
+    if (!key || !SSL_SESSION_is_resumable(sess)) return 0;
+    SSL_SESSION* x = SSL_SESSION_dup(sess);
+    if (x) session_cache().put(*key, x);
+    return 0;
+}
+
+void enable_session_cache(C* c) {
+    SSL_CTX_set_session_cache_mode(
+        (SSL_CTX*)c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb((SSL_CTX*)c, new_session_cb);
+}
+
+int use_cached_session(S* s, const char* key) {
+    auto k = (fastring*)SSL_get_ex_data((SSL*)s, session_index());
+    if (k) {
+        k->assign(key);
+    } else {
+        SSL_set_ex_data((SSL*)s, session_index(), new fastring(key));
+    }
+
+    SSL_SESSION* sess = session_cache().get(key);
+    if (!sess) return 0;
+    const int r = SSL_set_session((SSL*)s, sess);
+    SSL_SESSION_free(sess);
+    return r;
+}
+
+bool session_reused(const S* s) { return SSL_session_reused((SSL*)s) == 1; }
+
 int shutdown(S* s, int ms) {
     CHECK(co::sched()) << "must be called in coroutine..";
     int r, e;
@@ -101,23 +397,87 @@ int shutdown(S* s, int ms) {
     } while (true);
 }
 
+namespace {
+
+// result of SSL_accept() in the blocking thread pool
+struct accept_step_t {
+    int r;
+    int e;              // SSL_get_error(), if r < 0
+    unsigned long err;  // the last error in the error queue of the worker thread
+    int sys;            // errno of the worker thread
+};
+
+}  // namespace
+
+// Run a step of the handshake in the blocking thread pool, so that the RSA or
+// ECDHE work does not block other coroutines of the scheduler. The socket is
+// non-blocking, a step returns as soon as it needs more data. The error queue
+// and errno are thread local, the error is raised again in the calling thread.
+static int accept_offloaded(SSL* s, int* e) {
+    const accept_step_t x = co::run_blocking([s]() {
+        accept_step_t x;
+        ERR_clear_error();
+        x.r = SSL_accept(s);
+        x.e = x.r < 0 ? SSL_get_error(s, x.r) : SSL_ERROR_NONE;
+        x.err = ERR_peek_last_error();
+        x.sys = co::error();
+        ERR_clear_error();
+        return x;
+    });
+
+    ERR_clear_error();
+    if (x.err != 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        ERR_raise(ERR_GET_LIB(x.err), ERR_GET_REASON(x.err));
+#else
+        ERR_put_error(ERR_GET_LIB(x.err), ERR_GET_FUNC(x.err), ERR_GET_REASON(x.err), __FILE__,
+                      __LINE__);
+#endif
+    }
+    co::error(x.sys);
+    *e = x.e;
+    return x.r;
+}
+
+// Wait for the socket after a step in the worker thread. Events are edge
+// triggered, the scheduler may have taken the edge while the step was running,
+// so the socket is checked before waiting.
+static bool wait_after_step(int fd, bool rd, int ms) {
+#ifndef _WIN32
+    struct pollfd p = { fd, (short)(rd ? POLLIN : POLLOUT), 0 };
+    if (__sys_api(poll)(&p, 1, 0) > 0) return true;
+#endif
+    co::io_event ev(fd, rd ? co::ev_read : co::ev_write);
+    return ev.wait(ms);
+}
+
 int accept(S* s, int ms) {
     CHECK(co::sched()) << "must be called in coroutine..";
-    int r, e;
+    int r, e = SSL_ERROR_NONE;
     int fd = SSL_get_fd((SSL*)s);
     if (fd < 0) return -1;
 
+    // wait for the ClientHello here, the first step would return at once without it
+    const bool offload = FLG_ssl_offload_handshake;
+    if (offload && !wait_after_step(fd, true, ms)) return -1;
+
     do {
-        ERR_clear_error();
-        r = SSL_accept((SSL*)s);
+        if (offload) {
+            r = accept_offloaded((SSL*)s, &e);
+        } else {
+            ERR_clear_error();
+            r = SSL_accept((SSL*)s);
+            if (r < 0) e = SSL_get_error((SSL*)s, r);
+        }
         if (r == 1) return 1;  // success
         if (r == 0) {
             // TLOG << "SSL_accept return 0, error: " << SSL_get_error(s, 0);
             return 0;  // ssl connection shut down
         }
 
-        e = SSL_get_error((SSL*)s, r);
-        if (e == SSL_ERROR_WANT_READ) {
+        if (offload && (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE)) {
+            if (!wait_after_step(fd, e == SSL_ERROR_WANT_READ, ms)) return -1;
+        } else if (e == SSL_ERROR_WANT_READ) {
             co::io_event ev(fd, co::ev_read);
             if (!ev.wait(ms)) return -1;
         } else if (e == SSL_ERROR_WANT_WRITE) {
@@ -231,6 +591,11 @@ int send(S* s, const void* buf, int n, int ms) {
     int fd = SSL_get_fd((SSL*)s);
     if (fd < 0) return -1;
 
+#ifdef _CO_KTLS
+    // the kernel makes the records, write to the socket directly
+    if (BIO_get_ktls_send(SSL_get_wbio((SSL*)s))) return co::send((sock_t)fd, buf, n, ms);
+#endif
+
     const char* p = (const char*)buf;
     int remain = n;
 
@@ -262,6 +627,106 @@ int send(S* s, const void* buf, int n, int ms) {
     } while (true);
 }
 
+int sendv(S* s, const struct iovec* iov, int n, int ms) {
+#ifdef _CO_KTLS
+    // no need to merge buffers, the kernel makes the records
+    if (BIO_get_ktls_send(SSL_get_wbio((SSL*)s))) {
+        const int fd = SSL_get_fd((SSL*)s);
+        if (fd < 0) return -1;
+        return co::sendv((sock_t)fd, iov, n, ms);
+    }
+#endif
+
+    // max size of a TLS record, smaller buffers are merged up to this size
+    static const size_t N = 16 * 1024;
+    fastream buf;
+    int total = 0, r;
+
+    for (int i = 0; i < n; ++i) {
+        const char* p = (const char*)iov[i].iov_base;
+        const size_t len = iov[i].iov_len;
+        if (buf.size() + len <= N) {
+            if (buf.capacity() == 0) buf.reserve(N);
+            buf.append(p, len);
+            continue;
+        }
+        if (!buf.empty()) {
+            r = ssl::send(s, buf.data(), (int)buf.size(), ms);
+            if (r <= 0) return r;
+            total += r;
+            buf.clear();
+        }
+        if (len >= N) {
+            r = ssl::send(s, p, (int)len, ms);
+            if (r <= 0) return r;
+            total += r;
+        } else {
+            if (buf.capacity() == 0) buf.reserve(N);
+            buf.append(p, len);
+        }
+    }
+
+    if (!buf.empty()) {
+        r = ssl::send(s, buf.data(), (int)buf.size(), ms);
+        if (r <= 0) return r;
+        total += r;
+    }
+    return total;
+}
+
+// read at most n bytes from offset @off of the file
+static int read_at(int fd, void* buf, int n, int64_t off) {
+#ifdef _WIN32
+    if (_lseeki64(fd, off, SEEK_SET) < 0) return -1;
+    return _read(fd, buf, (unsigned int)n);
+#else
+    int r;
+    do { r = (int)::pread(fd, buf, (size_t)n, (off_t)off); } while (r < 0 && errno == EINTR);
+    return r;
+#endif
+}
+
+int64_t sendfile(S* s, int fd, int64_t off, int64_t len, int ms) {
+    if (len <= 0) return 0;
+
+#ifdef _CO_KTLS
+    // the kernel encrypts the data, no copy to the user space
+    if (BIO_get_ktls_send(SSL_get_wbio((SSL*)s))) {
+        const int fd_s = SSL_get_fd((SSL*)s);
+        int64_t remain = len;
+        do {
+            const size_t k = remain < (1 << 30) ? (size_t)remain : (1 << 30);
+            ossl_ssize_t r = SSL_sendfile((SSL*)s, fd, (off_t)off, k, 0);
+            if (r > 0) {
+                off += r;
+                remain -= r;
+                continue;
+            }
+            const int e = SSL_get_error((SSL*)s, (int)r);
+            if (e != SSL_ERROR_WANT_WRITE) return -1;
+            co::io_event ev((sock_t)fd_s, co::ev_write);
+            if (!ev.wait(ms)) return -1;
+        } while (remain > 0);
+        return len;
+    }
+#endif
+
+    // max size of a TLS record
+    static const int N = 16 * 1024;
+    fastream buf(len < N ? (size_t)len : N);
+    int64_t remain = len;
+    while (remain > 0) {
+        const int k = remain < N ? (int)remain : N;
+        const int r = read_at(fd, (char*)buf.data(), k, off);
+        if (r <= 0) return -1;
+        const int x = ssl::send(s, buf.data(), r, ms);
+        if (x <= 0) return x;
+        off += r;
+        remain -= r;
+    }
+    return len;
+}
+
 bool timeout() { return co::timeout(); }
 
 }  // namespace ssl
@@ -290,12 +755,23 @@ int get_fd(const S*) { return 0; }
 int use_private_key_file(C*, const char*) { return 0; }
 int use_certificate_file(C*, const char*) { return 0; }
 int check_private_key(const C*) { return 0; }
+int set_alpn(C*, const char*) { return 0; }
+const char* get_alpn(const S*, unsigned int* n) { *n = 0; return 0; }
+int enable_ktls(C*) { return 0; }
+bool ktls_send(const S*) { return false; }
+bool ktls_recv(const S*) { return false; }
+int set_ticket_key_rotation(C*, int) { return 0; }
+void enable_session_cache(C*) {}
+int use_cached_session(S*, const char*) { return 0; }
+bool session_reused(const S*) { return false; }
 int shutdown(S*, int) { return 0; }
 int accept(S*, int) { return 0; }
 int connect(S*, int) { return 0; }
 int recv(S*, void*, int, int) { return 0; }
 int recvn(S*, void*, int, int) { return 0; }
 int send(S*, const void*, int, int) { return 0; }
+int sendv(S*, const struct iovec*, int, int) { return 0; }
+int64_t sendfile(S*, int, int64_t, int64_t, int) { return 0; }
 bool timeout() { return false; }
 
 }  // namespace ssl
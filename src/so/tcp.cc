@@ -9,27 +9,79 @@
 #include "co/ssl.h"
 #include "co/str.h"
 #include "co/time.h"
+#include "./shm.h"
 
 DEF_int32(ssl_handshake_timeout, 3000, ">>#2 ssl handshake timeout in ms");
+DEF_int32(ssl_ticket_key_ttl, 3600,
+          ">>#2 ssl server rotates session ticket keys every n seconds, 0 for the openssl default");
+DEF_bool(ssl_offload_handshake, false,
+         ">>#2 run steps of ssl server handshakes in the blocking thread pool (see "
+         "co_offload_threads), instead of the scheduler threads");
+DEF_int32(tcp_connect_delay, 250,
+          ">>#2 delay in ms before tcp::Client tries the next address of a host, while "
+          "the previous attempts are still in progress, see RFC 8305");
+DEF_bool(ssl_ktls, false, ">>#2 use kernel TLS for ssl connections if supported (linux, openssl 3.0+)");
 
 namespace tcp {
 
 class Conn {
   public:
-    Conn() = default;
+    Conn() : _rpos(0) {}
     virtual ~Conn() = default;
 
     virtual int recv(void* buf, int n, int ms) = 0;
     virtual int recvn(void* buf, int n, int ms) = 0;
     virtual int send(const void* buf, int n, int ms) = 0;
+    virtual int sendv(const struct iovec* iov, int n, int ms) = 0;
+    virtual int64_t sendfile(int fd, int64_t off, int64_t len, int ms) = 0;
 
     virtual int close(int ms) = 0;
     virtual int reset(int ms) = 0;
 
     virtual int socket() const noexcept = 0;
     virtual const char* strerror() const noexcept = 0;
+    virtual const char* alpn() noexcept { return ""; }
+
+    // the read buffer, data in [_rpos, _rbuf.size()) is not consumed yet
+    size_t buffered() const { return _rbuf.size() - _rpos; }
+    const char* rdata() const { return _rbuf.data() + _rpos; }
+
+    void consume(size_t n) {
+        _rpos += n;
+        if (_rpos == _rbuf.size()) {
+            _rbuf.clear();
+            _rpos = 0;
+        }
+    }
+
+    // recv until at least n bytes are buffered
+    int fill(size_t n, int ms);
+
+  private:
+    fastring _rbuf;
+    size_t _rpos;
 };
 
+// size of a recv to fill the read buffer
+static const size_t kReadSize = 4096;
+
+int Conn::fill(size_t n, int ms) {
+    if (_rpos > 0) {
+        _rbuf.trim(_rpos, 'l');
+        _rpos = 0;
+    }
+    const size_t cap = n > kReadSize ? n : kReadSize;
+    if (_rbuf.capacity() < cap) _rbuf.reserve(cap);
+
+    while (_rbuf.size() < n) {
+        const size_t size = _rbuf.size();
+        const int r = this->recv((void*)(_rbuf.data() + size), (int)(_rbuf.capacity() - size), ms);
+        if (r <= 0) return r;
+        _rbuf.resize(size + r);
+    }
+    return (int)_rbuf.size();
+}
+
 class TcpConn : public Conn {
   public:
     TcpConn(int sock) : _sock(sock) {}
@@ -41,6 +93,14 @@ class TcpConn : public Conn {
 
     virtual int send(const void* buf, int n, int ms) { return co::send(_sock, buf, n, ms); }
 
+    virtual int sendv(const struct iovec* iov, int n, int ms) {
+        return co::sendv(_sock, iov, n, ms);
+    }
+
+    virtual int64_t sendfile(int fd, int64_t off, int64_t len, int ms) {
+        return co::sendfile(_sock, fd, off, len, ms);
+    }
+
     virtual int close(int ms) {
         // const int sock = god::swap(&_sock, -1);
         const int sock = _sock;
@@ -74,6 +134,12 @@ class SSLConn : public Conn {
 
     virtual int send(const void* buf, int n, int ms) { return ssl::send(_s, buf, n, ms); }
 
+    virtual int sendv(const struct iovec* iov, int n, int ms) { return ssl::sendv(_s, iov, n, ms); }
+
+    virtual int64_t sendfile(int fd, int64_t off, int64_t len, int ms) {
+        return ssl::sendfile(_s, fd, off, len, ms);
+    }
+
     virtual int close(int ms) {
         ssl::S* s = _s;
         _s = nullptr;
@@ -101,8 +167,18 @@ class SSLConn : public Conn {
 
     virtual const char* strerror() const noexcept { return ssl::strerror(_s); }
 
+    virtual const char* alpn() noexcept {
+        if (_alpn.empty() && _s) {
+            unsigned int n = 0;
+            const char* p = ssl::get_alpn(_s, &n);
+            if (p) _alpn.append(p, n);
+        }
+        return _alpn.c_str();
+    }
+
   private:
     ssl::S* _s;
+    fastring _alpn;
 };
 
 Connection::Connection(int sock) { _p = new TcpConn(sock); }
@@ -111,12 +187,89 @@ Connection::Connection(void* s) { _p = new SSLConn((ssl::S*)s); }
 
 int Connection::socket() const { return ((Conn*)_p)->socket(); }
 
-int Connection::recv(void* buf, int n, int ms) { return ((Conn*)_p)->recv(buf, n, ms); }
+const char* Connection::alpn() const { return ((Conn*)_p)->alpn(); }
+
+int Connection::recv(void* buf, int n, int ms) {
+    Conn* const c = (Conn*)_p;
+    if (c->buffered() == 0) {
+        if ((size_t)n >= kReadSize) return c->recv(buf, n, ms);
+        const int r = c->fill(1, ms);
+        if (r <= 0) return r;
+    }
+    const size_t k = c->buffered() < (size_t)n ? c->buffered() : (size_t)n;
+    memcpy(buf, c->rdata(), k);
+    c->consume(k);
+    return (int)k;
+}
+
+int Connection::recvn(void* buf, int n, int ms) {
+    Conn* const c = (Conn*)_p;
+    if (c->buffered() < (size_t)n && (size_t)n < kReadSize) {
+        const int r = c->fill(n, ms);
+        if (r <= 0) return r;
+    }
+    const size_t k = c->buffered() < (size_t)n ? c->buffered() : (size_t)n;
+    memcpy(buf, c->rdata(), k);
+    c->consume(k);
+    if (k == (size_t)n) return n;
+
+    const int r = c->recvn((char*)buf + k, n - (int)k, ms);
+    return r <= 0 ? r : n;
+}
+
+int Connection::peek(const char** p, int n, int ms) {
+    Conn* const c = (Conn*)_p;
+    if (c->buffered() < (size_t)n) {
+        const int r = c->fill(n, ms);
+        if (r <= 0) return r;
+    }
+    *p = c->rdata();
+    return (int)c->buffered();
+}
+
+int Connection::read_until(const char* delim, const char** p, int max, int ms) {
+    Conn* const c = (Conn*)_p;
+    const size_t m = strlen(delim);
+    size_t from = 0;  // bytes checked before will not be scanned again
+    while (true) {
+        size_t pos = (size_t)-1;
+        const size_t size = c->buffered();
+        if (size >= m) {
+            const char* const s = c->rdata();
+            for (size_t i = from; i + m <= size && i + m <= (size_t)max; ++i) {
+                if (s[i] == *delim && memcmp(s + i, delim, m) == 0) {
+                    pos = i;
+                    break;
+                }
+            }
+            from = size - m + 1;
+        }
+
+        if (pos != (size_t)-1) {
+            *p = c->rdata();
+            c->consume(pos + m);
+            return (int)(pos + m);
+        }
+        if (size >= (size_t)max) {
+            co::error(EMSGSIZE);
+            return -1;
+        }
 
-int Connection::recvn(void* buf, int n, int ms) { return ((Conn*)_p)->recvn(buf, n, ms); }
+        const int r = c->fill(size + 1, ms);
+        if (r <= 0) return r;
+    }
+}
 
 int Connection::send(const void* buf, int n, int ms) { return ((Conn*)_p)->send(buf, n, ms); }
 
+int Connection::sendv(const struct iovec* iov, int n, int ms) {
+    return ((Conn*)_p)->sendv(iov, n, ms);
+}
+
+int64_t Connection::sendfile(int fd, int64_t off, int64_t len, int ms) {
+    return ((Conn*)_p)->sendfile(fd, off, len, ms);
+}
+
 int Connection::close(int ms) {
     Conn* p = (Conn*)_p;
     _p = nullptr;
@@ -139,20 +292,254 @@ int Connection::reset(int ms) {
     return 0;
 }
 
+#ifdef __linux__
+// connection on shared memory rings, the socket is kept for liveness checks
+class ShmConn : public Conn {
+  public:
+    ShmConn(shm::Pipe* p, int sock) : _p(p), _sock(sock) {}
+    virtual ~ShmConn() { this->close(0); }
+
+    virtual int recv(void* buf, int n, int ms) { return _p->recv(buf, n, ms); }
+
+    virtual int recvn(void* buf, int n, int ms) {
+        int k = 0;
+        while (k < n) {
+            const int r = _p->recv((char*)buf + k, n - k, ms);
+            if (r <= 0) return r;
+            k += r;
+        }
+        return n;
+    }
+
+    virtual int send(const void* buf, int n, int ms) { return _p->send(buf, n, ms); }
+
+    virtual int sendv(const struct iovec* iov, int n, int ms) { return _p->sendv(iov, n, ms); }
+
+    virtual int64_t sendfile(int fd, int64_t off, int64_t len, int ms) {
+        return _p->sendfile(fd, off, len, ms);
+    }
+
+    virtual int close(int ms) {
+        shm::Pipe* const p = _p;
+        _p = nullptr;
+        if (p) {
+            delete p;
+            return co::close(_sock, ms);
+        }
+        return 0;
+    }
+
+    virtual int reset(int ms) { return this->close(ms); }
+
+    virtual int socket() const noexcept { return _sock; }
+
+    virtual const char* strerror() const noexcept { return co::strerror(); }
+
+  private:
+    shm::Pipe* _p;
+    int _sock;
+};
+#endif
+
 const char* Connection::strerror() const { return ((Conn*)_p)->strerror(); }
 
+// path of a unix domain socket endpoint "unix:path", or NULL for ip addresses
+inline const char* unix_path(const char* ip) {
+    return strncmp(ip, "unix:", 5) == 0 ? ip + 5 : nullptr;
+}
+
+#ifdef __linux__
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#endif
+
+inline bool set_int_opt(sock_t fd, int lv, int opt, int v) {
+    return co::setsockopt(fd, lv, opt, &v, sizeof(v)) == 0;
+}
+
+// set options of a listening socket, accepted sockets inherit the buffer sizes
+static void set_listen_opts(sock_t fd, const SockOpts& o, const fastring& addr) {
+#ifdef TCP_FASTOPEN
+    if (o.fastopen > 0 && !set_int_opt(fd, IPPROTO_TCP, TCP_FASTOPEN, o.fastopen)) {
+        WLOG << "server " << addr << " set TCP_FASTOPEN error: " << co::strerror();
+    }
+#endif
+    if (o.sndbuf > 0) co::set_send_buffer_size(fd, o.sndbuf);
+    if (o.rcvbuf > 0) co::set_recv_buffer_size(fd, o.rcvbuf);
+}
+
+// set options of a client socket, before it is connected
+static void set_connect_opts(sock_t fd, const SockOpts& o) {
+    // the buffer sizes are used in the handshake, and with TFO, connect()
+    // returns at once, the SYN goes out with the first data sent
+    if (o.sndbuf > 0) co::set_send_buffer_size(fd, o.sndbuf);
+    if (o.rcvbuf > 0) co::set_recv_buffer_size(fd, o.rcvbuf);
+#ifdef __linux__
+    if (o.fastopen > 0) set_int_opt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#endif
+}
+
+namespace {
+
+// State of the connection attempts to addresses of a host. Attempts run in
+// coroutines of the same scheduler, no lock is needed. As coroutines share
+// stacks, it is on the heap, and freed by the last one of the caller and the
+// attempts.
+struct connect_race_t {
+    connect_race_t(const SockOpts& o, int64_t deadline)
+        : refn(1), fd(-1), started(0), failed(0), err(0), over(false), deadline(deadline),
+          opts(o) {}
+
+    void unref() {
+        if (--refn == 0) delete this;
+    }
+
+    int refn;
+    int fd;        // socket of the first attempt connected
+    int started;   // attempts started
+    int failed;    // attempts failed
+    int err;       // error of the last attempt failed
+    bool over;     // the caller returned, sockets connected later are closed
+    int64_t deadline;  // ms since epoch, -1 for none
+    SockOpts opts;
+    co::event ev;  // signaled when an attempt is done
+};
+
+struct connect_attempt_t {
+    connect_race_t* r;
+    struct sockaddr_storage addr;
+    int addrlen;
+    int family;
+};
+
+void connect_attempt(connect_attempt_t* a) {
+    connect_race_t* const r = a->r;
+    int ms = -1;
+    if (r->deadline >= 0) {
+        const int64_t t = r->deadline - now::ms();
+        ms = t > 0 ? (int)t : 1;
+    }
+
+    int fd = (int)co::tcp_socket(a->family);
+    bool ok = false;
+    if (fd != -1) {
+        set_connect_opts(fd, r->opts);
+        ok = co::connect(fd, &a->addr, a->addrlen, ms) == 0;
+    }
+    if (ok && r->fd == -1 && !r->over) {
+        r->fd = fd;
+    } else {
+        if (!ok) {
+            ++r->failed;
+            r->err = co::error();
+        }
+        if (fd != -1) co::close(fd);
+    }
+    r->ev.signal();
+    r->unref();
+    delete a;
+}
+
+}  // namespace
+
+// Connect to one of the addresses of a host as in RFC 8305 (happy eyeballs),
+// return the socket connected, or -1 on error.
+//   - Addresses are tried with the families interleaved, in the order of the
+//     resolver otherwise. The next attempt starts FLG_tcp_connect_delay ms after
+//     the previous one, or at once if all previous attempts have failed. The
+//     first attempt connected wins, the others are closed when they are done.
+//   - With TCP_FASTOPEN_CONNECT, connect() returns at once, so the first address
+//     always wins then.
+static int race_connect(const struct addrinfo* info, const SockOpts& opts, int ms) {
+    co::vector<const struct addrinfo*> v;
+    {
+        co::vector<const struct addrinfo*> v6;
+        co::vector<const struct addrinfo*> v4;
+        for (const struct addrinfo* p = info; p; p = p->ai_next) {
+            if (p->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+            (p->ai_family == AF_INET6 ? v6 : v4).push_back(p);
+        }
+        auto& a = info->ai_family == AF_INET6 ? v6 : v4;
+        auto& b = info->ai_family == AF_INET6 ? v4 : v6;
+        for (size_t i = 0; i < a.size() || i < b.size(); ++i) {
+            if (i < a.size()) v.push_back(a[i]);
+            if (i < b.size()) v.push_back(b[i]);
+        }
+    }
+
+    const int64_t delay = FLG_tcp_connect_delay > 0 ? FLG_tcp_connect_delay : 0;
+    connect_race_t* const r = new connect_race_t(opts, ms >= 0 ? now::ms() + ms : -1);
+    size_t i = 0;
+    int64_t next = 0;  // time to start the next attempt
+    bool timeout = false;
+    while (r->fd == -1) {
+        const int64_t t = now::ms();
+        if (i < v.size() && (t >= next || r->failed == r->started)) {
+            auto a = new connect_attempt_t();
+            a->r = r;
+            memcpy(&a->addr, v[i]->ai_addr, v[i]->ai_addrlen);
+            a->addrlen = (int)v[i]->ai_addrlen;
+            a->family = v[i]->ai_family;
+            ++i;
+            ++r->refn;
+            ++r->started;
+            next = t + delay;
+            co::sched()->go(connect_attempt, a);
+            continue;
+        }
+        if (i == v.size() && r->failed == r->started) break;  // all failed
+
+        int64_t w = i < v.size() ? next - t : -1;
+        if (r->deadline >= 0) {
+            if (r->deadline <= t) {
+                timeout = true;
+                break;
+            }
+            if (w < 0 || r->deadline - t < w) w = r->deadline - t;
+        }
+        r->ev.wait(w < 0 ? (uint32_t)-1 : (uint32_t)w);
+    }
+
+    const int fd = r->fd;
+    if (fd == -1) co::error(timeout ? ETIMEDOUT : r->err);
+    r->over = true;
+    r->unref();
+    return fd;
+}
+
+// set options of a connection, failures are ignored as they are only hints
+static void set_conn_opts(sock_t fd, const SockOpts& o) {
+#ifdef __linux__
+    if (o.quickack) set_int_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    if (o.busy_poll > 0) set_int_opt(fd, SOL_SOCKET, SO_BUSY_POLL, o.busy_poll);
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    if (o.notsent_lowat > 0) set_int_opt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, o.notsent_lowat);
+#endif
+    (void)fd;
+    (void)o;
+}
+
 class ServerImpl {
   public:
     ServerImpl()
-        : _started(false),
+        : _unix(false),
+          _shm(false),
+          _reuseport(false),
+          _shed(true),
+          _max_conn(0),
+          _started(false),
           _count(0),
-          _fd((sock_t)-1),
-          _connfd((sock_t)-1),
+          _loops(0),
           _ssl_ctx(0),
           _status(0) {}
 
     ~ServerImpl() {
-        if (_fd != (sock_t)-1) this->exit();
+        if (_loops.load() > 0) this->exit();
         if (_ssl_ctx) {
             ssl::free_ctx(_ssl_ctx);
             _ssl_ctx = 0;
@@ -163,6 +550,17 @@ class ServerImpl {
 
     void on_exit(std::function<void()>&& cb) { _exit_cb = std::move(cb); }
 
+    void set_alpn(const char* protos) { _alpn = protos; }
+
+    void set_reuseport(bool on) { _reuseport = on; }
+
+    void set_sock_opts(const SockOpts& o) { _opts = o; }
+
+    void set_max_conn(uint32_t n, bool shed) {
+        _max_conn = n;
+        _shed = shed;
+    }
+
     void start(const char* ip, int port, const char* key, const char* ca);
     void exit();
     bool started() const { return _started.load(std::memory_order_relaxed); }
@@ -182,32 +580,57 @@ class ServerImpl {
     void stop();
     void on_tcp_connection(sock_t sock);
     void on_ssl_connection(sock_t sock);
+    void on_shm_connection(sock_t sock);
 
   private:
     fastring _ip;
+    fastring _addr;  // ip:port, or unix:path for unix domain sockets
+    fastring _path;  // path of the unix domain socket listened on
+    fastring _alpn;
     uint16_t _port;
+    bool _unix;
+    bool _shm;       // shm endpoint, a unix domain socket is used for the handshake
+    bool _reuseport;
+    bool _shed;
+    uint32_t _max_conn;  // 0 for no limit
+    SockOpts _opts;
     std::atomic_bool _started;
     std::atomic_uint32_t _count;  // refcount
-    sock_t _fd;
-    sock_t _connfd;
+    std::atomic_int _loops;       // accept loops running
     std::function<void(Connection)> _conn_cb;
     std::function<void()> _exit_cb;
     std::function<void(sock_t)> _on_sock;
     void* _ssl_ctx;
     std::atomic_int _status;
-    int _addrlen;
-    union {
-        struct sockaddr_in v4;
-        struct sockaddr_in6 v6;
-    } _addr;
 };
 
 void ServerImpl::start(const char* ip, int port, const char* key, const char* ca) {
     CHECK(_conn_cb != nullptr) << "connection callback not set..";
     _ip = (ip && *ip) ? ip : "0.0.0.0";
     _port = (uint16_t)port;
+    if (const char* name = shm::endpoint_name(_ip.c_str())) {
+#ifndef __linux__
+        CHECK(false) << "shm transport is only supported on linux: " << _ip;
+#endif
+        _shm = true;
+        _path = shm::unix_path(name).c_str() + 5;
+    } else if (const char* path = unix_path(_ip.c_str())) {
+#ifdef _WIN32
+        CHECK(false) << "unix domain socket is not supported on windows: " << _ip;
+#endif
+        _path = path;
+    }
+    _unix = !_path.empty();
+    if (_unix) {
+        _addr = _ip;
+    } else {
+        _addr << _ip << ':' << _port;
+    }
 
-    if (key && *key && ca && *ca) {
+    if (_shm) {
+        if (key && *key && ca && *ca) WLOG << "server " << _addr << ": ssl is ignored for shm";
+        _on_sock = std::bind(&ServerImpl::on_shm_connection, this, std::placeholders::_1);
+    } else if (key && *key && ca && *ca) {
         _ssl_ctx = ssl::new_server_ctx();
         CHECK(_ssl_ctx != nullptr) << "ssl new server contex error: " << ssl::strerror();
 
@@ -221,16 +644,45 @@ void ServerImpl::start(const char* ip, int port, const char* key, const char* ca
         r = ssl::check_private_key(_ssl_ctx);
         CHECK_EQ(r, 1) << "ssl check private key error: " << ssl::strerror();
 
-        _on_sock = std::bind(&ServerImpl::on_ssl_connection, this, std::placeholders::_1);
-        this->ref();
+        if (FLG_ssl_ktls && ssl::enable_ktls(_ssl_ctx) != 1) {
+            WLOG << "ssl server: kernel TLS is not supported by openssl";
+        }
 
-        _started.store(true, std::memory_order_relaxed);
-        go(&ServerImpl::loop, this);
+        if (FLG_ssl_ticket_key_ttl > 0) {
+            r = ssl::set_ticket_key_rotation(_ssl_ctx, FLG_ssl_ticket_key_ttl);
+            CHECK_EQ(r, 1) << "ssl set ticket key rotation error: " << ssl::strerror();
+        }
+
+        if (!_alpn.empty()) {
+            r = ssl::set_alpn(_ssl_ctx, _alpn.c_str());
+            CHECK_EQ(r, 1) << "ssl set alpn (" << _alpn << ") error: " << ssl::strerror();
+        }
+
+        _on_sock = std::bind(&ServerImpl::on_ssl_connection, this, std::placeholders::_1);
     } else {
         _on_sock = std::bind(&ServerImpl::on_tcp_connection, this, std::placeholders::_1);
-        this->ref();
-        _started.store(true, std::memory_order_relaxed);
+    }
+
+#ifndef __linux__
+    if (_reuseport) {
+        WLOG << "server " << _addr << ": SO_REUSEPORT is not supported here";
+        _reuseport = false;
+    }
+#endif
+    if (_reuseport && _unix) {
+        WLOG << "server " << _addr << ": SO_REUSEPORT is not supported for unix domain sockets";
+        _reuseport = false;
+    }
+
+    this->ref();  // released by the last accept loop
+    _started.store(true, std::memory_order_relaxed);
+    if (!_reuseport) {
+        _loops.store(1);
         go(&ServerImpl::loop, this);
+    } else {
+        auto& s = co::scheds();
+        _loops.store((int)s.size());
+        for (size_t i = 0; i < s.size(); ++i) s[i]->go(&ServerImpl::loop, this);
     }
 }
 
@@ -241,90 +693,166 @@ void ServerImpl::exit() {
 
     if (status == 0) {
         sleep::ms(1);
-        if (status != 2) go(&ServerImpl::stop, this);
+        if (status != 2) {
+            this->ref();  // released by stop()
+            go(&ServerImpl::stop, this);
+        }
     }
 
     while (_status.load(std::memory_order_relaxed) != 2) sleep::ms(1);
 }
 
+// Each connection wakes up an accept loop, which then closes its listening socket,
+// so the kernel will not pass the next connection to it in SO_REUSEPORT mode.
 void ServerImpl::stop() {
-    const char* ip = (_ip == "0.0.0.0" || _ip == "::") ? "127.0.0.1" : _ip.c_str();
-    tcp::Client c(ip, _port);
-    c.connect(-1);
+    fastring ip = (_ip == "0.0.0.0" || _ip == "::") ? "127.0.0.1" : _ip;
+    if (_unix) ip = fastring("unix:").append(_path);
+    while (_status.load(std::memory_order_relaxed) != 2) {
+        tcp::Client c(ip.c_str(), _port);
+        if (!c.connect(-1)) co::sleep(1);
+    }
+    this->unref();
 }
 
 /**
  * the server loop
- *   - It listens on a port and waits for connections.
+ *   - It listens on a port (or a unix domain socket) and waits for connections.
  *   - When a connection is accepted, it will start a new coroutine and call
  *     the connection callback to handle the connection.
+ *   - In SO_REUSEPORT mode, each scheduler runs a loop, and connections are
+ *     handled in the scheduler of the loop.
+ *   - co::accept() tries accept4() before it waits for the socket, so pending
+ *     connections are drained one after another in a single wakeup.
  */
 void ServerImpl::loop() {
+    sock_t fd;
     do {
+#ifndef _WIN32
+        if (_unix) {
+            const char* const path = _path.c_str();
+            struct sockaddr_un a;
+            const int len = co::init_addr(&a, path);
+            CHECK_GT(len, 0) << "invalid unix domain socket path: " << path;
+
+            fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
+            CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+
+            // remove the socket file left by a previous run
+            if (*path != '@') ::unlink(path);
+            int r = co::bind(fd, &a, len);
+            CHECK_EQ(r, 0) << "bind " << _addr << " failed: " << co::strerror();
+
+            r = co::listen(fd, 64 * 1024);
+            CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+            break;
+        }
+#endif
         fastring port = str::from(_port);
         struct addrinfo* info = 0;
         int r = getaddrinfo(_ip.c_str(), port.c_str(), nullptr, &info);
         CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
         CHECK(info != nullptr);
 
-        _fd = co::tcp_socket(info->ai_family);
-        CHECK_NE(_fd, (sock_t)-1) << "create socket error: " << co::strerror();
-        co::set_reuseaddr(_fd);
+        fd = co::tcp_socket(info->ai_family);
+        CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+        co::set_reuseaddr(fd);
+        if (_reuseport) {
+            CHECK(co::set_reuseport(fd)) << "set SO_REUSEPORT error: " << co::strerror();
+        }
 
         // turn off IPV6_V6ONLY
         if (info->ai_family == AF_INET6) {
             int on = 0;
-            co::setsockopt(_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+            co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
         }
 
-        r = co::bind(_fd, info->ai_addr, (int)info->ai_addrlen);
-        CHECK_EQ(r, 0) << "bind " << _ip << ':' << _port << " failed: " << co::strerror();
+        r = co::bind(fd, info->ai_addr, (int)info->ai_addrlen);
+        CHECK_EQ(r, 0) << "bind " << _addr << " failed: " << co::strerror();
+        set_listen_opts(fd, _opts, _addr);
 
-        r = co::listen(_fd, 64 * 1024);
+        r = co::listen(fd, 64 * 1024);
         CHECK_EQ(r, 0) << "listen error: " << co::strerror();
 
         freeaddrinfo(info);
     } while (0);
 
-    LOG << "server start: " << _ip << ':' << _port;
+    if (!_reuseport || co::sched_id() == 0) LOG << "server start: " << _addr;
+    int addrlen;
+    union {
+        struct sockaddr_in v4;
+        struct sockaddr_in6 v6;
+#ifndef _WIN32
+        struct sockaddr_un un;
+#endif
+    } addr;
+
     while (true) {
-        _addrlen = sizeof(_addr);
-        _connfd = co::accept(_fd, &_addr, &_addrlen);
+        // stop accepting until some connections are closed, they wait in the backlog
+        if (_max_conn > 0 && !_shed) {
+            while (this->conn_num() >= _max_conn && _status.load(std::memory_order_relaxed) == 0) {
+                co::sleep(1);
+            }
+            if (unlikely(_status.load(std::memory_order_relaxed) == 1)) break;
+        }
+
+        addrlen = sizeof(addr);
+        sock_t connfd = co::accept(fd, &addr, &addrlen);
 
         if (unlikely(_status.load(std::memory_order_relaxed) == 1)) {
-            co::reset_tcp_socket(_connfd);
+            co::reset_tcp_socket(connfd);
             break;
         }
 
-        if (unlikely(_connfd == (sock_t)-1)) {
-            WLOG << "server " << _ip << ':' << _port << " accept error: " << co::strerror();
+        if (unlikely(connfd == (sock_t)-1)) {
+            WLOG << "server " << _addr << " accept error: " << co::strerror();
+            continue;
+        }
+
+        if (_max_conn > 0 && this->conn_num() >= _max_conn) {
+            WLOG_EVERY_N(1024) << "server " << _addr << " reached max conn "
+                               << _max_conn << ", reset connection: "
+                               << co::addr2str(&addr, addrlen);
+            co::reset_tcp_socket(connfd);
             continue;
         }
 
         const uint32_t n = this->ref() - 1;
-        TLOG << "server " << _ip << ':' << _port
-             << " accept connection: " << co::addr2str(&_addr, _addrlen) << ", connfd: " << _connfd
-             << ", conn num: " << n;
-        go(&_on_sock, _connfd);
+        TLOG << "server " << _addr << " accept connection: " << co::addr2str(&addr, addrlen)
+             << ", connfd: " << connfd << ", conn num: " << n;
+        if (!_reuseport) {
+            go(&_on_sock, connfd);
+        } else {
+            co::sched()->go(&_on_sock, connfd);
+        }
     }
 
-    LOG << "server stopped: " << _ip << ':' << _port;
-    co::close(_fd);
-    _fd = (sock_t)-1;
-    _status.store(2);
-    this->unref();
+    co::close(fd);
+    if (--_loops == 0) {
+#ifndef _WIN32
+        if (_unix && _path[0] != '@') ::unlink(_path.c_str());
+#endif
+        LOG << "server stopped: " << _addr;
+        _status.store(2);
+        this->unref();
+    }
 }
 
 void ServerImpl::on_tcp_connection(sock_t fd) {
-    co::set_tcp_keepalive(fd);
-    co::set_tcp_nodelay(fd);
+    if (!_unix) {
+        co::set_tcp_keepalive(fd);
+        co::set_tcp_nodelay(fd);
+        set_conn_opts(fd, _opts);
+    }
     _conn_cb(tcp::Connection((int)fd));
     this->unref();
 }
 
 void ServerImpl::on_ssl_connection(sock_t fd) {
-    co::set_tcp_keepalive(fd);
-    co::set_tcp_nodelay(fd);
+    if (!_unix) {
+        co::set_tcp_keepalive(fd);
+        co::set_tcp_nodelay(fd);
+        set_conn_opts(fd, _opts);
+    }
 
     ssl::S* s = ssl::new_ssl((ssl::C*)_ssl_ctx);
     if (s == nullptr) goto new_ssl_err;
@@ -350,6 +878,21 @@ end:
     this->unref();
 }
 
+void ServerImpl::on_shm_connection(sock_t fd) {
+#ifdef __linux__
+    shm::Pipe* const p = shm::accept(fd, 3000);
+    if (p) {
+        Connection c;
+        c._p = new ShmConn(p, (int)fd);
+        _conn_cb(std::move(c));
+    } else {
+        ELOG << "shm handshake failed: " << co::strerror();
+        co::close(fd);
+    }
+#endif
+    this->unref();
+}
+
 Server::Server() { _p = new ServerImpl(); }
 
 Server::~Server() {
@@ -372,6 +915,26 @@ Server& Server::on_exit(std::function<void()>&& cb) {
 
 uint32_t Server::conn_num() const { return ((ServerImpl*)_p)->conn_num(); }
 
+Server& Server::set_alpn(const char* protos) {
+    ((ServerImpl*)_p)->set_alpn(protos);
+    return *this;
+}
+
+Server& Server::set_reuseport(bool on) {
+    ((ServerImpl*)_p)->set_reuseport(on);
+    return *this;
+}
+
+Server& Server::set_max_conn(uint32_t n, bool shed) {
+    ((ServerImpl*)_p)->set_max_conn(n, shed);
+    return *this;
+}
+
+Server& Server::set_sock_opts(const SockOpts& o) {
+    ((ServerImpl*)_p)->set_sock_opts(o);
+    return *this;
+}
+
 void Server::start(const char* ip, int port, const char* key, const char* ca) {
     ((ServerImpl*)_p)->start(ip, port, key, ca);
 }
@@ -381,9 +944,10 @@ void Server::exit() { ((ServerImpl*)_p)->exit(); }
 // |ref(4)|len(4)|port(8)|ip|
 // |ssl_ctx(void*)|ssl(void*)|ref(4)|len(4)|port(8)|ip|
 Client::Client(const char* ip, int port, bool use_ssl)
-    : _fd(-1), _use_ssl(use_ssl), _connected(false) {
+    : _fd(-1), _use_ssl(use_ssl), _connected(false), _shm(0) {
     if (!ip || !*ip) ip = "127.0.0.1";
     const size_t n = strlen(ip) + 1;
+    if (shm::endpoint_name(ip)) _use_ssl = use_ssl = false;  // no ssl on shared memory
     if (!use_ssl) {
         _p = (char*)::malloc(n + 16);
         _u[1] = n + 16;
@@ -398,7 +962,8 @@ Client::Client(const char* ip, int port, bool use_ssl)
     *(_p + 8 + fast::utoa((uint16_t)port, _p + 8)) = '\0';
 }
 
-Client::Client(const Client& c) : _u(c._u), _fd(-1), _use_ssl(c._use_ssl), _connected(false) {
+Client::Client(const Client& c)
+    : _u(c._u), _fd(-1), _use_ssl(c._use_ssl), _connected(false), _shm(0), _opts(c._opts) {
     if (_u) std::atomic_fetch_add_explicit((std::atomic_uint32_t*)_u, 1, std::memory_order_relaxed);
 }
 
@@ -411,22 +976,57 @@ Client::~Client() {
     }
 }
 
+#ifdef __linux__
+#define SHM_PIPE ((shm::Pipe*)_shm)
+#define SHM_CALL(x) if (unlikely(_shm != 0)) return SHM_PIPE->x
+#else
+#define SHM_CALL(x)
+#endif
+
 int Client::recv(void* buf, int n, int ms) {
+    SHM_CALL(recv(buf, n, ms));
     return !_use_ssl ? co::recv(_fd, buf, n, ms) : ssl::recv(_s[-1], buf, n, ms);
 }
 
 int Client::recvn(void* buf, int n, int ms) {
+#ifdef __linux__
+    if (unlikely(_shm != 0)) {
+        int k = 0;
+        while (k < n) {
+            const int r = SHM_PIPE->recv((char*)buf + k, n - k, ms);
+            if (r <= 0) return r;
+            k += r;
+        }
+        return n;
+    }
+#endif
     return !_use_ssl ? co::recvn(_fd, buf, n, ms) : ssl::recvn(_s[-1], buf, n, ms);
 }
 
 int Client::send(const void* buf, int n, int ms) {
+    SHM_CALL(send(buf, n, ms));
     return !_use_ssl ? co::send(_fd, buf, n, ms) : ssl::send(_s[-1], buf, n, ms);
 }
 
+int Client::sendv(const struct iovec* iov, int n, int ms) {
+    SHM_CALL(sendv(iov, n, ms));
+    return !_use_ssl ? co::sendv(_fd, iov, n, ms) : ssl::sendv(_s[-1], iov, n, ms);
+}
+
+int64_t Client::sendfile(int fd, int64_t off, int64_t len, int ms) {
+    SHM_CALL(sendfile(fd, off, len, ms));
+    return !_use_ssl ? co::sendfile(_fd, fd, off, len, ms)
+                     : ssl::sendfile(_s[-1], fd, off, len, ms);
+}
+
 bool Client::bind(const char* ip, int port) {
     CHECK(!this->connected()) << "bind must be called before connect";
 
     const char* const serv_ip = _p + 16;
+    if (shm::endpoint_name(serv_ip) || unix_path(serv_ip)) {
+        ELOG << "tcp::Client::bind() is not supported for " << serv_ip;
+        return false;
+    }
     const char* const serv_port = _p + 8;
     struct addrinfo *srv = 0, *cli = 0;
     defer(if (srv) freeaddrinfo(srv); if (cli) freeaddrinfo(cli););
@@ -462,32 +1062,89 @@ bool Client::connect(int ms) {
 
     const char* const ip = _p + 16;
     const char* const port = _p + 8;
+    const char* path = unix_path(ip);
     struct addrinfo* info = 0;
     defer(if (info) freeaddrinfo(info));
 
-    int r = getaddrinfo(ip, port, nullptr, &info);
-    if (r != 0) goto end;
-
-    CHECK_NOTNULL(info);
-    if (_fd == -1) {
-        _fd = (int)co::tcp_socket(info->ai_family);
-        if (_fd == -1) {
-            ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+    int r;
+    const char* const shm_name = shm::endpoint_name(ip);
+    fastring shm_path;
+    if (shm_name) {
+        shm_path = shm::unix_path(shm_name);
+        path = shm_path.c_str() + 5;
+    }
+    if (path) {
+#ifndef _WIN32
+        struct sockaddr_un a;
+        const int len = co::init_addr(&a, path);
+        if (len == 0) {
+            ELOG << "connect to " << ip << " failed: invalid path";
             goto end;
         }
-    }
-
-    r = co::connect(_fd, info->ai_addr, (int)info->ai_addrlen, ms);
-    if (r != 0) {
-        ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+        if (_fd == -1 && (_fd = (int)co::socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            ELOG << "connect to " << ip << " failed: " << co::strerror();
+            goto end;
+        }
+        if (co::connect(_fd, &a, len, ms) != 0) {
+            ELOG << "connect to " << ip << " failed: " << co::strerror();
+            goto end;
+        }
+#ifdef __linux__
+        if (shm_name && (_shm = shm::connect(_fd, ms)) == nullptr) {
+            ELOG << "connect to " << ip << " failed, shm handshake error: " << co::strerror();
+            goto end;
+        }
+#else
+        if (shm_name) {
+            ELOG << "connect to " << ip << " failed: shm transport is not supported";
+            goto end;
+        }
+#endif
+#else
+        ELOG << "connect to " << ip << " failed: unix domain socket is not supported";
         goto end;
+#endif
+    } else {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        r = getaddrinfo(ip, port, &hints, &info);
+        if (r != 0) goto end;
+
+        CHECK_NOTNULL(info);
+        if (_fd == -1 && info->ai_next) {
+            _fd = race_connect(info, _opts, ms);
+            if (_fd == -1) {
+                ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+                goto end;
+            }
+        } else {
+            if (_fd == -1) {
+                _fd = (int)co::tcp_socket(info->ai_family);
+                if (_fd == -1) {
+                    ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+                    goto end;
+                }
+            }
+
+            set_connect_opts(_fd, _opts);
+            r = co::connect(_fd, info->ai_addr, (int)info->ai_addrlen, ms);
+            if (r != 0) {
+                ELOG << "connect to " << ip << ':' << port << " failed: " << co::strerror();
+                goto end;
+            }
+        }
+        co::set_tcp_nodelay(_fd);
+        set_conn_opts(_fd, _opts);
     }
 
-    co::set_tcp_nodelay(_fd);
     if (_use_ssl) {
         if ((_s[-2] = ssl::new_client_ctx()) == nullptr) goto new_ctx_err;
+        ssl::enable_session_cache(_s[-2]);
+        if (FLG_ssl_ktls) ssl::enable_ktls(_s[-2]);
         if ((_s[-1] = ssl::new_ssl(_s[-2])) == nullptr) goto new_ssl_err;
         if (ssl::set_fd(_s[-1], _fd) != 1) goto set_fd_err;
+        ssl::use_cached_session(_s[-1], fastring(ip).append(':').append(port).c_str());
         if (ssl::connect(_s[-1], ms) != 1) goto connect_err;
     }
 
@@ -513,6 +1170,12 @@ end:
 
 void Client::disconnect() {
     if (_fd != -1) {
+#ifdef __linux__
+        if (_shm) {
+            delete SHM_PIPE;
+            _shm = 0;
+        }
+#endif
         if (_use_ssl) {
             if (_s[-1]) {
                 ssl::free_ssl(_s[-1]);
@@ -531,4 +1194,7 @@ void Client::disconnect() {
 
 const char* Client::strerror() const { return !_use_ssl ? co::strerror() : ssl::strerror(_s[-1]); }
 
+#undef SHM_CALL
+#undef SHM_PIPE
+
 }  // namespace tcp
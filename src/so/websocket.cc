@@ -0,0 +1,443 @@
+#include "./http.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WS_NEON
+#endif
+
+#include <memory>
+
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/hash/base64.h"
+#include "co/hash/sha1.h"
+#include "co/http.h"
+#include "co/log.h"
+#include "co/tcp.h"
+#include "co/vector.h"
+
+DEF_uint32(http_ws_max_msg_size, 1 << 20, ">>#2 max size of a websocket message, default: 1M");
+DEF_uint32(http_ws_max_queue_size, 8 << 20,
+           ">>#2 max bytes of websocket messages waiting to be sent on a connection, "
+           "the connection is closed beyond it, default: 8M");
+DEC_uint32(http_send_timeout);
+DEC_bool(http_log);
+
+#define WSLOG LOG_IF(FLG_http_log)
+
+namespace http {
+namespace {
+
+enum {
+    kContinuation = 0x0,
+    kClose = 0x8,
+    kPing = 0x9,
+    kPong = 0xa,
+};
+
+typedef std::shared_ptr<fastring> frame_ptr;
+
+// server frames are not masked, so a frame can be shared by many connections
+frame_ptr make_frame(int op, const void* s, size_t n) {
+    frame_ptr f = std::make_shared<fastring>(n + 10);
+    f->append((char)(0x80 | op));
+    if (n < 126) {
+        f->append((char)n);
+    } else if (n < 65536) {
+        f->append((char)126).append((char)(n >> 8)).append((char)n);
+    } else {
+        f->append((char)127);
+        for (int i = 56; i >= 0; i -= 8) f->append((char)((uint64_t)n >> i));
+    }
+    f->append(s, n);
+    return f;
+}
+
+frame_ptr make_close_frame(uint16_t code) {
+    const char x[2] = { (char)(code >> 8), (char)code };
+    return make_frame(kClose, x, 2);
+}
+
+// unmask @n bytes at @p with the 4-byte @key
+//   - 16 bytes are xored at a time with SSE2 on x86 or NEON on arm, then 8
+//     bytes at a time. Each step is a multiple of 4, so the key stays in phase.
+inline void unmask(char* p, size_t n, const char* key) {
+    uint32_t k;
+    memcpy(&k, key, 4);
+    size_t i = 0;
+#if defined(WS_SSE2)
+    const __m128i vk = _mm_set1_epi32((int)k);
+    for (; n - i >= 16; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(x, vk));
+    }
+#elif defined(WS_NEON)
+    const uint8x16_t vk = vreinterpretq_u8_u32(vdupq_n_u32(k));
+    for (; n - i >= 16; i += 16) {
+        vst1q_u8((uint8_t*)(p + i), veorq_u8(vld1q_u8((const uint8_t*)(p + i)), vk));
+    }
+#endif
+    const uint64_t k8 = ((uint64_t)k << 32) | k;
+    for (; n - i >= 8; i += 8) {
+        uint64_t x;
+        memcpy(&x, p + i, 8);
+        x ^= k8;
+        memcpy(p + i, &x, 8);
+    }
+    for (; i < n; ++i) p[i] ^= key[i & 3];
+}
+
+}  // namespace
+
+// A WebSocket connection. Frames are queued by send() from any thread, and
+// written by a writer coroutine in the scheduler of the connection. The reader
+// side is used only by the handler. As coroutines share stacks, the connection
+// is held here on the heap.
+struct ws_t {
+    explicit ws_t(tcp::Connection&& c)
+        : refn(1), conn(std::move(c)), queued(0), closing(false), broken(false), stop(false),
+          served(false), rpos(0), part_op(0) {}
+
+    void ref() { refn.fetch_add(1, std::memory_order_relaxed); }
+
+    void unref() {
+        if (refn.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    // queue a frame, no more frames are accepted after the @last one
+    bool push(const frame_ptr& f, bool last = false) {
+        co::mutex_guard g(mtx);
+        if (closing) return false;
+        if (queued + f->size() > FLG_http_ws_max_queue_size) {
+            WLOG << "websocket peer can't keep up, queued: " << queued;
+            closing = broken = true;
+            out.clear();
+            ev.signal();
+            return false;
+        }
+        out.push_back(f);
+        queued += f->size();
+        closing = last;
+        ev.signal();
+        return true;
+    }
+
+    // close with @code on protocol errors
+    int fail(uint16_t code) {
+        WLOG << "websocket protocol error, close with " << code;
+        this->push(make_close_frame(code), true);
+        return -1;
+    }
+
+    int recv(fastring& msg, int ms);
+
+    std::atomic<int> refn;
+    tcp::Connection conn;
+    co::mutex mtx;
+    co::vector<frame_ptr> out;  // frames to be sent, guarded by mtx
+    size_t queued;              // bytes in out
+    bool closing;               // the close frame was queued, or the connection broke
+    bool broken;                // send error, or the peer can't keep up
+    bool stop;                  // the handler returned, the writer exits
+    bool served;                // the writer exited, the connection was closed
+    co::event ev;               // signaled when frames are queued
+    co::event done;             // signaled when the writer exits
+
+    fastring rbuf;    // data received, frames are parsed in place
+    size_t rpos;      // beginning of the next frame in rbuf
+    fastring part;    // a fragmented message not finished yet
+    int part_op;      // opcode of the fragmented message, 0 if none
+};
+
+static void ws_writer(ws_t* w) {
+    co::vector<frame_ptr> v;
+    struct iovec iov[64];
+    bool stop = false;
+    while (!stop) {
+        w->ev.wait();
+        {
+            co::mutex_guard g(w->mtx);
+            v.swap(w->out);
+            w->queued = 0;
+            stop = w->stop;
+            if (w->broken) {
+                v.clear();
+                stop = true;
+            }
+        }
+
+        // frames queued together go out in one writev, as many as possible
+        for (size_t i = 0; i < v.size();) {
+            int n = 0;
+            for (; i < v.size() && n < 64; ++i, ++n) {
+                iov[n].iov_base = (void*)v[i]->data();
+                iov[n].iov_len = v[i]->size();
+            }
+            if (w->conn.sendv(iov, n, FLG_http_send_timeout) <= 0) {
+                ELOG << "websocket send error: " << w->conn.strerror();
+                co::mutex_guard g(w->mtx);
+                w->closing = w->broken = true;
+                w->out.clear();
+                stop = true;
+                break;
+            }
+        }
+        v.clear();
+    }
+
+    // wake up the handler blocked in recv()
+    if (w->broken) co::shutdown(w->conn.socket());
+    w->done.signal();
+}
+
+int ws_t::recv(fastring& msg, int ms) {
+    msg.clear();
+    while (true) {
+        const size_t avail = rbuf.size() - rpos;
+        if (avail >= 2) {
+            char* const p = &rbuf[rpos];
+            const bool fin = (p[0] & 0x80) != 0;
+            const int op = p[0] & 0x0f;
+            if ((p[0] & 0x70) || !(p[1] & 0x80)) return this->fail(1002);  // rsv, or unmasked
+
+            uint64_t len = p[1] & 0x7f;
+            size_t h = 2;
+            if (len == 126) {
+                if (avail < 4) goto recv_more;
+                len = ((uint64_t)(uint8_t)p[2] << 8) | (uint8_t)p[3];
+                h = 4;
+            } else if (len == 127) {
+                if (avail < 10) goto recv_more;
+                len = 0;
+                for (int i = 2; i < 10; ++i) len = (len << 8) | (uint8_t)p[i];
+                if (len >> 63) return this->fail(1002);  // the top bit MUST be 0
+                h = 10;
+            }
+            if (op >= kClose && (!fin || len > 125)) return this->fail(1002);
+
+            // compared without adding, a length from the peer may wrap around
+            const size_t max = FLG_http_ws_max_msg_size;
+            if (part.size() > max || len > max - part.size()) return this->fail(1009);
+            if (avail < h + 4 || avail - h - 4 < len) {
+                rbuf.reserve(rpos + h + 4 + (size_t)len);
+                goto recv_more;
+            }
+
+            char* const data = p + h + 4;
+            const size_t n = (size_t)len;
+            unmask(data, n, p + h);
+            rpos += h + 4 + n;
+
+            switch (op) {
+            case kContinuation:
+                if (part_op == 0) return this->fail(1002);
+                part.append(data, n);
+                if (fin) {
+                    const int r = part_op;
+                    msg.swap(part);
+                    part_op = 0;
+                    return r;
+                }
+                continue;
+            case WebSocket::kText:
+            case WebSocket::kBinary:
+                if (part_op != 0) return this->fail(1002);
+                if (fin) {
+                    msg.append(data, n);
+                    return op;
+                }
+                part.append(data, n);
+                part_op = op;
+                continue;
+            case kClose: {
+                // echo the status code, then the peer closes the connection
+                const uint16_t code =
+                    n >= 2 ? (uint16_t)(((uint8_t)data[0] << 8) | (uint8_t)data[1]) : 1000;
+                this->push(make_close_frame(code), true);
+                return 0;
+            }
+            case kPing:
+                this->push(make_frame(kPong, data, n));
+                continue;
+            case kPong:
+                continue;
+            default:
+                return this->fail(1002);
+            }
+        }
+
+    recv_more:
+        if (rpos > 0) { /* drop frames already parsed */
+            rbuf.trim(rpos, 'l');
+            rpos = 0;
+        }
+        if (rbuf.capacity() - rbuf.size() < 512) rbuf.reserve(rbuf.size() + 4096);
+        const int r = conn.recv(&rbuf[0] + rbuf.size(), (int)(rbuf.capacity() - rbuf.size()), ms);
+        if (r == 0) return 0;
+        if (r < 0) return -1;
+        rbuf.resize(rbuf.size() + r);
+    }
+}
+
+WebSocket::WebSocket(const WebSocket& ws) : _p(ws._p) {
+    if (_p) ((ws_t*)_p)->ref();
+}
+
+WebSocket& WebSocket::operator=(const WebSocket& ws) {
+    if (&ws != this) {
+        if (ws._p) ((ws_t*)ws._p)->ref();
+        if (_p) ((ws_t*)_p)->unref();
+        _p = ws._p;
+    }
+    return *this;
+}
+
+WebSocket::~WebSocket() {
+    if (_p) {
+        ((ws_t*)_p)->unref();
+        _p = 0;
+    }
+}
+
+bool WebSocket::send(const void* s, size_t n, Opcode op) {
+    return _p && ((ws_t*)_p)->push(make_frame(op, s, n));
+}
+
+int WebSocket::recv(fastring& msg, int ms) {
+    ws_t* const w = (ws_t*)_p;
+    if (!w || w->served) {
+        msg.clear();
+        return 0;
+    }
+    return w->recv(msg, ms);
+}
+
+void WebSocket::close(uint16_t code) {
+    if (_p) ((ws_t*)_p)->push(make_close_frame(code), true);
+}
+
+bool WebSocket::closed() const {
+    ws_t* const w = (ws_t*)_p;
+    if (!w) return true;
+    co::mutex_guard g(w->mtx);
+    return w->closing;
+}
+
+bool serve_websocket(tcp::Connection& conn, const Req& req, fastring& rest,
+                     const std::function<void(const Req&, WebSocket&)>& f) {
+    fastring up(req.header("Upgrade"));
+    const char* const key = req.header("Sec-WebSocket-Key");
+    if (up.tolower() != "websocket" || !*key || strcmp(req.header("Sec-WebSocket-Version"), "13")) {
+        return false;
+    }
+
+    // Sec-WebSocket-Accept: base64(sha1(key + GUID)), see RFC 6455 section 4.2.2
+    fastring s(strlen(key) + 36);
+    s.append(key).append("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    const fastring accept = base64_encode(sha1digest(s));
+    s.clear();
+    s.append("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n")
+        .append("Connection: Upgrade\r\nSec-WebSocket-Accept: ")
+        .append(accept)
+        .append("\r\n\r\n");
+    if (conn.send(s.data(), (int)s.size(), FLG_http_send_timeout) <= 0) {
+        ELOG << "websocket handshake error: " << conn.strerror();
+        return true;
+    }
+    WSLOG << "websocket upgraded: " << co::peer(conn.socket()) << ", url: " << req.url();
+
+    // the connection is moved to the heap, and closed when the handler returns
+
+    ws_t* const w = new ws_t(std::move(conn));
+    w->rbuf.swap(rest);
+    w->ref();  // held by the writer
+    co::sched()->go(ws_writer, w);
+    {
+        WebSocket ws;
+        *(ws_t**)&ws = w;
+        f(req, ws);
+        {
+            co::mutex_guard g(w->mtx);
+            if (!w->closing) {
+                w->out.push_back(make_close_frame(1000));
+                w->closing = true;
+            }
+            w->stop = true;
+            w->ev.signal();
+        }
+        w->done.wait();
+        w->conn.close();
+        w->served = true;
+    }
+    w->unref();
+    return true;
+}
+
+struct broadcaster_t {
+    co::mutex mtx;
+    co::vector<ws_t*> subs;
+};
+
+Broadcaster::Broadcaster() : _p(new broadcaster_t()) {}
+
+Broadcaster::~Broadcaster() {
+    auto b = (broadcaster_t*)_p;
+    for (size_t i = 0; i < b->subs.size(); ++i) b->subs[i]->unref();
+    delete b;
+}
+
+void Broadcaster::add(const WebSocket& ws) {
+    auto b = (broadcaster_t*)_p;
+    ws_t* const w = (ws_t*)ws._p;
+    if (!w) return;
+    co::mutex_guard g(b->mtx);
+    for (size_t i = 0; i < b->subs.size(); ++i) {
+        if (b->subs[i] == w) return;
+    }
+    w->ref();
+    b->subs.push_back(w);
+}
+
+void Broadcaster::del(const WebSocket& ws) {
+    auto b = (broadcaster_t*)_p;
+    co::mutex_guard g(b->mtx);
+    for (size_t i = 0; i < b->subs.size(); ++i) {
+        if (b->subs[i] == ws._p) {
+            b->subs[i]->unref();
+            b->subs[i] = b->subs.back();
+            b->subs.pop_back();
+            return;
+        }
+    }
+}
+
+size_t Broadcaster::send(const void* s, size_t n, WebSocket::Opcode op) {
+    auto b = (broadcaster_t*)_p;
+    const frame_ptr f = make_frame(op, s, n);
+    co::mutex_guard g(b->mtx);
+    size_t r = 0;
+    for (size_t i = 0; i < b->subs.size();) {
+        if (b->subs[i]->push(f)) {
+            ++r;
+            ++i;
+        } else { /* closed */
+            b->subs[i]->unref();
+            b->subs[i] = b->subs.back();
+            b->subs.pop_back();
+        }
+    }
+    return r;
+}
+
+size_t Broadcaster::size() const {
+    auto b = (broadcaster_t*)_p;
+    co::mutex_guard g(b->mtx);
+    return b->subs.size();
+}
+
+}  // namespace http
+
+#undef WSLOG
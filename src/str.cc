@@ -4,6 +4,18 @@
 
 #include <algorithm>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STR_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define STR_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace str {
 
 fastring replace(const char* s, size_t n, const char* sub, size_t m, const char* to, size_t l,
@@ -57,6 +69,24 @@ co::vector<fastring> split(const char* s, size_t n, const char* c, size_t m, siz
     return v;
 }
 
+co::vector<fastring> split_any(const char* s, size_t n, const char* c, size_t m, size_t t) {
+    co::vector<fastring> v;
+    if (unlikely(m == 0)) return v;
+    v.reserve(8);
+
+    const char* p;
+    const char* const end = s + n;
+
+    while ((p = str::memany(s, end - s, c, m))) {
+        v.emplace_back(s, p - s);
+        s = p + 1;
+        if (v.size() == t) break;
+    }
+
+    if (s < end) v.emplace_back(s, end - s);
+    return v;
+}
+
 // co::error() is equal to errno on linux/mac, that's not the fact on windows.
 #ifdef _WIN32
 #define _co_set_error(e) co::error(e)
@@ -195,7 +225,378 @@ double to_double(const char* s) {
     return 0;
 }
 
+namespace {
+
+inline uint64_t _load8(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+// all 8 bytes of @x are in '0'-'9'
+inline bool _is_8_digits(uint64_t x) {
+    return !(((x + 0x4646464646464646ULL) | (x - 0x3030303030303030ULL)) &
+             0x8080808080808080ULL);
+}
+
+// convert 8 digits loaded by _load8() to integer, the first digit is the low byte
+inline uint32_t _parse_8_digits(uint64_t x) {
+    x -= 0x3030303030303030ULL;
+    x = (x * 10) + (x >> 8);
+    x = (((x & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+         (((x >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >>
+        32;
+    return (uint32_t)x;
+}
+
+// parse decimal digits in [s, e), return false on invalid digits or overflow
+bool _parse_digits(const char* s, const char* e, uint64_t& v) {
+    if (s == e) return false;
+    uint64_t x = 0;
+    while (e - s >= 8) {
+        const uint64_t w = _load8(s);
+        if (!_is_8_digits(w)) break;
+        const uint32_t c = _parse_8_digits(w);
+        // UINT64_MAX: 184467440737'09551615
+        if (x > 184467440737ULL || (x == 184467440737ULL && c > 9551615)) return false;
+        x = x * 100000000 + c;
+        s += 8;
+    }
+    for (; s < e; ++s) {
+        const uint32_t d = (uint8_t)*s - '0';
+        if (d > 9) return false;
+        if (x > 1844674407370955161ULL || (x == 1844674407370955161ULL && d > 5)) return false;
+        x = x * 10 + d;
+    }
+    v = x;
+    return true;
+}
+
+const double _pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                         1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+}  // namespace
+
+bool parse_uint64(const char* s, size_t n, uint64_t& v) {
+    const char* const e = s + n;
+    if (s < e && *s == '+') ++s;
+    return _parse_digits(s, e, v);
+}
+
+bool parse_int64(const char* s, size_t n, int64_t& v) {
+    const char* const e = s + n;
+    bool neg = false;
+    if (s < e && (*s == '-' || *s == '+')) neg = *s++ == '-';
+    uint64_t x;
+    if (!_parse_digits(s, e, x)) return false;
+    if (neg) {
+        if (x > (uint64_t)INT64_MAX + 1) return false;
+        v = (int64_t)(0 - x);
+    } else {
+        if (x > (uint64_t)INT64_MAX) return false;
+        v = (int64_t)x;
+    }
+    return true;
+}
+
+bool parse_int32(const char* s, size_t n, int32_t& v) {
+    int64_t x;
+    if (!parse_int64(s, n, x) || x > INT32_MAX || x < INT32_MIN) return false;
+    v = (int32_t)x;
+    return true;
+}
+
+bool parse_uint32(const char* s, size_t n, uint32_t& v) {
+    uint64_t x;
+    if (!parse_uint64(s, n, x) || x > UINT32_MAX) return false;
+    v = (uint32_t)x;
+    return true;
+}
+
+// Up to 19 significant digits are kept in the mantissa @m. If @m fits in the
+// 53 bits of a double and the power of 10 is within 1e22, both are exact and
+// the result of a single multiplication or division is correctly rounded.
+// Other cases are rare in practice, and they are passed to strtod().
+bool parse_double(const char* s, size_t n, double& v) {
+    const char* p = s;
+    const char* const e = s + n;
+    bool neg = false;
+    if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    uint64_t m = 0;
+    int64_t exp10 = 0;
+    int digits = 0;  // significant digits in m
+    bool any = false, truncated = false;
+    uint32_t d;
+
+    for (; p < e && (d = (uint8_t)*p - '0') <= 9; ++p) {
+        any = true;
+        if (digits < 19) {
+            m = m * 10 + d;
+            if (m) ++digits;
+        } else {
+            ++exp10;
+            truncated |= d != 0;
+        }
+    }
+    if (p < e && *p == '.') {
+        for (++p; p < e && (d = (uint8_t)*p - '0') <= 9; ++p) {
+            any = true;
+            if (digits < 19) {
+                m = m * 10 + d;
+                if (m) ++digits;
+                --exp10;
+            } else {
+                truncated |= d != 0;
+            }
+        }
+    }
+    if (!any) return false;
+
+    if (p < e && (*p == 'e' || *p == 'E')) {
+        bool eneg = false;
+        if (++p < e && (*p == '-' || *p == '+')) eneg = *p++ == '-';
+        if (p == e) return false;
+        int64_t x = 0;
+        for (; p < e && (d = (uint8_t)*p - '0') <= 9; ++p) {
+            if (x < 100000) x = x * 10 + d;
+        }
+        exp10 += eneg ? -x : x;
+    }
+    if (p != e) return false;
+
+    if (m == 0) {
+        v = neg ? -0.0 : 0.0;
+        return true;
+    }
+    if (!truncated && m <= (1ULL << 53) && -22 <= exp10 && exp10 <= 22) {
+        double x = (double)m;
+        x = exp10 < 0 ? x / _pow10[-exp10] : x * _pow10[exp10];
+        v = neg ? -x : x;
+        return true;
+    }
+
+    // the string was checked above, strtod() will consume all of it
+    char buf[64];
+    fastring t;
+    char* b = buf;
+    if (n < sizeof(buf)) {
+        memcpy(buf, s, n);
+        buf[n] = '\0';
+    } else {
+        t.append(s, n);
+        b = (char*)t.c_str();
+    }
+    const int err = errno;
+    errno = 0;
+    const double x = strtod(b, 0);
+    const bool ok = errno != ERANGE;
+    errno = err;
+    if (!ok) return false;
+    v = x;
+    return true;
+}
+
 #undef _co_set_error
 #undef _co_reset_error
 
+namespace {
+
+inline uint32_t first_bit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return (uint32_t)r;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+inline uint8_t fold(uint8_t c, bool icase) {
+    return (icase && 'A' <= c && c <= 'Z') ? (uint8_t)(c + 32) : c;
+}
+
+const uint32_t kNone = (uint32_t)-1;
+
+}  // namespace
+
+matcher::matcher(std::initializer_list<co::strview> v, bool icase) : _icase(icase) {
+    this->_build(v.begin(), v.size());
+}
+
+matcher::matcher(const co::vector<co::strview>& v, bool icase) : _icase(icase) {
+    this->_build(v.data(), v.size());
+}
+
+matcher::matcher(const co::vector<fastring>& v, bool icase) : _icase(icase) {
+    co::vector<co::strview> x(v.size());
+    for (size_t i = 0; i < v.size(); ++i) x.push_back(co::strview(v[i].data(), v[i].size()));
+    this->_build(x.data(), x.size());
+}
+
+// The trie of the patterns is built first, then the failure links are resolved
+// in BFS order, so that each state has a transition for every class, and the
+// scan takes one lookup for each byte.
+void matcher::_build(const co::strview* v, size_t n) {
+    _n = n;
+    _ncls = 1;
+    _nfirst = 0;
+    memset(_cls, 0, sizeof(_cls));
+    memset(_start, 0, sizeof(_start));
+    for (size_t k = 0; k < n; ++k) {
+        for (size_t i = 0; i < v[k].size(); ++i) {
+            const uint8_t c = fold((uint8_t)v[k][i], _icase);
+            if (_cls[c] == 0) {
+                _cls[c] = (uint16_t)_ncls++;
+                if (_icase && 'a' <= c && c <= 'z') _cls[c - 32] = _cls[c];
+            }
+        }
+    }
+
+    _next.resize(_ncls);
+    for (uint32_t c = 0; c < _ncls; ++c) _next[c] = kNone;
+    _depth.resize(1);
+    _len.resize(1);
+    _id.resize(1);
+    _depth[0] = _len[0] = _id[0] = 0;
+
+    for (size_t k = 0; k < n; ++k) {
+        if (v[k].empty()) continue;
+        uint32_t st = 0;
+        for (size_t i = 0; i < v[k].size(); ++i) {
+            const uint32_t c = _cls[(uint8_t)v[k][i]];
+            if (_next[st * _ncls + c] == kNone) {
+                const uint32_t x = (uint32_t)_depth.size();
+                _next[st * _ncls + c] = x;
+                for (uint32_t j = 0; j < _ncls; ++j) _next.push_back(kNone);
+                _depth.push_back(_depth[st] + 1);
+                _len.push_back(0);
+                _id.push_back(0);
+            }
+            st = _next[st * _ncls + c];
+        }
+        if (_len[st] == 0) {
+            _len[st] = (uint32_t)v[k].size();
+            _id[st] = (uint32_t)k;
+        }
+    }
+
+    // bytes a pattern may begin with
+    for (int c = 0; c < 256; ++c) {
+        const uint32_t k = _cls[c];
+        if (k != 0 && _next[k] != kNone) {
+            _start[c] = 1;
+            if (_nfirst >= 0 && _nfirst < 8) {
+                _first[_nfirst++] = (char)c;
+            } else {
+                _nfirst = -1;
+            }
+        }
+    }
+    if (_nfirst < 0) _nfirst = 0;
+
+    co::vector<uint32_t> fail(_depth.size());
+    co::vector<uint32_t> q(_depth.size());
+    fail.resize(_depth.size());
+    for (uint32_t c = 0; c < _ncls; ++c) {
+        const uint32_t x = _next[c];
+        if (x == kNone) {
+            _next[c] = 0;
+        } else {
+            fail[x] = 0;
+            q.push_back(x);
+        }
+    }
+    for (size_t i = 0; i < q.size(); ++i) {
+        const uint32_t u = q[i];
+        const uint32_t f = fail[u];
+        if (_len[u] == 0) {
+            _len[u] = _len[f];
+            _id[u] = _id[f];
+        }
+        for (uint32_t c = 0; c < _ncls; ++c) {
+            uint32_t& x = _next[u * _ncls + c];
+            if (x == kNone) {
+                x = _next[f * _ncls + c];
+            } else {
+                fail[x] = _next[f * _ncls + c];
+                q.push_back(x);
+            }
+        }
+    }
+}
+
+// A match found is kept until no match can begin at or before it. Any match not
+// ended yet begins within the string of the current state, so the best match is
+// done when it begins before that string.
+const char* matcher::_find(const char* p, const char* e, size_t& len, size_t& id) const {
+    if (_depth.size() <= 1) return nullptr;
+    const uint32_t* const next = _next.data();
+    const char* best = nullptr;
+    uint32_t st = 0, blen = 0, bid = 0;
+
+    while (p < e) {
+        if (st == 0) {
+            if (best) break;
+#if defined(STR_SSE2) || defined(STR_NEON)
+            // skip bytes that can not begin a pattern
+            if (_nfirst > 0) {
+                for (; e - p >= 16; p += 16) {
+#if defined(STR_SSE2)
+                    const __m128i a = _mm_loadu_si128((const __m128i*)p);
+                    __m128i m = _mm_cmpeq_epi8(a, _mm_set1_epi8(_first[0]));
+                    for (int i = 1; i < _nfirst; ++i) {
+                        m = _mm_or_si128(m, _mm_cmpeq_epi8(a, _mm_set1_epi8(_first[i])));
+                    }
+                    const uint32_t r = (uint32_t)_mm_movemask_epi8(m);
+                    if (r) {
+                        p += first_bit(r);
+                        break;
+                    }
+#else
+                    const uint8x16_t a = vld1q_u8((const uint8_t*)p);
+                    uint8x16_t m = vceqq_u8(a, vdupq_n_u8((uint8_t)_first[0]));
+                    for (int i = 1; i < _nfirst; ++i) {
+                        m = vorrq_u8(m, vceqq_u8(a, vdupq_n_u8((uint8_t)_first[i])));
+                    }
+                    // 4 bits for each byte
+                    const uint64_t r = vget_lane_u64(
+                        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+                    if (r) {
+                        const uint32_t lo = (uint32_t)r;
+                        p += (lo ? first_bit(lo) : 32 + first_bit((uint32_t)(r >> 32))) >> 2;
+                        break;
+                    }
+#endif
+                }
+            }
+#endif
+            while (p < e && !_start[(uint8_t)*p]) ++p;
+            if (p == e) break;
+        }
+
+        st = next[st * _ncls + _cls[(uint8_t)*p++]];
+        const uint32_t l = _len[st];
+        if (l) {
+            const char* const b = p - l;
+            if (!best || b < best || (b == best && l > blen)) {
+                best = b;
+                blen = l;
+                bid = _id[st];
+            }
+        }
+        if (best && best < p - _depth[st]) break;
+    }
+
+    if (best) {
+        len = blen;
+        id = bid;
+    }
+    return best;
+}
+
 }  // namespace str
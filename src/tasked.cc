@@ -1,8 +1,11 @@
 #include "co/tasked.h"
 
 #include <atomic>
+#include <memory>
 
+#include "co/co.h"
 #include "co/co/thread.h"
+#include "co/stl.h"
 #include "co/time.h"
 #include "co/vector.h"
 
@@ -14,27 +17,31 @@ class TaskedImpl {
     typedef std::function<void()> F;
 
     struct Task {
-        Task(F&& f, int p, int c) : fun(std::move(f)), period(p), count(c) {}
+        Task(F&& f, int64_t p) : fun(std::move(f)), period(p), running(false) {}
         F fun;
-        int period;  // in seconds
-        int count;
+        int64_t period;            // in milliseconds, 0 for tasks run only once
+        std::atomic_bool running;  // a run is going on in a coroutine
     };
 
-    TaskedImpl() : _stop(0), _tasks(32), _new_tasks(32), _ev(), _mtx() {
+    typedef std::shared_ptr<Task> task_t;
+    typedef std::pair<int64_t, task_t> timed_task_t;  // <due time(ms), task>
+
+    explicit TaskedImpl(bool in_co)
+        : _stop(0), _in_co(in_co), _tasks(), _new_tasks(32), _ev(), _mtx() {
         std::thread(&TaskedImpl::loop, this).detach();
     }
 
     ~TaskedImpl() { this->stop(); }
 
-    void run_in(F&& f, int sec) {
-        std::lock_guard<std::mutex> g(_mtx);
-        _new_tasks.emplace_back(std::move(f), 0, sec);
-        if (sec <= 0) _ev.signal();
-    }
-
-    void run_every(F&& f, int sec) {
-        std::lock_guard<std::mutex> g(_mtx);
-        _new_tasks.emplace_back(std::move(f), sec, sec);
+    // run f() @delay ms later, and then every @period ms if @period > 0
+    void add(F&& f, int64_t delay, int64_t period) {
+        if (delay < 0) delay = 0;
+        task_t t = std::make_shared<Task>(std::move(f), period);
+        {
+            std::lock_guard<std::mutex> g(_mtx);
+            _new_tasks.emplace_back(now::ms() + delay, std::move(t));
+        }
+        _ev.signal();
     }
 
     void run_at(F&& f, int hour, int minute, int second, bool daily);
@@ -43,11 +50,13 @@ class TaskedImpl {
 
   private:
     void loop();
+    void run(const task_t& t);
 
   private:
     std::atomic_int _stop;
-    co::vector<Task> _tasks;
-    co::vector<Task> _new_tasks;
+    bool _in_co;
+    co::multimap<int64_t, task_t> _tasks;
+    co::vector<timed_task_t> _new_tasks;
     co::sync_event _ev;
     std::mutex _mtx;
 };
@@ -68,55 +77,60 @@ void TaskedImpl::run_at(F&& f, int hour, int minute, int second, bool daily) {
     if (seconds < now_seconds) seconds += 86400;
     int diff = seconds - now_seconds;
 
-    std::lock_guard<std::mutex> g(_mtx);
-    _new_tasks.emplace_back(std::move(f), (daily ? 86400 : 0), diff);
+    this->add(std::move(f), diff * 1000LL, daily ? 86400 * 1000LL : 0);
+}
+
+// in a coroutine, a periodic task does not run again before the last run is done
+void TaskedImpl::run(const task_t& t) {
+    if (!_in_co) {
+        t->fun();
+        return;
+    }
+    bool running = false;
+    if (!t->running.compare_exchange_strong(running, true)) return;
+    go([t]() {
+        t->fun();
+        t->running.store(false);
+    });
 }
 
 void TaskedImpl::loop() {
-    int64_t ms = 0;
-    int sec = 0;
-    co::Timer timer;
-    co::vector<Task> tmp(32);
+    co::vector<timed_task_t> tmp(32);
 
     while (!_stop.load(std::memory_order_relaxed)) {
-        timer.restart();
         {
             std::lock_guard<std::mutex> g(_mtx);
             if (!_new_tasks.empty()) _new_tasks.swap(tmp);
         }
 
         if (!tmp.empty()) {
-            _tasks.append(std::move(tmp));
+            for (auto& x : tmp) _tasks.emplace(x.first, std::move(x.second));
             tmp.clear();
         }
 
-        if (ms >= 1000) {
-            sec = (int)(ms / 1000);
-            ms -= sec * 1000;
-        }
-
-        for (size_t i = 0; i < _tasks.size();) {
-            auto& t = _tasks[i];
-            if ((t.count -= sec) <= 0) {
-                t.fun();
-                if (t.period > 0) {
-                    t.count = t.period;
-                    ++i;
-                } else {
-                    _tasks.remove(i);
-                }
-            } else {
-                ++i;
+        int64_t t = now::ms();
+        while (!_tasks.empty() && _tasks.begin()->first <= t) {
+            auto it = _tasks.begin();
+            int64_t due = it->first;
+            task_t task = std::move(it->second);
+            _tasks.erase(it);
+
+            this->run(task);
+            t = now::ms();
+            if (task->period > 0) {
+                // fixed rate, skip the runs missed if the task was late
+                due += task->period;
+                if (due <= t) due += ((t - due) / task->period + 1) * task->period;
+                _tasks.emplace(due, std::move(task));
             }
         }
 
-        _ev.wait(1000);
-        // if (_stop.load(std::memory_order_relaxed))
-        //     if (_stop) {
-        //         atomic_store(&_stop, 2);
-        //         return;
-        //     }
-        ms += timer.ms();
+        if (_tasks.empty()) {
+            _ev.wait();
+        } else {
+            const int64_t d = _tasks.begin()->first - now::ms();
+            if (d > 0) _ev.wait((uint32_t)(d < 86400000 ? d : 86400000));
+        }
     }
 
     atomic_store(&_stop, 2);
@@ -138,7 +152,7 @@ void TaskedImpl::stop() {
 
 }  // namespace xx
 
-Tasked::Tasked() { _p = new xx::TaskedImpl(); }
+Tasked::Tasked(bool in_co) { _p = new xx::TaskedImpl(in_co); }
 
 Tasked::~Tasked() {
     if (_p) {
@@ -147,9 +161,22 @@ Tasked::~Tasked() {
     }
 }
 
-void Tasked::run_in(F&& f, int sec) { ((xx::TaskedImpl*)_p)->run_in(std::move(f), sec); }
+void Tasked::run_in(F&& f, int sec) {
+    ((xx::TaskedImpl*)_p)->add(std::move(f), sec * 1000LL, 0);
+}
+
+void Tasked::run_every(F&& f, int sec) {
+    ((xx::TaskedImpl*)_p)->add(std::move(f), sec * 1000LL, sec * 1000LL);
+}
 
-void Tasked::run_every(F&& f, int sec) { ((xx::TaskedImpl*)_p)->run_every(std::move(f), sec); }
+void Tasked::run_in_ms(F&& f, uint32_t ms) {
+    ((xx::TaskedImpl*)_p)->add(std::move(f), ms, 0);
+}
+
+void Tasked::run_every_ms(F&& f, uint32_t ms) {
+    assert(ms > 0);
+    ((xx::TaskedImpl*)_p)->add(std::move(f), ms, ms);
+}
 
 void Tasked::run_at(F&& f, int hour, int minute, int second) {
     ((xx::TaskedImpl*)_p)->run_at(std::move(f), hour, minute, second, false);
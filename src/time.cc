@@ -5,18 +5,67 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include "co/flag.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CO_HAS_TSC
+#endif
+
+DEF_bool(time_tsc, false, ">>#0 read now::ns() from the TSC if it is invariant, x86_64 linux only");
+
 namespace co {
 namespace now {
 namespace xx {
 
 #ifdef CLOCK_MONOTONIC
 
-inline int64_t ns() {
+inline int64_t clock_ns() {
     struct timespec t;
     clock_gettime(CLOCK_MONOTONIC, &t);
     return static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
 }
 
+#ifdef CO_HAS_TSC
+// Convert TSC ticks to ns, the rate is measured against CLOCK_MONOTONIC in a
+// busy loop of about 10 ms. It is not used if the TSC is not invariant, which
+// may stop or change its rate in deep C-states or with frequency scaling.
+struct Tsc {
+    Tsc() : ok(false), tsc0(0), ns0(0), ns_per_tick(0) {
+        unsigned a, b, c, d;
+        if (!__get_cpuid(0x80000007, &a, &b, &c, &d) || !(d & (1u << 8))) return;
+        const int64_t t0 = clock_ns();
+        const uint64_t c0 = __rdtsc();
+        int64_t t1;
+        while ((t1 = clock_ns()) - t0 < 10000000);
+        const uint64_t c1 = __rdtsc();
+        if (c1 <= c0) return;
+        ns_per_tick = (double)(t1 - t0) / (double)(c1 - c0);
+        tsc0 = c1;
+        ns0 = t1;
+        ok = true;
+    }
+
+    int64_t ns() const { return ns0 + (int64_t)((double)(__rdtsc() - tsc0) * ns_per_tick); }
+
+    bool ok;
+    uint64_t tsc0;
+    int64_t ns0;
+    double ns_per_tick;
+};
+
+inline int64_t ns() {
+    if (FLG_time_tsc) {
+        static const Tsc tsc;
+        if (tsc.ok) return tsc.ns();
+    }
+    return clock_ns();
+}
+#else
+inline int64_t ns() { return clock_ns(); }
+#endif
+
 inline int64_t us() {
     struct timespec t;
     clock_gettime(CLOCK_MONOTONIC, &t);
@@ -29,6 +78,16 @@ inline int64_t ms() {
     return static_cast<int64_t>(t.tv_sec) * 1000 + t.tv_nsec / 1000000;
 }
 
+#ifdef CLOCK_MONOTONIC_COARSE
+inline int64_t ms_coarse() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+    return static_cast<int64_t>(t.tv_sec) * 1000 + t.tv_nsec / 1000000;
+}
+#else
+inline int64_t ms_coarse() { return ms(); }
+#endif
+
 #else
 
 // WARNING:
@@ -40,6 +99,8 @@ inline int64_t us() { return epoch::us(); }
 
 inline int64_t ms() { return epoch::ms(); }
 
+inline int64_t ms_coarse() { return epoch::ms(); }
+
 #endif
 
 }  // namespace xx
@@ -50,6 +111,8 @@ int64_t us() { return xx::us(); }
 
 int64_t ms() { return xx::ms(); }
 
+int64_t ms_coarse() { return xx::ms_coarse(); }
+
 fastring str(const char* fm) {
     time_t x = time(0);
     struct tm t;
@@ -76,6 +139,16 @@ int64_t ms() {
     return static_cast<int64_t>(t.tv_sec) * 1000 + t.tv_usec / 1000;
 }
 
+int64_t ms_coarse() {
+#ifdef CLOCK_REALTIME_COARSE
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME_COARSE, &t);
+    return static_cast<int64_t>(t.tv_sec) * 1000 + t.tv_nsec / 1000000;
+#else
+    return epoch::ms();
+#endif
+}
+
 }  // namespace epoch
 }  // namespace co
 
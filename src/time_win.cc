@@ -47,6 +47,8 @@ int64_t us() { return xx::us(); }
 
 int64_t ms() { return xx::ms(); }
 
+int64_t ms_coarse() { return (int64_t)GetTickCount64(); }
+
 fastring str(const char* fm) {
     int64_t x = time(0);
     struct tm t;
@@ -74,6 +76,8 @@ int64_t ms() { return filetime() / 10000; }
 
 int64_t us() { return filetime() / 10; }
 
+int64_t ms_coarse() { return filetime() / 10000; }
+
 }  // namespace epoch
 }  // namespace co
 
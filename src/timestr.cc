@@ -0,0 +1,160 @@
+#include "co/time.h"
+
+#include <string.h>
+#include <time.h>
+
+namespace co {
+namespace timestr {
+namespace {
+
+enum { f_year, f_mon, f_day, f_hour, f_min, f_sec, f_wday, f_num };
+
+struct layout_t {
+    const char* init;   // the string with the constant parts
+    int8_t pos[f_num];  // position of each field, -1 if it is not in the string
+    int8_t ms;          // position of the milliseconds, -1 if not present
+    bool names;         // month and weekday as names, e.g. "Jan", "Sun"
+    bool local;         // local time, or UTC
+};
+
+const layout_t g_iso = {"0000-00-00T00:00:00.000Z", {0, 5, 8, 11, 14, 17, -1}, 20, false, false};
+const layout_t g_http = {"Thu, 01 Jan 1970 00:00:00 GMT", {12, 8, 5, 17, 20, 23, 0}, -1, true, false};
+const layout_t g_log = {"0000 00:00:00.000", {-1, 0, 2, 5, 8, 11, -1}, 14, false, true};
+
+const char g_mon[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+const char g_wday[] = "SunMonTueWedThuFriSat";
+
+inline void put2(char* p, int v) {
+    p[0] = (char)('0' + v / 10);
+    p[1] = (char)('0' + v % 10);
+}
+
+// days since 1970-01-01 to the civil date, see
+// http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+inline void civil_from_days(int64_t z, int* f) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    f[f_year] = (int)(yoe + era * 400 + (m <= 2));
+    f[f_mon] = (int)m;
+    f[f_day] = (int)(doy - (153 * mp + 2) / 5 + 1);
+}
+
+class cache_t {
+  public:
+    explicit cache_t(const layout_t& l) : _l(l), _base(0), _end(0) {
+        strcpy(_buf, l.init);
+        for (int i = 0; i < f_num; ++i) _f[i] = _tm[i] = -1;
+    }
+
+    const char* format(int64_t ms);
+
+  private:
+    void set_minute(int64_t sec);
+    void put(int i, int v);
+
+    const layout_t& _l;
+    int64_t _base;   // the first second of the minute in _tm
+    int64_t _end;    // _base + 60, or 0 if _tm is not set
+    int _tm[f_num];  // fields of the minute, the second is set by format()
+    int _f[f_num];   // fields written to _buf
+    char _buf[32];
+};
+
+// fields of the minute of @sec
+void cache_t::set_minute(int64_t sec) {
+    if (_l.local) {
+        const time_t t = (time_t)sec;
+        struct tm x;
+#ifdef _WIN32
+        _localtime64_s(&x, &t);
+#else
+        localtime_r(&t, &x);
+#endif
+        _tm[f_year] = x.tm_year + 1900;
+        _tm[f_mon] = x.tm_mon + 1;
+        _tm[f_day] = x.tm_mday;
+        _tm[f_hour] = x.tm_hour;
+        _tm[f_min] = x.tm_min;
+        _tm[f_wday] = x.tm_wday;
+        _base = sec - x.tm_sec;
+    } else {
+        int64_t days = sec / 86400;
+        int64_t s = sec % 86400;
+        if (s < 0) s += 86400, --days;
+        civil_from_days(days, _tm);
+        _tm[f_hour] = (int)(s / 3600);
+        _tm[f_min] = (int)(s / 60 % 60);
+        const int64_t w = (days + 4) % 7;  // 1970-01-01 is Thursday
+        _tm[f_wday] = (int)(w < 0 ? w + 7 : w);
+        _base = sec - s % 60;
+    }
+    _end = _base + 60;
+}
+
+void cache_t::put(int i, int v) {
+    char* const p = _buf + _l.pos[i];
+    switch (i) {
+        case f_year:
+            put2(p, v / 100 % 100);
+            put2(p + 2, v % 100);
+            break;
+        case f_mon:
+            if (_l.names) {
+                memcpy(p, g_mon + (v - 1) * 3, 3);
+            } else {
+                put2(p, v);
+            }
+            break;
+        case f_wday:
+            memcpy(p, g_wday + v * 3, 3);
+            break;
+        default:
+            put2(p, v);
+    }
+}
+
+const char* cache_t::format(int64_t ms) {
+    int64_t sec = ms / 1000;
+    int r = (int)(ms % 1000);
+    if (r < 0) r += 1000, --sec;
+    if (sec < _base || sec >= _end) this->set_minute(sec);
+    _tm[f_sec] = (int)(sec - _base);
+
+    for (int i = 0; i < f_num; ++i) {
+        if (_l.pos[i] >= 0 && _f[i] != _tm[i]) {
+            this->put(i, _tm[i]);
+            _f[i] = _tm[i];
+        }
+    }
+    if (_l.ms >= 0) {
+        char* const p = _buf + _l.ms;
+        p[0] = (char)('0' + r / 100);
+        put2(p + 1, r % 100);
+    }
+    return _buf;
+}
+
+}  // namespace
+
+const char* iso8601(int64_t ms) {
+    static thread_local cache_t c(g_iso);
+    return c.format(ms);
+}
+
+const char* http_date(int64_t ms) {
+    static thread_local cache_t c(g_http);
+    return c.format(ms);
+}
+
+const char* logtime(int64_t ms) {
+    static thread_local cache_t c(g_log);
+    return c.format(ms);
+}
+
+}  // namespace timestr
+}  // namespace co
@@ -1,7 +1,19 @@
 #include "co/unitest.h"
 
+#include <algorithm>
+
 #include "co/time.h"
 
+#ifndef _WIN32
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+DEF_int32(ut_jobs, 1, ">>.run tests in N processes in parallel, not supported on windows", j);
+DEF_uint32(ut_slow_ms, 1000, ">>.report tests that take longer than this (in ms)");
+
 namespace unitest {
 namespace xx {
 
@@ -17,44 +29,189 @@ bool add_test(const char* name, bool& e, void (*f)(Test&)) {
 
 }  // namespace xx
 
+namespace {
+
+struct timed_t {
+    xx::Test* t;
+    int64_t us;  // time used by the test
+};
+
+void run_serial(std::vector<timed_t>& v) {
+    co::Timer timer;
+    for (auto& x : v) {
+        std::cout << "> begin test: " << x.t->name << std::endl;
+        timer.restart();
+        x.t->f(*x.t);
+        x.us = timer.us();
+        std::cout << "< test " << x.t->name << " done in " << x.us << " us" << std::endl;
+    }
+}
+
+#ifndef _WIN32
+// A test running in a child process. Output of the child goes to @out, and
+// failures are written to @res at the end:
+//   [case][file][line][msg len][msg] ...
+// The case and file names are string literals, their addresses are the same in
+// the parent, as the child is forked from it.
+struct child_t {
+    timed_t* x;
+    pid_t pid;
+    FILE* out;
+    FILE* res;
+    int64_t beg;
+};
+
+void run_child(child_t& c) {
+    ::dup2(fileno(c.out), 1);
+    ::dup2(fileno(c.out), 2);
+
+    // The fatal signal handler of co/log waits for the logging thread, which
+    // does not exist in the child. Let the parent see how the child died.
+    const int sigs[] = {SIGSEGV, SIGABRT, SIGFPE, SIGBUS, SIGILL};
+    for (int sig : sigs) ::signal(sig, SIG_DFL);
+
+    xx::Test& t = *c.x->t;
+    std::cout << "> begin test: " << t.name << std::endl;
+    co::Timer timer;
+    t.f(t);
+    const int64_t us = timer.us();
+    std::cout << "< test " << t.name << " done in " << us << " us" << std::endl;
+
+    for (auto& f : t.failed) {
+        const size_t n = f.msg.size();
+        fwrite(&f.c, sizeof(f.c), 1, c.res);
+        fwrite(&f.file, sizeof(f.file), 1, c.res);
+        fwrite(&f.line, sizeof(f.line), 1, c.res);
+        fwrite(&n, sizeof(n), 1, c.res);
+        fwrite(f.msg.data(), 1, n, c.res);
+    }
+    fflush(c.res);
+    fflush(stdout);
+    ::_exit(0);
+}
+
+// print output of the child, and collect failures of the test
+void reap_child(child_t& c, int status) {
+    xx::Test& t = *c.x->t;
+    c.x->us = co::now::us() - c.beg;
+
+    char buf[4096];
+    size_t r;
+    rewind(c.out);
+    while ((r = fread(buf, 1, sizeof(buf), c.out)) > 0) std::cout.write(buf, r);
+    std::cout.flush();
+
+    rewind(c.res);
+    const char* cs;
+    const char* file;
+    int line;
+    size_t n;
+    while (fread(&cs, sizeof(cs), 1, c.res) == 1 && fread(&file, sizeof(file), 1, c.res) == 1 &&
+           fread(&line, sizeof(line), 1, c.res) == 1 && fread(&n, sizeof(n), 1, c.res) == 1) {
+        fastring msg(n + 1);
+        msg.resize(n);
+        if (fread((void*)msg.data(), 1, n, c.res) != n) break;
+        t.failed.push_back(xx::Failed(cs, file, line, std::move(msg)));
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fastring msg(64);
+        if (WIFSIGNALED(status)) {
+            msg << "test crashed by signal " << WTERMSIG(status);
+        } else {
+            msg << "test exited with status " << WEXITSTATUS(status);
+        }
+        std::cout << co::Color::red << "< test " << t.name << ": " << msg << co::Color::deflt
+                  << std::endl;
+        t.failed.push_back(xx::Failed(t.c, "", 0, std::move(msg)));
+    }
+
+    fclose(c.out);
+    fclose(c.res);
+}
+
+// run each test in a child process, with at most @jobs of them at a time
+void run_parallel(std::vector<timed_t>& v, int jobs) {
+    std::vector<child_t> running;
+    size_t next = 0;
+    std::cout.flush();
+    fflush(stdout);
+
+    while (next < v.size() || !running.empty()) {
+        while (next < v.size() && (int)running.size() < jobs) {
+            child_t c = {&v[next++], 0, tmpfile(), tmpfile(), co::now::us()};
+            if (!c.out || !c.res) {
+                std::cout << "tmpfile() failed, try again without -j" << std::endl;
+                ::exit(1);
+            }
+            c.pid = ::fork();
+            if (c.pid == 0) run_child(c);
+            if (c.pid < 0) {
+                std::cout << "fork() failed, try again without -j" << std::endl;
+                ::exit(1);
+            }
+            running.push_back(c);
+        }
+
+        int status = 0;
+        const pid_t pid = ::waitpid(-1, &status, 0);
+        if (pid < 0) continue;
+        for (size_t i = 0; i < running.size(); ++i) {
+            if (running[i].pid == pid) {
+                reap_child(running[i], status);
+                running.erase(running.begin() + i);
+                break;
+            }
+        }
+    }
+}
+#endif
+
+}  // namespace
+
 int run_tests() {
     // n: number of tests to do
     // ft: number of failed tests
     // fc: number of failed cases
     int n = 0, ft = 0, fc = 0;
-    co::Timer timer;
     auto& tests = xx::tests();
 
-    std::vector<xx::Test*> enabled;
-    enabled.reserve(32);
+    std::vector<timed_t> v;
+    v.reserve(32);
     for (auto& t : tests)
-        if (t.enabled) enabled.push_back(&t);
+        if (t.enabled) v.push_back({&t, 0});
 
-    if (enabled.empty()) { /* run all tests by default */
-        n = tests.size();
-        for (auto& t : tests) {
-            std::cout << "> begin test: " << t.name << std::endl;
-            timer.restart();
-            t.f(t);
-            if (!t.failed.empty()) {
-                ++ft;
-                fc += t.failed.size();
-            }
-            std::cout << "< test " << t.name << " done in " << timer.us() << " us" << std::endl;
-        }
+    if (v.empty()) { /* run all tests by default */
+        for (auto& t : tests) v.push_back({&t, 0});
+    }
+    n = (int)v.size();
 
+#ifndef _WIN32
+    if (FLG_ut_jobs > 1 && n > 1) {
+        run_parallel(v, FLG_ut_jobs);
     } else {
-        n = enabled.size();
-        for (auto& t : enabled) {
-            std::cout << "> begin test: " << t->name << std::endl;
-            timer.restart();
-            t->f(*t);
-            if (!t->failed.empty()) {
-                ++ft;
-                fc += t->failed.size();
-            }
-            std::cout << "< test " << t->name << " done in " << timer.us() << " us" << std::endl;
+        run_serial(v);
+    }
+#else
+    run_serial(v);
+#endif
+
+    for (auto& x : v) {
+        if (!x.t->failed.empty()) {
+            ++ft;
+            fc += x.t->failed.size();
+        }
+    }
+
+    std::sort(v.begin(), v.end(), [](const timed_t& a, const timed_t& b) { return a.us > b.us; });
+    if (!v.empty() && v[0].us >= FLG_ut_slow_ms * 1000LL) {
+        std::cout << co::Color::yellow << "\nslow tests (>= " << FLG_ut_slow_ms << " ms):\n"
+                  << co::Color::deflt;
+        for (auto& x : v) {
+            if (x.us < FLG_ut_slow_ms * 1000LL) break;
+            std::cout << "  " << x.t->name << ": " << (x.us / 1000) << " ms\n";
         }
+        std::cout.flush();
     }
 
     if (fc == 0) {
@@ -8,10 +8,15 @@ target("libco")
     add_files("**.cc")
     add_options("with_openssl")
     add_options("with_libcurl")
+    add_options("with_zlib")
     add_options("cache_line_size")
+    add_options("log_min_level")
     add_options("disable_hook")
+    add_options("ctx_save_fpu")
+    add_options("with_sys_malloc")
     if is_plat("linux", "macosx") then
         add_options("with_backtrace")
+        add_options("with_usdt")
     end
     if not is_plat("windows") then
         add_options("fpic")
@@ -27,10 +32,27 @@ target("libco")
         add_packages("openssl")
     end
 
+    if has_config("with_zlib") then
+        add_defines("HAS_ZLIB")
+        add_packages("zlib")
+    end
+
+    if has_config("with_usdt") and is_plat("linux") then
+        add_defines("HAS_USDT")
+    end
+
+    if has_config("with_sys_malloc") then
+        add_defines("CO_SYS_MALLOC")
+    end
+
     if has_config("disable_hook") then
         add_defines("_CO_DISABLE_HOOK")
     end
 
+    if has_config("ctx_save_fpu") then
+        add_defines("CO_CTX_SAVE_FPU")
+    end
+
     if is_kind("shared") then
         set_symbols("debug", "hidden")
         add_defines("BUILDING_CO_SHARED")
@@ -39,11 +61,13 @@ target("libco")
         set_configvar("COOST_SHARED", 0)
     end
     set_configvar("CACHE_LINE_SIZE", "$(cache_line_size)")
+    set_configvar("LOG_MIN_LEVEL", "$(log_min_level)")
     add_configfiles("../include/co/config.h.in", {filename = "../include/co/config.h"})
 
     if is_plat("windows", "mingw") then
         add_defines("WIN32_LEAN_AND_MEAN")
         add_defines("_WINSOCK_DEPRECATED_NO_WARNINGS")
+        add_syslinks("synchronization", { public = true }) -- WaitOnAddress
         add_files("log/StackWalker.cpp")
         add_files("co/detours/creatwth.cpp")
         add_files("co/detours/detours.cpp")
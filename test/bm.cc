@@ -66,8 +66,43 @@ BM_group(malloc_free) {
     // );
 }
 
+BM_group(dtoa) {
+    char buf[32];
+    int n;
+    double v = 3.25, r = 0.1 + 0.2;
+
+    BM_add(milo::dtoa short)(n = milo::dtoa(v, buf););
+    BM_use(n);
+
+    BM_add(fast::dtoa short)(n = fast::dtoa(v, buf););
+    BM_use(n);
+
+    BM_add(milo::dtoa)(n = milo::dtoa(r, buf););
+    BM_use(n);
+
+    BM_add(fast::dtoa)(n = fast::dtoa(r, buf););
+    BM_use(n);
+}
+
+// fastring is relocated by realloc, std::string is moved one by one
+BM_group(vector_grow) {
+    BM_add(co::vector<fastring>)(
+        co::vector<fastring> v;
+        for (int i = 0; i < 1024; ++i) v.emplace_back(16, 'x');
+    );
+
+    BM_add(co::vector<std::string>)(
+        co::vector<std::string> v;
+        for (int i = 0; i < 1024; ++i) v.emplace_back(16, 'x');
+    );
+
+    BM_add(std::vector<fastring>)(
+        std::vector<fastring> v;
+        for (int i = 0; i < 1024; ++i) v.emplace_back(16, 'x');
+    );
+}
+
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
-    bm::run_benchmarks();
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
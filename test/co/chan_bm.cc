@@ -8,11 +8,14 @@ co::chan<int> ch00(0);
 co::chan<int> ch(100000);
 co::chan1<int> ch1(100000);
 co::chan1<int> ch10;
+co::chan_mpmc<int> chm(131072);
+co::chan_mpmc<int> chm0(2);
 BM_group(write) {
     BM_add1w(ch)(ch << 777;);
     BM_add1w(ch1)(ch1 << 777;);
     // BM_add(ch00)(ch00 << 777;);
-    BM_add(ch10)(ch10 << 777;);
+    BM_add1w(ch10)(ch10 << 777;);
+    BM_add1w(chm)(chm << 777;);
 }
 BM_group(read) {
     int v;
@@ -20,7 +23,8 @@ BM_group(read) {
     BM_add1w(ch)(ch >> v; assert(v == 777));
     BM_add1w(ch1)(ch1 >> v; assert(v == 777));
     // BM_add(ch00)(ch00 >> v; assert(v == 777));
-    BM_add(ch10)(ch10 >> v; assert(v == 777));
+    BM_add1w(ch10)(ch10 >> v; assert(v == 777));
+    BM_add1w(chm)(chm >> v; assert(v == 777));
 }
 template <class CHAN>
 void test_chan(CHAN& ch, co::wait_group& wg) {
@@ -58,11 +62,50 @@ BM_group(co) {
 
     BM_add(ch00)(test_chan(ch00, wg); wg.wait());
     BM_add(ch10)(test_chan(ch10, wg); wg.wait());
+    BM_add(chm0)(test_chan(chm0, wg); wg.wait());
+}
+
+// many producers and consumers on all the schedulers
+template <class CHAN>
+void test_mpmc(CHAN& ch, co::wait_group& wg) {
+    const int n = 4, m = 25000;
+    wg.add(n * 2);
+    for (int i = 0; i < n; ++i) {
+        co::next_sched()->go([&ch, &wg] {
+            for (int k = 0; k < m; ++k) ch << k;
+            wg.done();
+        });
+        co::next_sched()->go([&ch, &wg] {
+            int v;
+            for (int k = 0; k < m; ++k) ch >> v;
+            wg.done();
+        });
+    }
+}
+co::chan<int> chx(1024);
+co::chan_mpmc<int> chmx(1024);
+BM_group(mpmc) {
+    co::wait_group wg;
+
+    BM_add(chan)(test_mpmc(chx, wg); wg.wait());
+    BM_add(chan_mpmc)(test_mpmc(chmx, wg); wg.wait());
+}
+
+// throughput and latency with many threads or coroutines at the same time
+co::chan_mpmc<int> chp(1024);
+co::mutex mtx;
+BM_group(concurrent) {
+    int x = 0, v;
+
+    BM_add_co(chan_mpmc, 16)(chp << 1; chp >> v;);
+    BM_add_co(co::mutex, 16)(co::mutex_guard g(mtx); ++x;);
+    BM_add_parallel(co::mutex, 4)(co::mutex_guard g(mtx); ++x;);
+    BM_add_parallel(go, 4)(go([]() {}););
+    BM_use(x);
 }
 
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
 
-    bm::run_benchmarks();
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
@@ -0,0 +1,58 @@
+#include <atomic>
+#include <thread>
+
+#include "co/co.h"
+#include "co/print.h"
+#include "co/time.h"
+
+DEF_uint32(t, 4, "number of producer threads");
+DEF_uint32(n, 200000, "number of coroutines created by each thread");
+DEF_uint32(b, 0, "create coroutines with go_batch() in batches of b if b > 0");
+DEF_bool(c, false, "create coroutines in coroutines instead of threads");
+
+// Compare go() throughput of the lock-free task queue with the mutex version:
+//   ./go_bm -co_lockfree_queue=true
+//   ./go_bm -co_lockfree_queue=false
+//   ./go_bm -b 10000
+//   ./go_bm -c
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+
+    const uint32_t t = FLG_t;
+    const uint32_t n = FLG_n;
+    co::wait_group wg(t * n);
+    std::atomic_bool start{false};
+
+    std::vector<std::thread> v;
+    auto produce = [&]() {
+        while (!start.load()) FLG_c ? co::sleep(1) : std::this_thread::yield();
+        if (FLG_b == 0) {
+            for (uint32_t k = 0; k < n; ++k) go([wg]() { wg.done(); });
+            return;
+        }
+        co::vector<co::Closure*> cbs(FLG_b);
+        for (uint32_t k = 0; k < n; k += FLG_b) {
+            const uint32_t m = n - k < FLG_b ? n - k : FLG_b;
+            for (uint32_t j = 0; j < m; ++j) cbs.push_back(co::new_closure([wg]() { wg.done(); }));
+            co::go_batch(cbs);
+            cbs.clear();
+        }
+    };
+    for (uint32_t i = 0; i < t; ++i) {
+        if (FLG_c) {
+            go(produce);
+        } else {
+            v.emplace_back(produce);
+        }
+    }
+
+    co::Timer timer;
+    start.store(true);
+    wg.wait();
+    const int64_t us = timer.us();
+
+    for (auto& x : v) x.join();
+    co::print("threads: ", t, ", coroutines: ", t * n, ", time: ", us, " us, ",
+              (t * n) * 1000.0 / (us > 0 ? us : 1), " go/ms");
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "co/co.h"
+#include "co/print.h"
+#include "co/time.h"
+
+DEC_bool(co_huge_pages);
+
+DEF_uint32(n, 100000, "number of coroutines");
+DEF_uint32(r, 20, "rounds each coroutine sleeps and wakes up");
+
+// Coroutines take turns to run, touching their Coroutine structs, the shared
+// stacks and the buffers saving the stacks. Compare the time and TLB misses
+// with and without huge pages (perf counters of bm count the main thread only):
+//   perf stat -e dTLB-load-misses,dTLB-store-misses ./huge_bm
+//   perf stat -e dTLB-load-misses,dTLB-store-misses ./huge_bm -co_huge_pages
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+
+    const uint32_t n = FLG_n;
+    const uint32_t r = FLG_r;
+    co::wait_group wg(n);
+
+    co::Timer timer;
+    for (uint32_t i = 0; i < n; ++i) {
+        go([wg, r]() {
+            char buf[1024];
+            volatile char* const p = buf;
+            for (uint32_t k = 0; k < r; ++k) {
+                for (int j = 0; j < 1024; j += 64) p[j] = (char)k;
+                co::sleep(0);
+            }
+            wg.done();
+        });
+    }
+    wg.wait();
+    const int64_t us = timer.us();
+
+    co::print("huge pages: ", FLG_co_huge_pages ? "on" : "off", ", coroutines: ", n,
+              ", switches: ", (uint64_t)n * (r + 1), ", time: ", us, " us, ",
+              (uint64_t)n * (r + 1) * 1000.0 / (us > 0 ? us : 1), " switches/ms");
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <math.h>
+
+#include "co/co.h"
+#include "co/print.h"
+#include "co/time.h"
+
+DEF_uint32(n, 10000, "number of candidates to score");
+DEF_uint32(w, 2000, "work of scoring a candidate");
+DEF_uint32(g, 64, "number of candidates in a chunk");
+DEF_bool(c, false, "call parallel_reduce() in a coroutine instead of the main thread");
+
+// a CPU-bound score of the candidate @i
+static double score(size_t i) {
+    double x = (double)i;
+    for (uint32_t k = 0; k < FLG_w; ++k) x = sin(x) + (double)k * 1e-9;
+    return x;
+}
+
+// Compare scoring candidates across the schedulers with a serial loop:
+//   ./parallel_bm -n 10000 -w 2000 -g 64
+//   ./parallel_bm -c
+//   ./parallel_bm -co_sched_num 4
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    const size_t n = FLG_n;
+    auto add = [](double a, double b) { return a + b; };
+
+    co::Timer timer;
+    double s0 = 0;
+    for (size_t i = 0; i < n; ++i) s0 += score(i);
+    const int64_t t0 = timer.us();
+
+    double s1 = 0;
+    int64_t t1 = 0;
+    timer.restart();
+    if (FLG_c) {
+        co::wait_group wg(1);
+        go([&s1, &t1, n, add, wg]() {
+            co::Timer t;
+            const double s = co::parallel_reduce(0, n, FLG_g, 0.0, score, add);
+            t1 = t.us();
+            s1 = s;
+            wg.done();
+        });
+        wg.wait();
+    } else {
+        s1 = co::parallel_reduce(0, n, FLG_g, 0.0, score, add);
+        t1 = timer.us();
+    }
+
+    co::print("schedulers: ", co::sched_num(), ", candidates: ", n, ", grain: ", FLG_g);
+    co::print("serial:   ", t0, " us, sum: ", s0);
+    co::print("parallel: ", t1, " us, sum: ", s1, ", speedup: ", (double)t0 / (t1 > 0 ? t1 : 1));
+    return 0;
+}
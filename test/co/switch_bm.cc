@@ -0,0 +1,45 @@
+#include "co/benchmark.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "../../src/co/context/context.h"
+
+// Cost of a context switch, each iteration is a round trip:
+//   - tb_context_jump: jump to a context and back, two raw switches.
+//   - co::yield: a coroutine yields and is resumed by the scheduler, that is
+//     Sched::yield() and Sched::resume(), with two raw switches.
+// Build with -DCTX_SAVE_FPU=ON to compare with the switch that also saves the
+// MXCSR and x87 control words:
+//   ./switch_bm -bm_out=trimmed.json
+//   ./switch_bm -bm_baseline=trimmed.json
+static void bounce(tb_context_from_t from) {
+    for (;;) from = tb_context_jump(from.ctx, 0);
+}
+
+BM_group(switch) {
+    const size_t n = 64 * 1024;
+    char* stack = (char*)::malloc(n);
+    tb_context_t ctx = tb_context_make(stack, n, bounce);
+
+    BM_add(tb_context_jump)(ctx = tb_context_jump(ctx, 0).ctx;);
+    BM_use(ctx);
+    ::free(stack);
+
+    _g_.bm = "co::yield";
+    bm::xx::run(_g_, [](int64_t n) {
+        co::wait_group wg(1);
+        go([n, wg]() {
+            void* co = co::coroutine();
+            for (int64_t i = 0; i < n; ++i) {
+                co::resume(co);
+                co::yield();
+            }
+            wg.done();
+        });
+        wg.wait();
+    });
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    return bm::run_benchmarks() > 0 ? 1 : 0;
+}
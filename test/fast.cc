@@ -6,7 +6,9 @@
 
 #include "co/benchmark.h"
 #include "co/color.h"
+#include "co/fastream.h"
 #include "co/flag.h"
+#include "co/rand.h"
 #include "co/time.h"
 
 DEF_uint64(beg, 1000, "beg");
@@ -34,6 +36,23 @@ BM_group(uint64_to_string) {
     // BM_use(buf);
 }
 
+// integers of 1 to 20 digits, written to one stream separated by commas
+BM_group(uint64_array_to_string) {
+    static uint64_t v[1024];
+    for (size_t i = 0; i < 1024; ++i) v[i] = co::rand64() >> (co::rand() & 63);
+    fastream s(32 * 1024);
+
+    BM_add(per_call)({
+        s.clear();
+        for (size_t i = 0; i < 1024; ++i) s << v[i] << ',';
+    }) BM_use(s);
+
+    BM_add(format_ints)({
+        s.clear();
+        fast::format_ints(v, 1024, ',', s);
+    }) BM_use(s);
+}
+
 BM_group(uint64_to_hex) {
     BM_add(snprintf)(for (uint64_t i = FLG_beg; i < FLG_end;
                           i++) { snprintf(buf, 32, "0x%" PRIx64, i); }) BM_use(buf);
@@ -61,6 +80,5 @@ BM_group(double_to_string) {
 
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
-    bm::run_benchmarks();
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
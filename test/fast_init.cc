@@ -72,6 +72,5 @@ int main(int argc, char** argv) {
     fprintf(f, "};\n");
     fflush(f);
     fclose(f);
-    bm::run_benchmarks();
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
\ No newline at end of file
@@ -55,8 +55,19 @@ int main(int argc, char** argv) {
         ELOG << "This is ELOG (error).. " << 23;
         // FLOG << "This is FLOG (fatal).. " << 23;
         LOG << "hello " << nested_log() << "  " << nested_log();
+        for (int i = 0; i < 8; ++i) {
+            LOG_FIRST_N(2) << "first 2 of 8: " << i;
+            LOG_EVERY_N(4) << "every 4 of 8: " << i;
+            WLOG_EVERY_MS(1000) << "at most once a second: " << i;
+        }
         TOPIC_LOG("co") << "hello co";
         TOPIC_LOG("bob") << "hello bob";
+
+        static auto topic = log::register_topic("co");
+        TOPIC_LOG(topic) << "hello co, from a registered topic";
+
+        // binary logs, decoded by the blog tool
+        BLOG("This is BLOG (info).. {} {}", 23, "hello");
     }
     std::vector<std::shared_ptr<std::thread>> threads;
     for (int i = 0; i < os::cpunum(); ++i) {
@@ -0,0 +1,50 @@
+#include "co/all.h"
+
+DEF_string(s, "http://127.0.0.1:80", "server url");
+DEF_string(url, "/", "url of http request");
+DEF_int32(c, 8, "number of coroutines");
+DEF_int32(n, 1000, "requests per coroutine");
+
+co::wait_group wg;
+
+void fa() {
+    http::Agent a(FLG_s.c_str());
+    int r = a.get(FLG_url.c_str());
+    LOG << "response code: " << r;
+    LOG_IF(r == 0) << "error: " << a.strerror();
+    LOG << "body size: " << a.body().size();
+    LOG << "Content-Length: " << a.header("Content-Length");
+    LOG << "Content-Type: " << a.header("Content-Type");
+    LOG << a.header();
+    wg.done();
+}
+
+// connections are shared by agents on the same scheduler through the pool
+void fb(int64_t* ok) {
+    http::Agent a(FLG_s.c_str());
+    for (int i = 0; i < FLG_n; ++i) {
+        if (a.get(FLG_url.c_str()) == 200) ++*ok;
+    }
+    wg.done();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    FLG_log_console = true;
+
+    wg.add();
+    go(fa);
+    wg.wait();
+
+    co::vector<int64_t> ok(FLG_c, 0);
+    int64_t t = now::ms();
+    wg.add(FLG_c);
+    for (int i = 0; i < FLG_c; ++i) go(fb, &ok[i]);
+    wg.wait();
+    t = now::ms() - t;
+
+    int64_t n = 0;
+    for (auto& x : ok) n += x;
+    LOG << n << " requests done in " << t << " ms";
+    return 0;
+}
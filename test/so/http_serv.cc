@@ -23,10 +23,12 @@ DEF_string(ip, "0.0.0.0", "http server ip");
 DEF_int32(port, 80, "http server port");
 DEF_string(key, "", "private key file");
 DEF_string(ca, "", "certificate file");
+DEC_uint32(http_stream_body_size);
 
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
     FLG_log_console = true;
+    FLG_http_stream_body_size = 1 << 20;
 
     if (!FLG_key.empty() && !FLG_ca.empty()) {
         if (FLG_port == 80) FLG_port = 443;
@@ -47,6 +49,14 @@ int main(int argc, char** argv) {
                     res.set_status(200);
                     res.add_header("hello", "xxxxx");
                     res.set_body("hello post", 10);
+                } else if (req.url() == "/upload" && req.is_body_streamed()) {
+                    // bodies larger than FLG_http_stream_body_size are read in pieces
+                    char buf[4096];
+                    int64_t n = 0;
+                    int r;
+                    while ((r = req.read_body(buf, sizeof(buf))) > 0) n += r;
+                    res.set_status(r == 0 ? 200 : 400);
+                    res.set_body(fastring("received ") << n << " bytes");
                 } else {
                     res.set_status(403);
                 }
@@ -0,0 +1,180 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "co/all.h"
+
+// End-to-end benchmark of tcp, http and rpc. The servers are started in this
+// process, and driven by @c client coroutines, each with its own connection.
+//   - QPS, latency percentiles and cpu time per request are reported for each
+//     protocol. The cpu time is that of the whole process, server and client.
+//
+//   net_bm                          # all protocols, 64 clients, 5 seconds
+//   net_bm -mode http -c 256 -t 10  # http only, 256 clients, 10 seconds
+DEF_string(mode, "all", "tcp, http, rpc or all");
+DEF_string(ip, "127.0.0.1", "server ip");
+DEF_int32(port, 9966, "base port, tcp: port, http: port + 1, rpc: port + 2");
+DEF_int32(c, 64, "number of client coroutines (concurrency)");
+DEF_int32(t, 5, "test time in seconds for each protocol");
+DEF_int32(l, 64, "message length");
+
+class BenchService : public rpc::Service {
+  public:
+    BenchService() {
+        _methods["Bench.echo"] = [](json::Json& req, json::Json& res) {
+            res.add_member("result", req.get("params"));
+        };
+    }
+
+    virtual ~BenchService() = default;
+
+    virtual const char* name() const { return "Bench"; }
+
+    virtual const co::map<const char*, Fun>& methods() const { return _methods; }
+
+  private:
+    co::map<const char*, Fun> _methods;
+};
+
+void on_tcp_connection(tcp::Connection conn) {
+    fastring buf(FLG_l, '\0');
+    while (true) {
+        int r = conn.recvn(&buf[0], FLG_l);
+        if (r <= 0 || conn.send(buf.data(), FLG_l) <= 0) break;
+    }
+    conn.close();
+}
+
+void start_servers() {
+    static fastring body(FLG_l, 'x');
+    if (FLG_mode == "all" || FLG_mode == "tcp") {
+        tcp::Server().on_connection(on_tcp_connection).start(FLG_ip.c_str(), FLG_port);
+    }
+    if (FLG_mode == "all" || FLG_mode == "http") {
+        http::Server().on_req([](const http::Req&, http::Res& res) {
+            res.set_status(200);
+            res.set_body(body);
+        }).start(FLG_ip.c_str(), FLG_port + 1);
+    }
+    if (FLG_mode == "all" || FLG_mode == "rpc") {
+        rpc::Server().add_service(new BenchService).start(FLG_ip.c_str(), FLG_port + 2, "/");
+    }
+    co::sleep(100);
+}
+
+std::atomic_bool g_stop{false};
+co::vector<int32_t>* g_lat;  // latency (us) of requests, one vector per client
+std::atomic_int g_err{0};
+
+// send requests with @req() until stopped, @req() returns false on error
+template <typename F>
+void run_client(int i, F&& req) {
+    auto& v = g_lat[i];
+    while (!g_stop.load(std::memory_order_relaxed)) {
+        const int64_t t = co::now::us();
+        if (!req()) {
+            g_err.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        v.push_back((int32_t)(co::now::us() - t));
+    }
+}
+
+void tcp_client(int i) {
+    tcp::Client c(FLG_ip.c_str(), FLG_port);
+    if (!c.connect(3000)) {
+        g_err.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    fastring buf(FLG_l, 'x');
+    run_client(i, [&]() {
+        return c.send(buf.data(), FLG_l) == FLG_l && c.recvn(&buf[0], FLG_l) == FLG_l;
+    });
+    c.close();
+}
+
+void http_client(int i) {
+    http::Agent a(str::cat("http://", FLG_ip, ':', FLG_port + 1).c_str());
+    run_client(i, [&]() { return a.get("/") == 200; });
+}
+
+void rpc_client(int i) {
+    // a client may be referred to by other coroutines, do not put it on the stack
+    std::unique_ptr<rpc::Client> c(new rpc::Client(FLG_ip.c_str(), FLG_port + 2));
+    const fastring s(FLG_l, 'x');
+    run_client(i, [&]() {
+        json::Json req, res;
+        req.add_member("api", "Bench.echo").add_member("params", s);
+        c->call(req, res);
+        return res.has_member("result");
+    });
+    c->close();
+}
+
+int64_t cputime_us() {
+    struct rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    return (int64_t)(u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1000000 +
+           u.ru_utime.tv_usec + u.ru_stime.tv_usec;
+}
+
+void bench(const char* name, void (*client)(int)) {
+    g_stop.store(false);
+    g_err.store(0);
+    for (int i = 0; i < FLG_c; ++i) g_lat[i].clear();
+
+    co::wait_group wg(FLG_c);
+    const int64_t c0 = cputime_us();
+    const int64_t t0 = co::now::us();
+    for (int i = 0; i < FLG_c; ++i) {
+        go([wg, client, i]() {
+            client(i);
+            wg.done();
+        });
+    }
+    co::sleep(FLG_t * 1000);
+    g_stop.store(true);
+    wg.wait();
+    const int64_t t = co::now::us() - t0;
+    const int64_t c = cputime_us() - c0;
+
+    co::vector<int32_t> v;
+    for (int i = 0; i < FLG_c; ++i) v.append(g_lat[i].data(), g_lat[i].size());
+    if (v.empty()) {
+        co::print(name, ": no response, errors: ", g_err.load());
+        return;
+    }
+    std::sort(v.data(), v.data() + v.size());
+    auto pct = [&v](double p) { return v[(size_t)(p * (v.size() - 1))]; };
+
+    fastream s(256);
+    s << name << ": qps " << (int64_t)(v.size() * 1e6 / t)
+      << ", p50 " << pct(0.5) << "us, p99 " << pct(0.99) << "us, p999 " << pct(0.999)
+      << "us, max " << v.back() << "us, cpu/req " << ((double)c * 1000 / v.size()) << "ns";
+    if (g_err.load() > 0) s << ", errors " << g_err.load();
+    co::print(s);
+}
+
+int main(int argc, char** argv) {
+    FLG_help << "usage: \n"
+             << "\tnet_bm                          # all protocols, 64 clients, 5 seconds\n"
+             << "\tnet_bm -mode http -c 256 -t 10  # http only, 256 clients, 10 seconds\n";
+    flag::parse(argc, argv);
+
+    co::wait_group wg(1);
+    go([wg]() {
+        start_servers();
+        wg.done();
+    });
+    wg.wait();
+
+    g_lat = new co::vector<int32_t>[FLG_c];
+    co::print("concurrency: ", FLG_c, ", msg len: ", FLG_l, ", time: ", FLG_t, " seconds");
+    if (FLG_mode == "all" || FLG_mode == "tcp") bench("tcp ", tcp_client);
+    if (FLG_mode == "all" || FLG_mode == "http") bench("http", http_client);
+    if (FLG_mode == "all" || FLG_mode == "rpc") bench("rpc ", rpc_client);
+    delete[] g_lat;
+    return 0;
+}
@@ -5,6 +5,7 @@ DEF_int32(port, 9988, "server port");
 DEF_int32(client_num, 1, "client num");
 DEF_string(key, "", "private key file");
 DEF_string(ca, "", "certificate file");
+DEF_bool(reuseport, false, "one SO_REUSEPORT listener per scheduler");
 
 void conn_cb(tcp::Connection conn) {
     char buf[8] = { 0 };
@@ -103,7 +104,7 @@ int main(int argc, char** argv) {
         [](void* p) { delete (tcp::Client*) p; }
     );
 
-    tcp::Server().on_connection(conn_cb).start(
+    tcp::Server().on_connection(conn_cb).set_reuseport(FLG_reuseport).start(
         "0.0.0.0", FLG_port, FLG_key.c_str(), FLG_ca.c_str()
     );
 
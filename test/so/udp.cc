@@ -2,6 +2,7 @@
 
 DEF_string(ip, "127.0.0.1", "ip");
 DEF_int32(port, 6688, "port");
+DEF_bool(mmsg, false, "server recv and send in batch with recvmmsg/sendmmsg");
 
 void udp_server_fun() {
     sock_t fd = co::udp_socket();
@@ -40,6 +41,54 @@ void udp_server_fun() {
     co::close(fd);
 }
 
+#ifdef __linux__
+void udp_server_mmsg_fun() {
+    sock_t fd = co::udp_socket();
+
+    struct sockaddr_in addr;
+    co::init_addr(&addr, FLG_ip.c_str(), FLG_port);
+    co::bind(fd, &addr, sizeof(addr));
+
+    const int N = 16;
+    struct mmsghdr msgs[N];
+    struct iovec iov[N];
+    struct sockaddr_in cli[N];
+    char buf[N][4];
+
+    LOG << "server start, recvmmsg/sendmmsg";
+    while (true) {
+        for (int i = 0; i < N; ++i) {
+            iov[i].iov_base = buf[i];
+            iov[i].iov_len = 4;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &cli[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(cli[i]);
+        }
+
+        int r = co::recvmmsg(fd, msgs, N);
+        if (r == -1) {
+            LOG << "server recvmmsg error: " << co::strerror();
+            break;
+        }
+        LOG << "server recv " << r << " messages";
+
+        // reply pong to all of them in one syscall
+        for (int i = 0; i < r; ++i) {
+            memcpy(buf[i], "pong", 4);
+            iov[i].iov_len = 4;
+        }
+        if (co::sendmmsg(fd, msgs, r) == -1) {
+            LOG << "server sendmmsg error: " << co::strerror();
+            break;
+        }
+    }
+
+    co::close(fd);
+}
+#endif
+
 void udp_client_fun() {
     sock_t fd = co::udp_socket();
 
@@ -76,7 +125,15 @@ int main(int argc, char** argv) {
     flag::parse(argc, argv);
     FLG_log_console = true;
 
+#ifdef __linux__
+    if (FLG_mmsg) {
+        go(udp_server_mmsg_fun);
+    } else {
+        go(udp_server_fun);
+    }
+#else
     go(udp_server_fun);
+#endif
     sleep::ms(32);
     go(udp_client_fun);
 
@@ -42,11 +42,41 @@ BM_group(find) {
     co::print("p: ", p);
 }
 
+BM_group(split) {
+    fastring line;
+    for (int i = 0; i < 16; ++i) line << "field" << i << ',';
+    co::vector<co::strview> v(32);
+    size_t n = 0;
+
+    BM_add(str::split)(n = str::split(line, ',').size();) BM_use(n);
+
+    BM_add(str::split_into)(n = str::split_into(line, ',', v);) BM_use(n);
+
+    BM_add(str::split_view)(
+        n = 0;
+        for (co::strview f : str::split_view(line, ',')) n += f.size();
+    ) BM_use(n);
+}
+
+BM_group(parse) {
+    const char* i = "1234567890123";
+    const char* d = "3.14159265";
+    int64_t x = 0;
+    double y = 0;
+
+    BM_add(str::to_int64)(x = str::to_int64(i);) BM_use(x);
+
+    BM_add(str::parse_int64)(str::parse_int64(i, 13, x);) BM_use(x);
+
+    BM_add(str::to_double)(y = str::to_double(d);) BM_use(y);
+
+    BM_add(str::parse_double)(str::parse_double(d, 10, y);) BM_use(y);
+}
+
 int main(int argc, char** argv) {
     flag::parse(argc, argv);
     if (FLG_s.empty()) {
         FLG_s.append(256, 'x').append(128, 'y').append(128, 'z');
     }
-    bm::run_benchmarks();
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
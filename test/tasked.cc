@@ -1,5 +1,6 @@
 #include "co/tasked.h"
 
+#include "co/co.h"
 #include "co/color.h"
 #include "co/print.h"
 #include "co/time.h"
@@ -19,9 +20,15 @@ int main(int argc, char** argv) {
     s.run_every(g, 3);
     s.run_at(f, 17, 12, 59);
     s.run_daily(f, 5, 18, 0);
+    s.run_every_ms(g, 1500);
+
+    // run tasks in coroutines, a slow task does not delay others
+    co::Tasked x(true);
+    x.run_every_ms([]() { co::sleep(2000); f(); }, 500);
 
     sleep::sec(7);
     s.stop();
+    x.stop();
 
     return 0;
 }
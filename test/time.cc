@@ -4,6 +4,7 @@
 
 #include "co/benchmark.h"
 #include "co/fastream.h"
+#include "co/flag.h"
 #include "co/str.h"
 
 #ifndef _WIN32
@@ -38,6 +39,6 @@ BM_group(time) {
 }
 
 int main(int argc, char** argv) {
-    bm::run_benchmarks();
-    return 0;
+    flag::parse(argc, argv);
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
@@ -326,7 +326,5 @@ int main(int argc, char** argv) {
     co::print(rtw(s, "xxxxx"));
     co::print(ss.rfind("xxxxx"));
 
-    bm::run_benchmarks();
-
-    return 0;
+    return bm::run_benchmarks() > 0 ? 1 : 0;
 }
@@ -0,0 +1,67 @@
+#include "co/buf_chain.h"
+
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(buf_chain) {
+    DEF_case(append) {
+        co::buf_chain b;
+        EXPECT(b.empty());
+        EXPECT_EQ(b.str(), "");
+
+        b << "hello" << ' ' << 23 << ' ' << 3.5;
+        EXPECT_EQ(b.size(), 12);
+        EXPECT_EQ(b.segments(), 1);
+        EXPECT_EQ(b.str(), "hello 23 3.5");
+
+        fastring s(co::buf_chain::kBlockSize * 2 + 7, 'x');
+        b.clear();
+        b.append(s.data(), s.size());
+        EXPECT_EQ(b.size(), s.size());
+        EXPECT_EQ(b.segments(), 3);
+        EXPECT_EQ(b.str(), s);
+    }
+
+    DEF_case(append_ref) {
+        fastring body(100, 'b');
+        co::buf_chain b;
+        b << "head:";
+        b.append_ref(body.data(), body.size());
+        b << ":tail";
+        EXPECT_EQ(b.segments(), 3);
+        EXPECT_EQ(b.size(), 110);
+
+        struct iovec v[4];
+        EXPECT_EQ(b.iov(v, 4), 3);
+        EXPECT_EQ(v[1].iov_base, (void*)body.data());
+        EXPECT_EQ(v[1].iov_len, 100);
+        EXPECT_EQ(b.iov(v, 4, 2), 1);
+        EXPECT_EQ(v[0].iov_len, 5);
+        EXPECT_EQ(b.str(), "head:" + body + ":tail");
+    }
+
+    DEF_case(consume) {
+        fastring body(50, 'b');
+        co::buf_chain b;
+        b << "0123456789";
+        b.append_ref(body.data(), body.size());
+        b << "xyz";
+
+        b.consume(4);
+        EXPECT_EQ(b.size(), 59);
+        EXPECT_EQ(b.segments(), 3);
+        b.consume(6);
+        EXPECT_EQ(b.segments(), 2);
+        b.consume(49);
+        EXPECT_EQ(b.str(), "bxyz");
+        b.consume(100);
+        EXPECT(b.empty());
+        EXPECT_EQ(b.segments(), 0);
+
+        b << "again";
+        EXPECT_EQ(b.str(), "again");
+    }
+}
+
+}  // namespace test
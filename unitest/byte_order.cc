@@ -0,0 +1,100 @@
+#include "co/byte_order.h"
+#include "co/unitest.h"
+#include "co/vector.h"
+
+namespace test {
+
+// check hton_n() and ntoh_n() of @n integers, from and to unaligned buffers, and
+// in place. Each integer converted is read back with load_be*().
+template <typename T, typename L>
+static bool check_n(size_t n, L&& load) {
+    co::vector<T> v(n);
+    for (size_t i = 0; i < n; ++i) {
+        v.push_back((T)(0x0102030405060708ull * (i + 1) + (uint64_t)i * 0x1111));
+    }
+
+    co::vector<char> buf((n + 1) * sizeof(T));
+    buf.resize((n + 1) * sizeof(T));
+    T* const p = (T*)(buf.data() + 1);  // unaligned
+    hton_n(p, v.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        if (load((char*)p + i * sizeof(T)) != v[i]) return false;
+    }
+
+    co::vector<T> u(n);
+    u.resize(n);
+    ntoh_n(u.data(), p, n);
+    if (n > 0 && memcmp(u.data(), v.data(), n * sizeof(T)) != 0) return false;
+
+    ntoh_n(p, p, n);
+    if (n > 0 && memcmp(p, v.data(), n * sizeof(T)) != 0) return false;
+    hton_n(p, p, n);
+    for (size_t i = 0; i < n; ++i) {
+        if (load((char*)p + i * sizeof(T)) != v[i]) return false;
+    }
+    return true;
+}
+
+DEF_test(byte_order) {
+    DEF_case(load_store) {
+        const unsigned char b[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+        EXPECT_EQ(load_be16(b), 0x0102);
+        EXPECT_EQ(load_be16(b + 1), 0x0203);
+        EXPECT_EQ(load_be32(b), 0x01020304u);
+        EXPECT_EQ(load_be32(b + 1), 0x02030405u);
+        EXPECT_EQ(load_be64(b), 0x0102030405060708ull);
+        EXPECT_EQ(load_be64(b + 1), 0x0203040506070809ull);
+
+        unsigned char x[9] = {0};
+        store_be16(x + 1, 0x0a0b);
+        EXPECT_EQ(x[1], 0x0a);
+        EXPECT_EQ(x[2], 0x0b);
+        store_be32(x + 1, 0x0a0b0c0du);
+        EXPECT_EQ(memcmp(x + 1, "\x0a\x0b\x0c\x0d", 4), 0);
+        store_be64(x + 1, 0x0a0b0c0d0e0f1011ull);
+        EXPECT_EQ(memcmp(x + 1, "\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11", 8), 0);
+        EXPECT_EQ(x[0], 0);
+
+        EXPECT_EQ(load_be16(x + 1), 0x0a0b);
+        EXPECT_EQ(load_be32(x + 1), 0x0a0b0c0du);
+        EXPECT_EQ(load_be64(x + 1), 0x0a0b0c0d0e0f1011ull);
+    }
+
+    DEF_case(hton) {
+        uint16_t a = hton16(0x0102);
+        uint32_t b = hton32(0x01020304u);
+        uint64_t c = hton64(0x0102030405060708ull);
+        EXPECT_EQ(memcmp(&a, "\x01\x02", 2), 0);
+        EXPECT_EQ(memcmp(&b, "\x01\x02\x03\x04", 4), 0);
+        EXPECT_EQ(memcmp(&c, "\x01\x02\x03\x04\x05\x06\x07\x08", 8), 0);
+        EXPECT_EQ(ntoh16(a), 0x0102);
+        EXPECT_EQ(ntoh32(b), 0x01020304u);
+        EXPECT_EQ(ntoh64(c), 0x0102030405060708ull);
+    }
+
+    DEF_case(hton_n) {
+        // sizes around the 64-byte blocks of the SIMD code
+        const size_t sizes[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000};
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            const size_t n = sizes[i];
+            EXPECT(check_n<uint16_t>(n, [](const void* p) { return load_be16(p); }));
+            EXPECT(check_n<uint32_t>(n, [](const void* p) { return load_be32(p); }));
+            EXPECT(check_n<uint64_t>(n, [](const void* p) { return load_be64(p); }));
+        }
+
+        const uint16_t s[] = {0x0102, 0x0304};
+        uint16_t d[2];
+        hton_n(d, s, 2);
+        EXPECT_EQ(memcmp(d, "\x01\x02\x03\x04", 4), 0);
+        const uint32_t s32[] = {0x01020304u, 0x05060708u};
+        uint32_t d32[2];
+        hton_n(d32, s32, 2);
+        EXPECT_EQ(memcmp(d32, "\x01\x02\x03\x04\x05\x06\x07\x08", 8), 0);
+        const uint64_t s64[] = {0x0102030405060708ull};
+        uint64_t d64[1];
+        hton_n(d64, s64, 1);
+        EXPECT_EQ(memcmp(d64, "\x01\x02\x03\x04\x05\x06\x07\x08", 8), 0);
+    }
+}
+
+}  // namespace test
@@ -1,11 +1,29 @@
 #include "co/co.h"
+#include "co/co/await.h"
 
 #include <atomic>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
 #include "co/color.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/json.h"
 #include "co/print.h"
+#include "co/time.h"
 #include "co/unitest.h"
 
+DEC_string(co_dns_servers);
+DEC_bool(co_file_offload);
+DEC_bool(co_dedicated_stack);
+DEC_uint32(co_busy_poll_us);
+DEC_uint32(co_stack_num);
+DEC_bool(co_stack_profile);
+DEC_bool(co_trace);
 
 namespace test {
 
@@ -447,6 +465,168 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(sharded_lru_map) {
+        co::sharded_lru_map<int, int> m(4096, 8);
+        m.insert(1, 1);
+        int x = 0;
+        EXPECT(m.get(1, x));
+        EXPECT_EQ(x, 1);
+        EXPECT(!m.get(2, x));
+        EXPECT(m.visit(1, [](int& v) { ++v; }));
+        EXPECT(m.get(1, x));
+        EXPECT_EQ(x, 2);
+        m.visit_or_insert(1, [](int& v) { v += 10; });
+        m.visit_or_insert(3, [](int& v) { v += 10; });
+        EXPECT(m.get(1, x));
+        EXPECT_EQ(x, 12);
+        EXPECT(m.get(3, x));
+        EXPECT_EQ(x, 10);
+        m.erase(3);
+        m.erase(1);
+        EXPECT_EQ(m.size(), 0);
+
+        // coroutines and threads insert and read at the same time
+        co::wait_group wg(8);
+        std::atomic<int> bad(0);
+        auto f = [&m, &bad](int b) {
+            for (int k = 0; k < 1000; ++k) {
+                m.insert(b + k, b + k);
+                int v = 0;
+                if (m.get(b + k, v) && v != b + k) ++bad;
+            }
+        };
+        for (int i = 0; i < 4; ++i) {
+            go([wg, &f, i]() {
+                f(i * 1000);
+                wg.done();
+            });
+        }
+        for (int i = 4; i < 8; ++i) {
+            std::thread([wg, &f, i]() {
+                f(i * 1000);
+                wg.done();
+            }).detach();
+        }
+        wg.wait();
+        EXPECT_EQ(bad.load(), 0);
+        EXPECT_EQ(m.size(), 4096);
+        m.clear();
+        EXPECT_EQ(m.size(), 0);
+    }
+
+    DEF_case(mutex_contended) {
+        co::mutex m;
+        co::wait_group wg(8);
+        int n = 0;
+        for (int i = 0; i < 4; ++i) {
+            go([wg, m, &n]() {
+                for (int k = 0; k < 1000; ++k) {
+                    co::mutex_guard g(m);
+                    ++n;
+                    if (k % 100 == 0) co::sleep(1);  // suspended with the lock held
+                }
+                wg.done();
+            });
+        }
+        for (int i = 0; i < 4; ++i) {
+            std::thread([wg, m, &n]() {
+                for (int k = 0; k < 1000; ++k) {
+                    co::mutex_guard g(m);
+                    ++n;
+                }
+                wg.done();
+            }).detach();
+        }
+        wg.wait();
+        EXPECT_EQ(n, 8000);
+        EXPECT_EQ(m.try_lock(), true);
+        m.unlock();
+    }
+
+    DEF_case(shared_mutex) {
+        co::shared_mutex m;
+        m.lock_shared();
+        EXPECT_EQ(m.try_lock_shared(), true);
+        EXPECT_EQ(m.try_lock(), false);
+        m.unlock_shared();
+        m.unlock_shared();
+        EXPECT_EQ(m.try_lock(), true);
+        EXPECT_EQ(m.try_lock_shared(), false);
+        m.unlock();
+
+        // readers hold the lock at the same time
+        std::atomic_int readers{0};
+        int max_readers = 0;
+        co::wait_group wg(4);
+        for (int i = 0; i < 4; ++i) {
+            go([wg, m, &readers, &max_readers]() {
+                co::shared_lock_guard g(m);
+                const int n = ++readers;
+                if (n > max_readers) max_readers = n;
+                co::sleep(10);
+                --readers;
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_GT(max_readers, 1);
+
+        // readers coming after a waiting writer wait for the writer
+        int order = 0, w = 0, r = 0;
+        wg.add(3);
+        go([wg, m]() {
+            co::shared_lock_guard g(m);
+            co::sleep(20);
+            wg.done();
+        });
+        go([wg, m, &order, &w]() {
+            co::sleep(5);
+            co::unique_lock_guard g(m);
+            w = ++order;
+            wg.done();
+        });
+        go([wg, m, &order, &r]() {
+            co::sleep(10);
+            co::shared_lock_guard g(m);
+            r = ++order;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(w, 1);
+        EXPECT_EQ(r, 2);
+
+        // mixed coroutines and threads
+        int nw = 0;
+        wg.add(8);
+        for (int i = 0; i < 4; ++i) {
+            go([wg, m, &nw]() {
+                for (int k = 0; k < 500; ++k) {
+                    if (k % 4 == 0) {
+                        co::unique_lock_guard g(m);
+                        ++nw;
+                    } else {
+                        co::shared_lock_guard g(m);
+                        if (k % 50 == 1) co::sleep(1);
+                    }
+                }
+                wg.done();
+            });
+            std::thread([wg, m, &nw]() {
+                for (int k = 0; k < 500; ++k) {
+                    if (k % 4 == 0) {
+                        co::unique_lock_guard g(m);
+                        ++nw;
+                    } else {
+                        co::shared_lock_guard g(m);
+                    }
+                }
+                wg.done();
+            }).detach();
+        }
+        wg.wait();
+        EXPECT_EQ(nw, 8 * 125);
+    }
+
     DEF_case(event) {
         {
             co::event ev;
@@ -561,6 +741,179 @@ DEF_test(co) {
             EXPECT_EQ(ev.wait(0), false);
             EXPECT_EQ(ev.wait(0), false);
         }
+        {
+            // a waiter timed out leaves its waitx in the queue, and the next
+            // waiter reuses it, while another coroutine may have taken the place
+            // of the one timed out
+            co::event ev;
+            co::wait_group wg(1);
+            auto s = co::next_sched();
+            std::atomic_int st(0);
+            int64_t slept = 0;
+
+            s->go([wg, ev]() {
+                ev.wait(1);
+                wg.done();
+            });
+            wg.wait();
+
+            wg.add(2);
+            s->go([wg, &slept]() {
+                const int64_t t = now::ms();
+                co::sleep(50);
+                slept = now::ms() - t;
+                wg.done();
+            });
+            s->go([wg, ev, &st]() {
+                st = 1;
+                ev.wait();
+                st = 2;
+                wg.done();
+            });
+
+            while (st == 0) sleep::ms(1);
+            sleep::ms(2);
+            ev.signal();
+            for (int i = 0; i < 500 && st != 2; ++i) sleep::ms(1);
+            EXPECT_EQ(st.load(), 2);
+            if (st == 2) {
+                wg.wait();
+                EXPECT_GE(slept, 40);
+            }
+        }
+    }
+
+    DEF_case(condition_variable) {
+        co::mutex m;
+        co::condition_variable cv;
+        int ready = 0, n = 0;
+
+        // wait until @k waiters are queued, they count themselves with the lock held
+        auto wait_for_waiters = [&m, &n](int k) {
+            for (;;) {
+                {
+                    co::mutex_guard g(m);
+                    if (n == k) return;
+                }
+                sleep::ms(1);
+            }
+        };
+
+        co::wait_group wg(64);
+        for (int i = 0; i < 63; ++i) {
+            go([wg, m, cv, &ready, &n]() {
+                co::mutex_guard g(m);
+                ++n;
+                cv.wait(m, [&ready]() { return ready != 0; });
+                wg.done();
+            });
+        }
+        std::thread([wg, m, cv, &ready, &n]() {
+            co::mutex_guard g(m);
+            ++n;
+            cv.wait(m, [&ready]() { return ready != 0; });
+            wg.done();
+        }).detach();
+
+        wait_for_waiters(64);
+        {
+            co::mutex_guard g(m);
+            ready = 1;
+            cv.notify_all();
+        }
+        wg.wait();
+        EXPECT_EQ(n, 64);
+
+        n = 0;
+        ready = 0;
+        wg.add(2);
+        for (int i = 0; i < 2; ++i) {
+            go([wg, m, cv, &ready, &n]() {
+                co::mutex_guard g(m);
+                ++n;
+                cv.wait(m, [&ready]() { return ready != 0; });
+                --ready;
+                wg.done();
+            });
+        }
+        wait_for_waiters(2);
+        {
+            co::mutex_guard g(m);
+            ready = 1;
+            cv.notify_one();
+        }
+        for (;;) {
+            {
+                co::mutex_guard g(m);
+                if (ready == 0) break;
+            }
+            sleep::ms(1);
+        }
+        {
+            co::mutex_guard g(m);
+            ready = 1;
+            cv.notify_one();
+        }
+        wg.wait();
+        EXPECT_EQ(ready, 0);
+
+        bool r = true;
+        wg.add(1);
+        go([wg, m, cv, &r]() {
+            co::mutex_guard g(m);
+            r = cv.wait_for(m, 5);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r, false);
+
+        m.lock();
+        EXPECT_EQ(cv.wait_for(m, 5), false);
+        m.unlock();
+
+        // the waitx of the waiter timed out above is reused by the next waiter,
+        // while another coroutine may have taken the place of the one timed out
+        auto s = co::next_sched();
+        int64_t slept = 0;
+        n = 0;
+        wg.add(1);
+        s->go([wg, m, cv]() {
+            co::mutex_guard g(m);
+            cv.wait_for(m, 1);
+            wg.done();
+        });
+        wg.wait();
+
+        wg.add(2);
+        s->go([wg, &slept]() {
+            const int64_t t = now::ms();
+            co::sleep(50);
+            slept = now::ms() - t;
+            wg.done();
+        });
+        s->go([wg, m, cv, &n]() {
+            co::mutex_guard g(m);
+            ++n;
+            cv.wait(m);
+            ++n;
+            wg.done();
+        });
+        wait_for_waiters(1);
+        {
+            co::mutex_guard g(m);
+            cv.notify_one();
+        }
+        int k = 0;
+        for (int i = 0; i < 500 && k != 2; ++i) {
+            sleep::ms(1);
+            co::mutex_guard g(m);
+            k = n;
+        }
+        EXPECT_EQ(k, 2);
+        if (k == 2) {
+            wg.wait();
+            EXPECT_GE(slept, 40);
+        }
     }
 
     DEF_case(chan) {
@@ -782,8 +1135,10 @@ DEF_test(co) {
                 wg2.done();
             });
             s->go([ch, wg2]() {
-                TestChan x(7);
-                ch << x;
+                {
+                    TestChan x(7);
+                    ch << x;
+                }
                 wg2.done();
             });
             s->go([ch, wg1]() {
@@ -809,6 +1164,301 @@ DEF_test(co) {
         EXPECT_EQ(gc, gd);
     }
 
+    DEF_case(chan_batch) {
+        {
+            co::chan<int> ch(8);
+            int a[20], b[20];
+            for (int i = 0; i < 20; ++i) a[i] = i;
+            co::wait_group wg(1);
+            int sum = 0, reads = 0;
+            go([wg, ch, &b, &sum, &reads]() {
+                for (;;) {
+                    const size_t n = ch.read_n(b, 20);
+                    if (n == 0) break;
+                    ++reads;
+                    for (size_t i = 0; i < n; ++i) sum += b[i];
+                }
+                wg.done();
+            });
+            EXPECT_EQ(ch.write_n(a, 20), 20);
+            EXPECT(ch.done());
+            ch.close();
+            wg.wait();
+            EXPECT_EQ(sum, 190);
+            EXPECT_LT(reads, 20);
+            EXPECT_EQ(ch.write_n(a, 2), 0);
+            EXPECT(!ch.done());
+        }
+
+        {
+            // no buffer, move elements to the reader
+            co::chan<fastring> ch(0, 50);
+            fastring a[3] = {"x", "yy", "zzz"};
+            fastring b[3];
+            co::wait_group wg(1);
+            size_t n = 0;
+            go([wg, ch, &b, &n]() {
+                while (n < 3) {
+                    const size_t r = ch.read_n(b + n, 3 - n);
+                    if (r == 0) break;
+                    n += r;
+                }
+                wg.done();
+            });
+            EXPECT_EQ(ch.move_n(a, 3), 3);
+            wg.wait();
+            EXPECT_EQ(n, 3);
+            EXPECT_EQ(b[2], "zzz");
+            EXPECT(a[2].empty());
+            EXPECT_EQ(ch.read_n(b, 3), 0);  // timeout
+            EXPECT(!ch.done());
+        }
+
+        {
+            co::Sched* s = co::scheds()[0];
+            co::chan<int> ch(16, (uint32_t)-1, true);
+            co::wait_group wg(2);
+            int sum = 0;
+            s->go([wg, ch]() {
+                int a[100];
+                for (int i = 0; i < 100; ++i) a[i] = i + 1;
+                ch.write_n(a, 100);
+                ch.close();
+                wg.done();
+            });
+            s->go([wg, ch, &sum]() {
+                int b[7];
+                for (size_t n; (n = ch.read_n(b, 7)) > 0;) {
+                    for (size_t i = 0; i < n; ++i) sum += b[i];
+                }
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(sum, 5050);
+        }
+    }
+
+    DEF_case(select) {
+        {
+            co::chan<int> a(4), b(4);
+            co::wait_group wg(1);
+            int r[4] = {-2, -2, -2, -2};
+            int x = 0, y = 0;
+            go([wg, a, b, &r, &x, &y]() {
+                co::select s;
+                s.recv(a, x).recv(b, y);
+                r[0] = s.wait();   // b is ready
+                r[1] = s.wait(5);  // timeout
+                r[2] = s.wait();   // a is ready after sleep
+                r[3] = s.wait(0);  // no wait
+                wg.done();
+            });
+            b << 7;
+            co::sleep(20);
+            a << 3;
+            wg.wait();
+            EXPECT_EQ(r[0], 1);
+            EXPECT_EQ(y, 7);
+            EXPECT_EQ(r[1], -1);
+            EXPECT_EQ(r[2], 0);
+            EXPECT_EQ(x, 3);
+            EXPECT_EQ(r[3], -1);
+        }
+
+        {
+            // waits on other channels are cancelled, no element is lost
+            co::chan<int> a(0), b(0);
+            co::wait_group wg(3);
+            int sum = 0, na = 0, nb = 0;
+            go([wg, a, b, &sum, &na, &nb]() {
+                co::select s;
+                int x = 0, y = 0;
+                s.recv(a, x).recv(b, y);
+                for (int k = 0; k < 200; ++k) {
+                    const int i = s.wait();
+                    if (i == 0) { sum += x; ++na; }
+                    if (i == 1) { sum += y; ++nb; }
+                }
+                wg.done();
+            });
+            go([wg, a]() {
+                for (int i = 0; i < 100; ++i) a << 1;
+                wg.done();
+            });
+            go([wg, b]() {
+                for (int i = 0; i < 100; ++i) b << 2;
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(na, 100);
+            EXPECT_EQ(nb, 100);
+            EXPECT_EQ(sum, 300);
+        }
+
+        {
+            // a closed channel is ready
+            co::chan<fastring> a(1), b(1);
+            co::wait_group wg(1);
+            int r = -2;
+            bool done = true;
+            fastring x, y;
+            go([wg, a, b, &r, &done, &x, &y]() {
+                co::select s;
+                s.recv(a, x).recv(b, y);
+                r = s.wait(1000);
+                done = s.done();
+                wg.done();
+            });
+            co::sleep(5);
+            b.close();
+            wg.wait();
+            EXPECT_EQ(r, 1);
+            EXPECT(!done);
+        }
+    }
+
+    DEF_case(chan_mpmc) {
+        {
+            co::chan_mpmc<int> ch(4);
+            ch << 1 << 2;
+            EXPECT(ch.done());
+            int x = 0;
+            ch >> x;
+            EXPECT_EQ(x, 1);
+            ch >> x;
+            EXPECT_EQ(x, 2);
+        }
+
+        {
+            // writers are parked when the ring is full, readers when it is empty
+            co::chan_mpmc<int> ch(8);
+            co::wait_group wg(8);
+            std::atomic_int sum{0};
+            for (int i = 0; i < 4; ++i) {
+                go([wg, ch]() {
+                    for (int k = 1; k <= 1000; ++k) ch << k;
+                    wg.done();
+                });
+                go([wg, ch, &sum]() {
+                    int x;
+                    for (int k = 0; k < 1000; ++k) {
+                        ch >> x;
+                        sum += x;
+                    }
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT_EQ(sum.load(), 4 * 500500);
+        }
+
+        {
+            // threads and coroutines
+            co::chan_mpmc<fastring> ch(2);
+            co::wait_group wg(2);
+            int n = 0;
+            std::thread([wg, ch]() {
+                for (int k = 0; k < 100; ++k) ch << fastring("xx");
+                wg.done();
+            }).detach();
+            go([wg, ch, &n]() {
+                fastring s;
+                for (int k = 0; k < 100; ++k) {
+                    ch >> s;
+                    if (ch.done() && s == "xx") ++n;
+                }
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(n, 100);
+        }
+
+        {
+            co::chan_mpmc<int> ch(2, 10);
+            int x = 0;
+            ch >> x;  // timeout
+            EXPECT(!ch.done());
+            ch << 1 << 2 << 3;  // the last one timed out
+            EXPECT(!ch.done());
+
+            co::wait_group wg(1);
+            bool done = true;
+            go([wg, ch, &done]() {
+                int v;
+                co::chan_mpmc<int> c(2);
+                c.close();
+                c >> v;
+                done = c.done();
+                wg.done();
+            });
+            wg.wait();
+            EXPECT(!done);
+            ch.close();
+            EXPECT(!ch);
+            ch >> x;
+            EXPECT(ch.done());
+            EXPECT_EQ(x, 1);
+        }
+    }
+
+    DEF_case(local_chan) {
+        co::Sched* s = co::scheds()[0];
+        {
+            co::chan<int> ch(4, (uint32_t)-1, true);
+            co::wait_group wg(2);
+            int sum = 0;
+            s->go([wg, ch]() {
+                for (int i = 1; i <= 100; ++i) ch << i;
+                ch.close();
+                wg.done();
+            });
+            s->go([wg, ch, &sum]() {
+                int x;
+                for (;;) {
+                    ch >> x;
+                    if (!ch.done()) break;
+                    sum += x;
+                }
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(sum, 5050);
+        }
+
+        {
+            // no buffer, the writer hands the value off to the waiting reader
+            co::chan<fastring> ch(0, (uint32_t)-1, true);
+            co::wait_group wg(2);
+            fastring r;
+            s->go([wg, ch, &r]() {
+                fastring x;
+                ch >> x;
+                r = x;
+                wg.done();
+            });
+            s->go([wg, ch]() {
+                ch << fastring("hello");
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(r, "hello");
+        }
+
+        {
+            co::chan<int> ch(1, 10, true);
+            co::wait_group wg(1);
+            bool done = true;
+            s->go([wg, ch, &done]() {
+                int x;
+                ch >> x;
+                done = ch.done();
+                wg.done();
+            });
+            wg.wait();
+            EXPECT(!done);
+        }
+    }
+
     DEF_case(pool) {
         co::pool p([]() { return (void*)new int(0); }, [](void* p) { delete (int*)p; }, 8192);
 
@@ -846,6 +1496,876 @@ DEF_test(co) {
 
         p.clear();
     }
+
+    DEF_case(pool_shared) {
+        std::atomic_int created{0};
+        co::pool p(
+            [&created]() { ++created; return (void*)new int(0); },
+            [&created](void* p) { --created; delete (int*)p; },
+            8, 2
+        );
+
+        co::wait_group wg(1);
+        int r = 0;
+        go([&]() {
+            int* a = (int*)p.pop();
+            int* b = (int*)p.pop();
+            EXPECT_EQ(created.load(), 2);
+
+            // the third pop() waits until an element is pushed back
+            co::wait_group w(1);
+            go([&]() {
+                int* c = (int*)p.pop();
+                r = (c == a) ? 1 : 0;
+                p.push(c);
+                w.done();
+            });
+            co::sleep(16);
+            EXPECT_EQ(r, 0);
+            p.push(a);
+            w.wait();
+            EXPECT_EQ(r, 1);
+            EXPECT_EQ(created.load(), 2);
+
+            // a discarded element is no longer counted, a new one can be created
+            p.discard(b);
+            EXPECT_EQ(created.load(), 1);
+            int* x = (int*)p.pop();
+            int* y = (int*)p.pop();
+            EXPECT_EQ(created.load(), 2);
+            p.push(x);
+            p.push(y);
+            EXPECT_EQ(p.size(), 2);
+            p.clear();
+            EXPECT_EQ(created.load(), 0);
+            wg.done();
+        });
+        wg.wait();
+    }
+
+    DEF_case(pool_idle) {
+        std::atomic_int created{0};
+        co::pool p(
+            [&created]() { ++created; return (void*)new int(0); },
+            [&created](void* p) { --created; delete (int*)p; },
+            8
+        );
+        p.set_check([](void* e) { return *(int*)e >= 0; });
+        p.set_idle_timeout(32);
+
+        co::wait_group wg(1);
+        go([&]() {
+            int* a = (int*)p.pop();
+            int* b = (int*)p.pop();
+            *a = -1; // marked as broken, dropped by the check on pop()
+            p.push(b);
+            p.push(a);
+            EXPECT_EQ(p.size(), 2);
+            int* c = (int*)p.pop();
+            EXPECT_EQ(c, b);
+            EXPECT_EQ(created.load(), 1);
+
+            p.push(c);
+            co::sleep(128);
+            EXPECT_EQ(p.size(), 0);
+            EXPECT_EQ(created.load(), 0);
+            wg.done();
+        });
+        wg.wait();
+    }
+
+    DEF_case(resolve) {
+        // a fake name server, a.test -> 10.0.0.1, others are not found
+        sock_t fd = co::udp_socket();
+        sockaddr_in addr;
+        co::init_addr(&addr, "127.0.0.1", 0);
+        co::bind(fd, &addr, sizeof(addr));
+        int len = sizeof(addr);
+        getsockname(fd, (sockaddr*)&addr, (socklen_t*)&len);
+        FLG_co_dns_servers = co::addr2str(&addr);
+
+        std::atomic_int nq{0};
+        std::atomic_bool stop{false};
+        co::wait_group wg(1);
+        go([&]() {
+            char buf[512];
+            while (!stop.load()) {
+                sockaddr_in from;
+                int n = sizeof(from);
+                int r = co::recvfrom(fd, buf, 256, &from, &n, 16);
+                if (r <= 12) continue;
+                ++nq;
+                co::sleep(8);
+                const bool found = strstr(buf + 12, "\x01""a\x04test") != nullptr;
+                buf[2] = (char)0x81;
+                buf[3] = (char)(found ? 0x80 : 0x83);
+                if (found) {
+                    const char ans[16] = {
+                        (char)0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 0, 0, 1,
+                    };
+                    buf[7] = 1;
+                    memcpy(buf + r, ans, 16);
+                    r += 16;
+                }
+                co::sendto(fd, buf, r, &from, n);
+            }
+            co::close(fd);
+            wg.done();
+        });
+
+        co::wait_group w(2);
+        co::vector<fastring> ips[3];
+        int err[3];
+        for (int i = 0; i < 2; ++i) {
+            go([&, i]() {
+                err[i] = co::resolve("a.test", AF_INET, ips[i]);
+                w.done();
+            });
+        }
+        w.wait();
+        EXPECT_EQ(nq.load(), 1);
+        for (int i = 0; i < 2; ++i) {
+            EXPECT_EQ(err[i], 0);
+            EXPECT_EQ(ips[i].size(), 1);
+            if (!ips[i].empty()) EXPECT_EQ(ips[i][0], "10.0.0.1");
+        }
+
+        w.add(1);
+        go([&]() {
+            err[2] = co::resolve("A.TEST", AF_INET, ips[2]);
+            EXPECT_EQ(nq.load(), 1); // from the cache
+
+            co::vector<fastring> v;
+            EXPECT_EQ(co::resolve("127.0.0.1", AF_INET, v), 0);
+            EXPECT_EQ(co::resolve("nx.test", AF_INET, v), EAI_NONAME);
+            EXPECT_EQ(nq.load(), 2);
+            EXPECT_EQ(v.size(), 1);
+
+            struct hostent* h = gethostbyname("a.test");
+            EXPECT(h != nullptr);
+            if (h) {
+                EXPECT_EQ(h->h_length, 4);
+                EXPECT_EQ(inet_ntoa(*(in_addr*)h->h_addr_list[0]), fastring("10.0.0.1"));
+            }
+            w.done();
+        });
+        w.wait();
+        EXPECT_EQ(err[2], 0);
+
+        stop = true;
+        wg.wait();
+    }
+
+#ifndef _WIN32
+    DEF_case(file_offload) {
+        FLG_co_file_offload = true;
+        const char* path = "co_file_offload.txt";
+        co::wait_group wg(1);
+        go([&]() {
+            // buffers on the stack are copied as the I/O thread can not access them
+            {
+                fs::file f(path, 'w');
+                char s[8] = "hello ";
+                EXPECT_EQ(f.write(s, 6), 6);
+                fastring t("world");
+                EXPECT_EQ(f.write(t), 5);
+            }
+
+            bool ran = false;
+            go([&ran]() { ran = true; });
+
+            fs::file f(path, 'r');
+            char buf[16] = {0};
+            EXPECT_EQ(f.read(buf, 11), 11);
+            EXPECT_EQ(fastring(buf), "hello world");
+            EXPECT(ran); // other coroutines run while reading the file
+            f.close();
+
+            int fd = ::open(path, O_RDONLY);
+            char a[6] = {0}, b[7] = {0};
+            struct iovec iov[2] = {{a, 5}, {b, 6}};
+            EXPECT_EQ(::readv(fd, iov, 2), 11);
+            EXPECT_EQ(fastring(a), "hello");
+            EXPECT_EQ(fastring(b), " world");
+            ::close(fd);
+            wg.done();
+        });
+        wg.wait();
+        fs::remove(path);
+        FLG_co_file_offload = false;
+    }
+#endif
+
+    DEF_case(run_blocking) {
+        const auto done = co::blocking_stats().done;
+        co::wait_group wg(1);
+        go([&]() {
+            bool ran = false;
+            go([&ran]() { ran = true; });
+
+            const int x = 3;
+            fastring s = co::run_blocking([x]() {
+                ::usleep(1000);
+                return fastring(x, 'x');
+            });
+            EXPECT_EQ(s, "xxx");
+            EXPECT(ran); // the scheduler is not blocked
+
+            auto n = new std::atomic_int(0);
+            co::run_blocking([n]() { ++*n; });
+            EXPECT_EQ(n->load(), 1);
+            delete n;
+            wg.done();
+        });
+        wg.wait();
+
+        // not in coroutine, run in the calling thread
+        EXPECT_EQ(co::run_blocking([]() { return 7; }), 7);
+
+        const auto st = co::blocking_stats();
+        EXPECT_GT(st.threads, 0);
+        EXPECT_EQ(st.done, done + 2);
+        EXPECT_EQ(st.queued, 0);
+    }
+
+    DEF_case(sendv) {
+        sock_t ls = co::tcp_socket();
+        sockaddr_in addr;
+        co::init_addr(&addr, "127.0.0.1", 0);
+        co::bind(ls, &addr, sizeof(addr));
+        co::listen(ls, 8);
+        int len = sizeof(addr);
+        getsockname(ls, (sockaddr*)&addr, (socklen_t*)&len);
+
+        // a large buffer in the middle, so that writev is partially done
+        fastring a("hello "), b(4 << 20, 'x'), c(" world");
+        co::wait_group wg(2);
+        fastring r;
+        go([&]() {
+            sock_t fd = co::accept(ls, 0, 0);
+            r.resize(a.size() + b.size() + c.size());
+            EXPECT_EQ(co::recvn(fd, (void*)r.data(), (int)r.size()), (int)r.size());
+            co::close(fd);
+            wg.done();
+        });
+        go([&]() {
+            sock_t fd = co::tcp_socket();
+            EXPECT_EQ(co::connect(fd, &addr, sizeof(addr)), 0);
+            struct iovec iov[4] = {
+                {(void*)a.data(), a.size()}, {0, 0}, {(void*)b.data(), b.size()}, {(void*)c.data(), c.size()},
+            };
+            EXPECT_EQ(co::sendv(fd, iov, 4), (int)(a.size() + b.size() + c.size()));
+            co::close(fd);
+            wg.done();
+        });
+        wg.wait();
+        co::close(ls);
+        EXPECT(r.starts_with("hello xxx"));
+        EXPECT(r.ends_with("xxx world"));
+        EXPECT_EQ(r.size(), a.size() + b.size() + c.size());
+    }
+
+#ifndef _WIN32
+    DEF_case(sendfile) {
+        const char* path = "co_sendfile.test";
+        fastring a(1 << 20, 'x');
+        for (size_t i = 0; i < a.size(); i += 4096) a[i] = (char)('a' + (i >> 12) % 26);
+        {
+            fs::file f(path, 'w');
+            f.write(a);
+        }
+
+        sock_t ls = co::tcp_socket();
+        sockaddr_in addr;
+        co::init_addr(&addr, "127.0.0.1", 0);
+        co::bind(ls, &addr, sizeof(addr));
+        co::listen(ls, 8);
+        int len = sizeof(addr);
+        getsockname(ls, (sockaddr*)&addr, (socklen_t*)&len);
+
+        const int64_t off = 4096 + 7, n = (int64_t)a.size() - off - 100;
+        co::wait_group wg(2);
+        fastring r;
+        go([&]() {
+            sock_t fd = co::accept(ls, 0, 0);
+            r.resize((size_t)n);
+            EXPECT_EQ(co::recvn(fd, (void*)r.data(), (int)n), (int)n);
+            co::close(fd);
+            wg.done();
+        });
+        go([&]() {
+            sock_t fd = co::tcp_socket();
+            EXPECT_EQ(co::connect(fd, &addr, sizeof(addr)), 0);
+            const int f = ::open(path, O_RDONLY);
+            EXPECT_EQ(co::sendfile(fd, f, off, n), n);
+            EXPECT_EQ(co::sendfile(fd, f, (int64_t)a.size() - 10, 20), -1);  // beyond eof
+            ::close(f);
+            co::close(fd);
+            wg.done();
+        });
+        wg.wait();
+        co::close(ls);
+        EXPECT(r == a.substr((size_t)off, (size_t)n));
+        fs::remove(path);
+    }
+
+    DEF_case(hook_poll) {
+        int p[2], q[2];
+        EXPECT_EQ(::pipe(p), 0);
+        EXPECT_EQ(::pipe(q), 0);
+        co::wait_group wg(2);
+        go([&]() {
+            struct pollfd fds[2] = {{p[0], POLLIN, 0}, {q[0], POLLIN | POLLPRI, 0}};
+            EXPECT_EQ(::poll(fds, 2, 20), 0);  // timeout
+
+            co::Timer t;
+            EXPECT_EQ(::poll(fds, 2, 3000), 1);
+            EXPECT_LT(t.ms(), 1000);
+            EXPECT_EQ(fds[0].revents, 0);
+            EXPECT_EQ(fds[1].revents, POLLIN);
+
+            fd_set rs;
+            FD_ZERO(&rs);
+            FD_SET(p[0], &rs);
+            FD_SET(q[0], &rs);
+            struct timeval tv = {3, 0};
+            EXPECT_EQ(::select((p[0] > q[0] ? p[0] : q[0]) + 1, &rs, 0, 0, &tv), 1);
+            EXPECT(!FD_ISSET(p[0], &rs));
+            EXPECT(FD_ISSET(q[0], &rs));
+            wg.done();
+        });
+        go([&]() {
+            co::sleep(30);
+            EXPECT_EQ(::write(q[1], "x", 1), 1);
+            wg.done();
+        });
+        wg.wait();
+        for (int fd : {p[0], p[1], q[0], q[1]}) ::close(fd);
+    }
+#endif
+
+    DEF_case(go_batch) {
+        std::atomic_int n{0};
+        co::wait_group wg(100);
+        co::vector<co::Closure*> cbs;
+        for (int i = 0; i < 100; ++i) {
+            cbs.push_back(co::new_closure([wg, &n]() {
+                n.fetch_add(1, std::memory_order_relaxed);
+                wg.done();
+            }));
+        }
+        co::go_batch(cbs);
+        wg.wait();
+        EXPECT_EQ(n.load(), 100);
+        co::go_batch(0, 0);
+    }
+
+    DEF_case(go_hi) {
+        if (co::sched_num() == 1) {
+            co::vector<int> order;
+            co::wait_group wg(1);
+            go([&order, wg]() {
+                co::wait_group x(4);
+                go([&order, x]() { order.push_back(0); x.done(); });
+                go([&order, x]() { order.push_back(1); x.done(); });
+                co::go_hi([&order, x]() { order.push_back(2); x.done(); });
+                co::go_hi([&order, x]() { order.push_back(3); x.done(); });
+                x.wait();
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(order.size(), 4);
+            EXPECT_EQ(order[0], 2);
+            EXPECT_EQ(order[1], 3);
+            EXPECT_EQ(order[2], 0);
+            EXPECT_EQ(order[3], 1);
+        } else {
+            co::wait_group wg(8);
+            for (int i = 0; i < 8; ++i) co::go_hi([wg]() { wg.done(); });
+            wg.wait();
+        }
+    }
+
+    DEF_case(sleep_us) {
+        co::wait_group wg(1);
+        int64_t us = 0;
+        go([&]() {
+            co::Timer t;
+            for (int i = 0; i < 100; ++i) co::sleep_us(100);
+            us = t.us();
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_GE(us, 100 * 100);
+        EXPECT_LT(us, 60 * 1000);  // not rounded up to 1 ms each
+
+        co::Timer t;
+        co::sleep_us(500);
+        EXPECT_GE(t.us(), 500);
+    }
+
+    DEF_case(maybe_yield) {
+        EXPECT(!co::maybe_yield());  // not in coroutine
+
+        co::Sched* s = co::scheds()[0];
+        std::atomic_int x{0};
+        int seen = 0;
+        co::wait_group wg(2);
+        s->go([&x, &seen, wg]() {
+            co::Timer t;
+            while (t.ms() < 30) co::maybe_yield();
+            seen = x.load();
+            wg.done();
+        });
+        s->go([&x, wg]() {
+            x.store(1);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(seen, 1);
+    }
+
+    DEF_case(cls) {
+        static int ndel = 0;
+        static co::wait_group* del_wg;
+        struct X {
+            explicit X(int v) : v(v) {}
+            ~X() {
+                ++ndel;
+                del_wg->done();
+            }
+            int v;
+        };
+        static co::cls<X> a;
+        static co::cls<int> b;
+
+        co::Sched* s = co::scheds()[0];
+        int r[4] = {0};
+        co::wait_group wg(2);
+        co::wait_group dwg(3);  // values are deleted when the coroutines end
+        del_wg = &dwg;
+        s->go([&r, wg]() {
+            r[0] = a.get() == 0 && !b;
+            a.set(new X(1));
+            b.set(new int(2));
+            co::sleep(5);
+            r[1] = a->v + *b;
+            wg.done();
+        });
+        s->go([&r, wg]() {
+            r[2] = a.get() == 0;
+            a.set(new X(7));
+            a.set(new X(8));  // the old value is deleted
+            r[3] = a->v;
+            wg.done();
+        });
+        wg.wait();
+        dwg.wait();
+        EXPECT_EQ(r[0], 1);
+        EXPECT_EQ(r[1], 3);
+        EXPECT_EQ(r[2], 1);
+        EXPECT_EQ(r[3], 8);
+        EXPECT_EQ(ndel, 3);
+    }
+
+    DEF_case(stats) {
+        co::Sched* s = co::scheds()[0];
+        const co::sched_stats a = s->stats();
+        EXPECT_EQ(a.id, 0);
+
+        co::wait_group wg(1);
+        s->go([wg]() {
+            co::sleep(1);
+            wg.done();
+        });
+        wg.wait();
+
+        const co::sched_stats b = s->stats();
+        EXPECT_GE(b.switches, a.switches + 2);
+        EXPECT_GT(b.run_us + b.wait_us, a.run_us + a.wait_us);
+
+        // nothing else runs while the coroutine sleeps, the scheduler blocks in epoll
+        if (FLG_co_busy_poll_us == 0) EXPECT_GT(b.blocking_waits, a.blocking_waits);
+    }
+
+    DEF_case(stack_profile) {
+        co::Sched* s = co::scheds()[0];
+        FLG_co_stack_profile = true;
+        const co::stack_stats a = s->stack_profile();
+
+        // more coroutines than stacks, some of them must share a stack
+        const int n = FLG_co_stack_num * 2 + 1;
+        co::wait_group wg(n);
+        for (int i = 0; i < n; ++i) {
+            s->go([wg]() {
+                co::sleep(1);
+                wg.done();
+            });
+        }
+        wg.wait();
+        FLG_co_stack_profile = false;
+
+        // dedicated stacks are never saved
+        const co::stack_stats b = s->stack_profile();
+        if (!FLG_co_dedicated_stack) {
+            EXPECT_GT(b.saves, a.saves);
+            EXPECT_GT(b.max_bytes, 0);
+            EXPECT(!b.sites.empty());
+        }
+        uint64_t total = 0;
+        for (int i = 0; i < 16; ++i) total += b.hist[i];
+        EXPECT_EQ(total, b.saves);
+        EXPECT_GE(co::stack_profile().saves, b.saves);
+    }
+
+    DEF_case(stack_policy) {
+        co::Sched* s = co::scheds()[0];
+        const fastring policy = co::stack_policy();
+        EXPECT(!co::set_stack_policy("xxx"));
+        EXPECT_EQ(fastring(co::stack_policy()), policy);
+        EXPECT(co::set_stack_policy("lru"));
+        EXPECT_EQ(fastring(co::stack_policy()), "lru");
+
+        if (!FLG_co_dedicated_stack) {
+            // coroutines never suspended do not collide with others
+            uint64_t c = s->stats().stack_collisions;
+            const int n = FLG_co_stack_num * 4;
+            co::wait_group wg(n);
+            for (int i = 0; i < n; ++i) {
+                s->go([wg]() { wg.done(); });
+            }
+            wg.wait();
+            EXPECT_EQ(s->stats().stack_collisions, c);
+
+            // two coroutines switching to each other are bound to different stacks
+            co::event a, b;
+            c = s->stats().stack_collisions;
+            wg.add(2);
+            s->go([wg, a, b]() {
+                for (int i = 0; i < 100; ++i) {
+                    b.signal();
+                    a.wait();
+                }
+                wg.done();
+            });
+            s->go([wg, a, b]() {
+                for (int i = 0; i < 100; ++i) {
+                    b.wait();
+                    a.signal();
+                }
+                wg.done();
+            });
+            wg.wait();
+            if (FLG_co_stack_num > 1) EXPECT_LT(s->stats().stack_collisions, c + 10);
+
+            // more coroutines than stacks suspended at the same time, a stack is
+            // saved only if the one that ran last on it has not exited
+            c = s->stats().stack_collisions;
+            const int m = FLG_co_stack_num * 2;
+            co::wait_group started(m);
+            co::event all(true, false);
+            wg.add(m);
+            for (int i = 0; i < m; ++i) {
+                s->go([wg, started, all]() {
+                    // they run in the same scheduler, no one starts between the two
+                    started.done();
+                    if (started.load() == 0) {
+                        all.signal();
+                    } else {
+                        all.wait();
+                    }
+                    co::sleep(1);
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT_GT(s->stats().stack_collisions, c);
+        }
+
+        co::set_stack_policy(policy.c_str());
+    }
+
+    DEF_case(trace) {
+        FLG_co_trace = true;
+        co::Sched* s = co::scheds()[0];
+        co::wait_group wg(1);
+        s->go([]() {});  // the ring is created in the next loop of the scheduler
+        co::sleep(5);
+        s->go([wg]() {
+            co::sleep(2);
+            wg.done();
+        });
+        wg.wait();
+        co::sleep(5);
+        FLG_co_trace = false;
+
+        const fastring x = co::trace_json();
+        EXPECT(x.starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+        EXPECT(x.ends_with("]}"));
+        EXPECT(x.contains("\"name\":\"sched 0\""));
+        EXPECT(x.contains("\"name\":\"run\""));
+        EXPECT(x.contains("\"name\":\"timer\""));
+        EXPECT(x.contains("\"end\":\"exit\""));
+        json::Json j = json::parse(x);
+        EXPECT(j.is_object());
+        EXPECT(j.get("traceEvents").is_array());
+    }
+
+    DEF_case(cpu_profile) {
+        static std::atomic_bool stop;
+        stop.store(false);
+        co::wait_group wg(1);
+        go([wg]() {
+            while (!stop.load()) {}
+            wg.done();
+        });
+        const fastring x = co::cpu_profile(200, 1000);
+        stop.store(true);
+        wg.wait();
+#ifndef _WIN32
+        EXPECT(!x.empty());
+        EXPECT(x.contains("nanoseconds"));
+        EXPECT(x.contains("sched 0"));
+#if defined(__GNUC__)
+        EXPECT(x.contains("{lambda()#"));
+#endif
+#endif
+    }
+
+    DEF_case(trim_memory) {
+        // more coroutines than a block of the pool, blocks are freed and
+        // allocated again after the trim
+        co::Sched* s = co::scheds()[0];
+        for (int k = 0; k < 2; ++k) {
+            const int n = 10000;
+            std::atomic_int r(0);
+            co::wait_group wg(n);
+            for (int i = 0; i < n; ++i) {
+                s->go([wg, &r]() {
+                    co::sleep(1);
+                    r.fetch_add(1);
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT_EQ(r.load(), n);
+            co::trim_memory();
+            co::sleep(10);
+        }
+    }
+
+    DEF_case(active_sched_num) {
+        const int n = co::sched_num();
+        EXPECT_EQ(co::active_sched_num(), n);
+
+        co::set_active_sched_num(1);
+        EXPECT_EQ(co::active_sched_num(), 1);
+        std::atomic_int other(0);
+        co::wait_group wg(64);
+        for (int i = 0; i < 64; ++i) {
+            go([wg, &other]() {
+                if (co::sched_id() != 0) other.fetch_add(1);
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(other.load(), 0);
+
+        co::set_active_sched_num(0);
+        EXPECT_EQ(co::active_sched_num(), n);
+    }
+
+    DEF_case(semaphore) {
+        co::semaphore sem(2);
+        EXPECT_EQ(sem.count(), 2);
+        EXPECT(sem.try_acquire(2));
+        EXPECT(!sem.try_acquire());
+        EXPECT_EQ(sem.acquire(1, 1), false);
+        sem.release(2);
+
+        // at most 2 coroutines hold the semaphore at the same time
+        std::atomic_int cur(0), peak(0);
+        co::wait_group wg(16);
+        for (int i = 0; i < 16; ++i) {
+            go([&, wg]() {
+                {
+                    co::semaphore_guard g(sem);
+                    const int x = cur.fetch_add(1) + 1;
+                    int p = peak.load();
+                    while (x > p && !peak.compare_exchange_weak(p, x));
+                    co::sleep(1);
+                    cur.fetch_sub(1);
+                }
+                wg.done();  // after the semaphore was released
+            });
+        }
+        wg.wait();
+        EXPECT_LE(peak.load(), 2);
+        EXPECT_EQ(sem.count(), 2);
+
+        // a batch acquire waits for enough units, and serves in FIFO order
+        sem.acquire(2);
+        co::wait_group wg2(1);
+        go([&sem, wg2]() {
+            sem.acquire(2);
+            sem.release(2);
+            wg2.done();
+        });
+        co::sleep(5);
+        EXPECT_EQ(wg2.load(), 1);
+        sem.release(1);
+        co::sleep(5);
+        EXPECT_EQ(wg2.load(), 1);
+        EXPECT(!sem.try_acquire(1));  // the batch waiter is ahead
+        sem.release(1);
+        wg2.wait();
+        EXPECT_EQ(sem.count(), 2);
+    }
+
+    DEF_case(rate_limiter) {
+        co::rate_limiter rl(1000, 1);
+        EXPECT(rl.try_acquire());
+        EXPECT(!rl.try_acquire());
+
+        co::Timer t;
+        for (int i = 0; i < 20; ++i) rl.acquire();
+        EXPECT_GE(t.ms(), 18);
+        EXPECT_EQ(rl.acquire(100, 10), false);
+        EXPECT(rl.acquire(5, 10));
+
+        // tokens are saved up to the size of the bucket
+        rl.set_rate(1000, 10);
+        co::sleep(20);
+        EXPECT(rl.try_acquire(10));
+        EXPECT(!rl.try_acquire(1));
+    }
+
+    DEF_case(future) {
+        auto a = co::async([]() { return 3; });
+        auto b = co::async([]() { co::sleep(5); return fastring("xx"); });
+        EXPECT_EQ(a.get(), 3);
+        EXPECT_EQ(b.get(), "xx");
+        EXPECT(b.ready());
+
+        // waited in a coroutine, and a copy shares the value
+        int n = 0, m = 0;
+        auto c = co::async([&n]() { co::sleep(2); n = 7; });
+        co::wait_group wg(1);
+        go([c, &n, &m, wg]() {
+            co::future<void> d(c);
+            d.wait();
+            m = n;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(m, 7);
+
+        co::promise<int> p;
+        auto f = p.get_future();
+        EXPECT(!f.wait(1));
+        go([&p]() { co::sleep(2); p.set_value(11); });
+        EXPECT(f.wait(1000));
+        EXPECT_EQ(f.get(), 11);
+
+        auto x = co::async([]() { co::sleep(50); return 1; });
+        auto y = co::async([]() { return 2; });
+        EXPECT_EQ(co::when_any(x, y), 1);
+        co::when_all(x, y);
+        EXPECT(x.ready());
+
+        co::vector<co::future<int>> v(4);
+        for (int i = 0; i < 4; ++i) {
+            v.push_back(co::async([i]() { co::sleep(i == 2 ? 1 : 100); return i; }));
+        }
+        EXPECT_EQ(co::when_any(v), 2);
+        co::vector<co::future<int>> v2(1);
+        v2.push_back(co::promise<int>().get_future());
+        EXPECT_EQ(co::when_any(v2, 1), -1);
+        co::when_all(v);
+        EXPECT_EQ(v[3].get(), 3);
+
+        // set by a thread, while coroutines sharing the stack of the waiter
+        // have overwritten it
+        co::promise<int> q;
+        auto g = q.get_future();
+        auto s = co::next_sched();
+        int u = 0;
+        wg.add(1);
+        s->go([g, &u, wg]() {
+            u = g.get();
+            wg.done();
+        });
+        co::wait_group wg2(32);
+        for (int i = 0; i < 32; ++i) {
+            s->go([wg2]() {
+                volatile char buf[16 * 1024];
+                for (size_t k = 0; k < sizeof(buf); ++k) buf[k] = (char)0xcc;
+                co::sleep(1);
+                wg2.done();
+            });
+        }
+        wg2.wait();
+        std::thread([&q]() { q.set_value(23); }).join();
+        wg.wait();
+        EXPECT_EQ(u, 23);
+    }
+
+    DEF_case(parallel) {
+        co::vector<int> v(1000, 0);
+        int* const p = v.data();
+        co::parallel_for(0, 1000, 7, [p](size_t i) { p[i] = (int)i + 1; });
+        bool ok = true;
+        for (int i = 0; i < 1000; ++i) ok = ok && p[i] == i + 1;
+        EXPECT(ok);
+
+        auto sum = [](int64_t a, int64_t b) { return a + b; };
+        auto id = [](size_t i) { return (int64_t)i; };
+        EXPECT_EQ(co::parallel_reduce(0, 1000, 16, (int64_t)0, id, sum), 499500);
+        EXPECT_EQ(co::parallel_reduce(5, 5, 16, (int64_t)7, id, sum), 7);
+
+        // chunks are reduced in order
+        auto cat = [](fastring a, const fastring& b) { return a.append(b); };
+        auto chr = [](size_t i) { return fastring(1, (char)('a' + i)); };
+        EXPECT_EQ(co::parallel_reduce(0, 26, 3, fastring(), chr, cat), "abcdefghijklmnopqrstuvwxyz");
+
+        std::atomic<int64_t> r(0);
+        co::wait_group wg(1);
+        go([&r, wg, id, sum]() {
+            r = co::parallel_reduce(0, 100, 1, (int64_t)0, id, sum);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(r.load(), 4950);
+    }
+}
+
+#if defined(__cpp_impl_coroutine)
+co::task<int> add_later(int a, int b) {
+    co_await co::yield_now();
+    co_return a + b;
+}
+
+co::task<void> sum_to(int n, int& res, co::wait_group wg) {
+    int s = 0;
+    for (int i = 1; i <= n; ++i) s = co_await add_later(s, i);
+    co_await co::sleep_for(1);
+    auto f = co::async([]() { return 3; });
+    s += co_await f;
+    auto g = []() { co::sleep(1); return 4; };
+    s += co_await co::stackful(g);
+    res = s;
+    wg.done();
+}
+
+DEF_test(co_await) {
+    DEF_case(task) {
+        int res = 0;
+        co::wait_group wg(1);
+        co::spawn(sum_to(100, res, wg));
+        wg.wait();
+        EXPECT_EQ(res, 5057);
+    }
 }
+#endif
 
 }  // namespace test
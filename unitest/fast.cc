@@ -115,6 +115,24 @@ DEF_test(fast) {
         }
     }
 
+    DEF_case(format_ints) {
+        fast::stream s;
+        int64_t a[] = {1, -2, 0, INT64_MIN, INT64_MAX};
+        fast::format_ints(a, 5, ',', s);
+        EXPECT_EQ(fastring(s.data(), s.size()),
+                  "1,-2,0,-9223372036854775808,9223372036854775807");
+
+        uint64_t b[] = {UINT64_MAX, 10000};
+        s.clear();
+        fast::format_ints(b, 2, ' ', s);
+        fast::format_ints(b, 0, ' ', s);
+        EXPECT_EQ(fastring(s.data(), s.size()), "18446744073709551615 10000");
+
+        uint16_t c[] = {65535};
+        fast::format_ints(c, 1, ' ', s);
+        EXPECT_EQ(fastring(s.data(), s.size()), "18446744073709551615 1000065535");
+    }
+
     DEF_case(dtoa) {
         EXPECT_EQ(fastring(buf, fast::dtoa(0.0, buf)), "0.0");
         EXPECT_EQ(fastring(buf, fast::dtoa(0.00, buf)), "0.0");
@@ -1,6 +1,7 @@
 #include "co/fastream.h"
 
 #include "co/def.h"
+#include "co/str.h"
 #include "co/unitest.h"
 
 namespace test {
@@ -141,6 +142,12 @@ DEF_test(fastream) {
         fs.clear();
         fs << dp::_n(d, 4);
         EXPECT_EQ(fs.str(), "3.1415");
+
+        // all the digits are written before truncation, they must fit in the buffer
+        fastring s(1);
+        s << dp::_2(-1.2345678901234567e-300);
+        EXPECT_EQ(s, "-1.23e-300");
+        EXPECT_GE(s.capacity(), 25);
     }
 
     DEF_case(string) {
@@ -226,6 +233,40 @@ DEF_test(fastream) {
         EXPECT_EQ(fs.str(), "");
     }
 
+    DEF_case(fmt) {
+        fastream fs;
+        fs.fmt("{} + {} = {}", 1, 2, 3);
+        EXPECT_EQ(fs.str(), "1 + 2 = 3");
+
+        fs.clear();
+        fs.fmt("{}:{}/{}", "127.0.0.1", 7777, fastring("x"));
+        EXPECT_EQ(fs.str(), "127.0.0.1:7777/x");
+
+        fs.clear();
+        fs.fmt("{{}} {{{}}} }}", 'x');
+        EXPECT_EQ(fs.str(), "{} {x} }");
+
+        fs.clear();
+        fs.fmt("{} {} {}", true, 1.5);  // missing args
+        EXPECT_EQ(fs.str(), "true 1.5 {}");
+
+        fs.clear();
+        fs.fmt("no args", 1, 2);  // extra args
+        EXPECT_EQ(fs.str(), "no args");
+
+        fs.clear();
+        fs.fmt("{", 1);
+        EXPECT_EQ(fs.str(), "{");
+
+        const std::string s(100, 'x');
+        fs.clear();
+        fs.fmt("<{}>", s);
+        EXPECT_EQ(fs.size(), 102);
+        EXPECT_GE(fs.capacity(), 102);
+
+        EXPECT_EQ(str::format("{}-{}", "a", 23), "a-23");
+    }
+
     DEF_case(max_size) {
         fastream fs;
         fs << UINT64_MAX;
@@ -428,6 +428,25 @@ DEF_test(fastring) {
         EXPECT_EQ(s.ifind("Yy", 4), 4);
         EXPECT_EQ(fastring().ifind("xx"), s.npos);
 
+        // long enough to go through the SIMD paths
+        fastring l(std::string(100, 'a').c_str());
+        l.append("abcd").append(std::string(50, 'b').c_str()).append("abcx");
+        EXPECT_EQ(l.find("ab"), 100);
+        EXPECT_EQ(l.find("abcd"), 100);
+        EXPECT_EQ(l.find("abcx"), 154);
+        EXPECT_EQ(l.find("abcx", 155), l.npos);
+        EXPECT_EQ(l.find("ac"), l.npos);
+        EXPECT_EQ(l.find("bx"), l.npos);
+        EXPECT_EQ(l.find_first_of("dc"), 102);
+        EXPECT_EQ(l.find_first_of("xc", 103), 156);
+        EXPECT_EQ(l.find_first_of("wxyz"), 157);
+        EXPECT_EQ(l.find_first_of("wyz"), l.npos);
+        EXPECT_EQ(l.find_first_of("bcdwxyz"), 101);
+        for (size_t i = 0; i + 4 <= l.size(); i += 7) {
+            const fastring x = l.substr(i, 4);
+            EXPECT_EQ(l.find(x), std::string(l.c_str()).find(x.c_str()));
+        }
+
         EXPECT_EQ(s.find_first_of("xy"), 0);
         EXPECT_EQ(s.find_first_of("yz"), 3);
         EXPECT_EQ(s.find_first_of("xy", 2), 2);
@@ -100,6 +100,40 @@ DEF_test(flag) {
             fs::remove("ut_xxx.conf");
         }
     }
+
+    DEF_case(update) {
+        static int n = 0;  // the callback is never removed
+        EXPECT(flag::on_change("ut_int32", []() { ++n; }).empty());
+        EXPECT(!flag::on_change("ut_not_exist", []() {}).empty());
+
+        EXPECT(flag::update("ut_int32", "1k").empty());
+        EXPECT_EQ(FLG_ut_int32, 1024);
+        EXPECT_EQ(n, 1);
+        EXPECT(flag::update("ut_int32", "1024").empty());
+        EXPECT_EQ(n, 1);  // not changed
+
+        EXPECT(!flag::update("ut_int32", "xx").empty());
+        EXPECT_EQ(FLG_ut_int32, 1024);
+        EXPECT(!flag::update("ut_not_exist", "1").empty());
+        EXPECT(!flag::update("ut_string", "changed").empty());
+        EXPECT(flag::update("ut_string", FLG_ut_string).empty());
+
+        fs::fstream s("ut_xxx.conf", 'w');
+        if (s) {
+            s << "ut_int32  = 77" << '\n'
+              << "ut_double = 1.5" << '\n'
+              << "ut_xxx    = 3" << '\n';
+            s.close();
+
+            fastring e = flag::reload("ut_xxx.conf");
+            EXPECT(e.starts_with("flag not defined: ut_xxx"));
+            EXPECT_EQ(FLG_ut_int32, 77);
+            EXPECT_EQ(FLG_ut_double, 1.5);
+            EXPECT_EQ(n, 2);
+            fs::remove("ut_xxx.conf");
+        }
+        EXPECT(!flag::reload("ut_xxx.conf").empty());
+    }
 }
 
 }  // namespace test
@@ -1,5 +1,8 @@
 #include "co/fs.h"
 
+#include <mutex>
+
+#include "co/co/sock.h"  // for struct iovec
 #include "co/unitest.h"
 
 namespace test {
@@ -73,6 +76,95 @@ DEF_test(fs) {
         EXPECT_EQ(fs::fsize("xxx"), 10);
     }
 
+    DEF_case(mmap) {
+        fs::mmap_file m("xxx", fs::mmap_file::sequential | fs::mmap_file::willneed);
+        EXPECT(m);
+        EXPECT_EQ(m.size(), 10);
+        EXPECT_EQ(fastring(m.data(), m.size()), "1234567890");
+
+        fs::mmap_file x(std::move(m));
+        EXPECT(!m);
+        EXPECT_EQ(x.size(), 10);
+        EXPECT_EQ(*x.begin(), '1');
+        EXPECT_EQ(*(x.end() - 1), '0');
+        x.close();
+        EXPECT(!x);
+
+        EXPECT(!x.open("xxx_not_exist"));
+
+        fs::file f("xxempty", 'w');
+        f.close();
+        EXPECT(x.open("xxempty"));
+        EXPECT(x.empty());
+        EXPECT_EQ(fastring(x.data()), "");
+        x.close();
+        fs::remove("xxempty");
+    }
+
+    DEF_case(pread) {
+        fs::file f("xxp", 'w');
+        EXPECT_EQ(f.pwrite("world", 5, 6), 5);
+        EXPECT_EQ(f.pwrite("hello ", 6, 0), 6);
+        f.close();
+        EXPECT_EQ(fs::fsize("xxp"), 11);
+
+        EXPECT(f.open("xxp", '+'));
+        EXPECT_EQ(f.pread(5, 6), "world");
+        EXPECT_EQ(f.pread(8, 6), "world");  // past the end
+        EXPECT_EQ(f.pread(5, 0), "hello");
+        EXPECT_EQ(f.read(5), "hello");     // position not moved by pread
+        EXPECT_EQ(f.pread(4, 100), "");
+
+        char a[3], b[4];
+        struct iovec v[2];
+        v[0].iov_base = a; v[0].iov_len = 3;
+        v[1].iov_base = b; v[1].iov_len = 4;
+        EXPECT_EQ(f.preadv(v, 2, 4), 7);
+        EXPECT_EQ(fastring(a, 3), "o w");
+        EXPECT_EQ(fastring(b, 4), "orld");
+
+        v[0].iov_base = (void*)"HE"; v[0].iov_len = 2;
+        v[1].iov_base = (void*)"LLO"; v[1].iov_len = 3;
+        EXPECT_EQ(f.pwritev(v, 2, 0), 5);
+        EXPECT_EQ(f.pread(11, 0), "HELLO world");
+        f.close();
+        fs::remove("xxp");
+    }
+
+    DEF_case(async_fstream) {
+        fs::async_fstream s(16);
+        EXPECT(!s);
+        s << "dropped";  // not opened
+        EXPECT(s.open("xxa", 'w'));
+        EXPECT(s);
+
+        fastream x;
+        for (int i = 0; i < 100; ++i) {
+            s << i << ',';
+            x << i << ',';
+        }
+        const fastring big(40, 'x');  // larger than the buffer
+        s << big;
+        x << big;
+        s.flush();
+        EXPECT_EQ(fs::fsize("xxa"), (int64_t)x.size());
+
+        s << "end";
+        x << "end";
+        s.close();
+        EXPECT(!s);
+
+        fs::file f("xxa", 'r');
+        EXPECT_EQ(f.read(x.size() + 8), x.str());
+        f.close();
+
+        EXPECT(s.open("xxa", 'a'));
+        s << "!";
+        s.close();
+        EXPECT_EQ(fs::fsize("xxa"), (int64_t)x.size() + 1);
+        fs::remove("xxa");
+    }
+
     DEF_case(mkdir) {
         EXPECT(fs::mkdir("xxd"));
         EXPECT(fs::exists("xxd"));
@@ -138,6 +230,45 @@ DEF_test(fs) {
     }
 #endif
 
+    DEF_case(dir) {
+        EXPECT(fs::mkdir("xxw/a/b", true));
+        EXPECT(fs::mkdir("xxw/c"));
+        for (auto p : {"xxw/x", "xxw/a/y", "xxw/a/b/z", "xxw/c/z"}) {
+            fs::file f(p, 'w');
+        }
+
+        fs::dir d("xxw");
+        int n = 0, dirs = 0;
+        for (auto it = d.begin(); it != d.end(); ++it) {
+            ++n;
+            if (it.is_dir()) ++dirs;
+            if (*it == "x") EXPECT_EQ(it.type(), fs::dir::regular);
+#ifndef _WIN32
+            EXPECT_NE(it.ino(), 0);
+#endif
+        }
+        EXPECT_EQ(n, 3);
+        EXPECT_EQ(dirs, 2);
+        d.close();
+
+        for (int t : {1, 4}) {
+            std::mutex m;
+            co::vector<fastring> v;
+            fs::walk("xxw", [&](const fastring& path, fs::dir::type_t type) {
+                std::lock_guard<std::mutex> g(m);
+                v.push_back(path);
+                return path != "xxw/c";
+            }, t);
+            EXPECT_EQ(v.size(), 6);  // xxw/c not entered
+            int z = 0;
+            for (auto& x : v) z += x.ends_with("/z");
+            EXPECT_EQ(z, 1);
+        }
+
+        EXPECT(fs::remove("xxw", true));
+        EXPECT(!fs::exists("xxw"));
+    }
+
     DEF_case(remove) {
         EXPECT(fs::remove("xxx"));
         EXPECT(fs::remove("xxx.lnk"));
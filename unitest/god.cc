@@ -85,6 +85,11 @@ DEF_test(god) {
         EXPECT_EQ((god::is_same<god::const_ref_t<int>, const int&>()), true)
         EXPECT_EQ((god::is_same<god::const_ref_t<int&&>, const int&>()), true)
         EXPECT_EQ((god::is_same<god::const_ref_t<const int&>, const int&>()), true)
+
+        EXPECT_EQ(god::is_trivially_relocatable<int>(), true);
+        EXPECT_EQ(god::is_trivially_relocatable<const fastring>(), true);
+        EXPECT_EQ(god::is_trivially_relocatable<fastream>(), true);
+        EXPECT_EQ(god::is_trivially_relocatable<std::string>(), false);
     }
 }
 
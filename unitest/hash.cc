@@ -21,11 +21,120 @@ DEF_test(hash) {
         EXPECT_EQ(base64_decode(base64_encode(s)), s);
     }
 
+    DEF_case(base64_large) {
+        fastring s;
+        for (int i = 0; i < 1000; ++i) s << (char)(i * 131 + 7);
+
+        for (size_t n = 0; n <= s.size(); n += (n < 200 ? 1 : 97)) {
+            // encode every 3 bytes alone, which is done by the scalar code
+            fastring x;
+            for (size_t i = 0; i < n; i += 3) x << base64_encode(s.data() + i, n - i < 3 ? n - i : 3);
+            EXPECT_EQ(base64_encode(s.data(), n), x);
+            EXPECT_EQ(base64_decode(x), fastring(s.data(), n));
+        }
+
+        const fastring e = base64_encode(s);
+        fastring buf(base64_decoded_size(e.size()));
+        EXPECT_EQ(base64_decode(e.data(), e.size(), (char*)buf.data()), s.size());
+        EXPECT_EQ(memcmp(buf.data(), s.data(), s.size()), 0);
+        fastring ebuf(base64_encoded_size(s.size()));
+        EXPECT_EQ(base64_encode(s.data(), s.size(), (char*)ebuf.data()), e.size());
+        EXPECT_EQ(memcmp(ebuf.data(), e.data(), e.size()), 0);
+        EXPECT_EQ(base64_decode("", 0, (char*)buf.data()), 0);
+        EXPECT_EQ(base64_decode("aGV", 3, (char*)buf.data()), (size_t)-1);
+
+        // lines of 76 characters, separated by \r\n
+        fastring l;
+        for (size_t i = 0; i < e.size(); i += 76) {
+            l.append(e.data() + i, e.size() - i < 76 ? e.size() - i : 76).append("\r\n");
+        }
+        EXPECT_EQ(base64_decode(l), s);
+
+        // invalid characters in the middle
+        const char bad[] = { '*', '=', '\n', '\x80', '\xff', '\0' };
+        for (size_t i = 0; i < sizeof(bad); ++i) {
+            fastring x(e);
+            x[333] = bad[i];
+            EXPECT_EQ(base64_decode(x), "");
+        }
+    }
+
     DEF_case(md5sum) {
         EXPECT_EQ(md5sum(""), "d41d8cd98f00b204e9800998ecf8427e");
         EXPECT_EQ(md5sum("hello world"), "5eb63bbbe01eeed093cb22bb8f5acdc3");
     }
 
+    DEF_case(md5digest_n) {
+        fastring s;
+        for (int i = 0; i < 1000; ++i) s << (char)(i * 131 + 7);
+
+        // inputs of different sizes, the lanes finish at different blocks
+        const size_t k = 11;
+        const void* p[k];
+        size_t n[k];
+        char res[k][16];
+        for (size_t i = 0; i < k; ++i) {
+            p[i] = s.data() + i;
+            n[i] = i * i * 9 + (i & 1) * 55;
+        }
+        md5digest_n(k, p, n, res);
+        for (size_t i = 0; i < k; ++i) {
+            EXPECT_EQ(fastring(res[i], 16), md5digest(p[i], n[i]));
+        }
+
+        md5digest_n(1, p, n, res);
+        EXPECT_EQ(fastring(res[0], 16), md5digest("", 0));
+        md5digest_n(0, p, n, res);
+    }
+
+    DEF_case(sha1sum) {
+        EXPECT_EQ(sha1sum(""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+        EXPECT_EQ(sha1sum("abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+        EXPECT_EQ(
+            sha1sum("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+            "84983e441c3bd26ebaae4aa1f95129e5e54670f1"
+        );
+
+        // one million 'a', in pieces of different sizes
+        fastring a(1000, 'a');
+        sha1_ctx_t ctx;
+        sha1_init(&ctx);
+        for (size_t i = 0, k = 0; i < 1000000; i += k) {
+            k = (i % 997) + 1;
+            if (k > 1000000 - i) k = 1000000 - i;
+            sha1_update(&ctx, a.data(), k);
+        }
+        char res[20];
+        sha1_final(&ctx, (uint8_t*)res);
+        const fastring m(1000000, 'a');
+        EXPECT_EQ(fastring(res, 20), sha1digest(m));
+        EXPECT_EQ(sha1sum(m), "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+    }
+
+    DEF_case(sha256sum) {
+        EXPECT_EQ(sha256sum(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        EXPECT_EQ(sha256sum("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        EXPECT_EQ(
+            sha256sum("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+        );
+
+        // one million 'a', in pieces of different sizes
+        fastring a(1000, 'a');
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        for (size_t i = 0, k = 0; i < 1000000; i += k) {
+            k = (i % 997) + 1;
+            if (k > 1000000 - i) k = 1000000 - i;
+            sha256_update(&ctx, a.data(), k);
+        }
+        char res[32];
+        sha256_final(&ctx, (uint8_t*)res);
+        const fastring m(1000000, 'a');
+        EXPECT_EQ(fastring(res, 32), sha256digest(m));
+        EXPECT_EQ(sha256sum(m), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    }
+
     DEF_case(url_code) {
         EXPECT_EQ(url_encode("https://github.com/idealvin/co/xx.cc#L23"),
                   "https://github.com/idealvin/co/xx.cc#L23");
@@ -35,6 +144,35 @@ DEF_test(hash) {
         EXPECT_EQ(url_decode("http://xx.com/hello%20world"), "http://xx.com/hello world");
     }
 
+    DEF_case(url_code_large) {
+        // every byte value at every position of a 40-byte string, so that both the
+        // SIMD and the scalar code meet it; compare with encoding byte by byte.
+        fastring s(40, 'a');
+        for (int c = 0; c < 256; ++c) {
+            for (size_t i = 0; i < s.size(); i += 13) {
+                fastring t(s);
+                t[i] = (char)c;
+                fastring x;
+                for (size_t j = 0; j < t.size(); ++j) x << url_encode(t.data() + j, 1);
+                EXPECT_EQ(url_encode(t), x);
+                EXPECT_EQ(url_decode(x), t);
+            }
+        }
+
+        const fastring u("https://a.com/x?q=hello world&v=<\"x\">");
+        fastring buf(u.size() * 3);
+        const size_t n = url_encode(u.data(), u.size(), (char*)buf.data());
+        buf.resize(n);
+        EXPECT_EQ(buf, url_encode(u));
+
+        // decode in place
+        const size_t m = url_decode(buf.data(), buf.size(), (char*)buf.data());
+        EXPECT_EQ(fastring(buf.data(), m), u);
+        EXPECT_EQ(url_decode("%4", 2, (char*)buf.data()), (size_t)-1);
+        EXPECT_EQ(url_decode("%4x", 3, (char*)buf.data()), (size_t)-1);
+        EXPECT_EQ(url_decode("", 0, (char*)buf.data()), 0);
+    }
+
     DEF_case(hash) {
         if (sizeof(void*) == 8) {
             EXPECT_EQ(hash64("hello"), murmur_hash("hello", 5));
@@ -44,6 +182,43 @@ DEF_test(hash) {
 
         EXPECT_NE(crc16("hello"), 0);
     }
+
+    DEF_case(crc32c) {
+        EXPECT_EQ(crc32c("123456789"), 0xe3069283u);
+        EXPECT_EQ(crc32c(fastring(32, '\0')), 0x8a9136aau);
+        EXPECT_EQ(crc32c(fastring(32, '\xff')), 0x62a8ab43u);
+        EXPECT_EQ(crc32c("", 0), 0u);
+
+        // computed incrementally, with unaligned pieces
+        fastring s;
+        for (int i = 0; i < 300; ++i) s << (char)(i * 7);
+        const uint32_t x = crc32c(s);
+        for (size_t k = 1; k < 40; k += 3) {
+            uint32_t c = 0;
+            for (size_t i = 0; i < s.size(); i += k) {
+                c = crc32c(s.data() + i, k < s.size() - i ? k : s.size() - i, c);
+            }
+            EXPECT_EQ(c, x);
+        }
+    }
+
+    DEF_case(wyhash) {
+        EXPECT_EQ(wyhash("hello", 5), wyhash("hello", 5));
+        EXPECT_NE(wyhash("hello", 5), wyhash("hellp", 5));
+        EXPECT_NE(wyhash("hello", 5), wyhash("hello", 5, 1));
+        EXPECT_NE(wyhash("", 0), wyhash("\0", 1));
+
+        // no alignment required, and every length goes through a different path
+        fastring s(128, 'x');
+        char buf[136];
+        for (size_t n = 0; n <= 100; ++n) {
+            for (size_t o = 0; o < 8; o += 3) {
+                memcpy(buf + o, s.data(), n);
+                EXPECT_EQ(wyhash(buf + o, n), wyhash(s.data(), n));
+            }
+            if (n > 0) EXPECT_NE(wyhash(s.data(), n), wyhash(s.data(), n - 1));
+        }
+    }
 }
 
 }  // namespace test
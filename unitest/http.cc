@@ -0,0 +1,326 @@
+#include "co/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/tcp.h"
+#include "co/time.h"
+#include "co/unitest.h"
+
+#include <atomic>
+
+DEC_uint32(http_ws_max_msg_size);
+
+namespace test {
+
+#ifndef _WIN32
+// send a request without body, with extra header lines in @headers, return the
+// status of the response, or 0 on error
+static int request(tcp::Client& c, const char* method, const char* url, fastring& body,
+                   const char* headers = "") {
+    fastring s(256);
+    s << method << ' ' << url << " HTTP/1.1\r\nHost: unitest\r\n" << headers << "\r\n";
+    if (c.send(s.data(), (int)s.size()) != (int)s.size()) return 0;
+
+    char buf[1024];
+    size_t pos;
+    s.clear();
+    while ((pos = s.find("\r\n\r\n")) == s.npos) {
+        const int r = c.recv(buf, sizeof(buf));
+        if (r <= 0) return 0;
+        s.append(buf, r);
+    }
+
+    size_t n = 0;
+    const size_t x = s.find("Content-Length: ");
+    if (x != s.npos && x < pos && strcmp(method, "HEAD") != 0) n = atoi(s.data() + x + 16);
+    while (s.size() < pos + 4 + n) {
+        const int r = c.recv(buf, sizeof(buf));
+        if (r <= 0) return 0;
+        s.append(buf, r);
+    }
+    body.clear();
+    body.append(s.data() + pos + 4, n);
+    return atoi(s.data() + 9);  // HTTP/1.1 200 OK
+}
+
+// the body is the name of the route, followed by its parameters
+static http::Server::Handler route(const char* name) {
+    fastring s(name);
+    return [s](const http::Req&, http::Res& res, const http::Params& ps) {
+        fastring b(s);
+        for (int i = 0; i < ps.size(); ++i) b << ' ' << ps.name(i) << '=' << ps.value(i);
+        res.set_status(200);
+        res.set_body(b);
+    };
+}
+
+// GET @url on a new connection, return the body, or "error"
+static fastring get(const fastring& ip, const char* url, const char* headers = "") {
+    tcp::Client c(ip.c_str(), 0);
+    for (int i = 0; i < 500 && !c.connect(1000); ++i) co::sleep(1);
+    fastring body;
+    return request(c, "GET", url, body, headers) == 200 ? body : fastring("error");
+}
+
+// GET @url in a coroutine
+static fastring get_in_co(const fastring& ip, const char* url, const char* headers = "") {
+    fastring r;
+    co::wait_group wg(1);
+    go([&]() {
+        r = get(ip, url, headers);
+        wg.done();
+    });
+    wg.wait();
+    return r;
+}
+
+// a client frame, masked with a zero key, @len is the 64-bit length if it is not 0
+static fastring ws_frame(int b0, const fastring& data, uint64_t len = 0) {
+    fastring s;
+    s.append((char)b0);
+    if (len == 0 && data.size() < 126) {
+        s.append((char)(0x80 | data.size()));
+    } else {
+        if (len == 0) len = data.size();
+        s.append((char)(0x80 | 127));
+        for (int i = 56; i >= 0; i -= 8) s.append((char)(len >> i));
+    }
+    s.append(4, '\0');
+    return s.append(data);
+}
+
+// upgrade a connection to @ip, send @frames, and return the frames received till
+// the close frame, text messages are followed by ' ', the close frame is its code
+static fastring ws_run(const fastring& ip, const fastring& frames) {
+    fastring r;
+    co::wait_group wg(1);
+    go([&]() {
+        tcp::Client c(ip.c_str(), 0);
+        for (int i = 0; i < 500 && !c.connect(1000); ++i) co::sleep(1);
+        fastring s(
+            "GET /ws HTTP/1.1\r\nHost: unitest\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n");
+        s.append(frames);
+        if (c.send(s.data(), (int)s.size()) != (int)s.size()) goto end;
+
+        {
+            char buf[1024];
+            size_t pos;
+            s.clear();
+            while ((pos = s.find("\r\n\r\n")) == s.npos) {
+                const int n = c.recv(buf, sizeof(buf), 3000);
+                if (n <= 0) goto end;
+                s.append(buf, n);
+            }
+            if (atoi(s.data() + 9) != 101) goto end;
+            s.trim(pos + 4, 'l');
+
+            // server frames are small and not masked
+            while (true) {
+                while (s.size() < 2 || s.size() < 2 + (size_t)(s[1] & 0x7f)) {
+                    const int n = c.recv(buf, sizeof(buf), 3000);
+                    if (n <= 0) goto end;
+                    s.append(buf, n);
+                }
+                const size_t n = s[1] & 0x7f;
+                if ((s[0] & 0x0f) == 8) {
+                    r << (n >= 2 ? (((uint8_t)s[2] << 8) | (uint8_t)s[3]) : 0);
+                    break;
+                }
+                r.append(s.data() + 2, n).append(' ');
+                s.trim(2 + n, 'l');
+            }
+        }
+    end:
+        wg.done();
+    });
+    wg.wait();
+    return r;
+}
+#endif
+
+DEF_test(http) {
+    DEF_case(router) {
+#ifndef _WIN32
+        fastring path("/tmp/co_unitest_http_");
+        path << os::pid() << ".sock";
+        fastring ip("unix:");
+        ip << path;
+
+        http::Server serv;
+        serv.route(http::kGet, "/users", route("users"))
+            .route(http::kGet, "/users/me", route("me"))
+            .route(http::kGet, "/users/:id", route("user"))
+            .route(http::kGet, "/users/:id/files/*path", route("files"))
+            .route(http::kPost, "/users/:id", route("post"))
+            .route(http::kGet, "/a/b/c", route("abc"))
+            .route(http::kGet, "/:x/b/d", route("xbd"))
+            .route(http::kGet, "/static/*file", route("static"));
+        serv.start(ip.c_str(), 0);
+
+        co::wait_group wg(1);
+        co::vector<fastring> v(32);
+        co::vector<int> st(32);
+        go([&]() {
+            tcp::Client c(ip.c_str(), 0);
+            for (int i = 0; i < 500 && !c.connect(1000); ++i) co::sleep(1);
+            const char* reqs[][2] = {
+                {"GET", "/users"},                    // static segments
+                {"GET", "/users/me"},                 // static preferred to param
+                {"GET", "/users/7"},                  // param
+                {"GET", "//users//8/?a=1"},           // empty segments and query
+                {"POST", "/users/9"},                 // route of another method
+                {"GET", "/users/7/files/a/b.txt"},    // param and wildcard
+                {"GET", "/users/7/files"},            // empty wildcard
+                {"GET", "/a/b/c"},                    // static
+                {"GET", "/a/b/d"},                    // backtrack from "a" to ":x"
+                {"GET", "/static/css/x.css"},         // wildcard
+                {"HEAD", "/users/me"},                // HEAD uses GET routes
+                {"DELETE", "/users/7"},               // no route of the method
+                {"GET", "/nothing"},                  // no match
+                {"GET", "/a/b"},                      // no handler on the node
+                {"GET", "/users/7/x"},                // no match after param
+            };
+            for (size_t i = 0; i < sizeof(reqs) / sizeof(reqs[0]); ++i) {
+                fastring body;
+                st.push_back(request(c, reqs[i][0], reqs[i][1], body));
+                v.push_back(body);
+            }
+            wg.done();
+        });
+        wg.wait();
+        serv.exit();
+        fs::remove(path.c_str());
+
+        EXPECT_EQ(st.size(), 15);
+        if (st.size() == 15) {
+            EXPECT_EQ(st[0], 200);
+            EXPECT_EQ(v[0], "users");
+            EXPECT_EQ(v[1], "me");
+            EXPECT_EQ(v[2], "user id=7");
+            EXPECT_EQ(v[3], "user id=8");
+            EXPECT_EQ(v[4], "post id=9");
+            EXPECT_EQ(v[5], "files id=7 path=a/b.txt");
+            EXPECT_EQ(v[6], "files id=7 path=");
+            EXPECT_EQ(v[7], "abc");
+            EXPECT_EQ(v[8], "xbd x=a");
+            EXPECT_EQ(v[9], "static file=css/x.css");
+            EXPECT_EQ(st[10], 200);
+            EXPECT_EQ(v[10], "");
+            EXPECT_EQ(st[11], 405);
+            EXPECT_EQ(st[12], 404);
+            EXPECT_EQ(st[13], 404);
+            EXPECT_EQ(st[14], 404);
+        }
+#endif
+    }
+
+    DEF_case(cache) {
+#ifndef _WIN32
+        fastring path("/tmp/co_unitest_cache_");
+        path << os::pid() << ".sock";
+        fastring ip("unix:");
+        ip << path;
+        fastring path2(path + "2");
+        fastring ip2("unix:");
+        ip2 << path2;
+
+        // the body is the number of calls of the handler, a miss takes 50ms
+        std::atomic_int n{0};
+        auto f = [&n](const http::Req&, http::Res& res) {
+            const int x = ++n;
+            co::sleep(50);
+            res.set_status(200);
+            res.set_body(fastring() << x);
+        };
+        http::Server serv;
+        serv.on_req(f).cache(300, 60000);
+        serv.start(ip.c_str(), 0);
+        http::Server serv2;
+        serv2.on_req(f).cache(60000, 0, "Cookie");
+        serv2.start(ip2.c_str(), 0);
+
+        // requests for a missing entry wait for the one calling the handler
+        co::vector<fastring> v(8);
+        v.resize(8);
+        co::wait_group wg(8);
+        for (int i = 0; i < 8; ++i) {
+            go([&, i]() {
+                v[i] = get(ip, "/coalesce");
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(n.load(), 1);
+        for (int i = 0; i < 8; ++i) EXPECT_EQ(v[i], "1");
+
+        // a stale entry is served, while it is updated in the background
+        const fastring a = get_in_co(ip, "/stale");
+        EXPECT_EQ(get_in_co(ip, "/stale"), a);
+        sleep::ms(400);
+        EXPECT_EQ(get_in_co(ip, "/stale"), a);
+        sleep::ms(200);
+        const fastring b = get_in_co(ip, "/stale");
+        EXPECT_NE(b, a);
+        EXPECT_EQ(get_in_co(ip, "/stale"), b);
+
+        // requests with credentials go to the handler, unless they are in the key
+        const char* auth = "Authorization: Basic dTpw\r\n";
+        const char* cookie = "Cookie: id=1\r\n";
+        const char* cookie2 = "Cookie: id=2\r\n";
+        EXPECT_NE(get_in_co(ip, "/auth", auth), get_in_co(ip, "/auth", auth));
+        EXPECT_NE(get_in_co(ip, "/cookie", cookie), get_in_co(ip, "/cookie", cookie));
+        EXPECT_NE(get_in_co(ip2, "/auth", auth), get_in_co(ip2, "/auth", auth));
+        const fastring c1 = get_in_co(ip2, "/cookie", cookie);
+        EXPECT_EQ(get_in_co(ip2, "/cookie", cookie), c1);
+        EXPECT_NE(get_in_co(ip2, "/cookie", cookie2), c1);
+        EXPECT_EQ(get_in_co(ip2, "/cookie"), get_in_co(ip2, "/cookie"));
+
+        serv.exit();
+        serv2.exit();
+        fs::remove(path.c_str());
+        fs::remove(path2.c_str());
+#endif
+    }
+
+    // frames with lengths that overflow or are beyond the limit are rejected
+    DEF_case(websocket) {
+#ifndef _WIN32
+        fastring path("/tmp/co_unitest_ws_");
+        path << os::pid() << ".sock";
+        fastring ip("unix:");
+        ip << path;
+
+        http::Server serv;
+        serv.on_req([](const http::Req&, http::Res& res) { res.set_status(404); });
+        serv.websocket("/ws", [](const http::Req&, http::WebSocket& ws) {
+            fastring m;
+            while (ws.recv(m, 3000) > 0) ws.send(m);
+        });
+        serv.start(ip.c_str(), 0);
+
+        const fastring close(ws_frame(0x88, fastring("\x03\xe8", 2)));  // 1000
+        const fastring part(ws_frame(0x01, "0123456789"));            // text, not fin
+        const size_t max = FLG_http_ws_max_msg_size;
+
+        EXPECT_EQ(ws_run(ip, ws_frame(0x81, "hi") + part + ws_frame(0x80, "ab") + close),
+                  "hi 0123456789ab 1000");
+        EXPECT_EQ(ws_run(ip, ws_frame(0x81, "", 1ull << 63)), "1002");
+        EXPECT_EQ(ws_run(ip, ws_frame(0x81, "", ~0ull)), "1002");
+        EXPECT_EQ(ws_run(ip, ws_frame(0x81, "", 1ull << 40)), "1009");
+        EXPECT_EQ(ws_run(ip, ws_frame(0x81, "", max + 1)), "1009");
+
+        // the continuation wraps the total size around to 0 with the old check
+        EXPECT_EQ(ws_run(ip, part + ws_frame(0x80, "", (uint64_t)0 - 10)), "1002");
+        EXPECT_EQ(ws_run(ip, part + ws_frame(0x80, "", max - 9)), "1009");
+        EXPECT_EQ(ws_run(ip, part + ws_frame(0x80, "", (1ull << 63) - 5)), "1009");
+
+        serv.exit();
+        fs::remove(path.c_str());
+#endif
+    }
+}
+
+}  // namespace test
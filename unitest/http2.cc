@@ -0,0 +1,296 @@
+#include "co/http.h"
+#include "co/co.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/tcp.h"
+#include "co/unitest.h"
+
+DEC_uint32(http_max_body_size);
+
+namespace test {
+
+#ifndef _WIN32
+// A minimal HTTP/2 client with prior knowledge. It does not decode the response
+// header, the status is taken from the first field, which the server always sends
+// as an indexed :status of the static table when it is there.
+class h2_client {
+  public:
+    struct result {
+        result() : status(0), done(false) {}
+        int status;
+        bool done;
+        fastring body;
+    };
+
+    explicit h2_client(tcp::Client& c)
+        : _c(c), _pos(0), _window(65535), _init_window(65535), _stream_window(0) {}
+
+    bool start() {
+        fastring s("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+        put_frame(s, 0, 4, 0, 0);  // SETTINGS
+        return this->send(s);
+    }
+
+    // send a request with the header block @hb, and a body of @n bytes if n > 0
+    bool request(uint32_t id, const fastring& hb, size_t n = 0) {
+        fastring s;
+        put_frame(s, (uint32_t)hb.size(), 1, n > 0 ? 0x04 : 0x05, id);  // HEADERS
+        s << hb;
+        if (!this->send(s)) return false;
+
+        _stream_window = _init_window;
+        const fastring data(16384, 'x');
+        while (n > 0) {
+            size_t x = n < data.size() ? n : data.size();
+            if ((int64_t)x > _window) x = (size_t)_window;
+            if ((int64_t)x > _stream_window) x = (size_t)_stream_window;
+            if (x == 0) {
+                if (!this->next()) return false;  // wait for WINDOW_UPDATE
+                continue;
+            }
+            n -= x;
+            s.clear();
+            put_frame(s, (uint32_t)x, 0, n == 0 ? 0x01 : 0, id);  // DATA
+            s.append(data.data(), x);
+            if (!this->send(s)) return false;
+            _window -= x;
+            _stream_window -= x;
+        }
+        return true;
+    }
+
+    // read frames until the response on stream @id is complete
+    const result* response(uint32_t id) {
+        while (!this->res(id).done) {
+            if (!this->next()) return 0;
+        }
+        return &this->res(id);
+    }
+
+  private:
+    static void put_frame(fastring& s, uint32_t len, uint8_t type, uint8_t flags, uint32_t id) {
+        const char h[9] = {
+            (char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+            (char)(id >> 24),  (char)(id >> 16), (char)(id >> 8), (char)id,
+        };
+        s.append(h, 9);
+    }
+
+    static uint32_t get_u32(const char* p) {
+        const uint8_t* b = (const uint8_t*)p;
+        return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+    }
+
+    bool send(const fastring& s) { return _c.send(s.data(), (int)s.size()) == (int)s.size(); }
+
+    bool recv(size_t n) {
+        if (_in.size() - _pos >= n) return true;
+        _in.trim(_pos, 'l');
+        _pos = 0;
+        char buf[16384];
+        while (_in.size() < n) {
+            const int r = _c.recv(buf, sizeof(buf), 3000);
+            if (r <= 0) return false;
+            _in.append(buf, r);
+        }
+        return true;
+    }
+
+    result& res(uint32_t id) {
+        if (_res.size() <= id) _res.resize(id + 1);
+        return _res[id];
+    }
+
+    // read and handle a frame
+    bool next() {
+        if (!this->recv(9)) return false;
+        const uint8_t* h = (const uint8_t*)_in.data() + _pos;
+        const uint32_t len = ((uint32_t)h[0] << 16) | ((uint32_t)h[1] << 8) | h[2];
+        const uint8_t type = h[3], flags = h[4];
+        const uint32_t id = get_u32((const char*)h + 5) & 0x7fffffff;
+        if (!this->recv(9 + len)) return false;
+        const char* p = _in.data() + _pos + 9;
+        _pos += 9 + len;
+
+        switch (type) {
+            case 0:  // DATA
+                this->res(id).body.append(p, len);
+                break;
+            case 1: {  // HEADERS
+                static const int st[] = {200, 204, 206, 304, 400, 404, 500};
+                const int i = len > 0 ? (uint8_t)p[0] - 0x80 : 0;
+                this->res(id).status = i >= 8 && i <= 14 ? st[i - 8] : -1;
+                break;
+            }
+            case 3:  // RST_STREAM
+            case 7:  // GOAWAY
+                return false;
+            case 4:  // SETTINGS
+                if (flags & 0x01) return true;
+                for (uint32_t i = 0; i + 6 <= len; i += 6) {
+                    if (p[i] == 0 && p[i + 1] == 4) {
+                        const int64_t v = get_u32(p + i + 2);
+                        _stream_window += v - _init_window;
+                        _init_window = v;
+                    }
+                }
+                {
+                    fastring s;
+                    put_frame(s, 0, 4, 0x01, 0);
+                    if (!this->send(s)) return false;
+                }
+                break;
+            case 8: {  // WINDOW_UPDATE
+                const uint32_t x = get_u32(p) & 0x7fffffff;
+                (id == 0 ? _window : _stream_window) += x;
+                break;
+            }
+            default:
+                break;
+        }
+        if ((type == 0 || type == 1) && (flags & 0x01)) this->res(id).done = true;
+        return true;
+    }
+
+    tcp::Client& _c;
+    fastring _in;
+    size_t _pos;
+    int64_t _window;
+    int64_t _init_window;
+    int64_t _stream_window;  // send window of the current request
+    co::vector<result> _res;
+};
+
+// connect an h2_client to @ip, and call @f with it in a coroutine
+template <typename F>
+static void h2_run(const fastring& ip, F&& f) {
+    co::wait_group wg(1);
+    go([&]() {
+        tcp::Client c(ip.c_str(), 0);
+        for (int i = 0; i < 500 && !c.connect(1000); ++i) co::sleep(1);
+        h2_client h(c);
+        if (h.start()) f(h);
+        wg.done();
+    });
+    wg.wait();
+}
+
+// the header block in hex, spaces ignored
+static fastring unhex(const char* s) {
+    fastring r;
+    for (int x = -1; *s; ++s) {
+        if (*s == ' ') continue;
+        const int v = *s <= '9' ? *s - '0' : *s - 'a' + 10;
+        if (x < 0) {
+            x = v;
+        } else {
+            r.append((char)(x << 4 | v));
+            x = -1;
+        }
+    }
+    return r;
+}
+
+// literal header field without indexing, with a new name
+static fastring literal(const char* k, const char* v) {
+    fastring s;
+    s.append('\0').append((char)strlen(k)).append(k).append((char)strlen(v)).append(v);
+    return s;
+}
+#endif
+
+DEF_test(h2) {
+#ifndef _WIN32
+    fastring path("/tmp/co_unitest_http2_");
+    path << os::pid() << ".sock";
+    fastring ip("unix:");
+    ip << path;
+
+    // the body is the request line, and the values of some headers
+    http::Server serv;
+    serv.on_req([](const http::Req& req, http::Res& res) {
+        fastring b;
+        b << (req.is_method_get() ? "GET" : "POST") << ' ' << req.url() << ' '
+          << req.header("host") << ' ' << req.header("cache-control") << ' '
+          << req.header("custom-key") << ' ' << req.body_size();
+        res.set_status(200);
+        res.set_body(b);
+    });
+    serv.start(ip.c_str(), 0);
+
+    // RFC 7541 C.3 and C.4, requests sharing a dynamic table, in a connection
+    DEF_case(hpack) {
+        const char* v[][3] = {
+            {
+                "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                "8286 84be 5808 6e6f 2d63 6163 6865",
+                "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+            },
+            {
+                "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                "8286 84be 5886 a8eb 1064 9cbf",
+                "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+            },
+        };
+        for (int k = 0; k < 2; ++k) {
+            co::vector<fastring> r(3);
+            h2_run(ip, [&](h2_client& h) {
+                for (uint32_t i = 0; i < 3; ++i) {
+                    if (!h.request(i * 2 + 1, unhex(v[k][i]))) break;
+                    auto x = h.response(i * 2 + 1);
+                    if (!x) break;
+                    r.push_back(x->status == 200 ? x->body : fastring("error"));
+                }
+            });
+            EXPECT_EQ(r.size(), 3);
+            if (r.size() == 3) {
+                EXPECT_EQ(r[0], "GET / www.example.com   0");
+                EXPECT_EQ(r[1], "GET / www.example.com no-cache  0");
+                EXPECT_EQ(r[2], "GET /index.html www.example.com  custom-value 0");
+            }
+        }
+    }
+
+    DEF_case(header_name) {
+        const fastring base = unhex("8286 84");  // GET http /
+        const char* names[] = {"x-ok", "x-a\r\nx-b", "X-Up", "x:y", "x y"};
+        co::vector<int> st(8);
+        h2_run(ip, [&](h2_client& h) {
+            for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+                if (!h.request(i * 2 + 1, base + literal(names[i], "v"))) break;
+                auto x = h.response(i * 2 + 1);
+                if (!x) break;
+                st.push_back(x->status);
+            }
+        });
+        EXPECT_EQ(st.size(), 5);
+        if (st.size() == 5) {
+            EXPECT_EQ(st[0], 200);
+            EXPECT_EQ(st[1], 400);
+            EXPECT_EQ(st[2], 400);
+            EXPECT_EQ(st[3], 400);
+            EXPECT_EQ(st[4], 400);
+        }
+    }
+
+    // more data than the initial window of the connection
+    DEF_case(large_body) {
+        const uint32_t max_body = FLG_http_max_body_size;
+        FLG_http_max_body_size = 32 << 20;
+        const size_t n = (16 << 20) + 12345;
+        fastring r;
+        h2_run(ip, [&](h2_client& h) {
+            if (!h.request(1, unhex("8386 84"), n)) return;  // POST http /
+            auto x = h.response(1);
+            if (x && x->status == 200) r = x->body;
+        });
+        FLG_http_max_body_size = max_body;
+        EXPECT_EQ(r, fastring("POST /    ") << n);
+    }
+
+    serv.exit();
+    fs::remove(path.c_str());
+#endif
+}
+
+}  // namespace test
@@ -0,0 +1,81 @@
+#include "co/intern.h"
+
+#include <thread>
+
+#include "co/json.h"
+#include "co/str.h"
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(intern) {
+    DEF_case(base) {
+        fastring s("hello");
+        const co::interned a = co::intern("hello");
+        const co::interned b = co::intern(s.c_str());
+        const co::interned c = co::intern(co::strview("hello world", 5));
+        EXPECT_EQ(a.s, b.s);
+        EXPECT_EQ(a.s, c.s);
+        EXPECT_NE(a.s, (const char*)s.c_str());
+        EXPECT_EQ(a.n, 5);
+        EXPECT_EQ(a.h, b.h);
+        EXPECT_EQ(fastring(a.s), "hello");
+
+        const co::interned d = co::intern("hello2");
+        EXPECT_NE(a.s, d.s);
+        EXPECT_EQ(fastring(d.s), "hello2");
+
+        const co::interned e = co::intern("");
+        EXPECT_EQ(e.n, 0);
+        EXPECT_EQ(*e.s, '\0');
+        EXPECT_EQ(co::intern("").s, e.s);
+    }
+
+    DEF_case(grow) {
+        const size_t n = co::interned_count();
+        co::vector<const char*> v(2048);
+        for (int i = 0; i < 2048; ++i) {
+            v.push_back(co::intern(fastring("intern.grow.") << i).s);
+        }
+        EXPECT_EQ(co::interned_count(), n + 2048);
+        bool ok = true;
+        for (int i = 0; i < 2048; ++i) {
+            const fastring s = fastring("intern.grow.") << i;
+            if (co::intern(s).s != v[i] || s != v[i]) ok = false;
+        }
+        EXPECT(ok);
+        EXPECT_EQ(co::interned_count(), n + 2048);
+    }
+
+    DEF_case(threads) {
+        const int N = 4, M = 1000;
+        co::vector<const char*> v[N];
+        co::vector<std::thread> ts(N);
+        for (int t = 0; t < N; ++t) {
+            ts.emplace_back([&v, t, M]() {
+                v[t].reserve(M);
+                for (int i = 0; i < M; ++i) {
+                    v[t].push_back(co::intern(fastring("intern.threads.") << i).s);
+                }
+            });
+        }
+        for (auto& x : ts) x.join();
+
+        bool ok = true;
+        for (int t = 1; t < N; ++t) {
+            for (int i = 0; i < M; ++i) {
+                if (v[t][i] != v[0][i]) ok = false;
+            }
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(json_key) {
+        json::Json x = json::parse(R"({"a":1,"bb":2})");
+        const json::Key k(co::intern("bb"));
+        EXPECT_EQ(k.h, json::Key::hash("bb", 2, 2166136261u));
+        EXPECT_EQ(x.get(k).as_int(), 2);
+    }
+}
+
+}  // namespace test
@@ -1,10 +1,54 @@
 ﻿#include "co/json.h"
 
+#include <algorithm>
+#include <mutex>
+
 #include "co/str.h"
 #include "co/unitest.h"
 
 namespace test {
 
+// rebuild the json text from the events
+class SaxWriter : public json::SaxHandler {
+  public:
+    bool on_null() override { return this->put("null"); }
+    bool on_bool(bool v) override { return this->put(v ? "true" : "false"); }
+    bool on_int(int64_t v) override { return this->put(str::from(v)); }
+    bool on_double(double v) override { return this->put(json::Json(v).str()); }
+    bool on_string(const char* s, size_t n) override { return this->put(json::Json(s, n).str()); }
+    bool on_key(const char* s, size_t n) override {
+        this->put(fastring("\"").append(s, n).append("\":"));
+        _sep = false;
+        return true;
+    }
+    bool on_object_begin() override { return this->open("{"); }
+    bool on_object_end() override { return this->close('}'); }
+    bool on_array_begin() override { return this->open("["); }
+    bool on_array_end() override { return this->close(']'); }
+
+    bool put(const fastring& v) {
+        if (_sep) s << ',';
+        s << v;
+        _sep = true;
+        return true;
+    }
+
+    bool open(const char* v) {
+        this->put(v);
+        _sep = false;
+        return true;
+    }
+
+    bool close(char c) {
+        s << c;
+        _sep = true;
+        return true;
+    }
+
+    fastring s;
+    bool _sep = false;
+};
+
 DEF_test(json) {
     DEF_case(null) {
         co::Json n;
@@ -333,6 +377,18 @@ DEF_test(json) {
         EXPECT_EQ(o.get("z", 1).as_int(), 2);
         EXPECT_EQ(o.get("z", 2).as_int(), 3);
         EXPECT(o.get("z", 3).is_null());
+
+        // keys that are not null-terminated
+        fastring s("xyz");
+        EXPECT_EQ(o.get(co::strview(s.data(), 1)).as_int(), 3);
+        EXPECT_EQ(o.get(co::strview(s.data() + 1, 1)).as_int(), 7);
+        EXPECT(o.get(co::strview(s.data(), 2)).is_null());
+        EXPECT_EQ(o.get(co::strview(s.data() + 2, 1), 1).as_int(), 2);
+        EXPECT(o.has_member(co::strview(s.data() + 2, 1)));
+        EXPECT(!o.has_member(co::strview(s.data(), 0)));
+        o[co::strview(s.data(), 2)] = 9;
+        EXPECT_EQ(o.get("xy").as_int(), 9);
+        EXPECT_EQ(o.get(fastring("xy")).as_int(), 9);
     }
 
     DEF_case(set) {
@@ -419,6 +475,415 @@ DEF_test(json) {
         EXPECT_EQ(c[0].as_int(), 2);
     }
 
+    DEF_case(large_object) {
+        co::Json x;
+        for (int i = 0; i < 200; ++i) x.add_member(str::from(i).c_str(), i);
+        EXPECT_EQ(x.object_size(), 200);
+        EXPECT_EQ(x.get("0").as_int(), 0);
+        EXPECT_EQ(x.get("199").as_int(), 199);
+        EXPECT(x.has_member("100"));
+        EXPECT(!x.has_member("200"));
+
+        // the first one of repeated keys is found
+        x.add_member("7", 77);
+        EXPECT_EQ(x.get("7").as_int(), 7);
+
+        x["200"] = 200;
+        x.set("201", 201);
+        EXPECT_EQ(x.object_size(), 203);
+        EXPECT_EQ(x.get("200").as_int(), 200);
+        EXPECT_EQ(x.get("201").as_int(), 201);
+
+        x.remove("0");
+        EXPECT(!x.has_member("0"));
+        EXPECT_EQ(x.get("7").as_int(), 7);
+        x.remove("7");
+        EXPECT_EQ(x.get("7").as_int(), 77);
+        x.erase("100");
+        EXPECT(!x.has_member("100"));
+        EXPECT_EQ(x.get("101").as_int(), 101);
+        EXPECT_EQ(x.get(co::strview("1019", 3)).as_int(), 101);
+        EXPECT(x.get(co::strview("999x", 3)).is_null());
+        EXPECT_EQ(x.get("201").as_int(), 201);
+
+        co::Json y = json::parse(x.str());
+        EXPECT_EQ(y.object_size(), x.object_size());
+        EXPECT_EQ(y.get("150").as_int(), 150);
+        co::Json z = x.dup();
+        EXPECT_EQ(z.get("150").as_int(), 150);
+        co::Json u;
+        EXPECT(u.unpack_from(x.pack()));
+        EXPECT_EQ(u.get("150").as_int(), 150);
+
+        for (int i = 0; i < 200; ++i) x.remove(str::from(i).c_str());
+        EXPECT_EQ(x.object_size(), 2);
+        EXPECT(!x.has_member("7"));
+        EXPECT_EQ(x.get("201").as_int(), 201);
+    }
+
+    DEF_case(key) {
+        using namespace json::literals;
+        constexpr json::Key k = "timestamp"_jk;
+        static_assert(k.n == 9 && k.h == json::Key::hash("timestamp", 9, 2166136261u), "");
+
+        for (int n : {4, 100}) {
+            co::Json x;
+            for (int i = 0; i < n; ++i) x.add_member(str::from(i).c_str(), i);
+            x.add_member("timestamp", 1700000000);
+            x.add_member("time", json::object({{"zone", "utc"}}));
+            EXPECT_EQ(x.get(k).as_int64(), 1700000000);
+            EXPECT_EQ(x.get("2"_jk).as_int(), 2);
+            EXPECT_EQ(x.get("time"_jk, "zone"_jk).as_string(), "utc");
+            EXPECT(x.has_member("time"_jk));
+            EXPECT(!x.has_member("tim"_jk));
+            EXPECT(!x.has_member("times"_jk));
+            EXPECT(x.get("timestampx"_jk).is_null());
+
+            x["time"_jk]["zone"_jk] = "cst";
+            x["date"_jk] = 7;
+            x.set("time"_jk, "dst"_jk, false);
+            EXPECT_EQ(x.get("time", "zone").as_string(), "cst");
+            EXPECT(x.get("time", "dst") == false);
+            EXPECT_EQ(x.get("date").as_int(), 7);
+            EXPECT_EQ(x.object_size(), n + 3);
+        }
+    }
+
+    DEF_case(arena) {
+        json::Arena a;
+        fastring s("{\"a\":1,\"b\":\"hello\",\"c\":[1,2.5,true,null],\"d\":{\"x\":\"y\"}}");
+        for (int k = 0; k < 3; ++k) {
+            co::Json x = json::parse(s, a);
+            EXPECT(x.is_object());
+            EXPECT_EQ(x.type(), co::Json::t_object);
+            EXPECT_EQ(x.get("a").as_int(), 1);
+            EXPECT_EQ(x.get("b").as_string(), "hello");
+            EXPECT_EQ(x.get("c").array_size(), 4);
+            EXPECT_EQ(x.get("c", 1).as_double(), 2.5);
+            EXPECT(x.get("c", 3).is_null());
+            EXPECT_EQ(x.get("d", "x").as_string(), "y");
+            EXPECT_EQ(x.str(), s);
+
+            co::Json y = x.dup();
+            EXPECT_EQ(y.str(), s);
+
+            x.get("c").push_back(3);
+            x.get("c").remove(0);
+            x.add_member("e", "e");
+            x["f"] = 6;
+            x.set("d", "x", "z");
+            x.get("c")[2] = co::Json("t");
+            x.get("c")[3] = 4;
+            x.remove("a");
+            x.erase("b");
+            EXPECT_EQ(x.str(), "{\"f\":6,\"c\":[3,2.5,\"t\",4],\"d\":{\"x\":\"z\"},\"e\":\"e\"}");
+
+            co::Json z = json::object({ {"k", x.get("e")}, {"v", 1} });
+            EXPECT_EQ(z.get("k").as_string(), "e");
+            a.clear();
+            EXPECT_EQ(y.get("d", "x").as_string(), "y");
+        }
+
+        co::Json x = json::parse("[1,", a);
+        EXPECT(x.is_null());
+        x = json::parse("{\"a\":\"\\u4e2d\"}", a);
+        EXPECT_EQ(x.get("a").as_string(), "\xe4\xb8\xad");
+    }
+
+    DEF_case(share) {
+        fastring s("{\"a\":1,\"b\":\"hello\",\"c\":[1,2.5,true,null],\"d\":{\"x\":\"y\"}}");
+        co::Json x = json::parse(s);
+        EXPECT(!x.is_shared());
+        EXPECT_EQ(&x.share(), &x);
+        EXPECT(x.is_shared());
+        EXPECT(x.get("c").is_shared());
+        EXPECT_EQ(x.str(), s);
+
+        co::Json y = x.dup();
+        EXPECT(y.is_shared());
+        EXPECT_EQ(&y.get("d"), &x.get("d"));
+
+        y["d"]["x"] = "z";
+        y["c"].push_back(3);
+        y["c"][1] = 0;
+        y.remove("a");
+        y.add_member("e", x.get("d").dup());
+        EXPECT(!y.is_shared());
+        EXPECT_EQ(y.str(), "{\"d\":{\"x\":\"z\"},\"b\":\"hello\",\"c\":[1,0,true,null,3],\"e\":{\"x\":\"y\"}}");
+        EXPECT_EQ(x.str(), s);
+
+        co::Json z = x.dup();
+        z.set("d", "x", 3);
+        z.erase("c");
+        EXPECT_EQ(z.str(), "{\"a\":1,\"b\":\"hello\",\"d\":{\"x\":3}}");
+        x.reset();
+        EXPECT_EQ(y.get("e", "x").as_string(), "y");
+        EXPECT_EQ(z.get("b").as_string(), "hello");
+
+        // the only owner modifies it in place
+        co::Json u = json::parse(s);
+        u.share();
+        u.add_member("f", 6);
+        EXPECT(!u.is_shared());
+        EXPECT_EQ(u.get("f").as_int(), 6);
+
+        json::Arena a;
+        co::Json v = json::parse(s, a);
+        v.share();
+        co::Json w = v.dup();
+        v.reset();
+        a.clear();
+        EXPECT_EQ(w.str(), s);
+    }
+
+    DEF_case(insitu) {
+        json::Arena a;
+        fastring s("{\"a\":\"xx\",\"b\":[\"y\\ty\",\"\\u4e2d\\\"\",3],\"c\":{\"d\":\"\"}}");
+        fastring t(s);
+        co::Json x = json::parse_insitu((char*)t.data(), t.size(), a);
+        EXPECT_EQ(x.str(), json::parse(s).str());
+        EXPECT_EQ(x.get("a").as_string(), "xx");
+        EXPECT_EQ(x.get("a").as_c_str(), t.data() + 6);
+        EXPECT_EQ(x.get("b", 0).as_string(), "y\ty");
+        EXPECT_EQ(x.get("b", 1).as_string(), "\xe4\xb8\xad\"");
+        EXPECT_EQ(x.get("c", "d").string_size(), 0);
+
+        x.add_member("e", x.get("a").dup());
+        x.set("a", "z");
+        EXPECT_EQ(x.get("e").as_string(), "xx");
+        EXPECT_EQ(x.get("a").as_string(), "z");
+
+        t = "\"x\\ny\"";
+        x = json::parse_insitu((char*)t.data(), t.size(), a);
+        EXPECT_EQ(x.as_string(), "x\ny");
+        t = "[\"x";
+        x = json::parse_insitu((char*)t.data(), t.size(), a);
+        EXPECT(x.is_null());
+    }
+
+    DEF_case(path) {
+        co::Json v = json::parse(
+            "{\"a\":{\"b\":[1,2,3,{\"c\":\"x\"}]},\"m/n\":1,\"m~n\":2,\"\":3,\"7\":4}");
+        EXPECT_EQ(v.at(json::Path("/a/b/3/c")).as_string(), "x");
+        EXPECT_EQ(v.at(json::Path("/a/b/1")).as_int(), 2);
+        EXPECT_EQ(v.at(json::Path("/m~1n")).as_int(), 1);
+        EXPECT_EQ(v.at(json::Path("/m~0n")).as_int(), 2);
+        EXPECT_EQ(v.at(json::Path("/")).as_int(), 3);
+        EXPECT_EQ(v.at(json::Path("/7")).as_int(), 4);
+        EXPECT_EQ(v.at(json::Path("")).str(), v.str());
+        EXPECT(v.at(json::Path("/a/b/4")).is_null());
+        EXPECT(v.at(json::Path("/a/b/01")).is_null());
+        EXPECT(v.at(json::Path("/a/b/3/c/d")).is_null());
+        EXPECT(v.at(json::Path("/a/x")).is_null());
+        EXPECT_EQ(json::Path("/a/b/3/c").size(), 4);
+        EXPECT(!json::Path("a").valid());
+        EXPECT(!json::Path("/a~2").valid());
+        EXPECT(v.at(json::Path("/a~")).is_null());
+
+        // a large object is looked up through its hash index
+        co::Json o = json::object();
+        for (int i = 0; i < 100; ++i) o.add_member(str::cat("k", i).c_str(), i);
+        json::Path p("/k77");
+        EXPECT_EQ(o.at(p).as_int(), 77);
+        EXPECT(o.at(json::Path("/k100")).is_null());
+    }
+
+    DEF_case(lazy) {
+        fastring s(
+            "{ \"a\" : {\"b\": [1, -2.5, true, null, \"x\\\"y\", {\"c\":\"}]\"}, [] ] },"
+            " \"k\\u0031\": 7, \"e\": {}, \"n\": 123 }");
+        json::Lazy x;
+        EXPECT(x.parse(s));
+        EXPECT(x.root().is_object());
+        EXPECT_EQ(x.root().size(), 4);
+        EXPECT_EQ(x.get("a", "b").size(), 7);
+        EXPECT_EQ(x.get("a", "b", 0).as_int(), 1);
+        EXPECT(x.get("a", "b", 1).is_double());
+        EXPECT_EQ(x.get("a", "b", 1).as_double(), -2.5);
+        EXPECT(x.get("a", "b", 2).as_bool());
+        EXPECT(x.get("a", "b", 3).is_null());
+        EXPECT(x.get("a", "b", 3).exists());
+        EXPECT_EQ(x.get("a", "b", 4).as_string(), "x\"y");
+        EXPECT_EQ(x.get("a", "b", 5, "c").as_string(), "}]");
+        EXPECT_EQ(x.get("a", "b", 6).size(), 0);
+        EXPECT(!x.get("a", "b", 7).exists());
+        EXPECT(!x.get("a", "c").exists());
+        EXPECT_EQ(x.get("k1").as_int(), 7);
+        EXPECT_EQ(x.get("e").size(), 0);
+        EXPECT(!x.get("e", "x").exists());
+        EXPECT_EQ(x.root()["n"].as_int(), 123);
+        EXPECT_EQ(x.get("n").raw(), "123");
+        EXPECT_EQ(x.get("a", "b", 5).raw(), "{\"c\":\"}]\"}");
+
+        co::Json v = x.get("a", "b").to_json();
+        EXPECT_EQ(v.array_size(), 7);
+        EXPECT_EQ(v[5].get("c").as_string(), "}]");
+        EXPECT_EQ(x.get("a").to_json().str(), json::parse(s).get("a").str());
+
+        EXPECT(x.parse("[]"));
+        EXPECT_EQ(x.root().size(), 0);
+        EXPECT(!x.get(0).exists());
+        EXPECT(x.parse(" 3 "));
+        EXPECT_EQ(x.root().as_int(), 3);
+        EXPECT(!x.parse("{\"a\":[1}"));
+        EXPECT(!x.root().exists());
+        EXPECT(!x.parse("[\"x]"));
+    }
+
+    DEF_case(sax) {
+        fastring s(
+            "{\"a\":[1,-2.5,true,false,null,\"x\\\"\\u4e2dy\"],"
+            " \"b\" : {\"c\":{}, \"d\":[]}, \"e\":\"\", \"f\":12345678901234}");
+        SaxWriter w;
+        EXPECT(json::sax(s, w));
+        EXPECT_EQ(w.s, json::parse(s).str());
+
+        struct Sum : json::SaxHandler {
+            bool on_int(int64_t v) override { return n += v, true; }
+            bool on_key(const char* s, size_t n) override { return !(n == 4 && memcmp(s, "stop", 4) == 0); }
+            int64_t n = 0;
+        } x;
+        EXPECT(json::sax("[1, 2, {\"a\": 3}, [4]]", x));
+        EXPECT_EQ(x.n, 10);
+        EXPECT(!json::sax("[1, {\"stop\": 3}, 4]", x));
+
+        const char* bad[] = {"{\"a\":1,}", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":1]", "[tru]", "[1", "", "1 2"};
+        for (auto b : bad) EXPECT(!json::sax(b, strlen(b), x));
+    }
+
+    DEF_case(writer) {
+        co::Json v = json::parse(
+            "{\"a\":[1,-2.5,true,null,\"x\\\"\\u4e2d\\n\"],\"b\":{\"c\":{},\"d\":[]},"
+            "\"e\":\"\",\"f\":[{\"g\":[[1]]}]}");
+        auto write = [](json::Writer& w, const co::Json& f) {
+            w.begin_object();
+            w.key("a").begin_array();
+            w.value(1).value(-2.5).value(true).null().value("x\"\xe4\xb8\xad\n");
+            w.end_array();
+            w.key("b").begin_object().key("c").begin_object().end_object();
+            w.key("d").begin_array().end_array().end_object();
+            w.member("e", "");
+            w.key("f").value(f);
+            w.end_object();
+        };
+
+        fastream s;
+        json::Writer w(s);
+        write(w, v.get("f"));
+        EXPECT_EQ(s.str(), v.str());
+
+        fastring p;
+        json::Writer x(p, true);
+        write(x, v.get("f"));
+        EXPECT_EQ(p, v.pretty());
+
+        s.clear();
+        json::Writer y(s, false, 2);
+        y.value(3.14159);
+        EXPECT_EQ(s.str(), "3.14");
+    }
+
+    DEF_case(parse_lines) {
+        fastring s;
+        for (int i = 0; i < 30000; ++i) {
+            s << "{\"i\":" << i << ",\"s\":\"" << fastring(16, 'x') << "\"}\n";
+            if (i % 1000 == 0) s << " \r\n";
+        }
+        EXPECT_GT(s.size(), 1000 * 1000);
+
+        for (int threads = 1; threads <= 8; threads <<= 3) {
+            int64_t n = 0, sum = 0;
+            std::mutex m;
+            EXPECT(json::parse_lines(s, [&](size_t pos, co::Json& v) {
+                std::lock_guard<std::mutex> g(m);
+                if (s[pos] == '{') ++n;
+                sum += v.get("i").as_int64();
+                return true;
+            }, threads));
+            EXPECT_EQ(n, 30000);
+            EXPECT_EQ(sum, 30000LL * 29999 / 2);
+
+            int64_t next = 0;
+            size_t last = 0;
+            co::Json keep;
+            EXPECT(json::parse_lines(s, [&](size_t pos, co::Json& v) {
+                if (v.get("i").as_int64() == next && (next == 0 || pos > last)) ++next;
+                last = pos;
+                if (next == 7) keep = v;
+                return true;
+            }, threads, true));
+            EXPECT_EQ(next, 30000);
+            EXPECT_EQ(keep.get("i").as_int(), 6);
+        }
+
+        const size_t m = s.find('\n', s.size() / 2) + 1;
+        fastring t = s.substr(0, m);
+        t << "{\"i\":}\n" << s.substr(m);
+        const int64_t k = (int64_t)std::count(s.data(), s.data() + m, '{');
+        int64_t next = 0;
+        EXPECT(!json::parse_lines(t, [&](size_t, co::Json& v) {
+            if (v.get("i").as_int64() == next) ++next;
+            return true;
+        }, 8, true));
+        EXPECT_EQ(next, k);
+
+        int n = 0;
+        EXPECT(!json::parse_lines(s, [&](size_t, co::Json&) { return ++n < 10; }));
+        EXPECT_EQ(n, 10);
+        EXPECT(json::parse_lines("", 0, [&](size_t, co::Json&) { return false; }, 4));
+        EXPECT(json::parse_lines("1\n\"a\"\nnull", [&](size_t, co::Json&) { return ++n > 0; }));
+        EXPECT_EQ(n, 13);
+    }
+
+    DEF_case(stream) {
+        fastring s(
+            "{\"a\":[1,-2.5e3,true,false,null,\"x\\\"\\u4e2dy\"],"
+            " \"b\" : {\"c\":{}, \"d\":[]}, \"e\":\"\", \"f\":12345678901234}");
+        const fastring r = json::parse(s).str();
+
+        // split the document at every position
+        json::StreamParser sp;
+        for (size_t i = 0; i <= s.size(); ++i) {
+            sp.reset();
+            int x = sp.feed(s.data(), i);
+            EXPECT(i == s.size() ? x == 1 : x == 0);
+            EXPECT_EQ(sp.feed(s.data() + i, s.size() - i), 1);
+            EXPECT_EQ(sp.finish(), 1);
+            EXPECT_EQ(sp.value().str(), r);
+        }
+
+        // one byte at a time
+        sp.reset();
+        for (size_t i = 0; i < s.size(); ++i) EXPECT_NE(sp.feed(s.data() + i, 1), -1);
+        EXPECT_EQ(sp.feed(" \n", 2), 1);
+        EXPECT_EQ(sp.value().str(), r);
+
+        // a number is complete at the end of the input
+        sp.reset();
+        EXPECT_EQ(sp.feed("-12", 3), 0);
+        EXPECT_EQ(sp.feed("3", 1), 0);
+        EXPECT_EQ(sp.finish(), 1);
+        EXPECT_EQ(sp.value().as_int(), -123);
+
+        sp.reset();
+        EXPECT_EQ(sp.feed("tr", 2), 0);
+        EXPECT_EQ(sp.feed("ue", 2), 0);
+        EXPECT_EQ(sp.finish(), 1);
+        EXPECT_EQ(sp.value().as_bool(), true);
+
+        const char* bad[] = {
+            "{\"a\":1,}", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":1]", "[tru]",
+            "[1.]", "[\"x\"", "{\"a\":[1,{\"b\":", "1 2", "}", "[nul]",
+        };
+        for (auto b : bad) {
+            sp.reset();
+            int x = sp.feed(b, strlen(b));
+            if (x == 0) x = sp.finish();
+            EXPECT_EQ(x, -1);
+            EXPECT(sp.value().is_null());
+        }
+    }
+
     DEF_case(iterator) {
         co::Json v;
         EXPECT(v.begin() == v.end());
@@ -483,6 +948,9 @@ DEF_test(json) {
         EXPECT_EQ(json::parse("18446744073709551614").as_int64(), UINT64_MAX - 1);
         EXPECT_EQ(json::parse("1844674407370955161").as_int64(), 1844674407370955161ULL);
         EXPECT_EQ(json::parse("-9223372036854775807").as_int64(), INT64_MIN + 1);
+        EXPECT_EQ(json::parse("12345678").as_int64(), 12345678);
+        EXPECT_EQ(json::parse("-1234567890123456").as_int64(), -1234567890123456LL);
+        EXPECT_EQ(json::parse("[90000000000000001]")[0].as_int64(), 90000000000000001LL);
 
         fastring s("12345678901234567890888");
         s.resize(3);
@@ -512,6 +980,26 @@ DEF_test(json) {
         EXPECT_EQ(json::parse("1.7976931348623157e+308").as_double(), 1.7976931348623157e+308);
         EXPECT(json::parse("18446744073709551616").is_double());  // UINT64_MAX + 1
         EXPECT(json::parse("-9223372036854775809").is_double());  // INT64_MIN - 1
+        EXPECT_EQ(json::parse("2.2250738585072011e-308").as_double(), 2.2250738585072011e-308);
+        EXPECT_EQ(json::parse("9007199254740993.0").as_double(), 9007199254740993.0);
+        EXPECT_EQ(json::parse("0.00000000123456789").as_double(), 0.00000000123456789);
+        EXPECT_EQ(json::parse("1e23").as_double(), 1e23);
+        EXPECT_EQ(json::parse("1e-400").as_double(), 0.0);
+        EXPECT(json::parse("1e400").is_null());
+        {
+            const double x = json::parse("-0.0").as_double();
+            EXPECT(x == 0 && signbit(x));
+        }
+
+        // doubles written with all decimal places are parsed back exactly
+        {
+            double d = 0.1;
+            for (int i = 0; i < 2000; ++i) {
+                const double x = (i & 1) ? d : -1 / d;
+                EXPECT_EQ(json::parse(co::Json(x).str(324)).as_double(), x);
+                d = d * 1.37 + 1e-7 * i;
+            }
+        }
 
         fastring s("1234.567");
         s.resize(6);
@@ -634,6 +1122,143 @@ DEF_test(json) {
         EXPECT(json::parse("{ \"key\" : null88 }").is_null());
         EXPECT(json::parse("{ \"key\" : abcc }").is_null());
     }
+
+    DEF_case(pack) {
+        co::Json v;
+        EXPECT_EQ(v.pack(), fastring("\xc0", 1));
+        EXPECT_EQ(co::Json(true).pack(), "\xc3");
+        EXPECT_EQ(co::Json(7).pack(), "\x07");
+        EXPECT_EQ(co::Json(-1).pack(), "\xff");
+        EXPECT_EQ(co::Json(200).pack(), "\xcc\xc8");
+        EXPECT_EQ(co::Json(-200).pack(), fastring("\xd1\xff\x38", 3));
+        EXPECT_EQ(co::Json("abc").pack(), "\xa3" "abc");
+        EXPECT_EQ(json::array().pack(), "\x90");
+        EXPECT_EQ(json::object().pack(), "\x80");
+        EXPECT_EQ(co::Json({{"a", 1}}).pack(), "\x81\xa1" "a\x01");
+
+        v = json::parse(
+            "{\"a\":[1,-2,3.5,true,null,\"xx\"],\"b\":{\"c\":70000,\"d\":-9223372036854775808},"
+            "\"e\":18446744073709551615,\"f\":[],\"g\":{}}");
+        fastring s = v.pack();
+        EXPECT_LT(s.size(), v.str().size());
+        co::Json u = json::unpack(s);
+        EXPECT_EQ(u.str(), v.str());
+
+        fastring x(300, 'x');
+        v = json::array({x, x + x, fastring(70000, 'y')});
+        u = json::unpack(v.pack());
+        EXPECT_EQ(u[0].as_string(), x);
+        EXPECT_EQ(u[1].as_string(), x + x);
+        EXPECT_EQ(u[2].string_size(), 70000);
+
+        // float32, bin
+        u = json::unpack(fastring("\x92\xca\x3f\xc0\x00\x00\xc4\x02" "ab", 10));
+        EXPECT_EQ(u.str(), "[1.5,\"ab\"]");
+
+        EXPECT(!v.unpack_from(""));
+        EXPECT(v.is_null());
+        EXPECT(!v.unpack_from("\x92\x01"));
+        EXPECT(!v.unpack_from("\xa5" "abc"));
+        EXPECT(!v.unpack_from("\x81\x01\x01"));  // non-string key
+        EXPECT(!v.unpack_from("\x01\x01"));
+        EXPECT(!v.unpack_from("\xc1"));
+        EXPECT(!v.unpack_from("\xdd\xff\xff\xff\xff\x01"));
+        EXPECT(json::unpack(fastring(1024, '\x91')).is_null());
+    }
+
+    DEF_case(mp_reader) {
+        co::Json v = json::parse("{\"a\":3,\"b\":[1,{\"c\":\"x\"}],\"d\":2.5,\"e\":null,\"f\":\"hi\"}");
+        fastring s = v.pack();
+        json::mp::Reader r(s.data(), s.size());
+        uint32_t n = 0, l = 0;
+        const char* k;
+        int32_t i = 0;
+        double d = 0;
+        fastring x;
+        EXPECT(r.read_map(n));
+        EXPECT_EQ(n, 5);
+        EXPECT(r.read_str(k, l));
+        EXPECT_EQ(fastring(k, l), "a");
+        EXPECT(r.read(d));
+        EXPECT_EQ(d, 3.0);
+        EXPECT(r.read(x));
+        EXPECT_EQ(x, "b");
+        EXPECT(r.skip());
+        EXPECT(r.read(x));
+        EXPECT_EQ(x, "d");
+        EXPECT(r.read(i));
+        EXPECT_EQ(i, 2);
+        EXPECT(r.read(x));
+        EXPECT(r.read(x));  // nil
+        EXPECT(x.empty());
+        EXPECT(r.read(x));
+        EXPECT(!r.read(i));  // "hi" is not a number
+        EXPECT(!r.done());
+
+        fastream t;
+        json::mp::pack_map(t, 1);
+        json::mp::pack(t, fastring("u"));
+        json::mp::pack(t, (uint64_t)-1);
+        EXPECT_EQ(json::unpack(t.data(), t.size()).str(), "{\"u\":-1}");  // kept as int64
+    }
+
+    DEF_case(reader) {
+        json::Reader r(" {\"a\" : 3, \"b\":[1,{\"c\":\"]}\"}], \"d\":2.5,\"e\":null, \"f\":\"h\\u4e2di\", \"g\":[]} ");
+        const char* k;
+        uint32_t l = 0;
+        int32_t i = 0;
+        double d = 0;
+        bool b = false;
+        fastring x;
+        EXPECT(r.begin_object());
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT_EQ(fastring(k, l), "a");
+        EXPECT(r.read(d));
+        EXPECT_EQ(d, 3.0);
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT(r.skip());
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT_EQ(fastring(k, l), "d");
+        EXPECT(r.read(i));
+        EXPECT_EQ(i, 2);
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT(r.begin_array());  // null
+        EXPECT_EQ(r.next(), 0);
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT(!r.read(b));  // a string is not a bool
+        EXPECT(r.read(x));
+        EXPECT_EQ(x, "h\xe4\xb8\xadi");
+        EXPECT_EQ(r.next_key(k, l), 1);
+        EXPECT(r.begin_array());
+        EXPECT_EQ(r.next(), 0);
+        EXPECT_EQ(r.next_key(k, l), 0);
+        EXPECT(r.done());
+
+        json::Reader u("[true,[1, 2] ,3]");
+        int64_t v = 0;
+        EXPECT(u.begin_array());
+        EXPECT_EQ(u.next(), 1);
+        EXPECT(u.read(b));
+        EXPECT(b);
+        EXPECT_EQ(u.next(), 1);
+        EXPECT(u.begin_array());
+        EXPECT_EQ(u.next(), 1);
+        EXPECT(u.read(v));
+        EXPECT_EQ(u.next(), 1);
+        EXPECT(u.read(v));
+        EXPECT_EQ(u.next(), 0);
+        EXPECT_EQ(u.next(), 1);
+        EXPECT(u.read(v));
+        EXPECT_EQ(v, 3);
+        EXPECT_EQ(u.next(), 0);
+        EXPECT(u.done());
+
+        json::Reader w("{\"a\":1 \"b\":2}");
+        EXPECT(w.begin_object());
+        EXPECT_EQ(w.next_key(k, l), 1);
+        EXPECT(w.read(i));
+        EXPECT_EQ(w.next_key(k, l), -1);
+    }
 }
 
 }  // namespace test
@@ -0,0 +1,69 @@
+#include "co/mem.h"
+
+#include <string.h>
+
+#include <thread>
+
+#include "co/unitest.h"
+#include "co/vector.h"
+
+namespace test {
+
+DEF_test(mem) {
+    DEF_case(small) {
+        co::vector<void*> v(1024);
+        for (size_t n = 0; n <= 2048; n += 7) {
+            char* p = (char*)co::alloc(n);
+            EXPECT(p != 0);
+            EXPECT_EQ(((size_t)p & 15), 0);
+            memset(p, 'x', n);
+            v.push_back(p);
+        }
+        for (size_t i = 0; i < v.size(); ++i) co::free(v[i]);
+        co::free(0);
+    }
+
+    DEF_case(reuse) {
+        void* p = co::alloc(48);
+        co::free(p);
+        void* q = co::alloc(40);
+        EXPECT_EQ(p, q);
+        co::free(q);
+    }
+
+    DEF_case(realloc) {
+        char* p = (char*)co::realloc(0, 10);
+        memcpy(p, "hello", 6);
+        p = (char*)co::realloc(p, 12);
+        EXPECT_EQ(fastring(p), "hello");
+        p = (char*)co::realloc(p, 1000);
+        EXPECT_EQ(fastring(p), "hello");
+        p = (char*)co::realloc(p, 100000);
+        EXPECT_EQ(fastring(p), "hello");
+        co::free(p);
+    }
+
+    DEF_case(malloc) {
+        void* p = ::malloc(32);
+        co::free(p);
+        p = ::malloc(32);
+        p = co::realloc(p, 64);
+        co::free(p);
+    }
+
+    DEF_case(remote) {
+        co::vector<void*> v(20000);
+        for (int i = 0; i < 20000; ++i) v.push_back(co::alloc(64));
+        std::thread t([&v]() {
+            for (size_t i = 0; i < v.size(); ++i) co::free(v[i]);
+        });
+        t.join();
+        v.clear();
+
+        // blocks freed by the other thread are reused here
+        for (int i = 0; i < 20000; ++i) v.push_back(co::alloc(64));
+        for (size_t i = 0; i < v.size(); ++i) co::free(v[i]);
+    }
+}
+
+}  // namespace test
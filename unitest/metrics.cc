@@ -0,0 +1,84 @@
+#include "co/metrics.h"
+
+#include "co/co.h"
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(metrics) {
+    DEF_case(counter) {
+        co::metrics::counter c("test_counter_total", "a counter for test");
+        EXPECT_EQ(c.value(), 0);
+        c.inc();
+        c.inc(2);
+        EXPECT_EQ(c.value(), 3);
+
+        co::wait_group wg(8);
+        for (int i = 0; i < 8; ++i) {
+            go([&c, wg]() {
+                for (int k = 0; k < 1000; ++k) c.inc();
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(c.value(), 8003);
+    }
+
+    DEF_case(gauge) {
+        co::metrics::gauge g("test_gauge", "a gauge for test");
+        g.set(5);
+        g.add(3);
+        g.sub(10);
+        EXPECT_EQ(g.value(), -2);
+    }
+
+    DEF_case(histogram) {
+        typedef co::metrics::histogram H;
+        EXPECT_EQ(H::bucket(0), 0);
+        EXPECT_EQ(H::bucket(1), 0);
+        EXPECT_EQ(H::bucket(8), 7);
+        EXPECT_EQ(H::bucket(9), 8);
+        EXPECT_EQ(H::upper(H::bucket(9)), 9);
+        EXPECT_EQ(H::upper(H::bucket(16)), 16);
+        EXPECT_EQ(H::upper(H::bucket(17)), 18);
+        EXPECT_EQ(H::upper(H::bucket(1000)), 1024);
+        EXPECT_EQ(H::upper(H::bucket(1025)), 1152);
+
+        H h("test_latency_us", "a histogram for test");
+        EXPECT_EQ(h.percentile(0.5), 0);
+        for (uint64_t i = 1; i <= 1000; ++i) h.observe(i);
+        EXPECT_EQ(h.count(), 1000);
+        EXPECT_EQ(h.sum(), 500500);
+        const uint64_t p50 = h.percentile(0.5);
+        const uint64_t p99 = h.percentile(0.99);
+        EXPECT(500 <= p50 && p50 <= 500 * 9 / 8);
+        EXPECT(990 <= p99 && p99 <= 990 * 9 / 8);
+        EXPECT_EQ(h.percentile(1), 1024);
+    }
+
+    DEF_case(text) {
+        co::metrics::counter a("test_req_total{code=\"200\"}", "requests");
+        co::metrics::counter b("test_req_total{code=\"500\"}", "requests");
+        co::metrics::histogram h("test_us{api=\"x\"}", "latency");
+        a.inc(2);
+        b.inc();
+        h.observe(3);
+        h.observe(100);
+
+        const fastring s = co::metrics::text();
+        EXPECT(s.contains("# HELP test_req_total requests\n# TYPE test_req_total counter\n"
+                          "test_req_total{code=\"200\"} 2\ntest_req_total{code=\"500\"} 1\n"));
+        EXPECT(s.contains("# TYPE test_us histogram\n"));
+        EXPECT(s.contains("test_us_bucket{api=\"x\",le=\"2\"} 0\n"));
+        EXPECT(s.contains("test_us_bucket{api=\"x\",le=\"4\"} 1\n"));
+        EXPECT(s.contains("test_us_bucket{api=\"x\",le=\"128\"} 2\n"));
+        EXPECT(s.contains("test_us_bucket{api=\"x\",le=\"+Inf\"} 2\n"));
+        EXPECT(s.contains("test_us_sum{api=\"x\"} 103\n"));
+        EXPECT(s.contains("test_us_count{api=\"x\"} 2\n"));
+        EXPECT(!s.contains("le=\"256\""));
+        EXPECT(s.contains("co_sched_switches_total{sched=\"0\"} "));
+        EXPECT(s.contains("# TYPE co_blocking_done_total counter\n"));
+    }
+}
+
+}  // namespace test
@@ -29,6 +29,19 @@ DEF_test(os) {
     DEF_case(pid) { EXPECT_GE(os::pid(), 0); }
 
     DEF_case(cpunum) { EXPECT_GT(os::cpunum(), 0); }
+
+    DEF_case(topology) {
+        const os::topology_t& t = os::topology();
+        EXPECT_EQ(t.cpus, os::cpunum());
+        EXPECT_GT(t.cores, 0);
+        EXPECT_LE(t.cores, t.cpus);
+        EXPECT_GE(t.smt, 1);
+        EXPECT_GE(t.numa_nodes, 1);
+        EXPECT_GE(t.cpu_quota, 0.0);
+        EXPECT_GT(t.cpu_limit, 0);
+        EXPECT_LE(t.cpu_limit, t.cpus);
+        EXPECT_EQ(&t, &os::topology());
+    }
 }
 
 }  // namespace test
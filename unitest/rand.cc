@@ -40,6 +40,22 @@ DEF_test(rand) {
     s = co::randstr("0-2", 8);
     EXPECT(s.contains('0') || s.contains('1') || s.contains('2'));
     EXPECT(!s.contains('a') && !s.contains('b') && !s.contains('3'));
+
+    s = co::randstr("0-9", 2000);
+    int c[10] = {0};
+    for (size_t i = 0; i < s.size(); ++i) ++c[s[i] - '0'];
+    for (int i = 0; i < 10; ++i) EXPECT(100 < c[i] && c[i] < 300);
+
+    for (int i = 0; i < 1000; ++i) {
+        const uint32_t r = co::rand();
+        if (r == 0 || r >= 2147483647u) EXPECT(false);
+    }
+    EXPECT_NE(co::rand64(), co::rand64());
+
+    char b[13] = {0};
+    co::rand_bytes(b, 12);
+    EXPECT_EQ(b[12], '\0');
+    EXPECT_NE(fastring(b, 12), fastring(12, '\0'));
 }
 
 }  // namespace test
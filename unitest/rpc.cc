@@ -0,0 +1,75 @@
+#include "co/rpc.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/os.h"
+#include "co/unitest.h"
+
+#include <memory>
+
+DEC_uint32(shm_ring_size);
+
+namespace test {
+
+#ifdef __linux__
+class EchoService : public rpc::Service {
+  public:
+    EchoService() {
+        _methods["Echo.echo"] = [](json::Json& req, json::Json& res) {
+            res.add_member("result", req.get("params"));
+        };
+    }
+
+    virtual ~EchoService() = default;
+
+    virtual const char* name() const { return "Echo"; }
+
+    virtual const co::map<const char*, Fun>& methods() const { return _methods; }
+
+  private:
+    co::map<const char*, Fun> _methods;
+};
+#endif
+
+DEF_test(rpc) {
+    // rpc on shared memory rings, with messages larger than the rings
+    DEF_case(shm) {
+#ifdef __linux__
+        const uint32_t ring_size = FLG_shm_ring_size;
+        FLG_shm_ring_size = 4096;
+        fastring ip("shm:co_unitest_rpc_");
+        ip << os::pid();
+
+        rpc::Server serv;
+        serv.add_service(new EchoService).start(ip.c_str(), 0);
+
+        const size_t sizes[] = {1, 100, 4096, 100000};
+        co::vector<fastring> v(8);
+        co::wait_group wg(1);
+        go([&]() {
+            // the client is not on the shared stack of the coroutine
+            std::unique_ptr<rpc::Client> c(new rpc::Client(ip.c_str(), 0));
+            for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+                json::Json req({{"api", "Echo.echo"}, {"params", fastring(sizes[i], 'a' + i)}});
+                json::Json res;
+                for (int k = 0; k < 500 && res.is_null(); ++k) {
+                    c->call(req, res);
+                    if (res.is_null()) co::sleep(1);
+                }
+                v.push_back(res.get("result").as_string());
+            }
+            c->close();
+            wg.done();
+        });
+        wg.wait();
+        serv.exit();
+        FLG_shm_ring_size = ring_size;
+
+        EXPECT_EQ(v.size(), 4);
+        for (size_t i = 0; i < v.size(); ++i) {
+            EXPECT_EQ(v[i], fastring(sizes[i], 'a' + i));
+        }
+#endif
+    }
+}
+
+}  // namespace test
@@ -0,0 +1,95 @@
+#include "co/small_string.h"
+
+#include "co/stl.h"
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(small_string) {
+    DEF_case(base) {
+        co::small_string s;
+        EXPECT(s.empty());
+        EXPECT(s.is_inline());
+        EXPECT_EQ(s.capacity(), co::small_string::N);
+        EXPECT_EQ(fastring(s.c_str()), "");
+
+        s = "hello";
+        EXPECT_EQ(s.size(), 5);
+        EXPECT(s.is_inline());
+        EXPECT_EQ(s, "hello");
+        EXPECT_EQ(s, fastring("hello"));
+        EXPECT_EQ(fastring("hello"), s);
+        EXPECT_NE(s, "hell");
+        EXPECT(s < "hellp");
+        EXPECT(s.starts_with("he"));
+        EXPECT(s.ends_with("llo"));
+        EXPECT_EQ(s.find('l'), 2);
+        EXPECT_EQ(s.find("lo"), 3);
+        EXPECT_EQ(s.find('x'), s.npos);
+
+        co::small_string x("0123456789abcde");
+        EXPECT(x.is_inline());
+        x.append('f');
+        EXPECT(!x.is_inline());
+        EXPECT_EQ(x, "0123456789abcdef");
+        EXPECT_EQ(strlen(x.c_str()), 16);
+
+        x.append(x.data(), 8);  // append part of itself
+        EXPECT_EQ(x, "0123456789abcdef01234567");
+
+        x.assign(x.data() + 16, 8);
+        EXPECT_EQ(x, "01234567");
+
+        x.resize(10, 'x');
+        EXPECT_EQ(x, "01234567xx");
+        x.clear();
+        EXPECT(x.empty());
+        EXPECT_EQ(fastring(x.c_str()), "");
+    }
+
+    DEF_case(copy_and_move) {
+        co::small_string a("abc");
+        co::small_string b(a);
+        EXPECT_EQ(b, "abc");
+
+        co::small_string c(std::move(a));
+        EXPECT_EQ(c, "abc");
+        EXPECT(c.is_inline());
+        EXPECT(a.empty());
+
+        co::small_string l(32, 'x');
+        const char* p = l.data();
+        co::small_string m(std::move(l));
+        EXPECT_EQ(m.data(), p);
+        EXPECT(l.empty());
+        EXPECT(l.is_inline());
+
+        b = std::move(m);
+        EXPECT_EQ(b.size(), 32);
+        EXPECT_EQ(b.data(), p);
+
+        c.swap(b);
+        EXPECT_EQ(c.size(), 32);
+        EXPECT_EQ(b, "abc");
+    }
+
+    DEF_case(fastring) {
+        co::small_string s("GET");
+        fastring x;
+        x << s.tolower() << ' ' << "/";
+        EXPECT_EQ(x, "get /");
+
+        x += s.toupper();
+        EXPECT_EQ(x, "get /GET");
+        EXPECT_EQ(s.str(), "GET");
+
+        s << fastring("/x") << '/';
+        EXPECT_EQ(s, "GET/x/");
+
+        co::hash_map<co::small_string, int> m{{"GET", 1}, {"POST", 2}};
+        EXPECT_EQ(m[co::small_string(x.data() + 5, 3)], 1);
+        EXPECT(m.find("PUT") == m.end());
+    }
+}
+
+}  // namespace test
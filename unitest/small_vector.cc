@@ -0,0 +1,102 @@
+#include "co/small_vector.h"
+
+#include <string>
+
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(small_vector) {
+    DEF_case(base) {
+        co::small_vector<int, 4> v;
+        EXPECT(v.empty());
+        EXPECT(v.is_inline());
+        EXPECT_EQ(v.capacity(), 4);
+
+        for (int i = 0; i < 4; ++i) v.push_back(i);
+        EXPECT(v.is_inline());
+        EXPECT_EQ(v.size(), 4);
+        EXPECT_EQ(v.back(), 3);
+
+        v.emplace_back(4);
+        EXPECT(!v.is_inline());
+        EXPECT_EQ(v.size(), 5);
+        EXPECT_EQ(v[0], 0);
+        EXPECT_EQ(v[4], 4);
+
+        v.push_back(v[0]);  // refers to itself
+        EXPECT_EQ(v.back(), 0);
+
+        v.remove(1);
+        EXPECT_EQ(v.size(), 5);
+        EXPECT_EQ(v[1], 0);
+        EXPECT_EQ(v.pop_back(), 4);
+        v.remove_back();
+        EXPECT_EQ(v.size(), 3);
+
+        int n = 0;
+        for (auto& x : v) n += x;
+        EXPECT_EQ(n, 2);
+
+        v.resize(8);
+        EXPECT_EQ(v.size(), 8);
+        EXPECT_EQ(v[7], 0);
+
+        v.reset();
+        EXPECT(v.empty());
+        EXPECT(v.is_inline());
+
+        co::small_vector<int, 2> u = {1, 2, 3};
+        EXPECT_EQ(u.size(), 3);
+        u.append(u.data(), 3);
+        EXPECT_EQ(u.size(), 6);
+        EXPECT_EQ(u[5], 3);
+        u.append(2, 7);
+        EXPECT_EQ(u.size(), 8);
+        EXPECT_EQ(u.back(), 7);
+    }
+
+    DEF_case(copy_and_move) {
+        co::small_vector<std::string, 2> a;
+        a.emplace_back(32, 'x');
+        co::small_vector<std::string, 2> b(a);
+        EXPECT_EQ(b.size(), 1);
+        EXPECT_EQ(b[0], std::string(32, 'x'));
+
+        co::small_vector<std::string, 2> c(std::move(a));  // inline, moved one by one
+        EXPECT(a.empty());
+        EXPECT(c.is_inline());
+        EXPECT_EQ(c[0], std::string(32, 'x'));
+
+        for (int i = 0; i < 8; ++i) c.emplace_back(c[0]);
+        const std::string* p = c.data();
+        co::small_vector<std::string, 2> d(std::move(c));  // on heap, taken over
+        EXPECT_EQ(d.data(), p);
+        EXPECT_EQ(d.size(), 9);
+        EXPECT(c.empty());
+        EXPECT(c.is_inline());
+
+        b = d;
+        EXPECT_EQ(b.size(), 9);
+        EXPECT_EQ(b[8], std::string(32, 'x'));
+
+        d.clear();
+        d.push_back("hello");
+        d.swap(b);
+        EXPECT_EQ(d.size(), 9);
+        EXPECT_EQ(b.size(), 1);
+        EXPECT_EQ(b[0], "hello");
+    }
+
+    DEF_case(relocatable) {
+        co::small_vector<fastring, 2> v;
+        v.emplace_back(32, 'x');
+        const char* p = v[0].data();
+        for (int i = 0; i < 16; ++i) v.emplace_back("xx");
+        EXPECT_EQ(v.size(), 17);
+        EXPECT_EQ(v[0].data(), p);
+        EXPECT_EQ(v[16], "xx");
+    }
+}
+
+}  // namespace test
@@ -1,5 +1,10 @@
 #include "co/stl.h"
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "co/str.h"
 #include "co/unitest.h"
 
 namespace test {
@@ -16,6 +21,24 @@ DEF_test(table) {
     EXPECT_EQ(tb[15], 0);
     EXPECT_EQ(tb[16], 0);
     EXPECT_EQ(tb[17], 17);
+
+    co::table<int> tx(2, 2, 3);  // the first 8 elements are allocated at once
+    tx[7] = 7;
+    EXPECT_EQ(tx[7], 7);
+    EXPECT_EQ(tx[15], 0);
+
+    // rows are allocated in multiple threads at the same time
+    co::table<std::atomic_int> ta(4, 8);
+    std::vector<std::thread> v;
+    for (int k = 0; k < 4; ++k) {
+        v.emplace_back([&ta]() {
+            for (size_t i = 0; i < (16 << 8); ++i) ta[i].fetch_add(1);
+        });
+    }
+    for (auto& t : v) t.join();
+    int n = 0;
+    for (size_t i = 0; i < (16 << 8); ++i) n += ta[i] == 4;
+    EXPECT_EQ(n, 16 << 8);
 }
 
 DEF_test(lru_map) {
@@ -59,6 +82,144 @@ DEF_test(lru_map) {
     auto i = x.find("hello");
     EXPECT(i != x.end());
     EXPECT_EQ(i->second, 8);
+
+    // iterated from the most recently used one
+    co::lru_map<int, int> y(3);
+    y.insert(1, 1);
+    y.insert(2, 2);
+    y.insert(3, 3);
+    y.find(1);  // 1,3,2
+    fastream s;
+    for (auto& kv : y) s << kv.first;
+    EXPECT_EQ(s.str(), "132");
+    y.insert(4, 4);  // 4,1,3
+    EXPECT(y.find(2) == y.end());
+    y.erase(3);  // 4,1
+    y.insert(5, 5);  // 5,4,1, the node of 3 is reused
+    s.clear();
+    for (auto& kv : y) s << kv.first;
+    EXPECT_EQ(s.str(), "541");
+    y.clear();
+    EXPECT(y.begin() == y.end());
+    y.insert(6, 6);
+    EXPECT_EQ(y.find(6)->second, 6);
+
+    // the node array grows, and then the oldest ones are evicted
+    co::lru_map<fastring, fastring> z(1000);
+    for (int k = 0; k < 3000; ++k) {
+        z.insert(fastring(8, (char)('a' + k % 26)) << k, fastring(32, 'x') << k);
+        if (k % 7 == 0) z.find(fastring(8, 'a') << 0);  // keep it in use
+    }
+    EXPECT_EQ(z.size(), 1000);
+    EXPECT(z.find(fastring(8, 'a') << 0) != z.end());
+    EXPECT(z.find(fastring(8, 'b') << 1) == z.end());
+    auto zi = z.find(fastring(8, (char)('a' + 2999 % 26)) << 2999);
+    EXPECT(zi != z.end());
+    EXPECT_EQ(zi->second, fastring(32, 'x') << 2999);
+}
+
+DEF_test(flat_hash_map) {
+    DEF_case(base) {
+        co::flat_hash_map<int, int> m;
+        EXPECT(m.empty());
+        EXPECT(m.begin() == m.end());
+        EXPECT(m.find(1) == m.end());
+        EXPECT_EQ(m.erase(1), 0);
+
+        m[1] = 1;
+        m[2] = 2;
+        EXPECT_EQ(m.size(), 2);
+        EXPECT_EQ(m[1], 1);
+        EXPECT_EQ(m.find(2)->second, 2);
+        EXPECT_EQ(m.count(3), 0);
+
+        auto r = m.insert(std::make_pair(1, 8));
+        EXPECT(!r.second);
+        EXPECT_EQ(r.first->second, 1);
+        r = m.emplace(3, 3);
+        EXPECT(r.second);
+        EXPECT_EQ(m.size(), 3);
+
+        EXPECT_EQ(m.erase(2), 1);
+        EXPECT(!m.contains(2));
+        EXPECT_EQ(m.size(), 2);
+
+        int n = 0;
+        for (auto& kv : m) n += kv.second;
+        EXPECT_EQ(n, 4);
+
+        co::flat_hash_map<int, int> x{{1, 1}, {2, 2}};
+        x.swap(m);
+        EXPECT_EQ(x.size(), 2);
+        EXPECT_EQ(m[2], 2);
+
+        m.clear();
+        EXPECT(m.empty());
+        EXPECT(m.begin() == m.end());
+    }
+
+    DEF_case(many) {
+        // compare with std::unordered_map while inserting and erasing
+        co::flat_hash_map<uint64_t, uint64_t> m;
+        std::unordered_map<uint64_t, uint64_t> u;
+        uint64_t x = 7;
+        bool ok = true;
+        for (int i = 0; i < 100000; ++i) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            const uint64_t k = (x >> 33) % 5000;
+            if (x & (1ull << 20)) {
+                m[k] = i;
+                u[k] = i;
+            } else {
+                if (m.erase(k) != u.erase(k)) ok = false;
+            }
+        }
+        EXPECT(ok);
+        EXPECT_EQ(m.size(), u.size());
+        for (auto& kv : u) {
+            auto it = m.find(kv.first);
+            if (it == m.end() || it->second != kv.second) ok = false;
+        }
+        EXPECT(ok);
+
+        size_t n = 0;
+        for (auto it = m.begin(); it != m.end();) {
+            it = (it->first & 1) ? m.erase(it) : ++it;
+            ++n;
+        }
+        EXPECT_EQ(n, u.size());
+        for (auto& kv : m) {
+            if (kv.first & 1) ok = false;
+        }
+        EXPECT(ok);
+    }
+
+    DEF_case(fastring) {
+        co::flat_hash_map<fastring, fastring> m(64);
+        EXPECT_GE(m.capacity(), 64);
+        for (int i = 0; i < 1000; ++i) m.emplace(str::from(i), str::from(i * 2));
+        EXPECT_EQ(m.size(), 1000);
+        EXPECT_EQ(m["999"], "1998");
+
+        auto c = m;
+        EXPECT_EQ(c.size(), 1000);
+        EXPECT_EQ(c["7"], "14");
+
+        auto d = std::move(c);
+        EXPECT(c.empty());
+        EXPECT_EQ(d.size(), 1000);
+        EXPECT_EQ(d.find("500")->second, "1000");
+
+        fastring k("hello");
+        d[std::move(k)] = "world";
+        EXPECT(k.empty());
+        EXPECT_EQ(d["hello"], "world");
+
+        co::flat_hash_map<fastring, int> x{{"a", 1}};
+        fastream s;
+        s << x;
+        EXPECT_EQ(s.str(), "{\"a\":1}");
+    }
 }
 
 DEF_test(vector) {
@@ -275,6 +436,41 @@ DEF_test(vector) {
         EXPECT_EQ(a.back(), "8888");
     }
 
+    DEF_case(relocate) {
+        co::vector<fastring> v;
+        v.emplace_back(32, 'x');
+        const char* p = v[0].data();
+        for (int i = 0; i < 100; ++i) v.emplace_back(str::from(i));
+        EXPECT_EQ(v.size(), 101);
+        EXPECT_EQ(v[0].data(), p);  // moved by realloc, the string is not copied
+        EXPECT_EQ(v[100], "99");
+
+        v.remove(0);
+        EXPECT_EQ(v.size(), 100);
+        EXPECT_EQ(v[0], "99");
+
+        // the element pushed refers to the vector itself, which grows
+        co::vector<fastring> u;
+        u.push_back(fastring(32, 'u'));
+        while (u.size() < u.capacity()) u.push_back("x");
+        u.push_back(u[0]);
+        EXPECT_EQ(u.back(), fastring(32, 'u'));
+        u.emplace_back(u.back());
+        EXPECT_EQ(u.back(), fastring(32, 'u'));
+
+        co::vector<std::string> s;
+        s.emplace_back("hello");
+        while (s.size() < s.capacity()) s.emplace_back("x");
+        s.emplace_back(s[0]);
+        EXPECT_EQ(s.back(), "hello");
+        EXPECT_EQ(s[0], "hello");
+
+        co::vector<co::vector<int>> w;
+        for (int i = 0; i < 16; ++i) w.emplace_back(co::vector<int>{i, i});
+        EXPECT_EQ(w.size(), 16);
+        EXPECT_EQ(w[15][1], 15);
+    }
+
     DEF_case(sso) {
         co::vector<std::string> v;
         for (int i = 0; i < 4; ++i) {
@@ -1,5 +1,6 @@
 #include "co/str.h"
 
+#include "co/rand.h"
 #include "co/unitest.h"
 
 namespace test {
@@ -58,6 +59,96 @@ DEF_test(str) {
         EXPECT_EQ(v[2], "y||");
     }
 
+    DEF_case(strview) {
+        fastring s("GET /index.html HTTP/1.1\r\n");
+        co::strview v(s.data() + 4, 11);
+        EXPECT_EQ(v, "/index.html");
+        EXPECT(v.starts_with("/"));
+        EXPECT(v.ends_with(".html"));
+        EXPECT_EQ(v.find('.'), 6);
+        EXPECT_EQ(v.substr(1, 5), "index");
+        EXPECT_EQ(fastring(v), "/index.html");
+
+        auto x = str::split(v, '.');
+        EXPECT_EQ(x.size(), 2);
+        EXPECT_EQ(x[0], "/index");
+        EXPECT_EQ(x[1], "html");
+
+        x = str::split(co::strview(s.data(), 15), co::strview(" /x", 2));
+        EXPECT_EQ(x.size(), 2);
+        EXPECT_EQ(x[1], "index.html");
+
+        EXPECT_EQ(str::replace(v, ".html", ".htm"), "/index.htm");
+
+        fastring f;
+        f << co::strview(s.data(), 3) << ' ' << v;
+        EXPECT_EQ(f, "GET /index.html");
+    }
+
+    DEF_case(split_view) {
+        const char* cases[] = {"x||y", "|x|y|", "\nx\ny\n", "xy", "", "|", "||x||y||"};
+        for (const char* c : cases) {
+            auto v = str::split(c, '|');
+            size_t i = 0;
+            for (co::strview f : str::split_view(c, '|')) {
+                EXPECT_LT(i, v.size());
+                if (i < v.size()) EXPECT_EQ(v[i], fastring(f));
+                ++i;
+            }
+            EXPECT_EQ(i, v.size());
+
+            v = str::split(c, "||");
+            co::vector<co::strview> u;
+            EXPECT_EQ(str::split_into(c, "||", u), v.size());
+            for (size_t k = 0; k < u.size() && k < v.size(); ++k) EXPECT_EQ(v[k], fastring(u[k]));
+        }
+
+        co::vector<co::strview> u;
+        EXPECT_EQ(str::split_into("x||y", '|', u, 1), 2);
+        EXPECT_EQ(u[0], "x");
+        EXPECT_EQ(u[1], "|y");
+
+        fastring s("a,b,c");
+        EXPECT_EQ(str::split_into(s, ',', u), 3);
+        EXPECT_EQ(u[2], "c");
+        EXPECT_EQ(u[2].data(), s.data() + 4);
+
+        EXPECT_EQ(str::split_into(s, "", u), 0);
+    }
+
+    DEF_case(split_any) {
+        auto v = str::split_any("x y\tz", " \t");
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[0], "x");
+        EXPECT_EQ(v[1], "y");
+        EXPECT_EQ(v[2], "z");
+
+        v = str::split_any("x,;y", ",;");
+        EXPECT_EQ(v.size(), 3);
+        EXPECT_EQ(v[0], "x");
+        EXPECT_EQ(v[1], "");
+        EXPECT_EQ(v[2], "y");
+
+        v = str::split_any(fastring("x,;y"), ",;", 1);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0], "x");
+        EXPECT_EQ(v[1], ";y");
+
+        fastring s;
+        for (int i = 0; i < 20; ++i) s << "key" << i << (i % 3 == 0 ? '=' : i % 3 == 1 ? '&' : ';');
+        v = str::split_any(s, "=&;");
+        EXPECT_EQ(v.size(), 20);
+        EXPECT_EQ(v[0], "key0");
+        EXPECT_EQ(v[19], "key19");
+
+        v = str::split_any(s, "=&;@#");
+        EXPECT_EQ(v.size(), 20);
+        EXPECT_EQ(v[7], "key7");
+
+        v = str::split_any(s, "");
+        EXPECT_EQ(v.size(), 0);
+    }
+
     DEF_case(replace) {
         EXPECT_EQ(str::replace("$@xx$@", "$@", "#"), "#xx#");
         EXPECT_EQ(str::replace("$@xx$@", "$@", "#", 1), "#xx$@");
@@ -68,6 +159,77 @@ DEF_test(str) {
         EXPECT_EQ(str::replace(s, "o", "x", 1), "hellx world");
     }
 
+    DEF_case(matcher) {
+        str::matcher m({"he", "she", "his", "hers"});
+        EXPECT_EQ(m.size(), 4);
+        size_t pos, len, id;
+        EXPECT(m.find("ushers", pos, len, id));
+        EXPECT_EQ(pos, 1);  // "she", leftmost
+        EXPECT_EQ(len, 3);
+        EXPECT_EQ(id, 1);
+        EXPECT(!m.contains("xyz"));
+        EXPECT(!m.contains(""));
+        EXPECT_EQ(m.replace("ushers and his hers", "*"), "u*rs and * *");
+
+        co::vector<fastring> to;
+        to.push_back("1");
+        to.push_back("2");
+        to.push_back("3");
+        to.push_back("4");
+        EXPECT_EQ(m.replace("hershe his", to), "41 3");
+
+        fastring r;
+        EXPECT_EQ(m.find_all("he hers she", [&r](size_t pos, size_t len, size_t id) {
+            r << pos << ':' << len << ':' << id << ' ';
+        }), 3);
+        EXPECT_EQ(r, "0:2:0 3:4:3 8:3:1 ");
+
+        // longest at the same position, the first of equal patterns
+        str::matcher k({"ab", "abcd", "", "abc", "ab"});
+        EXPECT(k.find("xxabcde", pos, len, id));
+        EXPECT_EQ(pos, 2);
+        EXPECT_EQ(id, 1);
+        EXPECT(k.find("xxabx", pos, len, id));
+        EXPECT_EQ(id, 0);
+        EXPECT_EQ(k.replace("abcabcdab", "-"), "---");
+
+        // case-insensitive
+        str::matcher c({"Token=", "secret"}, true);
+        EXPECT_EQ(c.replace("TOKEN=1 Secret=2 token=3", "#"), "#1 #=2 #3");
+
+        // compare with a naive search, in long strings for the SIMD scan
+        co::vector<fastring> pats;
+        for (const char* x : {"a", "ab", "bab", "bca", "cc", "abcab", "x"}) pats.push_back(x);
+        str::matcher t(pats);
+        uint32_t seed = 17;
+        bool ok = true;
+        for (int i = 0; i < 200 && ok; ++i) {
+            fastring s;
+            for (int j = 0; j < 80; ++j) s.append("abcdefgh"[co::rand(seed) % (i < 100 ? 3 : 8)]);
+            fastring x;
+            for (size_t p = 0; p < s.size();) {
+                size_t best = 0, bid = 0;
+                for (size_t k = 0; k < pats.size(); ++k) {
+                    if (pats[k].size() > best && s.size() - p >= pats[k].size() &&
+                        memcmp(s.data() + p, pats[k].data(), pats[k].size()) == 0) {
+                        best = pats[k].size();
+                        bid = k;
+                    }
+                }
+                if (best) {
+                    x << '<' << bid << '>';
+                    p += best;
+                } else {
+                    x << s[p++];
+                }
+            }
+            co::vector<fastring> ids;
+            for (size_t k = 0; k < pats.size(); ++k) ids.push_back(fastring("<") << k << '>');
+            ok = t.replace(s, ids) == x;
+        }
+        EXPECT(ok);
+    }
+
     DEF_case(trim) {
         EXPECT_EQ(str::trim(" \txx\t  \n"), "xx");
         EXPECT_EQ(str::trim("$@xx@", "$@"), "xx");
@@ -148,6 +310,89 @@ DEF_test(str) {
         EXPECT_EQ(co::error(), 0);
     }
 
+    DEF_case(parse) {
+        int32_t i32 = 7;
+        int64_t i64 = 7;
+        uint32_t u32 = 7;
+        uint64_t u64 = 7;
+        double d = 7;
+
+        EXPECT(str::parse_int32("-32", 3, i32));
+        EXPECT_EQ(i32, -32);
+        EXPECT(str::parse_int32("-2147483648", 11, i32));
+        EXPECT_EQ(i32, INT32_MIN);
+        EXPECT(str::parse_uint32("4294967295", 10, u32));
+        EXPECT_EQ(u32, UINT32_MAX);
+        EXPECT(str::parse_int64("9223372036854775807", 19, i64));
+        EXPECT_EQ(i64, INT64_MAX);
+        EXPECT(str::parse_int64("-9223372036854775808", 20, i64));
+        EXPECT_EQ(i64, INT64_MIN);
+        EXPECT(str::parse_uint64("18446744073709551615", 20, u64));
+        EXPECT_EQ(u64, UINT64_MAX);
+        EXPECT(str::parse_uint64("+00012345678901234567", 21, u64));
+        EXPECT_EQ(u64, 12345678901234567ULL);
+        EXPECT(str::parse_int64(fastring("123"), i64));
+        EXPECT_EQ(i64, 123);
+
+        // no null terminator needed
+        EXPECT(str::parse_int64("1234567890xx", 10, i64));
+        EXPECT_EQ(i64, 1234567890);
+
+        // invalid or out of range, value not changed
+        u32 = 7;
+        i64 = 7;
+        u64 = 7;
+        EXPECT(!str::parse_uint32("4294967296", 10, u32));
+        EXPECT(!str::parse_int64("9223372036854775808", 19, i64));
+        EXPECT(!str::parse_int64("-9223372036854775809", 20, i64));
+        EXPECT(!str::parse_uint64("18446744073709551616", 20, u64));
+        EXPECT(!str::parse_uint64("184467440737095516150", 21, u64));
+        EXPECT(!str::parse_uint64("-1", 2, u64));
+        EXPECT(!str::parse_int64("", 0, i64));
+        EXPECT(!str::parse_int64("-", 1, i64));
+        EXPECT(!str::parse_int64(" 1", 2, i64));
+        EXPECT(!str::parse_int64("12345678x", 9, i64));
+        EXPECT(!str::parse_int64("0x10", 4, i64));
+        EXPECT(!str::parse_int64("8k", 2, i64));
+        EXPECT_EQ(u32, 7);
+        EXPECT_EQ(i64, 7);
+        EXPECT_EQ(u64, 7);
+
+        EXPECT(str::parse_double("3.14159", 7, d));
+        EXPECT_EQ(d, 3.14159);
+        EXPECT(str::parse_double("-0.5e-3", 7, d));
+        EXPECT_EQ(d, -0.5e-3);
+        EXPECT(str::parse_double(".5", 2, d));
+        EXPECT_EQ(d, 0.5);
+        EXPECT(str::parse_double("1.", 2, d));
+        EXPECT_EQ(d, 1.0);
+        EXPECT(str::parse_double("0", 1, d));
+        EXPECT_EQ(d, 0.0);
+        EXPECT(str::parse_double("1E22", 4, d));
+        EXPECT_EQ(d, 1e22);
+
+        // slow path
+        EXPECT(str::parse_double("1e300", 5, d));
+        EXPECT_EQ(d, 1e300);
+        EXPECT(str::parse_double("2.2250738585072014e-308", 23, d));
+        EXPECT_EQ(d, 2.2250738585072014e-308);
+        EXPECT(str::parse_double("12345678901234567890123", 23, d));
+        EXPECT_EQ(d, 12345678901234567890123.0);
+        EXPECT(str::parse_double("9007199254740993", 16, d));
+        EXPECT_EQ(d, 9007199254740992.0);
+
+        d = 7;
+        EXPECT(!str::parse_double("", 0, d));
+        EXPECT(!str::parse_double(".", 1, d));
+        EXPECT(!str::parse_double("1e", 2, d));
+        EXPECT(!str::parse_double("1e+", 3, d));
+        EXPECT(!str::parse_double("3.14d", 5, d));
+        EXPECT(!str::parse_double("inf", 3, d));
+        EXPECT(!str::parse_double("0x1p3", 5, d));
+        EXPECT(!str::parse_double("1e400", 5, d));
+        EXPECT_EQ(d, 7.0);
+    }
+
     DEF_case(from) {
         EXPECT_EQ(str::from(3.14), "3.14");
         EXPECT_EQ(str::from(false), "false");
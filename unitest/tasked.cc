@@ -0,0 +1,51 @@
+#include "co/tasked.h"
+
+#include <atomic>
+
+#include "co/co.h"
+#include "co/time.h"
+#include "co/unitest.h"
+
+namespace test {
+
+DEF_test(tasked) {
+    DEF_case(ms) {
+        std::atomic_int n{0}, m{0};
+        co::Tasked s;
+        const int64_t t = now::ms();
+        int64_t x = 0;
+        s.run_in_ms([&]() { x = now::ms(); ++n; }, 20);
+        s.run_every_ms([&]() { ++m; }, 10);
+        sleep::ms(105);
+        s.stop();
+        EXPECT_EQ(n.load(), 1);
+        EXPECT_GE(x - t, 20);
+        EXPECT_GE(m.load(), 5);
+        EXPECT_LE(m.load(), 11);
+    }
+
+    DEF_case(slow) {
+        std::atomic_int n{0}, m{0};
+        co::Tasked s;
+        s.run_every_ms([&]() { ++n; sleep::ms(60); }, 10);
+        s.run_every_ms([&]() { ++m; }, 10);
+        sleep::ms(105);
+        s.stop();
+        EXPECT_LE(n.load(), 2);
+        EXPECT_LE(m.load(), 3);  // delayed by the slow task
+    }
+
+    DEF_case(in_co) {
+        std::atomic_int n{0}, m{0};
+        co::Tasked s(true);
+        s.run_every_ms([&]() { ++n; co::sleep(60); }, 10);
+        s.run_every_ms([&]() { ++m; }, 10);
+        sleep::ms(105);
+        s.stop();
+        EXPECT_LE(n.load(), 2);  // skipped while the last run is going on
+        EXPECT_GE(m.load(), 5);
+        sleep::ms(80);
+    }
+}
+
+}  // namespace test
@@ -1,7 +1,11 @@
 #include "co/co/thread.h"
 
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
+#include "co/time.h"
 #include "co/unitest.h"
 
 namespace test {
@@ -22,6 +26,44 @@ DEF_test(thread) {
         EXPECT_EQ(em.wait(1), false);
     }
 
+    DEF_case(sync_event_threads) {
+        co::sync_event ev;
+        std::atomic_int n(0);
+        std::vector<std::thread> v;
+        for (int i = 0; i < 4; ++i) {
+            v.emplace_back([&]() {
+                ev.wait();
+                n.fetch_add(1);
+            });
+        }
+        while (n.load() < 4) {
+            ev.signal();
+            sleep::ms(1);
+        }
+        for (auto& t : v) t.join();
+        EXPECT_EQ(n.load(), 4);
+
+        // ping-pong between two threads
+        co::sync_event a, b;
+        std::thread t([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                a.wait();
+                b.signal();
+            }
+        });
+        int k = 0;
+        for (; k < 1000; ++k) {
+            a.signal();
+            if (!b.wait(3000)) break;
+        }
+        t.join();
+        EXPECT_EQ(k, 1000);
+
+        co::Timer timer;
+        EXPECT_EQ(ev.wait(10), false);
+        EXPECT_GE(timer.ms(), 9);
+    }
+
     DEF_case(gettid) { EXPECT_NE(co::thread_id(), -1); }
 
     DEF_case(tls) {
@@ -1,9 +1,15 @@
 #include "co/time.h"
 
+#include <time.h>
+
 #include "co/def.h"
+#include "co/flag.h"
+#include "co/rand.h"
 #include "co/str.h"
 #include "co/unitest.h"
 
+DEC_bool(time_tsc);
+
 namespace test {
 
 DEF_test(time) {
@@ -18,12 +24,67 @@ DEF_test(time) {
         EXPECT_LE(x, y);
     }
 
+    DEF_case(coarse) {
+        int64_t x = now::ms_coarse();
+        int64_t y = now::ms();
+        EXPECT_LE(x, y);
+        EXPECT_LT(y - x, 20);
+
+        x = epoch::ms_coarse();
+        y = epoch::ms();
+        EXPECT_LE(x, y);
+        EXPECT_LT(y - x, 20);
+    }
+
+    DEF_case(tsc) {
+        FLG_time_tsc = true;
+        int64_t x = now::ns();
+        int64_t y = now::ns();
+        FLG_time_tsc = false;
+        int64_t z = now::ns();
+        EXPECT_LE(x, y);
+        EXPECT_LT(z - y, 1000000);  // close to the system clock
+        EXPECT_GT(z - y, -1000000);
+    }
+
     DEF_case(str) {
         fastring ymdhms = now::str("%Y%m%d%H%M%S");
         fastring ymd = now::str("%Y%m%d");
         EXPECT(ymdhms.starts_with(ymd));
     }
 
+    DEF_case(timestr) {
+        EXPECT_EQ(fastring(co::timestr::iso8601(0)), "1970-01-01T00:00:00.000Z");
+        EXPECT_EQ(fastring(co::timestr::iso8601(-1)), "1969-12-31T23:59:59.999Z");
+        EXPECT_EQ(fastring(co::timestr::http_date(784111777000)), "Sun, 06 Nov 1994 08:49:37 GMT");
+        EXPECT_EQ(fastring(co::timestr::iso8601(1709164799123)), "2024-02-28T23:59:59.123Z");
+        EXPECT_EQ(fastring(co::timestr::iso8601(1709164800004)), "2024-02-29T00:00:00.004Z");
+        EXPECT_EQ(fastring(co::timestr::iso8601(1709164800567)), "2024-02-29T00:00:00.567Z");
+        EXPECT_EQ(fastring(co::timestr::iso8601(1709164861000)), "2024-02-29T00:01:01.000Z");
+
+#ifndef _WIN32
+        // compare with strftime(), times are in random order, then in sequence
+        bool ok = true;
+        int64_t ms = epoch::ms();
+        uint32_t seed = 7;
+        for (int i = 0; i < 2000 && ok; ++i) {
+            ms = i < 1000 ? (int64_t)(co::rand(seed)) * 997 : ms + 773;
+            const time_t sec = (time_t)(ms / 1000);
+            struct tm t;
+            char b[64];
+            gmtime_r(&sec, &t);
+            strftime(b, sizeof(b), "%Y-%m-%dT%H:%M:%S", &t);
+            ok = ok && fastring(co::timestr::iso8601(ms)).starts_with(b);
+            strftime(b, sizeof(b), "%a, %d %b %Y %H:%M:%S GMT", &t);
+            ok = ok && fastring(co::timestr::http_date(ms)) == b;
+            localtime_r(&sec, &t);
+            strftime(b, sizeof(b), "%m%d %H:%M:%S.", &t);
+            ok = ok && fastring(co::timestr::logtime(ms), 17).starts_with(b);
+        }
+        EXPECT(ok);
+#endif
+    }
+
     DEF_case(sleep) {
         int64_t beg = now::ms();
         sleep::ms(1);
@@ -50,12 +50,30 @@ option("with_libcurl")
     set_description("build with libcurl, required by http::Client")
 option_end()
 
+option("with_zlib")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with zlib, for compression of rotated log files")
+option_end()
+
 option("with_backtrace")
     set_default(false)
     set_showmenu(true)
     set_description("build with libbacktrace, for stack trace on linux/mac")
 option_end()
 
+option("with_usdt")
+    set_default(false)
+    set_showmenu(true)
+    set_description("build with USDT probes, sys/sdt.h required")
+option_end()
+
+option("with_sys_malloc")
+    set_default(false)
+    set_showmenu(true)
+    set_description("use malloc for memory of co, e.g. jemalloc or mimalloc linked in")
+option_end()
+
 -- build with -fPIC
 option("fpic")
     set_default(false)
@@ -70,12 +88,24 @@ option("disable_hook")
     set_description("disable system API hook")
 option_end()
 
+option("ctx_save_fpu")
+    set_default(false)
+    set_showmenu(true)
+    set_description("save the MXCSR and x87 control words on context switches, x64 only")
+option_end()
+
 option("cache_line_size")
     set_default("64")
     set_showmenu(true)
     set_description("set value of L1 cache line size")
 option_end()
 
+option("log_min_level")
+    set_default("0")
+    set_showmenu(true)
+    set_description("logs below this level (0-5) are removed at compile time")
+option_end()
+
 if has_config("with_libcurl") then
     add_requires("openssl >=1.1.0")
     add_requires("libcurl", {configs = {openssl = true, zlib = true}})
@@ -87,6 +117,10 @@ if has_config("with_backtrace") then
     add_requires("libbacktrace")
 end
 
+if has_config("with_zlib") then
+    add_requires("zlib")
+end
+
 
 -- include dir
 add_includedirs("include")
@@ -110,4 +144,4 @@ function redefine_file_macro(target, sourcefile, opt)
 end
 
 -- include sub-projects
-includes("src", "gen", "test", "unitest")
+includes("src", "gen", "blog", "test", "unitest")